@@ -274,6 +274,9 @@ static struct socket_id* mk_listen_id(char*, int, int);
 %token DNS_CACHE_MAX_TTL
 %token DNS_CACHE_MEM
 %token DNS_CACHE_GC_INT
+%token DNS_CACHE_ASYNC
+%token DNS_CACHE_PREFETCH
+%token DNS_CACHE_PREFETCH_HITS
 /*blacklist*/
 %token USE_DST_BLST
 %token DST_BLST_MEM
@@ -306,6 +309,7 @@ static struct socket_id* mk_listen_id(char*, int, int);
 %token TCP_CON_LIFETIME
 %token TCP_POLL_METHOD
 %token TCP_MAX_CONNECTIONS
+%token TCP_MAX_WRITE_QUEUE
 %token DISABLE_TLS
 %token ENABLE_TLS
 %token TLSLOG
@@ -329,6 +333,9 @@ static struct socket_id* mk_listen_id(char*, int, int);
 %token MCAST_LOOPBACK
 %token MCAST_TTL
 %token TOS
+%token UDP_RCV_BATCH
+%token UDP_REUSEPORT
+%token UDP_CPU_AFFINITY
 %token KILL_TIMEOUT
 
 %token FLAGS_DECL
@@ -580,6 +587,13 @@ assign_stm:
 	| DNS_CACHE_MEM error { yyerror("boolean value expected"); }
 	| DNS_CACHE_GC_INT EQUAL NUMBER   { IF_DNS_CACHE(dns_timer_interval=$3); }
 	| DNS_CACHE_GC_INT error { yyerror("boolean value expected"); }
+	| DNS_CACHE_ASYNC EQUAL NUMBER   { IF_DNS_CACHE(dns_async=$3); }
+	| DNS_CACHE_ASYNC error { yyerror("boolean value expected"); }
+	| DNS_CACHE_PREFETCH EQUAL NUMBER   { IF_DNS_CACHE(dns_prefetch_time=$3); }
+	| DNS_CACHE_PREFETCH error { yyerror("number expected"); }
+	| DNS_CACHE_PREFETCH_HITS EQUAL NUMBER
+									{ IF_DNS_CACHE(dns_prefetch_hits=$3); }
+	| DNS_CACHE_PREFETCH_HITS error { yyerror("number expected"); }
 	| USE_DST_BLST EQUAL NUMBER   { IF_DST_BLACKLIST(use_dst_blacklist=$3); }
 	| USE_DST_BLST error { yyerror("boolean value expected"); }
 	| DST_BLST_MEM EQUAL NUMBER   { IF_DST_BLACKLIST(blst_max_mem=$3); }
@@ -663,6 +677,14 @@ assign_stm:
 		#endif
 	}
 	| TCP_SEND_TIMEOUT EQUAL error { yyerror("number expected"); }
+	| TCP_MAX_WRITE_QUEUE EQUAL NUMBER {
+		#ifdef USE_TCP
+			tcp_wbuf_max=$3;
+		#else
+			warn("tcp support not compiled in");
+		#endif
+	}
+	| TCP_MAX_WRITE_QUEUE EQUAL error { yyerror("number expected"); }
 	| TCP_CON_LIFETIME EQUAL NUMBER {
 		#ifdef USE_TCP
 			tcp_con_lifetime=$3;
@@ -887,6 +909,28 @@ assign_stm:
 	| MCAST_TTL EQUAL error { yyerror("number expected"); }
 	| TOS EQUAL NUMBER { tos=$3; }
 	| TOS EQUAL error { yyerror("number expected"); }
+	| UDP_RCV_BATCH EQUAL NUMBER {
+		if ($3<1 || $3>UDP_RCV_BATCH_MAX)
+			yyerror("udp_rcv_batch out of range");
+		else udp_rcv_batch=$3;
+	}
+	| UDP_RCV_BATCH EQUAL error { yyerror("number expected"); }
+	| UDP_REUSEPORT EQUAL NUMBER {
+		#ifdef SO_REUSEPORT
+			udp_reuseport=$3;
+		#else
+			warn("udp_reuseport: SO_REUSEPORT not supported on this system");
+		#endif
+	}
+	| UDP_REUSEPORT EQUAL error { yyerror("boolean value expected"); }
+	| UDP_CPU_AFFINITY EQUAL NUMBER {
+		#ifdef __linux__
+			udp_cpu_affinity=$3;
+		#else
+			warn("udp_cpu_affinity: not supported on this system");
+		#endif
+	}
+	| UDP_CPU_AFFINITY EQUAL error { yyerror("boolean value expected"); }
 	| KILL_TIMEOUT EQUAL NUMBER { ser_kill_timeout=$3; }
 	| KILL_TIMEOUT EQUAL error { yyerror("number expected"); }
 	| STUN_REFRESH_INTERVAL EQUAL NUMBER { IF_STUN(stun_refresh_interval=$3); }
@@ -159,6 +159,12 @@
 /* maximum number of branches per transaction */
 #define MAX_BRANCHES    12
 
+/* maximum number of datagrams received with one recvmmsg() (udp_rcv_batch);
+ * each one needs a BUF_SIZE receive buffer in pkg mem */
+#define UDP_RCV_BATCH_MAX	16
+/* maximum number of datagrams sent with one sendmmsg() */
+#define UDP_SND_BATCH_MAX	MAX_BRANCHES
+
 /* max length of the text of fifo 'print' command */
 #define MAX_PRINT_TEXT 256
 
@@ -330,6 +330,35 @@ static void core_tcpinfo(rpc_t* rpc, void* c)
 #endif
 }
 
+static const char* core_udp_batch_doc[] = {
+	"Returns udp batching counters (syscalls and datagrams, summed over all"
+	" processes).",  /* Documentation string */
+	0                /* Method signature(s) */
+};
+
+static void core_udp_batch(rpc_t* rpc, void* c)
+{
+	void *handle;
+	unsigned int rcv_calls, rcv_msgs, snd_calls, snd_msgs;
+	int p;
+
+	rcv_calls=rcv_msgs=snd_calls=snd_msgs=0;
+	for (p=0; p<*process_count; p++) {
+		rcv_calls+=pt[p].udp_rcv_calls;
+		rcv_msgs+=pt[p].udp_rcv_msgs;
+		snd_calls+=pt[p].udp_snd_calls;
+		snd_msgs+=pt[p].udp_snd_msgs;
+	}
+	rpc->add(c, "{", &handle);
+	rpc->struct_add(handle, "ddddd",
+		"rcv_batch", udp_rcv_batch,
+		"rcv_calls", rcv_calls,
+		"rcv_msgs", rcv_msgs,
+		"snd_calls", snd_calls,
+		"snd_msgs", snd_msgs
+	);
+}
+
 /*
  * RPC Methods exported by this module
  */
@@ -346,6 +375,7 @@ rpc_export_t core_rpc_methods[] = {
 	{"core.kill",              core_kill,              core_kill_doc,              0        },
 	{"core.shmmem",            core_shmmem,            core_shmmem_doc,            0	},
 	{"core.tcp_info",          core_tcpinfo,           core_tcpinfo_doc,          0	},
+	{"core.udp_batch",         core_udp_batch,         core_udp_batch_doc,        0	},
 #ifdef USE_DNS_CACHE
 	{"dns.mem_info",          dns_cache_mem_info,     dns_cache_mem_info_doc,     0	},
 	{"dns.debug",          dns_cache_debug,           dns_cache_debug_doc,        0	},
@@ -70,8 +70,15 @@
 #define MAX_CNAME_CHAIN  10 
 
 
-static gen_lock_t* dns_hash_lock=0;
-static volatile unsigned int *dns_cache_mem_used=0; /* current mem. use */
+#define DNS_HASH_LOCKS	128 /* lock stripes, power of 2, <= DNS_HASH_SIZE */
+
+
+/* the hash buckets are protected by a set of locks, bucket h uses the lock
+ * h&(DNS_HASH_LOCKS-1); each bucket is kept in last used order (least
+ * recently used entry first) */
+static gen_lock_set_t* dns_hash_locks=0;
+/* current mem. use, one counter per lock, written only with its lock held */
+static volatile unsigned int *dns_cache_mem_used=0;
 unsigned int dns_cache_max_mem=DEFAULT_DNS_MAX_MEM; /* maximum memory used for
 													 the cached entries */
 unsigned int dns_neg_cache_ttl=DEFAULT_DNS_NEG_CACHE_TTL; /* neg. cache ttl */
@@ -81,8 +88,10 @@ unsigned int dns_timer_interval=DEFAULT_DNS_TIMER_INTERVAL; /* in s */
 int dns_flags=0; /* default flags used for the  dns_*resolvehost 
                     (compatibility wrappers) */
 
-#define LOCK_DNS_HASH()		lock_get(dns_hash_lock)
-#define UNLOCK_DNS_HASH()	lock_release(dns_hash_lock)
+#define dns_lock_no(h)		((h)&(DNS_HASH_LOCKS-1))
+#define LOCK_DNS_BUCKET(h)		lock_set_get(dns_hash_locks, dns_lock_no(h))
+#define UNLOCK_DNS_BUCKET(h)	lock_set_release(dns_hash_locks, dns_lock_no(h))
+#define DNS_MEM_USED(h)		dns_cache_mem_used[dns_lock_no(h)]
 
 #define FIX_TTL(t)  (((t)<dns_cache_min_ttl)?dns_cache_min_ttl: \
 						(((t)>dns_cache_max_ttl)?dns_cache_max_ttl:(t)))
@@ -93,10 +102,6 @@ struct dns_hash_head{
 	struct dns_hash_entry* prev;
 };
 
-#ifdef DNS_LU_LST
-struct dns_lu_lst* dns_last_used_lst=0;
-#endif
-
 static struct dns_hash_head* dns_hash=0;
 
 
@@ -133,6 +138,22 @@ const char* dns_strerror(int err)
 
 
 
+/* returns the total memory used by the cache
+ * the per lock counters are read without locking, so the result
+ * is only an approximation */
+inline static unsigned int dns_cache_mem_total()
+{
+	int i;
+	unsigned int total;
+	
+	total=0;
+	for (i=0; i<DNS_HASH_LOCKS; i++)
+		total+=dns_cache_mem_used[i];
+	return total;
+}
+
+
+
 /* "internal" only, don't use unless you really know waht you're doing */
 inline static void dns_destroy_entry(struct dns_hash_entry* e)
 {
@@ -181,7 +202,7 @@ inline static int dns_cache_free_mem(unsigned int target, int expired_only);
 
 static ticks_t dns_timer(ticks_t ticks, struct timer_ln* tl, void* data)
 {
-	if (*dns_cache_mem_used>12*(dns_cache_max_mem/16)){ /* ~ 75% used */
+	if (dns_cache_mem_total()>12*(dns_cache_max_mem/16)){ /* ~ 75% used */
 		dns_cache_free_mem(dns_cache_max_mem/2, 1); 
 	}else{
 		dns_cache_clean(-1, 1); /* all the table, only expired entries */
@@ -199,21 +220,15 @@ void destroy_dns_cache()
 		timer_free(dns_timer_h);
 		dns_timer_h=0;
 	}
-	if (dns_hash_lock){
-		lock_destroy(dns_hash_lock);
-		lock_dealloc(dns_hash_lock);
-		dns_hash_lock=0;
+	if (dns_hash_locks){
+		lock_set_destroy(dns_hash_locks);
+		lock_set_dealloc(dns_hash_locks);
+		dns_hash_locks=0;
 	}
 	if (dns_hash){
 		shm_free(dns_hash);
 		dns_hash=0;
 	}
-#ifdef DNS_LU_LST
-	if (dns_last_used_lst){
-		shm_free(dns_last_used_lst);
-		dns_last_used_lst=0;
-	}
-#endif
 	if (dns_cache_mem_used){
 		shm_free((void*)dns_cache_mem_used);
 		dns_cache_mem_used=0;
@@ -234,19 +249,14 @@ int init_dns_cache()
 		ret=E_BUG;
 		goto error;
 	}
-	dns_cache_mem_used=shm_malloc(sizeof(*dns_cache_mem_used));
+	dns_cache_mem_used=shm_malloc(sizeof(*dns_cache_mem_used)*
+											DNS_HASH_LOCKS);
 	if (dns_cache_mem_used==0){
 		ret=E_OUT_OF_MEM;
 		goto error;
 	}
-#ifdef DNS_LU_LST
-	dns_last_used_lst=shm_malloc(sizeof(*dns_last_used_lst));
-	if (dns_last_used_lst==0){
-		ret=E_OUT_OF_MEM;
-		goto error;
-	}
-	clist_init(dns_last_used_lst, next, prev);
-#endif
+	for (r=0; r<DNS_HASH_LOCKS; r++)
+		dns_cache_mem_used[r]=0;
 	dns_hash=shm_malloc(sizeof(struct dns_hash_head)*DNS_HASH_SIZE);
 	if (dns_hash==0){
 		ret=E_OUT_OF_MEM;
@@ -255,14 +265,14 @@ int init_dns_cache()
 	for (r=0; r<DNS_HASH_SIZE; r++)
 		clist_init(&dns_hash[r], next, prev);
 	
-	dns_hash_lock=lock_alloc();
-	if (dns_hash_lock==0){
+	dns_hash_locks=lock_set_alloc(DNS_HASH_LOCKS);
+	if (dns_hash_locks==0){
 		ret=E_OUT_OF_MEM;
 		goto error;
 	}
-	if (lock_init(dns_hash_lock)==0){
-		lock_dealloc(dns_hash_lock);
-		dns_hash_lock=0;
+	if (lock_set_init(dns_hash_locks)==0){
+		lock_set_dealloc(dns_hash_locks);
+		dns_hash_locks=0;
 		ret=-1;
 		goto error;
 	}
@@ -308,288 +318,162 @@ error:
 
 
 
-#ifdef DNS_CACHE_DEBUG
-#define DEBUG_LU_LST
-#ifdef DEBUG_LU_LST
-
-#include <stdlib.h> /* abort() */
-#define check_lu_lst(l) ((((l)->next==(l)) || ((l)->prev==(l))) && \
-							((l)!=dns_last_used_lst))
-
-#define dbg_lu_lst(txt, l) \
-		LOG(L_CRIT, "BUG: %s: crt(%p, %p, %p)," \
-					" prev(%p, %p, %p), next(%p, %p, %p)\n", txt, \
-					(l), (l)->next, (l)->prev, \
-					(l)->prev, (l)->prev->next, (l)->prev->prev, \
-					(l)->next, (l)->next->next, (l)->next->prev \
-				) 
-
-#define debug_lu_lst( txt, l) \
-	do{ \
-		if (check_lu_lst((l))){  \
-			dbg_lu_lst(txt  " crt:", (l)); \
-			abort(); \
-		} \
-		if (check_lu_lst((l)->next)){ \
-			dbg_lu_lst(txt  " next:",  (l)); \
-			abort(); \
-		} \
-		if (check_lu_lst((l)->prev)){ \
-			dbg_lu_lst(txt  " prev:", (l)); \
-			abort(); \
-		} \
-	}while(0)
-
-#endif
-#endif /* DNS_CACHE_DEBUG */
-
-
-/* must be called with the DNS_LOCK hold
+/* must be called with the lock of bucket h held
  * remove and entry from the hash, dec. its refcnt and if not referenced
  * anymore deletes it */
-void _dns_hash_remove(struct dns_hash_entry* e)
+void _dns_hash_remove(struct dns_hash_entry* e, int h)
 {
 	clist_rm(e, next, prev);
 #ifdef DNS_CACHE_DEBUG
 	e->next=e->prev=0;
 #endif
-#ifdef DNS_LU_LST
-#ifdef DEBUG_LU_LST
-	debug_lu_lst("_dns_hash_remove: pre rm:", &e->last_used_lst);
-#endif
-	clist_rm(&e->last_used_lst, next, prev);
-#ifdef DEBUG_LU_LST
-	debug_lu_lst("_dns_hash_remove: post rm:", &e->last_used_lst);
-#endif
-#ifdef DNS_CACHE_DEBUG
-	e->last_used_lst.next=e->last_used_lst.prev=0;
-#endif
-#endif
-	*dns_cache_mem_used-=e->total_size;
+	DNS_MEM_USED(h)-=e->total_size;
 	dns_hash_put(e);
 }
 
 
 
-/* non locking  version (the dns hash must _be_ locked externally)
- * returns 0 when not found, or the entry on success (an entry with a
- * similar name but with a CNAME type will always match).
+/* non locking  version (the lock of bucket h must _be_ held externally)
+ * looks only in bucket h, returns 0 when not found, or the entry on success
+ * (an entry with a similar name but with a CNAME type will always match).
+ * The found entry is moved at the end of the bucket (most recently used).
  * it doesn't increase the internal refcnt
- * returns the entry when found, 0 when not found and sets *err to !=0
- *  on error (e.g. recursive cnames)
  * WARNING: - internal use only
  *          - always check if the returned entry type is CNAME */
 inline static struct dns_hash_entry* _dns_hash_find(str* name, int type,
-														int* h, int* err)
+														int h, ticks_t now)
 {
 	struct dns_hash_entry* e;
 	struct dns_hash_entry* tmp;
-	struct dns_hash_entry* ret;
-	ticks_t now;
-	int cname_chain;
-	str cname;
 	
-	cname_chain=0;
-	ret=0;
-	now=get_ticks_raw();
-	*err=0;
-again:
-	*h=dns_hash_no(name->s, name->len, type);
-	DBG("dns_hash_find(%.*s(%d), %d), h=%d\n", name->len, name->s,
-												name->len, type, *h);
-	clist_foreach_safe(&dns_hash[*h], e, tmp, next){
+	clist_foreach_safe(&dns_hash[h], e, tmp, next){
 		/* automatically remove expired elements */
 		if ((s_ticks_t)(now-e->expire)>=0){
-				_dns_hash_remove(e);
-		}else if ((e->type==type) && (e->name_len==name->len) &&
-			(strncasecmp(e->name, name->s, e->name_len)==0)){
+				_dns_hash_remove(e, h);
+		}else if (((e->type==type) || (e->type==T_CNAME)) &&
+					(e->name_len==name->len) &&
+					(strncasecmp(e->name, name->s, e->name_len)==0)){
 			e->last_used=now;
-#ifdef DNS_LU_LST
-			/* add it at the end */
-#ifdef DEBUG_LU_LST
-			debug_lu_lst("_dns_hash_find: pre rm:", &e->last_used_lst);
-#endif
-			clist_rm(&e->last_used_lst, next, prev);
-			clist_append(dns_last_used_lst, &e->last_used_lst, next, prev);
-#ifdef DEBUG_LU_LST
-			debug_lu_lst("_dns_hash_find: post append:", &e->last_used_lst);
-#endif
-#endif
+			e->hits++;
+			/* move it at the end */
+			clist_rm(e, next, prev);
+			clist_append(&dns_hash[h], e, next, prev);
 			return e;
-		}else if ((e->type==T_CNAME) && (e->name_len==name->len) &&
-			(strncasecmp(e->name, name->s, e->name_len)==0)){
-			e->last_used=now;
-#ifdef DNS_LU_LST
-			/* add it at the end */
-#ifdef DEBUG_LU_LST
-			debug_lu_lst("_dns_hash_find: cname: pre rm:", &e->last_used_lst);
-#endif
-			clist_rm(&e->last_used_lst, next, prev);
-			clist_append(dns_last_used_lst, &e->last_used_lst, next, prev);
-#ifdef DEBUG_LU_LST
-			debug_lu_lst("_dns_hash_find: cname: post append:",
-							&e->last_used_lst);
-#endif
-#endif		
-			ret=e; /* if this is an unfinished cname chain, we try to
-					  return the last cname */
-			/* this is a cname => retry using its value */
-			if (cname_chain> MAX_CNAME_CHAIN){
-				LOG(L_ERR, "ERROR: _dns_hash_find: cname chain too long "
-						"or recursive (\"%.*s\")\n", name->len, name->s);
-				ret=0; /* error*/
-				*err=-1;
-				break;
-			}
-			cname_chain++;
-			cname.s=((struct cname_rdata*)e->rr_lst->rdata)->name;
-			cname.len= ((struct cname_rdata*)e->rr_lst->rdata)->name_len;
-			name=&cname;
-			goto again;
 		}
 	}
-	return ret;
+	return 0;
 }
 
 
 
-/* frees cache entries, if expired_only=0 only expired entries will be 
+/* frees cache entries, if expired_only!=0 only expired entries will be 
  * removed, else all of them
  * it will process maximum no entries (to process all of them use -1)
+ * only one bucket is locked at a time and the next call continues
+ * with the bucket following the last processed one
  * returns the number of deleted entries
  * This should be called from a timer process*/
 inline static int dns_cache_clean(unsigned int no, int expired_only)
 {
 	struct dns_hash_entry* e;
+	struct dns_hash_entry* t;
 	ticks_t now;
 	unsigned int n;
 	unsigned int deleted;
-#ifdef DNS_LU_LST
-	struct dns_lu_lst* l;
-	struct dns_lu_lst* tmp;
-#else
-	struct dns_hash_entry* t;
 	unsigned int h;
+	unsigned int i;
 	static unsigned int start=0;
-#endif
 	
 	n=0;
 	deleted=0;
 	now=get_ticks_raw();
-	LOCK_DNS_HASH();
-#ifdef DNS_LU_LST
-	clist_foreach_safe(dns_last_used_lst, l, tmp, next){
-		e=(struct dns_hash_entry*)(((char*)l)-
-				(char*)&((struct dns_hash_entry*)(0))->last_used_lst);
-		if (!expired_only || ((s_ticks_t)(now-e->expire)>=0)){
-				_dns_hash_remove(e);
-				deleted++;
-		}
-		n++;
-		if (n>=no) break;
-	}
-#else
-	for(h=start; h!=(start+DNS_HASH_SIZE); h++){
-		clist_foreach_safe(&dns_hash[h%DNS_HASH_SIZE], e, t, next){
-			if  ((s_ticks_t)(now-e->expire)>=0){
-				_dns_hash_remove(e);
-				deleted++;
-			}
-			n++;
-			if (n>=no) break;
-		}
-	}
-	/* not fair, but faster then random() */
-	if (!expired_only){
-		for(h=start; h!=(start+DNS_HASH_SIZE); h++){
-			clist_foreach_safe(&dns_hash[h%DNS_HASH_SIZE], e, t, next){
-				if  ((s_ticks_t)(now-e->expire)>=0){
-					_dns_hash_remove(e);
+	for (i=0; (i<DNS_HASH_SIZE) && (n<no); i++){
+		h=(start+i)%DNS_HASH_SIZE;
+		LOCK_DNS_BUCKET(h);
+			clist_foreach_safe(&dns_hash[h], e, t, next){
+				if (!expired_only || ((s_ticks_t)(now-e->expire)>=0)){
+					_dns_hash_remove(e, h);
 					deleted++;
 				}
 				n++;
-				if (n>=no) goto skip;
+				if (n>=no) break;
 			}
-		}
+		UNLOCK_DNS_BUCKET(h);
 	}
-skip:
-	start=h;
-#endif
-	UNLOCK_DNS_HASH();
+	start=(start+i)%DNS_HASH_SIZE; /* next time we start where we left */
 	return deleted;
 }
 
 
 
-/* frees cache entries, if expired_only=0 only expired entries will be 
- * removed, else all of them
+/* frees cache entries, if expired_only!=0 only expired entries will be 
+ * removed, else the expired ones first and then the least recently used
+ * entry of each bucket, round robin
  * it will stop when the dns cache used memory reaches target (to process all 
  * of them use 0)
+ * only one bucket is locked at a time
  * returns the number of deleted entries */
 inline static int dns_cache_free_mem(unsigned int target, int expired_only)
 {
 	struct dns_hash_entry* e;
+	struct dns_hash_entry* t;
 	ticks_t now;
 	unsigned int deleted;
-#ifdef DNS_LU_LST
-	struct dns_lu_lst* l;
-	struct dns_lu_lst* tmp;
-#else
-	struct dns_hash_entry* t;
+	unsigned int removed;
+	unsigned int used;
 	unsigned int h;
+	unsigned int i;
 	static unsigned int start=0;
-#endif
 	
 	deleted=0;
 	now=get_ticks_raw();
-	LOCK_DNS_HASH();
-#ifdef DNS_LU_LST
-	clist_foreach_safe(dns_last_used_lst, l, tmp, next){
-		if (*dns_cache_mem_used<=target) break;
-		e=(struct dns_hash_entry*)(((char*)l)-
-				(char*)&((struct dns_hash_entry*)(0))->last_used_lst);
-		if (!expired_only || ((s_ticks_t)(now-e->expire)>=0)){
-				_dns_hash_remove(e);
-				deleted++;
-		}
-	}
-#else
-	for(h=start; h!=(start+DNS_HASH_SIZE); h++){
-		clist_foreach_safe(&dns_hash[h%DNS_HASH_SIZE], e, t, next){
-			if (*dns_cache_mem_used<=target) 
-				goto skip;
-			if  ((s_ticks_t)(now-e->expire)>=0){
-				_dns_hash_remove(e);
-				deleted++;
+	/* local estimation, updated with what we remove */
+	used=dns_cache_mem_total();
+	for (i=0; (i<DNS_HASH_SIZE) && (used>target); i++){
+		h=(start+i)%DNS_HASH_SIZE;
+		LOCK_DNS_BUCKET(h);
+			clist_foreach_safe(&dns_hash[h], e, t, next){
+				if ((s_ticks_t)(now-e->expire)>=0){
+					used=(used>e->total_size)?used-e->total_size:0;
+					_dns_hash_remove(e, h);
+					deleted++;
+					if (used<=target) break;
+				}
 			}
-		}
+		UNLOCK_DNS_BUCKET(h);
 	}
-	/* not fair, but faster then random() */
+	start=(start+i)%DNS_HASH_SIZE;
 	if (!expired_only){
-		for(h=start; h!=(start+DNS_HASH_SIZE); h++){
-			clist_foreach_safe(&dns_hash[h%DNS_HASH_SIZE], e, t, next){
-				if (*dns_cache_mem_used<=target) 
-					goto skip;
-				if  ((s_ticks_t)(now-e->expire)>=0){
-					_dns_hash_remove(e);
-					deleted++;
-				}
+		/* not enough, remove the head of each bucket (least recently used)
+		 *  until the target is reached or the hash is empty */
+		do{
+			removed=0;
+			for (i=0; (i<DNS_HASH_SIZE) && (used>target); i++){
+				h=(start+i)%DNS_HASH_SIZE;
+				LOCK_DNS_BUCKET(h);
+					e=dns_hash[h].next;
+					if (e!=(void*)&dns_hash[h]){
+						used=(used>e->total_size)?used-e->total_size:0;
+						_dns_hash_remove(e, h);
+						removed++;
+					}
+				UNLOCK_DNS_BUCKET(h);
 			}
-		}
+			start=(start+i)%DNS_HASH_SIZE;
+			deleted+=removed;
+		}while(removed && (used>target));
 	}
-skip:
-	start=h;
-#endif
-	UNLOCK_DNS_HASH();
 	return deleted;
 }
 
 
 
-/* locking  version (the dns hash must _not_be locked externally)
+/* locking  version (no bucket lock must be held)
  * returns 0 when not found, the searched entry on success (with CNAMEs
  *  followed) or the last CNAME entry from an unfinished CNAME chain, 
  *  if the search matches a CNAME. On error sets *err (e.g. recursive CNAMEs).
+ * Only one bucket is locked at a time, while following a CNAME chain a
+ *  reference to the current CNAME entry is kept (its value is the next name)
  * it increases the internal refcnt => when finished dns_hash_put() must
  *  be called on the returned entry
  *  WARNING: - the return might be a CNAME even if type!=CNAME, see above */
@@ -597,32 +481,68 @@ inline static struct dns_hash_entry* dns_hash_get(str* name, int type, int* h,
 													int* err)
 {
 	struct dns_hash_entry* e;
+	struct dns_hash_entry* ret;
+	ticks_t now;
+	int cname_chain;
+	str cname;
 	
-	LOCK_DNS_HASH();
-	e=_dns_hash_find(name, type, h, err);
-	if (e){
-		atomic_inc(&e->refcnt);
+	cname_chain=0;
+	ret=0;
+	now=get_ticks_raw();
+	*err=0;
+again:
+	*h=dns_hash_no(name->s, name->len, type);
+	DBG("dns_hash_get(%.*s(%d), %d), h=%d\n", name->len, name->s,
+												name->len, type, *h);
+	LOCK_DNS_BUCKET(*h);
+		e=_dns_hash_find(name, type, *h, now);
+		if (e){
+			atomic_inc(&e->refcnt);
+		}
+	UNLOCK_DNS_BUCKET(*h);
+	if (e==0)
+		return ret; /* if this is an unfinished cname chain, we return the
+					   last cname */
+	/* name points inside ret (if a cname was followed), release it only
+	 * now */
+	dns_hash_put(ret);
+	ret=e;
+	if ((e->type==T_CNAME) && (type!=T_CNAME)){
+		/* this is a cname => retry using its value */
+		if (cname_chain> MAX_CNAME_CHAIN){
+			LOG(L_ERR, "ERROR: dns_hash_get: cname chain too long "
+					"or recursive (\"%.*s\")\n", name->len, name->s);
+			dns_hash_put(e);
+			*err=-1;
+			return 0;
+		}
+		cname_chain++;
+		cname.s=((struct cname_rdata*)e->rr_lst->rdata)->name;
+		cname.len= ((struct cname_rdata*)e->rr_lst->rdata)->name_len;
+		name=&cname;
+		goto again;
 	}
-	UNLOCK_DNS_HASH();
 	return e;
 }
 
 
 
 /* adds a fully created and init. entry (see dns_cache_mk_entry()) to the hash
- * table
+ * table, only the entry bucket is locked
+ * older entries with the same name and type are replaced (e.g. prefetch)
  * returns 0 on success, -1 on error */
 inline static int dns_cache_add(struct dns_hash_entry* e)
 {
 	int h;
+	struct dns_hash_entry* old;
+	struct dns_hash_entry* tmp;
 	
 	/* check space */
-	/* atomic_add_long(dns_cache_total_used, e->size); */
-	if ((*dns_cache_mem_used+e->total_size)>=dns_cache_max_mem){
+	if ((dns_cache_mem_total()+e->total_size)>=dns_cache_max_mem){
 		LOG(L_WARN, "WARNING: dns_cache_add: cache full, trying to free...\n");
 		/* free ~ 12% of the cache */
-		dns_cache_free_mem(*dns_cache_mem_used/16*14, 1);
-		if ((*dns_cache_mem_used+e->total_size)>=dns_cache_max_mem){
+		dns_cache_free_mem(dns_cache_mem_total()/16*14, 1);
+		if ((dns_cache_mem_total()+e->total_size)>=dns_cache_max_mem){
 			LOG(L_ERR, "ERROR: dns_cache_add: max. cache mem size exceeded\n");
 			return -1;
 		}
@@ -631,48 +551,16 @@ inline static int dns_cache_add(struct dns_hash_entry* e)
 	h=dns_hash_no(e->name, e->name_len, e->type);
 	DBG("dns_cache_add: adding %.*s(%d) %d (flags=%0x) at %d\n",
 			e->name_len, e->name, e->name_len, e->type, e->err_flags, h);
-	LOCK_DNS_HASH();
-		*dns_cache_mem_used+=e->total_size; /* no need for atomic ops, written
-										 only from within a lock */
-		clist_append(&dns_hash[h], e, next, prev);
-#ifdef DNS_LU_LST
-		clist_append(dns_last_used_lst, &e->last_used_lst, next, prev);
-#endif
-	UNLOCK_DNS_HASH();
-	return 0;
-}
-
-
-
-/* same as above, but it must be called with the dns hash lock held
- * returns 0 on success, -1 on error */
-inline static int dns_cache_add_unsafe(struct dns_hash_entry* e)
-{
-	int h;
-	
-	/* check space */
-	/* atomic_add_long(dns_cache_total_used, e->size); */
-	if ((*dns_cache_mem_used+e->total_size)>=dns_cache_max_mem){
-		LOG(L_WARN, "WARNING: dns_cache_add: cache full, trying to free...\n");
-		/* free ~ 12% of the cache */
-		UNLOCK_DNS_HASH();
-		dns_cache_free_mem(*dns_cache_mem_used/16*14, 1);
-		LOCK_DNS_HASH();
-		if ((*dns_cache_mem_used+e->total_size)>=dns_cache_max_mem){
-			LOG(L_ERR, "ERROR: dns_cache_add: max. cache mem size exceeded\n");
-			return -1;
+	LOCK_DNS_BUCKET(h);
+		clist_foreach_safe(&dns_hash[h], old, tmp, next){
+			if ((old->type==e->type) && (old->name_len==e->name_len) &&
+					(strncasecmp(old->name, e->name, e->name_len)==0))
+				_dns_hash_remove(old, h);
 		}
-	}
-	atomic_inc(&e->refcnt);
-	h=dns_hash_no(e->name, e->name_len, e->type);
-	DBG("dns_cache_add: adding %.*s(%d) %d (flags=%0x) at %d\n",
-			e->name_len, e->name, e->name_len, e->type, e->err_flags, h);
-	*dns_cache_mem_used+=e->total_size; /* no need for atomic ops, written
-										 only from within a lock */
-	clist_append(&dns_hash[h], e, next, prev);
-#ifdef DNS_LU_LST
-	clist_append(dns_last_used_lst, &e->last_used_lst, next, prev);
-#endif
+		DNS_MEM_USED(h)+=e->total_size; /* no need for atomic ops, written
+										 only from within the bucket lock */
+		clist_append(&dns_hash[h], e, next, prev);
+	UNLOCK_DNS_BUCKET(h);
 	return 0;
 }
 
@@ -1377,122 +1265,89 @@ inline static struct dns_hash_entry* dns_get_related(struct dns_hash_entry* e,
 
 
 
-/* calls the external resolver and populates the cache with the result
- * returns: 0 on error, pointer to hash entry on success
- * WARNING: make sure you use dns_hash_entry_put() when you're
- *  finished with the result)
- * */
-inline static struct dns_hash_entry* dns_cache_do_request(str* name, int type)
+/* adds the records of an answer to a name:type query to the cache
+ * returns the entry matching name:type (with a reference held, use
+ *  dns_hash_put() when finished) or 0; if instead only a CNAME chain was
+ *  found, its last value is copied in cname (cname->s must have room for
+ *  MAX_DNS_NAME chars), else cname->len is set to 0
+ * WARNING: - records must be pkg_malloc'ed, they are freed */
+struct dns_hash_entry* dns_cache_add_answer(str* name, int type,
+											struct rdata* records,
+											str* cname)
 {
-	struct rdata* records;
 	struct dns_hash_entry* e;
 	struct dns_hash_entry* l;
 	struct dns_hash_entry* r;
 	struct dns_hash_entry* t;
-	struct ip_addr* ip;
 	str cname_val;
-	char name_buf[MAX_DNS_NAME];
 	
 	e=0;
-	l=0;
 	cname_val.s=0;
-	
-	if (type==T_A){
-		if ((ip=str2ip(name))!=0){
-				e=dns_cache_mk_ip_entry(name, ip);
-				if (e)
-					atomic_set(&e->refcnt, 1);/* because we ret. a ref. to it*/
-				goto end; /* we do not cache obvious stuff */
-		}
-	}else if (type==T_AAAA){
-		if ((ip=str2ip6(name))!=0){
-				e=dns_cache_mk_ip_entry(name, ip);
-				if (e)
-					atomic_set(&e->refcnt, 1);/* because we ret. a ref. to it*/
-				goto end;/* we do not cache obvious stuff */
-		}
-	}
-	if (name->len>=MAX_DNS_NAME){
-		LOG(L_ERR, "ERROR: dns_cache_do_request: name too long (%d chars)\n",
-					name->len);
-		goto end;
-	}
-	/* null terminate the string, needed by get_record */
-	memcpy(name_buf, name->s, name->len);
-	name_buf[name->len]=0;
-	records=get_record(name_buf, type, RES_AR);
-	if (records){
+	cname_val.len=0;
 #ifdef CACHE_RELEVANT_RECS_ONLY
-		e=dns_cache_mk_rd_entry(name, type, &records);
+	e=dns_cache_mk_rd_entry(name, type, &records);
+	if (e){
+		l=e;
+		e=dns_get_related(l, type, &records);
+		/* e should contain the searched entry (if found) and l
+		 * all the entries (e and related) */
 		if (e){
-			l=e;
-			e=dns_get_related(l, type, &records);
-			/* e should contain the searched entry (if found) and l
-			 * all the entries (e and related) */
-			if (e){
-				atomic_set(&e->refcnt, 1); /* 1 because we return a 
-												ref. to it */
-			}else{
-				/* e==0 => l contains a  cname list => we use the last
-				 * cname from the chain for a new resolve attempt (l->prev) */
-				/* only one cname record is allowed (rfc2181), so we ignore 
-				 * the others (we take only the first one) */
-				cname_val.s=
-					((struct cname_rdata*)l->prev->rr_lst->rdata)->name;
-				cname_val.len=
-					((struct cname_rdata*)l->prev->rr_lst->rdata)->name_len;
-				DBG("dns_cache_do_request: cname detected: %.*s (%d)\n",
-						cname_val.len, cname_val.s, cname_val.len);
-			}
-			/* add all the records to the hash */
-			l->prev->next=0; /* we break the double linked list for easier
-								searching */
-			LOCK_DNS_HASH(); /* optimization */
-			for (r=l; r; r=t){
-				t=r->next;
-				dns_cache_add_unsafe(r); /* refcnt++ inside */
-				if (atomic_get(&r->refcnt)==0){
-					/* if cache adding failed and nobody else is interested
-					 * destroy this entry */
-					dns_destroy_entry(r);
-				}
-			}
-			UNLOCK_DNS_HASH();
-			/* if only cnames found => try to resolve the last one */
-			if (cname_val.s){ 
-				DBG("dns_cache_do_request: dns_get_entry(cname: %.*s (%d))\n",
-						cname_val.len, cname_val.s, cname_val.len);
-				e=dns_get_entry(&cname_val, type);
+			atomic_set(&e->refcnt, 1); /* 1 because we return a 
+											ref. to it */
+		}else{
+			/* e==0 => l contains a  cname list => we use the last
+			 * cname from the chain for a new resolve attempt (l->prev) */
+			/* only one cname record is allowed (rfc2181), so we ignore 
+			 * the others (we take only the first one) */
+			cname_val.s=
+				((struct cname_rdata*)l->prev->rr_lst->rdata)->name;
+			cname_val.len=
+				((struct cname_rdata*)l->prev->rr_lst->rdata)->name_len;
+			DBG("dns_cache_add_answer: cname detected: %.*s (%d)\n",
+					cname_val.len, cname_val.s, cname_val.len);
+			/* copy it now, once added the entry can be removed at any
+			 * time by another process */
+			if (cname_val.len<MAX_DNS_NAME)
+				memcpy(cname->s, cname_val.s, cname_val.len);
+			else
+				cname_val.len=0;
+		}
+		/* add all the records to the hash */
+		l->prev->next=0; /* we break the double linked list for easier
+							searching */
+		for (r=l; r; r=t){
+			t=r->next;
+			dns_cache_add(r); /* refcnt++ inside */
+			if (atomic_get(&r->refcnt)==0){
+				/* if cache adding failed and nobody else is interested
+				 * destroy this entry */
+				dns_destroy_entry(r);
 			}
 		}
-#else
-		l=dns_cache_mk_rd_entry2(records);
-#endif
-		free_rdata_list(records);
-	}else if (dns_neg_cache_ttl){
-		e=dns_cache_mk_bad_entry(name, type, dns_neg_cache_ttl, DNS_BAD_NAME);
-		atomic_set(&e->refcnt, 1); /* 1 because we return a ref. to it */
-		dns_cache_add(e); /* refcnt++ inside*/
-		goto end;
 	}
-#ifndef CACHE_RELEVANT_RECS_ONLY
+#else
+	l=dns_cache_mk_rd_entry2(records);
 	if (l){
 		/* add all the records to the cache, but return only the record
 		 * we are looking for */
 		l->prev->next=0; /* we break the double linked list for easier
 							searching */
-		LOCK_DNS_HASH(); /* optimization */
 		for (r=l; r; r=t){
 			t=r->next;
 			if (e==0){ /* no entry found yet */
 				if (r->type==T_CNAME){
 					if ((r->name_len==name->len) && (r->rr_lst) &&
 							(strncasecmp(r->name, name->s, name->len)==0)){
-						/* update the name with the name from the cname rec. */
+						/* update the name with the name from the cname rec.,
+						 * copied before r is added to the cache */
 						cname_val.s=
 								((struct cname_rdata*)r->rr_lst->rdata)->name;
 						cname_val.len=
 							((struct cname_rdata*)r->rr_lst->rdata)->name_len;
+						if (cname_val.len>=MAX_DNS_NAME)
+							cname_val.len=0;
+						memcpy(cname->s, cname_val.s, cname_val.len);
+						cname_val.s=cname->s;
 						name=&cname_val;
 					}
 				}else if ((r->type==type) && (r->name_len==name->len) &&
@@ -1502,21 +1357,91 @@ inline static struct dns_hash_entry* dns_cache_do_request(str* name, int type)
 												  to it */
 				}
 			}
-			dns_cache_add_unsafe(r); /* refcnt++ inside */
+			dns_cache_add(r); /* refcnt++ inside */
 			if (atomic_get(&r->refcnt)==0){
 				/* if cache adding failed and nobody else is interested
 				 * destroy this entry */
 				dns_destroy_entry(r);
 			}
 		}
-		UNLOCK_DNS_HASH();
-		if ((e==0) && (cname_val.s)){ /* not found, but found a cname */
-			/* only one cname is allowed (rfc2181), so we ignore the
-			 * others (we take only the first one) */
+	}
+#endif
+	free_rdata_list(records);
+	cname->len=(e==0)?cname_val.len:0;
+	return e;
+}
+
+
+
+/* adds a negative entry for name:type to the cache (see dns_neg_cache_ttl)
+ * returns the entry (with a reference held, use dns_hash_put() when
+ *  finished) or 0 on error */
+struct dns_hash_entry* dns_cache_add_bad(str* name, int type)
+{
+	struct dns_hash_entry* e;
+	
+	e=dns_cache_mk_bad_entry(name, type, dns_neg_cache_ttl, DNS_BAD_NAME);
+	if (e){
+		atomic_set(&e->refcnt, 1); /* 1 because we return a ref. to it */
+		dns_cache_add(e); /* refcnt++ inside*/
+	}
+	return e;
+}
+
+
+
+/* calls the external resolver and populates the cache with the result
+ * returns: 0 on error, pointer to hash entry on success
+ * WARNING: make sure you use dns_hash_entry_put() when you're
+ *  finished with the result)
+ * */
+inline static struct dns_hash_entry* dns_cache_do_request(str* name, int type)
+{
+	struct rdata* records;
+	struct dns_hash_entry* e;
+	struct ip_addr* ip;
+	str cname_val;
+	char name_buf[MAX_DNS_NAME];
+	char cname_buf[MAX_DNS_NAME];
+	
+	e=0;
+	
+	if (type==T_A){
+		if ((ip=str2ip(name))!=0){
+				e=dns_cache_mk_ip_entry(name, ip);
+				if (e)
+					atomic_set(&e->refcnt, 1);/* because we ret. a ref. to it*/
+				goto end; /* we do not cache obvious stuff */
+		}
+	}else if (type==T_AAAA){
+		if ((ip=str2ip6(name))!=0){
+				e=dns_cache_mk_ip_entry(name, ip);
+				if (e)
+					atomic_set(&e->refcnt, 1);/* because we ret. a ref. to it*/
+				goto end;/* we do not cache obvious stuff */
+		}
+	}
+	if (name->len>=MAX_DNS_NAME){
+		LOG(L_ERR, "ERROR: dns_cache_do_request: name too long (%d chars)\n",
+					name->len);
+		goto end;
+	}
+	/* null terminate the string, needed by get_record */
+	memcpy(name_buf, name->s, name->len);
+	name_buf[name->len]=0;
+	records=get_record(name_buf, type, RES_AR);
+	if (records){
+		cname_val.s=cname_buf;
+		e=dns_cache_add_answer(name, type, records, &cname_val);
+		/* if only cnames found => try to resolve the last one */
+		if ((e==0) && cname_val.len){
+			DBG("dns_cache_do_request: dns_get_entry(cname: %.*s (%d))\n",
+					cname_val.len, cname_val.s, cname_val.len);
 			e=dns_get_entry(&cname_val, type);
 		}
+	}else if (dns_neg_cache_ttl){
+		e=dns_cache_add_bad(name, type);
 	}
-#endif
 end:
 	return e;
 }
@@ -1531,6 +1456,7 @@ inline static struct dns_hash_entry* dns_get_entry(str* name, int type)
 {
 	int h;
 	struct dns_hash_entry* e;
+	struct dns_hash_entry* c;
 	str cname_val;
 	int err;
 	static int rec_cnt=0; /* recursion protection */
@@ -1552,8 +1478,12 @@ inline static struct dns_hash_entry* dns_get_entry(str* name, int type)
 		 * the others (we take only the first one) */
 		cname_val.s= ((struct cname_rdata*)e->rr_lst->rdata)->name;
 		cname_val.len=((struct cname_rdata*)e->rr_lst->rdata)->name_len;
-		dns_hash_put(e); /* not interested in the cname anymore */
-		if ((e=dns_cache_do_request(&cname_val, type))==0)
+		/* cname_val points inside the cname entry, keep it referenced
+		 * until the request is done */
+		c=e;
+		e=dns_cache_do_request(&cname_val, type);
+		dns_hash_put(c); /* not interested in the cname anymore */
+		if (e==0)
 			goto error; /* could not resolve cname */
 	}
 	/* found */
@@ -1569,6 +1499,179 @@ error:
 
 
 
+/* looks up name:type only in the cache, it never makes a dns request
+ * returns the entry (with a reference held, use dns_hash_put() when
+ *  finished) if the cache holds an answer (positive or negative) for it,
+ *  0 otherwise (not cached or unfinished CNAME chain) */
+struct dns_hash_entry* dns_get_cached_entry(str* name, int type)
+{
+	int h;
+	int err;
+	struct dns_hash_entry* e;
+	
+	e=dns_hash_get(name, type, &h, &err);
+	if (e && (e->type==T_CNAME) && (type!=T_CNAME)){
+		dns_hash_put(e);
+		e=0;
+	}
+	return e;
+}
+
+
+
+/* calls f(name, type, param) for each cached entry looked up at least
+ *  min_hits times since it was added or last prefetched and which expires
+ *  in less than window ticks; the entry hit count is reset
+ * negative and CNAME entries are skipped
+ * only one bucket is locked at a time, f is called with the entry bucket
+ *  locked so it must not use the cache
+ * returns the number of entries f was called for */
+int dns_cache_prefetch_scan(ticks_t window, unsigned int min_hits,
+							dns_prefetch_f* f, void* param)
+{
+	struct dns_hash_entry* e;
+	ticks_t now;
+	str name;
+	int h;
+	int n;
+	
+	n=0;
+	now=get_ticks_raw();
+	for (h=0; h<DNS_HASH_SIZE; h++){
+		LOCK_DNS_BUCKET(h);
+			clist_foreach(&dns_hash[h], e, next){
+				if ((e->rr_lst==0) || e->err_flags || (e->type==T_CNAME) ||
+						(e->hits<min_hits) ||
+						((s_ticks_t)(e->expire-now)<=0) ||
+						((s_ticks_t)(e->expire-now)>(s_ticks_t)window))
+					continue;
+				e->hits=0;
+				name.s=e->name;
+				name.len=e->name_len;
+				f(&name, e->type, param);
+				n++;
+			}
+		UNLOCK_DNS_BUCKET(h);
+	}
+	return n;
+}
+
+
+
+/* returns a pkg_malloc'ed struct rdata list (as get_record()) with a copy
+ *  of the not expired records of the entry e and releases e
+ * only A, AAAA, SRV, NAPTR and CNAME records are supported */
+static struct rdata* dns_entry_get_records(struct dns_hash_entry* e)
+{
+	struct dns_rr* rr;
+	struct rdata* head;
+	struct rdata** last;
+	struct rdata* rd;
+	struct naptr_rdata* src;
+	struct naptr_rdata* dst;
+	ticks_t now;
+	int size;
+	
+	head=0;
+	last=&head;
+	now=get_ticks_raw();
+	for (rr=e->rr_lst; rr; rr=rr->next){
+		if (rr->err_flags || ((s_ticks_t)(now-rr->expire)>=0))
+			continue;
+		switch(e->type){
+			case T_A:
+				size=sizeof(struct a_rdata);
+				break;
+			case T_AAAA:
+				size=sizeof(struct aaaa_rdata);
+				break;
+			case T_SRV:
+				size=SRV_RDATA_SIZE(*(struct srv_rdata*)rr->rdata);
+				break;
+			case T_NAPTR:
+				size=NAPTR_RDATA_SIZE(*(struct naptr_rdata*)rr->rdata);
+				break;
+			case T_CNAME:
+				size=CNAME_RDATA_SIZE(*(struct cname_rdata*)rr->rdata);
+				break;
+			default:
+				continue;
+		}
+		rd=pkg_malloc(sizeof(struct rdata)+e->name_len+1-1);
+		if (rd==0)
+			goto error;
+		memset(rd, 0, sizeof(struct rdata));
+		rd->rdata=pkg_malloc(size);
+		if (rd->rdata==0){
+			pkg_free(rd);
+			goto error;
+		}
+		memcpy(rd->rdata, rr->rdata, size);
+		if (e->type==T_NAPTR){
+			/* the strings point inside str_table */
+			src=(struct naptr_rdata*)rr->rdata;
+			dst=(struct naptr_rdata*)rd->rdata;
+			dst->flags=dst->str_table+(src->flags-src->str_table);
+			dst->services=dst->str_table+(src->services-src->str_table);
+			dst->regexp=dst->str_table+(src->regexp-src->str_table);
+			dst->repl=dst->str_table+(src->repl-src->str_table);
+		}
+		rd->type=e->type;
+		rd->class=C_IN;
+		rd->ttl=TICKS_TO_S(rr->expire-now);
+		memcpy(rd->name, e->name, e->name_len);
+		rd->name[e->name_len]=0;
+		rd->name_len=e->name_len;
+		*last=rd;
+		last=&rd->next;
+	}
+	dns_hash_put(e);
+	return head;
+error:
+	LOG(L_ERR, "ERROR: dns_entry_get_records: out of memory\n");
+	dns_hash_put(e);
+	free_rdata_list(head);
+	return 0;
+}
+
+
+
+/* returns a pkg_malloc'ed struct rdata list (as get_record()) with a copy
+ *  of the not expired records of name:type, resolved through the cache
+ *  (a dns request is made on miss, CNAMEs are followed) or 0 if not found
+ * only A, AAAA, SRV, NAPTR and CNAME records are supported
+ * WARNING: use free_rdata_list() when finished */
+struct rdata* dns_cache_get_record(str* name, int type)
+{
+	struct dns_hash_entry* e;
+
+	e=dns_get_entry(name, type);
+	if (e==0)
+		return 0;
+	return dns_entry_get_records(e);
+}
+
+
+
+/* like dns_cache_get_record(), but it only looks in the cache and never
+ *  makes a dns request (returns 0 if name:type is not cached or negative)
+ * WARNING: use free_rdata_list() when finished */
+struct rdata* dns_cache_get_cached_record(str* name, int type)
+{
+	struct dns_hash_entry* e;
+
+	e=dns_get_cached_entry(name, type);
+	if (e==0)
+		return 0;
+	if ((e->rr_lst==0) || e->err_flags){
+		dns_hash_put(e);
+		return 0;
+	}
+	return dns_entry_get_records(e);
+}
+
+
+
 /* gets the first non-expired, good record starting with record no
  * from the dns_hash_entry struct e
  * params:       e   - dns_hash_entry struct
@@ -2341,7 +2444,7 @@ int dns_srv_get_ip(str* name, struct ip_addr* ip, unsigned short* port,
 /* rpc functions */
 void dns_cache_mem_info(rpc_t* rpc, void* ctx)
 {
-	rpc->add(ctx, "dd",  *dns_cache_mem_used, dns_cache_max_mem);
+	rpc->add(ctx, "dd",  dns_cache_mem_total(), dns_cache_max_mem);
 }
 
 
@@ -2352,8 +2455,8 @@ void dns_cache_debug(rpc_t* rpc, void* ctx)
 	ticks_t now;
 	
 	now=get_ticks_raw();
-	LOCK_DNS_HASH();
-		for (h=0; h<DNS_HASH_SIZE; h++){
+	for (h=0; h<DNS_HASH_SIZE; h++){
+		LOCK_DNS_BUCKET(h);
 			clist_foreach(&dns_hash[h], e, next){
 				rpc->add(ctx, "sdddddd", 
 								e->name, e->type, e->total_size, e->refcnt.val,
@@ -2362,8 +2465,8 @@ void dns_cache_debug(rpc_t* rpc, void* ctx)
 								TICKS_TO_S(now-e->last_used),
 								e->err_flags);
 			}
-		}
-	UNLOCK_DNS_HASH();
+		UNLOCK_DNS_BUCKET(h);
+	}
 }
 
 
@@ -2379,8 +2482,8 @@ void dns_cache_debug_all(rpc_t* rpc, void* ctx)
 	ticks_t now;
 	
 	now=get_ticks_raw();
-	LOCK_DNS_HASH();
-		for (h=0; h<DNS_HASH_SIZE; h++){
+	for (h=0; h<DNS_HASH_SIZE; h++){
+		LOCK_DNS_BUCKET(h);
 			clist_foreach(&dns_hash[h], e, next){
 				for (i=0, rr=e->rr_lst; rr; i++, rr=rr->next){
 					rpc->add(ctx, "sddddddd", 
@@ -2420,8 +2523,8 @@ void dns_cache_debug_all(rpc_t* rpc, void* ctx)
 							rr->err_flags);
 				}
 			}
-		}
-	UNLOCK_DNS_HASH();
+		UNLOCK_DNS_BUCKET(h);
+	}
 }
 
 
@@ -46,8 +46,6 @@
 #error "DNS FAILOVER requires DNS CACHE support (define USE_DNS_CACHE)"
 #endif
 
-#define DNS_LU_LST
-
 /* dns functions return them as negative values (e.g. return -E_DNS_NO_IP)
  * listed in the order of importance ( if more errors, only the most important
  * is returned)
@@ -109,23 +107,14 @@ struct dns_rr{
 
 
 
-#ifdef DNS_LU_LST
-struct dns_lu_lst{  /* last used ordered list */
-	struct dns_lu_lst* next;
-	struct dns_lu_lst* prev;
-};
-#endif
-
 struct dns_hash_entry{
-	/* hash table links */
+	/* hash table links (the bucket is kept in last used order) */
 	struct dns_hash_entry* next;
 	struct dns_hash_entry* prev;
-#ifdef DNS_LU_LST
-	struct dns_lu_lst last_used_lst;
-#endif
 	struct dns_rr* rr_lst;
 	atomic_t refcnt;
 	ticks_t last_used;
+	unsigned int hits; /* lookups since added or last prefetched */
 	ticks_t expire; /* when the whole entry will expire */
 	int total_size;
 	unsigned short type;
@@ -156,6 +145,24 @@ void destroy_dns_cache();
 void dns_hash_put(struct dns_hash_entry* e);
 void dns_hash_put_shm_unsafe(struct dns_hash_entry* e);
 
+/* cache lookup only, never blocks (see dns_cache.c) */
+struct dns_hash_entry* dns_get_cached_entry(str* name, int type);
+/* populate the cache with a received answer, used by the dns resolver
+ * process (dns_resolver.c) */
+struct dns_hash_entry* dns_cache_add_answer(str* name, int type,
+											struct rdata* records,
+											str* cname);
+struct dns_hash_entry* dns_cache_add_bad(str* name, int type);
+
+typedef void (dns_prefetch_f)(str* name, int type, void* param);
+int dns_cache_prefetch_scan(ticks_t window, unsigned int min_hits,
+							dns_prefetch_f* f, void* param);
+
+/* pkg copy of the records of name:type, see get_record() */
+struct rdata* dns_cache_get_record(str* name, int type);
+/* the same, without a dns request on miss */
+struct rdata* dns_cache_get_cached_record(str* name, int type);
+
 inline static void dns_srv_handle_put(struct dns_srv_handle* h)
 {
 	if (h){
@@ -0,0 +1,696 @@
+/*
+ * $Id$
+ *
+ * asynchronous dns resolver process
+ *
+ * This file is part of ser, a free SIP server.
+ *
+ * ser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * For a license to use the ser software under conditions
+ * other than those described here, or to purchase support for this
+ * software, please contact iptel.org by e-mail at the following addresses:
+ *    info@iptel.org
+ *
+ * ser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#ifdef USE_DNS_CACHE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <resolv.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dns_resolver.h"
+#include "dns_cache.h"
+#include "resolve.h"
+#include "mem/mem.h"
+#include "mem/shm_mem.h"
+#include "locking.h"
+#include "timer_ticks.h"
+#include "dprint.h"
+#include "error.h"
+#include "pt.h"
+
+
+int dns_async=0;
+unsigned int dns_prefetch_time=DEFAULT_DNS_PREFETCH_TIME;
+unsigned int dns_prefetch_hits=DEFAULT_DNS_PREFETCH_HITS;
+
+
+/* request queued by a worker (shm), the name is stored after it */
+struct dns_async_req{
+	struct dns_async_req* next;
+	dns_async_cb_f* cb;
+	void* param;
+	int type;
+	str name;
+};
+
+struct dns_async_queue{
+	gen_lock_t* lock;
+	struct dns_async_req* first;
+	struct dns_async_req* last;
+};
+
+/* query sent by the resolver process (pkg, resolver process only)
+ * name is changed to the cname value while following a cname chain
+ * each query has its own socket, bound to a random port, and a random id,
+ * so that a spoofed answer has to guess both */
+struct dns_pending{
+	struct dns_pending* next;
+	struct dns_async_req* waiting; /* requests answered by this query */
+	ticks_t timeout; /* next retransmission, 0 = not sent yet */
+	int sock; /* -1 = not sent yet */
+	int pfd_idx; /* in dns_pfd, 0 = not polled */
+	unsigned short id;
+	unsigned short type;
+	int sent; /* transmissions */
+	int cname_chain;
+	int prefetch; /* refreshes a still valid entry, not replaced on failure */
+	str name;
+	char name_buf[MAX_DNS_NAME];
+};
+
+
+static struct dns_async_queue* dns_queue=0;
+static int dns_notify[2]={-1, -1}; /* workers wake up the resolver process */
+
+static struct dns_pending* dns_queries=0;
+static struct pollfd* dns_pfd=0; /* the notify pipe and the query sockets */
+static int dns_pfd_size=0;
+
+
+
+int init_dns_resolver()
+{
+	int r;
+
+	if (!dns_async)
+		return 0;
+#ifndef HAVE_RESOLV_RES
+	LOG(L_ERR, "ERROR: init_dns_resolver: no resolver options support,"
+			" dns_cache_async is not available\n");
+	return -1;
+#endif
+	dns_queue=shm_malloc(sizeof(struct dns_async_queue));
+	if (dns_queue==0){
+		LOG(L_ERR, "ERROR: init_dns_resolver: out of memory\n");
+		return E_OUT_OF_MEM;
+	}
+	memset(dns_queue, 0, sizeof(struct dns_async_queue));
+	dns_queue->lock=lock_alloc();
+	if (dns_queue->lock==0 || lock_init(dns_queue->lock)==0){
+		LOG(L_ERR, "ERROR: init_dns_resolver: failed to create the lock\n");
+		goto error;
+	}
+	if (pipe(dns_notify)<0){
+		LOG(L_ERR, "ERROR: init_dns_resolver: pipe: %s\n", strerror(errno));
+		goto error;
+	}
+	for (r=0; r<2; r++){
+		if (fcntl(dns_notify[r], F_SETFL,
+					fcntl(dns_notify[r], F_GETFL)|O_NONBLOCK)<0){
+			LOG(L_ERR, "ERROR: init_dns_resolver: fcntl: %s\n",
+					strerror(errno));
+			goto error;
+		}
+	}
+	return 0;
+error:
+	destroy_dns_resolver();
+	return -1;
+}
+
+
+
+void destroy_dns_resolver()
+{
+	struct dns_async_req* r;
+
+	if (dns_queue){
+		while(dns_queue->first){
+			r=dns_queue->first;
+			dns_queue->first=r->next;
+			shm_free(r);
+		}
+		if (dns_queue->lock){
+			lock_destroy(dns_queue->lock);
+			lock_dealloc(dns_queue->lock);
+		}
+		shm_free(dns_queue);
+		dns_queue=0;
+	}
+	if (dns_notify[0]>=0){
+		close(dns_notify[0]);
+		close(dns_notify[1]);
+		dns_notify[0]=dns_notify[1]=-1;
+	}
+}
+
+
+
+/* queues a request for the resolver process and wakes it up
+ * returns 0 if queued, <0 on error */
+int dns_resolve_async(str* name, int type, dns_async_cb_f* cb, void* param)
+{
+	struct dns_async_req* r;
+	char c;
+
+	if (dns_queue==0)
+		return -1;
+	if (name->len>=MAX_DNS_NAME){
+		LOG(L_ERR, "ERROR: dns_resolve_async: name too long (%d chars)\n",
+				name->len);
+		return -1;
+	}
+	r=shm_malloc(sizeof(struct dns_async_req)+name->len);
+	if (r==0){
+		LOG(L_ERR, "ERROR: dns_resolve_async: out of memory\n");
+		return E_OUT_OF_MEM;
+	}
+	r->next=0;
+	r->cb=cb;
+	r->param=param;
+	r->type=type;
+	r->name.s=(char*)(r+1);
+	r->name.len=name->len;
+	memcpy(r->name.s, name->s, name->len);
+
+	lock_get(dns_queue->lock);
+		if (dns_queue->last)
+			dns_queue->last->next=r;
+		else
+			dns_queue->first=r;
+		dns_queue->last=r;
+	lock_release(dns_queue->lock);
+	/* if the pipe is full the resolver has been woken up already */
+	c=0;
+	if (write(dns_notify[1], &c, 1)<0 && errno!=EAGAIN)
+		LOG(L_ERR, "ERROR: dns_resolve_async: write: %s\n", strerror(errno));
+	return 0;
+}
+
+
+
+static struct dns_pending* dns_query_by_name(str* name, int type)
+{
+	struct dns_pending* q;
+
+	for (q=dns_queries; q; q=q->next)
+		if ((q->type==type) && (q->name.len==name->len) &&
+				(strncasecmp(q->name.s, name->s, name->len)==0))
+			return q;
+	return 0;
+}
+
+
+
+/* opens a non-blocking udp socket bound to a random port
+ * returns the socket or -1 on error */
+static int dns_query_socket()
+{
+	struct sockaddr_in addr;
+	int s;
+	int r;
+
+	s=socket(AF_INET, SOCK_DGRAM, 0);
+	if (s<0){
+		LOG(L_ERR, "ERROR: dns_query_socket: socket: %s\n", strerror(errno));
+		return -1;
+	}
+	if (fcntl(s, F_SETFL, fcntl(s, F_GETFL)|O_NONBLOCK)<0){
+		LOG(L_ERR, "ERROR: dns_query_socket: fcntl: %s\n", strerror(errno));
+		close(s);
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family=AF_INET;
+	addr.sin_addr.s_addr=htonl(INADDR_ANY);
+	for (r=0; r<DNS_RESOLVER_BIND_TRIES; r++){
+		addr.sin_port=htons(1024+random()%(65536-1024));
+		if (bind(s, (struct sockaddr*)&addr, sizeof(addr))==0)
+			return s;
+		if (errno!=EADDRINUSE)
+			break;
+	}
+	/* not bound, sendto() will use an ephemeral port */
+	DBG("dns_query_socket: no random port: %s\n", strerror(errno));
+	return s;
+}
+
+
+
+/* creates a not yet sent query */
+static struct dns_pending* dns_query_new(str* name, int type)
+{
+	struct dns_pending* q;
+
+	q=pkg_malloc(sizeof(struct dns_pending));
+	if (q==0){
+		LOG(L_ERR, "ERROR: dns_query_new: out of memory\n");
+		return 0;
+	}
+	memset(q, 0, sizeof(struct dns_pending));
+	q->sock=-1;
+	q->type=type;
+	q->name.s=q->name_buf;
+	q->name.len=name->len;
+	memcpy(q->name_buf, name->s, name->len);
+	q->name_buf[name->len]=0;
+	q->next=dns_queries;
+	dns_queries=q;
+	return q;
+}
+
+
+
+/* removes the query and notifies the requests waiting for it */
+static void dns_query_done(struct dns_pending* q, int err)
+{
+	struct dns_pending** crt;
+	struct dns_async_req* r;
+
+	for (crt=&dns_queries; *crt; crt=&(*crt)->next)
+		if (*crt==q){
+			*crt=q->next;
+			break;
+		}
+	if (q->sock>=0)
+		close(q->sock);
+	while(q->waiting){
+		r=q->waiting;
+		q->waiting=r->next;
+		r->cb(err, r->param);
+		shm_free(r);
+	}
+	pkg_free(q);
+}
+
+
+
+/* the name does not exist or the query timed out */
+static void dns_query_failed(struct dns_pending* q, int err)
+{
+	struct dns_hash_entry* e;
+
+	/* a failed refresh keeps the old entry until it expires */
+	if (dns_neg_cache_ttl && !q->prefetch){
+		e=dns_cache_add_bad(&q->name, q->type);
+		dns_hash_put(e);
+	}
+	dns_query_done(q, err);
+}
+
+
+
+/* (re)transmits the query, each time to the next server */
+static void dns_query_send(struct dns_pending* q)
+{
+	union dns_query buf;
+	int len;
+	int ns;
+
+	if (q->sock<0){
+		q->sock=dns_query_socket();
+		if (q->sock<0){
+			dns_query_done(q, -1);
+			return;
+		}
+		q->id=(unsigned short)random();
+	}
+	len=res_mkquery(QUERY, q->name_buf, C_IN, q->type, 0, 0, 0,
+						buf.buff, sizeof(buf));
+	if (len<0){
+		LOG(L_ERR, "ERROR: dns_query_send: res_mkquery(%s, %d) failed\n",
+				q->name_buf, q->type);
+		dns_query_done(q, -1);
+		return;
+	}
+	buf.hdr.id=htons(q->id);
+	ns=q->sent%_res.nscount;
+	if (sendto(q->sock, buf.buff, len, 0,
+				(struct sockaddr*)&_res.nsaddr_list[ns],
+				sizeof(struct sockaddr_in))<0)
+		LOG(L_ERR, "ERROR: dns_query_send: sendto: %s\n", strerror(errno));
+	q->sent++;
+	q->timeout=get_ticks_raw()+S_TO_TICKS((_res.retrans>0)?_res.retrans:1);
+	if (q->timeout==0)
+		q->timeout=1; /* 0 means not sent */
+}
+
+
+
+/* adds the records to the cache, follows an unfinished cname chain */
+static void dns_query_answer(struct dns_pending* q, struct rdata* records)
+{
+	struct dns_hash_entry* e;
+	char cname_buf[MAX_DNS_NAME];
+	str cname;
+
+	cname.s=cname_buf;
+	e=dns_cache_add_answer(&q->name, q->type, records, &cname);
+	if (e){
+		dns_hash_put(e);
+		dns_query_done(q, 0);
+		return;
+	}
+	if (cname.len==0){
+		dns_query_failed(q, 0);
+		return;
+	}
+	if (q->cname_chain>=DNS_RESOLVER_MAX_CNAME){
+		LOG(L_WARN, "WARNING: dns_query_answer: CNAME chain too long or"
+				" recursive (\"%.*s\")\n", q->name.len, q->name.s);
+		dns_query_done(q, -1);
+		return;
+	}
+	q->cname_chain++;
+	memcpy(q->name_buf, cname.s, cname.len);
+	q->name_buf[cname.len]=0;
+	q->name.len=cname.len;
+	/* a new question, new socket and id */
+	close(q->sock);
+	q->sock=-1;
+	q->sent=0;
+	dns_query_send(q);
+}
+
+
+
+/* returns 1 if the answer comes from one of the servers */
+static int dns_from_server(struct sockaddr_in* from)
+{
+	int r;
+
+	for (r=0; r<_res.nscount; r++)
+		if ((_res.nsaddr_list[r].sin_addr.s_addr==from->sin_addr.s_addr) &&
+				(_res.nsaddr_list[r].sin_port==from->sin_port))
+			return 1;
+	return 0;
+}
+
+
+
+/* reads the answers received on the socket of q, drops those that do not
+ * come from one of the servers or do not match the id and the question */
+static void dns_query_read(struct dns_pending* q)
+{
+	union dns_query buf;
+	struct sockaddr_in from;
+	socklen_t from_len;
+	struct rdata* records;
+	char qname[MAX_DNS_NAME];
+	unsigned char* p;
+	unsigned short qtype;
+	int len;
+	int skip;
+
+	for(;;){
+		from_len=sizeof(from);
+		len=recvfrom(q->sock, buf.buff, sizeof(buf), 0,
+						(struct sockaddr*)&from, &from_len);
+		if (len<0){
+			if (errno==EINTR) continue;
+			if (errno!=EAGAIN && errno!=EWOULDBLOCK)
+				LOG(L_ERR, "ERROR: dns_query_read: recvfrom: %s\n",
+						strerror(errno));
+			return;
+		}
+		if ((len<HFIXEDSZ) || !buf.hdr.qr || !dns_from_server(&from))
+			continue;
+		if (ntohs(buf.hdr.id)!=q->id){
+			DBG("dns_query_read: answer with a wrong id %d for %s\n",
+					ntohs(buf.hdr.id), q->name_buf);
+			continue;
+		}
+		/* check that it answers our question */
+		if (ntohs(buf.hdr.qdcount)!=1)
+			continue;
+		p=buf.buff+HFIXEDSZ;
+		skip=dn_expand(buf.buff, buf.buff+len, p, qname, MAX_DNS_NAME-1);
+		if (skip<0 || (p+skip+4)>buf.buff+len)
+			continue;
+		memcpy(&qtype, p+skip, 2);
+		if ((ntohs(qtype)!=q->type) || (strcasecmp(qname, q->name_buf)!=0))
+			continue;
+
+		/* q may be freed or sent again from here on */
+		if (buf.hdr.tc){
+			/* truncated, let libresolv retry it over tcp */
+			DBG("dns_query_read: truncated answer for %s\n", q->name_buf);
+			records=get_record(q->name_buf, q->type, RES_AR);
+			if (records)
+				dns_query_answer(q, records);
+			else
+				dns_query_failed(q, 0);
+			return;
+		}
+		switch(buf.hdr.rcode){
+			case NOERROR:
+				records=dns_parse_answer(buf.buff, len, q->name_buf,
+											q->type, RES_AR);
+				if (records)
+					dns_query_answer(q, records);
+				else
+					dns_query_failed(q, 0);
+				break;
+			case NXDOMAIN:
+				dns_query_failed(q, 0);
+				break;
+			default:
+				/* server failure, try the next server right away */
+				DBG("dns_query_read: rcode %d for %s\n",
+						buf.hdr.rcode, q->name_buf);
+				q->timeout=get_ticks_raw();
+		}
+		return;
+	}
+}
+
+
+
+/* reads the answers of the queries whose sockets poll() found readable */
+static void dns_resolver_answers()
+{
+	struct dns_pending* q;
+	struct dns_pending* next;
+
+	/* dns_query_read() frees at most the query it reads */
+	for (q=dns_queries; q; q=next){
+		next=q->next;
+		if (q->pfd_idx && (dns_pfd[q->pfd_idx].fd==q->sock) &&
+				(dns_pfd[q->pfd_idx].revents & POLLIN))
+			dns_query_read(q);
+	}
+}
+
+
+
+/* fills dns_pfd with the notify pipe and the sockets of the sent queries
+ * returns the number of entries */
+static int dns_resolver_pfd()
+{
+	struct dns_pending* q;
+	struct pollfd* pfd;
+	int n;
+
+	n=1;
+	for (q=dns_queries; q; q=q->next)
+		if (q->sock>=0)
+			n++;
+	if (n>dns_pfd_size){
+		pfd=pkg_realloc(dns_pfd, 2*n*sizeof(struct pollfd));
+		if (pfd){
+			dns_pfd=pfd;
+			dns_pfd_size=2*n;
+		}else{
+			/* the others time out and are retransmitted */
+			LOG(L_ERR, "ERROR: dns_resolver_pfd: out of memory, polling"
+					" only %d queries\n", dns_pfd_size-1);
+		}
+	}
+	dns_pfd[0].fd=dns_notify[0];
+	dns_pfd[0].events=POLLIN;
+	dns_pfd[0].revents=0;
+	n=1;
+	for (q=dns_queries; q; q=q->next){
+		if ((q->sock<0) || (n>=dns_pfd_size)){
+			q->pfd_idx=0;
+			continue;
+		}
+		dns_pfd[n].fd=q->sock;
+		dns_pfd[n].events=POLLIN;
+		dns_pfd[n].revents=0;
+		q->pfd_idx=n;
+		n++;
+	}
+	return n;
+}
+
+
+
+/* takes over the requests queued by the workers */
+static void dns_resolver_requests()
+{
+	struct dns_async_req* r;
+	struct dns_async_req* next;
+	struct dns_hash_entry* e;
+	struct dns_pending* q;
+	char buf[64];
+
+	while(read(dns_notify[0], buf, sizeof(buf))>0);
+	lock_get(dns_queue->lock);
+		r=dns_queue->first;
+		dns_queue->first=dns_queue->last=0;
+	lock_release(dns_queue->lock);
+
+	for (; r; r=next){
+		next=r->next;
+		r->next=0;
+		/* answered at once if already cached (or an ip) */
+		if (((r->type==T_A) && str2ip(&r->name)) ||
+				((r->type==T_AAAA) && str2ip6(&r->name)) ||
+				((e=dns_get_cached_entry(&r->name, r->type))!=0 &&
+					(dns_hash_put(e), 1))){
+			r->cb(0, r->param);
+			shm_free(r);
+			continue;
+		}
+		/* one query for all the requests for the same name */
+		q=dns_query_by_name(&r->name, r->type);
+		if (q){
+			r->next=q->waiting;
+			q->waiting=r;
+			q->prefetch=0; /* the entry expired meanwhile */
+			continue;
+		}
+		q=dns_query_new(&r->name, r->type);
+		if (q==0){
+			r->cb(-1, r->param);
+			shm_free(r);
+			continue;
+		}
+		q->waiting=r;
+		dns_query_send(q); /* might free q */
+	}
+}
+
+
+
+/* dns_cache_prefetch_scan() callback, called with a cache bucket locked */
+static void dns_prefetch(str* name, int type, void* param)
+{
+	struct dns_pending* q;
+
+	if (dns_query_by_name(name, type))
+		return;
+	DBG("dns_prefetch: refreshing %.*s (%d)\n", name->len, name->s, type);
+	q=dns_query_new(name, type); /* sent from dns_resolver_timer() */
+	if (q)
+		q->prefetch=1;
+}
+
+
+
+/* sends the new queries, retransmits or gives up the old ones */
+static void dns_resolver_timer(ticks_t now)
+{
+	struct dns_pending* q;
+	struct dns_pending* next;
+
+	for (q=dns_queries; q; q=next){
+		next=q->next;
+		if (q->timeout==0){
+			dns_query_send(q);
+		}else if ((s_ticks_t)(now-q->timeout)>=0){
+			if (q->sent>=((_res.retry>0)?_res.retry:1)*_res.nscount){
+				DBG("dns_resolver_timer: %s (%d) timed out\n",
+						q->name_buf, q->type);
+				dns_query_failed(q, -1);
+			}else{
+				dns_query_send(q);
+			}
+		}
+	}
+}
+
+
+
+static void dns_resolver_loop()
+{
+	ticks_t now;
+	ticks_t last_prefetch;
+	int n;
+
+	last_prefetch=get_ticks_raw();
+	for(;;){
+		n=poll(dns_pfd, dns_resolver_pfd(), DNS_RESOLVER_TICK);
+		if (n<0 && errno!=EINTR){
+			LOG(L_ERR, "ERROR: dns_resolver_loop: poll: %s\n", strerror(errno));
+			continue;
+		}
+		if (n>0){
+			dns_resolver_answers();
+			if (dns_pfd[0].revents & POLLIN)
+				dns_resolver_requests();
+		}
+		now=get_ticks_raw();
+		if (dns_prefetch_time && (now-last_prefetch)>=S_TO_TICKS(1)){
+			last_prefetch=now;
+			dns_cache_prefetch_scan(S_TO_TICKS(dns_prefetch_time),
+										dns_prefetch_hits, dns_prefetch, 0);
+		}
+		dns_resolver_timer(now);
+	}
+}
+
+
+
+int start_dns_resolver()
+{
+	int pid;
+
+	if (dns_queue==0)
+		return 0;
+	if (_res.nscount<=0){
+		LOG(L_ERR, "ERROR: start_dns_resolver: no dns servers\n");
+		return -1;
+	}
+	pid=fork_process(DNS_RESOLVER_RANK, "dns resolver", 1);
+	if (pid<0){
+		LOG(L_CRIT, "ERROR: start_dns_resolver: cannot fork\n");
+		return -1;
+	}
+	if (pid==0){
+		/* child */
+		dns_pfd_size=DNS_RESOLVER_PFD_SIZE;
+		dns_pfd=pkg_malloc(dns_pfd_size*sizeof(struct pollfd));
+		if (dns_pfd==0){
+			LOG(L_CRIT, "ERROR: start_dns_resolver: out of memory\n");
+			exit(-1);
+		}
+		dns_resolver_loop();
+	}
+	return 0;
+}
+
+#endif /* USE_DNS_CACHE */
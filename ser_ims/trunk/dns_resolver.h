@@ -0,0 +1,77 @@
+/*
+ * $Id$
+ *
+ * asynchronous dns resolver process
+ *
+ * This file is part of ser, a free SIP server.
+ *
+ * ser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * For a license to use the ser software under conditions
+ * other than those described here, or to purchase support for this
+ * software, please contact iptel.org by e-mail at the following addresses:
+ *    info@iptel.org
+ *
+ * ser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * With dns_cache_async enabled a dedicated process sends the dns requests to
+ * the servers from resolv.conf, each from its own non-blocking udp socket
+ * bound to a random port and with a random id.
+ * Workers queue requests (dns_resolve_async()) and are notified through a
+ * callback, run in the resolver process, once the answer is in the dns
+ * cache. The same process refreshes the popular cache entries before they
+ * expire (dns_cache_prefetch).
+ */
+
+#ifndef _dns_resolver_h
+#define _dns_resolver_h
+
+#ifdef USE_DNS_CACHE
+
+#include "str.h"
+
+#define DNS_RESOLVER_RANK	3001 /* rank given to child_init of the
+									resolver process */
+#define DNS_RESOLVER_TICK	100  /* ms, maximum poll() wait */
+#define DNS_RESOLVER_MAX_CNAME	10 /* cname chain length */
+#define DNS_RESOLVER_BIND_TRIES	10 /* random ports tried for a query socket */
+#define DNS_RESOLVER_PFD_SIZE	64 /* initial poll() array size, grows with
+									  the pending queries */
+#define DEFAULT_DNS_PREFETCH_TIME	10 /* s before expire */
+#define DEFAULT_DNS_PREFETCH_HITS	2  /* hits needed to be prefetched */
+
+extern int dns_async; /* 1 if the resolver process is used */
+extern unsigned int dns_prefetch_time; /* 0 disables prefetching */
+extern unsigned int dns_prefetch_hits;
+
+/* called in the resolver process when the request is done
+ * err==0 if the dns cache holds the answer (positive or negative),
+ *  <0 on error or time-out */
+typedef void (dns_async_cb_f)(int err, void* param);
+
+int init_dns_resolver();
+void destroy_dns_resolver();
+
+/* forks the resolver process, must be called from the main process */
+int start_dns_resolver();
+
+/* queues a name:type request for the resolver process
+ * param must be in shared memory (cb is called from another process)
+ * returns 0 if queued, <0 on error or if the resolver process is not used
+ *  (the caller should fall back to the blocking dns functions) */
+int dns_resolve_async(str* name, int type, dns_async_cb_f* cb, void* param);
+
+#endif /* USE_DNS_CACHE */
+#endif
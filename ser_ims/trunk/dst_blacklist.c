@@ -64,11 +64,15 @@ struct dst_blst_entry{
 #define DEFAULT_BLST_TIMEOUT		60  /* 1 min. */
 #define DEFAULT_BLST_MAX_MEM	250 /* 1 Kb FIXME (debugging)*/
 #define DEFAULT_BLST_TIMER_INTERVAL		60 /* 1 min */
+#define DST_BLST_HASH_LOCKS		128 /* lock stripes, power of 2,
+										   <= DST_BLST_HASH_SIZE */
 
 
-static gen_lock_t* blst_lock=0;
+/* hash bucket h is protected by the lock h&(DST_BLST_HASH_LOCKS-1) */
+static gen_lock_set_t* blst_locks=0;
 static struct timer_ln* blst_timer_h=0;
 
+/* mem. used, one counter per lock, written only with its lock held */
 static volatile unsigned int* blst_mem_used=0;
 unsigned int  blst_max_mem=DEFAULT_BLST_MAX_MEM; /* maximum memory used
 													for the blacklist entries*/
@@ -77,8 +81,26 @@ unsigned int blst_timer_interval=DEFAULT_BLST_TIMER_INTERVAL;
 struct dst_blst_entry** dst_blst_hash=0;
 
 
-#define LOCK_BLST()		lock_get(blst_lock)
-#define UNLOCK_BLST()	lock_release(blst_lock)
+#define blst_lock_no(h)		((h)&(DST_BLST_HASH_LOCKS-1))
+#define LOCK_BLST(h)		lock_set_get(blst_locks, blst_lock_no(h))
+#define UNLOCK_BLST(h)		lock_set_release(blst_locks, blst_lock_no(h))
+#define BLST_MEM_USED(h)	blst_mem_used[blst_lock_no(h)]
+
+
+
+/* returns the total memory used by the blacklist
+ * the per lock counters are read without locking, so the result
+ * is only an approximation */
+inline static unsigned int blst_mem_total()
+{
+	int i;
+	unsigned int total;
+	
+	total=0;
+	for (i=0; i<DST_BLST_HASH_LOCKS; i++)
+		total+=blst_mem_used[i];
+	return total;
+}
 
 
 inline static void blst_destroy_entry(struct dst_blst_entry* e)
@@ -128,10 +150,10 @@ void destroy_dst_blacklist()
 		timer_free(blst_timer_h);
 		blst_timer_h=0;
 	}
-	if (blst_lock){
-		lock_destroy(blst_lock);
-		lock_dealloc(blst_lock);
-		blst_lock=0;
+	if (blst_locks){
+		lock_set_destroy(blst_locks);
+		lock_set_dealloc(blst_locks);
+		blst_locks=0;
 	}
 	if (dst_blst_hash){
 		shm_free(dst_blst_hash);
@@ -148,27 +170,32 @@ void destroy_dst_blacklist()
 int init_dst_blacklist()
 {
 	int ret;
+	int r;
 	
 	ret=-1;
-	blst_mem_used=shm_malloc(sizeof(*blst_mem_used));
+	blst_mem_used=shm_malloc(sizeof(*blst_mem_used)*DST_BLST_HASH_LOCKS);
 	if (blst_mem_used==0){
 		ret=E_OUT_OF_MEM;
 		goto error;
 	}
+	for (r=0; r<DST_BLST_HASH_LOCKS; r++)
+		blst_mem_used[r]=0;
 	dst_blst_hash=shm_malloc(sizeof(struct dst_blst_entry*) *
 											DST_BLST_HASH_SIZE);
 	if (dst_blst_hash==0){
 		ret=E_OUT_OF_MEM;
 		goto error;
 	}
-	blst_lock=lock_alloc();
-	if (blst_lock==0){
+	memset(dst_blst_hash, 0, sizeof(struct dst_blst_entry*) *
+											DST_BLST_HASH_SIZE);
+	blst_locks=lock_set_alloc(DST_BLST_HASH_LOCKS);
+	if (blst_locks==0){
 		ret=E_OUT_OF_MEM;
 		goto error;
 	}
-	if (lock_init(blst_lock)==0){
-		lock_dealloc(blst_lock);
-		blst_lock=0;
+	if (lock_set_init(blst_locks)==0){
+		lock_set_dealloc(blst_locks);
+		blst_locks=0;
 		ret=-1;
 		goto error;
 	}
@@ -195,7 +222,7 @@ error:
 }
 
 
-/* must be called with the lock held
+/* must be called with the bucket lock held
  * struct dst_blst_entry** head, struct dst_blst_entry* e */
 #define dst_blacklist_lst_add(head, e)\
 do{ \
@@ -205,12 +232,12 @@ do{ \
 
 
 
-/* must be called with the lock held
+/* must be called with the lock of bucket h held
  * returns a pointer to the blacklist entry if found, 0 otherwise
  * it also deletes expired elements (expire<=now) as it searches
  * proto==PROTO_NONE = wildcard */
 inline static struct dst_blst_entry* _dst_blacklist_lst_find(
-												struct dst_blst_entry** head,
+												unsigned short h,
 												struct ip_addr* ip,
 												unsigned char proto,
 												unsigned short port,
@@ -222,12 +249,13 @@ inline static struct dst_blst_entry* _dst_blacklist_lst_find(
 	unsigned char type;
 	
 	type=(ip->af==AF_INET6)*BLST_IS_IPV6;
-	for (crt=head, tmp=&(*head)->next; *crt; crt=tmp, tmp=&(*crt)->next){
+	for (crt=&dst_blst_hash[h], tmp=&(*crt)->next; *crt;
+			crt=tmp, tmp=&(*crt)->next){
 		e=*crt;
 		/* remove old expired entries */
 		if ((s_ticks_t)(now-(*crt)->expire)>=0){
 			*crt=(*crt)->next;
-			*blst_mem_used-=DST_BLST_ENTRY_SIZE(*e);
+			BLST_MEM_USED(h)-=DST_BLST_ENTRY_SIZE(*e);
 			blst_destroy_entry(e);
 		}else if ((e->port==port) && ((e->flags & BLST_IS_IPV6)==type) &&
 				((e->proto==PROTO_NONE) || (proto==PROTO_NONE) ||
@@ -244,8 +272,8 @@ inline static struct dst_blst_entry* _dst_blacklist_lst_find(
 /* frees all the expired entries until either there are no more of them
  *  or the total memory used is <= target (to free all of them use -1 for 
  *  targer)
- *  It must be called with LOCK_BLST held (or call dst_blacklist_clean_expired
- *   instead).
+ *  Only one bucket is locked at a time (no bucket lock must be held by the
+ *   caller) and the next call continues where the previous one stopped.
  *  params:   target  - free expired entries until no more then taget memory 
  *                      is used  (use 0 to free all of them)
  *            delta   - consider an entry expired if it expires after delta
@@ -255,69 +283,54 @@ inline static struct dst_blst_entry* _dst_blacklist_lst_find(
  *  returns: number of deleted entries
  *  This function should be called periodically from a timer
  */
-inline static int _dst_blacklist_clean_expired_unsafe(unsigned int target,
+inline static int dst_blacklist_clean_expired(unsigned int target,
 												ticks_t delta,
 												ticks_t timeout)
 {
 	static unsigned short start=0;
 	unsigned short h;
+	unsigned short i;
 	struct dst_blst_entry** crt;
 	struct dst_blst_entry** tmp;
 	struct dst_blst_entry* e;
 	ticks_t start_time;
 	ticks_t now;
+	unsigned int used;
 	int no=0;
 	
 	now=start_time=get_ticks_raw();
-	for(h=start; h!=(start+DST_BLST_HASH_SIZE); h++){
-		for (crt=&dst_blst_hash[h%DST_BLST_HASH_SIZE], tmp=&(*crt)->next;
-				*crt; crt=tmp, tmp=&(*crt)->next){
-			e=*crt;
-			if ((s_ticks_t)(now+delta-(*crt)->expire)>=0){
-				*crt=(*crt)->next;
-				*blst_mem_used-=DST_BLST_ENTRY_SIZE(*e);
-				blst_destroy_entry(e);
-				no++;
-				if (*blst_mem_used<=target)
-					goto skip;
+	/* local estimation, updated with what we remove */
+	used=blst_mem_total();
+	for(i=0; i<DST_BLST_HASH_SIZE; i++){
+		h=(start+i)%DST_BLST_HASH_SIZE;
+		LOCK_BLST(h);
+			for (crt=&dst_blst_hash[h], tmp=&(*crt)->next;
+					*crt; crt=tmp, tmp=&(*crt)->next){
+				e=*crt;
+				if ((s_ticks_t)(now+delta-(*crt)->expire)>=0){
+					*crt=(*crt)->next;
+					BLST_MEM_USED(h)-=DST_BLST_ENTRY_SIZE(*e);
+					used=(used>DST_BLST_ENTRY_SIZE(*e))?
+							used-DST_BLST_ENTRY_SIZE(*e):0;
+					blst_destroy_entry(e);
+					no++;
+					if (used<=target){
+						UNLOCK_BLST(h);
+						goto skip;
+					}
+				}
 			}
-		}
+		UNLOCK_BLST(h);
 		/* check for timeout only "between" hash cells */
 		now=get_ticks_raw();
 		if ((now-start_time)>=timeout){
-			DBG("_dst_blacklist_clean_expired_unsafe: timeout: %d > %d\n",
+			DBG("dst_blacklist_clean_expired: timeout: %d > %d\n",
 					TICKS_TO_MS(now-start_time), TICKS_TO_MS(timeout));
 			goto skip;
 		}
 	}
 skip:
-	start=h; /* next time we start where we left */
-	return no;
-}
-
-
-
-/* frees all the expired entries until either there are no more of them
- *  or the total memory used is <= target (to free all of them use -1 for 
- *  targer)
- *  params:   target  - free expired entries until no more then taget memory 
- *                      is used  (use 0 to free all of them)
- *            delta   - consider an entry expired if it expires after delta
- *                      ticks from now
- *            timeout - exit after timeout ticks
- *
- *  returns: number of deleted entries
- *  This function should be called periodically from a timer
- */
-inline static int dst_blacklist_clean_expired(unsigned int target,
-												ticks_t delta,
-												ticks_t timeout)
-{
-	int no;
-	
-	LOCK_BLST();
-		no=_dst_blacklist_clean_expired_unsafe(target, delta, timeout);
-	UNLOCK_BLST();
+	start=(start+i)%DST_BLST_HASH_SIZE; /* next time we start where we left */
 	if (no){
 		DBG("dst_blacklist_clean_expired, %d entries removed\n", no);
 	}
@@ -360,28 +373,33 @@ inline static int dst_blacklist_add_ip(unsigned char err_flags,
 	now=get_ticks_raw();
 	hash=dst_blst_hash_no(proto, ip, port);
 	/* check if the entry already exists */
-	LOCK_BLST();
-		e=_dst_blacklist_lst_find(&dst_blst_hash[hash], ip, proto, port, now);
+	LOCK_BLST(hash);
+		e=_dst_blacklist_lst_find(hash, ip, proto, port, now);
+		if ((e==0) && ((blst_mem_total()+size)>=blst_max_mem)){
+			/* first try to free some memory  (~ 12%), but don't
+			 * spend more then 250 ms; the cleanup locks the buckets
+			 * one by one, so our bucket must be released meanwhile */
+			UNLOCK_BLST(hash);
+			dst_blacklist_clean_expired(blst_mem_total()/16*14, 0, 
+															MS_TO_TICKS(250));
+			LOCK_BLST(hash);
+			/* it might have been added in the meantime */
+			e=_dst_blacklist_lst_find(hash, ip, proto, port, now);
+			if ((e==0) && (blst_mem_total()+size>=blst_max_mem)){
+				ret=-1;
+				goto error;
+			}
+		}
 		if (e){
 			e->flags|=err_flags;
 			e->expire=now+S_TO_TICKS(blst_timeout); /* update the timeout */
 		}else{
-			if ((*blst_mem_used+size)>=blst_max_mem){
-				/* first try to free some memory  (~ 12%), but don't
-				 * spend more then 250 ms*/
-				_dst_blacklist_clean_expired_unsafe(*blst_mem_used/16*14, 0, 
-															MS_TO_TICKS(250));
-				if (*blst_mem_used+size>=blst_max_mem){
-					ret=-1;
-					goto error;
-				}
-			}
 			e=shm_malloc(size);
 			if (e==0){
 				ret=E_OUT_OF_MEM;
 				goto error;
 			}
-			*blst_mem_used+=size;
+			BLST_MEM_USED(hash)+=size;
 			e->flags=err_flags;
 			e->proto=proto;
 			e->port=port;
@@ -391,7 +409,7 @@ inline static int dst_blacklist_add_ip(unsigned char err_flags,
 			dst_blacklist_lst_add(&dst_blst_hash[hash], e);
 		}
 error:
-	UNLOCK_BLST();
+	UNLOCK_BLST(hash);
 	return ret;
 }
 
@@ -410,12 +428,12 @@ inline static int dst_is_blacklisted_ip(unsigned char proto,
 	ret=0;
 	now=get_ticks_raw();
 	hash=dst_blst_hash_no(proto, ip, port);
-	LOCK_BLST();
-		e=_dst_blacklist_lst_find(&dst_blst_hash[hash], ip, proto, port, now);
+	LOCK_BLST(hash);
+		e=_dst_blacklist_lst_find(hash, ip, proto, port, now);
 		if (e){
 			ret=e->flags;
 		}
-	UNLOCK_BLST();
+	UNLOCK_BLST(hash);
 	return ret;
 }
 
@@ -443,7 +461,7 @@ int dst_is_blacklisted(struct dest_info* si)
 /* rpc functions */
 void dst_blst_mem_info(rpc_t* rpc, void* ctx)
 {
-	rpc->add(ctx, "dd",  *blst_mem_used, blst_max_mem);
+	rpc->add(ctx, "dd",  blst_mem_total(), blst_max_mem);
 }
 
 
@@ -466,7 +484,8 @@ static char* get_proto_name(unsigned char proto)
 
 
 
-/* only for debugging, it helds the lock too long for "production" use */
+/* only for debugging, it helds the bucket locks too long for "production"
+ * use */
 void dst_blst_debug(rpc_t* rpc, void* ctx)
 {
 	int h;
@@ -475,8 +494,8 @@ void dst_blst_debug(rpc_t* rpc, void* ctx)
 	struct ip_addr ip;
 	
 	now=get_ticks_raw();
-	LOCK_BLST();
-		for(h=0; h<DST_BLST_HASH_SIZE; h++){
+	for(h=0; h<DST_BLST_HASH_SIZE; h++){
+		LOCK_BLST(h);
 			for(e=dst_blst_hash[h]; e; e=e->next){
 				dst_blst_entry2ip(&ip, e);
 				rpc->add(ctx, "ssddd", get_proto_name(e->proto), 
@@ -486,8 +505,8 @@ void dst_blst_debug(rpc_t* rpc, void* ctx)
 										-TICKS_TO_S(now-e->expire) ,
 										e->flags);
 			}
-		}
-	UNLOCK_BLST();
+		UNLOCK_BLST(h);
+	}
 }
 
 #endif /* USE_DST_BLACKLIST */
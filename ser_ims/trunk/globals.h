@@ -86,6 +86,7 @@ extern int tcp_con_lifetime; /* connection lifetime */
 extern enum poll_types tcp_poll_method;
 extern int tcp_max_fd_no;
 extern int tcp_max_connections;
+extern int tcp_wbuf_max; /* max. bytes queued for write per connection */
 #endif
 #ifdef USE_TLS
 extern int tls_disable;
@@ -122,6 +123,9 @@ extern int stun_allow_fp;
 #endif
 
 extern int tos;
+extern int udp_rcv_batch;
+extern int udp_reuseport;
+extern int udp_cpu_affinity;
 
 /*
  * debug & log_stderr moved to dprint.h*/
@@ -190,6 +194,9 @@ unsigned int dns_cache_min_ttl; /* minimum ttl */
 unsigned int dns_timer_interval; /* gc timer interval in s */
 int dns_flags; /* default flags used for the  dns_*resolvehost 
                     (compatibility wrappers) */
+extern int dns_async; /* 1 if the dns resolver process is used */
+extern unsigned int dns_prefetch_time; /* refresh entries expiring in (s) */
+extern unsigned int dns_prefetch_hits; /* min. lookups to be refreshed */
 #endif
 #ifdef USE_DST_BLACKLIST
 extern int use_dst_blacklist; /* 1 if the blacklist is enabled */
@@ -290,6 +290,7 @@ static void destroy_devpoll(io_wait_h* h)
 static int init_select(io_wait_h* h)
 {
 	FD_ZERO(&h->master_set);
+	FD_ZERO(&h->master_wset);
 	return 0;
 }
 #endif
@@ -29,7 +29,8 @@
  * All the functions are inline because of speed reasons and because they are
  * used only from 2 places.
  * You also have to define:
- *     int handle_io(struct fd_map* fm, int idx) (see below)
+ *     int handle_io(struct fd_map* fm, int idx) (see below, the events
+ *      that triggered it are in fm->revents)
  *     (this could be trivially replaced by a callback pointer entry attached
  *      to the io_wait handler if more flexibility rather then performance
  *      is needed)
@@ -114,6 +115,8 @@ struct fd_map{
 	int fd;               /* fd no */
 	fd_type type;         /* "data" type */
 	void* data;           /* pointer to the corresponding structure */
+	short events;         /* watched events (POLLIN, POLLIN|POLLOUT) */
+	short revents;        /* events that triggered the current handle_io */
 };
 
 
@@ -153,6 +156,7 @@ struct io_wait_handler{
 #endif
 #ifdef HAVE_SELECT
 	fd_set master_set;
+	fd_set master_wset; /* fds watched for write */
 	int max_fd_select; /* maximum select used fd */
 #endif
 	/* common stuff for POLL, SIGIO_RT and SELECT
@@ -177,6 +181,7 @@ typedef struct io_wait_handler io_wait_h;
 	do{ \
 		(pfm)->type=0 /*F_NONE */; \
 		(pfm)->fd=-1; \
+		(pfm)->events=0; \
 	}while(0)
 
 /* add a fd_map structure to the fd hash */
@@ -188,6 +193,8 @@ static inline struct fd_map* hash_fd_map(	io_wait_h* h,
 	h->fd_hash[fd].fd=fd;
 	h->fd_hash[fd].type=type;
 	h->fd_hash[fd].data=data;
+	h->fd_hash[fd].events=POLLIN;
+	h->fd_hash[fd].revents=0;
 	return &h->fd_hash[fd];
 }
 
@@ -442,7 +449,8 @@ again_devpoll:
 		pf.fd=fd;
 		pf.events=POLLIN;
 check_io_again:
-		while( ((n=poll(&pf, 1, 0))>0) && (handle_io(e, idx)>0));
+		while( ((n=poll(&pf, 1, 0))>0) && ((e->revents=pf.revents), 1) &&
+				(handle_io(e, idx)>0));
 		if (n==-1){
 			if (errno==EINTR) goto check_io_again;
 			LOG(L_ERR, "ERROR: io_watch_add: check_io poll: %s [%d]\n",
@@ -499,6 +507,9 @@ inline static int io_watch_del(io_wait_h* h, int fd, int idx, int flags)
 #ifdef HAVE_SIGIO_RT
 	int fd_flags;
 #endif
+#ifdef HAVE_KQUEUE
+	short events;
+#endif
 	
 	if ((fd<0) || (fd>=h->max_fd_no)){
 		LOG(L_CRIT, "BUG: io_watch_del: invalid fd %d, not in [0, %d) \n",
@@ -521,6 +532,9 @@ inline static int io_watch_del(io_wait_h* h, int fd, int idx, int flags)
 		goto error;
 	}
 	
+#ifdef HAVE_KQUEUE
+	events=e->events;
+#endif
 	unhash_fd_map(e);
 	
 	switch(h->poll_method){
@@ -531,6 +545,7 @@ inline static int io_watch_del(io_wait_h* h, int fd, int idx, int flags)
 		case POLL_SELECT:
 			fix_fd_array;
 			FD_CLR(fd, &h->master_set);
+			FD_CLR(fd, &h->master_wset);
 			if (h->max_fd_select && (h->max_fd_select==fd))
 				/* we don't know the prev. max, so we just decrement it */
 				h->max_fd_select--; 
@@ -587,6 +602,9 @@ inline static int io_watch_del(io_wait_h* h, int fd, int idx, int flags)
 			if (!(flags & IO_FD_CLOSING)){
 				if (kq_ev_change(h, fd, EVFILT_READ, EV_DELETE, 0)==-1)
 					goto error;
+				if ((events & POLLOUT) &&
+						(kq_ev_change(h, fd, EVFILT_WRITE, EV_DELETE, 0)==-1))
+					goto error;
 			}
 			break;
 #endif
@@ -622,6 +640,148 @@ error:
 
 
 
+/* changes the events watched on an already added fd
+ * parameters:    h - handler
+ *               fd - file descriptor
+ *           events - new events: POLLIN, POLLOUT or POLLIN|POLLOUT
+ *            index - index in the fd_array if known, -1 if not
+ * returns 0 if ok, -1 on error */
+inline static int io_watch_chg(io_wait_h* h, int fd, short events, int idx)
+{
+	
+#define fix_fd_array \
+	do{\
+			if (idx==-1){ \
+				/* fix idx if -1 and needed */ \
+				for (idx=0; (idx<h->fd_no) && \
+							(h->fd_array[idx].fd!=fd); idx++); \
+			} \
+			if (idx<h->fd_no) \
+				h->fd_array[idx].events=events; \
+	}while(0)
+	
+	struct fd_map* e;
+	short add;
+	short del;
+#ifdef HAVE_EPOLL
+	int n;
+	struct epoll_event ep_event;
+#endif
+#ifdef HAVE_DEVPOLL
+	struct pollfd pfd;
+#endif
+	
+	if ((fd<0) || (fd>=h->max_fd_no)){
+		LOG(L_CRIT, "BUG: io_watch_chg: invalid fd %d, not in [0, %d) \n",
+						fd, h->fd_no);
+		goto error;
+	}
+	DBG("DBG: io_watch_chg (%p, %d, 0x%x, %d) fd_no=%d called\n",
+			h, fd, events, idx, h->fd_no);
+	e=get_fd_map(h, fd);
+	if (e==0 || e->type==0 /*F_NONE*/){
+		LOG(L_ERR, "ERROR: io_watch_chg: trying to change an unwatched"
+				" fd %d\n", fd);
+		goto error;
+	}
+	if (e->events==events)
+		return 0;
+	add=events & ~e->events;
+	del=e->events & ~events;
+	
+	switch(h->poll_method){
+		case POLL_POLL:
+			fix_fd_array;
+			break;
+#ifdef HAVE_SELECT
+		case POLL_SELECT:
+			fix_fd_array;
+			if (add & POLLIN)  FD_SET(fd, &h->master_set);
+			if (add & POLLOUT) FD_SET(fd, &h->master_wset);
+			if (del & POLLIN)  FD_CLR(fd, &h->master_set);
+			if (del & POLLOUT) FD_CLR(fd, &h->master_wset);
+			break;
+#endif
+#ifdef HAVE_SIGIO_RT
+		case POLL_SIGIO_RT:
+			/* signals are generated for all the events anyway, the
+			 * handle_io code must check fm->revents */
+			fix_fd_array;
+			break;
+#endif
+#ifdef HAVE_EPOLL
+		case POLL_EPOLL_LT:
+		case POLL_EPOLL_ET:
+			ep_event.events=((events & POLLIN)?EPOLLIN:0) |
+							((events & POLLOUT)?EPOLLOUT:0) |
+							((h->poll_method==POLL_EPOLL_ET)?EPOLLET:0);
+			ep_event.data.ptr=e;
+again_epoll:
+			n=epoll_ctl(h->epfd, EPOLL_CTL_MOD, fd, &ep_event);
+			if (n==-1){
+				if (errno==EAGAIN) goto again_epoll;
+				LOG(L_ERR, "ERROR: io_watch_chg: epoll_ctl failed: %s [%d]\n",
+					strerror(errno), errno);
+				goto error;
+			}
+			break;
+#endif
+#ifdef HAVE_KQUEUE
+		case POLL_KQUEUE:
+			if ((add & POLLIN) &&
+					(kq_ev_change(h, fd, EVFILT_READ, EV_ADD, e)==-1))
+				goto error;
+			if ((add & POLLOUT) &&
+					(kq_ev_change(h, fd, EVFILT_WRITE, EV_ADD, e)==-1))
+				goto error;
+			if ((del & POLLIN) &&
+					(kq_ev_change(h, fd, EVFILT_READ, EV_DELETE, 0)==-1))
+				goto error;
+			if ((del & POLLOUT) &&
+					(kq_ev_change(h, fd, EVFILT_WRITE, EV_DELETE, 0)==-1))
+				goto error;
+			break;
+#endif
+#ifdef HAVE_DEVPOLL
+		case POLL_DEVPOLL:
+				/* /dev/poll only ors the events, remove & re-add */
+				pfd.fd=fd;
+				pfd.events=POLLREMOVE;
+				pfd.revents=0;
+again_devpoll1:
+				if (write(h->dpoll_fd, &pfd, sizeof(pfd))==-1){
+					if (errno==EINTR) goto again_devpoll1;
+					LOG(L_ERR, "ERROR: io_watch_chg: removing fd from "
+								"/dev/poll failed: %s [%d]\n", 
+								strerror(errno), errno);
+					goto error;
+				}
+				pfd.events=events;
+again_devpoll2:
+				if (write(h->dpoll_fd, &pfd, sizeof(pfd))==-1){
+					if (errno==EINTR) goto again_devpoll2;
+					LOG(L_ERR, "ERROR: io_watch_chg: re-adding fd to "
+								"/dev/poll failed: %s [%d]\n", 
+								strerror(errno), errno);
+					goto error;
+				}
+				break;
+#endif
+		default:
+			LOG(L_CRIT, "BUG: io_watch_chg: no support for poll method "
+					" %s (%d)\n", poll_method_str[h->poll_method], 
+					h->poll_method);
+			goto error;
+	}
+	e->events=events;
+	return 0;
+error:
+	return -1;
+#undef fix_fd_array
+}
+
+
+
 /* io_wait_loop_x style function 
  * wait for io using poll()
  * params: h      - io_wait handle
@@ -633,6 +793,7 @@ inline static int io_wait_loop_poll(io_wait_h* h, int t, int repeat)
 {
 	int n, r;
 	int ret;
+	struct fd_map* fm;
 again:
 		ret=n=poll(h->fd_array, h->fd_no, t*1000);
 		if (n==-1){
@@ -644,7 +805,7 @@ again:
 			}
 		}
 		for (r=0; (r<h->fd_no) && n; r++){
-			if (h->fd_array[r].revents & (POLLIN|POLLERR|POLLHUP)){
+			if (h->fd_array[r].revents & (POLLIN|POLLOUT|POLLERR|POLLHUP)){
 				n--;
 				/* sanity checks */
 				if ((h->fd_array[r].fd >= h->max_fd_no)||
@@ -656,8 +817,9 @@ again:
 					h->fd_array[r].events=0; /* clear the events */
 					continue;
 				}
-				while((handle_io(get_fd_map(h, h->fd_array[r].fd), r) > 0)
-						 && repeat);
+				fm=get_fd_map(h, h->fd_array[r].fd);
+				fm->revents=h->fd_array[r].revents;
+				while((handle_io(fm, r) > 0) && repeat);
 			}
 		}
 error:
@@ -671,15 +833,19 @@ error:
 inline static int io_wait_loop_select(io_wait_h* h, int t, int repeat)
 {
 	fd_set sel_set;
+	fd_set sel_wset;
 	int n, ret;
 	struct timeval timeout;
 	int r;
+	struct fd_map* fm;
+	short revents;
 	
 again:
 		sel_set=h->master_set;
+		sel_wset=h->master_wset;
 		timeout.tv_sec=t;
 		timeout.tv_usec=0;
-		ret=n=select(h->max_fd_select+1, &sel_set, 0, 0, &timeout);
+		ret=n=select(h->max_fd_select+1, &sel_set, &sel_wset, 0, &timeout);
 		if (n<0){
 			if (errno==EINTR) goto again; /* just a signal */
 			LOG(L_ERR, "ERROR: io_wait_loop_select: select: %s [%d]\n",
@@ -689,10 +855,13 @@ again:
 		}
 		/* use poll fd array */
 		for(r=0; (r<h->max_fd_no) && n; r++){
-			if (FD_ISSET(h->fd_array[r].fd, &sel_set)){
-				while((handle_io(get_fd_map(h, h->fd_array[r].fd), r)>0)
-						&& repeat);
-				n--;
+			revents=(FD_ISSET(h->fd_array[r].fd, &sel_set)?POLLIN:0) |
+					(FD_ISSET(h->fd_array[r].fd, &sel_wset)?POLLOUT:0);
+			if (revents){
+				fm=get_fd_map(h, h->fd_array[r].fd);
+				fm->revents=revents;
+				while((handle_io(fm, r)>0) && repeat);
+				n-=((revents & POLLIN)!=0)+((revents & POLLOUT)!=0);
 			}
 		};
 	return ret;
@@ -705,6 +874,7 @@ again:
 inline static int io_wait_loop_epoll(io_wait_h* h, int t, int repeat)
 {
 	int n, r;
+	struct fd_map* fm;
 	
 again:
 		n=epoll_wait(h->epfd, h->ep_array, h->fd_no, t*1000);
@@ -727,9 +897,13 @@ again:
 		}
 #endif
 		for (r=0; r<n; r++){
-			if (h->ep_array[r].events & (EPOLLIN|EPOLLERR|EPOLLHUP)){
-				while((handle_io((struct fd_map*)h->ep_array[r].data.ptr,-1)>0)
-					&& repeat);
+			if (h->ep_array[r].events & (EPOLLIN|EPOLLOUT|EPOLLERR|EPOLLHUP)){
+				fm=(struct fd_map*)h->ep_array[r].data.ptr;
+				fm->revents=((h->ep_array[r].events & EPOLLIN)?POLLIN:0) |
+							((h->ep_array[r].events & EPOLLOUT)?POLLOUT:0) |
+							((h->ep_array[r].events & EPOLLERR)?POLLERR:0) |
+							((h->ep_array[r].events & EPOLLHUP)?POLLHUP:0);
+				while((handle_io(fm, -1)>0) && repeat);
 			}else{
 				LOG(L_ERR, "ERROR:io_wait_loop_epoll: unexpected event %x"
 							" on %d/%d, data=%p\n", h->ep_array[r].events,
@@ -747,6 +921,7 @@ error:
 inline static int io_wait_loop_kqueue(io_wait_h* h, int t, int repeat)
 {
 	int n, r;
+	struct fd_map* fm;
 	struct timespec tspec;
 	
 	tspec.tv_sec=t;
@@ -778,9 +953,12 @@ again:
 							"fd %d: %s [%ld]\n", h->kq_array[r].ident,
 							strerror(h->kq_array[r].data),
 							(long)h->kq_array[r].data);
-			}else /* READ/EOF */
-				while((handle_io((struct fd_map*)h->kq_array[r].udata, -1)>0)
-						&& repeat);
+			}else{ /* READ/WRITE/EOF */
+				fm=(struct fd_map*)h->kq_array[r].udata;
+				fm->revents=(h->kq_array[r].filter==EVFILT_WRITE)?
+								POLLOUT:POLLIN;
+				while((handle_io(fm, -1)>0) && repeat);
+			}
 		}
 error:
 	return n;
@@ -850,8 +1028,10 @@ again:
 			fm=get_fd_map(h, sigio_fd);
 			/* we can have queued signals generated by fds not watched
 			 * any more, or by fds in transition, to a child => ignore them*/
-			if (fm->type)
+			if (fm->type){
+				fm->revents=POLLIN;
 				handle_io(fm, -1);
+			}
 		}else{
 #ifdef EXTRA_DEBUG
 			DBG("io_wait_loop_sigio_rt: siginfo: signal=%d (%d),"
@@ -869,9 +1049,10 @@ again:
 				/* we can have queued signals generated by fds not watched
 			 	 * any more, or by fds in transition, to a child 
 				 * => ignore them */
-				if (fm->type)
+				if (fm->type){
+					fm->revents=sigio_band;
 					handle_io(fm, -1);
-				else
+				}else
 					LOG(L_ERR, "WARNING: io_wait_loop_sigio_rt: ignoring event"
 							" %x on fd %d (fm->fd=%d, fm->data=%p)\n",
 							sigio_band, sigio_fd, fm->fd, fm->data);
@@ -912,6 +1093,7 @@ inline static int io_wait_loop_devpoll(io_wait_h* h, int t, int repeat)
 {
 	int n, r;
 	int ret;
+	struct fd_map* fm;
 	struct dvpoll dpoll;
 
 		dpoll.dp_timeout=t*1000;
@@ -934,8 +1116,9 @@ again:
 							h->fd_array[r].fd, h->fd_array[r].revents);
 			}
 			/* POLLIN|POLLHUP just go through */
-			while((handle_io(get_fd_map(h, h->fd_array[r].fd), r) > 0) &&
-						repeat);
+			fm=get_fd_map(h, h->fd_array[r].fd);
+			fm->revents=h->fd_array[r].revents;
+			while((handle_io(fm, r) > 0) && repeat);
 		}
 error:
 	return ret;
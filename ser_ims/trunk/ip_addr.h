@@ -92,7 +92,8 @@ union sockaddr_union{
 
 
 
-enum si_flags { SI_NONE=0, SI_IS_IP=1, SI_IS_LO=2, SI_IS_MCAST=4 };
+enum si_flags { SI_NONE=0, SI_IS_IP=1, SI_IS_LO=2, SI_IS_MCAST=4,
+				SI_REUSEPORT=8 };
 
 struct socket_info{
 	int socket;
@@ -101,9 +102,11 @@ struct socket_info{
 	str address_str;        /* ip address converted to string -- optimization*/
 	unsigned short port_no;  /* port number */
 	str port_no_str; /* port number converted to string -- optimization*/
-	enum si_flags flags; /* SI_IS_IP | SI_IS_LO | SI_IS_MCAST */
+	enum si_flags flags; /* SI_IS_IP | SI_IS_LO | SI_IS_MCAST | SI_REUSEPORT */
 	union sockaddr_union su; 
 	int proto; /* tcp or udp*/
+	int* child_sockets; /* udp SO_REUSEPORT sockets, one per receiver child
+						   (udp_reuseport), 0 if the socket is shared */
 	struct socket_info* next;
 	struct socket_info* prev;
 };
@@ -147,6 +147,7 @@
 #include "atomic_ops_init.h"
 #ifdef USE_DNS_CACHE
 #include "dns_cache.h"
+#include "dns_resolver.h"
 #endif
 #ifdef USE_DST_BLACKLIST
 #include "dst_blacklist.h"
@@ -347,6 +348,9 @@ int use_dst_blacklist=0; /* 1 if the blacklist is enabled */
 #endif
 
 int tos = IPTOS_LOWDELAY;
+int udp_rcv_batch = 1; /* datagrams read with one recvmmsg(), 1 = recvfrom() */
+int udp_reuseport = 0; /* 1 if each udp receiver has its own SO_REUSEPORT socket*/
+int udp_cpu_affinity = 0; /* 1 if udp receiver child i is pinned to cpu i */
 
 #if 0
 char* names[MAX_LISTEN];              /* our names */
@@ -438,6 +442,7 @@ void cleanup(show_status)
 					 allow an almost gracious shutdown */
 	destroy_modules();
 #ifdef USE_DNS_CACHE
+	destroy_dns_resolver();
 	destroy_dns_cache();
 #endif
 #ifdef USE_DST_BLACKLIST
@@ -959,7 +964,11 @@ int main_loop()
 		for(si=udp_listen;si;si=si->next){
 			/* create the listening socket (for each address)*/
 			/* udp */
+			if (udp_reuseport && !(si->flags & SI_IS_MCAST))
+				si->flags|=SI_REUSEPORT;
 			if (udp_init(si)==-1) goto error;
+			/* and the ones of the receivers, while we still can bind */
+			if (udp_init_reuseport(si, children_no)==-1) goto error;
 			/* get first ipv4/ipv6 socket*/
 			if ((si->address.af==AF_INET)&&
 					((sendipv4==0)||(sendipv4->flags&SI_IS_LO)))
@@ -1018,6 +1027,14 @@ int main_loop()
 					goto error;
 				}else if (pid==0){
 					/* child */
+					if (si->child_sockets){
+						/* receive & send on this child's own socket */
+						si->socket=si->child_sockets[i];
+						DBG("main_loop: receiver %d on SO_REUSEPORT socket"
+								" %d\n", i, si->socket);
+					}
+					if (udp_cpu_affinity)
+						set_process_cpu(i);
 					bind_address=si; /* shortcut */
 #ifdef STATS
 					setstats( i+r*children_no );
@@ -1071,6 +1088,11 @@ int main_loop()
 		goto error;
 	}
 
+#ifdef USE_DNS_CACHE
+	/* dns resolver (before tcp main, it has a tcp. comm. fd) */
+	if (start_dns_resolver()<0) goto error;
+#endif
+
 #ifdef USE_TCP
 		if (!tcp_disable){
 				/* start tcp  & tls receivers */
@@ -1140,6 +1162,9 @@ static int calc_proc_no(void)
 #ifdef USE_SLOW_TIMER
 		+ 1 /* slow timer process */
 #endif
+#ifdef USE_DNS_CACHE
+		+ ((use_dns_cache && dns_async)?1:0) /* dns resolver process */
+#endif
 #ifdef USE_TCP
 		+((!tcp_disable)?( 1/* tcp main */ + tcp_children_no ):0)
 #endif
@@ -1529,6 +1554,15 @@ try_again:
 	}
 	if (use_dns_cache==0)
 		use_dns_failover=0; /* cannot work w/o dns_cache support */
+	if (dns_async && (use_dns_cache==0 || dont_fork)){
+		LOG(L_WARN, "WARNING: dns_cache_async needs use_dns_cache and"
+					" fork enabled, disabling it\n");
+		dns_async=0;
+	}
+	if (init_dns_resolver()<0){
+		LOG(L_CRIT, "could not initialize the dns resolver, exiting...\n");
+		goto error;
+	}
 #endif
 #ifdef USE_DST_BLACKLIST
 	if (init_dst_blacklist()<0){
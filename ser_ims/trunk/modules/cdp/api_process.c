@@ -58,13 +58,52 @@
 #include "peerstatemachine.h"
 
 
-handler_list *handlers = 0; /**< list of handlers */
+handler_list *handlers = 0; /**< list of handlers for all applications */
+handler_list *app_handlers = 0; /**< hash table of handlers by Application-Id */
 gen_lock_t *handlers_lock;	/**< lock for list of handlers */
 
+/**
+ * Calls the handlers of a list that match the message.
+ * Must be called with handlers_lock taken, which is released during the calls.
+ * @param p - peer that this message came from
+ * @param msg - the diameter message
+ * @param l - the list of handlers
+ * @param type - type of handlers to call
+ * @param any_app - if the handlers are for all applications, else only the
+ * ones for the Application-Id of the message are called
+ */
+static inline void api_call_handlers(peer *p,AAAMessage *msg,handler_list *l,
+	enum handler_types type,int any_app)
+{
+	handler *h;
+	handler x;
+	AAAMessage *rsp;
+	
+	for(h=l->head;h;h=h->next){
+		if (h->type!=type) continue;
+		if (!any_app && h->app_id!=msg->applicationId) continue;
+		x.handler = h->handler;
+		x.param = h->param;
+		lock_release(handlers_lock);
+		if (type == REQUEST_HANDLER) {
+			rsp = (x.handler.requestHandler)(msg,x.param);
+			if (rsp) {
+				//peer_send_msg(p,rsp);
+				sm_process(p,Send_Message,rsp,0,0);	
+			}
+		}
+		else {
+			(x.handler.responseHandler)(msg,x.param);
+		}
+		lock_get(handlers_lock);
+	}
+}
+
 /**
  * This callback is added as an internal message listener and used to process
  * transaction requests. 
- * - first it calls all the registered handlers for requests and responses
+ * - first it calls the handlers registered for the Application-Id of the 
+ * message, then the ones registered for all applications
  * - then it calls the transaction handler
  * @param p - peer that this message came from
  * @param msg - the diameter message
@@ -75,33 +114,13 @@ int api_callback(peer *p,AAAMessage *msg,void* ptr)
 {
 	cdp_trans_t *t;
 	int auto_drop;	
-	handler *h;
-	handler x;
 	enum handler_types type;
-	AAAMessage *rsp;
 	if (is_req(msg)) type = REQUEST_HANDLER;
 	else type=RESPONSE_HANDLER;
 
 	lock_get(handlers_lock);
-		for(h=handlers->head;h;h=h->next){
-			if (h->type==type){
-				x.handler = h->handler;
-				if (h->type == REQUEST_HANDLER) {
-					lock_release(handlers_lock);
-					rsp = (x.handler.requestHandler)(msg,h->param);
-					if (rsp) {
-						//peer_send_msg(p,rsp);
-						sm_process(p,Send_Message,rsp,0,0);	
-					}
-					lock_get(handlers_lock);
-				}
-				else {
-					lock_release(handlers_lock);
-					(x.handler.responseHandler)(msg,h->param);
-					lock_get(handlers_lock);
-				}
-			}
-		}		
+		api_call_handlers(p,msg,app_handlers+msg->applicationId%APP_HANDLERS_HASH_SIZE,type,0);
+		api_call_handlers(p,msg,handlers,type,1);
 	lock_release(handlers_lock);
 	
 	if (!is_req(msg)){		
@@ -71,6 +71,7 @@ enum handler_types {
  */ 
 typedef struct handler_t{
 	enum handler_types type;					/**< type of the handler */
+	AAAApplicationId app_id;					/**< Application-Id, for the handlers in app_handlers */
 	union {
 		AAARequestHandler_f *requestHandler;	/**< request callback function */
 		AAAResponseHandler_f *responseHandler;  /**< response callback function */
@@ -84,6 +85,9 @@ typedef struct handler_list_t{
 	handler *head;				/**< first handler in the list */
 	handler *tail;				/**< last handler in the list */
 } handler_list;
+
+/** size of the hash table of handlers by Application-Id */
+#define APP_HANDLERS_HASH_SIZE	16
 		
 int api_callback(peer *p,AAAMessage *msg,void* ptr);
 
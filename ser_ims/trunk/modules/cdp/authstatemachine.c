@@ -292,7 +292,8 @@ inline int auth_client_statefull_sm_process(cdp_session_t* s, int event, AAAMess
 				case AUTH_EV_SESSION_TIMEOUT:
 				case AUTH_EV_SERVICE_TERMINATED:
 				case AUTH_EV_SESSION_GRACE_TIMEOUT:
-					Session_Cleanup(s,NULL);					
+					Session_Cleanup(s,NULL);
+					s = 0;
 					break;					
 					
 				default:
@@ -406,6 +407,7 @@ inline int auth_client_statefull_sm_process(cdp_session_t* s, int event, AAAMess
 	}
 	if (s) {
 		if (s->cb) (s->cb)(AUTH_EV_SESSION_MODIFIED,s);
+		cdp_session_expiry_update(s);
 		AAASessionsUnlock(s->hash);
 	}
 	return rv;
@@ -544,6 +546,7 @@ inline void auth_server_statefull_sm_process(cdp_session_t* s, int event, AAAMes
 	}	
 	if (s) {
 		if (s->cb) (s->cb)(AUTH_EV_SESSION_MODIFIED,s);			
+		cdp_session_expiry_update(s);
 		AAASessionsUnlock(s->hash);
 	}
 }
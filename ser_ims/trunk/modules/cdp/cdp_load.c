@@ -98,6 +98,8 @@ int load_cdp( struct cdp_binds *cdpb)
 
 	FIND_EXP(AAAAddRequestHandler);
 	FIND_EXP(AAAAddResponseHandler);
+	FIND_EXP(AAAAddAppRequestHandler);
+	FIND_EXP(AAAAddAppResponseHandler);
 
 
 	FIND_EXP(AAACreateTransaction);
@@ -116,6 +118,7 @@ int load_cdp( struct cdp_binds *cdpb)
 	FIND_EXP(AAAGetAuthSession);
 	FIND_EXP(AAADropAuthSession);
 	FIND_EXP(AAATerminateAuthSession);
+	FIND_EXP(AAAUpdateAuthSessionTimers);
 	
 	return 1;
 }
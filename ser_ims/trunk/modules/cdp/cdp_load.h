@@ -89,6 +89,8 @@ struct cdp_binds {
 	
 	AAAAddRequestHandler_f		AAAAddRequestHandler;
 	AAAAddResponseHandler_f		AAAAddResponseHandler;
+	AAAAddAppRequestHandler_f	AAAAddAppRequestHandler;
+	AAAAddAppResponseHandler_f	AAAAddAppResponseHandler;
 
 
 	AAACreateTransaction_f		AAACreateTransaction;
@@ -107,6 +109,7 @@ struct cdp_binds {
 	AAAGetAuthSession_f			AAAGetAuthSession;
 	AAADropAuthSession_f		AAADropAuthSession;
 	AAATerminateAuthSession_f	AAATerminateAuthSession;
+	AAAUpdateAuthSessionTimers_f AAAUpdateAuthSessionTimers;
 
 };
 
@@ -101,6 +101,7 @@ inline routing_entry *new_routing_entry()
 		goto error;
 	}	
 	memset(x,0,sizeof(routing_entry));
+	x->weight = 1;
 	return x;
 error:
 	LOG(L_ERR,"ERROR:%s(): failed to create new routing_entry.\n",__FUNCTION__);	
@@ -118,6 +119,36 @@ inline void free_routing_entry(routing_entry *re)
 	shm_free(re);
 }
 
+/**
+ * Parses the name of a routing policy, as in the policy attribute of the Realm element.
+ * @param s - the name; unknown names or NULL give the default failover policy
+ * @returns the routing policy
+ */
+routing_policy routing_policy_from_str(char *s)
+{
+	if (!s) return DP_ROUTE_FAILOVER;
+	if (strcasecmp(s,"round-robin")==0) return DP_ROUTE_ROUND_ROBIN;
+	if (strcasecmp(s,"least-pending")==0) return DP_ROUTE_LEAST_PENDING;
+	if (strcasecmp(s,"session-hash")==0) return DP_ROUTE_SESSION_HASH;
+	if (strcasecmp(s,"failover")!=0)
+		LOG(L_ERR,"ERROR:routing_policy_from_str(): Unknown routing policy <%s> - using failover\n",s);
+	return DP_ROUTE_FAILOVER;
+}
+
+/**
+ * Returns the name of a routing policy.
+ * @param p - the routing policy
+ */
+char* routing_policy_to_str(routing_policy p)
+{
+	switch(p){
+		case DP_ROUTE_ROUND_ROBIN: return "round-robin";
+		case DP_ROUTE_LEAST_PENDING: return "least-pending";
+		case DP_ROUTE_SESSION_HASH: return "session-hash";
+		default: return "failover";
+	}
+}
+
 /** 
  * Free the space claimed by a routing realm
  */
@@ -199,6 +230,7 @@ inline void log_dp_config(int level,dp_config *x)
 	LOG(level,"\tConnTime: %d\n",x->connect_timeout);
 	LOG(level,"\tTranTime: %d\n",x->transaction_timeout);
 	LOG(level,"\tSessHash: %d\n",x->sessions_hash_size);
+	LOG(level,"\tTranHash: %d\n",x->transactions_hash_size);
 	LOG(level,"\tDefAuthT: %d\n",x->default_auth_session_timeout);
 	LOG(level,"\tMaxAuthT: %d\n",x->max_auth_session_timeout);
 	LOG(level,"\tPeers   : %d\n",x->peers_cnt);
@@ -227,15 +259,16 @@ inline void log_dp_config(int level,dp_config *x)
 		routing_entry *re;
 		LOG(level,"\tRouting Table : \n");
 		for(rr=x->r_table->realms;rr;rr=rr->next){
-			LOG(level,"\t\tRealm: %.*s\n",
-				rr->realm.len,rr->realm.s);
+			LOG(level,"\t\tRealm: %.*s \t Policy: %s\n",
+				rr->realm.len,rr->realm.s,routing_policy_to_str(rr->policy));
 			for(re=rr->routes;re;re=re->next)		
-				LOG(level,"\t\t\tRoute: [%4d] %.*s\n",
-					re->metric,re->fqdn.len,re->fqdn.s);			
+				LOG(level,"\t\t\tRoute: [%4d] %.*s \t Weight: %d\n",
+					re->metric,re->fqdn.len,re->fqdn.s,re->weight);			
 		}
+		LOG(level,"\t\tDefaultRoute Policy: %s\n",routing_policy_to_str(x->r_table->policy));
 		for(re=x->r_table->routes;re;re=re->next)		
-			LOG(level,"\t\tDefaultRoute: [%4d] %.*s\n",
-				re->metric,re->fqdn.len,re->fqdn.s);			
+			LOG(level,"\t\tDefaultRoute: [%4d] %.*s \t Weight: %d\n",
+				re->metric,re->fqdn.len,re->fqdn.s,re->weight);			
 	}
 	
 }
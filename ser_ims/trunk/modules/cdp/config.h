@@ -82,16 +82,30 @@ typedef struct {
 	app_type type;			/**< type of the application */
 } app_config;
 
+/** Maximum weight of a route */
+#define DP_ROUTE_MAX_WEIGHT 100
+
+/** How to choose among the connected routes of a realm */
+typedef enum {
+	DP_ROUTE_FAILOVER		= 0,	/**< the first connected route, in metric order */
+	DP_ROUTE_ROUND_ROBIN	= 1,	/**< weighted round-robin among the best metric connected routes */
+	DP_ROUTE_LEAST_PENDING	= 2,	/**< the best metric connected route with the fewest requests per weight in flight */
+	DP_ROUTE_SESSION_HASH	= 3		/**< the same Session-Id always to the same best metric connected route */
+} routing_policy;
+
 /** Routing Table Entry */
 typedef struct _routing_entry {
 	str fqdn;				/**< FQDN of the server 				*/
 	int metric;				/**< The metric of the route			*/
+	int weight;				/**< The weight for load-balancing among the same metric */
 	struct _routing_entry *next;
 } routing_entry;
 
 /** Routing Table realm */
 typedef struct _routing_realm {
 	str realm;				/**< the realm to identify				*/
+	routing_policy policy;	/**< how to choose among the routes		*/
+	unsigned int rr_next;	/**< round-robin counter				*/
 	routing_entry *routes;	/**< ordered list of routes				*/
 	struct _routing_realm *next; /**< the next realm in the table	*/
 } routing_realm;
@@ -99,6 +113,8 @@ typedef struct _routing_realm {
 /** Routing Table configuration */
 typedef struct {
 	routing_realm *realms;	/**< list of realms				 	*/
+	routing_policy policy;	/**< how to choose among the default routes */
+	unsigned int rr_next;	/**< round-robin counter for the default routes */
 	routing_entry *routes;	/**< ordered list of default routes 	*/
 } routing_table;
 
@@ -116,12 +132,13 @@ typedef struct {
 									 to you before */
 	int tc;						/**< Tc timer duration (30 seconds should be) */
 	int workers;				/**< Number of worker-processes to fork */
-	int queue_length;			/**< Length of the message queue; when it is filled, the server part will
+	int queue_length;			/**< Length of the message queue of each worker; when it is filled, the server part will
 									 block until workers will finish work on at least one item in the queue */
 	int connect_timeout;		/**< Connect timeout for outbound connections */
 	int transaction_timeout;	/**< Transaction timeout duration */
 	
 	int sessions_hash_size;		/**< Size of the sessions hash table */									 
+	int transactions_hash_size;	/**< Size of the transactions hash table */
 	int default_auth_session_timeout; /** The default Authorization Session Timeout to use if none other indicated */ 
 	int max_auth_session_timeout;	  /** The max Authorization Session Timeout limit */ 
 	
@@ -147,6 +164,8 @@ routing_entry *new_routing_entry();
 void free_dp_config(dp_config *x);
 void free_routing_realm(routing_realm *rr);
 void free_routing_entry(routing_entry *re);
+routing_policy routing_policy_from_str(char *s);
+char* routing_policy_to_str(routing_policy p);
 inline void log_dp_config(int level,dp_config *x);
 
 xmlDocPtr parse_dp_config_file(char* filename);
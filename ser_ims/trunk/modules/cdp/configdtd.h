@@ -68,8 +68,10 @@
 	ConnectTimeout	   CDATA		#IMPLIED\
 	TransactionTimeout CDATA		#IMPLIED\
 	SessionsHashSize CDATA			#IMPLIED\
+	TransactionsHashSize CDATA		#IMPLIED\
 	DefaultAuthSessionTimeout CDATA	#IMPLIED\
 	MaxAuthSessionTimeout CDATA		#IMPLIED\
+	DefaultRoutePolicy CDATA		#IMPLIED\
 >\
 <!ELEMENT Peer (#PCDATA)>\
 <!ATTLIST Peer\
@@ -99,16 +101,19 @@
 <!ELEMENT Realm (Route*)>\
 <!ATTLIST Realm\
 	name		CDATA				#REQUIRED\
+	policy		CDATA				#IMPLIED\
 >\
 <!ELEMENT Route (#PCDATA)>\
 <!ATTLIST Route\
 	FQDN		CDATA				#REQUIRED\
 	metric		CDATA				#REQUIRED\
+	weight		CDATA				#IMPLIED\
 >\
 <!ELEMENT DefaultRoute (#PCDATA)>\
 <!ATTLIST DefaultRoute\
 	FQDN		CDATA				#REQUIRED\
 	metric		CDATA				#REQUIRED\
+	weight		CDATA				#IMPLIED\
 >\
 ";
 
@@ -176,6 +176,19 @@ error:
 	return 0;		
 }
 
+/**
+ * Parses the weight of a route, clamped to 1..DP_ROUTE_MAX_WEIGHT.
+ * @param s - the weight attribute
+ * @returns the weight
+ */
+static inline int route_weight(char *s)
+{
+	int w = atoi(s);
+	if (w<1) w = 1;
+	if (w>DP_ROUTE_MAX_WEIGHT) w = DP_ROUTE_MAX_WEIGHT;
+	return w;
+}
+
 /**
  * Parses a DiameterPeer configuration file.
  * @param filename - path to the file
@@ -263,6 +276,10 @@ dp_config* parse_dp_config(xmlDocPtr doc)
 	if (xc) {x->sessions_hash_size = atoi((char*)xc);xmlFree(xc);}
 	else x->sessions_hash_size = 128;
 
+	xc = xmlGetProp(root,(xmlChar*)"TransactionsHashSize");
+	if (xc) {x->transactions_hash_size = atoi((char*)xc);xmlFree(xc);}
+	else x->transactions_hash_size = 1024;
+
 	xc = xmlGetProp(root,(xmlChar*)"DefaultAuthSessionTimeout");
 	if (xc) {x->default_auth_session_timeout = atoi((char*)xc);xmlFree(xc);}
 	else x->default_auth_session_timeout = 60;
@@ -403,6 +420,11 @@ dp_config* parse_dp_config(xmlDocPtr doc)
 					re->metric = atoi((char*)xc);			
 					xmlFree(xc);
 				}
+				xc = xmlGetProp(child,(xmlChar*)"weight");			
+				if (xc){
+					re->weight = route_weight((char*)xc);			
+					xmlFree(xc);
+				}
 				
 				/* add it the list in ascending order */
 				if (! x->r_table->routes || re->metric <= x->r_table->routes->metric){
@@ -432,6 +454,10 @@ dp_config* parse_dp_config(xmlDocPtr doc)
 			if (rr){			
 				xc = xmlGetProp(child,(xmlChar*)"name");
 				quote_trim_dup(&(rr->realm),(char*)xc);			
+				if (xc) xmlFree(xc);
+				xc = xmlGetProp(child,(xmlChar*)"policy");
+				rr->policy = routing_policy_from_str((char*)xc);
+				if (xc) xmlFree(xc);
 				
 				if (!x->r_table->realms) {				
 					x->r_table->realms = rr;
@@ -455,6 +481,11 @@ dp_config* parse_dp_config(xmlDocPtr doc)
 									re->metric = atoi((char*)xc);			
 									xmlFree(xc);
 								}
+								xc = xmlGetProp(nephew,(xmlChar*)"weight");
+								if (xc){
+									re->weight = route_weight((char*)xc);			
+									xmlFree(xc);
+								}
 								/* add it the list in ascending order */
 								if (! rr->routes || re->metric <= rr->routes->metric){
 									re->next = rr->routes;
@@ -479,6 +510,12 @@ dp_config* parse_dp_config(xmlDocPtr doc)
 		}
 	}
 	
+	if (x->r_table){
+		xc = xmlGetProp(root,(xmlChar*)"DefaultRoutePolicy");
+		x->r_table->policy = routing_policy_from_str((char*)xc);
+		if (xc) xmlFree(xc);
+	}
+	
 	if (doc) xmlFreeDoc(doc);	
 	parser_destroy();
 	return x;
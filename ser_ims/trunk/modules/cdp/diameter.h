@@ -236,6 +236,7 @@ typedef struct avp {
 	AAAVendorId vendorId;	/**< AVP vendor id 						*/
 	str data;				/**< AVP payload						*/
 	unsigned char free_it;	/**< if to free the payload when done	*/
+	unsigned char in_msg;	/**< if allocated together with the decoded message, so not to be freed alone */
 } AAA_AVP;
 
 
@@ -265,6 +266,8 @@ typedef struct _message_t {
 	AAA_AVP_LIST        avpList;		/**< list of AVPs in the message */
 	str                 buf;			/**< Diameter network representation */
 	void                *in_peer;		/**< Peer that this message was received from */
+	unsigned int        block_len;		/**< for decoded messages, the size of the single block holding the message, AVPs and buffer */
+	struct _message_t * volatile send_next; /**< next message in the peer's send queue */
 } AAAMessage;
 
 
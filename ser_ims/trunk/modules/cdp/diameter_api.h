@@ -127,6 +127,14 @@ typedef AAA_AVP* (*AAACreateAVP_f)(
 				size_t length,
 				AVPDataStatus data_status);
 
+void AAAInitAVPInMessage(
+			AAA_AVP *avp,
+			AAA_AVPCode code,
+			AAA_AVPFlag flags,
+			AAAVendorId vendorId,
+			char *data,
+			size_t length);
+
 AAA_AVP* AAACloneAVP(AAA_AVP *avp,unsigned char duplicate_data);
 
 AAAReturnCode AAAAddAVPToMessage(
@@ -206,6 +214,12 @@ typedef int (*AAAAddRequestHandler_f)(AAARequestHandler_f *f,void *param);
 int AAAAddResponseHandler(AAAResponseHandler_f *f,void *param);
 typedef int (*AAAAddResponseHandler_f)(AAAResponseHandler_f *f,void *param);
 
+int AAAAddAppRequestHandler(AAAApplicationId app_id,AAARequestHandler_f *f,void *param);
+typedef int (*AAAAddAppRequestHandler_f)(AAAApplicationId app_id,AAARequestHandler_f *f,void *param);
+
+int AAAAddAppResponseHandler(AAAApplicationId app_id,AAAResponseHandler_f *f,void *param);
+typedef int (*AAAAddAppResponseHandler_f)(AAAApplicationId app_id,AAAResponseHandler_f *f,void *param);
+
 /* MESSAGE SENDING */
 
 AAAReturnCode AAASendMessage(AAAMessage *message,AAATransactionCallback_f *callback_f,void *callback_param);
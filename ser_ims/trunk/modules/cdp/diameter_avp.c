@@ -185,6 +185,35 @@ error:
 	return 0;
 }
 
+/**
+ * Initializes an AVP which was allocated by the caller together with its message, as done by
+ * AAATranslateMessage(). The payload is not duplicated and the AVP is not freed by AAAFreeAVP(),
+ * but when its message is freed.
+ * @param avp - the AVP to initialize
+ * @param code - the code of the AVP
+ * @param flags - the flags to set
+ * @param vendorId - vendor id
+ * @param data - the payload, in the message buffer
+ * @param length - length of the payload
+ */
+void AAAInitAVPInMessage(
+	AAA_AVP *avp,
+	AAA_AVPCode code,
+	AAA_AVPFlag flags,
+	AAAVendorId vendorId,
+	char   *data,
+	size_t length)
+{
+	memset( avp, 0, sizeof(AAA_AVP) );
+	avp->code=code;
+	avp->flags=flags;
+	avp->vendorId=vendorId;
+	set_avp_fields( code, avp);
+	avp->data.s = data;
+	avp->data.len = length;
+	avp->in_msg = 1;
+}
+
 
 
 /**
@@ -377,7 +406,9 @@ AAAReturnCode  AAAFreeAVP(AAA_AVP **avp)
 	if ( (*avp)->free_it && (*avp)->data.s )
 		shm_free((*avp)->data.s);
 
-	shm_free( *avp );
+	/* the AVPs decoded by AAATranslateMessage() go with their message */
+	if ( !(*avp)->in_msg )
+		shm_free( *avp );
 	avp = 0;
 
 	return AAA_ERR_SUCCESS;
@@ -531,6 +562,7 @@ AAA_AVP* AAACloneAVP( AAA_AVP *avp , unsigned char clone_data)
 	}
 	memcpy( n_avp, avp, sizeof(AAA_AVP));
 	n_avp->next = n_avp->prev = 0;
+	n_avp->in_msg = 0;
 
 	if (clone_data) {
 		/* clone the avp data */
@@ -73,35 +73,53 @@ extern dp_config *config;		/**< Configuration for this diameter peer 	*/
 				/* CALLBACKS */
 
 extern handler_list *handlers; 		/**< list of handlers */
+extern handler_list *app_handlers;	/**< hash table of handlers by Application-Id */
 extern gen_lock_t *handlers_lock;	/**< lock for list of handlers */
 
 /**
- * Add a handler function for incoming requests.
+ * Appends a handler to a list of handlers.
+ * @param l - the list
+ * @param type - type of the handler
+ * @param app_id - Application-Id of the messages to call it for
  * @param f - the callback function
  * @param param - generic parameter to be used when calling the callback functions
  * @returns 1 on success, 0 on failure
  */
-int AAAAddRequestHandler(AAARequestHandler_f *f,void *param)
+static int add_handler(handler_list *l,enum handler_types type,AAAApplicationId app_id,
+	void *f,void *param)
 {
 	handler *h = shm_malloc(sizeof(handler));
 	if (!h) {
-		LOG(L_ERR,"ERR:AAAAddRequestHandler: error allocating %ld bytes in shm\n",
+		LOG(L_ERR,"ERR:add_handler: error allocating %ld bytes in shm\n",
 			(long int)sizeof(handler));
 		return 0;
 	}
-	h->type = REQUEST_HANDLER;
-	h->handler.requestHandler = f;
+	h->type = type;
+	h->app_id = app_id;
+	if (type==REQUEST_HANDLER) h->handler.requestHandler = (AAARequestHandler_f*)f;
+	else h->handler.responseHandler = (AAAResponseHandler_f*)f;
 	h->param = param;
 	h->next = 0;
 	lock_get(handlers_lock);
-	h->prev = handlers->tail;
-	if (handlers->tail) handlers->tail->next = h;
-	handlers->tail = h;
-	if (!handlers->head) handlers->head = h;
+	h->prev = l->tail;
+	if (l->tail) l->tail->next = h;
+	l->tail = h;
+	if (!l->head) l->head = h;
 	lock_release(handlers_lock);
 	return 1;
 }
 
+/**
+ * Add a handler function for incoming requests.
+ * @param f - the callback function
+ * @param param - generic parameter to be used when calling the callback functions
+ * @returns 1 on success, 0 on failure
+ */
+int AAAAddRequestHandler(AAARequestHandler_f *f,void *param)
+{
+	return add_handler(handlers,REQUEST_HANDLER,0,f,param);
+}
+
 /**
  * Add a handler function for incoming responses.
  * @param f - the callback function
@@ -110,23 +128,33 @@ int AAAAddRequestHandler(AAARequestHandler_f *f,void *param)
  */
 int AAAAddResponseHandler(AAAResponseHandler_f *f,void *param)
 {
-	handler *h = shm_malloc(sizeof(handler));
-	if (!h) {
-		LOG(L_ERR,"ERR:AAAAddResponseHandler: error allocating %ld bytes in shm\n",
-			(long int)sizeof(handler));
-		return 0;
-	}
-	h->type = RESPONSE_HANDLER;
-	h->handler.responseHandler = f;
-	h->param = param;
-	h->next = 0;
-	lock_get(handlers_lock);
-	h->prev = handlers->tail;
-	if (handlers->tail) handlers->tail->next = h;
-	handlers->tail = h;
-	if (!handlers->head) handlers->head = h;
-	lock_release(handlers_lock);
-	return 1;
+	return add_handler(handlers,RESPONSE_HANDLER,0,f,param);
+}
+
+/**
+ * Add a handler function for incoming requests of one application.
+ * It is called only for the requests with this Application-Id, without 
+ * walking the handlers of the other applications.
+ * @param app_id - the Application-Id
+ * @param f - the callback function
+ * @param param - generic parameter to be used when calling the callback functions
+ * @returns 1 on success, 0 on failure
+ */
+int AAAAddAppRequestHandler(AAAApplicationId app_id,AAARequestHandler_f *f,void *param)
+{
+	return add_handler(app_handlers+app_id%APP_HANDLERS_HASH_SIZE,REQUEST_HANDLER,app_id,f,param);
+}
+
+/**
+ * Add a handler function for incoming responses of one application.
+ * @param app_id - the Application-Id
+ * @param f - the callback function
+ * @param param - generic parameter to be used when calling the callback functions
+ * @returns 1 on success, 0 on failure
+ */
+int AAAAddAppResponseHandler(AAAApplicationId app_id,AAAResponseHandler_f *f,void *param)
+{
+	return add_handler(app_handlers+app_id%APP_HANDLERS_HASH_SIZE,RESPONSE_HANDLER,app_id,f,param);
 }
 
 
@@ -160,14 +188,17 @@ AAAReturnCode AAASendMessage(
 	/* only add transaction following when required */
 	if (callback_f){
 		if (is_req(message))
-			cdp_add_trans(message,callback_f,callback_param,config->transaction_timeout,1);
+			cdp_add_trans(message,p,callback_f,callback_param,config->transaction_timeout,1);
 		else
 			LOG(L_ERR,"ERROR:AAASendMessage(): can't add transaction callback for answer.\n");
 	}
 	
 //	if (!peer_send_msg(p,message))
-	if (!sm_process(p,Send_Message,message,0,0))	
+	if (!sm_process(p,Send_Message,message,0,0)){
+		/* the callback won't be called, so the caller still owns callback_param */
+		if (callback_f) del_trans(message);
 		goto error;
+	}
 		
 	return 1;
 error:	
@@ -204,14 +235,17 @@ AAAReturnCode AAASendMessageToPeer(
 	/* only add transaction following when required */
 	if (callback_f){
 		if (is_req(message))
-			cdp_add_trans(message,callback_f,callback_param,config->transaction_timeout,1);
+			cdp_add_trans(message,p,callback_f,callback_param,config->transaction_timeout,1);
 		else
 			LOG(L_ERR,"ERROR:AAASendMessageToPeer(): can't add transaction callback for answer.\n");
 	}
 		
 //	if (!peer_send_msg(p,message))
-	if (!sm_process(p,Send_Message,message,0,0))	
+	if (!sm_process(p,Send_Message,message,0,0)){
+		/* the callback won't be called, so the caller still owns callback_param */
+		if (callback_f) del_trans(message);
 		goto error;
+	}
 		
 	return 1;
 error:	
@@ -266,7 +300,7 @@ AAAMessage* AAASendRecvMessage(AAAMessage *message)
 	
 	if (is_req(message)){
 		sem_new(sem,0);
-		t = cdp_add_trans(message,sendrecv_cb,(void*)sem,config->transaction_timeout,0);
+		t = cdp_add_trans(message,p,sendrecv_cb,(void*)sem,config->transaction_timeout,0);
 
 //		if (!peer_send_msg(p,message)) {
 		if (!sm_process(p,Send_Message,message,0,0)){	
@@ -324,7 +358,7 @@ AAAMessage* AAASendRecvMessageToPeer(AAAMessage *message, str *peer_id)
 	
 	if (is_req(message)){
 		sem_new(sem,0);
-		t = cdp_add_trans(message,sendrecv_cb,(void*)sem,config->transaction_timeout,0);
+		t = cdp_add_trans(message,p,sendrecv_cb,(void*)sem,config->transaction_timeout,0);
 
 //		if (!peer_send_msg(p,message)) {
 		if (!sm_process(p,Send_Message,message,0,0)){	
@@ -426,8 +426,10 @@ AAAReturnCode  AAAFreeMessage(AAAMessage **msg)
 	/* free the avp list */
 	AAAFreeAVPList(&((*msg)->avpList));
 
-	/* free the buffer (if any) */
-	if ( (*msg)->buf.s )
+	/* free the buffer (if any and not decoded into the message block) */
+	if ( (*msg)->buf.s && !( (*msg)->block_len &&
+			(*msg)->buf.s >= (char*)(*msg) &&
+			(*msg)->buf.s < (char*)(*msg)+(*msg)->block_len ) )
 		shm_free( (*msg)->buf.s );
 
 	/* free the AAA msg */
@@ -460,25 +462,31 @@ AAAResultCode  AAASetMessageResultCode(
 
 /**
  *  This function convert message from the network format to the AAAMessage structure (decoder).
+ * The message structure, all its AVPs and (if attached) a copy of the input buffer are allocated
+ * as one shm block, with the AVP payloads pointing into the buffer. So decoding a message costs a single
+ * allocation, regardless of the number of AVPs and the source can be reused by the caller right away.
  * @param source - the source char buffer
  * @param sourceLen - the length of the input buffer
- * @param attach_buf - whether to attach the input buffer to the message
+ * @param attach_buf - whether to attach a copy of the input buffer to the message; if not, the AVPs point
+ * into the source, which must then live as long as the message 
  * @returns the AAAMessage* or NULL on error
  * \note This function is taken from DISC http://developer.berlios.de/projects/disc/ 
  */
 AAAMessage* AAATranslateMessage( unsigned char* source, unsigned int sourceLen,
 															int attach_buf)
 {
-	unsigned char *ptr;
+	unsigned char *ptr,*base;
 	AAAMessage    *msg;
 	unsigned char version;
 	unsigned int  msg_len;
 	AAA_AVP       *avp;
+	unsigned int  avp_cnt;
 	unsigned int  avp_code;
 	unsigned char avp_flags;
 	unsigned int  avp_len;
 	unsigned int  avp_vendorID;
 	unsigned int  avp_data_len;
+	unsigned int  block_len;
 
 	/* check the params */
 	if( !source || !sourceLen || sourceLen<AAA_MSG_HDR_SIZE) {
@@ -488,17 +496,8 @@ AAAMessage* AAATranslateMessage( unsigned char* source, unsigned int sourceLen,
 
 	/* inits */
 	msg = 0;
-	avp = 0;
 	ptr = source;
 
-	/* alloc a new message structure */
-	msg = (AAAMessage*)shm_malloc(sizeof(AAAMessage));
-	if (!msg) {
-		LOG(L_ERR,"ERROR:AAATranslateMessage: no more free memory!!\n");
-		goto error;
-	}
-	memset(msg,0,sizeof(AAAMessage));
-
 	/* get the version */
 	version = (unsigned char)*ptr;
 	ptr += VER_SIZE;
@@ -510,13 +509,63 @@ AAAMessage* AAATranslateMessage( unsigned char* source, unsigned int sourceLen,
 
 	/* message length */
 	msg_len = get_3bytes( ptr );
-	ptr += MESSAGE_LENGTH_SIZE;
-	if (msg_len>sourceLen) {
-		LOG(L_ERR,"ERROR:AAATranslateMessage: AAA message len [%d] bigger then"
+	if (msg_len>sourceLen || msg_len<AAA_MSG_HDR_SIZE) {
+		LOG(L_ERR,"ERROR:AAATranslateMessage: AAA message len [%d] invalid for"
 			" buffer len [%d]\n",msg_len,sourceLen);
 		goto error;
 	}
 
+	/* first pass - check the AVP headers and count them, to size the block */
+	avp_cnt = 0;
+	ptr = source + AAA_MSG_HDR_SIZE;
+	while (ptr < source+msg_len) {
+		if (ptr+AVP_HDR_SIZE(0x80)>source+msg_len){
+			LOG(L_ERR,"ERROR:AAATranslateMessage: source buffer to short!! "
+				"Cannot read the whole AVP header!\n");
+			goto error;
+		}
+		avp_flags = (unsigned char)ptr[AVP_CODE_SIZE];
+		avp_len = get_3bytes( ptr+AVP_CODE_SIZE+AVP_FLAGS_SIZE );
+		if (avp_len<=AVP_HDR_SIZE(avp_flags)) {
+			LOG(L_ERR,"ERROR:AAATranslateMessage: invalid AVP len [%d]\n",
+				avp_len);
+			goto error;
+		}
+		/* data length */
+		avp_data_len = avp_len-AVP_HDR_SIZE(avp_flags);
+		ptr += AVP_HDR_SIZE(avp_flags);
+		/*check the data length */
+		if ( source+msg_len<ptr+avp_data_len) {
+			LOG(L_ERR,"ERROR:AAATranslateMessage: source buffer to short!! "
+				"Cannot read a whole data for AVP!\n");
+			goto error;
+		}
+		ptr += to_32x_len( avp_data_len );
+		avp_cnt++;
+	}
+
+	/* alloc the message structure, the AVPs and the buffer in one block */
+	block_len = sizeof(AAAMessage) + avp_cnt*sizeof(AAA_AVP) + (attach_buf?msg_len:0);
+	msg = (AAAMessage*)shm_malloc(block_len);
+	if (!msg) {
+		LOG(L_ERR,"ERROR:AAATranslateMessage: no more free memory!!\n");
+		goto error;
+	}
+	memset(msg,0,sizeof(AAAMessage));
+	msg->block_len = block_len;
+	avp = (AAA_AVP*)(msg+1);
+
+	/* link the buffer to the message */
+	if (attach_buf) {
+		base = (unsigned char*)(avp+avp_cnt);
+		memcpy(base,source,msg_len);
+		msg->buf.s = (char*) base;
+		msg->buf.len = msg_len;
+	} else
+		base = source;
+
+	ptr = base + VER_SIZE + MESSAGE_LENGTH_SIZE;
+
 	/* command flags */
 	msg->flags = *ptr;
 	ptr += FLAGS_SIZE;
@@ -537,13 +586,8 @@ AAAMessage* AAATranslateMessage( unsigned char* source, unsigned int sourceLen,
 	msg->endtoendId = ntohl(*((unsigned int*)ptr));
 	ptr += END_TO_END_IDENTIFIER_SIZE;
 
-	/* start decoding the AVPS */
-	while (ptr < source+msg_len) {
-		if (ptr+AVP_HDR_SIZE(0x80)>source+msg_len){
-			LOG(L_ERR,"ERROR:AAATranslateMessage: source buffer to short!! "
-				"Cannot read the whole AVP header!\n");
-			goto error;
-		}
+	/* decode the AVPS, as views into the buffer - already checked above */
+	while (ptr < base+msg_len) {
 		/* avp code */
 		avp_code = get_4bytes( ptr );
 		ptr += AVP_CODE_SIZE;
@@ -553,11 +597,6 @@ AAAMessage* AAATranslateMessage( unsigned char* source, unsigned int sourceLen,
 		/* avp length */
 		avp_len = get_3bytes( ptr );
 		ptr += AVP_LENGTH_SIZE;
-		if (avp_len<1) {
-			LOG(L_ERR,"ERROR:AAATranslateMessage: invalid AVP len [%d]\n",
-				avp_len);
-			goto error;
-		}
 		/* avp vendor-ID */
 		avp_vendorID = 0;
 		if (avp_flags&AAA_AVP_FLAG_VENDOR_SPECIFIC) {
@@ -566,29 +605,16 @@ AAAMessage* AAATranslateMessage( unsigned char* source, unsigned int sourceLen,
 		}
 		/* data length */
 		avp_data_len = avp_len-AVP_HDR_SIZE(avp_flags);
-		/*check the data length */
-		if ( source+msg_len<ptr+avp_data_len) {
-			LOG(L_ERR,"ERROR:AAATranslateMessage: source buffer to short!! "
-				"Cannot read a whole data for AVP!\n");
-			goto error;
-		}
 
-		/* create the AVP */
-		avp = AAACreateAVP( avp_code, avp_flags, avp_vendorID, (char*) ptr,
-			avp_data_len, AVP_DONT_FREE_DATA);
-		if (!avp)
-			goto error;
+		/* init the AVP */
+		AAAInitAVPInMessage( avp, avp_code, avp_flags, avp_vendorID, (char*) ptr,
+			avp_data_len);
 
 		/* link the avp into aaa message to the end */
 		AAAAddAVPToMessage( msg, avp, msg->avpList.tail);
 
 		ptr += to_32x_len( avp_data_len );
-	}
-
-	/* link the buffer to the message */
-	if (attach_buf) {
-		msg->buf.s = (char*) source;
-		msg->buf.len = msg_len;
+		avp++;
 	}
 
 	msg->sessionId = AAAFindMatchingAVP(msg,0,AVP_Session_Id,0,0);
@@ -597,7 +623,6 @@ AAAMessage* AAATranslateMessage( unsigned char* source, unsigned int sourceLen,
 	return  msg;
 error:
 	LOG(L_ERR,"ERROR:AAATranslateMessage: message conversion droped!!\n");
-	AAAFreeMessage(&msg);
 	return 0;
 }
 
@@ -89,6 +89,7 @@ pid_list_head_t *pid_list;	/**< list of local processes			*/
 gen_lock_t *pid_list_lock;	/**< lock for list of local processes	*/
 
 extern handler_list *handlers; 		/**< list of handlers */
+extern handler_list *app_handlers;	/**< hash table of handlers by Application-Id */
 extern gen_lock_t *handlers_lock;	/**< lock for list of handlers */
 
 extern peer_list_t *peer_list;		/**< list of peers */
@@ -207,6 +208,13 @@ int diameter_peer_init_real()
 	handlers->head=0;
 	handlers->tail=0;
 
+	app_handlers = shm_malloc(APP_HANDLERS_HASH_SIZE*sizeof(handler_list));
+	if (!app_handlers){
+		LOG_NO_MEM("shm",APP_HANDLERS_HASH_SIZE*sizeof(handler_list));
+		goto error;
+	}
+	memset(app_handlers,0,APP_HANDLERS_HASH_SIZE*sizeof(handler_list));
+
 	/* init the pid list */
 	pid_list = shm_malloc(sizeof(pid_list_head_t));
 	if (!pid_list){
@@ -225,7 +233,7 @@ int diameter_peer_init_real()
 	peer_manager_init(config);
 	
 	/* init diameter transactions */
-	cdp_trans_init();
+	if (!cdp_trans_init(config->transactions_hash_size)) goto error;
 	
 	/* init the session */
 	if (!cdp_sessions_init(config->sessions_hash_size)) goto error;
@@ -485,7 +493,7 @@ extern int memlog;
  */
 void diameter_peer_destroy()
 {
-	int pid,status;
+	int pid,status,i;
 	handler *h;
 	
 	lock_get(shutdownx_lock);
@@ -559,9 +567,16 @@ void diameter_peer_destroy()
 		shm_free(handlers->head);
 		handlers->head = h;
 	}
+	for(i=0;i<APP_HANDLERS_HASH_SIZE;i++)
+		while(app_handlers[i].head){
+			h = app_handlers[i].head->next;
+			shm_free(app_handlers[i].head);
+			app_handlers[i].head = h;
+		}
 	lock_destroy(handlers_lock);
 	lock_dealloc((void*)handlers_lock);
 	shm_free(handlers);
+	shm_free(app_handlers);
 		
 	free_dp_config(config);	
 	LOG(L_CRIT,"INFO:destroy_diameter_peer(): Bye Bye from C Diameter Peer test\n");
@@ -60,6 +60,7 @@
 #include "diameter_peer.h"
 #include "config.h"
 #include "cdp_load.h"
+#include "worker.h"
 
 MODULE_VERSION
 
@@ -103,6 +104,8 @@ extern dp_config *config; 				/**< DiameterPeer configuration structure */
  * <p>
  * - AAAAddRequestHandler() - add a #AAARequestHandler_f callback to request being received
  * - AAAAddResponseHandler() - add a #AAAResponseHandler_f callback to responses being received
+ * - AAAAddAppRequestHandler() - add a #AAARequestHandler_f callback to requests of one application
+ * - AAAAddAppResponseHandler() - add a #AAAResponseHandler_f callback to responses of one application
  */
 static cmd_export_t cdp_cmds[] = {
 	{"load_cdp",					(cmd_function)load_cdp, 				NO_SCRIPT, 0, 0},
@@ -131,6 +134,8 @@ static cmd_export_t cdp_cmds[] = {
 
 	EXP_FUNC(AAAAddRequestHandler)
 	EXP_FUNC(AAAAddResponseHandler)
+	EXP_FUNC(AAAAddAppRequestHandler)
+	EXP_FUNC(AAAAddAppResponseHandler)
 
 
 	EXP_FUNC(AAACreateTransaction)
@@ -149,6 +154,7 @@ static cmd_export_t cdp_cmds[] = {
 	EXP_FUNC(AAAGetAuthSession)
 	EXP_FUNC(AAADropAuthSession)
 	EXP_FUNC(AAATerminateAuthSession)
+	EXP_FUNC(AAAUpdateAuthSessionTimers)
 	
 	{ 0, 0, 0, 0, 0 }
 };
@@ -164,13 +170,24 @@ static param_export_t cdp_params[] = {
 };
 
 
+/**
+ * Exported RPC methods.
+ * - cdp.queues - statistics of the task queues of the workers
+ */
+static rpc_export_t cdp_rpc[] = {
+	{"cdp.queues",	worker_rpc_queues,	worker_rpc_queues_doc,	0},
+	{"cdp.sessions",	cdp_rpc_sessions,	cdp_rpc_sessions_doc,	0},
+	{0, 0, 0, 0}
+};
+
+
 /**
  * Exported module interface
  */
 struct module_exports exports = {
 	"cdp",
 	cdp_cmds,                       /**< Exported functions */
-	0,
+	cdp_rpc,						/**< Exported RPC methods */
 	cdp_params,                     /**< Exported parameters */
 	cdp_init,                   /**< Module initialization function */
 	(response_function) 0,
@@ -133,6 +133,8 @@ struct cdp_binds cdp_binding={
 
 	AAAAddRequestHandler,
 	AAAAddResponseHandler,
+	AAAAddAppRequestHandler,
+	AAAAddAppResponseHandler,
 
 
 	AAACreateTransaction,
@@ -151,6 +153,7 @@ struct cdp_binds cdp_binding={
 	AAAGetAuthSession,
 	AAADropAuthSession,
 	AAATerminateAuthSession,
+	AAAUpdateAuthSessionTimers,
 
 };
 
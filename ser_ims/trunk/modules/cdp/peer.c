@@ -56,6 +56,7 @@
 
 #include "peer.h"
 #include "diameter.h"
+#include "send_queue.h"
 
 /**
  * Create a new peer.
@@ -108,6 +109,9 @@ void free_peer(peer *x,int locked)
 	if (!locked) lock_get(x->lock);
 	if (x->fqdn.s) shm_free(x->fqdn.s);
 	if (x->realm.s) shm_free(x->realm.s);	
+#ifdef CDP_SEND_QUEUE
+	send_queue_free(x->send_q);
+#endif
 	lock_destroy(x->lock);
 	lock_dealloc((void*)x->lock);
 	shm_free(x);
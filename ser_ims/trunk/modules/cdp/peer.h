@@ -124,8 +124,10 @@ typedef struct _peer_t{
 	time_t activity;		/**< timestamp of last activity */
 	int is_dynamic;			/**< whether this peer was accepted although it was not initially configured */
 	int waitingDWA;			/**< if a Diameter Watch-dog Request was sent out and waiting for an answer */
+	int pending;			/**< requests in flight (with a transaction), for least-pending routing */
 	
 	str send_pipe_name;		/**< pipe to signal messages to be sent out*/
+	struct _send_queue_t *send_q;	/**< shm queue of messages to be sent out, if available (else the send pipe is used) */
 	
 	int fd_exchange_pipe_local;	/**< pipe to communicate with the receiver process and exchange a file descriptor - local end, to read from */
 	int fd_exchange_pipe;	/**< pipe to communicate with the receiver process and exchange a file descriptor */
@@ -62,6 +62,7 @@
 
 #include "globals.h"
 #include "peerstatemachine.h"
+#include "send_queue.h"
 
 peer_list_t *peer_list=0;		/**< list of peers */
 gen_lock_t *peer_list_lock=0;	/**< lock for the list of peers */
@@ -103,6 +104,10 @@ int peer_manager_init(dp_config *config)
 		p = new_peer(config->peers[i].fqdn,config->peers[i].realm,config->peers[i].port);
 		if (!p) continue;
 		p->is_dynamic = 0;
+#ifdef CDP_SEND_QUEUE
+		/* before the fork, so that all processes get the eventfd */
+		p->send_q = send_queue_new();
+#endif
 		add_peer(p);
 	}
 	
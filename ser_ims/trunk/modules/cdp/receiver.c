@@ -68,6 +68,7 @@
 #include <time.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/uio.h>
 
 #include "utils.h"
 #include "globals.h"
@@ -77,6 +78,7 @@
 #include "config.h"
 
 #include "receiver.h"
+#include "send_queue.h"
 
 extern dp_config *config;		/**< Configuration for this diameter peer 	*/
 
@@ -122,11 +124,11 @@ static void log_serviced_peers(int level)
 #endif			
 			);
 	for(sp=serviced_peers;sp;sp=sp->next){
-		LOG(level,ANSI_GREEN" Peer: ["ANSI_YELLOW"%.*s"ANSI_GREEN"]  TCP Socket: ["ANSI_YELLOW"%d"ANSI_GREEN"] Recv.State: ["ANSI_YELLOW"%d"ANSI_GREEN"]\n",
+		LOG(level,ANSI_GREEN" Peer: ["ANSI_YELLOW"%.*s"ANSI_GREEN"]  TCP Socket: ["ANSI_YELLOW"%d"ANSI_GREEN"] Recv.Buffered: ["ANSI_YELLOW"%d"ANSI_GREEN"]\n",
 				sp->p?sp->p->fqdn.len:0,
 				sp->p?sp->p->fqdn.s:0,
 				sp->tcp_socket,
-				sp->state);
+				sp->buf_len);
 	}
 	LOG(level,"--------------------------------------------------------\n");	
 }
@@ -161,8 +163,17 @@ static int make_send_pipe(serviced_peer_t *sp)
 		return 0;
 	}
 	
-	if (sp->p) 
+	if (sp->p) {
+		/* the hand-over of the send queue is done under the peer lock, see send_queued_msgs() */
+		lock_get(sp->p->lock);
+#ifdef CDP_SEND_QUEUE
+		/* what was queued for a previous connection is dropped, as it was with the old pipe */
+		if (sp->p->send_q)
+			send_queue_flush(sp->p->send_q);
+#endif
 		sp->p->send_pipe_name=sp->send_pipe_name;
+		lock_release(sp->p->lock);
+	}
 	
 	return 1;	
 }
@@ -244,6 +255,10 @@ static void disconnect_serviced_peer(serviced_peer_t *sp,int locked)
 	}
 	sp->tcp_socket = -1;
 	close_send_pipe(sp);
+	/* a partial message can not be continued on another connection */
+	if (sp->buf) pkg_free(sp->buf);
+	sp->buf = 0;
+	sp->buf_len = 0;
 }
 
 /**
@@ -265,8 +280,8 @@ static void drop_serviced_peer(serviced_peer_t *sp,int locked)
 	if (sp->next) sp->next->prev = sp->prev;
 	if (sp->prev) sp->prev->next = sp->next;
 	else serviced_peers = sp->next;
-	if (sp->msg) shm_free(sp->msg);
-	sp->msg = 0;
+	if (sp->buf) pkg_free(sp->buf);
+	sp->buf = 0;
 	pkg_free(sp);
 }
 
@@ -512,127 +527,168 @@ done:
 
 /**
  * Does the actual receive operations on the Diameter TCP socket, for retrieving incoming messages.
- * The functions is to be called iteratively, each time there is something to be read from the TCP socket. It uses
- * a simple state machine to read first the version, then the header and then the rest of the message. When an
- * entire message is received, it is decoded and passed to the processing functions.
+ * The functions is to be called iteratively, each time there is something to be read from the TCP socket. It reads
+ * as much as fits in the peer's receive buffer and then frames all the complete messages in it, so that a burst
+ * of queued messages costs only one recv(). Each message is decoded and passed to the processing functions, while
+ * the trailing partial message (if any) is moved to the start of the buffer to be completed on the next call.
  * @param sp - the serviced peer to operate on
  * @return 1 on success, 0 on failure
  */
 static inline int do_receive(serviced_peer_t *sp)
 {
-	int cnt,n,version;
-	char *dst;
+	int cnt,length,version;
+	char *ptr;
 	AAAMessage *dmsg;
 	
-	switch (sp->state){
-		case Receiver_Waiting:
-			n = 1; /* wait for version */
-			dst = sp->buf;
-			break;
-			
-		case Receiver_Header: 
-			n = DIAMETER_HEADER_LEN - sp->buf_len; /* waiting for rest of header */
-			dst = sp->buf+sp->buf_len;
-			break;
-			
-		case Receiver_Rest_of_Message:
-			n = sp->length - sp->msg_len;	/* waiting for the rest of the message */
-			dst = sp->msg+sp->msg_len;
-			break;
-			
-		default:
-			LOG(L_ERR,"ERROR:do_receive(): [%.*s] Unknown state %d\n",
-					sp->p?sp->p->fqdn.len:0,
-					sp->p?sp->p->fqdn.s:0,
-					sp->state);			
+	if (!sp->buf){
+		sp->buf = pkg_malloc(DP_RECV_BUF_LEN);
+		if (!sp->buf){
+			LOG_NO_MEM("pkg",DP_RECV_BUF_LEN);
 			goto error_and_reset;
+		}
+		sp->buf_len = 0;
 	}
 	
-	cnt = recv(sp->tcp_socket,dst,n,0);
+	cnt = recv(sp->tcp_socket,sp->buf+sp->buf_len,DP_RECV_BUF_LEN-sp->buf_len,0);
 	
 	if (cnt<=0)	
 		goto error_and_reset;
 	
-	switch (sp->state){
-		case Receiver_Waiting:			
-			version = (unsigned char)(sp->buf[0]);
-			if (version!=1) {
-		  		LOG(L_ERR,"ERROR:do_receive(): [%.*s] Received Unknown version [%d]\n",
-		  				sp->p->fqdn.len,
-		  				sp->p->fqdn.s,
-		  				(unsigned char)sp->buf[0]);
-				goto error_and_reset;
-			}else{
-				sp->state = Receiver_Header;
-				sp->buf_len = 1;
-			}
-			break;
-			
-		case Receiver_Header:
-			sp->buf_len+=cnt;			
-			if (sp->buf_len==DIAMETER_HEADER_LEN){
-				sp->length = get_3bytes(sp->buf+1);
-				if (sp->length>DP_MAX_MSG_LENGTH){
-					LOG(L_ERR,"ERROR:do_receive(): [%.*s] Msg too big [%d] bytes\n",
-							sp->p?sp->p->fqdn.len:0,
-							sp->p?sp->p->fqdn.s:0,
-							sp->length);
-					goto error_and_reset;
-				}
-				LOG(L_DBG,"DBG:receive_loop(): [%.*s] Recv Version %d Length %d\n",
-						sp->p?sp->p->fqdn.len:0,
-						sp->p?sp->p->fqdn.s:0,
-						(unsigned char)(sp->buf[0]),
-						sp->length);
-				sp->msg = shm_malloc(sp->length);
-				if (!sp->msg) {
-					LOG_NO_MEM("shm",sp->length);
-					goto error_and_reset;
-				}
-				
-				memcpy(sp->msg,sp->buf,sp->buf_len);
-				sp->msg_len=sp->buf_len;
-				sp->state = Receiver_Rest_of_Message;
-			}
-			break;
-			
-		case Receiver_Rest_of_Message:
-			sp->msg_len+=cnt;
-			if (sp->msg_len==sp->length){
-		    	dmsg = AAATranslateMessage((unsigned char*)sp->msg,(unsigned int)sp->msg_len,1);		    	
-				if (dmsg) {
-					sp->msg = 0;
-					receive_message(dmsg,sp);
-				}
-				else {
-					shm_free(sp->msg);
-					sp->msg = 0;
-				}
-				sp->msg_len = 0;
-				sp->buf_len = 0;
-				sp->state = Receiver_Waiting;
-			}
-			break;
-			
-		default:
-			LOG(L_ERR,"ERROR:do_receive(): [%.*s] Unknown state %d\n",
+	sp->buf_len += cnt;
+	ptr = sp->buf;
+	while(ptr+DIAMETER_HEADER_LEN <= sp->buf+sp->buf_len){
+		version = (unsigned char)ptr[0];
+		if (version!=1) {
+	  		LOG(L_ERR,"ERROR:do_receive(): [%.*s] Received Unknown version [%d]\n",
+	  				sp->p?sp->p->fqdn.len:0,
+	  				sp->p?sp->p->fqdn.s:0,
+	  				version);
+			goto error_and_reset;
+		}
+		length = get_3bytes(ptr+1);
+		if (length>DP_MAX_MSG_LENGTH || length<DIAMETER_HEADER_LEN){
+			LOG(L_ERR,"ERROR:do_receive(): [%.*s] Invalid msg length [%d] bytes\n",
 					sp->p?sp->p->fqdn.len:0,
 					sp->p?sp->p->fqdn.s:0,
-					sp->state);			
+					length);
 			goto error_and_reset;
+		}
+		if (ptr+length > sp->buf+sp->buf_len) break; /* wait for the rest of the message */
+		
+		LOG(L_DBG,"DBG:do_receive(): [%.*s] Recv Version %d Length %d\n",
+				sp->p?sp->p->fqdn.len:0,
+				sp->p?sp->p->fqdn.s:0,
+				version,
+				length);
+		/* the message is decoded into its own block, as it outlives this buffer */
+		dmsg = AAATranslateMessage((unsigned char*)ptr,(unsigned int)length,1);
+		ptr += length;
+		if (dmsg) receive_message(dmsg,sp);
 	}
+	
+	/* keep the partial message at the start of the buffer */
+	sp->buf_len -= ptr-sp->buf;
+	if (sp->buf_len && ptr!=sp->buf)
+		memmove(sp->buf,ptr,sp->buf_len);
 	return 1;
 error_and_reset:
-	if (sp->msg){
-		shm_free(sp->msg);
-		sp->msg = 0;
-		sp->msg_len = 0;
-		sp->buf_len = 0;
-		sp->state = Receiver_Waiting;
-	}
+	sp->buf_len = 0;
 	return 0;
 }
 
+#ifdef CDP_SEND_QUEUE
+/**
+ * Writes out all the given buffers, continuing after partial writes.
+ * @param fd - the socket to write to
+ * @param iov - the buffers; modified on partial writes
+ * @param n - number of buffers
+ * @returns 1 on success, 0 on error
+ */
+static int writev_all(int fd,struct iovec *iov,int n)
+{
+	ssize_t cnt;
+	
+	while(n){
+		cnt = writev(fd,iov,n);
+		if (cnt<0){
+			if (errno==EINTR) continue;
+			return 0;
+		}
+		for(;n && cnt>=(ssize_t)iov->iov_len;iov++,n--)
+			cnt -= iov->iov_len;
+		if (n){
+			iov->iov_base = (char*)iov->iov_base+cnt;
+			iov->iov_len -= cnt;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Checks if this serviced peer is the consumer of the send queue of its peer.
+ * The queue has a single consumer: the receiver whose send pipe is attached to the peer.
+ * On a CER the receiver for unknown peers takes the peer over with make_send_pipe(),
+ * while the previous receiver might still be servicing it.
+ * \note Without the peer lock this is just a hint - send_queued_msgs() checks again under it.
+ * @param sp - the serviced peer
+ * @returns 1 if it owns the queue, 0 if not
+ */
+static inline int owns_send_queue(serviced_peer_t *sp)
+{
+	return sp->send_pipe_name.s && sp->p && sp->p->send_q &&
+		sp->send_pipe_name.s == sp->p->send_pipe_name.s;
+}
+
+/**
+ * Drains the send queue of a serviced peer, writing the messages out with one writev() per
+ * batch of DP_SEND_BATCH messages. The messages are freed after.
+ * The queue is drained under the peer lock and only if this serviced peer still owns it,
+ * so that a hand-over to another receiver never has two processes popping.
+ * @param sp - the serviced peer to send for
+ * @returns 1 on success, 0 on write error, when the peer should be dropped
+ */
+static int send_queued_msgs(serviced_peer_t *sp)
+{
+	send_queue_t *q=sp->p->send_q;
+	AAAMessage *msgs[DP_SEND_BATCH];
+	struct iovec iov[DP_SEND_BATCH];
+	int i,n,ret=1;
+
+	lock_get(sp->p->lock);
+	if (!owns_send_queue(sp)){
+		/* not acknowledged, the signal is for the new owner */
+		lock_release(sp->p->lock);
+		return 1;
+	}
+	send_queue_ack(q);
+	do {
+		for(n=0;n<DP_SEND_BATCH && (msgs[n]=send_queue_pop(q))!=0;n++){
+			iov[n].iov_base = msgs[n]->buf.s;
+			iov[n].iov_len = msgs[n]->buf.len;
+		}
+		if (!n) break;
+		LOG(L_DBG,"DBG:send_queued_msgs(): [%.*s] sending %d queued messages\n",
+				sp->p->fqdn.len,
+				sp->p->fqdn.s,
+				n);
+		if (sp->tcp_socket<0){
+			LOG(L_ERR,"ERROR:send_queued_msgs(): got a signal to send something, but the connection was not opened\n");
+		} else if (ret && !writev_all(sp->tcp_socket,iov,n)){
+			LOG(L_ERR,"INFO:send_queued_msgs(): [%.*s] write on socket [%d] returned error> %s... dropping\n",
+					sp->p->fqdn.len,
+					sp->p->fqdn.s,
+					sp->tcp_socket,
+					strerror(errno));
+			ret = 0;
+		}
+		for(i=0;i<n;i++)
+			AAAFreeMessage(&(msgs[i]));
+	} while(n==DP_SEND_BATCH);
+	lock_release(sp->p->lock);
+	return ret;
+}
+#endif /* CDP_SEND_QUEUE */
+
 /**
  * Selects once on sockets for receiving and sending stuff.
  * Monitors:
@@ -683,6 +739,12 @@ int receive_loop(peer *original_peer)
 					FD_SET(sp->send_pipe_fd,&rfds);
 					if (sp->send_pipe_fd>max) max = sp->send_pipe_fd;
 				}			
+#ifdef CDP_SEND_QUEUE
+				if (owns_send_queue(sp)) {
+					FD_SET(sp->p->send_q->event_fd,&rfds);
+					if (sp->p->send_q->event_fd>max) max = sp->p->send_q->event_fd;
+				}
+#endif
 			}
 			
 			tv.tv_sec=1;
@@ -759,6 +821,16 @@ int receive_loop(peer *original_peer)
 									sp->tcp_socket);
 							goto drop_peer;
 						}
+#ifdef CDP_SEND_QUEUE
+						if (owns_send_queue(sp) && 
+								FD_ISSET(sp->p->send_q->event_fd,&rfds)) {
+							/* send all that was queued */
+							if (!send_queued_msgs(sp)){
+								close(sp->tcp_socket);
+								goto drop_peer;
+							}
+						}
+#endif
 						if (sp->send_pipe_fd>=0 && FD_ISSET(sp->send_pipe_fd,&rfds)) {					
 							/* send */
 							LOG(L_DBG,"DBG:select_recv(): There is something on the send pipe\n");
@@ -965,10 +1037,10 @@ int receiver_send_socket(int sock, peer *p)
 
 /**
  * Sends a message to a peer (to be called from other processes).
- * This just writes the pointer to the message in the send pipe. The specific
- * peer process will pick that up and send the message, as only that specific
- * process has the id of socket (we are forking the peers dynamically and as such,
- * the sockets are not visible between processes).
+ * This just pushes the message on the peer's send queue, or for the peers without one, 
+ * writes the pointer to the message in the send pipe. The specific peer process will
+ * pick that up and send the message, as only that specific process has the id of socket
+ * (we are forking the peers dynamically and as such, the sockets are not visible between processes).
  * @param p - the peer to send to
  * @param msg - the message to send
  * @returns 1 on success, 0 on failure
@@ -981,6 +1053,14 @@ int peer_send_msg(peer *p,AAAMessage *msg)
 		LOG(L_ERR,"ERROR:peer_send_msg(): Peer %.*s has no attached send pipe\n",p->fqdn.len,p->fqdn.s);
 		return 0;
 	}
+#ifdef CDP_SEND_QUEUE
+	if (p->send_q){
+		LOG(L_DBG,"DBG:peer_send_msg(): Queue push [%p]\n",msg);
+		/* once linked in, the message belongs to the queue, even if the signal failed */
+		send_queue_push(p->send_q,msg);
+		return 1;
+	}
+#endif
 	fd = open(p->send_pipe_name.s,O_WRONLY);
 	if (fd<0){
 		LOG(L_ERR,"ERROR:peer_send_msg(): Peer %.*s error on pipe open > %s\n",p->fqdn.len,p->fqdn.s,strerror(errno));		
@@ -65,12 +65,9 @@
 
 #define DIAMETER_HEADER_LEN 20
 
+/** Size of the per-peer receive buffer - must fit at least one message of the maximum length */
+#define DP_RECV_BUF_LEN DP_MAX_MSG_LENGTH
 
-typedef enum {
-	Receiver_Waiting=0,
-	Receiver_Header=1,
-	Receiver_Rest_of_Message=2
-} receiver_state_t;
 
 /** list of receiver attached peers */
 typedef struct _serviced_peer_t {
@@ -82,12 +79,8 @@ typedef struct _serviced_peer_t {
 	int send_pipe_fd;							/**< reader from the pipe to signal messages to be sent out */
 	int send_pipe_fd_out;						/**< keep-alive writer for the pipe to signal messages to be sent out */
 
-	receiver_state_t state;						/**< current receiving state */
-	char buf[DIAMETER_HEADER_LEN];				/**< buffer to receive header into */
-	int buf_len;								/**< received bytes in the header */
-	int length;									/**< length of the message as written in the header */
-	char *msg;									/**< dynamic buffer for receiving one message */
-	int msg_len;								/**< received bytes in the dynamic buffer */
+	char *buf;									/**< receive buffer, allocated on first receive */
+	int buf_len;								/**< received bytes not yet framed into messages */
 		
 	
 	struct _serviced_peer_t *next;	/**< first peer in the list */	
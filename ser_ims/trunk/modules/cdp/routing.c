@@ -102,12 +102,126 @@ peer* get_first_connected_route(routing_entry *r,int app_id,int vendor_id)
 	return 0;
 }
 
+/** Maximum number of routes with the same metric to balance among */
+#define DP_ROUTE_MAX_BALANCED 32
+
+/**
+ * Hashes a string, continuing from a previous hash (FNV-1a).
+ * @param h - the previous hash or the FNV offset basis
+ * @param s - the string to hash
+ * @returns the hash
+ */
+static inline unsigned int route_hash(unsigned int h,str s)
+{
+	int i;
+	for(i=0;i<s.len;i++){
+		h ^= (unsigned char)s.s[i];
+		h *= 16777619;
+	}
+	return h;
+}
+
+/**
+ * Mixes the bits of a hash, so that close inputs give unrelated outputs.
+ * @param h - the hash to mix
+ * @returns the mixed hash
+ */
+static inline unsigned int route_hash_mix(unsigned int h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+/**
+ * Get a connected peer from the list of routing entries, according to a routing policy.
+ * Only the connected peers with the best (lowest) metric are balanced among, the others
+ * being backups. As the peers disconnected by the watchdog are not considered, the requests
+ * fail over to the remaining ones right away.
+ * @param r - the list of routing entries to look into, ordered by metric
+ * @param policy - how to choose among the connected peers with the same metric
+ * @param rr_next - round-robin counter of the list; not locked, as a lost update just skews one choice
+ * @param m - the message to route
+ * @param app_id - the application id that the peer must support
+ * @param vendor_id - the vendor id of the application
+ * @returns - the peer or null if none connected
+ */
+static peer* get_balanced_route(routing_entry *r,routing_policy policy,unsigned int *rr_next,
+	AAAMessage *m,int app_id,int vendor_id)
+{
+	routing_entry *i;
+	peer *p,*peers[DP_ROUTE_MAX_BALANCED];
+	int weights[DP_ROUTE_MAX_BALANCED];
+	int n=0,k,j,best=0,total=0,metric=0;
+	unsigned int h,sh,score,best_score=0;
+
+	if (policy==DP_ROUTE_FAILOVER || (policy==DP_ROUTE_SESSION_HASH && !m->sessionId))
+		return get_first_connected_route(r,app_id,vendor_id);
+	
+	for(i=r;i && n<DP_ROUTE_MAX_BALANCED;i=i->next){
+		if (n && i->metric!=metric) break;
+		p = get_peer_by_fqdn(&(i->fqdn));
+		if (p && (p->state==I_Open || p->state==R_Open) && peer_handles_application(p,app_id,vendor_id)) {
+			metric = i->metric;
+			peers[n] = p;
+			weights[n] = i->weight;
+			total += i->weight;
+			n++;
+		}
+	}
+	if (!n) return 0;
+	if (n==1) return peers[0];
+	
+	switch(policy){
+		case DP_ROUTE_ROUND_ROBIN:
+			/* pick the slot of the counter in the total weight */
+			k = (*rr_next)++ % total;
+			for(best=0;k>=weights[best];best++)
+				k -= weights[best];
+			break;
+		case DP_ROUTE_LEAST_PENDING:
+			/* lowest pending/weight; start at the counter so that the ties are rotated */
+			k = (*rr_next)++ % n;
+			best = k;
+			for(j=1;j<n;j++){
+				k = (k+1)%n;
+				if (peers[k]->pending*weights[best] < peers[best]->pending*weights[k])
+					best = k;
+			}
+			break;
+		case DP_ROUTE_SESSION_HASH:
+			/* weighted rendezvous hashing - each peer draws weight scores, the highest wins,
+			 * so a disconnected peer only moves its own sessions */
+			sh = route_hash(2166136261u,m->sessionId->data);
+			for(k=0;k<n;k++){
+				h = route_hash(sh,peers[k]->fqdn);
+				for(j=0;j<weights[k];j++){
+					score = route_hash_mix(h+j);
+					if (score>=best_score){
+						best_score = score;
+						best = k;
+					}
+				}
+			}
+			break;
+		default:
+			best = 0;
+	}
+	LOG(L_DBG,"get_balanced_route: %s chose %.*s out of %d peers with metric %d\n",
+		routing_policy_to_str(policy),peers[best]->fqdn.len,peers[best]->fqdn.s,n,metric);
+	return peers[best];
+}
+
 /**
  * Get the first connect peer that matches the routing mechanisms.
  * - First the Destination-Host AVP value is tried if connected (the peer does not have to
  * be in the routing table at all).
  * - Then we look for a connected peer in the specific realm for the Destination-Realm AVP
- * - Then we look for the first connected peer in the default routes
+ * - Then we look for a connected peer in the default routes
+ * In the realm and in the default routes, the peer is chosen according to the configured policy.
  * @param m - the Diameter message to find the destination peer for
  * @returns - the connected peer or null if none connected found
  */  
@@ -178,15 +292,16 @@ peer* get_routing_peer(AAAMessage *m)
 				strncasecmp(rr->realm.s,destination_realm.s,destination_realm.len)==0)
 					break;
 		if (rr) {
-			p = get_first_connected_route(rr->routes,app_id,vendor_id);
+			p = get_balanced_route(rr->routes,rr->policy,&(rr->rr_next),m,app_id,vendor_id);
 			if (p) return p;
 			else LOG(L_ERR,"ERROR:get_routing_peer(): No connected Route peer found for Realm <%.*s>. Trying DefaultRoutes next...\n",
 					destination_realm.len,destination_realm.s);
 		}	 
 	}
 	/* if not found in the realms or no destination_realm, 
-	 * get the first connected host in default routes */
-	p = get_first_connected_route(config->r_table->routes,app_id,vendor_id);
+	 * get a connected host in default routes */
+	p = get_balanced_route(config->r_table->routes,config->r_table->policy,&(config->r_table->rr_next),
+		m,app_id,vendor_id);
 	if (!p){
 		LOG(L_ERR,"ERROR:get_routing_peer(): No connected DefaultRoute peer found for app_id %d and vendor id %d.\n",
 				app_id,vendor_id);
@@ -0,0 +1,203 @@
+/**
+ * $Id$
+ *  
+ * Copyright (C) 2004-2006 FhG Fokus
+ *
+ * This file is part of Open IMS Core - an open source IMS CSCFs & HSS
+ * implementation
+ *
+ * Open IMS Core is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * For a license to use the Open IMS Core software under conditions
+ * other than those described here, or to purchase support for this
+ * software, please contact Fraunhofer FOKUS by e-mail at the following
+ * addresses:
+ *     info@open-ims.org
+ *
+ * Open IMS Core is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * It has to be noted that this Open Source IMS Core System is not 
+ * intended to become or act as a product in a commercial context! Its 
+ * sole purpose is to provide an IMS core reference implementation for 
+ * IMS technology testing and IMS application prototyping for research 
+ * purposes, typically performed in IMS test-beds.
+ * 
+ * Users of the Open Source IMS Core System have to be aware that IMS
+ * technology may be subject of patents and licence terms, as being 
+ * specified within the various IMS-related IETF, ITU-T, ETSI, and 3GPP
+ * standards. Thus all Open IMS Core users have to take notice of this 
+ * fact and have to agree to check out carefully before installing, 
+ * using and extending the Open Source IMS Core System, if related 
+ * patents and licences may become applicable to the intended usage 
+ * context.  
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * 
+ */
+ 
+/**
+ * \file
+ * 
+ * CDiameterPeer Per-peer shared memory send queues
+ * 
+ * The queue is the intrusive MPSC queue of D. Vyukov: the producers link in with a single
+ * atomic exchange, so they never wait for each other or for the consumer.
+ * 
+ */
+
+#include "send_queue.h"
+
+#ifdef CDP_SEND_QUEUE
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+
+#include "../../atomic_ops.h"
+#include "diameter_api.h"
+
+/**
+ * Creates a new send queue, with its eventfd.
+ * \note This must be called before forking, so that all the processes inherit the eventfd.
+ * @returns the new queue or NULL on error
+ */
+send_queue_t* send_queue_new()
+{
+	send_queue_t *q;
+
+	q = shm_malloc(sizeof(send_queue_t));
+	if (!q){
+		LOG_NO_MEM("shm",(int)sizeof(send_queue_t));
+		return 0;
+	}
+	memset(q,0,sizeof(send_queue_t));
+	q->event_fd = eventfd(0,EFD_NONBLOCK);
+	if (q->event_fd<0){
+		LOG(L_ERR,"ERROR:send_queue_new(): eventfd failed > %s\n",strerror(errno));
+		shm_free(q);
+		return 0;
+	}
+	q->in = (long)&q->stub;
+	q->out = &q->stub;
+	return q;
+}
+
+/**
+ * Frees a send queue and the messages still in it.
+ * @param q - the queue to free
+ */
+void send_queue_free(send_queue_t *q)
+{
+	if (!q) return;
+	send_queue_flush(q);
+	close(q->event_fd);
+	shm_free(q);
+}
+
+/**
+ * Links a message in, without signalling.
+ */
+static inline void send_queue_link(send_queue_t *q,AAAMessage *msg)
+{
+	AAAMessage *prev;
+
+	msg->send_next = 0;
+	prev = (AAAMessage*) mb_atomic_get_and_set_long(&q->in,(long)msg);
+	/* between the swap and this store the consumer sees the queue as empty - it is 
+	 * signalled only after, so it will come back */
+	prev->send_next = msg;
+}
+
+/**
+ * Pushes a message on the queue and signals the consumer.
+ * Can be called from any process.
+ * @param q - the queue
+ * @param msg - the message to send; it will be freed after sending
+ * @returns 1 on success, 0 if the consumer could not be signalled (the message is queued anyway)
+ */
+int send_queue_push(send_queue_t *q,AAAMessage *msg)
+{
+	uint64_t one=1;
+
+	send_queue_link(q,msg);
+	while (write(q->event_fd,&one,sizeof(one))<0){
+		if (errno==EINTR) continue;
+		/* EAGAIN means the counter is saturated - a signal is pending anyway */
+		if (errno==EAGAIN) break;
+		LOG(L_ERR,"ERROR:send_queue_push(): eventfd write failed > %s\n",strerror(errno));
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Pops the next message from the queue. Only to be called by the consumer.
+ * @param q - the queue
+ * @returns the message or NULL if the queue is empty (or a push is in progress, which will signal again)
+ */
+AAAMessage* send_queue_pop(send_queue_t *q)
+{
+	AAAMessage *out,*next;
+
+	out = q->out;
+	next = out->send_next;
+	if (out==&q->stub){
+		if (!next) return 0;
+		q->out = next;
+		out = next;
+		next = next->send_next;
+	}
+	if (next){
+		q->out = next;
+		membar_read();
+		return out;
+	}
+	if (out!=(AAAMessage*)atomic_get_long(&q->in)) 
+		return 0;
+	/* out is the last one - push the stub behind it, so that out can be unlinked */
+	send_queue_link(q,&q->stub);
+	next = out->send_next;
+	if (next){
+		q->out = next;
+		membar_read();
+		return out;
+	}
+	return 0;
+}
+
+/**
+ * Clears the signal on the eventfd. To be called by the consumer before draining the queue.
+ * @param q - the queue
+ */
+void send_queue_ack(send_queue_t *q)
+{
+	uint64_t cnt;
+	
+	while (read(q->event_fd,&cnt,sizeof(cnt))<0 && errno==EINTR)
+		;
+}
+
+/**
+ * Drops all the messages in the queue. Only to be called by the consumer, e.g. on disconnect.
+ * @param q - the queue
+ */
+void send_queue_flush(send_queue_t *q)
+{
+	AAAMessage *msg;
+	
+	send_queue_ack(q);
+	while ((msg=send_queue_pop(q))!=0)
+		AAAFreeMessage(&msg);
+}
+
+#endif /* CDP_SEND_QUEUE */
@@ -0,0 +1,96 @@
+/**
+ * $Id$
+ *  
+ * Copyright (C) 2004-2006 FhG Fokus
+ *
+ * This file is part of Open IMS Core - an open source IMS CSCFs & HSS
+ * implementation
+ *
+ * Open IMS Core is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * For a license to use the Open IMS Core software under conditions
+ * other than those described here, or to purchase support for this
+ * software, please contact Fraunhofer FOKUS by e-mail at the following
+ * addresses:
+ *     info@open-ims.org
+ *
+ * Open IMS Core is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * It has to be noted that this Open Source IMS Core System is not 
+ * intended to become or act as a product in a commercial context! Its 
+ * sole purpose is to provide an IMS core reference implementation for 
+ * IMS technology testing and IMS application prototyping for research 
+ * purposes, typically performed in IMS test-beds.
+ * 
+ * Users of the Open Source IMS Core System have to be aware that IMS
+ * technology may be subject of patents and licence terms, as being 
+ * specified within the various IMS-related IETF, ITU-T, ETSI, and 3GPP
+ * standards. Thus all Open IMS Core users have to take notice of this 
+ * fact and have to agree to check out carefully before installing, 
+ * using and extending the Open Source IMS Core System, if related 
+ * patents and licences may become applicable to the intended usage 
+ * context.  
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * 
+ */
+ 
+/**
+ * \file
+ * 
+ * CDiameterPeer Per-peer shared memory send queues
+ * 
+ * The processes which send out requests push the messages on the queue of the peer and
+ * signal its eventfd. The receiver process servicing the peer drains the queue and writes
+ * out the messages in batches. This replaces the open()/write()/close() on the send pipe
+ * for each message, which stays as a fallback for the peers without a queue (e.g. the
+ * dynamic peers, which are created after the fork).
+ * 
+ */
+
+#ifndef __CDP_SEND_QUEUE_H
+#define __CDP_SEND_QUEUE_H
+
+#include "utils.h"
+#include "diameter.h"
+
+#if defined(CDP_FOR_SER) && defined(__linux__) && !defined(CDP_NO_SEND_QUEUE)
+	#define CDP_SEND_QUEUE
+#endif
+
+/** Maximum number of messages written out with one writev() */
+#define DP_SEND_BATCH 64
+
+#ifdef CDP_SEND_QUEUE
+
+/**
+ * Lock-free multiple producers - single consumer queue of messages, linked through
+ * AAAMessage->send_next. The producers only swap the in pointer, the consumer 
+ * (the receiver process servicing the peer) owns the out end.
+ */
+typedef struct _send_queue_t {
+	volatile long in;			/**< last pushed message (AAAMessage*) - swapped by producers */
+	AAAMessage *out;			/**< next message to pop - only used by the consumer */
+	AAAMessage stub;			/**< placeholder for the empty queue */
+	int event_fd;				/**< eventfd signalled on each push */
+} send_queue_t;
+
+send_queue_t* send_queue_new();
+void send_queue_free(send_queue_t *q);
+
+int send_queue_push(send_queue_t *q,AAAMessage *msg);
+AAAMessage* send_queue_pop(send_queue_t *q);
+void send_queue_ack(send_queue_t *q);
+void send_queue_flush(send_queue_t *q);
+
+#endif /* CDP_SEND_QUEUE */
+
+#endif
@@ -160,6 +160,7 @@ int cdp_sessions_init(int hash_size)
 			goto error;
 		}
 		sessions[i].lock = lock_init(sessions[i].lock);
+		sessions[i].expiry_tick = time(0);
 	}
 	
 	session_id1 = shm_malloc(sizeof(unsigned int));
@@ -271,6 +272,70 @@ error:
 	return 0;
 }
 
+/**
+ * Returns the next second at which the timer has something to do for the session.
+ * This is the earliest of timeout and lifetime, as lifetime+grace can only come later.
+ * @param x - the session
+ * @returns the deadline or -1 if the timer does not care about this session
+ */
+static inline time_t cdp_session_deadline(cdp_session_t *x)
+{
+	time_t t=-1;
+	switch (x->type){
+		case AUTH_CLIENT_STATEFULL:
+		case AUTH_SERVER_STATEFULL:
+			if (x->u.auth.timeout>=0) t = x->u.auth.timeout;
+			if (x->u.auth.lifetime>0 && (t<0 || x->u.auth.lifetime<t)) t = x->u.auth.lifetime;
+			break;
+		default:
+			break;
+	}
+	return t;
+}
+
+/**
+ * Removes the session from the expiry wheel of its slot.
+ * \note Must be called with a lock on the x->hash
+ * @param x - the session
+ */
+static inline void cdp_session_expiry_del(cdp_session_t *x)
+{
+	if (!x->expiry_tick) return;
+	if (x->eprev) x->eprev->enext = x->enext;
+	else sessions[x->hash].expiry[x->expiry_tick%CDP_SESSION_EXPIRY_WHEEL] = x->enext;
+	if (x->enext) x->enext->eprev = x->eprev;
+	x->enext = 0;
+	x->eprev = 0;
+	x->expiry_tick = 0;
+}
+
+/**
+ * Files the session in the expiry wheel of its slot, at its next deadline.
+ * Overdue sessions are filed for the next second, so that the timer keeps on 
+ * firing them once per second, as long as the state machine does not move them.
+ * \note Must be called with a lock on the x->hash
+ * @param x - the session
+ */
+void cdp_session_expiry_update(cdp_session_t *x)
+{
+	cdp_session_list_t *slot=sessions+x->hash;
+	cdp_session_t **b;
+	unsigned int tick;
+	time_t t;
+	
+	cdp_session_expiry_del(x);
+	t = cdp_session_deadline(x);
+	if (t<0) return;
+	tick = t;
+	if (tick<=slot->expiry_tick) tick = slot->expiry_tick+1;
+	x->expiry_tick = tick;
+	b = slot->expiry+tick%CDP_SESSION_EXPIRY_WHEEL;
+	x->eprev = 0;
+	x->enext = *b;
+	if (*b) (*b)->eprev = x;
+	*b = x;
+}
+
 /**
  * Adds the session to the session list.
  * \note This returns with a lock, so unlock when done
@@ -289,6 +354,7 @@ void cdp_add_session(cdp_session_t *x)
 	if (sessions[x->hash].tail) sessions[x->hash].tail->next = x;
 	sessions[x->hash].tail = x;
 	if (!sessions[x->hash].head) sessions[x->hash].head = x;	
+	cdp_session_expiry_update(x);
 }
 
 /**
@@ -335,6 +401,8 @@ void del_session(cdp_session_t *x)
 		return;
 	}
 
+	cdp_session_expiry_del(x);
+	
 	if (sessions[x->hash].head == x) sessions[x->hash].head = x->next;
 	else if (x->prev) x->prev->next = x->next;
 	if (sessions[x->hash].tail == x) sessions[x->hash].tail = x->prev;
@@ -425,48 +493,79 @@ void cdp_sessions_log(int level)
 	LOG(level,"-------------------------------------\n");
 }
 
+/**
+ * Returns the timer event due for an auth session.
+ * @param x - the session
+ * @param now - the current time
+ * @returns the event or -1 if nothing is due yet
+ */
+static inline int cdp_session_timer_event(cdp_session_t *x,time_t now)
+{
+	if (x->u.auth.timeout>=0 && x->u.auth.timeout<=now){
+		//Session timeout
+		LOG(L_CRIT,"session TIMEOUT\n");
+		return AUTH_EV_SESSION_TIMEOUT;
+	}
+	if (x->u.auth.lifetime>0 && x->u.auth.lifetime+x->u.auth.grace_period<=now){
+		//lifetime + grace timeout
+		LOG(L_CRIT,"lifetime+grace TIMEOUT\n");
+		return AUTH_EV_SESSION_GRACE_TIMEOUT;
+	}
+	if (x->u.auth.lifetime>0 && x->u.auth.lifetime<=now){
+		//lifetime timeout
+		LOG(L_CRIT,"lifetime TIMEOUT\n");
+		return AUTH_EV_SESSION_LIFETIME_TIMEOUT;
+	}
+	return -1;
+}
+
+/**
+ * Timer for the sessions.
+ * Only the expiry wheel buckets of the seconds elapsed since the last run are looked at, 
+ * and in those only the sessions which are due in this turn of the wheel.
+ * The state machines release the slot lock, so the bucket is rescanned after each event.
+ * @param now - the current time
+ * @param ptr - unused
+ */
 int cdp_sessions_timer(time_t now, void* ptr)
 {
-	int hash;
-	cdp_session_t *x,*n;
-	for(hash=0;hash<sessions_hash_size;hash++){		
+	int hash,event;
+	unsigned int tick,last;
+	cdp_session_list_t *slot;
+	cdp_session_t *x;
+	
+	for(hash=0;hash<sessions_hash_size;hash++){
+		slot = sessions+hash;
 		AAASessionsLock(hash);
-		for(x = sessions[hash].head;x;x=n) {
-			n = x->next;
-			switch (x->type){
-				case AUTH_CLIENT_STATEFULL:
-					if (x->u.auth.timeout>=0 && x->u.auth.timeout<=now){
-						//Session timeout
-						LOG(L_CRIT,"session TIMEOUT\n");
-						auth_client_statefull_sm_process(x,AUTH_EV_SESSION_TIMEOUT,0);
-					} else if (x->u.auth.lifetime>0 && x->u.auth.lifetime+x->u.auth.grace_period<=now){
-						//lifetime + grace timeout
-						LOG(L_CRIT,"lifetime+grace TIMEOUT\n");
-						auth_client_statefull_sm_process(x,AUTH_EV_SESSION_GRACE_TIMEOUT,0);
-					}else if (x->u.auth.lifetime>0 && x->u.auth.lifetime<=now){
-						//lifetime timeout
-						LOG(L_CRIT,"lifetime+grace TIMEOUT\n");
-						auth_client_statefull_sm_process(x,AUTH_EV_SESSION_LIFETIME_TIMEOUT,0);
-					}
-					break;
-				case AUTH_SERVER_STATEFULL:
-					if (x->u.auth.timeout>=0 && x->u.auth.timeout<=now){
-						//Session timeout
-						LOG(L_CRIT,"session TIMEOUT\n");
-						auth_server_statefull_sm_process(x,AUTH_EV_SESSION_TIMEOUT,0);
-					}else if (x->u.auth.lifetime>0 && x->u.auth.lifetime+x->u.auth.grace_period<=now){
-						//lifetime + grace timeout
-						LOG(L_CRIT,"lifetime+grace TIMEOUT\n");
-						auth_server_statefull_sm_process(x,AUTH_EV_SESSION_GRACE_TIMEOUT,0);
-					}else if (x->u.auth.lifetime>0 && x->u.auth.lifetime<=now){
-						//lifetime timeout
-						LOG(L_CRIT,"lifetime+grace TIMEOUT\n");
-						auth_server_statefull_sm_process(x,AUTH_EV_SESSION_LIFETIME_TIMEOUT,0);
-					}
-					break;
-				default:
-					break;
-					
+		last = slot->expiry_tick;
+		if ((unsigned int)now<=last){
+			AAASessionsUnlock(hash);
+			continue;
+		}
+		slot->expiry_tick = now;
+		/* after a stall, one turn of the wheel covers everything */
+		if ((unsigned int)now-last>CDP_SESSION_EXPIRY_WHEEL) last = now-CDP_SESSION_EXPIRY_WHEEL;
+		for(tick=last+1;tick<=(unsigned int)now;tick++){
+			x = slot->expiry[tick%CDP_SESSION_EXPIRY_WHEEL];
+			while(x){
+				if (x->expiry_tick>now) {
+					/* a later turn of the wheel */
+					x = x->enext;
+					continue;
+				}
+				event = cdp_session_timer_event(x,now);
+				/* refiled for the next second or for its real deadline if this was changed meanwhile */
+				cdp_session_expiry_update(x);
+				if (event<0) {
+					x = slot->expiry[tick%CDP_SESSION_EXPIRY_WHEEL];
+					continue;
+				}
+				if (x->type==AUTH_CLIENT_STATEFULL)
+					auth_client_statefull_sm_process(x,event,0);
+				else
+					auth_server_statefull_sm_process(x,event,0);
+				AAASessionsLock(hash);
+				x = slot->expiry[tick%CDP_SESSION_EXPIRY_WHEEL];
 			}
 		}
 		AAASessionsUnlock(hash);
@@ -668,6 +767,16 @@ void AAADropAuthSession(AAASession *s)
 	AAADropSession(s);
 }
 
+/**
+ * Refiles the session in the timer index after u.auth.timeout, lifetime or grace_period 
+ * were changed outside of the state machines.
+ * \note Must be called with a lock on the s->hash
+ */
+void AAAUpdateAuthSessionTimers(AAASession *s)
+{
+	if (s) cdp_session_expiry_update(s);
+}
+
 /**
  * Creates an Accounting Session.
  */
@@ -683,3 +792,57 @@ void AAADropAccSession(AAASession *s)
 {
 	free_session(s);
 }
+
+
+#ifdef CDP_FOR_SER
+
+const char* cdp_rpc_sessions_doc[] = {
+	"Number of Diameter sessions by type and of the statefull auth sessions by state.",
+	0
+};
+
+/**
+ * RPC function returning the session counts.
+ * Each slot is locked only while it is counted.
+ */
+void cdp_rpc_sessions(rpc_t* rpc, void* ctx)
+{
+	void *handle;
+	int hash;
+	int type[ACCT_SERVER_STATEFULL+1];
+	int state[AUTH_ST_DISCON+1];
+	cdp_session_t *x;
+	
+	if (!sessions) {
+		rpc->fault(ctx, 500, "No sessions table");
+		return;
+	}
+	memset(type,0,sizeof(type));
+	memset(state,0,sizeof(state));
+	for(hash=0;hash<sessions_hash_size;hash++){
+		AAASessionsLock(hash);
+		for(x = sessions[hash].head;x;x=x->next){
+			if (x->type<=ACCT_SERVER_STATEFULL) type[x->type]++;
+			if ((x->type==AUTH_CLIENT_STATEFULL || x->type==AUTH_SERVER_STATEFULL) &&
+				x->u.auth.state<=AUTH_ST_DISCON) state[x->u.auth.state]++;
+		}
+		AAASessionsUnlock(hash);
+	}
+	if (rpc->add(ctx, "{", &handle) < 0) return;
+	rpc->struct_add(handle, "dddddddddddd",
+		"unknown", type[UNKNOWN_SESSION],
+		"auth_client_stateless", type[AUTH_CLIENT_STATELESS],
+		"auth_server_stateless", type[AUTH_SERVER_STATELESS],
+		"auth_client_statefull", type[AUTH_CLIENT_STATEFULL],
+		"auth_server_statefull", type[AUTH_SERVER_STATEFULL],
+		"acct_client", type[ACCT_CLIENT],
+		"acct_server_stateless", type[ACCT_SERVER_STATELESS],
+		"acct_server_statefull", type[ACCT_SERVER_STATEFULL],
+		"auth_idle", state[AUTH_ST_IDLE],
+		"auth_pending", state[AUTH_ST_PENDING],
+		"auth_open", state[AUTH_ST_OPEN],
+		"auth_discon", state[AUTH_ST_DISCON]
+	);
+}
+
+#endif
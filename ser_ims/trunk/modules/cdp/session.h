@@ -204,17 +204,26 @@ typedef struct _cdp_session_t {
 	AAASessionCallback_f *cb;			/**< session callback function */
 	
 	struct _cdp_session_t *next,*prev; 	
+	
+	unsigned int expiry_tick;			/**< second at which the timer looks at the session, 0 if not filed */
+	struct _cdp_session_t *enext,*eprev;/**< neighbours in the expiry wheel bucket */
 } cdp_session_t;
 
+/** Size of the per-slot expiry wheel, in seconds */
+#define CDP_SESSION_EXPIRY_WHEEL 64
+
 /** Session list structure */
 typedef struct _cdp_session_list_t {		
 	gen_lock_t *lock;				/**< lock for list operations */
 	cdp_session_t *head,*tail;		/**< first, last sessions in the list */ 
+	unsigned int expiry_tick;		/**< last second processed by the timer on this slot */
+	cdp_session_t *expiry[CDP_SESSION_EXPIRY_WHEEL];	/**< sessions by the second of their next deadline */
 } cdp_session_list_t;
 
 
 
 int cdp_sessions_init(int hash_size);
+unsigned int get_str_hash(str x,int hash_size);
 int cdp_sessions_destroy();
 void cdp_sessions_log(int level);
 int cdp_sessions_timer(time_t now, void* ptr);
@@ -223,6 +232,13 @@ cdp_session_t* cdp_get_session(str id);
 cdp_session_t* cdp_new_session(str id,cdp_session_type_t type); //this function is needed in the peerstatemachine
 void cdp_add_session(cdp_session_t *x);
 cdp_session_t* cdp_new_auth_session(str id,int is_client,int is_statefull);
+void cdp_session_expiry_update(cdp_session_t *x);
+
+#ifdef CDP_FOR_SER
+	#include "../../rpc.h"
+	extern const char* cdp_rpc_sessions_doc[];
+	void cdp_rpc_sessions(rpc_t* rpc, void* ctx);
+#endif
 
 
 /*           API Exported */
@@ -266,6 +282,9 @@ typedef void (*AAADropAuthSession_f)(AAASession *s);
 void AAATerminateAuthSession(AAASession *s);
 typedef void (*AAATerminateAuthSession_f)(AAASession *s);
 
+void AAAUpdateAuthSessionTimers(AAASession *s);
+typedef void (*AAAUpdateAuthSessionTimers_f)(AAASession *s);
+
 
 
 
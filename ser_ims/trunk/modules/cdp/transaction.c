@@ -59,24 +59,42 @@
 #include "globals.h"
 
 
-cdp_trans_list_t *trans_list=0;		/**< list of transactions */
+int trans_hash_size=1024;			/**< the size of the transactions hash table */
+cdp_trans_list_t *trans_table=0;	/**< hash table of transactions, indexed by hop-by-hop id */
+
+/**
+ * Computes the hash slot of a transaction.
+ * The Hop-by-hop id is a counter incremented for each new request, so it spreads evenly.
+ * @param hopbyhopid - the Hop-by-hop id of the request/answer
+ * @returns the hash slot
+ */
+#define trans_hash(hopbyhopid) ((hopbyhopid)%trans_hash_size)
 
 /**
  * Initializes the transaction structure.
  * Also adds a timer callback for checking the transaction statuses
+ * @param hash_size - size of the transactions hash table
  * @returns 1 if success or 0 on error
  */
-int cdp_trans_init()
+int cdp_trans_init(int hash_size)
 {
-	trans_list = shm_malloc(sizeof(cdp_trans_list_t));
-	if (!trans_list){
-		LOG_NO_MEM("shm",sizeof(cdp_trans_list_t));
+	int i;
+	if (hash_size<=0) hash_size = 1;
+	trans_hash_size = hash_size;
+	trans_table = shm_malloc(sizeof(cdp_trans_list_t)*trans_hash_size);
+	if (!trans_table){
+		LOG_NO_MEM("shm",sizeof(cdp_trans_list_t)*trans_hash_size);
 		return 0;
 	}
-	trans_list->head = 0;
-	trans_list->tail = 0;
-	trans_list->lock = lock_alloc();
-	trans_list->lock = lock_init(trans_list->lock);
+	memset(trans_table,0,sizeof(cdp_trans_list_t)*trans_hash_size);
+	for(i=0;i<trans_hash_size;i++){
+		trans_table[i].lock = lock_alloc();
+		if (!trans_table[i].lock){
+			LOG_NO_MEM("lock",sizeof(gen_lock_t));
+			return 0;
+		}
+		trans_table[i].lock = lock_init(trans_table[i].lock);
+	}
 
 	add_timer(1,0,cdp_trans_timer,0);
 	return 1;
@@ -85,33 +103,75 @@ int cdp_trans_init()
 int cdp_trans_destroy()
 {
 	cdp_trans_t *t=0;
-	if (trans_list){
-		lock_get(trans_list->lock);
-		while(trans_list->head){
-			t = trans_list->head;
-			trans_list->head = t->next;
-			cdp_free_trans(t);
-		}		
-		lock_destroy(trans_list->lock);
-		lock_dealloc((void*)trans_list->lock);
-		shm_free(trans_list);
-		trans_list = 0;
+	int i;
+	if (trans_table){
+		for(i=0;i<trans_hash_size;i++){
+			if (!trans_table[i].lock) continue;
+			lock_get(trans_table[i].lock);
+			while(trans_table[i].head){
+				t = trans_table[i].head;
+				trans_table[i].head = t->next;
+				cdp_free_trans(t);
+			}		
+			lock_destroy(trans_table[i].lock);
+			lock_dealloc((void*)trans_table[i].lock);
+		}
+		shm_free(trans_table);
+		trans_table = 0;
 	}
 	
 	return 1;
 }
+
+/**
+ * Unlink a transaction from its hash slot.
+ * \note Must be called with the lock on the slot taken.
+ * @param l - the hash slot
+ * @param x - the transaction to unlink
+ */
+void trans_unlink(cdp_trans_list_t *l,cdp_trans_t *x)
+{
+	if (x->prev) x->prev->next = x->next;
+	else l->head = x->next;
+	if (x->next) x->next->prev = x->prev;
+	else l->tail = x->prev;
+	x->next = 0;
+	x->prev = 0;
+}
+
+/**
+ * Finds a transaction matching both the Hop-by-hop and the End-to-end ids of a message.
+ * \note Must be called with the lock on the slot taken.
+ * @param l - the hash slot
+ * @param msg - the message to match
+ * @returns the cdp_trans_t* if found or NULL if not
+ */
+cdp_trans_t* trans_find(cdp_trans_list_t *l,AAAMessage *msg)
+{
+	cdp_trans_t *x;
+	for(x=l->head;x;x=x->next)
+		if (x->hopbyhopid==msg->hopbyhopId && x->endtoendid==msg->endtoendId)
+			return x;
+	return 0;
+}
+
 /**
  * Create and add a transaction to the transaction list.
+ * The slot is kept ordered by expiration. As the timeout is usually the same for all 
+ * transactions, the insertion point is found right away by walking back from the tail.
  * @param msg - the message that this related to
+ * @param p - the peer the message is sent to; its pending requests counter is incremented
+ * until the transaction ends (only for the configured peers, as the dynamic ones might be freed)
  * @param cb - callback to be called on response or time-out
  * @param ptr - generic pointer to pass to the callback on call
  * @param timeout - timeout time in seconds
  * @param auto_drop - whether to auto drop the transaction on event, or let the application do it later
  * @returns the created cdp_trans_t* or NULL on error 
  */
-inline cdp_trans_t* cdp_add_trans(AAAMessage *msg,AAATransactionCallback_f *cb, void *ptr,int timeout,int auto_drop)
+inline cdp_trans_t* cdp_add_trans(AAAMessage *msg,peer *p,AAATransactionCallback_f *cb, void *ptr,int timeout,int auto_drop)
 {
-	cdp_trans_t *x;
+	cdp_trans_t *x,*y;
+	cdp_trans_list_t *l;
 	x = shm_malloc(sizeof(cdp_trans_t));
 	if (!x) {
 		LOG_NO_MEM("shm",sizeof(cdp_trans_t));
@@ -129,17 +189,47 @@ inline cdp_trans_t* cdp_add_trans(AAAMessage *msg,AAATransactionCallback_f *cb,
 	*(x->ptr) = ptr;
 	x->expires = timeout + time(0);
 	x->auto_drop = auto_drop;
-	x->next = 0;
+	x->ans = 0;
+	x->hash = trans_hash(x->hopbyhopid);
+	x->p = 0;
+	if (p && !p->is_dynamic){
+		x->p = p;
+		lock_get(p->lock);
+		p->pending++;
+		lock_release(p->lock);
+	}
+	l = trans_table+x->hash;
 
-	lock_get(trans_list->lock);
-	x->prev = trans_list->tail;
-	if (trans_list->tail) trans_list->tail->next = x;
-	trans_list->tail = x;
-	if (!trans_list->head) trans_list->head = x;
-	lock_release(trans_list->lock);
+	lock_get(l->lock);
+	for(y=l->tail;y && y->expires>x->expires;y=y->prev);
+	x->prev = y;
+	if (y){
+		x->next = y->next;
+		y->next = x;
+	}else{
+		x->next = l->head;
+		l->head = x;
+	}
+	if (x->next) x->next->prev = x;
+	else l->tail = x;
+	lock_release(l->lock);
 	return x;
 }
 
+/**
+ * Stops counting an ended transaction in the pending requests of its peer.
+ * \note Must be called after unlinking and without the slot lock, as the peer lock is taken.
+ * @param x - the transaction
+ */
+void trans_release_peer(cdp_trans_t *x)
+{
+	if (!x->p) return;
+	lock_get(x->p->lock);
+	x->p->pending--;
+	lock_release(x->p->lock);
+	x->p = 0;
+}
+
 /**
  * Remove from the list and deallocate a transaction.
  * @param msg - the message that relates to that particular transaction
@@ -147,17 +237,16 @@ inline cdp_trans_t* cdp_add_trans(AAAMessage *msg,AAATransactionCallback_f *cb,
 inline void del_trans(AAAMessage *msg)
 {
 	cdp_trans_t *x;
-	lock_get(trans_list->lock);
-	x = trans_list->head;
-	while(x&& x->endtoendid!=msg->endtoendId && x->hopbyhopid!=msg->hopbyhopId) x = x->next;
+	cdp_trans_list_t *l;
+	l = trans_table+trans_hash(msg->hopbyhopId);
+	lock_get(l->lock);
+	x = trans_find(l,msg);
+	if (x) trans_unlink(l,x);
+	lock_release(l->lock);
 	if (x){
-		if (x->prev) x->prev->next = x->next;
-		else trans_list->head = x->next;
-		if (x->next) x->next->prev = x->prev;
-		else trans_list->tail = x->prev;
+		trans_release_peer(x);
 		cdp_free_trans(x);
 	}
-	lock_release(trans_list->lock);
 }
 
 /**
@@ -168,16 +257,13 @@ inline void del_trans(AAAMessage *msg)
 inline cdp_trans_t* cdp_take_trans(AAAMessage *msg)
 {
 	cdp_trans_t *x;
-	lock_get(trans_list->lock);
-	x = trans_list->head;
-	while(x&& x->endtoendid!=msg->endtoendId && x->hopbyhopid!=msg->hopbyhopId) x = x->next;
-	if (x){
-		if (x->prev) x->prev->next = x->next;
-		else trans_list->head = x->next;
-		if (x->next) x->next->prev = x->prev;
-		else trans_list->tail = x->prev;
-	}
-	lock_release(trans_list->lock);
+	cdp_trans_list_t *l;
+	l = trans_table+trans_hash(msg->hopbyhopId);
+	lock_get(l->lock);
+	x = trans_find(l,msg);
+	if (x) trans_unlink(l,x);
+	lock_release(l->lock);
+	if (x) trans_release_peer(x);
 	return x;
 }
 
@@ -193,35 +279,42 @@ inline void cdp_free_trans(cdp_trans_t *x)
 
 /**
  * Timer callback for checking the transaction status.
+ * Only the expired transactions at the head of each slot are looked at. They are unlinked
+ * under the slot lock and the time-out callbacks are fired after releasing it.
  * @param now - time of call
  * @param ptr - generic pointer, passed to the transactional callbacks
  */
 int cdp_trans_timer(time_t now, void* ptr)
 {
-	cdp_trans_t *x,*n;	
+	cdp_trans_t *x,*expired;
+	cdp_trans_list_t *l;
+	int i,auto_drop;
 	LOG(L_MEM,"DBG:trans_timer(): taking care of diameter transactions...\n");
-	lock_get(trans_list->lock);
-	x = trans_list->head;
-	while(x)
-	{
-		if (now>x->expires){
+	for(i=0;i<trans_hash_size;i++){
+		l = trans_table+i;
+		if (!l->head) continue;
+		expired = 0;
+		lock_get(l->lock);
+		while(l->head && now>l->head->expires){
+			x = l->head;
+			trans_unlink(l,x);
+			x->next = expired;
+			expired = x;
+		}
+		lock_release(l->lock);
+		
+		while(expired){
+			x = expired;
+			expired = x->next;
+			x->next = 0;
 			x->ans = 0;
-			if (x->cb){
-				(x->cb)(1,*(x->ptr),0);
-			}
-			n = x->next;
-			
-			if (x->prev) x->prev->next = x->next;
-			else trans_list->head = x->next;
-			if (x->next) x->next->prev = x->prev;
-			else trans_list->tail = x->prev;
-			if (x->auto_drop) cdp_free_trans(x);
-			
-			x = n;
-		} else 
-			x = x->next;
+			trans_release_peer(x);
+			/* after the callback, a transaction which is not auto-dropped belongs to the waiter */
+			auto_drop = x->auto_drop;
+			if (x->cb) (x->cb)(1,*(x->ptr),0);
+			if (auto_drop) cdp_free_trans(x);
+		}
 	}
-	lock_release(trans_list->lock);
 	return 1;
 }
 
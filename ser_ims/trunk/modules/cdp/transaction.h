@@ -58,6 +58,7 @@
 #include "utils.h"
 #include "diameter.h"
 #include "diameter_api.h"
+#include "peer.h"
 
 /** Diameter Transaction representation */
 typedef struct _cdp_trans_t{
@@ -68,20 +69,24 @@ typedef struct _cdp_trans_t{
 	AAAMessage *ans;				/**< answer for the transaction */
 	time_t expires;					/**< time of expiration, when a time-out event will happen */
 	int auto_drop;					/**< if to drop automatically the transaction on event or to let the app do it later */
-	struct _cdp_trans_t *next;		/**< the next transaction in the transaction list */
-	struct _cdp_trans_t *prev;		/**< the previous transaction in the transaction list */
+	unsigned int hash;				/**< slot in the transactions hash table */
+	peer *p;						/**< peer the request was sent to, counted in its pending requests */
+	struct _cdp_trans_t *next;		/**< the next transaction in the hash slot */
+	struct _cdp_trans_t *prev;		/**< the previous transaction in the hash slot */
 } cdp_trans_t;
 
-/** Diameter Transaction list */
+/** Diameter Transaction hash slot.
+ * The transactions in a slot are kept ordered by expiration time, so that the timer only
+ * has to look at the head of each slot to find the expired ones. */
 typedef struct {		
-	gen_lock_t *lock;				/**< lock for list operations */
-	cdp_trans_t *head,*tail;		/**< first, last transactions in the list */ 
+	gen_lock_t *lock;				/**< lock for slot operations */
+	cdp_trans_t *head,*tail;		/**< first (earliest to expire), last transactions in the slot */ 
 } cdp_trans_list_t;
 
-int cdp_trans_init();
+int cdp_trans_init(int hash_size);
 int cdp_trans_destroy();
 
-inline cdp_trans_t* cdp_add_trans(AAAMessage *msg,AAATransactionCallback_f *cb, void *ptr,int timeout,int auto_drop);
+inline cdp_trans_t* cdp_add_trans(AAAMessage *msg,peer *p,AAATransactionCallback_f *cb, void *ptr,int timeout,int auto_drop);
 void del_trans(AAAMessage *msg);
 inline cdp_trans_t* cdp_take_trans(AAAMessage *msg);
 inline void cdp_free_trans(cdp_trans_t *x);
@@ -50,6 +50,11 @@
  * 
  * This the process pool representation that is used for processing incoming messages. 
  * 
+ * Each worker has its own task queue. The tasks are put in the queue selected by
+ * the hash of their Session-Id, so the messages of a session are processed in 
+ * order by one worker. An idle worker takes the oldest task of a busy queue,
+ * unless a task of the same session is still in progress.
+ * 
  *  \author Dragos Vingarzan vingarzan -at- fokus dot fraunhofer dot de
  * 
  */
@@ -66,42 +71,65 @@
 
 #include "worker.h"
 #include "diameter_api.h"
+#include "session.h"
 
 /* defined in ../diameter_peer.c */
 int dp_add_pid(pid_t pid);
 void dp_del_pid(pid_t pid);
 
 extern dp_config *config;		/**< Configuration for this diameter peer 	*/
+extern int sessions_hash_size;	/**< size of the sessions hash table */
 
-task_queue_t *tasks;			/**< queue of tasks */
+task_queue_t *tasks;			/**< queues of tasks, one per worker */
+int tasks_cnt=0;				/**< number of task queues */
+worker_state_t *workers_state;	/**< state of the workers */
 
 cdp_cb_list_t *callbacks;		/**< list of callbacks for message processing */
 
 
 
 /**
- * Initializes the worker structures, like the task queue.
+ * Initializes the worker structures, like the task queues.
  */
 void worker_init()
 {
-	tasks = shm_malloc(sizeof(task_queue_t));
+	int i;
+	task_queue_t *q;
 	
-	tasks->lock = lock_alloc();
-	tasks->lock = lock_init(tasks->lock);
+	tasks_cnt = config->workers>0?config->workers:1;
+	tasks = shm_malloc(tasks_cnt*sizeof(task_queue_t));
+	if (!tasks) {
+		LOG_NO_MEM("shm",tasks_cnt*sizeof(task_queue_t));
+		goto out_of_memory;
+	}
+	memset(tasks,0,tasks_cnt*sizeof(task_queue_t));
+	workers_state = shm_malloc(tasks_cnt*sizeof(worker_state_t));
+	if (!workers_state) {
+		LOG_NO_MEM("shm",tasks_cnt*sizeof(worker_state_t));
+		goto out_of_memory;
+	}
+	memset(workers_state,0,tasks_cnt*sizeof(worker_state_t));
 	
-	sem_new(tasks->empty,0);
-		
-	sem_new(tasks->full,1);
+	for(i=0;i<tasks_cnt;i++){
+		q = tasks+i;
+		q->lock = lock_alloc();
+		if (!q->lock) goto out_of_memory;
+		q->lock = lock_init(q->lock);
 		
-	tasks->start = 0;
-	tasks->end = 0;
-	tasks->max = config->queue_length;
-	tasks->queue = shm_malloc(tasks->max*sizeof(task_t));
-	if (!tasks->queue) {
-		LOG_NO_MEM("shm",tasks->max*sizeof(task_t));
-		goto out_of_memory;
+		sem_new(q->empty,0);
+			
+		sem_new(q->full,1);
+			
+		q->start = 0;
+		q->end = 0;
+		q->max = config->queue_length;
+		q->queue = shm_malloc(q->max*sizeof(task_t));
+		if (!q->queue) {
+			LOG_NO_MEM("shm",q->max*sizeof(task_t));
+			goto out_of_memory;
+		}
+		memset(q->queue,0,q->max*sizeof(task_t));
 	}
-	memset(tasks->queue,0,tasks->max*sizeof(task_t));
 		
 	callbacks = shm_malloc(sizeof(cdp_cb_list_t));
 	if (!callbacks) goto out_of_memory;
@@ -110,15 +138,21 @@ void worker_init()
 	return;
 out_of_memory:
 	if (tasks){
-		if (tasks->lock) {
-			lock_destroy(tasks->lock);
-			lock_dealloc(&(tasks->lock)); 
+		for(i=0;i<tasks_cnt;i++){
+			q = tasks+i;
+			if (q->lock) {
+				lock_destroy(q->lock);
+				lock_dealloc(q->lock); 
+			}
+			sem_free(q->full);
+			sem_free(q->empty);
+			if (q->queue) shm_free(q->queue);
 		}
-		sem_free(tasks->full);
-		sem_free(tasks->empty);
-		if (tasks->queue) shm_free(tasks->queue);
 		shm_free(tasks);
+		tasks = 0;
 	}
+	if (workers_state) shm_free(workers_state);
+	workers_state = 0;
 	if (callbacks) shm_free(callbacks);
 }
 
@@ -127,7 +161,8 @@ out_of_memory:
  */
 void worker_destroy()
 {
-	int i,sval=0;
+	int i,j,k,sval=0,workers;
+	task_queue_t *q;
 	if (callbacks){
 		while(callbacks->head)
 			cb_remove(callbacks->head);
@@ -135,42 +170,48 @@ void worker_destroy()
 	}
 
 	// to deny runing the poison queue again
+	workers = config->workers;
 	config->workers = 0;
 	if (tasks) {
-	//	LOG(L_CRIT,"-1-\n");
-		lock_get(tasks->lock);
-		for(i=0;i<tasks->max;i++){
-			if (tasks->queue[i].msg) AAAFreeMessage(&(tasks->queue[i].msg));
-			tasks->queue[i].msg = 0;
-			tasks->queue[i].p = 0;
+		for(k=0;k<tasks_cnt;k++){
+			q = tasks+k;
+			lock_get(q->lock);
+			for(i=0;i<q->max;i++){
+				if (q->queue[i].msg) AAAFreeMessage(&(q->queue[i].msg));
+				q->queue[i].msg = 0;
+				q->queue[i].p = 0;
+			}
+			lock_release(q->lock);
 		}
-		lock_release(tasks->lock);
 
 		LOG(L_INFO,"Unlocking workers waiting on empty queue...\n");
-		for(i=0;i<config->workers;i++)
-			sem_release(tasks->empty);
+		for(k=0;k<tasks_cnt && k<workers;k++)
+			sem_release(tasks[k].empty);
 		LOG(L_INFO,"Unlocking workers waiting on full queue...\n");
-		i=0;
-		while(sem_getvalue(tasks->full,&sval)==0)			
-			if (sval<=0) {
-				sem_release(tasks->full);
-				i=1;
-			}
-			else break;
-		sleep(i);
-		
-		lock_get(tasks->lock);
-	//	LOG(L_CRIT,"-2-\n");	
-		shm_free(tasks->queue);
-		lock_destroy(tasks->lock);
-		lock_dealloc((void*)tasks->lock);
-	//	LOG(L_CRIT,"-3-\n");	
-		
-		//lock_release(tasks->empty);
-		sem_free(tasks->full);
-		sem_free(tasks->empty);
+		j=0;
+		for(k=0;k<tasks_cnt;k++){
+			q = tasks+k;
+			while(sem_getvalue(q->full,&sval)==0)			
+				if (sval<=0) {
+					sem_release(q->full);
+					j=1;
+				}
+				else break;
+		}
+		sleep(j);
 		
+		for(k=0;k<tasks_cnt;k++){
+			q = tasks+k;
+			lock_get(q->lock);
+			shm_free(q->queue);
+			lock_destroy(q->lock);
+			lock_dealloc((void*)q->lock);
+			
+			sem_free(q->full);
+			sem_free(q->empty);
+		}
 		shm_free(tasks);
+		shm_free(workers_state);
 	}
 }
 
@@ -278,81 +319,147 @@ void cb_remove(cdp_cb_t *cb)
 
 #else
 	/**
-	 * Adds a message as a task to the task queue.
+	 * Adds a message as a task to the task queue of its session.
 	 * This blocks if the task queue is full, until there is space.
+	 * If the queue was not empty, an idle worker is woken up to take some of them.
 	 * @param p - the peer that the message was received from
 	 * @param msg - the message
 	 * @returns 1 on success, 0 on failure (eg. shutdown in progress)
 	 */ 
 	int put_task(peer *p,AAAMessage *msg)
 	{
-		lock_get(tasks->lock);
-		while ((tasks->end+1)%tasks->max == tasks->start){
-			lock_release(tasks->lock);
+		task_queue_t *q;
+		unsigned int hash;
+		int i,k,depth;
+		
+		if (msg->sessionId && msg->sessionId->data.len)
+			hash = get_str_hash(msg->sessionId->data,sessions_hash_size)+1;
+		else
+			hash = msg->endtoendId%sessions_hash_size+1;
+		k = hash%tasks_cnt;
+		q = tasks+k;
+		
+		lock_get(q->lock);
+		while ((q->end+1)%q->max == q->start){
+			lock_release(q->lock);
 	
 			if (*shutdownx) {
-				sem_release(tasks->full);
+				sem_release(q->full);
 				return 0;
 			}
 			
-			sem_get(tasks->full);
+			sem_get(q->full);
 			
 			if (*shutdownx) {
-				sem_release(tasks->full);
+				sem_release(q->full);
 				return 0;
 			}
 			
-			lock_get(tasks->lock);
+			lock_get(q->lock);
 		}
-		tasks->queue[tasks->end].p = p;
-		tasks->queue[tasks->end].msg = msg;
-		tasks->end = (tasks->end+1) % tasks->max;
-		if (sem_release(tasks->empty)<0)
+		q->queue[q->end].p = p;
+		q->queue[q->end].msg = msg;
+		q->queue[q->end].hash = hash;
+		gettimeofday(&(q->queue[q->end].queued),0);
+		q->end = (q->end+1) % q->max;
+		depth = (q->end-q->start+q->max)%q->max;
+		if (depth>q->max_depth) q->max_depth = depth;
+		if (sem_release(q->empty)<0)
 			LOG(L_WARN,"WARN:put_task(): Error releasing tasks->empty semaphore > %s!\n",strerror(errno));
-		lock_release(tasks->lock);
+		lock_release(q->lock);
+		
+		if (depth>1)
+			for(i=1;i<tasks_cnt;i++){
+				k = (hash+i)%tasks_cnt;
+				if (!workers_state[k].idle) continue;
+				workers_state[k].idle = 0;
+				sem_release(tasks[k].empty);
+				break;
+			}
 		return 1;
 	}
 #endif
+
+/**
+ * Removes the first task from a queue, if no task of the same session is in progress.
+ * Must be called with the lock of the queue taken.
+ * @param q - the queue
+ * @param id - the id of the worker taking the task
+ * @param t - where to return the task
+ * @returns 1 if a task was taken, 0 if not
+ */
+static inline int task_queue_take(task_queue_t *q,int id,task_t *t)
+{
+	struct timeval now;
+	unsigned int hash,wait;
+	long long d;
+	int i;
+	
+	if (q->start == q->end) return 0;
+	hash = q->queue[q->start].hash;
+	for(i=0;i<tasks_cnt;i++)
+		if (workers_state[i].busy==hash) return 0;
+	workers_state[id].busy = hash;
+	
+	*t = q->queue[q->start];
+	q->queue[q->start].msg = 0;
+	q->start = (q->start+1) % q->max;
+	
+	gettimeofday(&now,0);
+	d = (long long)(now.tv_sec-t->queued.tv_sec)*1000000+(now.tv_usec-t->queued.tv_usec);
+	wait = d<0 ? 0 : (d>0xFFFFFFFFll ? 0xFFFFFFFFu : (unsigned int)d);
+	q->tasks++;
+	q->wait += wait;
+	if (wait>q->max_wait) q->max_wait = wait;
+	if (q!=tasks+id) q->stolen++;
+	
+	if (sem_release(q->full)<0)
+		LOG(L_WARN,"WARN:take_task(): Error releasing tasks->full semaphore > %s!\n",strerror(errno));
+	return 1;
+}
 	
 /**
- * Remove and return the first task from the queue (FIFO).
+ * Remove and return the first task from the queue of the worker (FIFO).
+ * If there is none that can be processed now, take the first one from the
+ * queue of another worker.
  * This blocks until there is something in the queue.
+ * @param id - the id of the worker
  * @returns the first task from the queue or an empty task on error (eg. shutdown in progress)
  */
-task_t take_task()
+task_t take_task(int id)
 {
-	task_t t={0,0};
-//	LOG(L_CRIT,"-1-\n");
-	lock_get(tasks->lock);
-//	LOG(L_CRIT,"-2-\n");
-	while(tasks->start == tasks->end){
-//		LOG(L_CRIT,"-3-\n");
-		lock_release(tasks->lock);
-//		LOG(L_CRIT,"-4-\n");
+	task_t t={0,0,0};
+	task_queue_t *q=tasks+id;
+	int i,k;
+	
+	while(1){
 		if (*shutdownx) {
-			sem_release(tasks->empty);
+			sem_release(q->empty);
 			return t;
 		}
-//		LOG(L_ERR,"-");
-		sem_get(tasks->empty);
-//		LOG(L_CRIT,"-5-\n");
+		workers_state[id].idle = 1;
+		sem_get(q->empty);
+		workers_state[id].idle = 0;
 		if (*shutdownx) {
-			sem_release(tasks->empty);
+			sem_release(q->empty);
 			return t;
 		}
 		
-		lock_get(tasks->lock);
-//		LOG(L_CRIT,"-6-\n");
+		lock_get(q->lock);
+		k = task_queue_take(q,id,&t);
+		lock_release(q->lock);
+		if (k) return t;
+		
+		for(i=1;i<tasks_cnt;i++){
+			q = tasks+(id+i)%tasks_cnt;
+			if (q->start == q->end) continue;
+			lock_get(q->lock);
+			k = task_queue_take(q,id,&t);
+			lock_release(q->lock);
+			if (k) return t;
+		}
+		q = tasks+id;
 	}
-//	LOG(L_CRIT,"-7-\n");
-	
-	t = tasks->queue[tasks->start];
-	tasks->queue[tasks->start].msg = 0;
-	tasks->start = (tasks->start+1) % tasks->max;
-	if (sem_release(tasks->full)<0)
-		LOG(L_WARN,"WARN:take_task(): Error releasing tasks->full semaphore > %s!\n",strerror(errno));
-	lock_release(tasks->lock);
-	return t;
 }
 
 /**
@@ -365,7 +472,7 @@ void worker_poison_queue()
 	int i;
 	if (config->workers&&tasks)
 	for(i=0;i<config->workers;i++)
-		if (sem_release(tasks->empty)<0)
+		if (sem_release(tasks[i%tasks_cnt].empty)<0)
 			LOG(L_WARN,"WARN:worker_poison_queue(): Error releasing tasks->empty semaphore > %s!\n",strerror(errno));
 }
 
@@ -380,19 +487,21 @@ void worker_poison_queue()
 void worker_process(int id)
 {
 	task_t t;
+	task_queue_t *q;
 	cdp_cb_t *cb;
 	int r;
 	LOG(L_INFO,"INFO:[%d] Worker process started...\n",id);	
 	/* init the application level for this child */
 	while(1){
 		if (shutdownx&&(*shutdownx)) break;
-		t = take_task();
+		t = take_task(id);
 		if (!t.msg) {
 			if (shutdownx&&(*shutdownx)) break;
-			LOG(L_INFO,"INFO:worker_process(): [%d] got empty task Q(%d/%d)\n",id,tasks->start,tasks->end);
+			LOG(L_INFO,"INFO:worker_process(): [%d] got empty task Q(%d/%d)\n",id,tasks[id].start,tasks[id].end);
 			continue;
 		}		
-		LOG(L_DBG,"DBG:worker_process(): [%d] got task Q(%d/%d)\n",id,tasks->start,tasks->end);
+		q = tasks+t.hash%tasks_cnt;
+		LOG(L_DBG,"DBG:worker_process(): [%d] got task Q%d(%d/%d)\n",id,(int)(q-tasks),q->start,q->end);
 		r = is_req(t.msg);
 		for(cb = callbacks->head;cb;cb = cb->next)
 			(*(cb->cb))(t.p,t.msg,*(cb->ptr));
@@ -403,6 +512,10 @@ void worker_process(int id)
 			/* will be freed by the user in upper api */
 			/*AAAFreeMessage(&(t.msg));*/
 		}
+		workers_state[id].busy = 0;
+		/* the owner of the queue might have skipped the next task of this session */
+		if (q!=tasks+id && q->start!=q->end)
+			sem_release(q->empty);
 	}
 	worker_poison_queue();
 	LOG(L_INFO,"INFO:[%d]... Worker process finished\n",id);	
@@ -420,3 +533,41 @@ void worker_process(int id)
 	exit(0);
 }
 
+
+#ifdef CDP_FOR_SER
+
+const char* worker_rpc_queues_doc[] = {
+	"Task queues of the workers: depth, max depth, tasks taken, tasks stolen by other workers, mean and max wait in microseconds.",
+	0
+};
+
+/**
+ * RPC function returning the statistics of the task queues.
+ * The counters are read without the locks.
+ */
+void worker_rpc_queues(rpc_t* rpc, void* ctx)
+{
+	void *handle;
+	task_queue_t *q;
+	int i;
+	
+	if (!tasks) {
+		rpc->fault(ctx, 500, "No task queues");
+		return;
+	}
+	for(i=0;i<tasks_cnt;i++){
+		q = tasks+i;
+		if (rpc->add(ctx, "{", &handle) < 0) return;
+		rpc->struct_add(handle, "ddddddd",
+			"queue", i,
+			"depth", (q->end-q->start+q->max)%q->max,
+			"max_depth", q->max_depth,
+			"tasks", (int)q->tasks,
+			"stolen", (int)q->stolen,
+			"mean_wait", q->tasks ? (int)(q->wait/q->tasks) : 0,
+			"max_wait", (int)q->max_wait
+		);
+	}
+}
+
+#endif
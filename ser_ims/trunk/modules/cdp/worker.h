@@ -60,6 +60,8 @@
 #include "diameter.h"
 #include "utils.h"
 
+#include <sys/time.h>
+
 /** function to be called on worker initialization */
 typedef int (*worker_init_function)(int rank);
 
@@ -67,9 +69,11 @@ typedef int (*worker_init_function)(int rank);
 typedef struct _task_t {
 	peer *p;			/**< peer that the message was received from */
 	AAAMessage *msg;	/**< diameter message received */
+	unsigned int hash;	/**< hash of the Session-Id, selects the queue; never 0 */
+	struct timeval queued;	/**< when the task was put in the queue */
 } task_t;
 
-/** task queue */
+/** task queue; each worker has one, the tasks of a session go all to the same one */
 typedef struct {
 	gen_lock_t *lock;	/**< lock for task queue operations */ 
 	int start;			/**< start position in the queue array (index of oldest task) */
@@ -78,8 +82,20 @@ typedef struct {
 	task_t *queue;		/**< array holding the tasks */
 	gen_sem_t *empty;	/**< id of semaphore for signaling an empty queue */
 	gen_sem_t *full;	/**< id of semaphore for signaling an full queue */
+	
+	unsigned int tasks;		/**< number of tasks taken from the queue */
+	unsigned int stolen;	/**< number of tasks taken by other workers */
+	int max_depth;			/**< max number of tasks waiting in the queue */
+	unsigned long long wait;/**< total time the tasks waited in the queue, in microseconds */
+	unsigned int max_wait;	/**< max time a task waited in the queue, in microseconds */
 } task_queue_t;
 
+/** state of a worker, used to keep the order of the tasks of a session when stealing */
+typedef struct {
+	volatile unsigned int busy;	/**< hash of the task in progress, 0 if none */
+	volatile int idle;			/**< if waiting for a task */
+} worker_state_t;
+
 /** callback function to be called on message processing */
 typedef int (*cdp_cb_f)(peer *p,AAAMessage *msg,void* ptr);
 
@@ -104,13 +120,19 @@ int cb_add(cdp_cb_f cb,void *ptr);
 void cb_remove(cdp_cb_t *cb);
 
 int put_task(peer *p,AAAMessage *msg);
-task_t take_task();
+task_t take_task(int id);
 
 
 void worker_poison_queue();
 
 void worker_process(int id);
 
+#ifdef CDP_FOR_SER
+	#include "../../rpc.h"
+	extern const char* worker_rpc_queues_doc[];
+	void worker_rpc_queues(rpc_t* rpc, void* ctx);
+#endif
+
 
 
 #endif
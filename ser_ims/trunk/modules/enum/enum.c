@@ -38,6 +38,12 @@
 #include "../../data_lump.h"
 #include "../../ut.h"
 #include "../../resolve.h"
+#ifdef USE_DNS_CACHE
+#include "../../dns_cache.h"
+#include "../../dns_resolver.h"
+#endif
+#include "../../mem/shm_mem.h"
+#include "../../timer.h"
 #include "../../mem/mem.h"
 #include "../../dset.h"
 #include "../../qvalue.h"
@@ -319,6 +325,35 @@ static inline void naptr_sort(struct rdata** head)
 }	
 
 	
+/*
+ * Set while the failure route of enum_query_async() runs, in the timer
+ * process, which must not block on a dns query
+ */
+static int enum_cache_only = 0;
+
+
+/*
+ * Returns the NAPTR records of name, from the dns cache if in use (the
+ * answer may be there already after enum_query_async())
+ */
+static struct rdata* get_naptr(char* name)
+{
+#ifdef USE_DNS_CACHE
+	str s;
+
+	if (use_dns_cache) {
+		s.s = name;
+		s.len = strlen(name);
+		if (s.len > 0 && s.s[s.len - 1] == '.') s.len--;
+		if (enum_cache_only)
+			return dns_cache_get_cached_record(&s, T_NAPTR);
+		return dns_cache_get_record(&s, T_NAPTR);
+	}
+#endif
+	return get_record(name, T_NAPTR, RES_ONLY_TYPE);
+}
+
+
 /*
  * See documentation in README file.
  */
@@ -386,7 +421,7 @@ int enum_query(struct sip_msg* msg, char* p1, char* p2)
 
 	memcpy(name + j, suffix.s, suffix.len + 1);
 
-	head = get_record(name, T_NAPTR, RES_ONLY_TYPE);
+	head = get_naptr(name);
 
 	if (head == 0) {
 		DBG("enum_query(): No NAPTR record found for %s.\n", name);
@@ -786,7 +821,7 @@ int enum_query_orig(struct sip_msg* msg, char* p1, char* p2)
 
 	memcpy(name + j, suffix.s, suffix.len + 1);
 
-	head = get_record(name, T_NAPTR, RES_ONLY_TYPE);
+	head = get_naptr(name);
 
 	if (head == 0) {
 		DBG("enum_query_orig(): No NAPTR record found for %s.\n", name);
@@ -890,3 +925,143 @@ done:
 }
 
 
+struct enum_async_ctx {
+	struct timer_ln resume;	/* runs the failure route from the timer process */
+	unsigned int hash_index;
+	unsigned int label;
+	int route;
+};
+
+
+/*
+ * Continues the suspended transaction, one shot timer handler; enum_query()
+ * in the failure route only looks in the dns cache, so a missing answer
+ * fails right away instead of blocking all the timers
+ */
+static ticks_t enum_async_resume(ticks_t ticks, struct timer_ln* tl, void* param)
+{
+	struct enum_async_ctx* ctx = param;
+
+	enum_cache_only = 1;
+	if (tmb.t_continue(ctx->hash_index, ctx->label, ctx->route, 0, 0) < 0) {
+		LOG(L_ERR, "enum_async_resume(): error resuming the transaction %u:%u\n",
+		    ctx->hash_index, ctx->label);
+	}
+	enum_cache_only = 0;
+	shm_free(ctx);
+	return 0;
+}
+
+
+/*
+ * Called from the dns resolver process once the answer is cached; the
+ * failure route is not run here, it would hold up the other queries, but
+ * handed over to the timer process
+ */
+static void enum_async_cb(int err, void* param)
+{
+	struct enum_async_ctx* ctx = param;
+
+	if (err < 0) {
+		DBG("enum_async_cb(): lookup failed for transaction %u:%u\n",
+		    ctx->hash_index, ctx->label);
+	}
+	timer_init(&ctx->resume, enum_async_resume, ctx, 0);
+	if (timer_add(&ctx->resume, 1) < 0) {
+		LOG(L_CRIT, "BUG: enum_async_cb(): could not schedule the resume of"
+		    " transaction %u:%u\n", ctx->hash_index, ctx->label);
+	}
+}
+
+
+/*
+ * See documentation in README file.
+ */
+
+int enum_query_async(struct sip_msg* msg, char* p1, char* p2)
+{
+	char *user_s;
+	int user_len, i, j;
+	char name[MAX_DOMAIN_SIZE];
+	str suffix, n;
+	struct enum_async_ctx* ctx;
+
+	if (!tmb.t_suspend) {
+		LOG(L_ERR, "enum_query_async(): tm module not loaded\n");
+		return -1;
+	}
+
+#ifdef USE_DNS_CACHE
+	/* without the resolver process the script has to call enum_query() */
+	if (!use_dns_cache || !dns_async) {
+		DBG("enum_query_async(): dns resolver not in use\n");
+		return -1;
+	}
+#else
+	DBG("enum_query_async(): dns resolver not compiled in\n");
+	return -1;
+#endif
+
+	if (p2) {
+	    if (get_str_fparam(&suffix, msg, (fparam_t*)p2) < 0) {
+		ERR("Unable to get suffix value\n");
+		return -1;
+	    }
+	} else {
+	    suffix = domain_suffix;
+	}
+
+	if (parse_sip_msg_uri(msg) < 0) {
+		LOG(L_ERR, "enum_query_async(): uri parsing failed\n");
+		return -1;
+	}
+
+	if (test_e164(&(msg->parsed_uri.user)) == -1) {
+		LOG(L_ERR, "enum_query_async(): uri user is not an E164 number\n");
+		return -1;
+	}
+
+	user_s = msg->parsed_uri.user.s;
+	user_len = msg->parsed_uri.user.len;
+
+	j = 0;
+	for (i = user_len - 1; i > 0; i--) {
+		name[j] = user_s[i];
+		name[j + 1] = '.';
+		j = j + 2;
+	}
+	if (j + suffix.len >= MAX_DOMAIN_SIZE) {
+		LOG(L_ERR, "enum_query_async(): name too long\n");
+		return -1;
+	}
+	memcpy(name + j, suffix.s, suffix.len);
+	n.s = name;
+	n.len = j + suffix.len;
+	if (n.len > 0 && n.s[n.len - 1] == '.') n.len--;
+	if (n.len >= MAX_DNS_NAME) {
+		LOG(L_ERR, "enum_query_async(): name too long\n");
+		return -1;
+	}
+
+	ctx = shm_malloc(sizeof(struct enum_async_ctx));
+	if (!ctx) {
+		LOG(L_ERR, "enum_query_async(): no shared memory left\n");
+		return -1;
+	}
+	ctx->route = (int)(long)p1;
+
+	if (tmb.t_suspend(msg, &ctx->hash_index, &ctx->label) < 0) {
+		LOG(L_ERR, "enum_query_async(): error suspending the transaction\n");
+		shm_free(ctx);
+		return -1;
+	}
+
+#ifdef USE_DNS_CACHE
+	if (dns_resolve_async(&n, T_NAPTR, enum_async_cb, ctx) < 0) {
+		/* already suspended, resume it from the timer as a failed lookup */
+		LOG(L_ERR, "enum_query_async(): error queuing the dns query\n");
+		enum_async_cb(-1, ctx);
+	}
+#endif
+	return 0;
+}
@@ -56,5 +56,12 @@ int enum_query(struct sip_msg* msg, char* p1, char* p2);
  */
 int enum_query_orig(struct sip_msg* msg, char* p1, char* p2);
 
+/*
+ * Suspend the transaction while the NAPTR records of the request uri user
+ * are resolved by the dns resolver process, then continue in the failure
+ * route p1, where enum_query() is answered from the dns cache
+ */
+int enum_query_async(struct sip_msg* msg, char* p1, char* p2);
+
 
 #endif /* ENUM_H */
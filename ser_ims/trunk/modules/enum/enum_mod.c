@@ -39,6 +39,7 @@
 #include <stdlib.h>
 #include "../../sr_module.h"
 #include "../../error.h"
+#include "../tm/tm_load.h"
 #include "enum.h"
 
 MODULE_VERSION
@@ -48,14 +49,21 @@ str tel_uri_params = STR_STATIC_INIT("");
 str tel_uri_params_orig = STR_STATIC_INIT(";orig");
 str default_service = STR_NULL;
 
+struct tm_binds tmb;
+
+static int mod_init(void);
+static int fixup_async_route(void** param, int param_no);
+
 
 /*
  * Exported functions
  */
 static cmd_export_t cmds[] = {
-	{"enum_query", enum_query, 0, 0,                REQUEST_ROUTE},
-	{"enum_query", enum_query, 1, fixup_var_str_1,  REQUEST_ROUTE},
-	{"enum_query", enum_query, 2, fixup_var_str_12, REQUEST_ROUTE},
+	{"enum_query", enum_query, 0, 0,                REQUEST_ROUTE|FAILURE_ROUTE},
+	{"enum_query", enum_query, 1, fixup_var_str_1,  REQUEST_ROUTE|FAILURE_ROUTE},
+	{"enum_query", enum_query, 2, fixup_var_str_12, REQUEST_ROUTE|FAILURE_ROUTE},
+	{"enum_query_async", enum_query_async, 1, fixup_async_route, REQUEST_ROUTE},
+	{"enum_query_async", enum_query_async, 2, fixup_async_route, REQUEST_ROUTE},
 	{"enum_query_orig", enum_query_orig, 0, 0,                REQUEST_ROUTE},
 	{"enum_query_orig", enum_query_orig, 1, fixup_var_str_1,  REQUEST_ROUTE},
 	{"enum_query_orig", enum_query_orig, 2, fixup_var_str_12, REQUEST_ROUTE},
@@ -84,9 +92,35 @@ struct module_exports exports = {
 	cmds,     /* Exported functions */
 	0,        /* RPC method */
 	params,   /* Exported parameters */
-	0,        /* module initialization function */
+	mod_init, /* module initialization function */
 	0,        /* response function*/
 	0,        /* destroy function */
 	0,        /* oncancel function */
 	0         /* per-child init function */
 };
+
+
+static int mod_init(void)
+{
+	load_tm_f load_tm;
+
+	/* tm is needed only by enum_query_async() */
+	memset(&tmb, 0, sizeof(tmb));
+	load_tm = (load_tm_f)find_export("load_tm", NO_SCRIPT, 0);
+	if (load_tm && load_tm(&tmb) == -1) {
+		LOG(L_ERR, "enum: mod_init: can't load tm functions\n");
+		return -1;
+	}
+	return 0;
+}
+
+
+/*
+ * The first parameter of enum_query_async() is the failure_route to
+ * continue in, the second one the domain suffix
+ */
+static int fixup_async_route(void** param, int param_no)
+{
+	if (param_no == 2) return fixup_var_str_2(param, param_no);
+	return fixup_failure_route_1(param, param_no);
+}
@@ -33,11 +33,14 @@
 
 
 #include "../../str.h"
+#include "../tm/tm_load.h"
 
 extern str domain_suffix;
 extern str tel_uri_params;
 extern str tel_uri_params_orig;
 extern str default_service;
 
+extern struct tm_binds tmb;
+
 
 #endif /* ENUM_MOD_H */
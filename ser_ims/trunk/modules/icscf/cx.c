@@ -138,21 +138,20 @@ AAAMessage* CxRequestHandler(AAAMessage *request,void *param)
 
 
 /**
- * Sends an UAR and returns the UAA.
- * @param msg - the SIP message
+ * Creates an UAR.
  * @param private_identity - the username
  * @param public_identity - the public identity
  * @param visited_network_id - id of the roaming network
  * @param authorization_type - if registration or de-registration
  * @param realm - Realm
- * @returns the UAA message received or NULL on error
+ * @param sos_reg - if this is an emergency registration
+ * @returns the UAR message or NULL on error
  */
-AAAMessage* Cx_UAR(struct sip_msg *msg,str private_identity, str public_identity, str visited_network_id,
+static AAAMessage* Cx_new_UAR(str private_identity, str public_identity, str visited_network_id,
 			int authorization_type,str realm, int sos_reg)
 {
 	AAAMessage *uar=0;
 	AAASession *session=0;
-	AAAMessage *uaa=0;
 	
 	session = cdpb.AAACreateSession(0);
 
@@ -175,6 +174,36 @@ AAAMessage* Cx_UAR(struct sip_msg *msg,str private_identity, str public_identity
 	if (authorization_type!=AVP_IMS_UAR_REGISTRATION)
 		if (!Cx_add_authorization_type(uar,authorization_type)) goto error;
 
+	return uar;
+	
+error:
+	//free stuff
+	if (session) cdpb.AAADropSession(session);
+	if (uar) cdpb.AAAFreeMessage(&uar);
+	return 0;
+}
+
+/**
+ * Sends an UAR and returns the UAA.
+ * @param msg - the SIP message
+ * @param private_identity - the username
+ * @param public_identity - the public identity
+ * @param visited_network_id - id of the roaming network
+ * @param authorization_type - if registration or de-registration
+ * @param realm - Realm
+ * @param sos_reg - if this is an emergency registration
+ * @returns the UAA message received or NULL on error
+ */
+AAAMessage* Cx_UAR(struct sip_msg *msg,str private_identity, str public_identity, str visited_network_id,
+			int authorization_type,str realm, int sos_reg)
+{
+	AAAMessage *uar=0;
+	AAAMessage *uaa=0;
+	
+	uar = Cx_new_UAR(private_identity,public_identity,visited_network_id,
+			authorization_type,realm,sos_reg);
+	if (!uar) return 0;
+
 	#ifdef WITH_IMS_PM
 		ims_pm_diameter_request(uar);
 	#endif				
@@ -187,26 +216,50 @@ AAAMessage* Cx_UAR(struct sip_msg *msg,str private_identity, str public_identity
 	#endif				
 	
 	return uaa;
-	
-error:
-	//free stuff
-	if (session) cdpb.AAADropSession(session);
-	if (uar) cdpb.AAAFreeMessage(&uar);
-	return 0;
 }	
 
+/**
+ * Sends an UAR without waiting for the UAA.
+ * The UAA (or NULL on time-out) is passed later to the callback, in a Diameter worker.
+ * @param msg - the SIP message
+ * @param private_identity - the username
+ * @param public_identity - the public identity
+ * @param visited_network_id - id of the roaming network
+ * @param authorization_type - if registration or de-registration
+ * @param realm - Realm
+ * @param sos_reg - if this is an emergency registration
+ * @param cb - transactional callback to be called on UAA or time-out
+ * @param param - generic parameter for the callback; owned by the caller if this fails
+ * @returns 1 if the UAR was sent, 0 on error
+ */
+int Cx_UAR_async(struct sip_msg *msg,str private_identity, str public_identity, str visited_network_id,
+			int authorization_type,str realm, int sos_reg,AAATransactionCallback_f *cb,void *param)
+{
+	AAAMessage *uar=0;
+	
+	uar = Cx_new_UAR(private_identity,public_identity,visited_network_id,
+			authorization_type,realm,sos_reg);
+	if (!uar) return 0;
+
+	#ifdef WITH_IMS_PM
+		ims_pm_diameter_request(uar);
+	#endif				
+	if (icscf_forced_hss_peer_str.len)
+		return cdpb.AAASendMessageToPeer(uar,&icscf_forced_hss_peer_str,cb,param);
+	else 
+		return cdpb.AAASendMessage(uar,cb,param);	
+}	
 
 
 /**
- * Sends an LIR and returns the LIA.
- * @param msg - the SIP message
+ * Creates an LIR.
  * @param public_identity - the public identity
  * @param realm - Realm
- * @returns the LIA message received or NULL on error
+ * @returns the LIR message or NULL on error
  */
-AAAMessage* Cx_LIR(struct sip_msg *msg, str public_identity,str realm)
+static AAAMessage* Cx_new_LIR(str public_identity,str realm)
 {
-	AAAMessage *lir=0,*lia=0;
+	AAAMessage *lir=0;
 	AAASession *session=0;
 	
 	session = cdpb.AAACreateSession(0);
@@ -225,6 +278,29 @@ AAAMessage* Cx_LIR(struct sip_msg *msg, str public_identity,str realm)
 
 	if (!Cx_add_public_identity(lir,public_identity)) goto error;
 			
+	return lir;
+	
+error:
+	//free stuff
+	if (session) cdpb.AAADropSession(session);
+	if (lir) cdpb.AAAFreeMessage(&lir);
+	return 0;
+}
+
+/**
+ * Sends an LIR and returns the LIA.
+ * @param msg - the SIP message
+ * @param public_identity - the public identity
+ * @param realm - Realm
+ * @returns the LIA message received or NULL on error
+ */
+AAAMessage* Cx_LIR(struct sip_msg *msg, str public_identity,str realm)
+{
+	AAAMessage *lir=0,*lia=0;
+	
+	lir = Cx_new_LIR(public_identity,realm);
+	if (!lir) return 0;
+	
 	#ifdef WITH_IMS_PM
 		ims_pm_diameter_request(lir);
 	#endif				
@@ -236,13 +312,32 @@ AAAMessage* Cx_LIR(struct sip_msg *msg, str public_identity,str realm)
 		ims_pm_diameter_answer(lia);
 	#endif				
 
-	
 	return lia;
-	
-error:
-	//free stuff
-	if (session) cdpb.AAADropSession(session);
-	if (lir) cdpb.AAAFreeMessage(&lir);
-	return 0;
-}	
+}
 
+/**
+ * Sends an LIR without waiting for the LIA.
+ * The LIA (or NULL on time-out) is passed later to the callback, in a Diameter worker.
+ * @param msg - the SIP message
+ * @param public_identity - the public identity
+ * @param realm - Realm
+ * @param cb - transactional callback to be called on LIA or time-out
+ * @param param - generic parameter for the callback; owned by the caller if this fails
+ * @returns 1 if the LIR was sent, 0 on error
+ */
+int Cx_LIR_async(struct sip_msg *msg, str public_identity,str realm,
+			AAATransactionCallback_f *cb,void *param)
+{
+	AAAMessage *lir=0;
+	
+	lir = Cx_new_LIR(public_identity,realm);
+	if (!lir) return 0;
+	
+	#ifdef WITH_IMS_PM
+		ims_pm_diameter_request(lir);
+	#endif				
+	if (icscf_forced_hss_peer_str.len)
+		return cdpb.AAASendMessageToPeer(lir,&icscf_forced_hss_peer_str,cb,param);
+	else 
+		return cdpb.AAASendMessage(lir,cb,param);
+}
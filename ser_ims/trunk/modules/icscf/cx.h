@@ -70,10 +70,23 @@ AAAMessage* CxRequestHandler(AAAMessage *request,void *param);
 
 
 
+/** Context of a SIP request suspended while waiting for a Cx answer */
+typedef struct {
+	unsigned int hash_index;	/**< tm hash index of the suspended transaction */
+	unsigned int label;			/**< tm label of the suspended transaction */
+	int route;					/**< failure_route to resume the script in */
+	int orig;					/**< if the request is originating (for LIR) */
+	AAAMessage *ans;			/**< the answer received, NULL on time-out */
+} cx_async_ctx;
+
 AAAMessage* Cx_UAR(struct sip_msg *msg,str private_identity, str public_identity, str visited_network_id,
 			int authorization_type,str realm, int sos_reg);
+int Cx_UAR_async(struct sip_msg *msg,str private_identity, str public_identity, str visited_network_id,
+			int authorization_type,str realm, int sos_reg,AAATransactionCallback_f *cb,void *param);
 
 
 AAAMessage* Cx_LIR(struct sip_msg *msg, str public_identity,str realm);
+int Cx_LIR_async(struct sip_msg *msg, str public_identity,str realm,
+			AAATransactionCallback_f *cb,void *param);
 
 #endif /* I_CSCF_CX_H */
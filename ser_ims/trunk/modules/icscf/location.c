@@ -58,6 +58,7 @@
 #include "location.h"
 
 #include "../../mem/shm_mem.h"
+#include "../../modules/tm/tm_load.h"
 
 #include "mod.h"
 #include "db.h"
@@ -65,6 +66,7 @@
 #include "cx.h"
 #include "cx_avp.h"
 #include "registration.h"
+#include "ims_pm_icscf.h"
 
 #include "../../action.h" /* run_actions */
 #include "../../route.h" /* route_get */
@@ -79,53 +81,68 @@ extern str icscf_default_realm_str;		/**< fixed default realm */
 extern int route_on_term_user_unknown_n;/**< script route number for Initial request processing after HSS says User Unknown */	
 
 /**
- * Perform Location-Information-Request.
- * creates and send the user location query
+ * Extracts from a request the data required for the Location-Information-Request.
  * @param msg - the SIP message
- * @param str1 - not used
- * @param str2 - not used
- * @returns true if OK, false if not
+ * @param public_identity - the public identity to fill; if not originating, it is 
+ * allocated in shm and must be freed by the caller
+ * @param realm - the realm to fill
+ * @param orig - to fill with whether the request is originating
+ * @returns #CSCF_RETURN_TRUE if OK, #CSCF_RETURN_FALSE if not or #CSCF_RETURN_BREAK if a reply was sent
  */
-int I_LIR(struct sip_msg* msg, char* str1, char* str2)
+static int I_LIR_get_params(struct sip_msg* msg, str *public_identity, str *realm, int *orig)
 {
-	int result=CSCF_RETURN_FALSE;
-	str public_identity={0,0};
-	str realm={0,0};
-	AAAMessage *lia=0;	
-	int orig = 0;
-
-	
+	*orig = 0;
 	LOG(L_DBG,"DBG:"M_NAME":I_LIR: Starting ...\n");
 	/* check if we received what we should */
 	if (msg->first_line.type!=SIP_REQUEST) {
 		LOG(L_ERR,"ERR:"M_NAME":I_LIR: The message is not a request\n");
-		goto done;
+		return CSCF_RETURN_FALSE;
 	}
 	
 	/* check orig uri parameter in topmost Route */
-	if (I_originating(msg, str1, str2)==CSCF_RETURN_TRUE) {
-		orig = 1;
+	if (I_originating(msg, 0, 0)==CSCF_RETURN_TRUE) {
+		*orig = 1;
 		LOG(L_DBG,"DBG:"M_NAME":I_LIR: orig\n");
 	}
 	
 	/* extract data from message */	
-	if (orig) {
-		public_identity = cscf_get_asserted_identity(msg);
-		realm = cscf_get_realm_from_uri(public_identity);
+	if (*orig) {
+		*public_identity = cscf_get_asserted_identity(msg);
+		*realm = cscf_get_realm_from_uri(*public_identity);
 	} else {
-		realm = cscf_get_realm_from_ruri(msg);
-		public_identity=cscf_get_public_identity_from_requri(msg);
+		*realm = cscf_get_realm_from_ruri(msg);
+		*public_identity=cscf_get_public_identity_from_requri(msg);
 	}
-	if (!public_identity.len) {
+	if (!public_identity->len) {
 		LOG(L_ERR,"ERR:"M_NAME":I_LIR: Public Identity not found, responding with 400\n");
-		if (orig)
+		if (*orig)
 			cscf_reply_transactional(msg,400,MSG_400_NO_PUBLIC_FROM);
 		else
 			cscf_reply_transactional(msg,400,MSG_400_NO_PUBLIC);
-		result=CSCF_RETURN_BREAK;
-		goto done;
+		return CSCF_RETURN_BREAK;
 	}
-	if(!realm.len) realm = icscf_default_realm_str;
+	if(!realm->len) *realm = icscf_default_realm_str;
+	return CSCF_RETURN_TRUE;
+}
+
+/**
+ * Perform Location-Information-Request.
+ * creates and send the user location query
+ * @param msg - the SIP message
+ * @param str1 - not used
+ * @param str2 - not used
+ * @returns true if OK, false if not
+ */
+int I_LIR(struct sip_msg* msg, char* str1, char* str2)
+{
+	int result=CSCF_RETURN_FALSE;
+	str public_identity={0,0};
+	str realm={0,0};
+	AAAMessage *lia=0;	
+	int orig = 0;
+
+	result = I_LIR_get_params(msg,&public_identity,&realm,&orig);
+	if (result!=CSCF_RETURN_TRUE) goto done;
 
 	lia = Cx_LIR(msg,public_identity,realm);
 	
@@ -148,6 +165,92 @@ done:
 	return result;	
 }
 
+/**
+ * Resumes a request suspended by I_LIR_async(), processing the LIA.
+ * Called by tm on the request retrieved from the transaction.
+ * @param msg - the original SIP message retrieved from the transaction
+ * @param param - the cx_async_ctx of the request
+ * @returns 1 if the script should continue in the resume route, 0 if a reply was sent
+ */
+static int I_LIR_continue(struct sip_msg* msg, void *param)
+{
+	cx_async_ctx *ctx = param;
+	return I_LIA(msg,&(ctx->ans),ctx->orig)==CSCF_RETURN_TRUE;
+}
+
+/**
+ * Transactional callback for the LIA of I_LIR_async().
+ * Runs in a Diameter worker process and resumes the suspended request.
+ * @param is_timeout - if this is a time-out
+ * @param param - the cx_async_ctx of the request
+ * @param lia - the LIA or NULL on time-out
+ */
+static void I_LIR_async_cb(int is_timeout,void *param,AAAMessage *lia)
+{
+	cx_async_ctx *ctx = param;
+	#ifdef WITH_IMS_PM
+		ims_pm_diameter_answer(lia);
+	#endif				
+	ctx->ans = lia;
+	if (tmb.t_continue(ctx->hash_index,ctx->label,ctx->route,I_LIR_continue,ctx)<0)
+		LOG(L_ERR,"ERR:"M_NAME":I_LIR_async_cb: Error resuming the transaction %u:%u\n",
+			ctx->hash_index,ctx->label);
+	if (ctx->ans) cdpb.AAAFreeMessage(&(ctx->ans));
+	shm_free(ctx);
+}
+
+/**
+ * Perform Location-Information-Request without blocking the process.
+ * The request transaction is suspended and the process is freed. When the LIA arrives,
+ * it is processed as in I_LIR() and, if successful, the script continues in the given
+ * failure_route; otherwise the request was already replied.
+ * @param msg - the SIP message
+ * @param str1 - the failure_route to resume in (fixed to its index)
+ * @param str2 - not used
+ * @returns break if suspended or replied, false if the LIR can not be done
+ */
+int I_LIR_async(struct sip_msg* msg, char* str1, char* str2)
+{
+	int result=CSCF_RETURN_FALSE;
+	str public_identity={0,0};
+	str realm={0,0};
+	int orig = 0;
+	cx_async_ctx *ctx=0;
+
+	result = I_LIR_get_params(msg,&public_identity,&realm,&orig);
+	if (result!=CSCF_RETURN_TRUE) return result;
+
+	ctx = shm_malloc(sizeof(cx_async_ctx));
+	if (!ctx){
+		LOG(L_ERR,"ERR:"M_NAME":I_LIR_async: Error allocating %d bytes\n",(int)sizeof(cx_async_ctx));
+		cscf_reply_transactional(msg,500,MSG_500_SERVER_ERROR_OUT_OF_MEMORY);
+		result = CSCF_RETURN_BREAK;
+		goto done;
+	}
+	memset(ctx,0,sizeof(cx_async_ctx));
+	ctx->route = (int)(long)str1;
+	ctx->orig = orig;
+	
+	if (tmb.t_suspend(msg,&(ctx->hash_index),&(ctx->label))<0){
+		LOG(L_ERR,"ERR:"M_NAME":I_LIR_async: Error suspending the transaction\n");
+		shm_free(ctx);
+		cscf_reply_transactional(msg,500,MSG_500_SERVER_ERROR_SUSPEND);
+		result = CSCF_RETURN_BREAK;
+		goto done;
+	}
+
+	if (!Cx_LIR_async(msg,public_identity,realm,I_LIR_async_cb,ctx)){
+		LOG(L_ERR,"ERR:"M_NAME":I_LIR_async: Error creating/sending LIR\n");
+		shm_free(ctx);
+		cscf_reply_transactional(msg,480,MSG_480_DIAMETER_ERROR);
+	}
+	result = CSCF_RETURN_BREAK;
+done:	
+	if (public_identity.s && !orig) 
+		shm_free(public_identity.s); // shm_malloc in cscf_get_public_identity_from_requri		
+	return result;
+}
+
 /**
  * Process a Location-Information-Answer.
  * Called from the Cx_LIA handler when the LIA is received
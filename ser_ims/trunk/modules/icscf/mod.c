@@ -139,6 +139,7 @@ cipherInstance ci;			/**< keeps mode (ECB, CBC) and IV */
 	/** IMS PM parameters storage */
 	char* ims_pm_node_type="I-CSCF";
 	char* ims_pm_logfile="/opt/OpenIMSCore/default_ims_pm.log";
+	int ims_pm_dump_interval=60;		/**< seconds between dumps of the IMS PM totals, -1 for raw events */
 #endif /* WITH_IMS_PM */
 
 
@@ -151,6 +152,8 @@ cipherInstance ci;			/**< keeps mode (ECB, CBC) and IV */
  * - I_trans_in_processing() - if this transaction is already in processing
  * - I_UAR() - trigger an UAR and fwd the message based on the UAA  
  * - I_LIR() - trigger an LIR and fwd the message based on the UAA
+ * - I_UAR_async() - trigger an UAR and continue in a failure_route on UAA, without blocking the process
+ * - I_LIR_async() - trigger an LIR and continue in a failure_route on LIA, without blocking the process
  * - I_scscf_select() - select the next unused S-CSCF from the list for this request
  * - I_scscf_drop() - drop the list of S-CSCFs for this request
  * <p>
@@ -174,6 +177,8 @@ static cmd_export_t icscf_cmds[]={
 	{"I_trans_in_processing", 		I_trans_in_processing, 		0, 0, REQUEST_ROUTE}, 
 	{"I_UAR", 						I_UAR, 						1, 0, REQUEST_ROUTE}, 
 	{"I_LIR", 						I_LIR, 						0, 0, REQUEST_ROUTE}, 	
+	{"I_UAR_async",					I_UAR_async,				2, fixup_failure_route_1, REQUEST_ROUTE}, 
+	{"I_LIR_async",					I_LIR_async,				1, fixup_failure_route_1, REQUEST_ROUTE}, 	
 	{"I_scscf_select",				I_scscf_select,				1, 0, REQUEST_ROUTE|FAILURE_ROUTE}, 
 	{"I_scscf_drop",				I_scscf_drop,				0, 0, REQUEST_ROUTE|ONREPLY_ROUTE|FAILURE_ROUTE}, 
 	
@@ -230,16 +235,28 @@ static param_export_t icscf_params[]={
 #ifdef WITH_IMS_PM
 	{"ims_pm_node_type",		STR_PARAM, &ims_pm_node_type},
 	{"ims_pm_logfile",			STR_PARAM, &ims_pm_logfile},
+	{"ims_pm_dump_interval",			INT_PARAM, &ims_pm_dump_interval},
 #endif /* WITH_IMS_PM */
 
 	{0,0,0} 
 };
 
 /** module exports */
+/**
+ * Exported RPC methods.
+ * - icscf.ims_pm - IMS PM totals
+ */
+static rpc_export_t icscf_rpc[]={
+#ifdef WITH_IMS_PM
+	{"icscf.ims_pm",		ims_pm_rpc_stats,		ims_pm_rpc_stats_doc,		0},
+#endif /* WITH_IMS_PM */
+	{0, 0, 0, 0}
+};
+
 struct module_exports exports = {
 	"icscf", 
 	icscf_cmds,
-	0,
+	icscf_rpc,
 	icscf_params,
 	
 	icscf_mod_init,		/* module initialization function */
@@ -338,7 +355,7 @@ static int icscf_mod_init(void)
 	if (!fix_parameters()) goto error;
 
 	#ifdef WITH_IMS_PM
-		ims_pm_init(icscf_name_str,ims_pm_node_type, ims_pm_logfile);
+		ims_pm_init(icscf_name_str,ims_pm_node_type, ims_pm_logfile,ims_pm_dump_interval);
 		ims_pm_init_icscf();
 	#endif /* WITH_IMS_PM */
 	
@@ -424,6 +441,9 @@ static int icscf_mod_child_init(int rank)
 {
 	LOG(L_INFO,"INFO:"M_NAME":mod_init: Initialization of module in child [%d] %s \n",
 		rank,pt[process_no].desc);
+	#ifdef WITH_IMS_PM
+		if (ims_pm_init_child(rank)<0) return -1;
+	#endif /* WITH_IMS_PM */
 	/* don't do anything for main process and TCP manager process */
 	if ( rank == PROC_MAIN || rank == PROC_TCP_MAIN )
 		return 0;
@@ -58,12 +58,14 @@
 
 #include "../../mem/shm_mem.h"
 #include "../../dset.h"
+#include "../../modules/tm/tm_load.h"
 #include "../../parser/parse_uri.h"
 
 #include "mod.h"
 #include "sip.h"
 #include "cx.h"
 #include "cx_avp.h"
+#include "ims_pm_icscf.h"
 
 extern struct tm_binds tmb;            /**< Structure with pointers to tm funcs 		*/
 //extern int (*sl_reply)(struct sip_msg* _msg, char* _str1, char* _str2); 
@@ -71,29 +73,31 @@ extern struct tm_binds tmb;            /**< Structure with pointers to tm funcs
 extern struct cdp_binds cdpb;            /**< Structure with pointers to cdp funcs 		*/
 										
 /**
- * Perform User Authorization Request.
- * creates and send the user authorization query
+ * Extracts from a REGISTER the data required for the User Authorization Request.
  * @param msg - the SIP message
- * @param str1 - the realm
- * @param str2 - if to do capabilities
- * @returns true if OK, false if not
+ * @param str1 - if to do capabilities
+ * @param private_identity - the private identity to fill
+ * @param public_identity - the public identity to fill
+ * @param visited_network_id - the visited network id to fill
+ * @param authorization_type - the authorization type to fill
+ * @param realm - the realm to fill
+ * @param sos_reg - to fill with whether this is an emergency registration
+ * @returns #CSCF_RETURN_TRUE if OK, #CSCF_RETURN_FALSE if not or #CSCF_RETURN_BREAK if a reply was sent
  */
-int I_UAR(struct sip_msg* msg, char* str1, char* str2)
+static int I_UAR_get_params(struct sip_msg* msg, char* str1, str *private_identity, str *public_identity,
+		str *visited_network_id, int *authorization_type, str *realm, int *sos_reg)
 {
 	int result=CSCF_RETURN_FALSE;
-	str private_identity,public_identity,visited_network_id;
-	int authorization_type=AVP_IMS_UAR_REGISTRATION;	
 	int expires=3600;
 	struct hdr_field *hdr ;
-	str realm;
-	AAAMessage* uaa;
 	contact_t *c;
-	int sos_reg=0;
 	contact_body_t *b = 0;
 	
-	realm = cscf_get_realm_from_ruri(msg);
+	*authorization_type=AVP_IMS_UAR_REGISTRATION;
+	*sos_reg=0;
+	*realm = cscf_get_realm_from_ruri(msg);
 	
-	LOG(L_DBG,"DBG:"M_NAME":I_UAR: Starting ... <%.*s>\n",realm.len,realm.s);
+	LOG(L_DBG,"DBG:"M_NAME":I_UAR: Starting ... <%.*s>\n",realm->len,realm->s);
 	/* check if we received what we should */
 	if (msg->first_line.type!=SIP_REQUEST) {
 		LOG(L_ERR,"ERR:"M_NAME":I_UAR: The message is not a request\n");
@@ -107,16 +111,16 @@ int I_UAR(struct sip_msg* msg, char* str1, char* str2)
 	}
 	
 	/* extract data from message */
-	private_identity=cscf_get_private_identity(msg,realm);
-	if (!private_identity.len) {
+	*private_identity=cscf_get_private_identity(msg,*realm);
+	if (!private_identity->len) {
 		LOG(L_ERR,"ERR:"M_NAME":I_UAR: Private Identity not found, responding with 400\n");
 		cscf_reply_transactional(msg,400,MSG_400_NO_PRIVATE);
 		result=CSCF_RETURN_BREAK;
 		goto done;		
 	}
 	
-	public_identity=cscf_get_public_identity(msg);
-	if (!public_identity.len) {
+	*public_identity=cscf_get_public_identity(msg);
+	if (!public_identity->len) {
 		LOG(L_ERR,"ERR:"M_NAME":I_UAR: Public Identity not found, responding with 400\n");
 		cscf_reply_transactional(msg,400,MSG_400_NO_PUBLIC);
 		result=CSCF_RETURN_BREAK;
@@ -132,21 +136,21 @@ int I_UAR(struct sip_msg* msg, char* str1, char* str2)
 
 	for(c=b->contacts;c;c=c->next){
 	
-		sos_reg = cscf_get_sos_uri_param(c->uri);
-		if(sos_reg == -1){
+		*sos_reg = cscf_get_sos_uri_param(c->uri);
+		if(*sos_reg == -1){
 			/*error case*/
 			cscf_reply_transactional(msg,400, MSG_400_MALFORMED_CONTACT);
 			result=CSCF_RETURN_BREAK;
 			goto done;		
-		}else if (sos_reg == -2){
+		}else if (*sos_reg == -2){
 			cscf_reply_transactional(msg,500, MSG_500_SERVER_ERROR_OUT_OF_MEMORY);
 			result=CSCF_RETURN_BREAK;
 			goto done;		
 		}
 	 }
 	
-	visited_network_id=cscf_get_visited_network_id(msg , &hdr);
-	if (!visited_network_id.len) {
+	*visited_network_id=cscf_get_visited_network_id(msg , &hdr);
+	if (!visited_network_id->len) {
 		LOG(L_ERR,"ERR:"M_NAME":I_UAR: Visited Network Identity not found, responding with 400\n");
 		cscf_reply_transactional(msg,400,MSG_400_NO_VISITED);
 		result=CSCF_RETURN_BREAK;
@@ -154,11 +158,37 @@ int I_UAR(struct sip_msg* msg, char* str1, char* str2)
 	}
 	
 	
-	if (atoi(str1)) authorization_type=AVP_IMS_UAR_REGISTRATION_AND_CAPABILITIES;
+	if (atoi(str1)) *authorization_type=AVP_IMS_UAR_REGISTRATION_AND_CAPABILITIES;
 	else {
 		expires = cscf_get_max_expires(msg,0);
-		if (expires == 0) authorization_type=AVP_IMS_UAR_DE_REGISTRATION;
+		if (expires == 0) *authorization_type=AVP_IMS_UAR_DE_REGISTRATION;
 	}
+
+	return CSCF_RETURN_TRUE;
+done:	
+	return result;	
+}
+
+/**
+ * Perform User Authorization Request.
+ * creates and send the user authorization query
+ * @param msg - the SIP message
+ * @param str1 - if to do capabilities
+ * @param str2 - not used
+ * @returns true if OK, false if not
+ */
+int I_UAR(struct sip_msg* msg, char* str1, char* str2)
+{
+	int result=CSCF_RETURN_FALSE;
+	str private_identity,public_identity,visited_network_id;
+	int authorization_type;	
+	str realm;
+	AAAMessage* uaa;
+	int sos_reg;
+	
+	result = I_UAR_get_params(msg,str1,&private_identity,&public_identity,&visited_network_id,
+				&authorization_type,&realm,&sos_reg);
+	if (result!=CSCF_RETURN_TRUE) goto done;
 	
 	uaa = Cx_UAR(msg,private_identity,public_identity,visited_network_id, 
 				authorization_type,realm, sos_reg);
@@ -177,6 +207,89 @@ done:
 	return result;	
 }
 
+/**
+ * Resumes a REGISTER suspended by I_UAR_async(), processing the UAA.
+ * Called by tm on the request retrieved from the transaction.
+ * @param msg - the original SIP message retrieved from the transaction
+ * @param param - the cx_async_ctx of the request
+ * @returns 1 if the script should continue in the resume route, 0 if a reply was sent
+ */
+static int I_UAR_continue(struct sip_msg* msg, void *param)
+{
+	cx_async_ctx *ctx = param;
+	return I_UAA(msg,ctx->ans)==CSCF_RETURN_TRUE;
+}
+
+/**
+ * Transactional callback for the UAA of I_UAR_async().
+ * Runs in a Diameter worker process and resumes the suspended REGISTER.
+ * @param is_timeout - if this is a time-out
+ * @param param - the cx_async_ctx of the request
+ * @param uaa - the UAA or NULL on time-out
+ */
+static void I_UAR_async_cb(int is_timeout,void *param,AAAMessage *uaa)
+{
+	cx_async_ctx *ctx = param;
+	#ifdef WITH_IMS_PM
+		ims_pm_diameter_answer(uaa);
+	#endif				
+	ctx->ans = uaa;
+	if (tmb.t_continue(ctx->hash_index,ctx->label,ctx->route,I_UAR_continue,ctx)<0)
+		LOG(L_ERR,"ERR:"M_NAME":I_UAR_async_cb: Error resuming the REGISTER transaction %u:%u\n",
+			ctx->hash_index,ctx->label);
+	if (ctx->ans) cdpb.AAAFreeMessage(&(ctx->ans));
+	shm_free(ctx);
+}
+
+/**
+ * Perform User Authorization Request without blocking the process.
+ * The REGISTER transaction is suspended and the process is freed. When the UAA arrives, 
+ * it is processed as in I_UAR() and, if successful, the script continues in the given
+ * failure_route; otherwise the REGISTER was already replied.
+ * @param msg - the SIP message
+ * @param str1 - the failure_route to resume in (fixed to its index)
+ * @param str2 - if to do capabilities
+ * @returns break if suspended or replied, false if the UAR can not be done
+ */
+int I_UAR_async(struct sip_msg* msg, char* str1, char* str2)
+{
+	int result=CSCF_RETURN_FALSE;
+	str private_identity,public_identity,visited_network_id;
+	int authorization_type;	
+	str realm;
+	int sos_reg;
+	cx_async_ctx *ctx;
+	
+	result = I_UAR_get_params(msg,str2,&private_identity,&public_identity,&visited_network_id,
+				&authorization_type,&realm,&sos_reg);
+	if (result!=CSCF_RETURN_TRUE) return result;
+
+	ctx = shm_malloc(sizeof(cx_async_ctx));
+	if (!ctx){
+		LOG(L_ERR,"ERR:"M_NAME":I_UAR_async: Error allocating %d bytes\n",(int)sizeof(cx_async_ctx));
+		cscf_reply_transactional(msg,500,MSG_500_SERVER_ERROR_OUT_OF_MEMORY);
+		return CSCF_RETURN_BREAK;
+	}
+	memset(ctx,0,sizeof(cx_async_ctx));
+	ctx->route = (int)(long)str1;
+	
+	if (tmb.t_suspend(msg,&(ctx->hash_index),&(ctx->label))<0){
+		LOG(L_ERR,"ERR:"M_NAME":I_UAR_async: Error suspending the REGISTER transaction\n");
+		shm_free(ctx);
+		cscf_reply_transactional(msg,500,MSG_500_SERVER_ERROR_SUSPEND);
+		return CSCF_RETURN_BREAK;
+	}
+	
+	if (!Cx_UAR_async(msg,private_identity,public_identity,visited_network_id, 
+				authorization_type,realm,sos_reg,I_UAR_async_cb,ctx)){
+		LOG(L_ERR,"ERR:"M_NAME":I_UAR_async: Error creating/sending UAR\n");
+		shm_free(ctx);
+		cscf_reply_transactional(msg,480,MSG_480_DIAMETER_ERROR);
+		return CSCF_RETURN_BREAK;
+	}
+	return CSCF_RETURN_BREAK;
+}
+
 /**
  * Process a UAA.
  * Called from the Cx_UAA handler when the UAA is received
@@ -84,6 +84,7 @@
 
 #define MSG_500_ERROR_SAVING_LIST "Server Error while saving S-CSCF list on I-CSCF"
 #define MSG_500_SERVER_ERROR_OUT_OF_MEMORY "Server Error - Out of memory" 
+#define MSG_500_SERVER_ERROR_SUSPEND "Server Error - Could not suspend the transaction"
 
 #define MSG_600_FORWARDING_FAILED "Busy everywhere - Forwarding to S-CSCF failed"
 
@@ -94,6 +95,8 @@
 
 int I_UAR(struct sip_msg* msg, char* str1, char* str2);
 
+int I_UAR_async(struct sip_msg* msg, char* str1, char* str2);
+
 int I_UAA(struct sip_msg* msg, AAAMessage* uaa);
 
 
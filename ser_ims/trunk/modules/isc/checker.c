@@ -69,6 +69,7 @@
 #include "../../parser/msg_parser.h"
 
 #include "../../mem/mem.h"
+#include "../../hashes.h"
 
 #include "../scscf/scscf_load.h"
 #include "../../modules/tm/tm_load.h"
@@ -82,6 +83,115 @@
 extern struct tm_binds isc_tmb;            /**< Structure with pointers to tm funcs 		*/
 extern struct scscf_binds isc_scscfb;      /**< Structure with pointers to S-CSCF funcs 	*/
 
+/** Compiled iFC regular expression */
+typedef struct _isc_regex {
+	unsigned int hash;			/**< hash of the pattern					*/
+	str pattern;				/**< the pattern, or the SDP line			*/
+	str content;				/**< the SDP content pattern, if for SDP	*/
+	int ok;						/**< if the pattern compiled				*/
+	regex_t comp;				/**< the compiled expression				*/
+	struct _isc_regex *next;	/**< next in the hash slot					*/
+} isc_regex;
+
+/** size of the compiled regex cache hash table, power of 2 */
+#define ISC_REGEX_HASH_SIZE	256
+/** max number of compiled regex to keep, the cache is emptied over this */
+#define ISC_REGEX_MAX_CNT	4096
+/** max number of regex a single SPT check gets from the cache */
+#define ISC_REGEX_PER_SPT	2
+
+/** 
+ * Cache of the compiled iFC regular expressions, in this process.
+ * regcomp() keeps the compiled expression in the private heap of the process, so 
+ * this can not live in the shared memory user profile. Instead each process compiles
+ * every distinct pattern of the profiles once and then just runs regexec() on it. 
+ */
+static isc_regex *isc_regex_cache[ISC_REGEX_HASH_SIZE];
+static int isc_regex_cnt=0;
+
+/**
+ * Drops all the compiled regex of this process.
+ */
+static void isc_regex_flush()
+{
+	int i;
+	isc_regex *r,*n;
+	for(i=0;i<ISC_REGEX_HASH_SIZE;i++){
+		for(r=isc_regex_cache[i];r;r=n){
+			n = r->next;
+			if (r->ok) regfree(&(r->comp));
+			pkg_free(r);
+		}
+		isc_regex_cache[i]=0;
+	}
+	isc_regex_cnt=0;
+}
+
+/**
+ * Empties the cache if it is full. Must be called only while no regex returned by
+ * isc_get_regex() is in use, i.e. before checking a SPT.
+ */
+static inline void isc_regex_check_size()
+{
+	if (isc_regex_cnt+ISC_REGEX_PER_SPT>ISC_REGEX_MAX_CNT) isc_regex_flush();
+}
+
+/**
+ * Returns the compiled regex for a SPT pattern, compiling it on first use in this process.
+ * The cache is never flushed here, so the regex stays valid during the SPT check.
+ * @param pattern - the pattern or, if content.s is set, the SDP line
+ * @param content - the SDP content pattern, to match as "line=content", or {0,0}
+ * @returns the compiled regex or NULL if the pattern is invalid or on error
+ */
+static regex_t* isc_get_regex(str pattern,str content)
+{
+	unsigned int hash;
+	isc_regex *r;
+	char *x;
+	
+	hash = get_hash2_raw(&pattern,&content) & (ISC_REGEX_HASH_SIZE-1);
+	for(r=isc_regex_cache[hash];r;r=r->next)
+		if (r->pattern.len==pattern.len && r->content.len==content.len && 
+			(content.s!=0)==(r->content.s!=0) &&
+			memcmp(r->pattern.s,pattern.s,pattern.len)==0 &&
+			memcmp(r->content.s,content.s,content.len)==0)
+				return r->ok?&(r->comp):0;
+	
+	/* the pattern is kept right after the structure, NULL terminated for regcomp */
+	r = pkg_malloc(sizeof(isc_regex)+pattern.len+1+content.len+1);
+	if (!r){
+		LOG(L_ERR,"ERR:"M_NAME":isc_get_regex(): error allocating %d bytes\n",
+			(int)sizeof(isc_regex)+pattern.len+1+content.len+1);
+		return 0;
+	}
+	memset(r,0,sizeof(isc_regex));
+	x = (char*)(r+1);
+	r->hash = hash;
+	r->pattern.s = x;
+	r->pattern.len = pattern.len;
+	memcpy(x,pattern.s,pattern.len);
+	x += pattern.len;
+	if (content.s){
+		*x++ = '=';
+		r->content.s = x;
+		r->content.len = content.len;
+		memcpy(x,content.s,content.len);
+		x += content.len;
+	}
+	*x = 0;
+	
+	r->ok = (regcomp(&(r->comp),r->pattern.s,REG_ICASE|REG_EXTENDED|REG_NOSUB)==0);
+	if (!r->ok)
+		LOG(L_ERR,"ERR:"M_NAME":isc_get_regex(): invalid iFC regular expression <%s>\n",r->pattern.s);
+	
+	r->next = isc_regex_cache[hash];
+	isc_regex_cache[hash] = r;
+	isc_regex_cnt++;
+	return r->ok?&(r->comp):0;
+}
+
+static str s_null={0,0};
+static str s_empty={"",0};
 /**
  *	Check if a Service Point Trigger for Header matches the SDP body
  *	@param spt - the service point trigger
@@ -92,18 +202,11 @@ static int isc_check_headers(ims_spt *spt, struct hdr_field *headers)
 {
 	struct hdr_field *i;
 	char c,ch;
-	char buf[256];
-	regex_t header_comp,content_comp;
+	regex_t *header_comp,*content_comp;
 	i = headers;
-	/* compile the regex for header name */
-	memcpy(buf,spt->sip_header.header.s,spt->sip_header.header.len);
-	buf[spt->sip_header.header.len]=0;
-	regcomp(&(header_comp),buf,REG_ICASE|REG_EXTENDED);
-	
-	/* compile the regex for content */
-	memcpy(buf,spt->sip_header.content.s,spt->sip_header.content.len);
-	buf[spt->sip_header.content.len]=0;
-	regcomp(&(content_comp),buf,REG_ICASE|REG_EXTENDED);
+	/* get the compiled regex for header name and content */
+	header_comp = isc_get_regex(spt->sip_header.header,s_null);
+	content_comp = isc_get_regex(spt->sip_header.content,s_null);
 	
 	DBG("DEBUG:"M_NAME":isc_check_headers: Looking for Header[%.*s(%d)] %.*s \n",
 		spt->sip_header.header.len,spt->sip_header.header.s,spt->sip_header.type,
@@ -113,7 +216,7 @@ static int isc_check_headers(ims_spt *spt, struct hdr_field *headers)
 		i->name.s[i->name.len]=0;
 		
 		if ((spt->sip_header.type>0&&spt->sip_header.type==i->type)|| //matches known type
-			(regexec(&(header_comp),i->name.s,0,NULL,0)==0)//or matches the name
+			(header_comp && regexec(header_comp,i->name.s,0,NULL,0)==0)//or matches the name
 		   )		
 		{
 			
@@ -123,21 +226,14 @@ static int isc_check_headers(ims_spt *spt, struct hdr_field *headers)
 			//if the header should be absent but found it
 		
 			if (spt->sip_header.content.s==NULL)
-				if (spt->condition_negated) {
-						regfree(&(header_comp));
-						regfree(&(content_comp));	
-						return FALSE;
-					}
+				if (spt->condition_negated) return FALSE;
 													
 			//check regex
 			c = i->body.s[i->body.len];
 			i->body.s[i->body.len]=0;
 		
-			if (regexec(&(content_comp),i->body.s,0,NULL,0)==0)//regex match
+			if (content_comp && regexec(content_comp,i->body.s,0,NULL,0)==0)//regex match
 			{
-		
-				regfree(&(header_comp));
-				regfree(&(content_comp));
 				i->body.s[i->body.len]=c;
 				return TRUE;
 			}
@@ -148,8 +244,6 @@ static int isc_check_headers(ims_spt *spt, struct hdr_field *headers)
 		i = i->next;
 	}
 	
-	regfree(&(header_comp));
-	regfree(&(content_comp));
 	return FALSE;
 }
 
@@ -164,8 +258,7 @@ static int isc_check_session_desc(ims_spt *spt, struct sip_msg *msg)
 {
 	int len;
 	char *body,c;
-	char *x;
-	regex_t comp;
+	regex_t *comp;
 
 	if (msg->content_type==NULL) return FALSE;
 	if (str2icmp(msg->content_type->body,sdp)!=0) return FALSE;
@@ -179,23 +272,19 @@ static int isc_check_session_desc(ims_spt *spt, struct sip_msg *msg)
 		msg->content_length->parsed=(void*)(long)len;
 	} else
 		len = (long)msg->content_length->parsed;
+	/* get the compiled regexp for line=content */	
+	comp = isc_get_regex(spt->session_desc.line,spt->session_desc.content.s?
+		spt->session_desc.content:s_empty);
+	if (!comp) return FALSE;
 	c = body[len];
 	body[len]=0;
-	x = pkg_malloc(spt->session_desc.line.len+2+spt->session_desc.content.len);
-	sprintf(x,"%.*s=%.*s",
-		spt->session_desc.line.len,spt->session_desc.line.s,
-		spt->session_desc.content.len,spt->session_desc.content.s);
-	/* compile the whole  regexp */	
-	regcomp(&(comp),x,REG_ICASE|REG_EXTENDED);	
-	if (regexec(&(comp),body,0,NULL,0)==0)//regex match
+	if (regexec(comp,body,0,NULL,0)==0)//regex match
 	{
 		body[len]=c;
 		DBG("DEBUG:"M_NAME":ifc_check_session_desc:      Found Session Desc. > %s\n",body);
-		pkg_free(x);
 		return TRUE;
 	}
 	body[len]=c;
-	pkg_free(x);
 	return FALSE;
 }
 
@@ -211,6 +300,7 @@ static int isc_check_session_desc(ims_spt *spt, struct sip_msg *msg)
 static int isc_check_spt(ims_spt *spt,struct sip_msg *msg,char direction,char registration_type)
 {
 	int r=FALSE;
+	isc_regex_check_size();
 	switch(spt->type){
 		case IFC_REQUEST_URI:
 			DBG("DEBUG:"M_NAME":ifc_check_spt:             SPT type %d -> RequestURI == %.*s ?\n",spt->type,
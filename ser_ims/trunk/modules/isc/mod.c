@@ -100,6 +100,7 @@ int isc_expires_grace=120;			/**< expires value to add to the expires in the 3rd
 	/** IMS PM parameters storage */
 	char* ims_pm_node_type="S-CSCF.ISC";
 	char* ims_pm_logfile="/opt/OpenIMSCore/default_ims_pm.log";
+	int ims_pm_dump_interval=60;		/**< seconds between dumps of the IMS PM totals, -1 for raw events */
 #endif /* WITH_IMS_PM */
 
 
@@ -157,6 +158,7 @@ static param_export_t isc_params[] = {
 #ifdef WITH_IMS_PM
 	{"ims_pm_node_type",				STR_PARAM, &ims_pm_node_type},
 	{"ims_pm_logfile",					STR_PARAM, &ims_pm_logfile},
+	{"ims_pm_dump_interval",					INT_PARAM, &ims_pm_dump_interval},
 #endif /* WITH_IMS_PM */
 										 
 	{ 0, 0, 0 }
@@ -166,10 +168,21 @@ static param_export_t isc_params[] = {
 /**
  * Exported module interface
  */
+/**
+ * Exported RPC methods.
+ * - isc.ims_pm - IMS PM totals
+ */
+static rpc_export_t isc_rpc[]={
+#ifdef WITH_IMS_PM
+	{"isc.ims_pm",		ims_pm_rpc_stats,		ims_pm_rpc_stats_doc,		0},
+#endif /* WITH_IMS_PM */
+	{0, 0, 0, 0}
+};
+
 struct module_exports exports = {
 	"isc",
 	isc_cmds,                       /**< Exported functions */
-	0,
+	isc_rpc,
 	isc_params,                     /**< Exported parameters */
 	isc_init,                   /**< Module initialization function */
 	(response_function) 0,
@@ -223,7 +236,7 @@ static int isc_init( void )
 	isc_my_uri_sip.s[isc_my_uri_sip.len]=0;	
 
 	#ifdef WITH_IMS_PM
-		ims_pm_init(isc_my_uri_sip,ims_pm_node_type, ims_pm_logfile);
+		ims_pm_init(isc_my_uri_sip,ims_pm_node_type, ims_pm_logfile,ims_pm_dump_interval);
 	#endif /* WITH_IMS_PM */
 
 	return 0;
@@ -240,6 +253,9 @@ static int isc_child_init( int rank )
 {
 	LOG( L_INFO, "INFO:"M_NAME": - child init [%d]\n", rank );
 
+	#ifdef WITH_IMS_PM
+		if (ims_pm_init_child(rank)<0) return -1;
+	#endif /* WITH_IMS_PM */
 /* don't do anything for main process and TCP manager process */
 	if ( rank == PROC_MAIN || rank == PROC_TCP_MAIN )
 		return 0;
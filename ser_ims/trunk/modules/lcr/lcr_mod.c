@@ -37,6 +37,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <limits.h>
 #include <arpa/inet.h>
 #include "../../sr_module.h"
 #include "../../dprint.h"
@@ -55,6 +57,7 @@
 #include "../../qvalue.h"
 #include "../../dset.h"
 #include "../../ip_addr.h"
+#include "../../atomic_ops.h"
 #include "lcr_rpc.h"
 #include "lcr_mod.h"
 
@@ -114,7 +117,6 @@ int reload_gws ( void );
 /*
  * Database variables
  */
-static db_con_t* db_handle = 0;   /* Database connection handle */
 static db_func_t lcr_dbf;
 
 /*
@@ -159,9 +161,41 @@ unsigned short rpid_avp_name_str;
 
 static avp_ident_t tm_timer_param;	/* TM module's invite timer avp */
 
+/*
+ * Row of lcr table, kept on the trie node of its prefix
+ */
+struct lcr_rule {
+    str from_uri;		/* From URI pattern in LIKE syntax */
+    int grp_id;
+    int priority;
+    struct lcr_rule *next;
+};
+
+/*
+ * Prefix trie of lcr table, one node per prefix character
+ */
+struct lcr_node {
+    char c;
+    struct lcr_rule *rules;	/* Rows whose prefix ends here */
+    struct lcr_node *child;	/* First child */
+    struct lcr_node *next;	/* Next sibling */
+};
+
+/*
+ * Gateway selected by load_gws() with the sort keys of its last row
+ */
+struct gw_match {
+    struct gw_info *gw;
+    unsigned int prefix_len;
+    int priority;
+    int rnd;
+};
+
 struct gw_info **gws;	/* Pointer to current gw table pointer */
 struct gw_info *gws_1;	/* Pointer to gw table 1 */
 struct gw_info *gws_2;	/* Pointer to gw table 2 */
+struct lcr_node **lcrs;	/* lcr tries going with gw tables 1 and 2 */
+atomic_t *lcr_readers;	/* load_gws() calls using gw tables 1 and 2 */
 struct tm_binds tmb;
 
 /* AVPs overwriting the module parameters */
@@ -237,24 +271,6 @@ struct module_exports exports = {
 };
 
 
-int lcr_db_init(char* db_url)
-{
-	if (lcr_dbf.init==0){
-		LOG(L_CRIT, "BUG: lcr_db_bind: null dbf\n");
-		goto error;
-	}
-	db_handle=lcr_dbf.init(db_url);
-	if (db_handle==0){
-		LOG(L_ERR, "ERROR: lcr_db_bind: unable to connect to the database\n");
-		goto error;
-	}
-	return 0;
-error:
-	return -1;
-}
-
-
-
 int lcr_db_bind(char* db_url)
 {
 	if (bind_dbmod(db_url, &lcr_dbf)<0){
@@ -279,15 +295,6 @@ int lcr_db_bind(char* db_url)
 }
 
 
-void lcr_db_close()
-{
-	if (db_handle && lcr_dbf.close){
-		lcr_dbf.close(db_handle);
-		db_handle=0;
-	}
-}
-
-
 int lcr_db_ver(char* db_url, str* name)
 {
 	db_con_t* dbh;
@@ -309,18 +316,12 @@ int lcr_db_ver(char* db_url, str* name)
 
 
 /*
- * Module initialization function callee in each child separately
+ * Module initialization function callee in each child separately,
+ * gateways are selected from memory so children need no database
+ * connection
  */
 static int child_init(int rank)
 {
-	if (rank==PROC_MAIN || rank==PROC_TCP_MAIN)
-		return 0; /* do nothing for the main or tcp_main processes */
-	if (lcr_db_init(db_url.s) < 0) {
-		LOG(L_ERR, "ERROR: lcr:child_init():"
-		    " Unable to connect to the database\n");
-		return -1;
-	}
-
 	return 0;
 }
 
@@ -417,6 +418,21 @@ static int mod_init(void)
 	}
 	gws = (struct gw_info **)shm_malloc(sizeof(struct gw_info *));
 	*gws = gws_1;
+	lcrs = (struct lcr_node **)shm_malloc(sizeof(struct lcr_node *) * 2);
+	if (lcrs == 0) {
+	    LOG(L_ERR, "ERROR: lcr: mod_init(): "
+		"No memory for lcr table\n");
+	    goto err;
+	}
+	lcrs[0] = lcrs[1] = 0;
+	lcr_readers = (atomic_t *)shm_malloc(sizeof(atomic_t) * 2);
+	if (lcr_readers == 0) {
+	    LOG(L_ERR, "ERROR: lcr: mod_init(): "
+		"No memory for lcr table\n");
+	    goto err;
+	}
+	atomic_set(&lcr_readers[0], 0);
+	atomic_set(&lcr_readers[1], 0);
 
 	/* First reload */
         if (reload_gws() == -1) {
@@ -480,20 +496,171 @@ err:
 
 static void destroy(void)
 {
-	lcr_db_close();
-
 	if (inv_timer_param) pkg_free(inv_timer_param);
 	if (inv_timer_next_param) pkg_free(inv_timer_next_param);
 }
 
 
+/*
+ * Free an lcr trie
+ */
+static void free_lcr_trie(struct lcr_node *n)
+{
+    struct lcr_node *c;
+    struct lcr_rule *r;
+
+    while (n) {
+	while (n->rules) {
+	    r = n->rules;
+	    n->rules = r->next;
+	    shm_free(r);
+	}
+	free_lcr_trie(n->child);
+	c = n->next;
+	shm_free(n);
+	n = c;
+    }
+}
+
+
+/*
+ * Add a row of lcr table to the trie under root
+ */
+static int add_lcr_rule(struct lcr_node *root, str *prefix, str *from_uri,
+			int grp_id, int priority)
+{
+    struct lcr_node *n, *c;
+    struct lcr_rule *r;
+    char ch;
+    int i;
+
+    n = root;
+    for (i = 0; i < prefix->len; i++) {
+	ch = tolower(prefix->s[i]);
+	for (c = n->child; c && c->c != ch; c = c->next);
+	if (!c) {
+	    c = (struct lcr_node *)shm_malloc(sizeof(struct lcr_node));
+	    if (!c) goto nomem;
+	    memset(c, 0, sizeof(struct lcr_node));
+	    c->c = ch;
+	    c->next = n->child;
+	    n->child = c;
+	}
+	n = c;
+    }
+    r = (struct lcr_rule *)shm_malloc(sizeof(struct lcr_rule) + from_uri->len);
+    if (!r) goto nomem;
+    r->from_uri.s = (char *)(r + 1);
+    r->from_uri.len = from_uri->len;
+    memcpy(r->from_uri.s, from_uri->s, from_uri->len);
+    r->grp_id = grp_id;
+    r->priority = priority;
+    r->next = n->rules;
+    n->rules = r;
+    return 0;
+
+ nomem:
+    LOG(L_ERR, "reload_gws(): No memory for lcr table\n");
+    return -1;
+}
+
+
+/*
+ * Read lcr table into a new trie, which replaces *trie
+ */
+static int reload_lcrs(db_con_t* dbh, struct lcr_node **trie)
+{
+    int q_len, i, grp_id, priority;
+    char query[LCR_MAX_QUERY_SIZE];
+    str prefix, from_uri;
+    struct lcr_node *root;
+    db_res_t* res;
+    db_row_t* row;
+
+    q_len = snprintf(query, LCR_MAX_QUERY_SIZE, "SELECT %.*s, %.*s, %.*s, %.*s FROM %.*s",
+		     prefix_col.len, prefix_col.s,
+		     from_uri_col.len, from_uri_col.s,
+		     grp_id_col.len, grp_id_col.s,
+		     priority_col.len, priority_col.s,
+		     lcr_table.len, lcr_table.s);
+
+    if (q_len >= LCR_MAX_QUERY_SIZE) {
+	LOG(L_ERR, "lcr_reload_gws(): Too long database query\n");
+	return -1;
+    }
+
+    if (lcr_dbf.raw_query(dbh, query, &res) < 0) {
+	LOG(L_ERR, "lcr_reload_gws(): Failed to query lcr data\n");
+	return -1;
+    }
+
+    free_lcr_trie(*trie);
+    *trie = 0;
+    root = (struct lcr_node *)shm_malloc(sizeof(struct lcr_node));
+    if (!root) {
+	LOG(L_ERR, "reload_gws(): No memory for lcr table\n");
+	goto error;
+    }
+    memset(root, 0, sizeof(struct lcr_node));
+
+    for (i = 0; i < RES_ROW_N(res); i++) {
+	row = RES_ROWS(res) + i;
+	/* NULL prefix, From URI or group never match in SQL either */
+	if ((VAL_NULL(ROW_VALUES(row)) == 1) ||
+	    (VAL_NULL(ROW_VALUES(row) + 1) == 1) ||
+	    (VAL_NULL(ROW_VALUES(row) + 2) == 1))
+	    continue;
+	prefix.s = (char *)VAL_STRING(ROW_VALUES(row));
+	prefix.len = strlen(prefix.s);
+	from_uri.s = (char *)VAL_STRING(ROW_VALUES(row) + 1);
+	from_uri.len = strlen(from_uri.s);
+	grp_id = VAL_INT(ROW_VALUES(row) + 2);
+	/* NULL priority sorts last in descending order */
+	if (VAL_NULL(ROW_VALUES(row) + 3) == 1) {
+	    priority = INT_MIN;
+	} else {
+	    priority = VAL_INT(ROW_VALUES(row) + 3);
+	}
+	if (add_lcr_rule(root, &prefix, &from_uri, grp_id, priority) < 0)
+	    goto error;
+    }
+
+    lcr_dbf.free_result(dbh, res);
+    *trie = root;
+    return 1;
+
+ error:
+    lcr_dbf.free_result(dbh, res);
+    free_lcr_trie(root);
+    return -1;
+}
+
+
+/*
+ * Wait until no load_gws() call uses gw table and lcr trie idx any more,
+ * so that they can be overwritten
+ */
+static void wait_lcr_readers(int idx)
+{
+    int i;
+
+    for (i = 1; atomic_get(&lcr_readers[idx]); i++) {
+	if (i % 1000 == 0)
+	    LOG(L_WARN, "reload_gws(): Still waiting for %d users of gw table %d\n",
+		atomic_get(&lcr_readers[idx]), idx + 1);
+	sleep_us(1000);
+    }
+    membar();
+}
+
+
 /*
  * Reload gws to unused gw table and when done, make the unused gw table
  * the one in use.
  */
 int reload_gws ( void )
 {
-    int q_len, i;
+    int q_len, i, grp_id;
     unsigned int ip_addr, port, prefix_len;
     uri_type scheme;
     uri_transport transport;
@@ -502,12 +669,13 @@ int reload_gws ( void )
     db_res_t* res;
     db_row_t* row;
 
-    q_len = snprintf(query, LCR_MAX_QUERY_SIZE, "SELECT %.*s, %.*s, %.*s, %.*s, %.*s FROM %.*s",
+    q_len = snprintf(query, LCR_MAX_QUERY_SIZE, "SELECT %.*s, %.*s, %.*s, %.*s, %.*s, %.*s FROM %.*s",
 		     ip_addr_col.len, ip_addr_col.s,
 		     port_col.len, port_col.s,
 		     uri_scheme_col.len, uri_scheme_col.s,
 		     transport_col.len, transport_col.s,
 		     prefix_col.len, prefix_col.s,
+		     grp_id_col.len, grp_id_col.s,
 		     gw_table.len, gw_table.s);
 
     if (q_len >= LCR_MAX_QUERY_SIZE) {
@@ -538,6 +706,9 @@ int reload_gws ( void )
 	    return -1;
     }
 
+    /* load_gws() calls from before the last reload may still use them */
+    wait_lcr_readers((*gws == gws_1) ? 1 : 0);
+
     for (i = 0; i < RES_ROW_N(res); i++) {
 	row = RES_ROWS(res) + i;
 	if (VAL_NULL(ROW_VALUES(row)) == 1) {
@@ -594,6 +765,12 @@ int reload_gws ( void )
 		return -1;
 	    }
 	}
+	/* Gateway without group is never selected */
+	if (VAL_NULL(ROW_VALUES(row) + 5) == 1) {
+	    grp_id = -1;
+	} else {
+	    grp_id = VAL_INT(ROW_VALUES(row) + 5);
+	}
 	if (*gws == gws_1) {
 		gws_2[i].ip_addr = ip_addr;
 		gws_2[i].port = port;
@@ -602,6 +779,7 @@ int reload_gws ( void )
 		gws_2[i].prefix_len = prefix_len;
 		if (prefix_len)
 		    memcpy(&(gws_2[i].prefix[0]), prefix, prefix_len);
+		gws_2[i].grp_id = grp_id;
 	} else {
 		gws_1[i].ip_addr = ip_addr;
 		gws_1[i].port = port;
@@ -610,17 +788,26 @@ int reload_gws ( void )
 		gws_1[i].prefix_len = prefix_len;
 		if (prefix_len)
 		    memcpy(&(gws_1[i].prefix[0]), prefix, prefix_len);
+		gws_1[i].grp_id = grp_id;
 	}
     }
 
     lcr_dbf.free_result(dbh, res);
+
+    /* lcr trie goes with the gw table, both are switched by *gws */
+    if (reload_lcrs(dbh, &(lcrs[(*gws == gws_1) ? 1 : 0])) < 0) {
+	    lcr_dbf.close(dbh);
+	    return -1;
+    }
     lcr_dbf.close(dbh);
 
     if (*gws == gws_1) {
 	    gws_2[i].ip_addr = 0;
+	    membar_write();
 	    *gws = gws_2;
     } else {
 	    gws_1[i].ip_addr = 0;
+	    membar_write();
 	    *gws = gws_1;
     }
 
@@ -628,16 +815,91 @@ int reload_gws ( void )
 }
 
 /*
- * Load GW info from database to lcr_gw_addr_port AVPs
+ * SQL LIKE match of s against pattern p: '%' matches any string, '_' any
+ * character and '\\' escapes them; case insensitive like MySQL does it
+ */
+static int like_match(str *p, str *s)
+{
+    int pi, si, star_p, star_s, esc;
+    char c;
+
+    pi = si = star_s = 0;
+    star_p = -1;
+    while (si < s->len) {
+	if (pi < p->len && p->s[pi] == '%') {
+	    star_p = ++pi;
+	    star_s = si;
+	    continue;
+	}
+	if (pi < p->len) {
+	    c = p->s[pi];
+	    esc = (c == '\\' && pi + 1 < p->len);
+	    if (esc) c = p->s[pi + 1];
+	    if ((c == '_' && !esc) || tolower(c) == tolower(s->s[si])) {
+		pi += 1 + esc;
+		si++;
+		continue;
+	    }
+	}
+	if (star_p < 0) return 0;
+	pi = star_p;
+	si = ++star_s;
+    }
+    while (pi < p->len && p->s[pi] == '%') pi++;
+    return pi == p->len;
+}
+
+
+/*
+ * Match the rules of a trie node against From URI and for each gateway in
+ * their groups keep the row that "ORDER BY CHAR_LENGTH(prefix), priority
+ * DESC, RAND()" would return last
+ */
+static void match_lcr_rules(struct lcr_node *n, unsigned int prefix_len,
+			    str *from_uri, struct gw_info *gw, struct gw_match *m)
+{
+    struct lcr_rule *r;
+    int i, rnd;
+
+    for (r = n->rules; r; r = r->next) {
+	if (!like_match(&r->from_uri, from_uri)) continue;
+	for (i = 0; i < MAX_NO_OF_GWS && gw[i].ip_addr; i++) {
+	    if (gw[i].grp_id != r->grp_id) continue;
+	    rnd = rand();
+	    /* nodes are visited by growing prefix_len */
+	    if (m[i].gw && prefix_len == m[i].prefix_len &&
+		(r->priority > m[i].priority ||
+		 (r->priority == m[i].priority && rnd < m[i].rnd)))
+		continue;
+	    m[i].gw = gw + i;
+	    m[i].prefix_len = prefix_len;
+	    m[i].priority = r->priority;
+	    m[i].rnd = rnd;
+	}
+    }
+}
+
+
+/*
+ * Order of the rows of the former load_gws() query
+ */
+static inline int gw_match_before(struct gw_match *a, struct gw_match *b)
+{
+    if (a->prefix_len != b->prefix_len) return a->prefix_len < b->prefix_len;
+    if (a->priority != b->priority) return a->priority > b->priority;
+    return a->rnd < b->rnd;
+}
+
+
+/*
+ * Load GW info from the in memory gw and lcr tables to lcr_gw_addr_port
+ * AVPs
  */
 int load_gws(struct sip_msg* _m, char* _s1, char* _s2)
 {
-    db_res_t* res;
-    db_row_t *row, *r;
     str ruri_user, from_uri, value;
-    char query[LCR_MAX_QUERY_SIZE];
     char ruri[MAX_URI_SIZE];
-    unsigned int q_len, i, j, prefix_len;
+    unsigned int i, j, cnt, prefix_len;
     unsigned int addr, port;
     uri_type scheme;
     uri_transport transport;
@@ -645,6 +907,10 @@ int load_gws(struct sip_msg* _m, char* _s1, char* _s2)
     str addr_str, port_str;
     char *at, *prefix;
     int_str val;
+    struct gw_info *gw;
+    struct lcr_node *n;
+    struct gw_match m[MAX_NO_OF_GWS], t;
+    int idx;
 
     /* Find Request-URI user */
     if (parse_sip_msg_uri(_m) < 0) {
@@ -676,63 +942,48 @@ int load_gws(struct sip_msg* _m, char* _s1, char* _s2)
 	from_uri = get_from(_m)->uri;
     }
 
-    q_len = snprintf(query, LCR_MAX_QUERY_SIZE, "SELECT %.*s.%.*s, %.*s.%.*s, %.*s.%.*s, %.*s.%.*s, %.*s.%.*s FROM %.*s, %.*s WHERE '%.*s' LIKE %.*s.%.*s AND '%.*s' LIKE CONCAT(%.*s.%.*s, '%%') AND %.*s.%.*s = %.*s.%.*s ORDER BY CHAR_LENGTH(%.*s.%.*s), %.*s.%.*s DESC, RAND()",
-		     gw_table.len, gw_table.s, ip_addr_col.len, ip_addr_col.s,
-		     gw_table.len, gw_table.s, port_col.len, port_col.s,
-		     gw_table.len, gw_table.s, uri_scheme_col.len, uri_scheme_col.s,
-		     gw_table.len, gw_table.s, transport_col.len, transport_col.s,
-		     gw_table.len, gw_table.s, prefix_col.len, prefix_col.s,
-		     gw_table.len, gw_table.s, lcr_table.len, lcr_table.s,
-		     from_uri.len, from_uri.s,
-		     lcr_table.len, lcr_table.s, from_uri_col.len, from_uri_col.s,
-		     ruri_user.len, ruri_user.s,
-		     lcr_table.len, lcr_table.s, prefix_col.len, prefix_col.s,
-		     lcr_table.len, lcr_table.s, grp_id_col.len,  grp_id_col.s,
-		     gw_table.len, gw_table.s, grp_id_col.len, grp_id_col.s,
-		     lcr_table.len, lcr_table.s, prefix_col.len, prefix_col.s,
-		     lcr_table.len, lcr_table.s, priority_col.len, priority_col.s);
-    if (q_len >= LCR_MAX_QUERY_SIZE) {
-	LOG(L_ERR, "load_gws(): Too long database query\n");
-	return -1;
+    /* gw table and its lcr trie are switched together by *gws; they are
+     * counted as used, so that reload_gws() does not overwrite them until
+     * we are done */
+    while (1) {
+	gw = *gws;
+	idx = (gw == gws_1) ? 0 : 1;
+	atomic_inc(&lcr_readers[idx]);
+	membar();
+	if (*gws == gw) break;
+	atomic_dec(&lcr_readers[idx]);
     }
-    if (lcr_dbf.raw_query(db_handle, query, &res) < 0) {
-	LOG(L_ERR, "load_gws(): Failed to query accept data\n");
-	return -1;
+    n = lcrs[idx];
+
+    /* Longest prefix match, collecting the rules of every prefix on the way */
+    memset(m, 0, sizeof(m));
+    if (n) match_lcr_rules(n, 0, &from_uri, gw, m);
+    for (i = 0; n && i < ruri_user.len; i++) {
+	for (n = n->child; n && n->c != tolower(ruri_user.s[i]); n = n->next);
+	if (n) match_lcr_rules(n, i + 1, &from_uri, gw, m);
     }
 
-    for (i = 0; i < RES_ROW_N(res); i++) {
-	row = RES_ROWS(res) + i;
-	if (VAL_NULL(ROW_VALUES(row)) == 1) {
-		LOG(L_ERR, "load_gws(): Gateway IP address is NULL\n");
-		goto skip;
-	}
-      	addr = (unsigned int)VAL_INT(ROW_VALUES(row));
-	for (j = i + 1; j < RES_ROW_N(res); j++) {
-		r = RES_ROWS(res) + j;
-		if (addr == (unsigned int)VAL_INT(ROW_VALUES(r))) goto skip;
-	}
-	if (VAL_NULL(ROW_VALUES(row) + 1) == 1) {
-		port = 0;
-	} else {
-		port = (unsigned int)VAL_INT(ROW_VALUES(row) + 1);
-	}
-	if (VAL_NULL(ROW_VALUES(row) + 2) == 1) {
-	    scheme = SIP_URI_T;
-	} else {
-	    scheme = (uri_type)VAL_INT(ROW_VALUES(row) + 2);
-	}
-	if (VAL_NULL(ROW_VALUES(row) + 3) == 1) {
-	    transport = PROTO_NONE;
-	} else {
-	    transport = (uri_transport)VAL_INT(ROW_VALUES(row) + 3);
-	}
-	if (VAL_NULL(ROW_VALUES(row) + 4) == 1) {
-	    prefix_len = 0;
-	    prefix = (char *)0;
-	} else {
-	    prefix = (char *)VAL_STRING(ROW_VALUES(row) + 4);
-	    prefix_len = strlen(prefix);
+    /* Sort matched gateways in query order */
+    cnt = 0;
+    for (i = 0; i < MAX_NO_OF_GWS; i++) {
+	if (!m[i].gw) continue;
+	t = m[i];
+	for (j = cnt; j > 0 && gw_match_before(&t, &m[j - 1]); j--)
+	    m[j] = m[j - 1];
+	m[j] = t;
+	cnt++;
+    }
+
+    for (i = 0; i < cnt; i++) {
+	addr = m[i].gw->ip_addr;
+	for (j = i + 1; j < cnt; j++) {
+		if (addr == m[j].gw->ip_addr) goto skip;
 	}
+	port = m[i].gw->port;
+	scheme = m[i].gw->scheme;
+	transport = m[i].gw->transport;
+	prefix_len = m[i].gw->prefix_len;
+	prefix = m[i].gw->prefix;
 	if (5 + prefix_len + ruri_user.len + 1 + 15 + 1 + 5 + 1 + 14 > MAX_URI_SIZE) {
 	    LOG(L_ERR, "load_gws(): Request URI would be too long\n");
 	    goto skip;
@@ -789,8 +1040,7 @@ int load_gws(struct sip_msg* _m, char* _s1, char* _s2)
 	continue;
     }
 
-    lcr_dbf.free_result(db_handle, res);
-
+    atomic_dec(&lcr_readers[idx]);
     return 1;
 }
 
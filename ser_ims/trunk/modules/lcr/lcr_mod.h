@@ -51,6 +51,7 @@ struct gw_info {
     uri_transport transport;
     unsigned int prefix_len;
     char prefix[16];
+    int grp_id;
 };
 
 extern struct gw_info **gws;	/* Pointer to current gw table pointer */
@@ -1080,6 +1080,7 @@ int bin_cache_load_registrar_from_table(){
 		if (registrar[contact->hash].tail) registrar[contact->hash].tail->next = contact;
 		registrar[contact->hash].tail = contact;
 		if (!registrar[contact->hash].head) registrar[contact->hash].head = contact;
+		r_expiry_update(contact);
 		r_unlock(contact->hash);
 		bin_free(&x);
 	}
@@ -1204,6 +1205,7 @@ int bin_cache_load_dialogs_from_table(){
 		if (p_dialogs[dialog->hash].tail) p_dialogs[dialog->hash].tail->next = dialog;
 		p_dialogs[dialog->hash].tail = dialog;
 		if (!p_dialogs[dialog->hash].head) p_dialogs[dialog->hash].head = dialog;
+		d_expiry_update(dialog);
 		d_unlock(dialog->hash);
 		bin_free(&x);
 	}
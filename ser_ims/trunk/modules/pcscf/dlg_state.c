@@ -81,6 +81,20 @@ extern int pcscf_dialogs_expiration_time;	/**< expiration time for a dialog		*/
 extern int pcscf_dialogs_enable_release;	/**< if to enable dialog release		*/
 time_t d_time_now;							/**< current time for dialog updates 	*/
 
+/*
+ * Dialogs expiry index
+ * 
+ * Each hash slot keeps a timer wheel of its p_dialogs, filed by their expiration, so that
+ * dialog_timer() only visits the dialogs with something to expire instead of scanning all
+ * of them on every run. A tick is D_EXPIRY_TICK seconds and a dialog due further than 
+ * D_EXPIRY_WHEEL ticks away is skipped until the wheel comes around to its tick. The wheel
+ * is protected by the lock of the slot. Code changing the expiration of a dialog has to 
+ * call d_expiry_update() after it.
+ * 
+ * With WITH_IMS_PM, the slot also keeps the number of its dialogs per method, refreshed
+ * by d_expiry_update().
+ */
+
 extern str pcscf_record_route_mo;			/**< Record-route for originating case 	*/
 extern str pcscf_record_route_mo_uri;		/**< URI for Record-route originating	*/ 
 extern str pcscf_record_route_mt;			/**< Record-route for terminating case 	*/
@@ -177,6 +191,7 @@ int p_dialogs_init(int hash_size)
 			return 0;
 		}
 		p_dialogs[i].lock = lock_init(p_dialogs[i].lock);
+		p_dialogs[i].expiry_tick = time(0)/D_EXPIRY_TICK;
 	}
 			
 	return 1;
@@ -350,6 +365,7 @@ p_dialog* add_p_dialog(str call_id,str host,int port, int transport)
 		if (d->prev) d->prev->next = d;
 		p_dialogs[d->hash].tail = d;
 		if (!p_dialogs[d->hash].head) p_dialogs[d->hash].head = d;
+		d_expiry_update(d);
 
 		return d;
 }
@@ -591,6 +607,11 @@ out_of_memory:
  */
 void del_p_dialog(p_dialog *d)
 {
+	d_expiry_del(d);
+#ifdef WITH_IMS_PM
+	if (d->pm_counted) p_dialogs[d->hash].pm_dialogs[d->pm_method]--;
+	d->pm_counted = 0;
+#endif
 	if (d->prev) d->prev->next = d->next;
 	else p_dialogs[d->hash].head = d->next;
 	if (d->next) d->next->prev = d->prev;
@@ -598,6 +619,59 @@ void del_p_dialog(p_dialog *d)
 	free_p_dialog(d);
 }
 
+/**
+ * Removes a p_dialog from the expiry index of its hash slot.
+ * \note Must be called with a lock on the dialogs slot
+ * @param d - the dialog
+ */
+void d_expiry_del(p_dialog *d)
+{
+	p_dialog **bucket;
+	
+	if (!d->expiry_tick) return;
+	bucket = p_dialogs[d->hash].expiry+(d->expiry_tick%D_EXPIRY_WHEEL);
+	if (d->eprev) d->eprev->enext = d->enext;
+	else *bucket = d->enext;
+	if (d->enext) d->enext->eprev = d->eprev;
+	d->enext = 0;
+	d->eprev = 0;
+	d->expiry_tick = 0;
+}
+
+/**
+ * Files a p_dialog in the expiry index of its hash slot, at the tick of its expiration,
+ * and refreshes the IMS PM counters of the slot for it.
+ * \note Must be called with a lock on the dialogs slot
+ * @param d - the dialog
+ */
+void d_expiry_update(p_dialog *d)
+{
+	p_dialog_hash_slot *slot;
+	unsigned int tick;
+	
+	slot = p_dialogs+d->hash;
+#ifdef WITH_IMS_PM
+	if (d->pm_counted) slot->pm_dialogs[d->pm_method]--;
+	d->pm_method = (d->method>=0 && d->method<=DLG_METHOD_MAX)?d->method:DLG_METHOD_OTHER;
+	slot->pm_dialogs[d->pm_method]++;
+	d->pm_counted = 1;
+#endif
+	
+	/* round up, as the timer expires what is due at the time of the tick */
+	if (d->expires<=(time_t)slot->expiry_tick*D_EXPIRY_TICK)
+		tick = slot->expiry_tick+1;
+	else
+		tick = (d->expires+D_EXPIRY_TICK-1)/D_EXPIRY_TICK;
+	if (tick==d->expiry_tick) return;
+	
+	d_expiry_del(d);
+	d->expiry_tick = tick;
+	d->eprev = 0;
+	d->enext = slot->expiry[tick%D_EXPIRY_WHEEL];
+	if (d->enext) d->enext->eprev = d;
+	slot->expiry[tick%D_EXPIRY_WHEEL] = d;
+}
+
 /**
  * Destroys the dialog.
  * @param d - the dialog to delete
@@ -1053,6 +1127,7 @@ int P_save_dialog(struct sip_msg* msg, char* str1, char* str2)
 	tmb.new_dlg_uas(msg,99,&d->dialog_s);
 	if(cscf_get_p_charging_vector(msg, &icid, 0, 0))
 		STR_SHM_DUP(d->icid,icid,"shm");
+	d_expiry_update(d);
 	d_unlock(d->hash);
 	print_p_dialogs(L_INFO);
 	
@@ -1442,12 +1517,14 @@ int P_update_dialog(struct sip_msg* msg, char* str1, char* str2)
 		}
 	}
 	
+	d_expiry_update(d);
 	d_unlock(d->hash);
 	
 	print_p_dialogs(L_INFO);
 	
 	return CSCF_RETURN_TRUE;	
 out_of_memory:
+	d_expiry_update(d);
 	d_unlock(d->hash);
 	return CSCF_RETURN_ERROR;	
 }
@@ -1811,38 +1888,62 @@ out_of_memory:
 
 /**
  * The dialog timer looks for expired dialogs and removes them.
+ * Only the p_dialogs due in the expiry index of each hash slot are visited.
  * @param ticks - the current time
  * @param param - pointer to the dialogs list
  */
 void dialog_timer(unsigned int ticks, void* param)
 {
 	p_dialog *d,*dn;
+	p_dialog_hash_slot *s;
+	unsigned int now_tick,tick,first_tick,dn_tick;
 	int i;
 	#ifdef WITH_IMS_PM
-		int dialog_cnt[DLG_METHOD_MAX+1];
+		int j,dialog_cnt[DLG_METHOD_MAX+1];
 		for(i=0;i<=DLG_METHOD_MAX;i++)
 			dialog_cnt[i]=0;
 	#endif
 	
 	LOG(L_DBG,"DBG:"M_NAME":dialog_timer: Called at %d\n",ticks);
 	if (!p_dialogs) p_dialogs = (p_dialog_hash_slot*)param;
+	s = p_dialogs;
 
 	d_act_time();
+	now_tick = d_time_now/D_EXPIRY_TICK;
 	
 	for(i=0;i<p_dialogs_hash_size;i++){
 		d_lock(i);
-			d = p_dialogs[i].head;
-			while(d){
-				dn = d->next;
-				if (d->expires<=d_time_now) {						
-						if (!terminate_p_dialog(d)) 
-							del_p_dialog(d);					
+			first_tick = s[i].expiry_tick+1;
+			if (now_tick-s[i].expiry_tick > D_EXPIRY_WHEEL) first_tick = now_tick-D_EXPIRY_WHEEL+1;
+			/* anything filed from now on goes after now_tick */
+			s[i].expiry_tick = now_tick;
+			
+			for(tick=first_tick;tick<=now_tick;tick++){
+				d = s[i].expiry[tick%D_EXPIRY_WHEEL];
+				while(d){
+					dn = d->enext;
+					if (d->expiry_tick>now_tick || d->expires>d_time_now) {
+						/* due on a later turn of the wheel or prolonged meanwhile */
+						if (d->expiry_tick<=now_tick) d_expiry_update(d);
+						d = dn;
+						continue;
+					}
+					dn_tick = dn?dn->expiry_tick:0;
+					/* retried on the next tick, unless terminating it drops it or 
+					 * changes its expiration */
+					d_expiry_update(d);
+					if (!terminate_p_dialog(d)) 
+						del_p_dialog(d);
+					/* releasing the call can also shorten the dialog in the other 
+					 * direction, which moves it to another bucket */
+					if (dn && dn->expiry_tick!=dn_tick) dn = s[i].expiry[tick%D_EXPIRY_WHEEL];
+					d = dn;
 				}
-				#ifdef WITH_IMS_PM
-					else dialog_cnt[d->method]++;
-				#endif										
-				d = dn;
 			}
+			#ifdef WITH_IMS_PM
+				for(j=0;j<=DLG_METHOD_MAX;j++)
+					dialog_cnt[j] += s[i].pm_dialogs[j];
+			#endif
 		d_unlock(i);
 	}
 	print_p_dialogs(L_INFO);
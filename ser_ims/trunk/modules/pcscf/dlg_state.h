@@ -125,13 +125,28 @@ typedef struct _p_dialog {
 													
 	dlg_t *dialog_s;  /* dialog as UAS*/
 	dlg_t *dialog_c;  /* dialog as UAC*/
+	
+	unsigned int expiry_tick;		/**< expiry index tick it is filed at, 0 if not indexed	*/
+	struct _p_dialog *enext,*eprev;	/**< neighbours in the expiry index bucket	*/
+#ifdef WITH_IMS_PM
+	char pm_counted;				/**< if counted in the slot counters		*/
+	enum p_dialog_method pm_method;	/**< method it is counted for				*/
+#endif
 			
 	struct _p_dialog *next,*prev;	
 } p_dialog;
 
+#define D_EXPIRY_TICK	60		/**< seconds per expiry index tick - the dialog_timer() interval	*/
+#define D_EXPIRY_WHEEL	64		/**< number of expiry index buckets per hash slot				*/
+
 typedef struct {
 	p_dialog *head,*tail;
 	gen_lock_t *lock;				/**< slot lock 					*/	
+	p_dialog *expiry[D_EXPIRY_WHEEL];/**< expiry index, p_dialogs by tick	*/
+	unsigned int expiry_tick;		/**< last expiry index tick processed	*/
+#ifdef WITH_IMS_PM
+	int pm_dialogs[DLG_METHOD_MAX+1];/**< IMS PM counters, dialogs per method */
+#endif
 } p_dialog_hash_slot;
 
 
@@ -158,6 +173,8 @@ int store_dlg_icid(struct sip_msg * msg,  str callid, enum p_dialog_direction di
 int terminate_p_dialog(p_dialog *d);
 void del_p_dialog(p_dialog *d);
 void free_p_dialog(p_dialog *d);
+void d_expiry_update(p_dialog *d);
+void d_expiry_del(p_dialog *d);
 void print_p_dialogs(int log_level);
 		
 
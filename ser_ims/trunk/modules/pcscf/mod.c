@@ -70,6 +70,7 @@
 
 #include "../../sr_module.h"
 #include "../../socket_info.h"
+#include "../../pt.h"
 #include "../../timer.h"
 #include "../../locking.h"
 #include "../../modules/tm/tm_load.h"
@@ -87,6 +88,7 @@
 #include "registrar_subscribe.h"
 #include "registrar.h"
 #include "nat_helper.h"
+#include "nat_keepalive.h"
 #include "security.h"
 #include "dlg_state.h"
 #include "sdp_util.h"
@@ -157,6 +159,7 @@ gen_lock_t* pcscf_dialog_count_lock=0; 		/**< Lock for the dialog counter					*/
 int pcscf_nat_enable = 1; 					/**< whether to enable NAT							*/
 int pcscf_nat_ping = 1; 					/**< whether to ping anything 						*/
 int pcscf_nat_pingall = 0; 					/**< whether to ping also the UA that don't look like being behind a NAT */
+int pcscf_nat_ping_interval = 10;			/**< seconds between two pings of the same pin hole	*/
 int pcscf_nat_detection_type = 0; 			/**< the NAT detection tests 						*/
 
 struct socket_info* force_socket = 0;		/**< 												*/
@@ -224,6 +227,7 @@ int * callback_singleton;				/**< Callback singleton 								*/
 	/** IMS PM parameters storage */
 	char* ims_pm_node_type="P-CSCF";
 	char* ims_pm_logfile="/opt/OpenIMSCore/default_ims_pm.log";
+	int ims_pm_dump_interval=60;		/**< seconds between dumps of the IMS PM totals, -1 for raw events */
 #endif /* WITH_IMS_PM */
 
 
@@ -418,6 +422,7 @@ static cmd_export_t pcscf_cmds[]={
 	/* For Gq or Rx*/
 	{"P_release_call_onreply",		P_release_call_onreply,		1, 0, ONREPLY_ROUTE}, 
 	{"P_AAR",						P_AAR,						1, 0, ONREPLY_ROUTE},
+	{"P_AAR_async",					P_AAR_async,				1, 0, ONREPLY_ROUTE},
 	{"P_STR",						P_STR,						1, 0, REQUEST_ROUTE|ONREPLY_ROUTE},
 	{"P_generates_aar",				P_generates_aar,			1, 0, ONREPLY_ROUTE},
 
@@ -454,6 +459,7 @@ static cmd_export_t pcscf_cmds[]={
  * - NAT_enable - if to enable NAT detection for signalling
  * - ping - if to ping endpoints to keep pinholes alive
  * - ping_all - if to ping all endpoints, irespective of their IP networks being public
+ * - ping_interval - seconds between two pings of the same pin hole, spread by the keepalive process
  * - nat_detection_type - which NATs to detect
  * <p>
  * - rtpproxy_enable - if the enable usage of the RTPProxy
@@ -522,6 +528,7 @@ static param_export_t pcscf_params[]={
 	{"NAT_enable",						INT_PARAM,		&pcscf_nat_enable},
 	{"ping",							INT_PARAM,		&pcscf_nat_ping},
 	{"ping_all",						INT_PARAM,		&pcscf_nat_pingall},
+	{"ping_interval",					INT_PARAM,		&pcscf_nat_ping_interval},
 	{"nat_detection_type",				INT_PARAM,		&pcscf_nat_detection_type},
 	
 	{"rtpproxy_enable",     			PARAM_INT,		&rtpproxy_enable      },
@@ -549,6 +556,7 @@ static param_export_t pcscf_params[]={
 #ifdef WITH_IMS_PM
 	{"ims_pm_node_type",				STR_PARAM, 		&ims_pm_node_type},
 	{"ims_pm_logfile",					STR_PARAM, 		&ims_pm_logfile},
+	{"ims_pm_dump_interval",					INT_PARAM, 		&ims_pm_dump_interval},
 #endif /* WITH_IMS_PM */	
 	
 	{"forced_clf_peer",					STR_PARAM, 		&forced_clf_peer},
@@ -579,10 +587,23 @@ static param_export_t pcscf_params[]={
 };
 
 /** module exports */
+/**
+ * Exported RPC methods.
+ * - pcscf.nat_keepalive - counters of the NAT keepalive process
+ * - pcscf.ims_pm - IMS PM totals
+ */
+static rpc_export_t pcscf_rpc[]={
+	{"pcscf.nat_keepalive",	nat_keepalive_rpc_stats,	nat_keepalive_rpc_stats_doc,	0},
+#ifdef WITH_IMS_PM
+	{"pcscf.ims_pm",		ims_pm_rpc_stats,			ims_pm_rpc_stats_doc,			0},
+#endif /* WITH_IMS_PM */
+	{0, 0, 0, 0}
+};
+
 struct module_exports exports = {
 	"pcscf", 
 	pcscf_cmds,
-	0,
+	pcscf_rpc,
 	pcscf_params,
 	
 	mod_init,		/* module initialization function */
@@ -800,7 +821,7 @@ static int mod_init(void)
 	if (!fix_parameters()) goto error;
 
 	#ifdef WITH_IMS_PM
-		ims_pm_init(pcscf_name_str,ims_pm_node_type, ims_pm_logfile);
+		ims_pm_init(pcscf_name_str,ims_pm_node_type, ims_pm_logfile,ims_pm_dump_interval);
 		ims_pm_init_pcscf();
 	#endif /* WITH_IMS_PM */
 	
@@ -936,6 +957,12 @@ static int mod_init(void)
 			goto error;
 	}	
 	
+	/* init the NAT keepalive array, before the registrar loads its contacts */
+	if (pcscf_nat_enable && pcscf_nat_ping){
+		if (!nat_keepalive_init()) goto error;
+		register_procs(1);
+	}
+	
 	/* init the registrar storage */
 	if (!r_storage_init(registrar_hash_size)) goto error;
 	if (pcscf_persistency_mode!=NO_PERSISTENCY){
@@ -944,7 +971,7 @@ static int mod_init(void)
 	}
 
 	/* register the registrar timer */
-	if (register_timer(registrar_timer,registrar,10)<0) goto error;
+	if (register_timer(registrar_timer,registrar,R_EXPIRY_TICK)<0) goto error;
 	
 	/* init the registrar subscriptions */
 	if (!r_subscription_init()) goto error;
@@ -972,7 +999,7 @@ static int mod_init(void)
 	}
 
 	/* register the dialog timer */
-	if (register_timer(dialog_timer,p_dialogs,60)<0) goto error;
+	if (register_timer(dialog_timer,p_dialogs,D_EXPIRY_TICK)<0) goto error;
 	
 	if (pcscf_nat_enable)
 		if(!nat_prepare_1918addr()) goto error;
@@ -1011,6 +1038,12 @@ static int mod_child_init(int rank)
 {
 	LOG(L_INFO,"INFO:"M_NAME":mod_init: Initialization of module in child [%d] \n",
 		rank);
+	#ifdef WITH_IMS_PM
+		if (ims_pm_init_child(rank)<0) return -1;
+	#endif /* WITH_IMS_PM */
+	/* fork the NAT keepalive process */
+	if ( rank == PROC_MAIN && !nat_keepalive_start() )
+		return -1;
 	/* don't do anything for main process and TCP manager process */
 	if ( rank == PROC_MAIN || rank == PROC_TCP_MAIN )
 		return 0;
@@ -1022,7 +1055,8 @@ static int mod_child_init(int rank)
 		lock_get(process_lock);
 			if((*callback_singleton)==0){
 				*callback_singleton=1;
-				cdpb.AAAAddRequestHandler(PCCRequestHandler,NULL);
+				cdpb.AAAAddAppRequestHandler(IMS_Rx,PCCRequestHandler,NULL);
+				cdpb.AAAAddAppRequestHandler(IMS_Gq,PCCRequestHandler,NULL);
 			}
 		lock_release(process_lock);
 	}
@@ -1058,6 +1092,7 @@ static void mod_destroy(void)
 		parser_destroy();
 		r_subscription_destroy();
 		r_storage_destroy();
+		nat_keepalive_destroy();
 		p_dialogs_destroy();
         lock_get(pcscf_dialog_count_lock);
         shm_free(pcscf_dialog_count);
@@ -238,8 +238,6 @@
 #include "registrar_storage.h"
 #include "nat_helper.h"
 
-static const char udp_ping[2] = { 10, 13};	/**< message to ping with - CRLF */
-static const char tcp_ping[2] = { 10, 13};	/**< message to ping with - CRLF */
 
 extern int pcscf_nat_enable; 				/**< whether to enable NAT */
 extern int pcscf_nat_ping; 					/**< whether to ping anything */
@@ -464,55 +462,3 @@ int requires_nat(struct sip_msg * msg)
 	return pcscf_nat_enable && (pcscf_nat_pingall || nat_uac_test(msg));
 }
 
-
-/**
- * Pings a contact to keep the NAT pinhole alive.
- * @param c - the r_contact to ping
- * @returns 1 on success, -1 on failure
- */
-int nat_send_ping(r_contact *c) {
-	struct dest_info dst;
-	
-	if(c->pinhole == NULL)
-		return 1;
-	if (c->transport != PROTO_UDP && 
-		c->transport != PROTO_TCP && 
-		c->transport != PROTO_NONE)
-		return 1;
-	init_dest_info(&dst);
-	dst.proto = c->pinhole->proto;
-	dst.send_sock=c->pinhole->bind_address;
-	dst.id=c->pinhole->proto_reserved1;
-	
-	memset(&(dst.to), 0, sizeof(union sockaddr_union));
-	dst.to.s.sa_family=c->pinhole->nat_addr.af;
-	switch(dst.to.s.sa_family) {
-		case AF_INET6:
-			memcpy(&dst.to.sin6.sin6_addr, c->pinhole->nat_addr.u.addr, c->pinhole->nat_addr.len);
-			//dst.to.sin6.sin6_len=sizeof(struct sockaddr_in6);
-			dst.to.sin6.sin6_port=htons(c->pinhole->nat_port);
-			break;
-		case AF_INET:
-			memcpy(&dst.to.sin.sin_addr, c->pinhole->nat_addr.u.addr, c->pinhole->nat_addr.len);
-			//dst.to.sin.sin_len=sizeof(struct sockaddr_in);
-			dst.to.sin.sin_port=htons(c->pinhole->nat_port);
-			break;
-		default:
-			LOG(L_CRIT,"CRIT:"M_NAME":nat_send_ping: unknown address family %d\n", dst.to.s.sa_family);
-			return -1;
-	}
-	dst.send_sock=get_send_socket(0, &dst.to, PROTO_UDP);
-	if(dst.send_sock == NULL) {
-		LOG(L_ERR,"ERR:"M_NAME":nat_send_ping: cannot get sending socket\n");
-		return -1;
-	}
-	if (dst.proto==PROTO_UDP) udp_send(&dst, (char *)udp_ping, sizeof(udp_ping));
-	else
-	if (dst.proto==PROTO_TCP)
-#ifdef SER_MOD_INTERFACE		
-		tcp_send(&dst, 0, (char *)tcp_ping, sizeof(tcp_ping));
-#else
-		tcp_send(&dst, (char *)tcp_ping, sizeof(tcp_ping));
-#endif	
-	return 1; 
-}
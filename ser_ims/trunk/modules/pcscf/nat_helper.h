@@ -109,7 +109,6 @@ int is1918addr(str *saddr);
 /** NAT test for rport */
 #define NAT_UAC_TEST_RPORT	0x10 
  
-int nat_send_ping(r_contact *c);
 int nat_uac_test(struct sip_msg * msg);
 int nat_prepare_1918addr();
 r_nat_dest* nat_msg_origin(struct sip_msg * msg);
@@ -0,0 +1,419 @@
+/**
+ * $Id$
+ *  
+ * Copyright (C) 2004-2006 FhG Fokus
+ *
+ * This file is part of Open IMS Core - an open source IMS CSCFs & HSS
+ * implementation
+ *
+ * Open IMS Core is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * For a license to use the Open IMS Core software under conditions
+ * other than those described here, or to purchase support for this
+ * software, please contact Fraunhofer FOKUS by e-mail at the following
+ * addresses:
+ *     info@open-ims.org
+ *
+ * Open IMS Core is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * It has to be noted that this Open Source IMS Core System is not 
+ * intended to become or act as a product in a commercial context! Its 
+ * sole purpose is to provide an IMS core reference implementation for 
+ * IMS technology testing and IMS application prototyping for research 
+ * purposes, typically performed in IMS test-beds.
+ * 
+ * Users of the Open Source IMS Core System have to be aware that IMS
+ * technology may be subject of patents and licence terms, as being 
+ * specified within the various IMS-related IETF, ITU-T, ETSI, and 3GPP
+ * standards. Thus all Open IMS Core users have to take notice of this 
+ * fact and have to agree to check out carefully before installing, 
+ * using and extending the Open Source IMS Core System, if related 
+ * patents and licences may become applicable to the intended usage 
+ * context.  
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * 
+ */
+ 
+ 
+/**
+ * \file
+ * 
+ * Proxy-CSCF - NAT pin holes keepalive process
+ * 
+ * The pin holes of the registered contacts are kept in a compact array in shared memory,
+ * updated by the registrar on each change of a contact (nat_ka_update(), nat_ka_del()). 
+ * A separate process goes through the array once per ping interval, in small steps so 
+ * that the pings are spread evenly over the interval, and sends the UDP pings of a step
+ * in batches with udp_send_batch() (sendmmsg() where available). The registrar slot 
+ * locks are never held while pinging.
+ * 
+ */
+
+#include <sys/time.h>
+#include <time.h>
+
+#include "../../pt.h"
+#include "../../ut.h"
+#include "../../forward.h"
+#include "../../udp_server.h"
+#include "../../tcp_server.h"
+#include "../../mem/shm_mem.h"
+
+#include "mod.h"
+#include "nat_keepalive.h"
+
+extern int pcscf_nat_ping_interval;		/**< seconds between two pings of the same pin hole */
+
+static const char udp_ping[2] = { 10, 13};	/**< message to ping with - CRLF */
+static const char tcp_ping[2] = { 10, 13};	/**< message to ping with - CRLF */
+
+nat_ka_table *nat_ka=0;					/**< the pin holes to keep alive	*/
+
+/**
+ * Initializes the keepalive array.
+ * @returns 1 on success, 0 on error
+ */
+int nat_keepalive_init()
+{
+	nat_ka = shm_malloc(sizeof(nat_ka_table));
+	if (!nat_ka){
+		LOG(L_ERR,"ERR:"M_NAME":nat_keepalive_init: Unable to alloc %d bytes\n",
+			(int)sizeof(nat_ka_table));
+		return 0;
+	}
+	memset(nat_ka,0,sizeof(nat_ka_table));
+	nat_ka->lock = lock_alloc();
+	if (!nat_ka->lock){
+		LOG(L_ERR,"ERR:"M_NAME":nat_keepalive_init: Error creating lock\n");
+		shm_free(nat_ka);
+		nat_ka = 0;
+		return 0;
+	}
+	nat_ka->lock = lock_init(nat_ka->lock);
+	return 1;
+}
+
+/**
+ * Destroys the keepalive array.
+ */
+void nat_keepalive_destroy()
+{
+	if (!nat_ka) return;
+	lock_get(nat_ka->lock);
+	if (nat_ka->dests) shm_free(nat_ka->dests);
+	lock_destroy(nat_ka->lock);
+	lock_dealloc(nat_ka->lock);
+	shm_free(nat_ka);
+	nat_ka = 0;
+}
+
+/**
+ * Resolves where to send the pings for a pin hole.
+ * @param pinhole - the NAT pin hole
+ * @param dst - where to write the destination
+ * @returns 1 on success, 0 on error
+ */
+static int nat_ka_dst(r_nat_dest *pinhole,struct dest_info *dst)
+{
+	init_dest_info(dst);
+	dst->proto = pinhole->proto;
+	dst->id = pinhole->proto_reserved1;
+	
+	memset(&(dst->to), 0, sizeof(union sockaddr_union));
+	dst->to.s.sa_family = pinhole->nat_addr.af;
+	switch(dst->to.s.sa_family) {
+		case AF_INET6:
+			memcpy(&dst->to.sin6.sin6_addr, pinhole->nat_addr.u.addr, pinhole->nat_addr.len);
+			dst->to.sin6.sin6_port = htons(pinhole->nat_port);
+			break;
+		case AF_INET:
+			memcpy(&dst->to.sin.sin_addr, pinhole->nat_addr.u.addr, pinhole->nat_addr.len);
+			dst->to.sin.sin_port = htons(pinhole->nat_port);
+			break;
+		default:
+			LOG(L_CRIT,"CRIT:"M_NAME":nat_ka_dst: unknown address family %d\n", dst->to.s.sa_family);
+			return 0;
+	}
+	dst->send_sock = get_send_socket(0, &dst->to, PROTO_UDP);
+	if (!dst->send_sock) {
+		LOG(L_ERR,"ERR:"M_NAME":nat_ka_dst: cannot get sending socket\n");
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Adds or refreshes the pin hole of a contact in the keepalive array.
+ * Contacts without a pin hole, or over other transports than UDP and TCP, are removed.
+ * \note Must be called with a lock on the registrar hash slot of the contact
+ * @param c - the r_contact
+ */
+void nat_ka_update(r_contact *c)
+{
+	nat_ka_dest *e,*x;
+	struct dest_info dst;
+	int max;
+	
+	if (!nat_ka) return;
+	if (!c->pinhole ||
+		(c->transport != PROTO_UDP && c->transport != PROTO_TCP && c->transport != PROTO_NONE) ||
+		(c->pinhole->proto != PROTO_UDP && c->pinhole->proto != PROTO_TCP) ||
+		!nat_ka_dst(c->pinhole,&dst)){
+		nat_ka_del(c);
+		return;
+	}
+	
+	lock_get(nat_ka->lock);
+	if (!c->ka_index){
+		if (nat_ka->cnt==nat_ka->max){
+			max = nat_ka->max?nat_ka->max*2:1024;
+			x = shm_realloc(nat_ka->dests,max*sizeof(nat_ka_dest));
+			if (!x){
+				lock_release(nat_ka->lock);
+				LOG(L_ERR,"ERR:"M_NAME":nat_ka_update: Unable to alloc %d bytes\n",
+					max*(int)sizeof(nat_ka_dest));
+				return;
+			}
+			nat_ka->dests = x;
+			nat_ka->max = max;
+		}
+		e = nat_ka->dests+nat_ka->cnt;
+		e->c = c;
+		e->failed = 0;
+		c->ka_index = ++nat_ka->cnt;
+	}
+	e = nat_ka->dests+c->ka_index-1;
+	e->dst = dst;
+	e->expires = c->expires;
+	lock_release(nat_ka->lock);
+}
+
+/**
+ * Removes the pin hole of a contact from the keepalive array.
+ * The last pin hole of the array takes its place, so that the array has no gaps.
+ * \note Must be called with a lock on the registrar hash slot of the contact
+ * @param c - the r_contact
+ */
+void nat_ka_del(r_contact *c)
+{
+	int i;
+	
+	if (!nat_ka || !c->ka_index) return;
+	lock_get(nat_ka->lock);
+	i = c->ka_index-1;
+	nat_ka->cnt--;
+	if (i!=nat_ka->cnt){
+		nat_ka->dests[i] = nat_ka->dests[nat_ka->cnt];
+		nat_ka->dests[i].c->ka_index = i+1;
+	}
+	c->ka_index = 0;
+	lock_release(nat_ka->lock);
+}
+
+/**
+ * Marks the outcome of the pings sent to a batch of pin holes copied out of the array.
+ * The pin holes that moved or were dropped in the meantime are skipped.
+ * \note Must be called with a lock on the keepalive array
+ * @param batch - the pin holes
+ * @param pos - the array positions they were copied from
+ * @param n - the number of pin holes
+ */
+static inline void nat_ka_mark(nat_ka_dest *batch,int *pos,int n)
+{
+	int i;
+	
+	for(i=0;i<n;i++)
+		if (pos[i]<nat_ka->cnt && nat_ka->dests[pos[i]].c==batch[i].c)
+			nat_ka->dests[pos[i]].failed = batch[i].failed;
+}
+
+/**
+ * Pings a batch of pin holes.
+ * @param batch - the pin holes
+ * @param n - the number of pin holes
+ * @param now - the current time
+ * @param stale - incremented with the pin holes not pinged
+ * @returns the number of pings sent
+ */
+static int nat_ka_ping(nat_ka_dest *batch,int n,time_t now,unsigned int *stale)
+{
+	struct udp_batch_msg msgs[NAT_KEEPALIVE_BATCH];
+	int idx[NAT_KEEPALIVE_BATCH];
+	int i,k=0,sent=0;
+	
+	for(i=0;i<n;i++){
+		if (batch[i].expires<=now){
+			/* the registrar drops it soon, no point in keeping the NAT open */
+			(*stale)++;
+			continue;
+		}
+		if (batch[i].dst.proto==PROTO_TCP){
+#ifdef SER_MOD_INTERFACE		
+			batch[i].failed = tcp_send(&batch[i].dst, 0, (char *)tcp_ping, sizeof(tcp_ping))<0;
+#else
+			batch[i].failed = tcp_send(&batch[i].dst, (char *)tcp_ping, sizeof(tcp_ping))<0;
+#endif
+			if (batch[i].failed) (*stale)++;
+			else sent++;
+			continue;
+		}
+		msgs[k].dst = &batch[i].dst;
+		msgs[k].buf = (char *)udp_ping;
+		msgs[k].len = sizeof(udp_ping);
+		idx[k++] = i;
+	}
+	if (!k) return sent;
+	
+	sent += udp_send_batch(msgs,k);
+	for(i=0;i<k;i++){
+		batch[idx[i]].failed = msgs[i].ret==-1;
+		if (batch[idx[i]].failed) (*stale)++;
+	}
+	return sent;
+}
+
+/**
+ * Returns the milliseconds elapsed since a moment.
+ * @param t - the moment
+ */
+static inline long nat_ka_ms_since(struct timeval *t)
+{
+	struct timeval now;
+	gettimeofday(&now,0);
+	return (now.tv_sec-t->tv_sec)*1000+(now.tv_usec-t->tv_usec)/1000;
+}
+
+/**
+ * The keepalive process.
+ * Each interval of pcscf_nat_ping_interval seconds is divided in steps of 
+ * NAT_KEEPALIVE_STEP milliseconds and each step pings its share of the array, so that each
+ * pin hole is pinged once per interval without bursts. Pin holes added during an interval
+ * are pinged in the next one if they landed behind the current position.
+ */
+static void nat_keepalive_process()
+{
+	nat_ka_dest batch[NAT_KEEPALIVE_BATCH];
+	int pos[NAT_KEEPALIVE_BATCH];
+	struct timeval round_start,step_start;
+	unsigned int pings=0,stale=0;
+	int steps,step=0,i=0,n,target;
+	long ms;
+	time_t now;
+	
+	steps = pcscf_nat_ping_interval*1000/NAT_KEEPALIVE_STEP;
+	if (steps<1) steps = 1;
+	LOG(L_INFO,"INFO:"M_NAME":nat_keepalive_process: started, pinging every %d seconds in %d steps\n",
+		pcscf_nat_ping_interval,steps);
+	gettimeofday(&round_start,0);
+	
+	while(1){
+		gettimeofday(&step_start,0);
+		step++;
+		now = time(0);
+		
+		lock_get(nat_ka->lock);
+		target = (int)((long)nat_ka->cnt*step/steps);
+		lock_release(nat_ka->lock);
+		
+		while(i<target){
+			lock_get(nat_ka->lock);
+			if (target>nat_ka->cnt) target = nat_ka->cnt;
+			for(n=0;n<NAT_KEEPALIVE_BATCH && i<target;n++,i++){
+				batch[n] = nat_ka->dests[i];
+				pos[n] = i;
+			}
+			lock_release(nat_ka->lock);
+			if (!n) break;
+			
+			pings += nat_ka_ping(batch,n,now,&stale);
+			
+			lock_get(nat_ka->lock);
+			nat_ka_mark(batch,pos,n);
+			lock_release(nat_ka->lock);
+		}
+		
+		if (step>=steps){
+			ms = nat_ka_ms_since(&round_start);
+			lock_get(nat_ka->lock);
+			nat_ka->pings += pings;
+			nat_ka->pings_per_sec = ms>0?(unsigned int)(pings*1000L/ms):pings;
+			nat_ka->stale = stale;
+			lock_release(nat_ka->lock);
+			LOG(L_DBG,"DBG:"M_NAME":nat_keepalive_process: %u pings in %ld ms, %u stale pin holes\n",
+				pings,ms,stale);
+			gettimeofday(&round_start,0);
+			pings = 0;
+			stale = 0;
+			step = 0;
+			i = 0;
+		}
+		
+		ms = nat_ka_ms_since(&step_start);
+		if (ms<NAT_KEEPALIVE_STEP) sleep_us((NAT_KEEPALIVE_STEP-ms)*1000);
+	}
+}
+
+/**
+ * Forks the keepalive process.
+ * Must be called from the main process, from child_init with rank PROC_MAIN, and the
+ * process must be registered in mod_init with register_procs().
+ * @returns 1 on success, 0 on error
+ */
+int nat_keepalive_start()
+{
+	int pid;
+	
+	if (!nat_ka) return 1;
+	pid = fork_process(NAT_KEEPALIVE_PROCESS_RANK,"pcscf NAT keepalive",1);
+	if (pid<0){
+		LOG(L_ERR,"ERR:"M_NAME":nat_keepalive_start: Error on fork() for the keepalive process\n");
+		return 0;
+	}
+	if (pid==0) nat_keepalive_process();
+	return 1;
+}
+
+
+const char* nat_keepalive_rpc_stats_doc[] = {
+	"NAT keepalive: pin holes, pings per second over the last interval, total pings and stale pin holes.",
+	0
+};
+
+/**
+ * RPC function returning the counters of the keepalive process.
+ */
+void nat_keepalive_rpc_stats(rpc_t* rpc, void* ctx)
+{
+	void *handle;
+	int cnt;
+	unsigned int pps,stale;
+	unsigned long pings;
+	
+	if (!nat_ka) {
+		rpc->fault(ctx, 500, "NAT keepalive is not enabled");
+		return;
+	}
+	lock_get(nat_ka->lock);
+	cnt = nat_ka->cnt;
+	pps = nat_ka->pings_per_sec;
+	pings = nat_ka->pings;
+	stale = nat_ka->stale;
+	lock_release(nat_ka->lock);
+	
+	if (rpc->add(ctx, "{", &handle) < 0) return;
+	rpc->struct_add(handle, "dddd",
+		"pinholes", cnt,
+		"pings_per_sec", (int)pps,
+		"pings", (int)pings,
+		"stale", (int)stale
+	);
+}
@@ -0,0 +1,98 @@
+/**
+ * $Id$
+ *  
+ * Copyright (C) 2004-2006 FhG Fokus
+ *
+ * This file is part of Open IMS Core - an open source IMS CSCFs & HSS
+ * implementation
+ *
+ * Open IMS Core is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * For a license to use the Open IMS Core software under conditions
+ * other than those described here, or to purchase support for this
+ * software, please contact Fraunhofer FOKUS by e-mail at the following
+ * addresses:
+ *     info@open-ims.org
+ *
+ * Open IMS Core is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * It has to be noted that this Open Source IMS Core System is not 
+ * intended to become or act as a product in a commercial context! Its 
+ * sole purpose is to provide an IMS core reference implementation for 
+ * IMS technology testing and IMS application prototyping for research 
+ * purposes, typically performed in IMS test-beds.
+ * 
+ * Users of the Open Source IMS Core System have to be aware that IMS
+ * technology may be subject of patents and licence terms, as being 
+ * specified within the various IMS-related IETF, ITU-T, ETSI, and 3GPP
+ * standards. Thus all Open IMS Core users have to take notice of this 
+ * fact and have to agree to check out carefully before installing, 
+ * using and extending the Open Source IMS Core System, if related 
+ * patents and licences may become applicable to the intended usage 
+ * context.  
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * 
+ */
+ 
+ 
+/**
+ * \file
+ * 
+ * Proxy-CSCF - NAT pin holes keepalive process
+ * 
+ */
+ 
+
+#ifndef P_CSCF_NAT_KEEPALIVE_H_
+#define P_CSCF_NAT_KEEPALIVE_H_
+
+#include "../../ip_addr.h"
+#include "../../locking.h"
+#include "../../rpc.h"
+#include "registrar_storage.h"
+
+#define NAT_KEEPALIVE_PROCESS_RANK	2101	/**< rank given to the child_init of the keepalive process	*/
+#define NAT_KEEPALIVE_STEP			100		/**< milliseconds between two batches of pings				*/
+#define NAT_KEEPALIVE_BATCH			64		/**< pin holes copied out of the array at once				*/
+
+/** A NAT pin hole to keep alive */
+typedef struct {
+	struct dest_info dst;		/**< where to send the pings, resolved from the r_nat_dest	*/
+	time_t expires;				/**< expiration of the contact							*/
+	char failed;				/**< if the last ping could not be sent					*/
+	r_contact *c;				/**< the contact, to update its ka_index on moves		*/
+} nat_ka_dest;
+
+/** The keepalive array of the pin holes, with the counters of the keepalive process */
+typedef struct {
+	gen_lock_t *lock;			/**< lock for the array and the ka_index of the contacts	*/
+	nat_ka_dest *dests;			/**< the pin holes, without gaps						*/
+	int cnt;					/**< number of pin holes in the array					*/
+	int max;					/**< allocated size of the array						*/
+	
+	unsigned long pings;		/**< pings sent since the start							*/
+	unsigned int pings_per_sec;	/**< pings per second over the last interval			*/
+	unsigned int stale;			/**< pin holes not pinged in the last interval, of expired
+									 contacts or with a failed ping						*/
+} nat_ka_table;
+
+int nat_keepalive_init();
+void nat_keepalive_destroy();
+int nat_keepalive_start();
+
+void nat_ka_update(r_contact *c);
+void nat_ka_del(r_contact *c);
+
+extern const char* nat_keepalive_rpc_stats_doc[];
+void nat_keepalive_rpc_stats(rpc_t* rpc, void* ctx);
+
+#endif //P_CSCF_NAT_KEEPALIVE_H_
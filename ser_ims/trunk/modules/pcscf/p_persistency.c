@@ -181,6 +181,7 @@ int load_snapshot_dialogs()
 				if (p_dialogs[d->hash].tail) p_dialogs[d->hash].tail->next = d;
 				p_dialogs[d->hash].tail = d;
 				if (!p_dialogs[d->hash].head) p_dialogs[d->hash].head = d;
+				d_expiry_update(d);
 				d_unlock(d->hash);
 				
 				memmove(x.s,x.s+x.max,x.len-x.max);
@@ -209,6 +210,7 @@ int load_snapshot_dialogs()
 				if (p_dialogs[d->hash].tail) p_dialogs[d->hash].tail->next = d;
 				p_dialogs[d->hash].tail = d;
 				if (!p_dialogs[d->hash].head) p_dialogs[d->hash].head = d;
+				d_expiry_update(d);
 				d_unlock(d->hash);
 			}
 			bin_free(&x);
@@ -353,6 +355,7 @@ int load_snapshot_registrar()
 				if (registrar[c->hash].tail) registrar[c->hash].tail->next = c;
 				registrar[c->hash].tail = c;
 				if (!registrar[c->hash].head) registrar[c->hash].head = c;
+				r_expiry_update(c);
 				r_unlock(c->hash);
 				
 				memmove(x.s,x.s+x.max,x.len-x.max);
@@ -381,6 +384,7 @@ int load_snapshot_registrar()
 				if (registrar[c->hash].tail) registrar[c->hash].tail->next = c;
 				registrar[c->hash].tail = c;
 				if (!registrar[c->hash].head) registrar[c->hash].head = c;
+				r_expiry_update(c);
 				r_unlock(c->hash);
 			}
 			bin_free(&x);
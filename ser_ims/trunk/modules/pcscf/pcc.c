@@ -302,6 +302,7 @@ void callback_for_pccsession(int event,void *session)
 						}
 						//set expires to 0, so that the registrar timer will clean the r_contact
 						contact->expires=time(0)-1; 
+						r_expiry_update(contact);
 						r_unlock(contact->hash);
 					}
 				}				
@@ -345,6 +346,7 @@ void callback_for_pccsession(int event,void *session)
 							contact->pcc_session_id.len=0; 							
 						}
 						contact->expires=time(0)-1; 
+						r_expiry_update(contact);
 						r_unlock(contact->hash);
 					}
 				}				
@@ -504,6 +506,7 @@ int pcc_auth_init_register(contact_t * aor, str callid,
 		auth->u.auth.lifetime = duration;
 		auth->u.auth.grace_period = REGISTRATION_GRACE_PERIOD;
 		if (auth->u.auth.timeout<auth->u.auth.lifetime) auth->u.auth.timeout = duration;
+		cdpb.AAAUpdateAuthSessionTimers(auth);
 		*expireReg = 0;
 				
 	}
@@ -570,6 +573,7 @@ int pcc_auth_init_dlg(p_dialog **dlgp, AAASession ** authp, int * relatch, int p
 		}		 
 		STR_SHM_DUP(dlg->pcc_session_id,auth->id,"pcc_auth_init_dlg") ;
 		auth->u.auth.lifetime = dlg->expires;
+		cdpb.AAAUpdateAuthSessionTimers(auth);
 		STR_SHM_DUP(pcc_authdata->icid,dlg->icid,"pcc_auth_init_dlg");
 		
 	} else {
@@ -684,20 +688,19 @@ error:
 }
 
 /**
- * Sends the Authorization Authentication Request.
+ * Creates the Authorization Authentication Request.
  * @param req - SIP request  
  * @param res - SIP response
  * @param str1 - 0/o/orig for originating side, 1/t/term for terminating side, r/REGISTER for registration
  * @param pcc_session_id - the returned AAAsession id
  * @param is_shm - req is from shared memory 
  * 
- * @returns AAA message or NULL on error  
+ * @returns AAR message or NULL on error  
  */
-AAAMessage *PCC_AAR(struct sip_msg *req, struct sip_msg *res, char *str1, contact_t* aor, 
+static AAAMessage *PCC_new_AAR(struct sip_msg *req, struct sip_msg *res, char *str1, contact_t* aor, 
 		str* pcc_session_id, int is_shm)
 {
 	AAAMessage* aar = NULL;
-	AAAMessage* aaa = 0;
 	AAASession* auth = 0;
 	AAA_AVP* avp=0;
 
@@ -899,15 +902,7 @@ AAAMessage *PCC_AAR(struct sip_msg *req, struct sip_msg *res, char *str1, contac
 
 	if (auth) cdpb.AAASessionsUnlock(auth->hash);
 	
-	LOG(L_INFO,"INFO:"M_NAME":PCC_AAR: sending AAR to PCRF\n");
-	/*---------- 3. Send AAR to PCRF ----------*/
-	if (forced_qos_peer.len)
-		aaa = cdpb.AAASendRecvMessageToPeer(aar,&forced_qos_peer);
-	else 
-		aaa = cdpb.AAASendRecvMessage(aar);	
-	
-	LOG(L_INFO,"INFO:"M_NAME":PCC_AAR: received AAA from PCRF\n");
-	return aaa;
+	return aar;
 
 out_of_memory:
 	LOG(L_CRIT,"CRIT:"M_NAME":PCC_AAR:out of memory\n");
@@ -931,6 +926,71 @@ end:
 }
 
 
+/**
+ * Sends the Authorization Authentication Request and waits for the answer.
+ * @param req - SIP request  
+ * @param res - SIP response
+ * @param str1 - 0/o/orig for originating side, 1/t/term for terminating side, r/REGISTER for registration
+ * @param pcc_session_id - the returned AAAsession id
+ * @param is_shm - req is from shared memory 
+ * 
+ * @returns AAA message or NULL on error  
+ */
+AAAMessage *PCC_AAR(struct sip_msg *req, struct sip_msg *res, char *str1, contact_t* aor, 
+		str* pcc_session_id, int is_shm)
+{
+	AAAMessage* aar = NULL;
+	AAAMessage* aaa = 0;
+
+	aar = PCC_new_AAR(req,res,str1,aor,pcc_session_id,is_shm);
+	if (!aar) return 0;
+	
+	LOG(L_INFO,"INFO:"M_NAME":PCC_AAR: sending AAR to PCRF\n");
+	/*---------- 3. Send AAR to PCRF ----------*/
+	if (forced_qos_peer.len)
+		aaa = cdpb.AAASendRecvMessageToPeer(aar,&forced_qos_peer);
+	else 
+		aaa = cdpb.AAASendRecvMessage(aar);	
+	
+	LOG(L_INFO,"INFO:"M_NAME":PCC_AAR: received AAA from PCRF\n");
+	return aaa;
+}
+
+/**
+ * Sends the Authorization Authentication Request without waiting for the answer.
+ * The AAA (or NULL on time-out) is passed later to the callback, in a Diameter worker.
+ * @param req - SIP request  
+ * @param res - SIP response
+ * @param str1 - 0/o/orig for originating side, 1/t/term for terminating side, r/REGISTER for registration
+ * @param pcc_session_id - the returned AAAsession id, a shm copy as the AAA can come after
+ *  the session was freed; to be freed by the caller with shm_free()
+ * @param is_shm - req is from shared memory 
+ * @param cb - transactional callback to be called on AAA or time-out
+ * @param param - generic parameter for the callback; owned by the caller if this fails
+ * 
+ * @returns 1 if the AAR was sent, 0 on error  
+ */
+int PCC_AAR_async(struct sip_msg *req, struct sip_msg *res, char *str1, contact_t* aor, 
+		str* pcc_session_id, int is_shm, AAATransactionCallback_f *cb, void *param)
+{
+	AAAMessage* aar = NULL;
+	str id={0,0};
+
+	aar = PCC_new_AAR(req,res,str1,aor,&id,is_shm);
+	if (!aar) return 0;
+	STR_SHM_DUP(*pcc_session_id,id,"PCC_AAR_async");
+	
+	LOG(L_INFO,"INFO:"M_NAME":PCC_AAR_async: sending AAR to PCRF\n");
+	if (forced_qos_peer.len)
+		return cdpb.AAASendMessageToPeer(aar,&forced_qos_peer,cb,param);
+	else 
+		return cdpb.AAASendMessage(aar,cb,param);	
+out_of_memory:
+	cdpb.AAAFreeMessage(&aar);
+	return 0;
+}
+
+
 /* handle an AAA response to an AAR for resource reservation for a successfull registration or initiated/updated dialog 
  * @param aaa - the diameter reply
  * @return -  1 if result code found and processing ok, -1 if error
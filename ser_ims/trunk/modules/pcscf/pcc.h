@@ -88,6 +88,8 @@ void pcc_auth_clean_dlg_safe(p_dialog *dlg);
 
 
 AAAMessage* PCC_AAR(struct sip_msg *req, struct sip_msg *res, char *str1, contact_t *aor, str * pcc_session_id, int is_shm);
+int PCC_AAR_async(struct sip_msg *req, struct sip_msg *res, char *str1, contact_t *aor, str * pcc_session_id, int is_shm,
+		AAATransactionCallback_f *cb, void *param);
 AAAMessage* PCC_STR(struct sip_msg *msg, char *str1, contact_t * aor);
 AAAMessage* PCC_ASA(AAAMessage *request);
 int PCC_AAA(AAAMessage *msg, unsigned int * rc, str pcc_session_id);
@@ -58,6 +58,7 @@
 
 #include "pcc.h"
 #include "sip.h"
+#include "release_call.h"
 #include "dlg_state.h"
 
 extern struct tm_binds tmb;            /**< Structure with pointers to tm funcs 		*/
@@ -237,6 +238,129 @@ error:
 }
 
 
+/** Context of an AAR sent by P_AAR_async() */
+typedef struct {
+	str pcc_session_id;		/**< the Rx/Gq session id, a shm copy filled in when creating the AAR */
+	str call_id;			/**< Call-ID of the call to release if the AAR is rejected */
+} pcc_async_ctx;
+
+static str _488_qos_text_s={"Not Acceptable Here - QoS rejected",34};
+
+/**
+ * Frees the context of P_AAR_async_cb() and its copy of the session id.
+ * @param ctx - the context to free
+ */
+static void free_pcc_async_ctx(pcc_async_ctx *ctx)
+{
+	if (ctx->pcc_session_id.s) shm_free(ctx->pcc_session_id.s);
+	shm_free(ctx);
+}
+
+/**
+ * Transactional callback for the AAA of P_AAR_async().
+ * Runs in a Diameter worker process. If the PCRF rejected the AAR, the call is released.
+ * @param is_timeout - if this is a time-out
+ * @param param - the pcc_async_ctx of the AAR
+ * @param aaa - the AAA or NULL on time-out
+ */
+static void P_AAR_async_cb(int is_timeout,void *param,AAAMessage *aaa)
+{
+	pcc_async_ctx *ctx = param;
+	unsigned int result = AAA_SUCCESS;
+	
+	if (!aaa){
+		/* default policy is if PDF/PCRF not working, then leave everything flow */
+		LOG(L_INFO,"INFO:"M_NAME":P_AAR_async_cb: no AAA received for <%.*s>\n",
+			ctx->call_id.len,ctx->call_id.s);
+		goto done;
+	}
+	if(PCC_AAA(aaa, &result, ctx->pcc_session_id)>0){
+		LOG(L_INFO,"INFO:"M_NAME":P_AAR_async_cb: recieved an AAA with result code %u\n",result);
+	}
+	cdpb.AAAFreeMessage(&aaa);
+	
+	if ((result < 2000 || result >= 3000) && ctx->call_id.len) {
+		LOG(L_INFO,"INFO:"M_NAME":P_AAR_async_cb: AAR rejected, releasing call <%.*s>\n",
+			ctx->call_id.len,ctx->call_id.s);
+		release_call(ctx->call_id,488,_488_qos_text_s);
+	}
+done:
+	free_pcc_async_ctx(ctx);
+}
+
+/**
+ * Creates the context for P_AAR_async_cb() in shared memory.
+ * @param call_id - Call-ID of the call
+ * @returns the new context or NULL on error
+ */
+static pcc_async_ctx* new_pcc_async_ctx(str call_id)
+{
+	pcc_async_ctx *ctx;
+	ctx = shm_malloc(sizeof(pcc_async_ctx)+call_id.len);
+	if (!ctx){
+		LOG(L_ERR,"ERR:"M_NAME":new_pcc_async_ctx: error allocating %d bytes\n",
+			(int)sizeof(pcc_async_ctx)+call_id.len);
+		return 0;
+	}
+	memset(ctx,0,sizeof(pcc_async_ctx));
+	ctx->call_id.s = (char*)(ctx+1);
+	ctx->call_id.len = call_id.len;
+	if (call_id.len) memcpy(ctx->call_id.s,call_id.s,call_id.len);
+	return ctx;
+}
+
+/**
+ * Non-blocking version of P_AAR(), to be used on replies.
+ * The AAR is sent and the reply is relayed right away, without waiting for the PCRF.
+ * When the AAA arrives, it is processed in a Diameter worker and, if the PCRF rejected
+ * the session, the call is released as by P_release_call_onreply().
+ * Replies to REGISTER still wait for the AAA, as P_AAR() does, so that a rejected AAR 
+ * fails them.
+ * @param msg - The SIP response  
+ * @param str1 - orig/term/register
+ * @param str2 - not used 
+ * @returns 1 if the AAR was sent (or not needed) or 0 on failure   
+ */
+int P_AAR_async(struct sip_msg* msg, char* str1, char* str2)
+{	
+	struct cell *t;
+	pcc_async_ctx *ctx;
+	str call_id={0,0};
+	
+	if (!pcscf_use_pcc) return CSCF_RETURN_TRUE;
+	
+	if (msg->first_line.type == SIP_REQUEST) {
+		LOG(L_ERR,"ERR:"M_NAME":P_AAR_async: called upon request\n");
+		return CSCF_RETURN_FALSE;
+	}
+	t=tmb.t_gett();
+	if (!t) {
+		LOG(L_ERR,"ERR:"M_NAME":P_AAR_async: cannot get the transaction\n");
+		return CSCF_RETURN_FALSE;
+	}
+	
+	if ((strncmp(t->method.s,"INVITE",6)==0)||(strncmp(t->method.s,"UPDATE",6)==0)||(strncmp(t->method.s,"PRACK",5)==0))
+	{
+		call_id = cscf_get_call_id(msg,0);
+		ctx = new_pcc_async_ctx(call_id);
+		if (!ctx) return CSCF_RETURN_TRUE;
+		if (!PCC_AAR_async(t->uas.request, msg, str1, NULL, &(ctx->pcc_session_id), 1, P_AAR_async_cb, ctx)){
+			free_pcc_async_ctx(ctx);
+			return CSCF_RETURN_TRUE;
+		}
+		return CSCF_RETURN_TRUE;
+	}
+	
+	if ((strncmp(t->method.s,"REGISTER",8)==0))
+	{
+		/* a rejected AAR must fail the 200 OK, which could not be taken back once relayed */
+		return P_AAR_register(t->uas.request, msg);
+	}
+	
+	LOG(L_DBG,"DBG:"M_NAME":P_AAR_async: Policy and Charging Control non-applicable\n");
+	return CSCF_RETURN_TRUE;
+}
+
 
 /**
  * P_STR() will be called, if PCSCF receives BYE, CANCEL, 3xx, 4xx, 5xx or 6xx.
@@ -89,99 +89,109 @@ extern int pcscf_use_ipsec;
 #endif
 /**
  * The Registrar timer looks for expires contacts and removes them.
- * For the non-deleted contacts a ping is sent if the UA is behind a NAT.
+ * Only the r_contacts due in the expiry index of each hash slot are visited.
+ * The NAT pin holes are pinged by the keepalive process, see nat_keepalive.c.
  * @param ticks - the current time
  * @param param - pointer to the domain_list
  */
 void registrar_timer(unsigned int ticks, void* param)
 {
 	r_contact *c,*cn;
+	r_hash_slot *r;
+	unsigned int now_tick,tick,first_tick;
 	int i;
 	#ifdef WITH_IMS_PM
-		int impu_cnt=0,contact_cnt=0,ipsec_cnt=0,tls_cnt=0,nat_cnt=0;
-		r_public *rp;
+		r_pm_counters pm;
 	#endif
 	
 	LOG(L_DBG,"DBG:"M_NAME":registrar_timer: Called at %d\n",ticks);
 	if (!registrar) registrar = (r_hash_slot*)param;
+	r = registrar;
 
 	r_act_time();
+	now_tick = time_now/R_EXPIRY_TICK;
 	
 	for(i=0;i<r_hash_size;i++){
 		r_lock(i);
-			c = registrar[i].head;
-			while(c){
-				cn = c->next;
-				switch (c->reg_state){
-					case NOT_REGISTERED:
-						LOG(L_DBG,"DBG:"M_NAME":registrar_timer: Contact <%.*s> Not Registered and removed.\n",
-								c->uri.len,c->uri.s);
-                                                if(pcscf_use_ipsec ==2)
-                                                  del_tcp_ipsec(c);
-						del_r_contact(c);
-						break;
-					case REGISTERED:
-						if (c->expires<=time_now) {
-							LOG(L_DBG,"DBG:"M_NAME":registrar_timer: Contact <%.*s> expired and Deregistered.\n",
-								c->uri.len,c->uri.s);		
-							if (c->security){
-								/* If we have IPSec SAs, we keep them REGISTRATION_GRACE_PERIOD seconds more to relay further messages */
-								c->reg_state = DEREGISTERED;
-								c->expires = time_now + REGISTRATION_GRACE_PERIOD;
-							}else{
+			first_tick = r[i].expiry_tick+1;
+			if (now_tick-r[i].expiry_tick > R_EXPIRY_WHEEL) first_tick = now_tick-R_EXPIRY_WHEEL+1;
+			/* anything filed from now on goes after now_tick */
+			r[i].expiry_tick = now_tick;
+			
+			for(tick=first_tick;tick<=now_tick;tick++){
+				c = r[i].expiry[tick%R_EXPIRY_WHEEL];
+				while(c){
+					cn = c->enext;
+					if (c->expiry_tick>now_tick) {/* due on a later turn of the wheel */
+						c = cn;
+						continue;
+					}
+					switch (c->reg_state){
+						case NOT_REGISTERED:
+							LOG(L_DBG,"DBG:"M_NAME":registrar_timer: Contact <%.*s> Not Registered and removed.\n",
+									c->uri.len,c->uri.s);
+	                                                if(pcscf_use_ipsec ==2)
+	                                                  del_tcp_ipsec(c);
+							del_r_contact(c);
+							c = 0;
+							break;
+						case REGISTERED:
+							if (c->expires<=time_now) {
+								LOG(L_DBG,"DBG:"M_NAME":registrar_timer: Contact <%.*s> expired and Deregistered.\n",
+									c->uri.len,c->uri.s);		
+								if (c->security){
+									/* If we have IPSec SAs, we keep them REGISTRATION_GRACE_PERIOD seconds more to relay further messages */
+									c->reg_state = DEREGISTERED;
+									c->expires = time_now + REGISTRATION_GRACE_PERIOD;
+								}else{
+									LOG(L_DBG,"DBG:"M_NAME":registrar_timer: Contact <%.*s> expired and removed.\n",
+									c->uri.len,c->uri.s);						
+	                                                                if(pcscf_use_ipsec ==2)
+	                                                                  del_tcp_ipsec(c);
+									del_r_contact(c);
+									c = 0;
+								}
+							}
+							break;
+						case DEREGISTERED:
+							if (c->expires<=time_now) {
 								LOG(L_DBG,"DBG:"M_NAME":registrar_timer: Contact <%.*s> expired and removed.\n",
-								c->uri.len,c->uri.s);						
-                                                                if(pcscf_use_ipsec ==2)
-                                                                  del_tcp_ipsec(c);
+									c->uri.len,c->uri.s);		
+								P_security_drop(c,c->security);
+								P_security_drop(c,c->security_temp);
+	                                                        if(pcscf_use_ipsec ==2)
+	                                                          del_tcp_ipsec(c);
 								del_r_contact(c);
+								c = 0;
 							}
-						}
-						#ifdef WITH_IMS_PM
-							else {
-									contact_cnt++;
-									for(rp=c->head;rp;rp=rp->next)
-										impu_cnt++;
-									if (c->security && c->security->type==SEC_IPSEC) ipsec_cnt++;
-									if (c->security && c->security->type==SEC_TLS) tls_cnt++;				
-									if (c->pinhole) nat_cnt++;
-							}			
-						#endif
-						break;
-					case DEREGISTERED:
-						if (c->expires<=time_now) {
-							LOG(L_DBG,"DBG:"M_NAME":registrar_timer: Contact <%.*s> expired and removed.\n",
-								c->uri.len,c->uri.s);		
-							P_security_drop(c,c->security);
-							P_security_drop(c,c->security_temp);
-                                                        if(pcscf_use_ipsec ==2)
-                                                          del_tcp_ipsec(c);
-							del_r_contact(c);
-						}
-						break;
-					case REG_PENDING:
-						if (c->expires<=time_now) {
-							LOG(L_DBG,"DBG:"M_NAME":registrar_timer: Contact <%.*s> Registration pending expired and removed.\n",
-								c->uri.len,c->uri.s);		
-							P_security_drop(c,c->security);
-							P_security_drop(c,c->security_temp);
-                                                        if(pcscf_use_ipsec ==2)
-                                                          del_tcp_ipsec(c);
-							del_r_contact(c);
-						}
-						break;
-				}				
-				if (pcscf_nat_enable && pcscf_nat_ping) nat_send_ping(c);
-				c = cn;
+							break;
+						case REG_PENDING:
+							if (c->expires<=time_now) {
+								LOG(L_DBG,"DBG:"M_NAME":registrar_timer: Contact <%.*s> Registration pending expired and removed.\n",
+									c->uri.len,c->uri.s);		
+								P_security_drop(c,c->security);
+								P_security_drop(c,c->security_temp);
+	                                                        if(pcscf_use_ipsec ==2)
+	                                                          del_tcp_ipsec(c);
+								del_r_contact(c);
+								c = 0;
+							}
+							break;
+					}
+					if (c) r_expiry_update(c);
+					c = cn;
+				}
 			}
 		r_unlock(i);
 	}
 	print_r(L_INFO);
 	#ifdef WITH_IMS_PM
-		IMS_PM_LOG01(RD_NbrContact,contact_cnt);
-		IMS_PM_LOG01(RD_NbrIMPU,impu_cnt);
-		IMS_PM_LOG01(RD_NbrIPSecSA,ipsec_cnt);
-		IMS_PM_LOG01(RD_NbrTLSSA,tls_cnt);
-		IMS_PM_LOG01(RD_NbrNATPinHoles,nat_cnt);
+		r_pm_get(&pm);
+		IMS_PM_LOG01(RD_NbrContact,pm.contacts);
+		IMS_PM_LOG01(RD_NbrIMPU,pm.impus);
+		IMS_PM_LOG01(RD_NbrIPSecSA,pm.ipsec);
+		IMS_PM_LOG01(RD_NbrTLSSA,pm.tls);
+		IMS_PM_LOG01(RD_NbrNATPinHoles,pm.nat);
 	#endif
 }
 
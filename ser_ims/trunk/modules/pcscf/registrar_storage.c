@@ -66,6 +66,7 @@
 #include "registrar_storage.h"
 //#include "registrar_notify.h"
 #include "nat_helper.h"
+#include "nat_keepalive.h"
 #include "security.h"
 #include "dlg_state.h"
 /* For PCC sessions*/
@@ -77,6 +78,24 @@ time_t time_now;				/**< current time 							*/
 r_hash_slot *registrar=0;		/**< the actual registrar					*/
 int 	   r_hash_size=128;		/**< number of hash slots in the registrar	*/
 
+/*
+ * Registrar expiry index
+ * 
+ * Each hash slot keeps a timer wheel of its r_contacts, filed by their expiration, so that
+ * registrar_timer() only visits the contacts with something to expire instead of scanning
+ * the whole registrar on every run. A tick is R_EXPIRY_TICK seconds and a contact due 
+ * further than R_EXPIRY_WHEEL ticks away is skipped until the wheel comes around to its
+ * tick. The wheel is protected by the lock of the slot and is kept up to date by the 
+ * functions below. Code changing the expiration or the registration state of a contact 
+ * directly has to call r_expiry_update() itself.
+ * 
+ * With WITH_IMS_PM, the slot also keeps the counters of its registered contacts, refreshed
+ * by r_expiry_update() and by r_pm_update() for changes of the public identities or of 
+ * the security associations.
+ * 
+ * r_expiry_update() also refreshes the pin hole of the contact in the NAT keepalive array.
+ */
+
 
 /**
  * Update the time.
@@ -166,6 +185,7 @@ int r_storage_init(int hash_size)
 			return 0;
 		}
 		registrar[i].lock = lock_init(registrar[i].lock);
+		registrar[i].expiry_tick = time(0)/R_EXPIRY_TICK;
 	}
 			
 	if (!registrar) return 0;
@@ -296,6 +316,7 @@ r_public* add_r_public(r_contact *c,str aor,int is_default)
 	if (c->tail) c->tail->next = p;
 	c->tail = p;
 	if (!c->head) c->head=p;
+	r_pm_update(c);
 	
 	return p;
 }
@@ -387,6 +408,7 @@ void del_r_public(r_contact *c,r_public *p)
 	if (c->tail == p) c->tail = p->prev;
 	else p->next->prev = p->prev;
 	free_r_public(p);
+	r_pm_update(c);
 }
 
 /**
@@ -670,6 +692,7 @@ r_contact* add_r_contact(str host,int port,int transport,str uri,
 		if (!registrar[c->hash].head) registrar[c->hash].head=c;
 		c->pinhole = pinhole;
 		c->sos_flag = sos_flag;
+		r_expiry_update(c);
 	return c;
 }
 
@@ -744,10 +767,12 @@ r_contact* update_r_contact(str host,int port,int transport,
 		}
 		if (pinhole) c->pinhole = *pinhole;
 		c->sos_flag = sos_mask;
+		r_expiry_update(c);
 		return c;
 	}
 	
 out_of_memory:
+	r_expiry_update(c);
 	return c;	
 }
 
@@ -815,6 +840,128 @@ r_nat_dest* get_r_nat_pinhole(str host, int port, int transport) {
 }
 
 
+#ifdef WITH_IMS_PM
+/**
+ * Takes out of the IMS PM counters of its hash slot what a r_contact added to them.
+ * \note Must be called with a lock on the hash slot
+ * @param c - the r_contact
+ */
+static inline void r_pm_sub(r_contact *c)
+{
+	r_pm_counters *pm = &(registrar[c->hash].pm);
+	
+	pm->contacts -= c->pm.contacts;
+	pm->impus -= c->pm.impus;
+	pm->ipsec -= c->pm.ipsec;
+	pm->tls -= c->pm.tls;
+	pm->nat -= c->pm.nat;
+	memset(&(c->pm),0,sizeof(r_pm_counters));
+}
+#endif
+
+/**
+ * Refreshes what a r_contact adds to the IMS PM counters of its hash slot.
+ * Only registered contacts are counted. Does nothing without WITH_IMS_PM.
+ * \note Must be called with a lock on the hash slot
+ * @param c - the r_contact
+ */
+void r_pm_update(r_contact *c)
+{
+#ifdef WITH_IMS_PM
+	r_pm_counters *pm = &(registrar[c->hash].pm);
+	r_public *p;
+	
+	r_pm_sub(c);
+	if (c->reg_state!=REGISTERED) return;
+	c->pm.contacts = 1;
+	for(p=c->head;p;p=p->next)
+		c->pm.impus++;
+	if (c->security && c->security->type==SEC_IPSEC) c->pm.ipsec = 1;
+	if (c->security && c->security->type==SEC_TLS) c->pm.tls = 1;
+	if (c->pinhole) c->pm.nat = 1;
+	
+	pm->contacts += c->pm.contacts;
+	pm->impus += c->pm.impus;
+	pm->ipsec += c->pm.ipsec;
+	pm->tls += c->pm.tls;
+	pm->nat += c->pm.nat;
+#endif
+}
+
+#ifdef WITH_IMS_PM
+/**
+ * Sums up the IMS PM counters of all the hash slots.
+ * @param pm - where to put the totals
+ */
+void r_pm_get(r_pm_counters *pm)
+{
+	int i;
+	
+	memset(pm,0,sizeof(r_pm_counters));
+	if (!registrar) return;
+	for(i=0;i<r_hash_size;i++){
+		r_lock(i);
+			pm->contacts += registrar[i].pm.contacts;
+			pm->impus += registrar[i].pm.impus;
+			pm->ipsec += registrar[i].pm.ipsec;
+			pm->tls += registrar[i].pm.tls;
+			pm->nat += registrar[i].pm.nat;
+		r_unlock(i);
+	}
+}
+#endif
+
+/**
+ * Removes a r_contact from the expiry index of its hash slot.
+ * \note Must be called with a lock on the hash slot
+ * @param c - the r_contact
+ */
+void r_expiry_del(r_contact *c)
+{
+	r_contact **bucket;
+	
+	if (!c->expiry_tick) return;
+	bucket = registrar[c->hash].expiry+(c->expiry_tick%R_EXPIRY_WHEEL);
+	if (c->eprev) c->eprev->enext = c->enext;
+	else *bucket = c->enext;
+	if (c->enext) c->enext->eprev = c->eprev;
+	c->enext = 0;
+	c->eprev = 0;
+	c->expiry_tick = 0;
+}
+
+/**
+ * Files a r_contact in the expiry index of its hash slot, at the tick of its expiration,
+ * and refreshes its IMS PM counters and its NAT keepalive entry.
+ * A not registered contact is filed for the next tick, so that the registrar_timer() 
+ * drops it.
+ * \note Must be called with a lock on the hash slot
+ * @param c - the r_contact
+ */
+void r_expiry_update(r_contact *c)
+{
+	r_hash_slot *slot;
+	unsigned int tick;
+	
+	slot = registrar+c->hash;
+	r_pm_update(c);
+	nat_ka_update(c);
+	
+	/* round up, as the timer expires what is due at the time of the tick */
+	if (c->reg_state==NOT_REGISTERED || c->expires<=(time_t)slot->expiry_tick*R_EXPIRY_TICK)
+		tick = slot->expiry_tick+1;
+	else
+		tick = (c->expires+R_EXPIRY_TICK-1)/R_EXPIRY_TICK;
+	if (tick==c->expiry_tick) return;
+	
+	r_expiry_del(c);
+	c->expiry_tick = tick;
+	c->eprev = 0;
+	c->enext = slot->expiry[tick%R_EXPIRY_WHEEL];
+	if (c->enext) c->enext->eprev = c;
+	slot->expiry[tick%R_EXPIRY_WHEEL] = c;
+}
+
 /**
  * Drops and deallocates a r_contact.
  * \note Don't forget to release the lock on the !!OLD!! hash value
@@ -832,6 +979,11 @@ void del_r_contact(r_contact *c)
 		c->pcc_session_id.len=0;
 		c->pcc_session_id.s=0;
 	}
+	r_expiry_del(c);
+#ifdef WITH_IMS_PM
+	r_pm_sub(c);
+#endif
+	nat_ka_del(c);
 	if (registrar[c->hash].head == c) registrar[c->hash].head = c->next;
 	else c->prev->next = c->next;
 	if (registrar[c->hash].tail == c) registrar[c->hash].tail = c->prev;
@@ -134,6 +134,17 @@ typedef struct _r_security {
  */
 typedef enum reg_type_{NORMAL_REG = 1, EMERG_REG = 2, ANY_REG = 3} r_reg_type;
 
+#ifdef WITH_IMS_PM
+/** IMS PM counters, kept per hash slot instead of counting the registrar on each timer run */
+typedef struct {
+	int contacts;				/**< registered contacts				*/
+	int impus;					/**< their public identities			*/
+	int ipsec;					/**< their IPSec SAs					*/
+	int tls;					/**< their TLS SAs						*/
+	int nat;					/**< their NAT pin holes				*/
+} r_pm_counters;
+#endif
+
 /** Registrar Contact Structure */
 typedef struct _r_contact {
 	unsigned int hash;			/**< the hash value 					*/
@@ -163,15 +174,31 @@ typedef struct _r_contact {
     struct socket_info * si_pc;
     struct socket_info * si_ps;
 
+	unsigned int expiry_tick;	/**< expiry index tick it is filed at, 0 if not indexed	*/
+	struct _r_contact *enext,*eprev; /**< neighbours in the expiry index bucket	*/
+#ifdef WITH_IMS_PM
+	r_pm_counters pm;			/**< what this contact adds to the slot counters	*/
+#endif
+	int ka_index;				/**< position+1 in the NAT keepalive array, 0 if not in it, 
+									 protected by the lock of the array				*/
+
 	struct _r_contact *next;	/**< next contact in this hash slot 	*/
 	struct _r_contact *prev;	/**< previous contact in this hash slot	*/
 } r_contact;
 
+#define R_EXPIRY_TICK	10		/**< seconds per expiry index tick - the registrar_timer() interval	*/
+#define R_EXPIRY_WHEEL	64		/**< number of expiry index buckets per hash slot				*/
+
 /** Registrar Slot Structure */
 typedef struct {
 	r_contact *head;			/**< first contact in the slot			*/
 	r_contact *tail;			/**< last contact in the slot			*/
 	gen_lock_t *lock;			/**< slot lock 							*/
+	r_contact *expiry[R_EXPIRY_WHEEL];/**< expiry index, r_contacts by tick	*/
+	unsigned int expiry_tick;		/**< last expiry index tick processed	*/
+#ifdef WITH_IMS_PM
+	r_pm_counters pm;			/**< IMS PM counters of the registered contacts in the slot */
+#endif
 } r_hash_slot;
 
 
@@ -219,6 +246,13 @@ r_contact* update_r_contact_sec(str host,int port,int transport,
 void del_r_contact(r_contact *c);
 void free_r_contact(r_contact *c);
 
+void r_expiry_update(r_contact *c);
+void r_expiry_del(r_contact *c);
+void r_pm_update(r_contact *c);
+#ifdef WITH_IMS_PM
+void r_pm_get(r_pm_counters *pm);
+#endif
+
 r_nat_dest * get_r_nat_pinhole(str host, int port, int transport);
 
 r_contact * get_next_em_r_contact(str pub_id, contact_t * contact);
@@ -145,6 +145,7 @@ int release_call_confirmed(p_dialog *d, int reason_code, str reason_text)
 		if (o->expires>time_now+TIME_TO_EXPIRE)
 		{
 			o->expires=time_now+TIME_TO_EXPIRE;
+			d_expiry_update(o);
 		}
 	}
 		
@@ -162,6 +163,7 @@ int release_call_confirmed(p_dialog *d, int reason_code, str reason_text)
 		if (d->expires>time_now+TIME_TO_EXPIRE)
 		{
 			d->expires=time_now+TIME_TO_EXPIRE;
+			d_expiry_update(d);
 		}
 		/*Before generating a request, we have to generate
 		 * the route_set in the dlg , because the route set
@@ -319,6 +321,7 @@ int release_call_previous(p_dialog *d,enum release_call_situation situation,int
 		// just in case no reply is received
 		if (o->expires>time_now+TIME_TO_EXPIRE) {
 				o->expires=time_now+TIME_TO_EXPIRE;
+				d_expiry_update(o);
 		}
 		
 	}
@@ -331,6 +334,7 @@ int release_call_previous(p_dialog *d,enum release_call_situation situation,int
 	if (d->expires>time_now+TIME_TO_EXPIRE)
 	{
 		d->expires=time_now+TIME_TO_EXPIRE;
+		d_expiry_update(d);
 	}
 			
 	if (d->is_releasing>MAX_TIMES_TO_TRY_TO_RELEASE){
@@ -1033,6 +1033,7 @@ int P_security_200(struct sip_msg *rpl,char *str1, char *str2)
 			
 			c->security = c->security_temp;
 			c->security_temp = 0;
+			r_pm_update(c);
 		}
 	}	
 	
@@ -1129,6 +1130,7 @@ int P_security_200(struct sip_msg *rpl,char *str1, char *str2)
 				c->reg_state = DEREGISTERED;
 				r_act_time();
 				c->expires = time_now + 60;
+				r_expiry_update(c);
 			}			
 			r_unlock(c->hash);
 		
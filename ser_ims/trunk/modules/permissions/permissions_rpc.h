@@ -36,6 +36,7 @@
 rpc_export_t permissions_rpc[] = {
 	{"trusted.reload", trusted_reload, trusted_reload_doc, 0},
 	{"trusted.dump",   trusted_dump,   trusted_dump_doc,   RET_ARRAY},
+	{"trusted.stats",  trusted_stats_rpc, trusted_stats_doc, 0},
 	{"ipmatch.reload", im_reload,      im_reload_doc, 0},
 	{0, 0, 0, 0}
 };
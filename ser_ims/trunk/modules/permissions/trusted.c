@@ -50,6 +50,7 @@
 struct trusted_list ***hash_table;     /* Pointer to current hash table pointer */
 struct trusted_list **hash_table_1;   /* Pointer to hash table 1 */
 struct trusted_list **hash_table_2;   /* Pointer to hash table 2 */
+struct trusted_stats *trusted_stats;  /* Counters of allow_trusted */
 
 /*
  * Initialize data structures
@@ -59,6 +60,15 @@ int init_trusted(void)
 	hash_table_1 = hash_table_2 = 0;
 	hash_table = 0;
 
+	trusted_stats = (struct trusted_stats *)shm_malloc(sizeof(struct trusted_stats));
+	if (!trusted_stats) {
+		LOG(L_ERR, "init_trusted(): No memory for trusted statistics\n");
+		return -1;
+	}
+	memset(trusted_stats, 0, sizeof(struct trusted_stats));
+	atomic_set(&trusted_stats->hits, 0);
+	atomic_set(&trusted_stats->misses, 0);
+
 	if (db_mode == ENABLE_CACHE) {
 
 		hash_table_1 = new_hash_table();
@@ -83,6 +93,8 @@ int init_trusted(void)
 	if (hash_table_1) free_hash_table(hash_table_1);
 	if (hash_table_2) free_hash_table(hash_table_2);
 	if (hash_table) shm_free(hash_table);
+	shm_free(trusted_stats);
+	trusted_stats = 0;
 	return -1;
 }
 
@@ -91,9 +103,11 @@ int init_trusted(void)
  */
 void clean_trusted(void)
 {
+	free_trusted_regexps();
 	if (hash_table_1) free_hash_table(hash_table_1);
 	if (hash_table_2) free_hash_table(hash_table_2);
 	if (hash_table) shm_free(hash_table);
+	if (trusted_stats) shm_free(trusted_stats);
 }
 
 
@@ -190,12 +204,9 @@ static int match_res(struct sip_msg* msg, db_res_t* _r)
 
 
 /*
- * Checks based on request's source address, protocol, and from field
- * if request can be trusted without authentication.  Possible protocol
- * values are "any" (that matches any protocol), "tcp", "udp", "tls",
- * and "sctp".
+ * Looks the request up in the database or in the cached trusted table
  */
-int allow_trusted(struct sip_msg* _msg, char* str1, char* str2)
+static int match_trusted(struct sip_msg* _msg)
 {
 	int result;
 	db_res_t* res;
@@ -245,6 +256,25 @@ int allow_trusted(struct sip_msg* _msg, char* str1, char* str2)
 }
 
 
+/*
+ * Checks based on request's source address, protocol, and from field
+ * if request can be trusted without authentication.  Possible protocol
+ * values are "any" (that matches any protocol), "tcp", "udp", "tls",
+ * and "sctp".
+ */
+int allow_trusted(struct sip_msg* _msg, char* str1, char* str2)
+{
+	int result;
+
+	result = match_trusted(_msg);
+	if (trusted_stats) {
+		if (result == 1) atomic_inc(&trusted_stats->hits);
+		else atomic_inc(&trusted_stats->misses);
+	}
+	return result;
+}
+
+
 
 /*
  * Reload trusted table to new hash table and when done, make new hash table
@@ -258,7 +288,8 @@ int reload_trusted_table(void)
 	db_val_t* val;
 
 	struct trusted_list **new_hash_table;
-	int i;
+	unsigned int gen, n;
+	int i, k;
 
 	cols[0] = source_col;
 	cols[1] = proto_col;
@@ -288,6 +319,8 @@ int reload_trusted_table(void)
 	}
 
 	row = RES_ROWS(res);
+	gen = trusted_stats->reloads + 1;
+	n = 0;
 
 	DBG("Number of rows in trusted table: %d\n", RES_ROW_N(res));
 
@@ -297,16 +330,21 @@ int reload_trusted_table(void)
 		    (VAL_TYPE(val) == DB_STRING) && !VAL_NULL(val) &&
 		    (VAL_TYPE(val + 1) == DB_STRING) && !VAL_NULL(val + 1) &&
 		    (VAL_TYPE(val + 2) == DB_STRING) && !VAL_NULL(val + 2)) {
-			if (hash_table_insert(new_hash_table,
+			k = hash_table_insert(new_hash_table,
 					       (char *)VAL_STRING(val),
 					       (char *)VAL_STRING(val + 1),
-					       (char *)VAL_STRING(val + 2)) == -1) {
+					       (char *)VAL_STRING(val + 2),
+					       gen, n);
+			if (k == -1) {
 				LOG(L_ERR, "ERROR: permissions: "
 						"trusted_reload(): Hash table problem\n");
 				perm_dbf.free_result(db_handle, res);
 				perm_dbf.close(db_handle);
 				return -1;
 			}
+			/* ignored rows get no pattern id and are not counted */
+			if (k == 0) continue;
+			n++;
 			DBG("Tuple <%s, %s, %s> inserted into trusted hash table\n",
 			    VAL_STRING(val), VAL_STRING(val + 1), VAL_STRING(val + 2));
 		} else {
@@ -321,6 +359,8 @@ int reload_trusted_table(void)
 	perm_dbf.free_result(db_handle, res);
 
 	*hash_table = new_hash_table;
+	trusted_stats->reloads = gen;
+	trusted_stats->entries = n;
 
 	DBG("Trusted table reloaded successfully.\n");
 
@@ -29,12 +29,29 @@
 
 #include <sys/types.h>
 #include <regex.h>
+#include "../../mem/mem.h"
 #include "../../mem/shm_mem.h"
 #include "../../parser/parse_from.h"
 #include "../../ut.h"
+#include "im_hash.h"
 #include "trusted_hash.h"
 
 
+/*
+ * Pattern of a table entry compiled by this process. regcomp() allocates
+ * from the private heap, so each process compiles the patterns of the
+ * current table once, on first use.
+ */
+struct trusted_re {
+	regex_t preg;
+	int state;                  /* 0 - not compiled yet, 1 - compiled */
+};
+
+static struct trusted_re *re_cache = 0;   /* Indexed by trusted_list id */
+static unsigned int re_size = 0;
+static unsigned int re_gen = 0;           /* Table generation of re_cache */
+
+
 /*
  * Create and initialize a hash table
  */
@@ -68,20 +85,15 @@ void free_hash_table(struct trusted_list** table)
 
 
 /* 
- * String hash function 
+ * Hash function of source IP and protocol
  */
-static unsigned int hash(str* src_ip)
+static unsigned int hash(struct ip_addr* ip, int proto)
 {
-	char *p;
-	unsigned int h = 0;
-	unsigned int len;
+	unsigned int h = proto;
 	unsigned int i;
 	
-	p = src_ip->s;
-	len = src_ip->len;
-	
-	for (i = 0; i < len; i++) {
-		h = ( h << 5 ) - h + *(p + i);
+	for (i = 0; i < ip->len; i++) {
+		h = ( h << 5 ) - h + ip->u.addr[i];
 	}
 
 	return h % HASH_SIZE;
@@ -91,11 +103,32 @@ static unsigned int hash(str* src_ip)
 /* 
  * Add <src_ip, proto, pattern> into hash table, where proto is integer
  * representation of string argument proto.
+ * Returns 1 if inserted, 0 if the entry can never match and was left out,
+ * -1 on error.
  */
-int hash_table_insert(struct trusted_list** hash_table, char* src_ip, char* proto, char* pattern)
+int hash_table_insert(struct trusted_list** hash_table, char* src_ip, char* proto, char* pattern,
+		unsigned int gen, unsigned int id)
 {
 	struct trusted_list *np;
 	unsigned int hash_val;
+	struct ip_addr ip;
+	unsigned short port;
+	regex_t preg;
+	str s;
+
+	/* Entries which can never match are left out */
+	s.s = src_ip;
+	s.len = strlen(src_ip);
+	port = 0;
+	if (parse_ip(&s, &ip, &port) || port) {
+		LOG(L_ERR, "hash_table_insert(): Invalid source IP '%s', entry ignored\n", src_ip);
+		return 0;
+	}
+	if (regcomp(&preg, pattern, REG_NOSUB)) {
+		LOG(L_ERR, "hash_table_insert(): Error in regular expression '%s', entry ignored\n", pattern);
+		return 0;
+	}
+	regfree(&preg);
 
 	np = (struct trusted_list *) shm_malloc(sizeof(*np));
 	if (np == NULL) {
@@ -135,7 +168,10 @@ int hash_table_insert(struct trusted_list** hash_table, char* src_ip, char* prot
 	}
 	(void) strcpy(np->pattern, pattern);
 
-	hash_val = hash(&(np->src_ip));
+	np->ip = ip;
+	np->gen = gen;
+	np->id = id;
+	hash_val = hash(&(np->ip), np->proto);
 	np->next = hash_table[hash_val];
 	hash_table[hash_val] = np;
 
@@ -143,6 +179,65 @@ int hash_table_insert(struct trusted_list** hash_table, char* src_ip, char* prot
 }
 
 
+/*
+ * Free the patterns compiled by this process
+ */
+void free_trusted_regexps(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < re_size; i++) {
+		if (re_cache[i].state) regfree(&re_cache[i].preg);
+	}
+	if (re_cache) pkg_free(re_cache);
+	re_cache = 0;
+	re_size = 0;
+}
+
+
+/*
+ * Return the pattern of the entry compiled by this process, compiling it
+ * on first use after each reload
+ */
+static regex_t* trusted_regexp(struct trusted_list* np)
+{
+	struct trusted_re *re;
+	unsigned int size;
+
+	if (np->gen != re_gen) {
+		free_trusted_regexps();
+		re_gen = np->gen;
+	}
+
+	if (np->id >= re_size) {
+		size = re_size ? re_size : 16;
+		while (size <= np->id) size *= 2;
+		re = (struct trusted_re *)pkg_malloc(sizeof(*re) * size);
+		if (!re) {
+			LOG(L_ERR, "match_hash_table(): No memory for compiled patterns\n");
+			return 0;
+		}
+		memset(re, 0, sizeof(*re) * size);
+		if (re_cache) {
+			memcpy(re, re_cache, sizeof(*re) * re_size);
+			pkg_free(re_cache);
+		}
+		re_cache = re;
+		re_size = size;
+	}
+
+	re = re_cache + np->id;
+	if (!re->state) {
+		if (regcomp(&re->preg, np->pattern, REG_NOSUB)) {
+			LOG(L_ERR, "match_hash_table(): Error in regular expression\n");
+			return 0;
+		}
+		re->state = 1;
+	}
+	return &re->preg;
+}
+
+
 /* 
  * Check if an entry exists in hash table that has given src_ip and protocol
  * value and pattern that matches to From URI.
@@ -151,37 +246,35 @@ int match_hash_table(struct trusted_list** table, struct sip_msg* msg)
 {
 	str uri;
 	char uri_string[MAX_URI_SIZE + 1];
-	regex_t preg;
+	regex_t *preg;
 	struct trusted_list *np;
-	str src_ip;
+	int proto, i;
 
-	src_ip.s = ip_addr2a(&msg->rcv.src_ip);
-	src_ip.len = strlen(src_ip.s);
+	uri_string[0] = 0;
+	uri.len = -1;
 
-	if (parse_from_header(msg) < 0) return -1;
-	uri = get_from(msg)->uri;
-	if (uri.len > MAX_URI_SIZE) {
-		LOG(L_ERR, "match_hash_table(): From URI too large\n");
-		return -1;
-	}
-	memcpy(uri_string, uri.s, uri.len);
-	uri_string[uri.len] = (char)0;
-
-	for (np = table[hash(&src_ip)]; np != NULL; np = np->next) {
-		if ((np->src_ip.len == src_ip.len) && 
-		    (strncasecmp(np->src_ip.s, src_ip.s, src_ip.len) == 0) &&
-		    ((np->proto == PROTO_NONE) || (np->proto == msg->rcv.proto))) {
-			if (regcomp(&preg, np->pattern, REG_NOSUB)) {
-				LOG(L_ERR, "match_hash_table(): Error in regular expression\n");
-				return -1;
-			}
-			if (regexec(&preg, uri_string, 0, (regmatch_t *)0, 0)) {
-				regfree(&preg);
-			} else {
-				regfree(&preg);
-				return 1;
+	/* Entries of the request protocol, then the ones of any protocol */
+	for (i = 0; i < 2; i++) {
+		proto = i ? PROTO_NONE : msg->rcv.proto;
+		for (np = table[hash(&msg->rcv.src_ip, proto)]; np != NULL; np = np->next) {
+			if ((np->proto != proto) || !ip_addr_cmp(&np->ip, &msg->rcv.src_ip))
+				continue;
+			/* From URI is only needed for trusted addresses */
+			if (uri.len < 0) {
+				if (parse_from_header(msg) < 0) return -1;
+				uri = get_from(msg)->uri;
+				if (uri.len > MAX_URI_SIZE) {
+					LOG(L_ERR, "match_hash_table(): From URI too large\n");
+					return -1;
+				}
+				memcpy(uri_string, uri.s, uri.len);
+				uri_string[uri.len] = (char)0;
 			}
+			preg = trusted_regexp(np);
+			if (!preg) return -1;
+			if (!regexec(preg, uri_string, 0, (regmatch_t *)0, 0)) return 1;
 		}
+		if (proto == PROTO_NONE) break;
 	}
 	return -1;
 }
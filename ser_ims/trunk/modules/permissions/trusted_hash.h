@@ -34,6 +34,8 @@
 #include "../../parser/msg_parser.h"
 #include "../../rpc.h"
 #include "../../str.h"
+#include "../../ip_addr.h"
+#include "../../atomic_ops.h"
 
 #define HASH_SIZE 128
 
@@ -42,11 +44,26 @@
  */
 struct trusted_list {
 	str src_ip;                 /* Source IP of SIP message */
+	struct ip_addr ip;          /* Parsed source IP, the hash key with proto */
 	int proto;                  /* Protocol -- UDP, TCP, TLS, or SCTP */
 	char *pattern;              /* Pattern matching From header field */
+	unsigned int gen;           /* Reload that built the table */
+	unsigned int id;            /* Index of the compiled pattern in each process */
 	struct trusted_list *next;  /* Next element in the list */
 };
 
+/*
+ * Counters of allow_trusted, in shared memory
+ */
+struct trusted_stats {
+	atomic_t hits;              /* Requests allowed */
+	atomic_t misses;            /* Requests not allowed */
+	unsigned int reloads;       /* Successful reloads, also the table generation */
+	unsigned int entries;       /* Rows of the current table */
+};
+
+extern struct trusted_stats *trusted_stats;
+
 
 /*
  * Create and initialize a hash table
@@ -69,8 +86,11 @@ void destroy_hash_table(struct trusted_list** table);
 /* 
  * Add <src_ip, proto, pattern> into hash table, where proto is integer
  * representation of string argument proto.
+ * Returns 1 if inserted, 0 if the entry can never match and was left out,
+ * -1 on error.
  */
-int hash_table_insert(struct trusted_list** hash_table, char* src_ip, char* proto, char* pattern);
+int hash_table_insert(struct trusted_list** hash_table, char* src_ip, char* proto, char* pattern,
+		unsigned int gen, unsigned int id);
 
 
 /* 
@@ -92,4 +112,10 @@ void hash_table_print(struct trusted_list** hash_table, rpc_t* rpc, void* ctx);
 void empty_hash_table(struct trusted_list** hash_table);
 
 
+/*
+ * Free the patterns compiled by this process
+ */
+void free_trusted_regexps(void);
+
+
 #endif /* _TRUSTED_HASH_H */
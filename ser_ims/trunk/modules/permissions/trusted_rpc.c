@@ -96,3 +96,30 @@ void trusted_dump(rpc_t* rpc, void* ctx)
 		hash_table_print(*hash_table, rpc, ctx);
 	}
 }
+
+
+
+const char* trusted_stats_doc[2] = {
+	"Return allow_trusted hits and misses, reloads and rows of trusted table",
+	0
+};
+
+/*
+ * Fifo function to print the counters of allow_trusted
+ */
+void trusted_stats_rpc(rpc_t* rpc, void* ctx)
+{
+	void* st;
+
+	if (!trusted_stats) {
+		rpc->fault(ctx, 400, "Database is not enabled");
+		return;
+	}
+
+	if (rpc->add(ctx, "{", &st) < 0) return;
+	rpc->struct_add(st, "dddd",
+			"hits", atomic_get(&trusted_stats->hits),
+			"misses", atomic_get(&trusted_stats->misses),
+			"reloads", (int)trusted_stats->reloads,
+			"entries", (int)trusted_stats->entries);
+}
@@ -46,4 +46,11 @@ extern const char* trusted_dump_doc[];
  */
 void trusted_dump(rpc_t* rpc, void* ctx);
 
+extern const char* trusted_stats_doc[];
+
+/*
+ * Fifo function to print the counters of allow_trusted
+ */
+void trusted_stats_rpc(rpc_t* rpc, void* ctx);
+
 #endif /* _TRUSTED_RPC_H */
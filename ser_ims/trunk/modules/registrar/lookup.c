@@ -95,17 +95,17 @@ int lookup(struct sip_msg* _m, char* _t, char* _s)
 
 	get_act_time();
 
-	ul.lock_udomain((udomain_t*)_t);
+	ul.lock_udomain((udomain_t*)_t, &uid);
 	res = ul.get_urecord((udomain_t*)_t, &uid, &r);
 	if (res < 0) {
 		LOG(L_ERR, "lookup(): Error while querying usrloc\n");
-		ul.unlock_udomain((udomain_t*)_t);
+		ul.unlock_udomain((udomain_t*)_t, &uid);
 		return -2;
 	}
 	
 	if (res > 0) {
 		DBG("lookup(): '%.*s' Not found in usrloc\n", uid.len, ZSW(uid.s));
-		ul.unlock_udomain((udomain_t*)_t);
+		ul.unlock_udomain((udomain_t*)_t, &uid);
 		return -3;
 	}
 
@@ -126,14 +126,14 @@ int lookup(struct sip_msg* _m, char* _t, char* _s)
 			_m->parsed_uri_ok=0;
 			goto skip_rewrite_uri;
 			}else if (set_dst_uri(_m, &ptr->received) < 0) {
-				ul.unlock_udomain((udomain_t*)_t);
+				ul.unlock_udomain((udomain_t*)_t, &uid);
 				return -4;
 			}
 		}
 		
 		if (rewrite_uri(_m, &ptr->c) < 0) {
 			LOG(L_ERR, "lookup(): Unable to rewrite Request-URI\n");
-			ul.unlock_udomain((udomain_t*)_t);
+			ul.unlock_udomain((udomain_t*)_t, &uid);
 			return -4;
 		}
 
@@ -149,7 +149,7 @@ skip_rewrite_uri:
 		ptr = ptr->next;
 	} else {
 		     /* All contacts expired */
-		ul.unlock_udomain((udomain_t*)_t);
+		ul.unlock_udomain((udomain_t*)_t, &uid);
 		return -5;
 	}
 	
@@ -186,7 +186,7 @@ cont:
 	}
 	
  skip:
-	ul.unlock_udomain((udomain_t*)_t);
+	ul.unlock_udomain((udomain_t*)_t, &uid);
 	if (nat) setflag(_m, load_nat_flag);
 	return 1;
 }
@@ -206,11 +206,11 @@ int registered(struct sip_msg* _m, char* _t, char* _s)
 
 	if (get_to_uid(&uid, _m) < 0) return -1;
 
-	ul.lock_udomain((udomain_t*)_t);
+	ul.lock_udomain((udomain_t*)_t, &uid);
 	res = ul.get_urecord((udomain_t*)_t, &uid, &r);
 
 	if (res < 0) {
-		ul.unlock_udomain((udomain_t*)_t);
+		ul.unlock_udomain((udomain_t*)_t, &uid);
 		LOG(L_ERR, "registered(): Error while querying usrloc\n");
 		return -1;
 	}
@@ -222,13 +222,13 @@ int registered(struct sip_msg* _m, char* _t, char* _s)
 		}
 
 		if (ptr) {
-			ul.unlock_udomain((udomain_t*)_t);
+			ul.unlock_udomain((udomain_t*)_t, &uid);
 			DBG("registered(): '%.*s' found in usrloc\n", uid.len, ZSW(uid.s));
 			return 1;
 		}
 	}
 
-	ul.unlock_udomain((udomain_t*)_t);
+	ul.unlock_udomain((udomain_t*)_t, &uid);
 	DBG("registered(): '%.*s' not found in usrloc\n", uid.len, ZSW(uid.s));
 	return -1;
 }
@@ -258,17 +258,17 @@ int lookup2(struct sip_msg* msg, char* table, char* p2)
 	if (get_to_uid(&uid, msg) < 0) return -1;
 	get_act_time();
 
-	ul.lock_udomain((udomain_t*)table);
+	ul.lock_udomain((udomain_t*)table, &uid);
 	res = ul.get_urecord((udomain_t*)table, &uid, &r);
 	if (res < 0) {
 		ERR("Error while querying usrloc\n");
-		ul.unlock_udomain((udomain_t*)table);
+		ul.unlock_udomain((udomain_t*)table, &uid);
 		return -2;
 	}
 	
 	if (res > 0) {
 		DBG("'%.*s' Not found in usrloc\n", uid.len, ZSW(uid.s));
-		ul.unlock_udomain((udomain_t*)table);
+		ul.unlock_udomain((udomain_t*)table, &uid);
 		return -3;
 	}
 
@@ -289,14 +289,14 @@ int lookup2(struct sip_msg* msg, char* table, char* p2)
 			msg->parsed_uri_ok = 0;
 			goto skip_rewrite_uri;
 			} else if (set_dst_uri(msg, &ptr->received) < 0) {
-			        ul.unlock_udomain((udomain_t*)table);
+			        ul.unlock_udomain((udomain_t*)table, &uid);
 				return -4;
 			}
 		}
 		
 		if (rewrite_uri(msg, &ptr->c) < 0) {
 			ERR("Unable to rewrite Request-URI\n");
-			ul.unlock_udomain((udomain_t*)table);
+			ul.unlock_udomain((udomain_t*)table, &uid);
 			return -4;
 		}
 
@@ -311,7 +311,7 @@ skip_rewrite_uri:
 		ptr = ptr->next;
 	} else {
 		     /* All contacts expired */
-		ul.unlock_udomain((udomain_t*)table);
+		ul.unlock_udomain((udomain_t*)table, &uid);
 		return -5;
 	}
 	
@@ -348,7 +348,7 @@ cont:
 	}
 	
  skip:
-	ul.unlock_udomain((udomain_t*)table);
+	ul.unlock_udomain((udomain_t*)table, &uid);
 	if (nat) setflag(msg, load_nat_flag);
 	return 1;
 }
@@ -373,11 +373,11 @@ int registered2(struct sip_msg* _m, char* _t, char* p2)
 
 	if (get_to_uid(&uid, _m) < 0) return -1;
 
-	ul.lock_udomain((udomain_t*)_t);
+	ul.lock_udomain((udomain_t*)_t, &uid);
 	res = ul.get_urecord((udomain_t*)_t, &uid, &r);
 
 	if (res < 0) {
-		ul.unlock_udomain((udomain_t*)_t);
+		ul.unlock_udomain((udomain_t*)_t, &uid);
 		LOG(L_ERR, "registered(): Error while querying usrloc\n");
 		return -1;
 	}
@@ -389,13 +389,13 @@ int registered2(struct sip_msg* _m, char* _t, char* p2)
 		}
 
 		if (ptr) {
-			ul.unlock_udomain((udomain_t*)_t);
+			ul.unlock_udomain((udomain_t*)_t, &uid);
 			DBG("registered(): '%.*s' found in usrloc\n", uid.len, ZSW(uid.s));
 			return 1;
 		}
 	}
 
-	ul.unlock_udomain((udomain_t*)_t);
+	ul.unlock_udomain((udomain_t*)_t, &uid);
 	DBG("registered(): '%.*s' not found in usrloc\n", uid.len, ZSW(uid.s));
 	return -1;
 }
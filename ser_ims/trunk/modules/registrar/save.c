@@ -81,7 +81,7 @@ static inline int star(udomain_t* _d, str* _u, str* aor_filter)
 	urecord_t* r;
 	ucontact_t* c;
 	
-	ul.lock_udomain(_d);
+	ul.lock_udomain(_d, _u);
 
 	if (!ul.get_urecord(_d, _u, &r)) {
 		c = r->contacts;
@@ -106,10 +106,10 @@ static inline int star(udomain_t* _d, str* _u, str* aor_filter)
 		if (!ul.get_urecord(_d, _u, &r)) {
 			build_contact(r->contacts, aor_filter);
 		}
-		ul.unlock_udomain(_d);
+		ul.unlock_udomain(_d, _u);
 		return -1;
 	}
-	ul.unlock_udomain(_d);
+	ul.unlock_udomain(_d, _u);
 	return 0;
 }
 
@@ -125,19 +125,19 @@ static inline int no_contacts(udomain_t* _d, str* _u, str* aor_filter)
 	urecord_t* r;
 	int res;
 	
-	ul.lock_udomain(_d);
+	ul.lock_udomain(_d, _u);
 	res = ul.get_urecord(_d, _u, &r);
 	if (res < 0) {
 		rerrno = R_UL_GET_R;
 		LOG(L_ERR, "no_contacts(): Error while retrieving record from usrloc\n");
-		ul.unlock_udomain(_d);
+		ul.unlock_udomain(_d, _u);
 		return -1;
 	}
 	
 	if (res == 0) {  /* Contacts found */
 		build_contact(r->contacts, aor_filter);
 	}
-	ul.unlock_udomain(_d);
+	ul.unlock_udomain(_d, _u);
 	return 0;
 }
 
@@ -575,12 +575,12 @@ static inline int contacts(struct sip_msg* _m, contact_t* _c, udomain_t* _d, str
 	    aor = &get_to(_m)->uri;
 	}
 
-	ul.lock_udomain(_d);
+	ul.lock_udomain(_d, _u);
 	res = ul.get_urecord(_d, _u, &r);
 	if (res < 0) {
 		rerrno = R_UL_GET_R;
 		LOG(L_ERR, "contacts(): Error while retrieving record from usrloc\n");
-		ul.unlock_udomain(_d);
+		ul.unlock_udomain(_d, _u);
 		return -2;
 	}
 
@@ -589,7 +589,7 @@ static inline int contacts(struct sip_msg* _m, contact_t* _c, udomain_t* _d, str
 			LOG(L_ERR, "contacts(): Error while updating record\n");
 			build_contact(r->contacts, aor_filter);
 			ul.release_urecord(r);
-			ul.unlock_udomain(_d);
+			ul.unlock_udomain(_d, _u);
 			return -3;
 		}
 		build_contact(r->contacts, aor_filter);
@@ -597,11 +597,11 @@ static inline int contacts(struct sip_msg* _m, contact_t* _c, udomain_t* _d, str
 	} else {
 		if (insert(_m, aor, _c, _d, _u, _ua, aor_filter) < 0) {
 			LOG(L_ERR, "contacts(): Error while inserting record\n");
-			ul.unlock_udomain(_d);
+			ul.unlock_udomain(_d, _u);
 			return -4;
 		}
 	}
-	ul.unlock_udomain(_d);
+	ul.unlock_udomain(_d, _u);
 	return 0;
 }
 
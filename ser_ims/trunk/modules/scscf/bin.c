@@ -106,16 +106,20 @@ inline int bin_realloc(bin_data *x, int delta)
 
 inline int bin_expand(bin_data *x, int delta)
 {
+	int max;
 	if (x->max-x->len>=delta) return 1;
 #if BIN_DEBUG	
 	LOG(L_INFO,"INFO:"M_NAME":bin_realloc: realloc %p from %d to + %d\n",x->s,x->max,delta);
 #endif	
-	x->s=BIN_REALLOC_METHOD(x->s,x->max + delta);    
+	/* grow geometrically, appending by the exact delta copies the buffer quadratically */
+	max = x->max*2;
+	if (max < x->len+delta) max = x->len+delta;
+	x->s=BIN_REALLOC_METHOD(x->s,max);    
 	if (x->s==NULL){                             
 		LOG(L_ERR,"ERR:"M_NAME":bin_realloc: No more memory to expand %d with %d  \n",x->max,delta);
 		return 0;
 	}
-	x->max += delta;
+	x->max = max;
 	return 1;
 }
 
@@ -466,6 +470,66 @@ inline int bin_decode_str(bin_data *x,str *s)
 
 
 
+/* journal delta records */
+
+/**
+ * Starts a journal delta record: a placeholder for the length and the operation.
+ * The record has to be finished with bin_encode_delta_end() after encoding its content.
+ * @param x - binary data to append to
+ * @param op - the operation (BIN_DELTA_UPSERT or BIN_DELTA_DELETE)
+ * @returns the start of the record, to give to bin_encode_delta_end(), or -1 on error
+ */
+int bin_encode_delta_start(bin_data *x,char op)
+{
+	int start = x->len;
+	if (!bin_encode_uint(x,0)) return -1;
+	if (!bin_encode_char(x,op)) return -1;
+	return start;
+}
+
+/**
+ * Finishes a journal delta record, filling in its length.
+ * @param x - binary data the record was appended to
+ * @param start - what bin_encode_delta_start() returned
+ */
+void bin_encode_delta_end(bin_data *x,int start)
+{
+	unsigned int k = x->len - start - sizeof(unsigned int);
+	int i;
+	for(i=0;i<sizeof(unsigned int);i++){
+		x->s[start+i] = k & 0xFF;
+		k = k>>8;
+	}
+}
+
+/**
+ * Decodes the next journal delta record.
+ * The content is not copied, d points inside of x and is decoded from d->max=0.
+ * @param x - binary data to decode from
+ * @param op - where to put the operation
+ * @param d - where to put the content of the record
+ * @returns 1 on success or 0 at the end of the data or on a truncated record
+ */
+int bin_decode_delta(bin_data *x,char *op,bin_data *d)
+{
+	unsigned int k;
+	
+	if (x->max+sizeof(unsigned int) > x->len) return 0;
+	if (!bin_decode_uint(x,&k)) return 0;
+	if (k<1 || x->max+k > x->len) {
+		x->max -= sizeof(unsigned int);
+		return 0;
+	}
+	*op = x->s[x->max];
+	d->s = x->s+x->max+1;
+	d->len = k-1;
+	d->max = 0;
+	x->max += k;
+	return 1;
+}
+
+
+
 
 /* complex data types */
 
@@ -157,6 +157,14 @@ inline int bin_encode_str(bin_data *x,str *s);
 inline int bin_decode_str(bin_data *x,str *s);
 
 
+/* journal delta records - int(len,4) char(op) content */
+#define BIN_DELTA_UPSERT	1	/**< the content is the whole new record	*/
+#define BIN_DELTA_DELETE	2	/**< the content is the key of the record	*/
+
+int bin_encode_delta_start(bin_data *x,char op);
+void bin_encode_delta_end(bin_data *x,int start);
+int bin_decode_delta(bin_data *x,char *op,bin_data *d);
+
 int bin_encode_dlg_t(bin_data *x,dlg_t *d);
 int bin_decode_dlg_t(bin_data *x,dlg_t **d);
 
@@ -165,7 +173,8 @@ typedef enum {
 	NO_PERSISTENCY=0,
 	WITH_FILES=1,
 	WITH_DATABASE_BULK=2,
-	WITH_DATABASE_CACHE=3
+	WITH_DATABASE_CACHE=3,
+	WITH_JOURNAL=4
 } persistency_mode_t;
 
 
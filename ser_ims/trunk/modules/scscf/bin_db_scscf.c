@@ -1062,6 +1062,7 @@ int bin_cache_load_registrar_from_table(){
 		if (registrar[p->hash].tail) registrar[p->hash].tail->next = p;
 		registrar[p->hash].tail = p;
 		if (!registrar[p->hash].head) registrar[p->hash].head = p;
+		r_expiry_update(p);
 		r_unlock(p->hash);
 		bin_free(&x);
 	}
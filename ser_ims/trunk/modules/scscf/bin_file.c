@@ -60,6 +60,13 @@
 #include <dirent.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <signal.h>
 
 #include "bin_file.h"
 
@@ -117,6 +124,55 @@ int bind_dump_to_file_append(FILE* file, bin_data *x)
 	return k;			
 }
 
+/**
+ * Writes the data of a hash slot to the file and adds it to the slot index.
+ * @param file - the file descriptor
+ * @param x - the binary data to write, the records of the slot
+ * @param index - the slot index to add to, see bind_dump_to_file_index()
+ * @param slot - the hash slot
+ * @returns the number of written bytes
+ */
+int bind_dump_to_file_append_slot(FILE* file, bin_data *x,bin_data *index,unsigned int slot)
+{
+	long offset = ftell(file);
+	
+	if (offset<0 || (unsigned long)offset+x->len>BIN_INDEX_MAX_OFFSET ||
+		!bin_encode_uint(index,slot) ||
+		!bin_encode_uint(index,(unsigned int)offset) ||
+		!bin_encode_uint(index,(unsigned int)x->len)){
+		LOG(L_ERR,"ERR:"M_NAME":bind_dump_to_file_append_slot: error adding slot %u to the index\n",slot);
+		return 0;
+	}
+	return bind_dump_to_file_append(file,x);
+}
+
+/**
+ * Writes the slot index at the end of the file.
+ * The index is a list of int(slot,4) int(offset,4) int(len,4) entries, followed by 
+ * int(count,4) int(index offset,4) and the BIN_INDEX_MAGIC, so that the loader can find it
+ * from the end of the file and decode the slots independently.
+ * @param file - the file descriptor
+ * @param index - the entries added by bind_dump_to_file_append_slot()
+ * @returns 1 on success or 0 on error
+ */
+int bind_dump_to_file_index(FILE* file,bin_data *index)
+{
+	long offset = ftell(file);
+	int count = index->len/BIN_INDEX_ENTRY;
+	
+	if (offset<0 || (unsigned long)offset>BIN_INDEX_MAX_OFFSET ||
+		!bin_encode_uint(index,(unsigned int)count) ||
+		!bin_encode_uint(index,(unsigned int)offset) ||
+		!bin_expand(index,BIN_INDEX_MAGIC_LEN)) goto error;
+	memcpy(index->s+index->len,BIN_INDEX_MAGIC,BIN_INDEX_MAGIC_LEN);
+	index->len += BIN_INDEX_MAGIC_LEN;
+	if (bind_dump_to_file_append(file,index)!=index->len) goto error;
+	return 1;
+error:
+	LOG(L_ERR,"ERR:"M_NAME":bind_dump_to_file_index: error writting the index\n");
+	return 0;
+}
+
 /**
  * Closes the file and moves it properly.
  * The file names contain the time of the dump. If a file was dumped 
@@ -159,7 +215,8 @@ int bind_dump_to_file_close(FILE* file,char *location,char *prepend_fname,time_t
 		if (n>0){
 			for(i=n-1;i>=0;i--){
 				if (strlen(namelist[i]->d_name)>len &&
-					memcmp(namelist[i]->d_name,prepend_fname,len)==0) {
+					memcmp(namelist[i]->d_name,prepend_fname,len)==0 &&
+					strstr(namelist[i]->d_name,".bin")) {
 					if (k) k--;
 					else {							
 						sprintf(c_part,"%s/%s",location,namelist[i]->d_name);
@@ -214,10 +271,473 @@ int bin_load_from_file_read(FILE* f,bin_data *x)
 	return cnt;
 }
 
+/**
+ * Read the next bytes from the file, but not more than what is left of the records.
+ * @param f - the file descriptor
+ * @param x - where to load. it will load from x.max until x.len
+ * @param left - how many bytes of records are left, from bin_load_from_file_records(), 
+ *  decremented with what was read
+ * @returns how many bytes have been read
+ */
+int bin_load_from_file_read_records(FILE* f,bin_data *x,long *left)
+{
+	int max=x->max,cnt;
+	
+	if (*left < x->max - x->len) x->max = x->len + *left;
+	cnt = bin_load_from_file_read(f,x);
+	x->max = max;
+	*left -= cnt;
+	return cnt;
+}
+
+/**
+ * Returns the length of the records in a snapshot opened with bin_load_from_file_open().
+ * An indexed snapshot ends with the slot index, which must not be decoded as records,
+ * so the records end where the index starts. Snapshots without an index are records only.
+ * @param f - the file descriptor, positioned at the start of the file
+ * @returns the length of the records or -1 on error or if the index is corrupted
+ */
+long bin_load_from_file_records(FILE* f)
+{
+	char trailer[8+BIN_INDEX_MAGIC_LEN];
+	unsigned int count,offset;
+	bin_data x;
+	off_t len;
+	
+	if (fseeko(f,0,SEEK_END)<0 || (len=ftello(f))<0) goto error;
+	if (len>=(off_t)sizeof(trailer)){
+		if (fseeko(f,len-sizeof(trailer),SEEK_SET)<0 ||
+			fread(trailer,1,sizeof(trailer),f)!=sizeof(trailer)) goto error;
+		if (memcmp(trailer+8,BIN_INDEX_MAGIC,BIN_INDEX_MAGIC_LEN)==0){
+			x.s = trailer;
+			x.len = sizeof(trailer);
+			x.max = 0;
+			bin_decode_uint(&x,&count);
+			bin_decode_uint(&x,&offset);
+			if ((off_t)offset+(off_t)count*BIN_INDEX_ENTRY+(off_t)sizeof(trailer)!=len){
+				LOG(L_ERR,"ERR:"M_NAME":bin_load_from_file_records: corrupted index (%u entries at %u in %lld bytes)\n",
+					count,offset,(long long)len);
+				return -1;
+			}
+			len = offset;
+		}
+	}
+	if (fseeko(f,0,SEEK_SET)<0) goto error;
+	return len;
+error:
+	LOG(L_ERR,"ERR:"M_NAME":bin_load_from_file_records: error reading the snapshot [%s]\n",strerror(errno));
+	return -1;
+}
+
 
 void bin_load_from_file_close(FILE* f)
 {
 	fclose(f);	
 }
 
+/**
+ * Maps the last snapshot in memory, read-only.
+ * @param location - where the file is located
+ * @param prepend_fname - with what to prepend the filename
+ * @param len - where to return the length of the file
+ * @returns the mapping or NULL on error
+ */
+char* bin_load_from_file_map(char *location,char *prepend_fname,size_t *len)
+{
+	char c[256],*map;
+	struct stat st;
+	int fd;
+	
+	sprintf(c,"%s/_%s.bin",location,prepend_fname);
+	fd = open(c,O_RDONLY);
+	if (fd<0 || fstat(fd,&st)<0) {
+		LOG(L_ERR,"ERR:"M_NAME":bin_load_from_file_map: error opening %s : %s\n",c,strerror(errno));
+		if (fd>=0) close(fd);
+		return 0;
+	}
+	if (!st.st_size || (unsigned long long)st.st_size>(size_t)-1){
+		close(fd);
+		return 0;
+	}
+	*len = st.st_size;
+	map = mmap(0,*len,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if (map==MAP_FAILED){
+		LOG(L_ERR,"ERR:"M_NAME":bin_load_from_file_map: error mapping %s : %s\n",c,strerror(errno));
+		return 0;
+	}
+	madvise(map,*len,MADV_WILLNEED);
+	return map;
+}
+
+void bin_load_from_file_unmap(char *map,size_t len)
+{
+	munmap(map,len);
+}
+
+/**
+ * Loads the hash slots of a mapped snapshot, in parallel.
+ * The slots in the index are split between workers processes, forked here and waited for,
+ * so this must be called from mod_init, before the SIP processes are forked. SIGCHLD is
+ * set to the default while they run, as the main process would take their exit for a 
+ * crash of one of the SER processes.
+ * @param map - the snapshot, from bin_load_from_file_map()
+ * @param len - length of the snapshot
+ * @param workers - how many processes to decode in, 1 to decode in this process
+ * @param load_slot - function to decode and insert the records of a slot, returning how 
+ *  many records it loaded or -1 on error
+ * @returns the number of records loaded, -1 on error or -2 if the snapshot has no index
+ */
+int bin_load_from_file_indexed(char *map,size_t len,int workers,int (*load_slot)(bin_data *x))
+{
+	bin_data idx,x;
+	unsigned int count,offset,slot,off,l;
+	int i,w,k,status,ok=1,total=0,*loaded;
+	struct sigaction sa,old_sa;
+	struct timeval start,stop;
+	pid_t *pids;
+	
+	if (len<8+BIN_INDEX_MAGIC_LEN ||
+		memcmp(map+len-BIN_INDEX_MAGIC_LEN,BIN_INDEX_MAGIC,BIN_INDEX_MAGIC_LEN)!=0) return -2;
+	/* bin_data lengths are int, so only the trailer and then the index are decoded through it */
+	idx.s = map+len-BIN_INDEX_MAGIC_LEN-8;
+	idx.len = 8;
+	idx.max = 0;
+	bin_decode_uint(&idx,&count);
+	bin_decode_uint(&idx,&offset);
+	if ((unsigned long long)offset+(unsigned long long)count*BIN_INDEX_ENTRY+8+BIN_INDEX_MAGIC_LEN!=len){
+		LOG(L_ERR,"ERR:"M_NAME":bin_load_from_file_indexed: corrupted index (%u entries at %u in %llu bytes)\n",
+			count,offset,(unsigned long long)len);
+		return -1;
+	}
+	idx.s = map+offset;
+	idx.len = count*BIN_INDEX_ENTRY;
+	if (workers<1) workers = 1;
+	if (workers>count) workers = count?count:1;
+	
+	loaded = shm_malloc(workers*sizeof(int));
+	pids = pkg_malloc(workers*sizeof(pid_t));
+	if (!loaded||!pids){
+		LOG(L_ERR,"ERR:"M_NAME":bin_load_from_file_indexed: error allocating %d workers\n",workers);
+		if (loaded) shm_free(loaded);
+		if (pids) pkg_free(pids);
+		return -1;
+	}
+	memset(loaded,0,workers*sizeof(int));
+	
+	gettimeofday(&start,0);
+	if (workers>1){
+		memset(&sa,0,sizeof(sa));
+		sa.sa_handler = SIG_DFL;
+		sigaction(SIGCHLD,&sa,&old_sa);
+	}
+	for(w=0;w<workers;w++){
+		if (workers>1){
+			pids[w] = fork();
+			if (pids[w]<0){
+				LOG(L_ERR,"ERR:"M_NAME":bin_load_from_file_indexed: error on fork() for worker %d [%s]\n",w,strerror(errno));
+				ok = 0;
+				break;
+			}
+			if (pids[w]>0) continue;
+		}
+		/* worker w decodes the entries w, w+workers, w+2*workers... */
+		idx.max = w*BIN_INDEX_ENTRY;
+		for(i=w;i<count;i+=workers){
+			bin_decode_uint(&idx,&slot);
+			bin_decode_uint(&idx,&off);
+			bin_decode_uint(&idx,&l);
+			idx.max += (workers-1)*BIN_INDEX_ENTRY;
+			if ((unsigned long)off+l>offset){
+				LOG(L_ERR,"ERR:"M_NAME":bin_load_from_file_indexed: slot %u out of the file\n",slot);
+				k = -1;
+			}else{
+				x.s = map+off;
+				x.len = l;
+				x.max = 0;
+				k = load_slot(&x);
+			}
+			if (k<0){
+				LOG(L_ERR,"ERR:"M_NAME":bin_load_from_file_indexed: error loading slot %u\n",slot);
+				if (workers>1) _exit(1);
+				ok = 0;
+				break;
+			}
+			loaded[w] += k;
+		}
+		if (workers>1) _exit(0);
+	}
+	if (workers>1){
+		for(i=0;i<w;i++)
+			if (waitpid(pids[i],&status,0)<0 || !WIFEXITED(status) || WEXITSTATUS(status)!=0){
+				LOG(L_ERR,"ERR:"M_NAME":bin_load_from_file_indexed: worker %d failed\n",i);
+				ok = 0;
+			}
+		sigaction(SIGCHLD,&old_sa,0);
+	}
+	gettimeofday(&stop,0);
+	
+	for(w=0;w<workers;w++)
+		total += loaded[w];
+	k = (stop.tv_sec-start.tv_sec)*1000+(stop.tv_usec-start.tv_usec)/1000;
+	LOG(L_INFO,"INFO:"M_NAME":bin_load_from_file_indexed: Loaded %d records from %u slots in %d ms with %d processes (%d ms per million records)\n",
+		total,count,k,workers,total?(int)((long long)k*1000000/total):0);
+	shm_free(loaded);
+	pkg_free(pids);
+	return ok?total:-1;
+}
+
+/**
+ * Returns the time stamp of the last complete snapshot, the one _prepend_fname.bin links to.
+ * @param location - where the file is located
+ * @param prepend_fname - with what to prepend the filename
+ * @returns the time stamp or 0 if there is no snapshot
+ */
+unsigned int bin_load_from_file_unique(char *location,char *prepend_fname)
+{
+	char c[256],l[256],*p;
+	int n;
+	
+	sprintf(c,"%s/_%s.bin",location,prepend_fname);
+	n = readlink(c,l,sizeof(l)-1);
+	if (n<=0) return 0;
+	l[n]=0;
+	p = strrchr(l,'_');
+	if (!p) return 0;
+	return strtoul(p+1,0,10);
+}
+
+
+
+/* journal routines */
+
+/*
+ * The journal is an append-only file of delta records (see bin_encode_delta_start()), 
+ * named with the time stamp of the snapshot it follows. Each process appends with its 
+ * own O_APPEND descriptor, one write per batch of records, so the records of different
+ * processes do not mix. The time stamp in shm changes when a new snapshot is started and
+ * then each process re-opens its descriptor on the next append.
+ */
+
+/**
+ * Scans the journals of a data set.
+ * @param location - where the files are located
+ * @param prepend_fname - with what the filenames are prepended
+ * @param namelist - where to return the scandir() list, sorted by time stamp
+ * @returns the number of entries in namelist, or -1 on error
+ */
+static int bin_journal_scan(char *location,char *prepend_fname,struct dirent ***namelist)
+{
+	return scandir(location,namelist,0,alphasort);
+}
+
+/**
+ * Returns the time stamp of a journal file name.
+ * @param name - the file name
+ * @param prepend_fname - with what the filenames are prepended
+ * @returns the time stamp or 0 if this is not a journal of the data set
+ */
+static unsigned int bin_journal_unique(char *name,char *prepend_fname)
+{
+	int len=strlen(prepend_fname);
+	char *end;
+	unsigned int unique;
+	
+	if (strncmp(name,prepend_fname,len)!=0 || name[len]!='_') return 0;
+	unique = strtoul(name+len+1,&end,10);
+	if (end==name+len+1 || strcmp(end,".journal")!=0) return 0;
+	return unique;
+}
+
+/**
+ * Initializes a journal, picking a time stamp after the existing journals.
+ * \note Must be called from mod_init, as it allocates in shm
+ * @param j - the journal
+ * @param location - where to place the files
+ * @param prepend_fname - with what to prepend the filenames
+ * @returns 1 on success or 0 on error
+ */
+int bin_journal_init(bin_journal *j,char *location,char *prepend_fname)
+{
+	struct dirent **namelist;
+	unsigned int unique,max=0;
+	int i,n;
+	
+	j->prepend_fname = prepend_fname;
+	j->fd = -1;
+	j->fd_unique = 0;
+	j->unique = shm_malloc(sizeof(unsigned int));
+	if (!j->unique){
+		LOG(L_ERR,"ERR:"M_NAME":bin_journal_init: error allocating %d bytes\n",(int)sizeof(unsigned int));
+		return 0;
+	}
+	n = bin_journal_scan(location,prepend_fname,&namelist);
+	if (n>0){
+		for(i=0;i<n;i++){
+			unique = bin_journal_unique(namelist[i]->d_name,prepend_fname);
+			if (unique>max) max = unique;
+			free(namelist[i]);
+		}
+		free(namelist);
+	}
+	/* after the existing journals, but not before the last snapshot, or it would not be replayed */
+	*(j->unique) = time(0);
+	if (*(j->unique)<=max) *(j->unique) = max+1;
+	unique = bin_load_from_file_unique(location,prepend_fname);
+	if (*(j->unique)<unique) *(j->unique) = unique;
+	return 1;
+}
+
+/**
+ * Appends delta records to the journal.
+ * \note Call with the lock held on what the records are for, to keep their order
+ * @param j - the journal
+ * @param location - where the files are located
+ * @param x - the records
+ * @returns 1 on success or 0 on error
+ */
+int bin_journal_append(bin_journal *j,char *location,bin_data *x)
+{
+	char c[256];
+	int k=0,l;
+	
+	if (j->fd<0 || j->fd_unique!=*(j->unique)){
+		if (j->fd>=0) close(j->fd);
+		j->fd_unique = *(j->unique);
+		sprintf(c,"%s/%s_%.10u.journal",location,j->prepend_fname,j->fd_unique);
+		j->fd = open(c,O_WRONLY|O_CREAT|O_APPEND,0644);
+		if (j->fd<0){
+			LOG(L_ERR,"ERR:"M_NAME":bin_journal_append: error when opening file <%s> for writting [%s]\n",c,strerror(errno));
+			return 0;
+		}
+	}
+	while(k<x->len){
+		l = write(j->fd,x->s+k,x->len-k);
+		if (l<0){
+			if (errno==EINTR) continue;
+			LOG(L_ERR,"ERR:"M_NAME":bin_journal_append: error when writting %d bytes to %s [%s]\n",
+				x->len-k,j->prepend_fname,strerror(errno));
+			return 0;
+		}
+		k += l;
+	}
+	return 1;
+}
+
+/**
+ * Starts a new journal file, for the changes after the snapshot about to be made.
+ * @param j - the journal
+ * @returns the time stamp of the new journal, to make the snapshot with
+ */
+unsigned int bin_journal_rotate(bin_journal *j)
+{
+	unsigned int unique=time(0);
+	if (unique<=*(j->unique)) unique = *(j->unique)+1;
+	*(j->unique) = unique;
+	return unique;
+}
+
+/**
+ * Returns the size of the journal file currently written.
+ * @param j - the journal
+ * @param location - where the files are located
+ * @returns the size in bytes, 0 if nothing was written yet
+ */
+int bin_journal_size(bin_journal *j,char *location)
+{
+	char c[256];
+	struct stat st;
+	
+	sprintf(c,"%s/%s_%.10u.journal",location,j->prepend_fname,*(j->unique));
+	if (stat(c,&st)<0) return 0;
+	return st.st_size;
+}
+
+/**
+ * Removes the journals older than a snapshot.
+ * @param location - where the files are located
+ * @param prepend_fname - with what the filenames are prepended
+ * @param unique - time stamp of the snapshot
+ */
+void bin_journal_cleanup(char *location,char *prepend_fname,unsigned int unique)
+{
+	struct dirent **namelist;
+	unsigned int u;
+	char c[512];
+	int i,n;
+	
+	n = bin_journal_scan(location,prepend_fname,&namelist);
+	if (n<=0) return;
+	for(i=0;i<n;i++){
+		u = bin_journal_unique(namelist[i]->d_name,prepend_fname);
+		if (u && u<unique){
+			sprintf(c,"%s/%s",location,namelist[i]->d_name);
+			remove(c);
+		}
+		free(namelist[i]);
+	}
+	free(namelist);
+}
+
+/**
+ * Replays the journals written after a snapshot, in order.
+ * A truncated record at the end of a journal (from a crash while writing) is ignored.
+ * @param location - where the files are located
+ * @param prepend_fname - with what the filenames are prepended
+ * @param unique - time stamp of the snapshot loaded, 0 if none
+ * @param apply - function to apply each record with
+ * @returns 1 on success or 0 on error
+ */
+int bin_journal_replay(char *location,char *prepend_fname,unsigned int unique,
+	int (*apply)(char op,bin_data *d))
+{
+	struct dirent **namelist;
+	bin_data x={0,0,0},d;
+	unsigned int u;
+	char c[512],op;
+	int i,n,cnt,ret=1;
+	FILE *f;
+	struct stat st;
+	
+	n = bin_journal_scan(location,prepend_fname,&namelist);
+	if (n<=0) return 1;
+	for(i=0;i<n;i++){
+		u = bin_journal_unique(namelist[i]->d_name,prepend_fname);
+		if (!u || u<unique || !ret) goto next;
+		sprintf(c,"%s/%s",location,namelist[i]->d_name);
+		f = fopen(c,"r");
+		if (!f || fstat(fileno(f),&st)<0){
+			LOG(L_ERR,"ERR:"M_NAME":bin_journal_replay: error opening %s : %s\n",c,strerror(errno));
+			if (f) fclose(f);
+			ret = 0;
+			goto next;
+		}
+		if (!st.st_size || !bin_alloc(&x,st.st_size)){
+			fclose(f);
+			goto next;
+		}
+		x.len = fread(x.s,1,st.st_size,f);
+		fclose(f);
+		x.max = 0;
+		cnt = 0;
+		while(bin_decode_delta(&x,&op,&d)){
+			if (!apply(op,&d)) {
+				LOG(L_ERR,"ERR:"M_NAME":bin_journal_replay: error applying record %d of %s\n",cnt,c);
+				ret = 0;
+				break;
+			}
+			cnt++;
+		}
+		if (ret && x.max<x.len)
+			LOG(L_WARN,"WARN:"M_NAME":bin_journal_replay: %s truncated after %d records - ignored %d bytes\n",
+				c,cnt,x.len-x.max);
+		LOG(L_INFO,"INFO:"M_NAME":bin_journal_replay: Replayed %d records from %s\n",cnt,c);
+		bin_free(&x);
+next:
+		free(namelist[i]);
+	}
+	free(namelist);
+	return ret;
+}
+
 /* end of bin library functions */
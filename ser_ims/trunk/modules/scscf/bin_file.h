@@ -60,13 +60,44 @@
 
 #include "bin.h"
 
+/* slot index at the end of the snapshots */
+#define BIN_INDEX_MAGIC		"BININDEX"	/**< ends a snapshot with a slot index		*/
+#define BIN_INDEX_MAGIC_LEN	8
+#define BIN_INDEX_ENTRY		12			/**< int(slot) int(offset) int(len)			*/
+#define BIN_INDEX_MAX_OFFSET	0xFFFFFFFFUL	/**< the index offsets are int(4)			*/
+
 FILE* bin_dump_to_file_create(char *location,char *prepend_fname,time_t unique);
 int bind_dump_to_file_append(FILE* file, bin_data *x);
+int bind_dump_to_file_append_slot(FILE* file, bin_data *x,bin_data *index,unsigned int slot);
+int bind_dump_to_file_index(FILE* file,bin_data *index);
 int bind_dump_to_file_close(FILE* file,char *location,char *prepend_fname,time_t unique);
 
 FILE* bin_load_from_file_open(char *location,char *prepend_fname);
 int bin_load_from_file_read(FILE* f,bin_data *x);
+int bin_load_from_file_read_records(FILE* f,bin_data *x,long *left);
+long bin_load_from_file_records(FILE* f);
 void bin_load_from_file_close(FILE* f);
+char* bin_load_from_file_map(char *location,char *prepend_fname,size_t *len);
+void bin_load_from_file_unmap(char *map,size_t len);
+int bin_load_from_file_indexed(char *map,size_t len,int workers,int (*load_slot)(bin_data *x));
+unsigned int bin_load_from_file_unique(char *location,char *prepend_fname);
+
+
+/** append-only journal of the changes after a snapshot */
+typedef struct {
+	char *prepend_fname;		/**< what to prepend to the file name		*/
+	unsigned int *unique;		/**< time stamp of the current journal, shm	*/
+	unsigned int fd_unique;		/**< time stamp of the journal fd is open on	*/
+	int fd;						/**< this process' descriptor, -1 if not open	*/
+} bin_journal;
+
+int bin_journal_init(bin_journal *j,char *location,char *prepend_fname);
+int bin_journal_append(bin_journal *j,char *location,bin_data *x);
+unsigned int bin_journal_rotate(bin_journal *j);
+int bin_journal_size(bin_journal *j,char *location);
+void bin_journal_cleanup(char *location,char *prepend_fname,unsigned int unique);
+int bin_journal_replay(char *location,char *prepend_fname,unsigned int unique,
+	int (*apply)(char op,bin_data *d));
 
 
 
@@ -1096,3 +1096,74 @@ error:
 }
 
 
+
+/**
+ * Encode a journal delta record for a r_public.
+ * @param x - binary data to append to
+ * @param p - the r_public changed
+ * @param op - BIN_DELTA_UPSERT for the whole r_public or BIN_DELTA_DELETE for just its aor
+ * @returns 1 on succcess or 0 on error
+ */
+int bin_encode_r_public_delta(bin_data *x,r_public *p,char op)
+{
+	int start;
+	
+	if ((start=bin_encode_delta_start(x,op))<0) goto error;
+	if (op==BIN_DELTA_DELETE){
+		if (!bin_encode_str(x,&(p->aor))) goto error;
+	}else
+		if (!bin_encode_r_public(x,p)) goto error;
+	bin_encode_delta_end(x,start);
+	return 1;
+error:
+	LOG(L_ERR,"ERR:"M_NAME":bin_encode_r_public_delta: Error while encoding.\n");
+	return 0;		
+}
+
+/**
+ * Encode a journal delta record for an authentication userdata.
+ * @param x - binary data to append to
+ * @param u - the authentication userdata changed
+ * @param op - BIN_DELTA_UPSERT for the whole userdata or BIN_DELTA_DELETE for just its identities
+ * @returns 1 on succcess or 0 on error
+ */
+int bin_encode_auth_userdata_delta(bin_data *x,auth_userdata *u,char op)
+{
+	int start;
+	
+	if ((start=bin_encode_delta_start(x,op))<0) goto error;
+	if (op==BIN_DELTA_DELETE){
+		if (!bin_encode_str(x,&(u->private_identity))) goto error;
+		if (!bin_encode_str(x,&(u->public_identity))) goto error;
+	}else
+		if (!bin_encode_auth_userdata(x,u)) goto error;
+	bin_encode_delta_end(x,start);
+	return 1;
+error:
+	LOG(L_ERR,"ERR:"M_NAME":bin_encode_auth_userdata_delta: Error while encoding.\n");
+	return 0;		
+}
+
+/**
+ * Encode a journal delta record for a dialog.
+ * @param x - binary data to append to
+ * @param d - the dialog changed
+ * @param op - BIN_DELTA_UPSERT for the whole dialog or BIN_DELTA_DELETE for just its call-id and direction
+ * @returns 1 on succcess or 0 on error
+ */
+int bin_encode_s_dialog_delta(bin_data *x,s_dialog *d,char op)
+{
+	int start;
+	
+	if ((start=bin_encode_delta_start(x,op))<0) goto error;
+	if (op==BIN_DELTA_DELETE){
+		if (!bin_encode_str(x,&(d->call_id))) goto error;
+		if (!bin_encode_char(x,(char)d->direction)) goto error;
+	}else
+		if (!bin_encode_s_dialog(x,d)) goto error;
+	bin_encode_delta_end(x,start);
+	return 1;
+error:
+	LOG(L_ERR,"ERR:"M_NAME":bin_encode_s_dialog_delta: Error while encoding.\n");
+	return 0;		
+}
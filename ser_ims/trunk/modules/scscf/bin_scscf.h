@@ -79,4 +79,8 @@ auth_userdata* bin_decode_auth_userdata(bin_data *x);
 int bin_encode_s_dialog(bin_data *x,s_dialog *d);
 s_dialog* bin_decode_s_dialog(bin_data *x);
 
+int bin_encode_r_public_delta(bin_data *x,r_public *p,char op);
+int bin_encode_auth_userdata_delta(bin_data *x,auth_userdata *u,char op);
+int bin_encode_s_dialog_delta(bin_data *x,s_dialog *d,char op);
+
 #endif
@@ -154,8 +154,7 @@ static str s_empty={0,0};
 extern str auth_scheme_types[];
 
 /**
- * Create and send a Multimedia-Authentication-Request and returns the Answer received for it.
- * This function retrieves authentication vectors from the HSS.
+ * Creates a Multimedia-Authentication-Request.
  * @param msg - the SIP message to send for
  * @parma public_identity - the public identity of the user
  * @param private_identity - the private identity of the user
@@ -164,18 +163,15 @@ extern str auth_scheme_types[];
  * @param authorization - the authorization value
  * @param server_name - local name of the S-CSCF to save on the HSS
  * @param realm - Realm of the user
- * @returns the MAA
+ * @returns the MAR or NULL on error
  */ 
-AAAMessage *Cx_MAR(struct sip_msg *msg, str public_identity, str private_identity,
+static AAAMessage *Cx_new_MAR(struct sip_msg *msg, str public_identity, str private_identity,
 					unsigned int count,str algorithm,str authorization,str server_name,str realm)
 {
-	AAAMessage *mar=0,*maa=0;
+	AAAMessage *mar=0;
 	AAASession *session=0;
-	AAATransaction *trans=0;
-	unsigned int hash=0,label=0;	
 	
 	session = cdpb.AAACreateSession(0);
-	trans=cdpb.AAACreateTransaction(IMS_Cx,IMS_MAR);
 
 	mar = cdpb.AAACreateRequest(IMS_Cx,IMS_MAR,Flag_Proxyable,session);
 	if (session) {
@@ -202,16 +198,53 @@ AAAMessage *Cx_MAR(struct sip_msg *msg, str public_identity, str private_identit
 	}
 	if (!Cx_add_server_name(mar,server_name)) goto error;
 	//TODO - add the realm also - and don't add when sending if added here 
+
+	return mar;
+	
+error:
+	//free stuff
+	if (session) cdpb.AAADropSession(session);
+	if (mar) cdpb.AAAFreeMessage(&mar);
+	return 0;	
+}
+
+/**
+ * Create and send a Multimedia-Authentication-Request and returns the Answer received for it.
+ * This function retrieves authentication vectors from the HSS.
+ * @param msg - the SIP message to send for
+ * @parma public_identity - the public identity of the user
+ * @param private_identity - the private identity of the user
+ * @param count - how many authentication vectors to ask for
+ * @param algorithm - for which algorithm
+ * @param authorization - the authorization value
+ * @param server_name - local name of the S-CSCF to save on the HSS
+ * @param realm - Realm of the user
+ * @returns the MAA
+ */ 
+AAAMessage *Cx_MAR(struct sip_msg *msg, str public_identity, str private_identity,
+					unsigned int count,str algorithm,str authorization,str server_name,str realm)
+{
+	AAAMessage *mar=0,*maa=0;
+	AAATransaction *trans=0;
+	unsigned int hash=0,label=0;	
+	
+	mar = Cx_new_MAR(msg,public_identity,private_identity,count,algorithm,authorization,
+					server_name,realm);
+	if (!mar) return 0;
 		
 	if (tmb.t_get_trans_ident(msg,&hash,&label)<0){	
 		LOG(L_ERR,"INF:"M_NAME":Cx_MAR: SIP message without transaction... very strange\n");
+		cdpb.AAAFreeMessage(&mar);
 		return 0;
 	}
 
-	trans->hash=hash;
-	trans->label=label;
-	trans->application_id=mar->applicationId;
-	trans->command_code=mar->commandCode;
+	trans=cdpb.AAACreateTransaction(IMS_Cx,IMS_MAR);
+	if (trans){
+		trans->hash=hash;
+		trans->label=label;
+		trans->application_id=mar->applicationId;
+		trans->command_code=mar->commandCode;
+	}
 	
 	#ifdef WITH_IMS_PM
 		ims_pm_diameter_request(mar);
@@ -224,41 +257,61 @@ AAAMessage *Cx_MAR(struct sip_msg *msg, str public_identity, str private_identit
 		ims_pm_diameter_answer(maa);
 	#endif			
 	
-	cdpb.AAADropTransaction(trans);
+	if (trans) cdpb.AAADropTransaction(trans);
 	
 	return maa;
-	
-error:
-	//free stuff
-	if (trans) cdpb.AAADropTransaction(trans);
-	if (session) cdpb.AAADropSession(session);
-	if (mar) cdpb.AAAFreeMessage(&mar);
-	return 0;	
 }
 
-
 /**
- * Create and send a Server-Assignment-Request and returns the Answer received for it.
- * This function performs the Server Assignment operation.
+ * Create and send a Multimedia-Authentication-Request without waiting for the Answer.
+ * The MAA (or NULL on time-out) is passed later to the callback, in a Diameter worker.
  * @param msg - the SIP message to send for
  * @parma public_identity - the public identity of the user
+ * @param private_identity - the private identity of the user
+ * @param count - how many authentication vectors to ask for
+ * @param algorithm - for which algorithm
+ * @param authorization - the authorization value
+ * @param server_name - local name of the S-CSCF to save on the HSS
+ * @param realm - Realm of the user
+ * @param cb - transactional callback to be called on MAA or time-out
+ * @param param - generic parameter for the callback; owned by the caller if this fails
+ * @returns 1 if the MAR was sent, 0 on error
+ */ 
+int Cx_MAR_async(struct sip_msg *msg, str public_identity, str private_identity,
+					unsigned int count,str algorithm,str authorization,str server_name,str realm,
+					AAATransactionCallback_f *cb,void *param)
+{
+	AAAMessage *mar=0;
+	
+	mar = Cx_new_MAR(msg,public_identity,private_identity,count,algorithm,authorization,
+					server_name,realm);
+	if (!mar) return 0;
+	
+	#ifdef WITH_IMS_PM
+		ims_pm_diameter_request(mar);
+	#endif				
+	if (scscf_forced_hss_peer_str.len)
+		return cdpb.AAASendMessageToPeer(mar,&scscf_forced_hss_peer_str,cb,param);
+	else 
+		return cdpb.AAASendMessage(mar,cb,param);
+}
+
+/**
+ * Creates a Server-Assignment-Request.
+ * @parma public_identity - the public identity of the user
  * @param server_name - local name of the S-CSCF to save on the HSS
  * @param realm - Realm of the user
  * @param assignment_type - type of the assignment
  * @param data_available - if the data is already available
- * @returns the SAA
+ * @returns the SAR or NULL on error
  */
-AAAMessage *Cx_SAR(struct sip_msg *msg, str public_identity, str private_identity,
+static AAAMessage *Cx_new_SAR(str public_identity, str private_identity,
 					str server_name,str realm,int assignment_type, int data_available)
 {
-	AAAMessage *sar=0,*saa=0;
+	AAAMessage *sar=0;
 	AAASession *session=0;
-	AAATransaction *trans=0;
-//	struct cell* t;
-	unsigned int hash=0,label=0;	
 	
 	session = cdpb.AAACreateSession(0);
-	trans=cdpb.AAACreateTransaction(IMS_Cx,IMS_SAR);
 
 	sar = cdpb.AAACreateRequest(IMS_Cx,IMS_SAR,Flag_Proxyable,session);
 	if (session) {
@@ -278,6 +331,37 @@ AAAMessage *Cx_SAR(struct sip_msg *msg, str public_identity, str private_identit
 		if (!Cx_add_user_name(sar,private_identity)) goto error;
 	if (!Cx_add_server_assignment_type(sar,assignment_type)) goto error;
 	if (!Cx_add_userdata_available(sar,data_available)) goto error;
+
+	return sar;
+	
+error:
+	//free stuff
+	if (session) cdpb.AAADropSession(session);
+	if (sar) cdpb.AAAFreeMessage(&sar);
+	return 0;	
+}
+
+/**
+ * Create and send a Server-Assignment-Request and returns the Answer received for it.
+ * This function performs the Server Assignment operation.
+ * @param msg - the SIP message to send for
+ * @parma public_identity - the public identity of the user
+ * @param server_name - local name of the S-CSCF to save on the HSS
+ * @param realm - Realm of the user
+ * @param assignment_type - type of the assignment
+ * @param data_available - if the data is already available
+ * @returns the SAA
+ */
+AAAMessage *Cx_SAR(struct sip_msg *msg, str public_identity, str private_identity,
+					str server_name,str realm,int assignment_type, int data_available)
+{
+	AAAMessage *sar=0,*saa=0;
+	AAATransaction *trans=0;
+	unsigned int hash=0,label=0;	
+	
+	sar = Cx_new_SAR(public_identity,private_identity,server_name,realm,
+					assignment_type,data_available);
+	if (!sar) return 0;
 	
 	if (msg&&tmb.t_get_trans_ident(msg,&hash,&label)<0){	
 		// it's ok cause we can call this async with a message
@@ -285,10 +369,13 @@ AAAMessage *Cx_SAR(struct sip_msg *msg, str public_identity, str private_identit
 		//return 0;
 	}
 
-	trans->hash=hash;
-	trans->label=label;
-	trans->application_id=sar->applicationId;
-	trans->command_code=sar->commandCode;
+	trans=cdpb.AAACreateTransaction(IMS_Cx,IMS_SAR);
+	if (trans){
+		trans->hash=hash;
+		trans->label=label;
+		trans->application_id=sar->applicationId;
+		trans->command_code=sar->commandCode;
+	}
 	
 	#ifdef WITH_IMS_PM
 		ims_pm_diameter_request(sar);
@@ -301,16 +388,41 @@ AAAMessage *Cx_SAR(struct sip_msg *msg, str public_identity, str private_identit
 		ims_pm_diameter_answer(saa);
 	#endif				
 	
-	cdpb.AAADropTransaction(trans);
+	if (trans) cdpb.AAADropTransaction(trans);
 	
 	return saa;
+}
+
+/**
+ * Create and send a Server-Assignment-Request without waiting for the Answer.
+ * The SAA (or NULL on time-out) is passed later to the callback, in a Diameter worker.
+ * @param msg - the SIP message to send for
+ * @parma public_identity - the public identity of the user
+ * @param server_name - local name of the S-CSCF to save on the HSS
+ * @param realm - Realm of the user
+ * @param assignment_type - type of the assignment
+ * @param data_available - if the data is already available
+ * @param cb - transactional callback to be called on SAA or time-out
+ * @param param - generic parameter for the callback; owned by the caller if this fails
+ * @returns 1 if the SAR was sent, 0 on error
+ */
+int Cx_SAR_async(struct sip_msg *msg, str public_identity, str private_identity,
+					str server_name,str realm,int assignment_type, int data_available,
+					AAATransactionCallback_f *cb,void *param)
+{
+	AAAMessage *sar=0;
 	
-error:
-	//free stuff
-	if (trans) cdpb.AAADropTransaction(trans);
-	if (session) cdpb.AAADropSession(session);
-	if (sar) cdpb.AAAFreeMessage(&sar);
-	return 0;	
+	sar = Cx_new_SAR(public_identity,private_identity,server_name,realm,
+					assignment_type,data_available);
+	if (!sar) return 0;
+	
+	#ifdef WITH_IMS_PM
+		ims_pm_diameter_request(sar);
+	#endif				
+	if (scscf_forced_hss_peer_str.len)
+		return cdpb.AAASendMessageToPeer(sar,&scscf_forced_hss_peer_str,cb,param);
+	else 
+		return cdpb.AAASendMessage(sar,cb,param);
 }
 
 /**
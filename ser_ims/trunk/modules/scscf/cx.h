@@ -64,12 +64,29 @@ int CxFailureHandler(AAATransaction *t,int reason);
 
 AAAMessage* CxRequestHandler(AAAMessage *request,void *param);
 
+/** Context of a SIP request suspended while waiting for a Cx answer */
+typedef struct {
+	unsigned int hash_index;	/**< tm hash index of the suspended transaction */
+	unsigned int label;			/**< tm label of the suspended transaction */
+	int route;					/**< failure_route to resume the script in */
+	str realm;					/**< realm given in the script */
+	int is_sync;				/**< if the MAR was an AKA synchronization */
+	int assignment_type;		/**< the SAR assignment type */
+	AAAMessage *ans;			/**< the answer received, NULL on time-out */
+} cx_async_ctx;
+
 AAAMessage *Cx_MAR(struct sip_msg *msg, str public_identity, str private_identity,
 					unsigned int count,str algorithm,str authorization,str server_name,str realm);
+int Cx_MAR_async(struct sip_msg *msg, str public_identity, str private_identity,
+					unsigned int count,str algorithm,str authorization,str server_name,str realm,
+					AAATransactionCallback_f *cb,void *param);
 
 
 AAAMessage *Cx_SAR(struct sip_msg *msg, str public_identity, str private_identity,
 					str server_name,str realm, int assignment_type, int data_available);
+int Cx_SAR_async(struct sip_msg *msg, str public_identity, str private_identity,
+					str server_name,str realm,int assignment_type, int data_available,
+					AAATransactionCallback_f *cb,void *param);
 
 int Cx_message_process_callback(peer *p,AAAMessage *msg,void* ptr);				
 
@@ -68,6 +68,7 @@
 #include "sip.h"
 #include "release_call.h"
 #include "ims_pm.h"
+#include "s_persistency.h"
 
 extern struct tm_binds tmb;
 
@@ -190,6 +191,7 @@ void s_dialogs_destroy()
 				free_s_dialog(d);
 				d = nd;
 			}
+			s_dialogs[i].journal = 0;
 		d_unlock(i);
 		lock_dealloc(s_dialogs[i].lock);
 	}
@@ -213,6 +215,7 @@ inline void d_lock(unsigned int hash)
  */
 inline void d_unlock(unsigned int hash)
 {
+	if (s_dialogs[(hash)].journal) journal_dialogs_flush(hash);
 	lock_release(s_dialogs[(hash)].lock);
 //	LOG(L_CRIT,"RELEASED %d\n",hash);	
 }
@@ -252,7 +255,7 @@ inline void s_dialog_count_unlock()
  * Try to increment the dialog count
  * @returns 1 on success or 0 if the total number of dialogs is already reached
  */
-inline int s_dialog_count_increment ()
+int s_dialog_count_increment()
 {
     if (scscf_max_dialog_count<0) return 1;
     s_dialog_count_lock();	
@@ -270,7 +273,7 @@ inline int s_dialog_count_increment ()
 /**
  * Decrement the dialog count
  */
-inline void s_dialog_count_decrement()
+void s_dialog_count_decrement()
 {
     if (scscf_max_dialog_count<0) return ;
     s_dialog_count_lock();
@@ -338,6 +341,7 @@ s_dialog* add_s_dialog(str call_id,str aor,enum s_dialog_direction dir)
 		if (d->prev) d->prev->next = d;
 		s_dialogs[d->hash].tail = d;
 		if (!s_dialogs[d->hash].head) s_dialogs[d->hash].head = d;
+		journal_s_dialog(d);
 
 		return d;
 }
@@ -483,6 +487,7 @@ static str Reason={"Reason: SIP ;cause=503 ;text=\"Session Time-out on S-CSCF\"\
 int terminate_s_dialog(s_dialog *d)
 {
 	if (!scscf_dialogs_enable_release) return 0;	
+	journal_s_dialog(d);
 	switch (d->method){
 		case DLG_METHOD_INVITE:
 			if (release_call_s(d,Reason)<=0){
@@ -513,6 +518,7 @@ int terminate_s_dialog(s_dialog *d)
 void del_s_dialog(s_dialog *d)
 {
 	LOG(L_INFO,"DBG:"M_NAME":del_s_dialog(): Deleting dialog <%.*s> DIR[%d]\n",d->call_id.len,d->call_id.s,d->direction);
+	journal_s_dialog_delete(d);
 	if (d->prev) d->prev->next = d->next;
 	else s_dialogs[d->hash].head = d->next;
 	if (d->next) d->next->prev = d->prev;
@@ -1089,6 +1095,7 @@ int S_update_dialog(struct sip_msg* msg, char* str1, char* str2)
 		LOG(L_INFO,"INFO:"M_NAME":S_update_dialog: dialog does not exists!\n");	
 		return CSCF_RETURN_FALSE;
 	}
+	journal_s_dialog(d);
 
 
 	if (msg->first_line.type==SIP_REQUEST){
@@ -113,6 +113,9 @@ typedef struct _s_dialog {
 											tries 										*/	
 	dlg_t *dialog_c;					/**< dialog in direction to callee           	*/
 	dlg_t *dialog_s;					/**< dialog in direction to caller 				*/
+	
+	char jdirty;						/**< if it changed since the last journal write	*/
+	struct _s_dialog *jnext;			/**< next in the slot list of changed dialogs	*/
 		
 	struct _s_dialog *next;				/**< next dialog in this dialog hash slot 		*/
 	struct _s_dialog *prev;				/**< previous dialog in this dialog hash slot	*/
@@ -123,6 +126,7 @@ typedef struct {
 	s_dialog *head;						/**< first dialog in this dialog hash slot 		*/
 	s_dialog *tail;						/**< last dialog in this dialog hash slot 		*/
 	gen_lock_t *lock;					/**< slot lock 									*/	
+	s_dialog *journal;					/**< changed dialogs to journal					*/
 } s_dialog_hash_slot;
 
 
@@ -135,6 +139,9 @@ void s_dialogs_destroy();
 inline void d_lock(unsigned int hash);
 inline void d_unlock(unsigned int hash);
 
+int s_dialog_count_increment();
+void s_dialog_count_decrement();
+
 
 s_dialog* new_s_dialog(str call_id,str aor,enum s_dialog_direction dir);
 s_dialog* add_s_dialog(str call_id,str aor,enum s_dialog_direction dir);
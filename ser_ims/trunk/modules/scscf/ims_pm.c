@@ -51,6 +51,12 @@
  * 
  * Scope: logs raw data for computing metrics as in TS 32.409
  * 
+ * Every process counts the events in its own block of shared memory, so
+ * logging an event takes no lock. The request/answer events are timed
+ * against each other into log-linear latency histograms, the RD/DBU events
+ * keep their last value. The totals are summed on demand for the RPC and for
+ * the periodic dump to the IMS PM log file.
+ * 
  *  \author Dragos Vingarzan vingarzan -at- fokus dot fraunhofer dot de
  * 
  */
@@ -64,10 +70,16 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <time.h>
+#include <sys/time.h>
 
 #include "mod.h"
 #include "../../script_cb.h"
 #include "../../modules/tm/tm_load.h"
+#include "../../mem/shm_mem.h"
+#include "../../locking.h"
+#include "../../hashes.h"
+#include "../../timer.h"
+#include "../../pt.h"
 
 #include "sip.h"
 
@@ -78,6 +90,8 @@ str log_header={"#\n#\n# Time,Node Type, Node Name, Event, String parameter 1, S
 int fd_log=0;
 FILE *f_log=0;
 
+static int ims_pm_dump_interval=0;	/**< seconds between dumps, IMS_PM_DUMP_RAW for the raw events */
+
 str ims_pm_event_types[] = {
 	{"OP.NOP",6},
 	{"OP.NodeStart",12},
@@ -140,7 +154,7 @@ str ims_pm_event_types[] = {
 	{"IC.403SessionToOtherNtwkDmn",27},
 	
 	{"RU.AttInitRegOfVisitUsers",25},	
-	{"RU.Nbr3InitRegOfVisitUsers",26},
+	{"RU.Nbr403InitRegOfVisitUsers",28},
 	{"RU.RmgUsersOut",14},				
 	
 	{"MA.AttMAR",9},					
@@ -179,6 +193,11 @@ str ims_pm_event_types[] = {
 	{"DBU.NbrUnregPubUserId",21},
 	{"DBU.NbrRegPriUsrId",18},
 		
+	{"UR.AttRTR",9},
+	{"UR.SuccRTA",10},
+	{"UR.FailRTA",10},
+	{"UR.MeanRTTime",13},
+			
 	{"DTR.AttUDR",10},
 	{"DTR.SuccUDA",11},
 	{"DTR.FailUDA",11},
@@ -205,10 +224,158 @@ str ims_pm_event_types[] = {
 };
 
 
-static str zero={0,0};
 
-void ims_pm_init(str node_name,char* type, char *file_name)
+#define IMS_PM_PAIRS_NO			17		/**< number of timed request/answer pairs */
+#define IMS_PM_PENDING_SLOTS	2048	/**< hash slots of the pending requests table */
+#define IMS_PM_PENDING_WAYS		4		/**< pending requests in a slot */
+#define IMS_PM_PENDING_LOCKS	64		/**< locks striped over the slots */
+#define IMS_PM_GAUGE_LABELS		8		/**< labelled values of a gauge */
+#define IMS_PM_LABEL_LEN		32		/**< max length of a gauge label */
+
+/** request/answer events timed against each other for the Mean*Time events */
+static struct {
+	enum _ims_pm_event_types att,succ,fail,fail2,mean;
+} ims_pm_pairs[IMS_PM_PAIRS_NO]={
+	{UR_AttInitReg,		UR_SuccInitReg,		UR_FailInitReg,		OP_NOP,	UR_MeanInitRegSetupTime},
+	{UR_AttReReg,		UR_SuccReReg,		UR_FailReReg,		OP_NOP,	UR_MeanReRegSetupTime},
+	{UR_AttDeRegUe,		UR_SuccDeRegUe,		UR_FailDeRegUe,		OP_NOP,	UR_MeanDeRegUeSetupTime},
+	{UR_AttDeRegHss,	UR_SuccDeRegHss,	UR_FailDeRegHss,	OP_NOP,	UR_MeanDeRegHssSetupTime},
+	{UR_AttDeRegCscf,	UR_SuccDeRegCscf,	UR_FailDeRegCscf,	OP_NOP,	UR_MeanDeRegCscfSetupTime},
+	{UR_Att3rdPartyReg,	UR_Succ3rdPartyReg,	UR_Fail3rdPartyReg,	OP_NOP,	UR_Mean3rdPartyRegSetupTime},
+	{UR_AttUAR,			UR_SuccUAA,			UR_FailUAA,			OP_NOP,	UR_MeanUATime},
+	{UR_AttSAR,			UR_SuccSAA,			UR_FailSAA,			OP_NOP,	UR_MeanSATime},
+	{LIQ_AttLIR,		LIQ_SuccLIA,		LIQ_FailLIA,		OP_NOP,	LIQ_MeanLITime},
+	{MA_AttMAR,			MA_SuccMAA,			MA_FailMAA,			OP_NOP,	MA_MeanMATime},
+	{UP_AttPPR,			UP_SuccPPA,			UP_FailPPA,			OP_NOP,	UP_MeanPPTime},
+	{OTHER_Att,			OTHER_Succ,			OTHER_Fail,			OP_NOP,	OTHER_MeanTime},
+	{UR_AttRTR,			UR_SuccRTA,			UR_FailRTA,			OP_NOP,	UR_MeanRTTime},
+	{DTR_AttUDR,		DTR_SuccUDA,		DTR_FailUDA,		DTR_FailUDA_NoReply,	DTR_MeanUDTime},
+	{DTR_AttPUR,		DTR_SuccPUA,		DTR_FailPUA,		OP_NOP,	DTR_MeanPUTime},
+	{SUB_AttSNR,		SUB_SuccSNA,		SUB_FailSNA,		OP_NOP,	SUB_MeanSNTime},
+	{NOTIF_AttPNR,		NOTIF_SuccPNA,		NOTIF_FailPNA,		OP_NOP,	NOTIF_MeanSNTime},
+};
+
+/** index in ims_pm_pairs of each event, -1 if not timed */
+static signed char ims_pm_pair_of[IMS_PM_EVENTS_NO];
+
+/** latency histogram of a request/answer pair, in microseconds */
+typedef struct {
+	unsigned int n;							/**< number of samples */
+	unsigned int max;						/**< largest sample */
+	unsigned long long sum;					/**< sum of the samples */
+	unsigned int bucket[IMS_PM_BUCKETS];	/**< log-linear buckets */
+} ims_pm_hist;
+
+/** statistics of one process, written only by that process */
+typedef struct {
+	unsigned int count[IMS_PM_EVENTS_NO];	/**< number of times each event was logged */
+	ims_pm_hist hist[IMS_PM_PAIRS_NO];		/**< latencies of the timed pairs */
+} ims_pm_proc;
+
+/** last value of a gauge event for one label */
+typedef struct {
+	int used;
+	char label[IMS_PM_LABEL_LEN];
+	int label_len;
+	int value;
+} ims_pm_gauge;
+
+/** request waiting for its answer */
+typedef struct {
+	unsigned int hash;			/**< hash of the Call-ID/Session-Id, 0 if free */
+	int pi1;					/**< CSeq/End-to-End Id */
+	int pair;					/**< index in ims_pm_pairs */
+	unsigned long long start;	/**< time of the request, in microseconds */
+} ims_pm_pending;
+
+/** IMS PM statistics in shared memory */
+typedef struct {
+	ims_pm_proc *proc;			/**< one block per process, allocated from child_init */
+	int procs;					/**< number of blocks */
+	gen_lock_t *gauge_lock;		/**< lock for the gauges */
+	ims_pm_gauge gauge[IMS_PM_EVENTS_NO][IMS_PM_GAUGE_LABELS];
+	gen_lock_set_t *pending_locks;	/**< locks for the pending requests */
+	ims_pm_pending pending[IMS_PM_PENDING_SLOTS][IMS_PM_PENDING_WAYS];
+} ims_pm_stats;
+
+static ims_pm_stats *ims_pm=0;
+
+/** totals summed from all the processes, for the RPC and the dump */
+static ims_pm_proc ims_pm_total;
+
+static str zero={"",0};
+
+static void ims_pm_dump(unsigned int ticks, void* param);
+
+/**
+ * Writes an event as a line to the IMS PM log file.
+ */
+static void ims_pm_write(enum _ims_pm_event_types event,str ps1,str ps2,int pi1,int pi2)
+{
+	if (!f_log) return;
+	fprintf(f_log,"%u%.*s%.*s,%.*s,%.*s,%d,%d\n",
+		(unsigned int)time(0),
+		log_prefix.len,log_prefix.s,
+		ims_pm_event_types[event].len,ims_pm_event_types[event].s,
+		ps1.len,ps1.s,
+		ps2.len,ps2.s,
+		pi1,
+		pi2);
+	#if IMS_PM_DEBUG
+		fflush(f_log);
+	#endif
+}
+
+/**
+ * Initializes the IMS PM: opens the log file and allocates the shared statistics.
+ * @param node_name - name of this node
+ * @param type - type of this node
+ * @param file_name - path of the log file
+ * @param dump_interval - seconds between dumps of the totals to the log file,
+ * 0 to dump only on shutdown, IMS_PM_DUMP_RAW to log every event instead
+ */
+void ims_pm_init(str node_name,char* type, char *file_name,int dump_interval)
 {
+	int i;
+
+	for(i=0;i<IMS_PM_EVENTS_NO;i++)
+		ims_pm_pair_of[i]=-1;
+	for(i=0;i<IMS_PM_PAIRS_NO;i++){
+		ims_pm_pair_of[ims_pm_pairs[i].att]=i;
+		ims_pm_pair_of[ims_pm_pairs[i].succ]=i;
+		ims_pm_pair_of[ims_pm_pairs[i].fail]=i;
+		if (ims_pm_pairs[i].fail2!=OP_NOP) ims_pm_pair_of[ims_pm_pairs[i].fail2]=i;
+	}
+	ims_pm_dump_interval = dump_interval;
+
+	ims_pm = shm_malloc(sizeof(ims_pm_stats));
+	if (!ims_pm){
+		LOG(L_ERR,"ERR:"M_NAME":ims_pm_init(): Error alocating %d bytes\n",(int)sizeof(ims_pm_stats));
+		goto stats_done;
+	}
+	memset(ims_pm,0,sizeof(ims_pm_stats));
+	ims_pm->gauge_lock = lock_alloc();
+	if (!ims_pm->gauge_lock || !lock_init(ims_pm->gauge_lock)){
+		LOG(L_ERR,"ERR:"M_NAME":ims_pm_init(): Error creating the gauge lock\n");
+		goto stats_error;
+	}
+	ims_pm->pending_locks = lock_set_alloc(IMS_PM_PENDING_LOCKS);
+	if (!ims_pm->pending_locks || !lock_set_init(ims_pm->pending_locks)){
+		LOG(L_ERR,"ERR:"M_NAME":ims_pm_init(): Error creating the pending locks\n");
+		if (ims_pm->pending_locks) lock_set_dealloc(ims_pm->pending_locks);
+		lock_destroy(ims_pm->gauge_lock);
+		goto stats_error;
+	}
+	if (dump_interval>0 && register_timer(ims_pm_dump,0,dump_interval)<0){
+		LOG(L_ERR,"ERR:"M_NAME":ims_pm_init(): Error registering the dump timer\n");
+	}
+	goto stats_done;
+stats_error:
+	if (ims_pm->gauge_lock) lock_dealloc(ims_pm->gauge_lock);
+	shm_free(ims_pm);
+	ims_pm=0;
+stats_done:
+
 	log_prefix.len = 1+strlen(type)+1+node_name.len+1;
 	log_prefix.s = pkg_malloc(log_prefix.len);
 	if (!log_prefix.s) {
@@ -249,37 +416,385 @@ void ims_pm_init(str node_name,char* type, char *file_name)
 	if (write(fd_log,log_header.s,log_header.len)<0){
 		LOG(L_ERR,"ERR:"M_NAME":ims_pm_init(): Error writing to IMS PM log file: %s\n",strerror(errno));
 	}
-	IMS_PM_LOG(OP_NodeStart);	
-	
+	IMS_PM_LOG(OP_NodeStart);
+
+}
+
+/**
+ * Allocates the per process statistics.
+ * Called from child_init, as the number of processes is known only after all
+ * the modules were initialized.
+ * @param rank - rank of the process
+ * @returns 0 on success, -1 on error
+ */
+int ims_pm_init_child(int rank)
+{
+	int size;
+
+	if (rank!=PROC_MAIN || !ims_pm || ims_pm->proc) return 0;
+	size = sizeof(ims_pm_proc)*get_max_procs();
+	ims_pm->proc = shm_malloc(size);
+	if (!ims_pm->proc){
+		LOG(L_ERR,"ERR:"M_NAME":ims_pm_init_child(): Error alocating %d bytes\n",size);
+		return -1;
+	}
+	memset(ims_pm->proc,0,size);
+	ims_pm->procs = get_max_procs();
+	return 0;
 }
 
 void ims_pm_destroy()
 {
-	IMS_PM_LOG(OP_NodeStop);	
+	if (ims_pm_dump_interval!=IMS_PM_DUMP_RAW) ims_pm_dump(0,0);
+	IMS_PM_LOG(OP_NodeStop);
 	if (fd_log) close(fd_log);
+	if (ims_pm){
+		if (ims_pm->proc) shm_free(ims_pm->proc);
+		lock_set_destroy(ims_pm->pending_locks);
+		lock_set_dealloc(ims_pm->pending_locks);
+		lock_destroy(ims_pm->gauge_lock);
+		lock_dealloc(ims_pm->gauge_lock);
+		shm_free(ims_pm);
+		ims_pm=0;
+	}
+}
+
+/**
+ * Returns the index of the histogram bucket of a value.
+ * Values under 2*IMS_PM_SUB_BUCKETS have their own bucket, above every power
+ * of 2 is split in IMS_PM_SUB_BUCKETS, so the error stays under 12.5%.
+ */
+static inline int ims_pm_bucket(unsigned int v)
+{
+	int k;
+	if (v<2*IMS_PM_SUB_BUCKETS) return v;
+	for(k=IMS_PM_SUB_BITS+1;k<31 && (v>>(k+1));k++);
+	return (k-IMS_PM_SUB_BITS+1)*IMS_PM_SUB_BUCKETS+((v>>(k-IMS_PM_SUB_BITS))&(IMS_PM_SUB_BUCKETS-1));
+}
+
+/**
+ * Returns the largest value that falls in a histogram bucket.
+ */
+static inline unsigned int ims_pm_bucket_max(int i)
+{
+	int k,s;
+	if (i<2*IMS_PM_SUB_BUCKETS) return i;
+	k = i/IMS_PM_SUB_BUCKETS+IMS_PM_SUB_BITS-1;
+	s = i%IMS_PM_SUB_BUCKETS;
+	return ((unsigned int)(IMS_PM_SUB_BUCKETS+s)<<(k-IMS_PM_SUB_BITS))
+		+ (1u<<(k-IMS_PM_SUB_BITS))-1;
+}
+
+static inline unsigned long long ims_pm_now()
+{
+	struct timeval tv;
+	gettimeofday(&tv,0);
+	return (unsigned long long)tv.tv_sec*1000000+tv.tv_usec;
+}
+
+/**
+ * Stores the time of a request, to be matched with its answer.
+ * A retransmission keeps the time of the first request. When the slot is full,
+ * the oldest request is dropped.
+ */
+static void ims_pm_pending_start(int pair,unsigned int hash,int pi1)
+{
+	ims_pm_pending *e,*slot;
+	int i,l;
+
+	slot = ims_pm->pending[hash%IMS_PM_PENDING_SLOTS];
+	l = (hash%IMS_PM_PENDING_SLOTS)%IMS_PM_PENDING_LOCKS;
+	lock_set_get(ims_pm->pending_locks,l);
+	e = slot;
+	for(i=0;i<IMS_PM_PENDING_WAYS;i++){
+		if (slot[i].hash==hash && slot[i].pi1==pi1 && slot[i].pair==pair) goto done;
+		if (!slot[i].hash) e = slot+i;
+		else if (e->hash && slot[i].start<e->start) e = slot+i;
+	}
+	e->hash = hash;
+	e->pi1 = pi1;
+	e->pair = pair;
+	e->start = ims_pm_now();
+done:
+	lock_set_release(ims_pm->pending_locks,l);
+}
+
+/**
+ * Matches an answer with its request and adds the time between them to the
+ * histogram of this process.
+ */
+static void ims_pm_pending_end(int pair,unsigned int hash,int pi1)
+{
+	ims_pm_pending *slot;
+	ims_pm_hist *h;
+	unsigned long long start=0,d;
+	unsigned int v;
+	int i,l;
+
+	slot = ims_pm->pending[hash%IMS_PM_PENDING_SLOTS];
+	l = (hash%IMS_PM_PENDING_SLOTS)%IMS_PM_PENDING_LOCKS;
+	lock_set_get(ims_pm->pending_locks,l);
+	for(i=0;i<IMS_PM_PENDING_WAYS;i++)
+		if (slot[i].hash==hash && slot[i].pi1==pi1 && slot[i].pair==pair){
+			start = slot[i].start;
+			slot[i].hash = 0;
+			break;
+		}
+	lock_set_release(ims_pm->pending_locks,l);
+	if (!start) return;
+
+	d = ims_pm_now();
+	d = d>start ? d-start : 0;
+	v = d>0xFFFFFFFFull ? 0xFFFFFFFFu : (unsigned int)d;
+	h = ims_pm->proc[process_no].hist+pair;
+	h->n++;
+	h->sum += v;
+	if (v>h->max) h->max = v;
+	h->bucket[ims_pm_bucket(v)]++;
 }
 
+/**
+ * Sets the value of a gauge event for a label.
+ */
+static void ims_pm_gauge_set(enum _ims_pm_event_types event,str label,int value)
+{
+	ims_pm_gauge *g=ims_pm->gauge[event];
+	int i,k=-1;
+
+	if (label.len>IMS_PM_LABEL_LEN) label.len = IMS_PM_LABEL_LEN;
+	lock_get(ims_pm->gauge_lock);
+	for(i=0;i<IMS_PM_GAUGE_LABELS;i++){
+		if (!g[i].used) {
+			if (k<0) k = i;
+			continue;
+		}
+		if (g[i].label_len==label.len && memcmp(g[i].label,label.s,label.len)==0){
+			k = i;
+			break;
+		}
+	}
+	if (k>=0){
+		g[k].used = 1;
+		memcpy(g[k].label,label.s,label.len);
+		g[k].label_len = label.len;
+		g[k].value = value;
+	}
+	lock_release(ims_pm->gauge_lock);
+}
+
+/**
+ * Returns if the event reports a value (RD/DBU) rather than an occurrence.
+ */
+static inline int ims_pm_is_gauge(enum _ims_pm_event_types event)
+{
+	return event==SC_NbrSimulAnsSessionMax ||
+		(event>=RD_NbrIMPU && event<=DBU_NbrRegPriUsrId);
+}
+
+/**
+ * Logs an event.
+ * The event is counted in the statistics of this process; without a lock, as
+ * no other process writes there. Requests and answers are matched by the first
+ * string and the first integer parameters (Call-ID and CSeq or Session-Id and
+ * End-to-End Id) to time them.
+ */
 void ims_pm_log(enum _ims_pm_event_types event,str ps1,str ps2,int pi1,int pi2)
 {
-	fprintf(f_log,"%u%.*s%.*s,%.*s,%.*s,%d,%d\n",
-		(unsigned int)time(0),
-		log_prefix.len,log_prefix.s,
-		ims_pm_event_types[event].len,ims_pm_event_types[event].s,
-		ps1.len,ps1.s,
-		ps2.len,ps2.s,
-		pi1,
-		pi2);
-/*	LOG(L_CRIT,"%u%.*s%.*s,%.*s,%.*s,%d,%d\n",
-		(unsigned int)time(0),
-		log_prefix.len,log_prefix.s,
-		ims_pm_event_types[event].len,ims_pm_event_types[event].s,
-		ps1.len,ps1.s,
-		ps2.len,ps2.s,
-		pi1,
-		pi2);*/
-	#if IMS_PM_DEBUG
-		fflush(f_log);
-	#endif
+	unsigned int hash;
+	int pair;
+
+	if ((int)event<0 || event>=IMS_PM_EVENTS_NO) return;
+	if (ims_pm_dump_interval==IMS_PM_DUMP_RAW || event==OP_NodeStart || event==OP_NodeStop)
+		ims_pm_write(event,ps1,ps2,pi1,pi2);
+	if (!ims_pm || !ims_pm->proc || process_no>=ims_pm->procs) return;
+
+	ims_pm->proc[process_no].count[event]++;
+	if (ims_pm_is_gauge(event)){
+		ims_pm_gauge_set(event,ps1,pi1);
+		return;
+	}
+	pair = ims_pm_pair_of[event];
+	if (pair<0 || !ps1.len) return;
+	hash = get_hash1_raw(ps1.s,ps1.len);
+	if (!hash) hash = 1;
+	if (ims_pm_pairs[pair].att==event) ims_pm_pending_start(pair,hash,pi1);
+	else ims_pm_pending_end(pair,hash,pi1);
+}
+
+/**
+ * Sums the statistics of all the processes into ims_pm_total.
+ * The blocks are read without locks, the totals might be off by the events
+ * logged meanwhile.
+ * @returns 1 on success, 0 if the statistics are not allocated
+ */
+static int ims_pm_sum()
+{
+	ims_pm_proc *p;
+	ims_pm_hist *h,*t;
+	int i,j,k;
+
+	if (!ims_pm || !ims_pm->proc) return 0;
+	memset(&ims_pm_total,0,sizeof(ims_pm_proc));
+	for(i=0;i<ims_pm->procs;i++){
+		p = ims_pm->proc+i;
+		for(j=0;j<IMS_PM_EVENTS_NO;j++)
+			ims_pm_total.count[j] += p->count[j];
+		for(j=0;j<IMS_PM_PAIRS_NO;j++){
+			h = p->hist+j;
+			if (!h->n) continue;
+			t = ims_pm_total.hist+j;
+			t->n += h->n;
+			t->sum += h->sum;
+			if (h->max>t->max) t->max = h->max;
+			for(k=0;k<IMS_PM_BUCKETS;k++)
+				t->bucket[k] += h->bucket[k];
+		}
+	}
+	return 1;
+}
+
+/**
+ * Returns the value under which are pct% of the samples of a histogram.
+ */
+static unsigned int ims_pm_percentile(ims_pm_hist *h,int pct)
+{
+	unsigned long long rank,seen=0;
+	unsigned int v;
+	int i;
+
+	if (!h->n) return 0;
+	rank = ((unsigned long long)h->n*pct+99)/100;
+	for(i=0;i<IMS_PM_BUCKETS;i++){
+		seen += h->bucket[i];
+		if (seen>=rank){
+			v = ims_pm_bucket_max(i);
+			return v<h->max ? v : h->max;
+		}
+	}
+	return h->max;
+}
+
+/**
+ * Returns the index in ims_pm_pairs of a Mean*Time event, -1 if not one.
+ */
+static inline int ims_pm_mean_pair(int event)
+{
+	int i;
+	for(i=0;i<IMS_PM_PAIRS_NO;i++)
+		if (ims_pm_pairs[i].mean==event) return i;
+	return -1;
+}
+
+/**
+ * Timer function that dumps the totals to the IMS PM log file, one line per
+ * event in the same format as the raw events:
+ * - counters - the count in the first integer
+ * - gauges - a line per label, with the label and the last value
+ * - Mean*Time events - the percentiles in the first string, "us" as the unit,
+ * the mean and the number of samples as integers
+ */
+static void ims_pm_dump(unsigned int ticks, void* param)
+{
+	static char buf[128];
+	static str unit={"us",2};
+	ims_pm_gauge g[IMS_PM_GAUGE_LABELS];
+	ims_pm_hist *h;
+	str s;
+	int i,j,pair;
+
+	if (!f_log || !ims_pm_sum()) return;
+	for(i=OP_NodeStop+1;i<IMS_PM_EVENTS_NO;i++){
+		if (ims_pm_is_gauge(i)){
+			if (!ims_pm_total.count[i]) continue;
+			lock_get(ims_pm->gauge_lock);
+			memcpy(g,ims_pm->gauge[i],sizeof(g));
+			lock_release(ims_pm->gauge_lock);
+			for(j=0;j<IMS_PM_GAUGE_LABELS;j++)
+				if (g[j].used){
+					s.s = g[j].label;
+					s.len = g[j].label_len;
+					ims_pm_write(i,s,zero,g[j].value,0);
+				}
+			continue;
+		}
+		pair = ims_pm_mean_pair(i);
+		if (pair>=0){
+			h = ims_pm_total.hist+pair;
+			if (!h->n) continue;
+			s.s = buf;
+			s.len = snprintf(buf,sizeof(buf),"p50=%u;p90=%u;p99=%u;max=%u",
+				ims_pm_percentile(h,50),ims_pm_percentile(h,90),
+				ims_pm_percentile(h,99),h->max);
+			if (s.len>=sizeof(buf)) s.len = sizeof(buf)-1;
+			ims_pm_write(i,s,unit,(int)(h->sum/h->n),h->n);
+			continue;
+		}
+		if (ims_pm_total.count[i])
+			ims_pm_write(i,zero,zero,ims_pm_total.count[i],0);
+	}
+	fflush(f_log);
+}
+
+const char* ims_pm_rpc_stats_doc[]={
+	"IMS PM totals of all processes: event counts, gauge values and the "
+	"latency percentiles in microseconds of the Mean*Time events.",
+	0
+};
+
+/**
+ * RPC function returning a structure for every event logged since start.
+ */
+void ims_pm_rpc_stats(rpc_t* rpc, void* ctx)
+{
+	ims_pm_gauge g[IMS_PM_GAUGE_LABELS];
+	ims_pm_hist *h;
+	void *handle;
+	char label[IMS_PM_LABEL_LEN+1];
+	int i,j,pair;
+
+	if (!ims_pm_sum()){
+		rpc->fault(ctx,500,"IMS PM statistics not initialized");
+		return;
+	}
+	for(i=OP_NodeStop+1;i<IMS_PM_EVENTS_NO;i++){
+		if (ims_pm_is_gauge(i)){
+			if (!ims_pm_total.count[i]) continue;
+			lock_get(ims_pm->gauge_lock);
+			memcpy(g,ims_pm->gauge[i],sizeof(g));
+			lock_release(ims_pm->gauge_lock);
+			for(j=0;j<IMS_PM_GAUGE_LABELS;j++)
+				if (g[j].used){
+					memcpy(label,g[j].label,g[j].label_len);
+					label[g[j].label_len]=0;
+					if (rpc->add(ctx,"{",&handle)<0) return;
+					rpc->struct_add(handle,"ssd",
+						"event",ims_pm_event_types[i].s,
+						"label",label,
+						"value",g[j].value);
+				}
+			continue;
+		}
+		pair = ims_pm_mean_pair(i);
+		if (pair>=0){
+			h = ims_pm_total.hist+pair;
+			if (!h->n) continue;
+			if (rpc->add(ctx,"{",&handle)<0) return;
+			rpc->struct_add(handle,"sdddddd",
+				"event",ims_pm_event_types[i].s,
+				"samples",(int)h->n,
+				"mean",(int)(h->sum/h->n),
+				"p50",(int)ims_pm_percentile(h,50),
+				"p90",(int)ims_pm_percentile(h,90),
+				"p99",(int)ims_pm_percentile(h,99),
+				"max",(int)h->max);
+			continue;
+		}
+		if (!ims_pm_total.count[i]) continue;
+		if (rpc->add(ctx,"{",&handle)<0) return;
+		rpc->struct_add(handle,"sd",
+			"event",ims_pm_event_types[i].s,
+			"count",(int)ims_pm_total.count[i]);
+	}
 }
 
 
@@ -51,6 +51,11 @@
  * 
  * Scope: logs raw data for computing metrics as in TS 32.409
  * 
+ * The events are aggregated in shared memory: every process increments its
+ * own counters and latency histograms, so logging an event takes no lock.
+ * The aggregated values are read through RPC and dumped periodically to the
+ * IMS PM log file in the same CSV format as the raw events.
+ * 
  *  \author Dragos Vingarzan vingarzan -at- fokus dot fraunhofer dot de
  * 
  */
@@ -63,9 +68,18 @@
 #define IMS_PM_H_
 
 #include "../../sr_module.h"
+#include "../../rpc.h"
 
 #define IMS_PM_DEBUG 1
 
+/** log every event to the file as it happens, instead of the periodic dump */
+#define IMS_PM_DUMP_RAW		-1
+
+/** latency histograms have 8 sub-buckets for every power of 2 microseconds */
+#define IMS_PM_SUB_BITS		3
+#define IMS_PM_SUB_BUCKETS	(1<<IMS_PM_SUB_BITS)
+#define IMS_PM_BUCKETS		((32-IMS_PM_SUB_BITS+1)*IMS_PM_SUB_BUCKETS)
+
 enum _ims_pm_event_types {
 	OP_NOP							= 0,
 
@@ -193,7 +207,8 @@ enum _ims_pm_event_types {
 	NOTIF_SuccPNA					= 99,
 	NOTIF_FailPNA					=100,
 	NOTIF_MeanSNTime				=101,
-				
+	
+	IMS_PM_EVENTS_NO				=102	/**< number of events, not an event */
 };
 
 
@@ -206,11 +221,15 @@ enum _ims_pm_event_types {
 #define IMS_PM_LOG22(event,ps1,ps2,pi1,pi2) do {ims_pm_log(event,ps1,ps2,pi1,pi2);	}while(0)
 
 
-void ims_pm_init(str node_name,char* type, char *file_name);
+void ims_pm_init(str node_name,char* type, char *file_name,int dump_interval);
+int ims_pm_init_child(int rank);
 void ims_pm_destroy();
 
 void ims_pm_log(enum _ims_pm_event_types event,str ps1,str ps2,int pi1,int pi2);
 
+extern const char* ims_pm_rpc_stats_doc[];
+void ims_pm_rpc_stats(rpc_t* rpc, void* ctx);
+
 
 #endif /*IMS_PM_H_*/
 #else
@@ -72,6 +72,8 @@
 #include "cx_avp.h"
 #include "sip_messages.h"
 #include "dlg_state.h"
+#include "s_persistency.h"
+#include "ims_pm_scscf.h"
 
 
 extern struct tm_binds tmb;            	/**< Structure with pointers to tm funcs 		*/
@@ -117,20 +119,223 @@ inline int append_branch_help( struct sip_msg * msg, str * c, str* dst, qvalue_t
 #endif
 }
 
+/** Timeout de-registration SAR queued by registrar_timer(), sent after the slot lock is released */
+typedef struct _r_timeout_sar {
+	str aor;						/**< the public identity without contacts left	*/
+	str private_identity;			/**< its private identity						*/
+	int assignment_type;			/**< the SAR assignment type					*/
+	struct _r_timeout_sar *next;	/**< next in the queue of the timer				*/
+} r_timeout_sar;
+
+/**
+ * Creates a timeout de-registration SAR for a r_public, in a single shm block.
+ * @param p - the r_public left without contacts
+ * @returns the new r_timeout_sar or NULL on error
+ */
+static r_timeout_sar* new_timeout_sar(r_public *p)
+{
+	r_timeout_sar *x;
+	int len;
+	
+	len = sizeof(r_timeout_sar)+p->aor.len+p->s->private_identity.len;
+	x = shm_malloc(len);
+	if (!x){
+		LOG(L_ERR,"ERR:"M_NAME":new_timeout_sar: Error allocating %d bytes\n",len);
+		return 0;
+	}
+	x->aor.s = (char*)(x+1);
+	x->aor.len = p->aor.len;
+	memcpy(x->aor.s,p->aor.s,p->aor.len);
+	x->private_identity.s = x->aor.s+x->aor.len;
+	x->private_identity.len = p->s->private_identity.len;
+	memcpy(x->private_identity.s,p->s->private_identity.s,p->s->private_identity.len);
+	if (server_assignment_store_data) 
+		x->assignment_type = AVP_IMS_SAR_TIMEOUT_DEREGISTRATION_STORE_SERVER_NAME;
+	else x->assignment_type = AVP_IMS_SAR_TIMEOUT_DEREGISTRATION;
+	x->next = 0;
+	return x;
+}
+
+/**
+ * Looks up the r_public of a timeout de-registration SAR again.
+ * \note Aquires the lock on the hash slot on success, so release it when you are done.
+ * @param x - the timeout de-registration SAR
+ * @returns the r_public or NULL if it is gone in the meantime
+ */
+static r_public* timeout_sar_public(r_timeout_sar *x)
+{
+	r_public *p;
+	
+	p = get_r_public(x->aor);
+	if (!p) return 0;
+	if (p->hash>=r_hash_size){
+		/* matched a Wildcarded PSI, which is not the one we are looking for */
+		r_unlock(p->hash);
+		return 0;
+	}
+	p->sar_pending = 0;
+	return p;
+}
+
 /**
- * The Registrar timer looks for expires contacts and removes them
+ * Puts back in the expiry index a r_public for which the timeout de-registration failed,
+ * so that it is tried again on the next registrar_timer() run.
+ * @param x - the timeout de-registration SAR
+ */
+static void timeout_sar_failed(r_timeout_sar *x)
+{
+	r_public *p;
+	
+	LOG(L_DBG,"DBG:"M_NAME":timeout_sar_failed: User <%.*s> deregistration SAR failed.Keeping into registrar, but with no contacts\n",
+		x->aor.len,x->aor.s);
+	p = timeout_sar_public(x);
+	if (!p) return;
+	r_expiry_update(p);
+	journal_r_public(p);
+	r_unlock(p->hash);
+}
+
+/**
+ * De-registers a public identity and its implicit set after a successful timeout de-registration.
+ * @param x - the timeout de-registration SAR
+ */
+static void timeout_sar_deregister(r_timeout_sar *x)
+{
+	r_public *p,*rpublic;
+	r_contact *c2,*cn2;
+	r_subscriber *s2,*sn2;
+	ims_public_identity *pi;
+	int j,n,hash,rpublic_hash;
+	
+	p = timeout_sar_public(x);
+	if (!p) return;
+	hash = p->hash;
+	
+	r_act_time();
+	if (p->head || p->reg_state!=REGISTERED){
+		LOG(L_DBG,"DBG:"M_NAME":timeout_sar_deregister: User <%.*s> registered again in the meantime.\n",
+			p->aor.len,p->aor.s);
+		r_expiry_update(p);
+		journal_r_public(p);
+		r_unlock(hash);
+		return;
+	}
+	if (!p->s){
+		LOG(L_DBG,"DBG:"M_NAME":timeout_sar_deregister: Problem r_public does not contain IMS Subscription <%.*s> \n",
+			p->aor.len,p->aor.s);
+		r_expiry_update(p);
+		journal_r_public(p);
+		r_unlock(hash);
+		return;
+	}
+	/* de-register everything in this implicit set */
+	for(j=0;j<p->s->service_profiles_cnt;j++)
+		for(n=0;n<p->s->service_profiles[j].public_identities_cnt;n++){
+			pi = &(p->s->service_profiles[j].public_identities[n]);
+			if (pi->public_identity.len == p->aor.len &&
+				strncasecmp(pi->public_identity.s,p->aor.s,p->aor.len)==0) continue;
+			rpublic = get_r_public_previous_lock(pi->public_identity,hash);
+			
+			if(!rpublic){
+				LOG(L_INFO,"INFO:"M_NAME":timeout_sar_deregister: The implicit set public identity <%.*s> was not found in the registrar",
+					pi->public_identity.len,pi->public_identity.s);
+				continue;
+			}
+			rpublic_hash = rpublic->hash;
+			
+			c2 = rpublic->head;
+			while(c2){
+				cn2 = c2->next;
+				if (!r_valid_contact(c2)){
+					LOG(L_DBG,"DBG:"M_NAME":timeout_sar_deregister: Contact <%.*s> expired and removed (because of implicit set).\n",c2->uri.len,c2->uri.s);
+					S_event_reg(rpublic,c2,0,IMS_REGISTRAR_CONTACT_EXPIRED,1);/* send now because we might drop the dialog soon */	
+					del_r_contact(rpublic,c2);
+				}
+				c2 = cn2;
+			}
+			
+			s2 = rpublic->shead;
+			while(s2){
+				sn2 = s2->next;
+				if (!r_valid_subscriber(s2)){
+					LOG(L_DBG,"DBG:"M_NAME":timeout_sar_deregister: Subscriber <%.*s> expired and removed (because of implicit set).\n",s2->subscriber.len,s2->subscriber.s);
+					del_r_subscriber(rpublic,s2);
+				}										  
+				s2 = sn2;
+			}
+	
+			if (!rpublic->head){/* no more contacts, then deregister it */
+				if (!rpublic->shead)  {/* delete it if there are no more subscribers for it */     
+					LOG(L_DBG,"DBG:"M_NAME":timeout_sar_deregister: User <%.*s> removed (because of implicit set).\n",
+						rpublic->aor.len,rpublic->aor.s);
+					del_r_public(rpublic);
+				}else{/* else mark it unregistered - to avoid more SAR */
+					LOG(L_DBG,"DBG:"M_NAME":timeout_sar_deregister: User <%.*s> kept unregistered - has subscribers (because of implicit set).\n",
+				        rpublic->aor.len,rpublic->aor.s);                                                
+					rpublic->reg_state = NOT_REGISTERED;                                       
+					r_expiry_update(rpublic);
+					journal_r_public(rpublic);
+				}
+			}
+			/* because the lock was taken with a previous lock */
+			if (rpublic_hash!=hash) r_unlock(rpublic_hash);
+		}
+
+	LOG(L_DBG,"DBG:"M_NAME":timeout_sar_deregister: User <%.*s> deregistered.\n",
+		p->aor.len,p->aor.s);
+	if (!p->shead)	{/* delete it if there are no more subscribers for it */						
+		LOG(L_DBG,"DBG:"M_NAME":timeout_sar_deregister: User <%.*s> removed.\n",
+			p->aor.len,p->aor.s);
+		del_r_public(p);
+	}else{/* else mark it unregistered - to avoid more SAR */
+		LOG(L_DBG,"DBG:"M_NAME":timeout_sar_deregister: User <%.*s> kept unregistered - has subscribers.\n",
+			p->aor.len,p->aor.s);								
+		p->reg_state = NOT_REGISTERED;								
+		r_expiry_update(p);
+		journal_r_public(p);
+	}
+	r_unlock(hash);
+}
+
+/**
+ * Transactional callback for the SAA of a timeout de-registration.
+ * Runs in a Diameter worker process, without any registrar lock held by the timer.
+ * @param is_timeout - if this is a time-out
+ * @param param - the r_timeout_sar
+ * @param saa - the SAA or NULL on time-out
+ */
+static void timeout_sar_cb(int is_timeout,void *param,AAAMessage *saa)
+{
+	r_timeout_sar *x = param;
+	#ifdef WITH_IMS_PM
+		ims_pm_diameter_answer(saa);
+	#endif				
+	if (SAA(0,saa,x->aor,x->private_identity,x->assignment_type)==CSCF_RETURN_TRUE)
+		timeout_sar_deregister(x);
+	else 
+		timeout_sar_failed(x);
+	if (saa) cdpb.AAAFreeMessage(&saa);
+	shm_free(x);
+}
+
+/**
+ * The Registrar timer looks for expires contacts and removes them.
+ * Only the r_publics due in the expiry index of each hash slot are visited. The timeout
+ * de-registration SARs for the ones left without contacts are queued and sent after the
+ * slot lock is released; the de-registration of the implicit set is done when the SAA 
+ * arrives, in timeout_sar_cb().
  * @param ticks - the current time
  * @param param - pointer to the domain_list
  */
 void registrar_timer(unsigned int ticks, void* param)
 {
-	r_public *p,*pn,*rpublic;
-	r_contact *c,*c2=0,*cn,*cn2=0;
-	r_subscriber *s,*sn,*s2=0,*sn2=0;
-	int i,j,n,assignment_type,sar_res;
-	ims_public_identity *pi=0;
+	r_public *p,*pn;
+	r_contact *c,*cn;
+	r_subscriber *s,*sn;
 	r_hash_slot *r;
-	int rpublic_hash;
+	r_timeout_sar *sars,*x;
+	unsigned int now_tick,tick,first_tick;
+	int i,deleted;
 	
 	#ifdef WITH_IMS_PM
 		int impu_cnt=0,contact_cnt=0,subs_cnt=0;
@@ -142,149 +347,97 @@ void registrar_timer(unsigned int ticks, void* param)
 	LOG(L_DBG,"DBG:"M_NAME":registrar_timer: Called at %d\n",ticks);
 
 	r_act_time();
+	now_tick = time_now/R_EXPIRY_TICK;
 
 	for(i=0;i<r_hash_size;i++){
+		sars = 0;
 		r_lock(i);
-			p = r[i].head;
-			while(p){
-				pn = p->next;
-				c = p->head;
-									
-				while(c){
-					cn = c->next;
-					if (!r_valid_contact(c)){
-						LOG(L_DBG,"DBG:"M_NAME":registrar_timer: Contact <%.*s> expired and removed.\n",
-							c->uri.len,c->uri.s);							
-						S_event_reg(p,c,0,IMS_REGISTRAR_CONTACT_EXPIRED,1);/* send now because we might drop the dialog soon */	
-						del_r_contact(p,c);
+			first_tick = r[i].expiry_tick+1;
+			if (now_tick-r[i].expiry_tick > R_EXPIRY_WHEEL) first_tick = now_tick-R_EXPIRY_WHEEL+1;
+			/* anything filed from now on goes after now_tick */
+			r[i].expiry_tick = now_tick;
+			
+			for(tick=first_tick;tick<=now_tick;tick++){
+				p = r[i].expiry[tick%R_EXPIRY_WHEEL];
+				while(p){
+					pn = p->enext;
+					if (p->expiry_tick>now_tick) {/* due on a later turn of the wheel */
+						p = pn;
+						continue;
 					}
-					#ifdef WITH_IMS_PM
-						else contact_cnt++;
-					#endif
-					c = cn;
-				}
-				s = p->shead;
-				while(s){
-					sn = s->next;
-					if (!r_valid_subscriber(s)){
-						LOG(L_DBG,"DBG:"M_NAME":registrar_timer: Subscriber <%.*s> expired and removed.\n",
-							s->subscriber.len,s->subscriber.s);
-						del_r_subscriber(p,s);
+					c = p->head;
+					while(c){
+						cn = c->next;
+						if (!r_valid_contact(c)){
+							LOG(L_DBG,"DBG:"M_NAME":registrar_timer: Contact <%.*s> expired and removed.\n",
+								c->uri.len,c->uri.s);							
+							S_event_reg(p,c,0,IMS_REGISTRAR_CONTACT_EXPIRED,1);/* send now because we might drop the dialog soon */	
+							del_r_contact(p,c);
+						}
+						c = cn;
 					}
-					#ifdef WITH_IMS_PM
-						else subs_cnt++;
-					#endif
-					s = sn;
-				}
-				
-				if (!p->head){/* no more contacts, then deregister it */
-					switch (p->reg_state){
-						case REGISTERED:
-							if (server_assignment_store_data) 
-								assignment_type = AVP_IMS_SAR_TIMEOUT_DEREGISTRATION_STORE_SERVER_NAME;
-							else assignment_type = AVP_IMS_SAR_TIMEOUT_DEREGISTRATION;
-							sar_res = SAR(0,cscf_get_realm_from_uri(p->aor),p->aor,p->s->private_identity,assignment_type,0);
-							
-							if (sar_res==1){
-								/* SAR successful, de-register everything in this implicit set */
-								if (!p->s){
-									LOG(L_DBG,"DBG:"M_NAME":registrar_timer: Problem r_public does not contain IMS Subscription <%.*s> \n",
+					s = p->shead;
+					while(s){
+						sn = s->next;
+						if (!r_valid_subscriber(s)){
+							LOG(L_DBG,"DBG:"M_NAME":registrar_timer: Subscriber <%.*s> expired and removed.\n",
+								s->subscriber.len,s->subscriber.s);
+							del_r_subscriber(p,s);
+						}
+						s = sn;
+					}
+					
+					deleted = 0;
+					if (!p->head){/* no more contacts, then deregister it */
+						switch (p->reg_state){
+							case REGISTERED:
+								if (p->sar_pending) break;
+								x = new_timeout_sar(p);
+								if (!x) break;
+								x->next = sars;
+								sars = x;
+								p->sar_pending = 1;
+								break;
+								
+							case UNREGISTERED:
+								/* Don't drop it, just keep it for unregistered triggering*/
+								break;
+								
+							case NOT_REGISTERED:								
+								/* to avoid sending SAR when we still have subscribers, but no contact */
+								if (!p->shead)	{/* delete it if there are no more subscribers for it */						
+									LOG(L_DBG,"DBG:"M_NAME":registrar_timer: User <%.*s> removed - no more subscribers.\n",
 										p->aor.len,p->aor.s);
-									break;
+									del_r_public(p);
+									deleted = 1;
 								}
-								for(j=0;j<p->s->service_profiles_cnt;j++)
-									for(n=0;n<p->s->service_profiles[j].public_identities_cnt;n++){
-										pi = &(p->s->service_profiles[j].public_identities[n]);
-										if (pi->public_identity.len == p->aor.len &&
-											strncasecmp(pi->public_identity.s,p->aor.s,p->aor.len)==0) continue;
-										rpublic = get_r_public_previous_lock(pi->public_identity,p->hash);
-										
-										if(!rpublic){
-											LOG(L_INFO,"INFO:"M_NAME":registrar_timer: The implicit set public identity <%.*s> was not found in the registrar",
-												pi->public_identity.len,pi->public_identity.s);
-											continue;
-										}
-										rpublic_hash = rpublic->hash;
-										
-										c2 = rpublic->head;
-										while(c2){
-											cn2 = c2->next;
-											if (!r_valid_contact(c2)){
-												LOG(L_DBG,"DBG:"M_NAME":registrar_timer: Contact <%.*s> expired and removed (because of implicit set).\n",c2->uri.len,c2->uri.s);
-												S_event_reg(rpublic,c2,0,IMS_REGISTRAR_CONTACT_EXPIRED,1);/* send now because we might drop the dialog soon */	
-												del_r_contact(rpublic,c2);
-											}
-											c2 = cn2;
-										}
-										
-										s2 = rpublic->shead;
-										while(s2){
-											sn2 = s2->next;
-											if (!r_valid_subscriber(s2)){
-												LOG(L_DBG,"DBG:"M_NAME":registrar_timer: Subscriber <%.*s> expired and removed (because of implicit set).\n",s2->subscriber.len,s2->subscriber.s);
-												del_r_subscriber(rpublic,s2);
-											}										  
-											s2 = sn2;
-										}
-								
-										if (!rpublic->head){/* no more contacts, then deregister it */
-											if (!rpublic->shead)  {/* delete it if there are no more subscribers for it */     
-												LOG(L_DBG,"DBG:"M_NAME":registrar_timer: User <%.*s> removed (because of implicit set).\n",
-													rpublic->aor.len,rpublic->aor.s);
-												del_r_public(rpublic);
-											}else{/* else mark it unregistered - to avoid more SAR */
-												LOG(L_DBG,"DBG:"M_NAME":registrar_timer: User <%.*s> kept unregistered - has subscribers (because of implicit set).\n",
-											        rpublic->aor.len,rpublic->aor.s);                                                
-												rpublic->reg_state = NOT_REGISTERED;                                       
-											}
-										}
-										/* because the lock was taken with a previous lock */
-										if (rpublic_hash!=i) r_unlock(rpublic_hash);
-									}
-
-							  LOG(L_DBG,"DBG:"M_NAME":registrar_timer: User <%.*s> deregistered.\n",
-									p->aor.len,p->aor.s);
-							  if (!p->shead)	{/* delete it if there are no more subscribers for it */						
-								LOG(L_DBG,"DBG:"M_NAME":registrar_timer: User <%.*s> removed.\n",
-									p->aor.len,p->aor.s);
-								del_r_public(p);
-							  }else{/* else mark it unregistered - to avoid more SAR */
-								LOG(L_DBG,"DBG:"M_NAME":registrar_timer: User <%.*s> kept unregistered - has subscribers.\n",
-								p->aor.len,p->aor.s);								
-								p->reg_state = NOT_REGISTERED;								
-							  }
-							}else{
-								LOG(L_DBG,"DBG:"M_NAME":registrar_timer: User <%.*s> deregistration SAR failed.Keeping into registrar, but with no contacts\n",
-									p->aor.len,p->aor.s);
-								#ifdef WITH_IMS_PM
-									impu_cnt++;
-								#endif
-							}										
-							break;
-							
-						case UNREGISTERED:
-							/* Don't drop it, just keep it for unregistered triggering*/
-							 #ifdef WITH_IMS_PM
-								impu_cnt++;
-							#endif
-							break;
-							
-						case NOT_REGISTERED:								
-							/* to avoid sending SAR when we still have subscribers, but no contact */
-							if (!p->shead)	{/* delete it if there are no more subscribers for it */						
-								LOG(L_DBG,"DBG:"M_NAME":registrar_timer: User <%.*s> removed - no more subscribers.\n",
-									p->aor.len,p->aor.s);
-								del_r_public(p);							
-							}
-							break;
+								break;
+						}
 					}
+					if (!deleted) r_expiry_update(p);
+					p = pn;
 				}
-				#ifdef WITH_IMS_PM
-					else impu_cnt++;
-				#endif
-				p = pn;
 			}
-		r_unlock(i);		
+			#ifdef WITH_IMS_PM
+				impu_cnt += r[i].pm.impus;
+				contact_cnt += r[i].pm.contacts;
+				subs_cnt += r[i].pm.subscribers;
+			#endif
+		r_unlock(i);
+		
+		/* the HSS is asked only now, without keeping the slot locked while waiting */
+		while(sars){
+			x = sars;
+			sars = sars->next;
+			x->next = 0;
+			if (!Cx_SAR_async(0,x->aor,x->private_identity,scscf_name_str,
+					cscf_get_realm_from_uri(x->aor),x->assignment_type,0,timeout_sar_cb,x)){
+				LOG(L_ERR,"ERR:"M_NAME":registrar_timer: Error creating/sending SAR for <%.*s>\n",
+					x->aor.len,x->aor.s);
+				timeout_sar_failed(x);
+				shm_free(x);
+			}
+		}
 	}
 	print_r(L_INFO);
 	#ifdef WITH_IMS_PM
@@ -294,6 +447,8 @@ void registrar_timer(unsigned int ticks, void* param)
 	#endif
 }
 
+static int S_assign_server_do(struct sip_msg *msg,char *str1,int async_route);
+
 /**
  * Does the Server Assignment procedures, assigning this S-CSCF to the user.
  * Covered cases:
@@ -316,6 +471,32 @@ void registrar_timer(unsigned int ticks, void* param)
  * @returns true if ok, false if not, break on error
  */
 int S_assign_server(struct sip_msg *msg,char *str1,char *str2 )
+{
+	return S_assign_server_do(msg,str1,-1);
+}
+
+/**
+ * Does the Server Assignment procedures as S_assign_server(), without blocking the process on the SAR.
+ * If a SAR is required, the REGISTER transaction is suspended and the script continues in the given 
+ * failure_route if the SAA was successful and the registrar saved. Otherwise the REGISTER is replied to.
+ * @param msg - the SIP REGISTER message (that is authorized)
+ * @param str1 - the failure_route to resume in (fixed to its index)
+ * @param str2 - the realm to look for in Authorization
+ * @returns true if ok without a SAR, false if not, break if suspended or on error
+ */
+int S_assign_server_async(struct sip_msg *msg,char *str1,char *str2 )
+{
+	return S_assign_server_do(msg,str2,(int)(long)str1);
+}
+
+/**
+ * Does the Server Assignment procedures for S_assign_server() and S_assign_server_async().
+ * @param msg - the SIP REGISTER message (that is authorized)
+ * @param str1 - the realm to look for in Authorization
+ * @param async_route - failure_route to resume in after an async SAR or -1 for a blocking SAR
+ * @returns true if ok, false if not, break on error or if suspended
+ */
+static int S_assign_server_do(struct sip_msg *msg,char *str1,int async_route)
 {
 	int ret=CSCF_RETURN_FALSE;
 	str private_identity,public_identity,realm;
@@ -423,7 +604,11 @@ int S_assign_server(struct sip_msg *msg,char *str1,char *str2 )
 	else
 		data_available = AVP_IMS_SAR_USER_DATA_ALREADY_AVAILABLE;
 	
-	ret = SAR(msg,realm,public_identity,private_identity,assignment_type,data_available);
+	if (async_route<0)
+		ret = SAR(msg,realm,public_identity,private_identity,assignment_type,data_available);
+	else
+		ret = SAR_async(msg,realm,public_identity,private_identity,assignment_type,data_available,
+			async_route);
 
 done:			
 	return ret;	
@@ -526,8 +711,7 @@ int SAR(struct sip_msg *msg, str realm, str public_identity, str private_identit
 				int assignment_type,int data_available)
 {
 	AAAMessage *saa;
-	int rc=-1,experimental_rc=-1;
-	str xml={0,0},ccf1={0,0},ccf2={0,0},ecf1={0,0},ecf2={0,0};
+	int ret;
 		
 	if (realm.len==0){
 		realm = cscf_get_realm_from_uri(private_identity);
@@ -535,6 +719,28 @@ int SAR(struct sip_msg *msg, str realm, str public_identity, str private_identit
 	saa = Cx_SAR(msg,public_identity,private_identity,scscf_name_str,realm,
 		assignment_type,data_available);
 	
+	ret = SAA(msg,saa,public_identity,private_identity,assignment_type);
+	
+	if (saa) cdpb.AAAFreeMessage(&saa);
+	return ret;
+}
+
+/**
+ * Processes a SAA, saving the registrar.
+ * Can respond with a SIP reply if msg!=0
+ * @param msg - the SIP message
+ * @param saa - the SAA received or NULL on time-out; not freed here
+ * @param public_identity - public identity
+ * @param private_identity - private identity
+ * @param assignment_type - assignment type
+ * @returns CSCF_RETURN_TRUE if ok, CSCF_RETURN_FALSE on error or CSCF_RETURN_BREAK on response sent out
+ */
+int SAA(struct sip_msg *msg, AAAMessage *saa, str public_identity, str private_identity,
+				int assignment_type)
+{
+	int rc=-1,experimental_rc=-1;
+	str xml={0,0},ccf1={0,0},ccf2={0,0},ecf1={0,0},ecf2={0,0};
+
 	if (!saa){
 		//TODO - add the warning code 99 in the reply	
 		if (msg) S_REGISTER_reply(msg,480,MSG_480_DIAMETER_TIMEOUT_SAR);		
@@ -595,19 +801,99 @@ success:
 	
 	Cx_get_charging_info(saa,&ccf1,&ccf2,&ecf1,&ecf2);
 	if (msg||assignment_type==AVP_IMS_SAR_UNREGISTERED_USER){
-		int ret = save_location(msg,assignment_type,&xml,&ccf1,&ccf2,&ecf1,&ecf2);
-		if (saa) cdpb.AAAFreeMessage(&saa);
-		return ret;
+		return save_location(msg,assignment_type,&xml,&ccf1,&ccf2,&ecf1,&ecf2);
 	}else{
 		/* it was called internally and there is no SIP message to respond to */		
 	}
-	if (saa) cdpb.AAAFreeMessage(&saa);
 	return CSCF_RETURN_TRUE;
 done:	
-	if (saa) cdpb.AAAFreeMessage(&saa);
 	return CSCF_RETURN_FALSE;
 error:	
-	if (saa) cdpb.AAAFreeMessage(&saa);
+	return CSCF_RETURN_BREAK;
+}
+
+/**
+ * Resumes a REGISTER suspended by SAR_async(), processing the SAA.
+ * Called by tm on the request retrieved from the transaction.
+ * @param msg - the original SIP message retrieved from the transaction
+ * @param param - the cx_async_ctx of the request
+ * @returns 1 if the script should continue in the resume route, 0 if not
+ */
+static int SAR_continue(struct sip_msg *msg,void *param)
+{
+	cx_async_ctx *ctx = param;
+	str private_identity,public_identity;
+	
+	private_identity = cscf_get_private_identity(msg,ctx->realm);
+	public_identity = cscf_get_public_identity(msg);
+
+	return SAA(msg,ctx->ans,public_identity,private_identity,ctx->assignment_type)==CSCF_RETURN_TRUE;
+}
+
+/**
+ * Transactional callback for the SAA of SAR_async().
+ * Runs in a Diameter worker process and resumes the suspended REGISTER.
+ * @param is_timeout - if this is a time-out
+ * @param param - the cx_async_ctx of the request
+ * @param saa - the SAA or NULL on time-out
+ */
+static void SAR_async_cb(int is_timeout,void *param,AAAMessage *saa)
+{
+	cx_async_ctx *ctx = param;
+	#ifdef WITH_IMS_PM
+		ims_pm_diameter_answer(saa);
+	#endif				
+	ctx->ans = saa;
+	if (tmb.t_continue(ctx->hash_index,ctx->label,ctx->route,SAR_continue,ctx)<0)
+		LOG(L_ERR,"ERR:"M_NAME":SAR_async_cb: Error resuming the REGISTER transaction %u:%u\n",
+			ctx->hash_index,ctx->label);
+	if (ctx->ans) cdpb.AAAFreeMessage(&(ctx->ans));
+	shm_free(ctx);
+}
+
+/**
+ * Sends a SAR for a SIP request without waiting for the SAA.
+ * The transaction is suspended and resumed when the SAA arrives, in the given failure_route.
+ * Responds with a SIP reply on errors.
+ * @param msg - the SIP message
+ * @param realm - the realm
+ * @param public_identity - public identity
+ * @param private_identity - private identity
+ * @param assignment_type - assignment type
+ * @param data_available - if the data is already available
+ * @param route - failure_route to resume the script in
+ * @returns CSCF_RETURN_BREAK as the request is suspended or a response was sent out
+ */
+int SAR_async(struct sip_msg *msg, str realm, str public_identity, str private_identity,
+				int assignment_type,int data_available,int route)
+{
+	cx_async_ctx *ctx;
+	
+	ctx = shm_malloc(sizeof(cx_async_ctx));
+	if (!ctx){
+		LOG(L_ERR,"ERR:"M_NAME":SAR_async: Error allocating %d bytes\n",(int)sizeof(cx_async_ctx));
+		S_REGISTER_reply(msg,500,MSG_500_SAR_FAILED);
+		return CSCF_RETURN_BREAK;
+	}
+	memset(ctx,0,sizeof(cx_async_ctx));
+	ctx->route = route;
+	ctx->realm = realm;
+	ctx->assignment_type = assignment_type;
+	
+	if (tmb.t_suspend(msg,&(ctx->hash_index),&(ctx->label))<0){
+		LOG(L_ERR,"ERR:"M_NAME":SAR_async: Error suspending the REGISTER transaction\n");
+		shm_free(ctx);
+		S_REGISTER_reply(msg,500,MSG_500_SUSPEND);
+		return CSCF_RETURN_BREAK;
+	}
+	
+	if (!Cx_SAR_async(msg,public_identity,private_identity,scscf_name_str,realm,
+			assignment_type,data_available,SAR_async_cb,ctx)){
+		LOG(L_ERR,"ERR:"M_NAME":SAR_async: Error creating/sending SAR\n");
+		shm_free(ctx);
+		S_REGISTER_reply(msg,480,MSG_480_DIAMETER_ERROR);
+		return CSCF_RETURN_BREAK;
+	}
 	return CSCF_RETURN_BREAK;
 }
 
@@ -59,6 +59,9 @@
 
 #include "../../sr_module.h"
 
+struct _message_t; /* AAAMessage, cdp headers are not included here since isc
+                      includes this header too */
+
 /** User Not Registered */
 #define IMS_USER_NOT_REGISTERED 0
 /** User registered */
@@ -72,6 +75,8 @@ void registrar_timer(unsigned int ticks, void* param);
 
 int S_assign_server(struct sip_msg *msg,char *str1,char *str2 );
 
+int S_assign_server_async(struct sip_msg *msg,char *str1,char *str2 );
+
 int S_assign_server_unreg(struct sip_msg *msg,char *str1,char *str2 );
 
 int S_update_contacts(struct sip_msg *msg,char *str1,char *str2);
@@ -79,6 +84,12 @@ int S_update_contacts(struct sip_msg *msg,char *str1,char *str2);
 int SAR(struct sip_msg *msg, str realm,str public_identity, str private_identity,
 				int assignment_type,int data_available);
 
+int SAA(struct sip_msg *msg, struct _message_t *saa, str public_identity, str private_identity,
+				int assignment_type);
+
+int SAR_async(struct sip_msg *msg, str realm, str public_identity, str private_identity,
+				int assignment_type,int data_available,int route);
+
 int save_location(struct sip_msg *msg,int assignment_type,str *xml,str *ccf1,str *ccf2,str *ecf1,str *ecf2);
 
 
@@ -61,9 +61,14 @@
 #include "../../parser/parse_uri.h"
 #include "../../locking.h"
 #include "../../modules/tm/tm_load.h"
+#include "../../ut.h"
+#include "../../pt.h"
+#include "../cdp/sem.h"
 #include "sip.h"
 #include "ims_pm.h"
 
+#include <stdarg.h>
+
 extern struct tm_binds tmb;            		/**< Structure with pointers to tm funcs 		*/
 
 extern str scscf_name_str;							/**< fixed name of the S-CSCF 					*/
@@ -77,40 +82,140 @@ extern time_t time_now;						/**< Current time of the S-CSCF registrar		*/
 extern int r_hash_size;						/**< Size of S-CSCF registrar hash table		*/
 extern r_hash_slot *registrar;				/**< The S-CSCF registrar 						*/
 
-r_notification_list *notification_list=0;	/**< List of pending notifications				*/
+extern int scscf_notification_processes;	/**< processes to send the NOTIFYs from, 0 for the timer */
+
+r_notification_list *notification_list=0;	/**< Lists of pending notifications, one per notification process */
+static int notification_list_cnt=0;			/**< how many lists there are					*/
 	
 /**
- * Initializes the reg notifications list.
+ * Initializes the reg notifications lists.
+ * Without notification_processes there is one list, sent from the notification_timer() and
+ * by the events to send now. Else there is one per process and the notifications of a dialog
+ * always go in the same list, so that they are sent in order and the dialog is used by only
+ * that process, or under the list lock by r_notify_send_now().
  */
 int r_notify_init()
 {
-	notification_list = shm_malloc(sizeof(r_notification_list));
+	int i;
+	
+	notification_list_cnt = scscf_notification_processes>0?scscf_notification_processes:1;
+	notification_list = shm_malloc(notification_list_cnt*sizeof(r_notification_list));
 	if (!notification_list) return 0;
-	memset(notification_list,0,sizeof(r_notification_list));
-	notification_list->lock = lock_alloc();
-	if (!notification_list->lock) return 0;
-	notification_list->lock = lock_init(notification_list->lock);
+	memset(notification_list,0,notification_list_cnt*sizeof(r_notification_list));
+	for(i=0;i<notification_list_cnt;i++){
+		notification_list[i].lock = lock_alloc();
+		if (!notification_list[i].lock) return 0;
+		notification_list[i].lock = lock_init(notification_list[i].lock);
+		if (scscf_notification_processes>0) 
+			sem_new(notification_list[i].empty,0);
+	}
 	return 1;
+out_of_memory:
+	return 0;
 }
 
 /**
- * Destroys the reg notifications list.
+ * Destroys the reg notifications lists.
  */
 void r_notify_destroy()
 {
 	r_notification *n,*nn;
-	lock_get(notification_list->lock);
-	n = notification_list->head;
-	while(n){
-		nn = n->next;
-		free_r_notification(n);
-		n = nn;
+	int i;
+	
+	for(i=0;i<notification_list_cnt;i++){
+		lock_get(notification_list[i].lock);
+		n = notification_list[i].head;
+		while(n){
+			nn = n->next;
+			free_r_notification(n);
+			n = nn;
+		}
+		lock_destroy(notification_list[i].lock);
+		lock_dealloc(notification_list[i].lock);
+		sem_free(notification_list[i].empty);
 	}
-	lock_destroy(notification_list->lock);
-	lock_dealloc(notification_list->lock);	
 	shm_free(notification_list);
 }
 
+/**
+ * Loop of a notification process, sending the notifications of its list.
+ * The list stays locked while sending, so that r_notify_send_now() finds no notification
+ * in flight when it returns.
+ * @param k - the index of the process and of its list
+ */
+static void r_notification_process(int k)
+{
+	r_notification_list *l=notification_list+k;
+	r_notification *n;
+	
+	LOG(L_INFO,"INFO:"M_NAME":r_notification_process: Notification process %d started\n",k);
+	while(1){
+		if (sem_get(l->empty)<0) continue;
+		lock_get(l->lock);
+		n = l->head;
+		if (n){
+			l->head = n->next;
+			if (n->next) n->next->prev = 0;
+			else l->tail = 0;
+			send_notification(n);
+			free_r_notification(n);
+		}
+		lock_release(l->lock);
+	}
+}
+
+/**
+ * Sends right away, from the calling process, all the pending notifications.
+ * Used by the events which have to be sent now, because the caller is about to free the
+ * dialog the notifications reference. With notification_processes all the lists are 
+ * drained, as the notification processes would send them only later.
+ * \note The semaphores are not decremented, the notification processes will just find
+ * the lists empty.
+ */
+static void r_notify_send_now()
+{
+	r_notification_list *l;
+	r_notification *n;
+	
+	if (scscf_notification_processes<=0){
+		notification_timer(0,0);
+		return;
+	}
+	for(l=notification_list;l<notification_list+notification_list_cnt;l++){
+		lock_get(l->lock);
+		while(l->head){
+			n = l->head;
+			l->head = n->next;
+			if (n->next) n->next->prev = 0;
+			else l->tail = 0;
+			send_notification(n);
+			free_r_notification(n);
+		}
+		lock_release(l->lock);
+	}
+}
+
+/**
+ * Forks the notification processes.
+ * Must be called from the main process, from child_init with rank PROC_MAIN, and the
+ * processes must be registered in mod_init with register_procs().
+ * @returns 1 on success, 0 on error
+ */
+int r_notify_start()
+{
+	int k,pid;
+	
+	for(k=0;k<scscf_notification_processes;k++){
+		pid = fork_process(R_NOTIFY_PROCESS_RANK+k,"scscf notifications",1);
+		if (pid<0){
+			LOG(L_ERR,"ERR:"M_NAME":r_notify_start: Error on fork() for notification process %d\n",k);
+			return 0;
+		}
+		if (pid==0) r_notification_process(k);
+	}
+	return 1;
+}
+
 
 static str lookup_sip={"sip:",4};
 /**
@@ -471,10 +576,10 @@ static str subs_active={"active;expires=",15};
  * @param pv - r_public* to which it refers
  * @param cv - the r_contact* to which it refers or NULL if for all
  * @param ps - the r_subscriber*  to which it refers or NULL if for all
- * @param content - the body content
+ * @param reginfo - the body content, shared by the notifications, or NULL if none
  * @param expires - the remaining subcription expiration time in seconds
  */
-static void r_create_notifications(void *pv,void *cv,void *ps,str content,long expires)
+static void r_create_notifications(void *pv,void *cv,void *ps,r_reginfo *reginfo,long expires)
 {
 	r_notification *n;
 	r_public *p=(r_public*)pv;
@@ -509,7 +614,7 @@ static void r_create_notifications(void *pv,void *cv,void *ps,str content,long e
 			STR_PKG_DUP(subscription_state,subs_terminated,"pkg subs state");
 		}
 		n = new_r_notification(req_uri,uri,subscription_state,event,
-			content_type,content,s->dialog,s->version++);						
+			content_type,reginfo,s->dialog,s->version++);						
 		if (req_uri.s) pkg_free(req_uri.s);
 		if (subscription_state.s) pkg_free(subscription_state.s);	
 		if (n) {
@@ -528,9 +633,67 @@ out_of_memory:
 	return;	
 }
 
-/** Maximum reginfo XML size */
+/** Initial reginfo XML buffer size */
 #define MAX_REGINFO_SIZE 16384
 
+static char *reginfo_buf=0;				/**< buffer to render the reginfo in, in pkg	*/
+static int reginfo_max=0;				/**< size of reginfo_buf						*/
+static int reginfo_len=0;				/**< what is rendered so far					*/
+static int reginfo_error=0;				/**< if the rendering failed					*/
+
+/**
+ * Makes room for len more bytes in the reginfo buffer.
+ * @returns 1 on success, 0 on error
+ */
+static int reginfo_expand(int len)
+{
+	char *b;
+	int max;
+	
+	if (reginfo_len+len<=reginfo_max) return 1;
+	max = reginfo_max?reginfo_max*2:MAX_REGINFO_SIZE;
+	while(max<reginfo_len+len) max *= 2;
+	b = pkg_realloc(reginfo_buf,max);
+	if (!b){
+		LOG(L_ERR,"ERR:"M_NAME":reginfo_expand: Error allocating %d bytes.\n",max);
+		reginfo_error = 1;
+		return 0;
+	}
+	reginfo_buf = b;
+	reginfo_max = max;
+	return 1;
+}
+
+/**
+ * Appends a string to the reginfo.
+ */
+static inline void reginfo_append(str x)
+{
+	if (!reginfo_expand(x.len)) return;
+	memcpy(reginfo_buf+reginfo_len,x.s,x.len);
+	reginfo_len += x.len;
+}
+
+/**
+ * Appends a formatted string to the reginfo.
+ */
+static void reginfo_printf(char *fmt,...)
+{
+	va_list ap;
+	int k;
+	
+	if (!reginfo_expand(128)) return;
+	va_start(ap,fmt);
+	k = vsnprintf(reginfo_buf+reginfo_len,reginfo_max-reginfo_len,fmt,ap);
+	va_end(ap);
+	if (k>=reginfo_max-reginfo_len){
+		if (!reginfo_expand(k+1)) return;
+		va_start(ap,fmt);
+		vsnprintf(reginfo_buf+reginfo_len,reginfo_max-reginfo_len,fmt,ap);
+		va_end(ap);
+	}
+	if (k>0) reginfo_len += k;
+}
 
 
 /**
@@ -571,7 +734,8 @@ static str xml_start={"<?xml version=\"1.0\"?>\n",22};
 
 static str r_full={"full",4};
 static str r_partial={"partial",7};
-static str r_reginfo_s={"<reginfo xmlns=\"urn:ietf:params:xml:ns:reginfo\" version=\"%s\" state=\"%.*s\">\n",74};
+static str r_reginfo_s={"<reginfo xmlns=\"urn:ietf:params:xml:ns:reginfo\" version=\"",57};
+static str r_reginfo_state={"\" state=\"%.*s\">\n",16};
 static str r_reginfo_e={"</reginfo>\n",11};
 
 //static str r_init={"init",4};
@@ -600,36 +764,32 @@ static str uri_s={"\t\t\t<uri>",8};
 static str uri_e={"</uri>\n",7};
 /**
  * Creates the full reginfo XML.
+ * \note Must be called with a lock on the r_public pv. The other public identities of the
+ * implicit registration set are locked only while they are rendered.
  * @param pv - the r_public to create for
  * @param event_type - event type
  * @param subsExpires - subscription expiration
- * @returns the str with the XML content
+ * @returns the shared reginfo or NULL on error
  */
-str r_get_reginfo_full(void *pv,int event_type,long *subsExpires)
+r_reginfo* r_get_reginfo_full(void *pv,int event_type,long *subsExpires)
 {		
-	str x={0,0};
-	str buf,pad;	
-	char bufc[MAX_REGINFO_SIZE],padc[MAX_REGINFO_SIZE];
-
+	str x;
 	r_public *p=(r_public*)pv,*p2;
 	r_contact *c;
 	r_contact_param *cp;
 	ims_public_identity *pi;
-	int i,j;
+	int i,j,version_pos;
 	unsigned int hash;
 	
-	buf.s = bufc;
-	buf.len=0;
-	pad.s = padc;
-	pad.len=0;
+	reginfo_len = 0;
+	reginfo_error = 0;
 	
 	*subsExpires = r_update_subscription_status(p);
 	
-	STR_APPEND(buf,xml_start);
-	sprintf(pad.s,r_reginfo_s.s,"%d",r_full.len,r_full.s);
-	pad.len = strlen(pad.s);
-	STR_APPEND(buf,pad);
-	
+	reginfo_append(xml_start);
+	reginfo_append(r_reginfo_s);
+	version_pos = reginfo_len;
+	reginfo_printf(r_reginfo_state.s,r_full.len,r_full.s);
 	
 	if (p->s){
 		for(i=0;i<p->s->service_profiles_cnt;i++)
@@ -643,51 +803,41 @@ str r_get_reginfo_full(void *pv,int event_type,long *subsExpires)
 						p2 = get_r_public(pi->public_identity);
 					if (p2){
 						if (p2->reg_state==REGISTERED)
-							sprintf(pad.s,registration_s.s,p2->aor.len,p2->aor.s,p2,r_active.len,r_active.s);
+							reginfo_printf(registration_s.s,p2->aor.len,p2->aor.s,p2,r_active.len,r_active.s);
 						else 
-							sprintf(pad.s,registration_s.s,p2->aor.len,p2->aor.s,p2,r_terminated.len,r_terminated.s);
-						pad.len = strlen(pad.s);
-						STR_APPEND(buf,pad);
+							reginfo_printf(registration_s.s,p2->aor.len,p2->aor.s,p2,r_terminated.len,r_terminated.s);
 						c = p2->head;
 						while(c){
 							if(c->qvalue != -1) {
 								float q = (float)c->qvalue/1000;
-								sprintf(pad.s,contact_s_q.s,c,r_active.len,r_active.s,r_registered.len,r_registered.s,c->expires-time_now, q);
+								reginfo_printf(contact_s_q.s,c,r_active.len,r_active.s,r_registered.len,r_registered.s,c->expires-time_now, q);
 							}
 							else
-								sprintf(pad.s,contact_s.s,c,r_active.len,r_active.s,r_registered.len,r_registered.s,c->expires-time_now);
-							pad.len = strlen(pad.s);
-							STR_APPEND(buf,pad);							
-							STR_APPEND(buf,uri_s);
-							STR_APPEND(buf,c->uri);
-							STR_APPEND(buf,uri_e);
+								reginfo_printf(contact_s.s,c,r_active.len,r_active.s,r_registered.len,r_registered.s,c->expires-time_now);
+							reginfo_append(uri_s);
+							reginfo_append(c->uri);
+							reginfo_append(uri_e);
 							for(cp=c->parameters;cp;cp=cp->next){
-								sprintf(pad.s,unknown_param_s.s,cp->name.len,cp->name.s);
-								pad.len = strlen(pad.s);
-								STR_APPEND(buf,pad);
-								STR_APPEND(buf,cp->value);
-								STR_APPEND(buf,unknown_param_e);
+								reginfo_printf(unknown_param_s.s,cp->name.len,cp->name.s);
+								reginfo_append(cp->value);
+								reginfo_append(unknown_param_e);
 							}
-							STR_APPEND(buf,contact_e);
+							reginfo_append(contact_e);
 							c = c->next;
 						}
-						STR_APPEND(buf,registration_e);
+						reginfo_append(registration_e);
 						if (p2->hash != p->hash) r_unlock(p2->hash);
 					}
 				}
 			}				
 	}
 
-	STR_APPEND(buf,r_reginfo_e);
+	reginfo_append(r_reginfo_e);
 
-	
-	x.s = pkg_malloc(buf.len+1);
-	if (x.s){
-		x.len = buf.len;
-		memcpy(x.s,buf.s,buf.len);
-		x.s[x.len]=0;
-	}
-	return x;
+	if (reginfo_error) return 0;
+	x.s = reginfo_buf;
+	x.len = reginfo_len;
+	return new_r_reginfo(x,version_pos);
 }
 
 
@@ -697,31 +847,27 @@ str r_get_reginfo_full(void *pv,int event_type,long *subsExpires)
  * @param pc - the r_contatct to create for
  * @param event_type - event type
  * @param subsExpires - subscription expiration
- * @returns the str with the XML content
+ * @returns the shared reginfo or NULL on error
  */
-str r_get_reginfo_partial( void *pv,void *pc,int event_type,long *subsExpires)
+r_reginfo* r_get_reginfo_partial( void *pv,void *pc,int event_type,long *subsExpires)
 {		
-	str x={0,0};
-	str buf,pad;	
-	char bufc[MAX_REGINFO_SIZE],padc[MAX_REGINFO_SIZE];
-	int expires=-1;
+	str x;
+	int expires=-1,version_pos;
 
 	r_public *p=(r_public*)pv;
 	r_contact *c=(r_contact*)pc;
 	r_contact_param *cp;
 	str state,event;
 	
-	buf.s = bufc;
-	buf.len=0;
-	pad.s = padc;
-	pad.len=0;
+	reginfo_len = 0;
+	reginfo_error = 0;
 
 	*subsExpires = r_update_subscription_status(p);
 	
-	STR_APPEND(buf,xml_start);
-	sprintf(pad.s,r_reginfo_s.s,"%d",r_partial.len,r_partial.s);
-	pad.len = strlen(pad.s);
-	STR_APPEND(buf,pad);
+	reginfo_append(xml_start);
+	reginfo_append(r_reginfo_s);
+	version_pos = reginfo_len;
+	reginfo_printf(r_reginfo_state.s,r_partial.len,r_partial.s);
 	
 	
 	if (p){
@@ -732,11 +878,9 @@ str r_get_reginfo_partial( void *pv,void *pc,int event_type,long *subsExpires)
 			 event_type==IMS_REGISTRAR_CONTACT_UNREGISTERED||
 			 event_type==IMS_REGISTRAR_CONTACT_REJECTED)
 		   )
-			sprintf(pad.s,registration_s.s,p->aor.len,p->aor.s,p,r_terminated.len,r_terminated.s);
+			reginfo_printf(registration_s.s,p->aor.len,p->aor.s,p,r_terminated.len,r_terminated.s);
 		else 
-			sprintf(pad.s,registration_s.s,p->aor.len,p->aor.s,p,r_active.len,r_active.s);
-		pad.len = strlen(pad.s);
-		STR_APPEND(buf,pad);
+			reginfo_printf(registration_s.s,p->aor.len,p->aor.s,p,r_active.len,r_active.s);
 		if (c){
 			switch(event_type){
 				case IMS_REGISTRAR_CONTACT_REGISTERED:
@@ -783,37 +927,30 @@ str r_get_reginfo_partial( void *pv,void *pc,int event_type,long *subsExpires)
 			}
 			if(c->qvalue != -1) {
                         	float q = (float)c->qvalue/1000;
-                                sprintf(pad.s,contact_s_q.s,c,r_active.len,r_active.s,r_registered.len,r_registered.s,c->expires-time_now, q);
+                                reginfo_printf(contact_s_q.s,c,r_active.len,r_active.s,r_registered.len,r_registered.s,c->expires-time_now, q);
                         }
 			else
-				sprintf(pad.s,contact_s.s,c,state.len,state.s,event.len,event.s,expires);
-			pad.len = strlen(pad.s);
-			STR_APPEND(buf,pad);							
-			STR_APPEND(buf,uri_s);
-			STR_APPEND(buf,c->uri);
-			STR_APPEND(buf,uri_e);
+				reginfo_printf(contact_s.s,c,state.len,state.s,event.len,event.s,expires);
+			reginfo_append(uri_s);
+			reginfo_append(c->uri);
+			reginfo_append(uri_e);
 			for(cp=c->parameters;cp;cp=cp->next){
-				sprintf(pad.s,unknown_param_s.s,cp->name.len,cp->name.s);
-				pad.len = strlen(pad.s);
-				STR_APPEND(buf,pad);
-				STR_APPEND(buf,cp->value);
-				STR_APPEND(buf,unknown_param_e);
+				reginfo_printf(unknown_param_s.s,cp->name.len,cp->name.s);
+				reginfo_append(cp->value);
+				reginfo_append(unknown_param_e);
 			}			
-			STR_APPEND(buf,contact_e);
-			STR_APPEND(buf,registration_e);
+			reginfo_append(contact_e);
+			reginfo_append(registration_e);
 		}
 	}
 
-	STR_APPEND(buf,r_reginfo_e);
+	reginfo_append(r_reginfo_e);
 
 	
-	x.s = pkg_malloc(buf.len+1);
-	if (x.s){
-		x.len = buf.len;
-		memcpy(x.s,buf.s,buf.len);
-		x.s[x.len]=0;		
-	}
-	return x;
+	if (reginfo_error) return 0;
+	x.s = reginfo_buf;
+	x.len = reginfo_len;
+	return new_r_reginfo(x,version_pos);
 }
 
 /**
@@ -830,27 +967,27 @@ int S_event_reg(void *pv,void *c,void *ps,int event_type,int send_now)
 {
 	r_public *p=(r_public*)pv;
 	r_subscriber *s=(r_subscriber*)ps;
-	str content={0,0};
+	r_reginfo *content=0;
 	long subsExpires=-1;
 
 	r_act_time();
 	switch (event_type){
 		case IMS_REGISTRAR_NONE:
-			if (send_now) notification_timer(0,0);
+			if (send_now) r_notify_send_now();
 			return 0;
 			break;
 		case IMS_REGISTRAR_SUBSCRIBE:
 			content = r_get_reginfo_full(p,event_type,&subsExpires);
 			r_create_notifications(p,0,s,content,subsExpires);			
-			if (content.s) pkg_free(content.s);
-			if (send_now) notification_timer(0,0);
+			if (content) r_reginfo_unref(content);
+			if (send_now) r_notify_send_now();
 			return 1;
 			break;
 		case IMS_REGISTRAR_UNSUBSCRIBE:
 			subsExpires=0;
 			r_create_notifications(p,0,s,content,subsExpires);			
-			if (content.s) pkg_free(content.s);
-			if (send_now) notification_timer(0,0);
+			if (content) r_reginfo_unref(content);
+			if (send_now) r_notify_send_now();
 			return 1;
 			break;
 			
@@ -865,14 +1002,14 @@ int S_event_reg(void *pv,void *c,void *ps,int event_type,int send_now)
 		case IMS_REGISTRAR_CONTACT_REJECTED:
 			content = r_get_reginfo_partial(p,c,event_type,&subsExpires);	
 			r_create_notifications(p,c,s,content,subsExpires);
-			if (content.s) pkg_free(content.s);
-			if (send_now) notification_timer(0,0);
+			if (content) r_reginfo_unref(content);
+			if (send_now) r_notify_send_now();
 			return 1;
 			break;
 				
 		default:
 			LOG(L_ERR,"ERR:"M_NAME":S_event_reg: Unknown event %d\n",event_type);
-			if (send_now) notification_timer(0,0);
+			if (send_now) r_notify_send_now();
 			return 0;	
 	}		
 }
@@ -909,7 +1046,7 @@ void uac_request_cb(struct cell *t,int type,struct tmcb_params *ps)
  */
 void send_notification(r_notification *n)
 {
-	str h={0,0};
+	str h={0,0},content={0,0},v;
 	int k=0;
 #ifdef SER_MOD_INTERFACE
         uac_req_t req;
@@ -949,30 +1086,46 @@ void send_notification(r_notification *n)
 		STR_APPEND(h,ctype_hdr2);
 	}
 	
+	/* the shared reginfo, with the version of this subscriber */
+	if (n->reginfo){
+		v.s = int2str(n->version,&v.len);
+		content.s = pkg_malloc(n->reginfo->content.len+v.len);
+		if (!content.s){
+			LOG(L_ERR,"ERR:"M_NAME":send_notification: Error allocating %d bytes\n",n->reginfo->content.len+v.len);
+		}else{
+			memcpy(content.s,n->reginfo->content.s,n->reginfo->version_pos);
+			content.len = n->reginfo->version_pos;
+			STR_APPEND(content,v);
+			memcpy(content.s+content.len,n->reginfo->content.s+n->reginfo->version_pos,
+				n->reginfo->content.len-n->reginfo->version_pos);
+			content.len += n->reginfo->content.len-n->reginfo->version_pos;
+		}
+	}
+	
 	//LOG(L_CRIT,"DLG:%p\n",n->dialog);
 	#ifdef WITH_IMS_PM
 		k = n->is_scscf_dereg;
 	#endif 
-	if (n->content.len)	{
+	if (content.len)	{
 #ifdef SER_MOD_INTERFACE
 		set_uac_req(&req,
 					&method,
 					&h,
-					&(n->content),
+					&content,
 					n->dialog,
 					TMCB_RESPONSE_IN|TMCB_ON_FAILURE|TMCB_LOCAL_COMPLETED,
 					uac_request_cb,
 					(void*)k);
 		tmb.t_request_within(&req);
 #else	
-		tmb.t_request_within(&method, &h, &(n->content), n->dialog, uac_request_cb, (void*)k);
+		tmb.t_request_within(&method, &h, &content, n->dialog, uac_request_cb, (void*)k);
 #endif		
 	} else { 
 #ifdef SER_MOD_INTERFACE
 		set_uac_req(&req,
 					&method,
 					0,
-					&(n->content),
+					&content,
 					n->dialog,
 					TMCB_RESPONSE_IN|TMCB_ON_FAILURE|TMCB_LOCAL_COMPLETED,
 					uac_request_cb,
@@ -983,6 +1136,7 @@ void send_notification(r_notification *n)
 #endif		
 	}
 	if (h.s) pkg_free(h.s);
+	if (content.s) pkg_free(content.s);
 	
 	#ifdef WITH_IMS_PM
 		if (n->is_scscf_dereg) IMS_PM_LOG11(UR_AttDeRegCscf,n->dialog->id.call_id,n->dialog->loc_seq.value);
@@ -995,12 +1149,15 @@ void send_notification(r_notification *n)
 /**
  * The Notification timer looks for unsent notifications and sends them.
  *  - because not all events should wait until the notifications for them are sent
+ * With notification_processes, they send the notifications as soon as they are added,
+ * so there is nothing to do here.
  * @param ticks - the current time
  * @param param - pointer to the domain_list
  */
 void notification_timer(unsigned int ticks, void* param)
 {
 	r_notification *n;
+	if (scscf_notification_processes>0) return;
 	lock_get(notification_list->lock);
 	while(notification_list->head){
 		n = notification_list->head;
@@ -1017,6 +1174,41 @@ void notification_timer(unsigned int ticks, void* param)
 }
 
 
+/**
+ * Creates a shared reginfo document.
+ * The document is copied in shm, where the notifications to all the subscribers reference it
+ * instead of each having its own copy. The creator holds the first reference.
+ * @param content - the XML, without the version
+ * @param version_pos - where the version of each subscriber goes in content
+ * @returns the r_reginfo or NULL on error
+ */
+r_reginfo* new_r_reginfo(str content,int version_pos)
+{
+	r_reginfo *r;
+	
+	r = shm_malloc(sizeof(r_reginfo)+content.len);
+	if (!r){
+		LOG(L_ERR,"ERR:"M_NAME":new_r_reginfo: Error allocating %d bytes\n",
+			(int)sizeof(r_reginfo)+content.len);
+		return 0;
+	}
+	atomic_set(&r->ref,1);
+	r->content.s = (char*)(r+1);
+	r->content.len = content.len;
+	memcpy(r->content.s,content.s,content.len);
+	r->version_pos = version_pos;
+	return r;
+}
+
+/**
+ * Drops a reference to a shared reginfo document and frees it after the last one.
+ * @param r - the reginfo
+ */
+void r_reginfo_unref(r_reginfo *r)
+{
+	if (r && atomic_dec_and_test(&r->ref)) shm_free(r);
+}
+
 
 /**
  * Creates a notification based on the given parameters
@@ -1025,16 +1217,15 @@ void notification_timer(unsigned int ticks, void* param)
  * @param subscription_state - the Subscription-State header value
  * @param event - the event
  * @param content_type - content type
- * @param content - content
+ * @param reginfo - the shared content, to take a reference to, or NULL if none
  * @param dialog - dialog to send on
+ * @param version - the reginfo version for this subscriber
  * @returns the r_notification or NULL on error
  */
 r_notification* new_r_notification(str req_uri,str uri,str subscription_state,str event,
-					str content_type,str content,dlg_t *dialog,int version)
+					str content_type,r_reginfo *reginfo,dlg_t *dialog,int version)
 {
 	r_notification *n=0;
-	str buf;	
-	char bufc[MAX_REGINFO_SIZE];
 	
 	n = shm_malloc(sizeof(r_notification));
 	if (!n){
@@ -1054,10 +1245,11 @@ r_notification* new_r_notification(str req_uri,str uri,str subscription_state,st
 	
 	STR_SHM_DUP(n->content_type,content_type,"new_r_notification");
 	
-	sprintf(bufc,content.s,version);
-	buf.s = bufc;
-	buf.len = strlen(bufc);
-	STR_SHM_DUP(n->content,buf,"new_r_notification");
+	if (reginfo){
+		atomic_inc(&reginfo->ref);
+		n->reginfo = reginfo;
+	}
+	n->version = version;
 	
 	n->dialog = dialog;
 	
@@ -1074,14 +1266,20 @@ out_of_memory:
  */
 void add_r_notification(r_notification *n)
 {
+	r_notification_list *l=notification_list;
+	
 	if (!n) return;
-	lock_get(notification_list->lock);
+	/* the notifications of a dialog always go to the same process */
+	if (scscf_notification_processes>0)
+		l += ((unsigned long)n->dialog/sizeof(dlg_t))%notification_list_cnt;
+	lock_get(l->lock);
 	n->next = 0;
-	n->prev = notification_list->tail;
-	if (notification_list->tail) notification_list->tail->next = n;
-	notification_list->tail = n;
-	if (!notification_list->head) notification_list->head = n;		
-	lock_release(notification_list->lock);
+	n->prev = l->tail;
+	if (l->tail) l->tail->next = n;
+	l->tail = n;
+	if (!l->head) l->head = n;		
+	lock_release(l->lock);
+	if (l->empty) sem_release(l->empty);
 }
 
 /**
@@ -1096,7 +1294,7 @@ void free_r_notification(r_notification *n)
 		if (n->subscription_state.s) shm_free(n->subscription_state.s);
 		if (n->event.s) shm_free(n->event.s);
 		if (n->content_type.s) shm_free(n->content_type.s);
-		if (n->content.s) shm_free(n->content.s);
+		r_reginfo_unref(n->reginfo);
 		shm_free(n);
 	}
 }
@@ -57,7 +57,9 @@
 
 #include "../../sr_module.h"
 #include "../../locking.h"
+#include "../../atomic_ops.h"
 #include "../../modules/tm/tm_load.h"
+#include <semaphore.h>
 #include "ims_pm.h"
 
 
@@ -83,6 +85,13 @@ enum {
 	IMS_REGISTRAR_CONTACT_REJECTED	 	/**< Administratively removed, user should not retry */
 }IMS_Registrar_events;
 
+/** reginfo document, rendered once per event and shared by all its notifications */
+typedef struct _r_reginfo {
+	atomic_t ref;						/**< references from the notifications and the creator */
+	str content;						/**< the XML, without the version	*/
+	int version_pos;					/**< where the version goes in content */
+} r_reginfo;
+
 /** reg event notification structure */
 typedef struct _r_notification {	
 	str req_uri;						/**< Request-URI to send to			*/
@@ -91,7 +100,8 @@ typedef struct _r_notification {
 	str event;							/**< reg event						*/
 		
 	str content_type;					/**< content type					*/
-	str content;						/**< content						*/
+	r_reginfo *reginfo;					/**< shared content, NULL if none	*/
+	int version;						/**< reginfo version for this subscriber */
 	
 	dlg_t *dialog;						/**< dialog to send on				*/
 	
@@ -108,11 +118,15 @@ typedef struct {
 	gen_lock_t *lock;					/**< lock for notifications ops		*/
 	r_notification *head;				/**< first notification in the list	*/
 	r_notification *tail;				/**< last notification in the list	*/
+	sem_t *empty;						/**< posted for each notification added, with notification_processes */
 } r_notification_list;
 
+/** rank of the first notification process, as passed to child_init */
+#define R_NOTIFY_PROCESS_RANK	2001
 
 int r_notify_init();
 void r_notify_destroy();
+int r_notify_start();
 
 
 int S_can_subscribe(struct sip_msg *msg,char *str1,char *str2);
@@ -128,8 +142,11 @@ void send_notification(r_notification *n);
 
 void notification_timer(unsigned int ticks, void* param);
 
+r_reginfo* new_r_reginfo(str content,int version_pos);
+void r_reginfo_unref(r_reginfo *r);
+
 r_notification* new_r_notification(str req_uri,str uri,str subscription_state,str event,
-					str content_type,str content,dlg_t *dialog,int version);
+					str content_type,r_reginfo *reginfo,dlg_t *dialog,int version);
 void add_r_notification(r_notification *n);
 void free_r_notification(r_notification *n);
 
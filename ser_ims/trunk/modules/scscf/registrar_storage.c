@@ -73,6 +73,11 @@
  * new_r_public changed, if its a wpsi then i give the fixed hash number (r_hash_size)
  * 				and i compile the regexp and save it in the r_public->regexp
  * 
+ * The wildcards are now matched without regcomp, through the wildcard PSI index
+ * (see wpsi_index below), updated by add_r_public and del_r_public. Those matches are
+ * anchored on the whole aor and, if more wildcards match, the longest literal prefix 
+ * wins. The wildcards that the index can not represent are still matched as regexps.
+ * 
  * 
 */
 
@@ -87,10 +92,13 @@
 
 
 #include <time.h>
+#include <ctype.h>
+#include <regex.h>
 
 #include "mod.h"
 #include "registrar_storage.h"
 #include "dlg_state.h"
+#include "s_persistency.h"
 
 
 extern struct tm_binds tmb;            /**< Structure with pointers to tm funcs 		*/
@@ -100,6 +108,50 @@ extern int scscf_support_wildcardPSI;
 int r_hash_size;						/**< Size of S-CSCF registrar hash table		*/
 r_hash_slot *registrar=0;				/**< The S-CSCF registrar 						*/
 
+/*
+ * Wildcarded PSI index
+ * 
+ * The wildcards of all the Wildcarded PSIs in the last hash slot are compiled once, 
+ * when the r_public is created, and kept in shm, so that every process can use them.
+ * They are bucketed by the first WPSI_INDEX_PREFIX characters of their literal prefix
+ * (the part before the first wildcard), so a lookup only looks at the wildcards with 
+ * the same prefix as the aor and at the few with a shorter literal prefix, instead of
+ * trying all of them. The index is protected by the lock of the last hash slot and is
+ * updated together with the slot list.
+ * Wildcards longer than WPSI_MAX_LEN or with regexp operators other than '*' and '?'
+ * can not be indexed. They are kept as regexps ('*' -> ".*", '?' -> ".?", '.' literal) 
+ * in an extra bucket and matched with regexec() as before, unanchored, when no indexed
+ * wildcard matched.
+ */
+#define WPSI_INDEX_PREFIX	8		/**< characters of the literal prefix used for bucketing	*/
+#define WPSI_INDEX_SIZE		64		/**< number of index buckets								*/
+#define WPSI_INDEX_REGEX	(WPSI_INDEX_SIZE+1)	/**< bucket of the wildcards matched as regexps	*/
+#define WPSI_MAX_LEN		256		/**< maximum length of an indexed wildcard pattern			*/
+#define WPSI_REGEX_CHARS	"^$+|()[]{}\\"	/**< regexp operators that the index does not match	*/
+
+t_regexp_unit **wpsi_index=0;		/**< wildcard buckets, then one for short prefixes and one for regexps */
+
+/*
+ * Registrar expiry index
+ * 
+ * Each hash slot keeps a timer wheel of its r_publics, filed by the earliest expiration 
+ * of their contacts and subscribers, so that registrar_timer() only visits the r_publics
+ * with something to expire instead of scanning the whole registrar on every run. A tick is
+ * R_EXPIRY_TICK seconds and an r_public due further than R_EXPIRY_WHEEL ticks away is 
+ * skipped until the wheel comes around to its tick. The wheel is protected by the lock of
+ * the slot and is kept up to date by the functions changing the contacts, the subscribers 
+ * or the registration state below. Code changing an expiration directly has to call 
+ * r_expiry_update() itself.
+ */
+
+/*
+ * Registrar journal
+ * 
+ * With the journal persistency, the functions below also mark the r_publics they change 
+ * with journal_r_public(), so that r_unlock() writes them to the journal. Code changing an
+ * r_public directly has to call journal_r_public() itself.
+ */
+
 
 time_t time_now;						/**< Current time of the S-CSCF registrar 		*/
 		
@@ -174,9 +226,19 @@ int r_storage_init(int hash_size)
 	
 	r_hash_size = hash_size;
 	registrar = shm_malloc(sizeof(r_hash_slot)*(r_hash_size+1)); // 1 slot extra for the WildPSI
+	if (!registrar) return 0;
 	memset(registrar,0,sizeof(r_hash_slot)*(r_hash_size+1));
 	
+	wpsi_index = shm_malloc(sizeof(t_regexp_unit*)*(WPSI_INDEX_REGEX+1));
+	if (!wpsi_index){
+		LOG(L_ERR,"ERR:"M_NAME":r_storage_init(): Unable to alloc %d bytes\n",
+			(int)sizeof(t_regexp_unit*)*(WPSI_INDEX_REGEX+1));
+		return 0;
+	}
+	memset(wpsi_index,0,sizeof(t_regexp_unit*)*(WPSI_INDEX_REGEX+1));
+	
 	for(i=0;i<r_hash_size+1;i++){
+		registrar[i].expiry_tick = time(0)/R_EXPIRY_TICK;
 		registrar[i].lock = lock_alloc();
 		if (!registrar[i].lock){
 			LOG(L_ERR,"ERR:"M_NAME":r_storage_init(): Error creating lock\n");
@@ -184,8 +246,6 @@ int r_storage_init(int hash_size)
 		}
 		registrar[i].lock = lock_init(registrar[i].lock);
 	}
-			
-	if (!registrar) return 0;
 	
 	return 1;
 }
@@ -205,10 +265,13 @@ void r_storage_destroy()
 				free_r_public(p);
 				p = np;
 			}
+			registrar[i].journal = 0;
 		r_unlock(i);
 		lock_dealloc(registrar[i].lock);
 	}
 	shm_free(registrar);
+	if (wpsi_index) shm_free(wpsi_index);
+	wpsi_index = 0;
 }
 
 
@@ -229,6 +292,7 @@ inline void r_lock(unsigned int hash)
  */
 inline void r_unlock(unsigned int hash)
 {
+	if (registrar[(hash)].journal) journal_registrar_flush(hash);
 	lock_release(registrar[(hash)].lock);
 	// LOG(L_CRIT,"RELEASED %d\n",hash);	
 }
@@ -320,6 +384,8 @@ r_subscriber* add_r_subscriber(r_public  *p,str subscriber,int event,int expires
 	if (p->stail) p->stail->next = s;
 	p->stail = s;
 	if (!p->shead) p->shead=s;
+	r_expiry_update(p);
+	journal_r_public(p);
 	
 	return s;
 }
@@ -345,9 +411,16 @@ r_subscriber* update_r_subscriber(r_public *p,str subscriber,int event,int* expi
 			return add_r_subscriber(p,subscriber,event,*expires,dialog);
 		else return 0;
 	}else{
-		if (expires) s->expires = *expires;
-		if (s->dialog && s->dialog!=dialog) tmb.free_dlg(s->dialog);
-		s->dialog = dialog;
+		if (expires) {
+			s->expires = *expires;
+			r_expiry_update(p);
+			journal_r_public(p);
+		}
+		if (s->dialog!=dialog) {
+			if (s->dialog) tmb.free_dlg(s->dialog);
+			s->dialog = dialog;
+			journal_r_public(p);
+		}
 		return s;
 	}
 }
@@ -369,6 +442,8 @@ void del_r_subscriber(r_public *p,r_subscriber *s)
 	if (s->dialog) tmb.free_dlg(s->dialog);
 	
 	free_r_subscriber(s);
+	r_expiry_update(p);
+	journal_r_public(p);
 }
 
 /**
@@ -633,6 +708,8 @@ r_contact* add_r_contact(r_public *p,str uri,int expires,str ua,str path,qvalue_
 	else p->tail = c;
 	if (!p->head) p->head=c;
 	c->sos_flag = sos_flag;
+	r_expiry_update(p);
+	journal_r_public(p);
 	return c;
 }
 
@@ -665,7 +742,11 @@ r_contact* update_r_contact(r_public *p,str uri,int *expires, str *ua,str *path,
 			c = add_r_contact(p,uri,*expires,*ua,*path,qvalue,(cp?*cp:0),(sos_flag?*sos_flag:0));
 		else return 0;
 	}else{
-		if (expires) c->expires = *expires;
+		if (expires) {
+			c->expires = *expires;
+			r_expiry_update(p);
+			journal_r_public(p);
+		}
 		if (ua){
 			if (c->ua.s) shm_free(c->ua.s);
 			STR_SHM_DUP(c->ua,*ua,"shm");
@@ -681,6 +762,7 @@ r_contact* update_r_contact(r_public *p,str uri,int *expires, str *ua,str *path,
 		}
 		if (sos_flag)
 			c->sos_flag = *sos_flag;
+		journal_r_public(p);
 	}
 	
 	/* Save instance id for Public GRUU if there is a +sip.instance parameter */
@@ -714,6 +796,8 @@ void del_r_contact(r_public *p,r_contact *c)
 	if (p->tail == c) p->tail = c->prev;
 	else c->next->prev = c->prev;
 	free_r_contact(c);
+	r_expiry_update(p);
+	journal_r_public(p);
 }
 
 /**
@@ -739,48 +823,228 @@ void free_r_contact(r_contact *c)
 
 void free_regexp_list(t_regexp_list **regexp);
 
-/*
- * This function just needed because for regexp * by itself has no meaning
- * it has to be .* that means any character none or more times
- *  * ->.*
- *  ? ->.  or .?  we do .? because it is more logical
- *  . -> \.
- *  and we terminate it with \0 because its for regcomp
-*/
-char *escape_all_wildcards_and_copy(str wpsi)
+/**
+ * Computes the index bucket for a string.
+ * @param s - the string, at least WPSI_INDEX_PREFIX characters long
+ * @returns the bucket
+ */
+static inline int wpsi_bucket(char *s)
 {
-	char *res;
-	int i,j,len;
-	len=1+wpsi.len; // the \0
-	j=0;
-	//first lets see how many wildcards there are to see how much space is needed
-	for (i=0;i<wpsi.len;i++)
-	{
-		switch(wpsi.s[i])
-		{
-			case '?': case '*':// case '.':
-				len++;
-				break;
-		}
+	unsigned int h=0;
+	int i;
+	for(i=0;i<WPSI_INDEX_PREFIX;i++)
+		h = h*31 + tolower((unsigned char)s[i]);
+	return h%WPSI_INDEX_SIZE;
+}
+
+/**
+ * Compiles a wildcard that the index can not represent into a regexp unit.
+ * The wildcards are escaped as regcomp() needs them: '*' -> ".*", '?' -> ".?", '.' -> "\\.".
+ * The regex_t can not be kept, as regcomp() allocates it in the memory of this process, so
+ * the regexp is only checked here and compiled again by wpsi_regex_match().
+ * @param wpsi - the wildcard as received in the profile
+ * @returns the new unit or NULL on error
+ */
+static t_regexp_unit* wpsi_compile_regex(str wpsi)
+{
+	t_regexp_unit *u;
+	regex_t exp;
+	char err[256];
+	int i,j,len,errcode;
+	
+	len = wpsi.len;
+	for(i=0;i<wpsi.len;i++)
+		if (wpsi.s[i]=='*'||wpsi.s[i]=='?'||wpsi.s[i]=='.') len++;
+	u = shm_malloc(sizeof(t_regexp_unit)+len+1);
+	if (!u){
+		LOG(L_ERR,"ERR:"M_NAME":wpsi_compile_regex(): Unable to alloc %d bytes\n",
+			(int)sizeof(t_regexp_unit)+len+1);
+		return 0;
 	}
-	res=shm_malloc(len);
-	// then do the copy
-	for (i=0;i<wpsi.len;i++)
-	{
-		switch(wpsi.s[i]) {
+	memset(u,0,sizeof(t_regexp_unit));
+	u->s = (char*)(u+1);
+	for(i=0,j=0;i<wpsi.len;i++)
+		switch(wpsi.s[i]){
 			case '.':
-				res[j++]='\\';
-				res[j++]=wpsi.s[i];
-				break;
-			case '?' : case '*':
-				res[j++]='.';
-			default :
-				res[j++]=wpsi.s[i];	
+				u->s[j++]='\\';
+				u->s[j++]='.';
 				break;
+			case '*': case '?':
+				u->s[j++]='.';
+			default:
+				u->s[j++]=wpsi.s[i];
+		}
+	u->s[j]=0;
+	u->len = j;
+	u->regex = 1;
+	u->bucket = -1;
+	
+	errcode = regcomp(&exp,u->s,REG_ICASE|REG_EXTENDED|REG_NOSUB);
+	if (errcode){
+		regerror(errcode,&exp,err,sizeof(err));
+		LOG(L_ERR,"ERR:"M_NAME":wpsi_compile_regex(): Wildcarded PSI <%.*s> is not a valid regexp (%s) - ignored\n",
+			wpsi.len,wpsi.s,err);
+		shm_free(u);
+		return 0;
+	}
+	regfree(&exp);
+	LOG(L_INFO,"INFO:"M_NAME":wpsi_compile_regex(): Wildcarded PSI <%.*s> can not be indexed - matching it as regexp %s\n",
+		wpsi.len,wpsi.s,u->s);
+	return u;
+}
+
+/**
+ * Compiles a wildcard into a regexp unit.
+ * The pattern is kept in lower-case, as matching is case insensitive.
+ * Wildcards that the index can not represent are compiled by wpsi_compile_regex().
+ * @param wpsi - the wildcard as received in the profile
+ * @returns the new unit or NULL on error
+ */
+static t_regexp_unit* wpsi_compile(str wpsi)
+{
+	t_regexp_unit *u;
+	int i;
+	
+	if (wpsi.len>WPSI_MAX_LEN) return wpsi_compile_regex(wpsi);
+	for(i=0;i<wpsi.len;i++)
+		if (wpsi.s[i] && strchr(WPSI_REGEX_CHARS,wpsi.s[i])) return wpsi_compile_regex(wpsi);
+	
+	u = shm_malloc(sizeof(t_regexp_unit)+wpsi.len+1);
+	if (!u){
+		LOG(L_ERR,"ERR:"M_NAME":wpsi_compile(): Unable to alloc %d bytes\n",
+			(int)sizeof(t_regexp_unit)+wpsi.len+1);
+		return 0;
+	}
+	memset(u,0,sizeof(t_regexp_unit));
+	u->s = (char*)(u+1);
+	u->len = wpsi.len;
+	u->prefix_len = -1;
+	for(i=0;i<wpsi.len;i++){
+		u->s[i] = tolower((unsigned char)wpsi.s[i]);
+		if (u->prefix_len<0 && (u->s[i]=='*'||u->s[i]=='?')) u->prefix_len = i;
+	}
+	u->s[wpsi.len]=0;
+	if (u->prefix_len<0) u->prefix_len = wpsi.len;
+	u->bucket = -1;
+	return u;
+}
+
+/**
+ * Matches a string against a compiled wildcard.
+ * The whole string has to match; '*' matches any string and '?' one or no character.
+ * Runs the pattern as a NFA over the string, so it is linear in the string length.
+ * @param u - the compiled wildcard
+ * @param aor - the string to match
+ * @returns 1 on match, 0 if not
+ */
+static int wpsi_match(t_regexp_unit *u,str aor)
+{
+	static char states[2][WPSI_MAX_LEN+1];
+	char *cur=states[0],*nxt=states[1],*x;
+	int i,k,any;
+	char c;
+	
+	if (aor.len<u->prefix_len || 
+		strncasecmp(aor.s,u->s,u->prefix_len)!=0) return 0;
+	if (u->prefix_len==u->len) return aor.len==u->len;
+	
+	memset(cur,0,u->len+1);
+	cur[u->prefix_len]=1;
+	for(i=u->prefix_len;i<aor.len;i++){
+		/* the wildcards may also match nothing */
+		for(k=u->prefix_len;k<u->len;k++)
+			if (cur[k] && (u->s[k]=='*'||u->s[k]=='?')) cur[k+1]=1;
+		memset(nxt,0,u->len+1);
+		c = tolower((unsigned char)aor.s[i]);
+		any=0;
+		for(k=u->prefix_len;k<u->len;k++){
+			if (!cur[k]) continue;
+			switch(u->s[k]){
+				case '*':
+					nxt[k]=1;
+					break;
+				case '?':
+					nxt[k+1]=1;
+					break;
+				default:
+					if (u->s[k]!=c) continue;
+					nxt[k+1]=1;
+			}
+			any=1;
 		}
+		if (!any) return 0;
+		x=cur;cur=nxt;nxt=x;
+	}
+	for(k=u->prefix_len;k<u->len;k++)
+		if (cur[k] && (u->s[k]=='*'||u->s[k]=='?')) cur[k+1]=1;
+	return cur[u->len];
+}
+
+/**
+ * Matches a string against a wildcard kept as regexp, as regexec() does, unanchored.
+ * @param u - the regexp unit, from wpsi_compile_regex()
+ * @param aor - the string to match
+ * @returns 1 on match, 0 if not or on error
+ */
+static int wpsi_regex_match(t_regexp_unit *u,str aor)
+{
+	regex_t exp;
+	char *c;
+	int k;
+	
+	if (regcomp(&exp,u->s,REG_ICASE|REG_EXTENDED|REG_NOSUB)!=0) return 0;
+	c = pkg_malloc(aor.len+1);
+	if (!c){
+		LOG(L_ERR,"ERR:"M_NAME":wpsi_regex_match(): Unable to alloc %d bytes\n",aor.len+1);
+		regfree(&exp);
+		return 0;
+	}
+	memcpy(c,aor.s,aor.len);
+	c[aor.len]=0;
+	k = regexec(&exp,c,0,0,0)==0;
+	pkg_free(c);
+	regfree(&exp);
+	return k;
+}
+
+/**
+ * Adds the wildcards of a Wildcarded PSI r_public to the index.
+ * \note Must be called with the lock on the last hash slot
+ * @param p - the r_public
+ */
+void wpsi_index_add(r_public *p)
+{
+	t_regexp_unit *u;
+	if (!p->regexp||!wpsi_index) return;
+	for(u=p->regexp->head;u;u=u->next){
+		if (u->bucket>=0) continue;
+		if (u->regex) u->bucket = WPSI_INDEX_REGEX;
+		else if (u->prefix_len>=WPSI_INDEX_PREFIX) u->bucket = wpsi_bucket(u->s);
+		else u->bucket = WPSI_INDEX_SIZE;
+		u->bprev = 0;
+		u->bnext = wpsi_index[u->bucket];
+		if (u->bnext) u->bnext->bprev = u;
+		wpsi_index[u->bucket] = u;
+	}
+}
+
+/**
+ * Removes the wildcards of a Wildcarded PSI r_public from the index.
+ * \note Must be called with the lock on the last hash slot
+ * @param p - the r_public
+ */
+void wpsi_index_del(r_public *p)
+{
+	t_regexp_unit *u;
+	if (!p->regexp||!wpsi_index) return;
+	for(u=p->regexp->head;u;u=u->next){
+		if (u->bucket<0) continue;
+		if (u->bprev) u->bprev->bnext = u->bnext;
+		else wpsi_index[u->bucket] = u->bnext;
+		if (u->bnext) u->bnext->bprev = u->bprev;
+		u->bnext = u->bprev = 0;
+		u->bucket = -1;
 	}
-	res[j]=0;
-	return res;
 }
 
 /**
@@ -792,18 +1056,14 @@ char *escape_all_wildcards_and_copy(str wpsi)
  * @returns - the r_public created, NULL on error
  */
  /**
-  * In case of a Wildcarded PSI, it compiles the regexp for quick processing
+  * In case of a Wildcarded PSI, it compiles the wildcards for quick processing
   */
 r_public* new_r_public(str aor, enum Reg_States reg_state, ims_subscription *s)
 {
 	r_public *p;
 	
-	/*I didn't want to make this so complicated..*/
 	t_regexp_unit *newwpsi;
-	char *temp=0;
 	int i,j;
-	//int len;
-	//int errcode;
 	
 	p = shm_malloc(sizeof(r_public));
 	if (!p){
@@ -825,9 +1085,14 @@ r_public* new_r_public(str aor, enum Reg_States reg_state, ims_subscription *s)
 		p->hash=r_hash_size;
 		/*will be in the last slot*/
 		p->regexp=shm_malloc(sizeof(t_regexp_list));
+		if (!p->regexp){
+			LOG(L_ERR,"ERR:"M_NAME":new_r_public(): Unable to alloc %d bytes\n",
+				(int)sizeof(t_regexp_list));
+			goto error;
+		}
 		p->regexp->head=NULL;
 		p->regexp->tail=NULL;
-		/*lets compile the regular expression and compile it..*/
+		/* compile each wildcard once, matching is done on the compiled form */
 		for (i=0;i<s->service_profiles_cnt;i++)
 		{
 			for (j=0;j<s->service_profiles[i].public_identities_cnt;j++)
@@ -835,35 +1100,11 @@ r_public* new_r_public(str aor, enum Reg_States reg_state, ims_subscription *s)
 				if (s->service_profiles[i].public_identities[j].wildcarded_psi.s && s->service_profiles[i].public_identities[j].wildcarded_psi.len>0)
 				 {
 					// for each wildcardpsi we add a member to the regexp list in the r_public
-					newwpsi=shm_malloc(sizeof(t_regexp_unit));
-					newwpsi->next=NULL;
-					newwpsi->prev=NULL;
-					// now we have to deal with using an external function that expects
-					// some string with a finishing \0 character
-					//len=s->service_profiles[i].public_identities[j].wildcarded_psi.len;
-					temp=escape_all_wildcards_and_copy(s->service_profiles[i].public_identities[j].wildcarded_psi);
-					//temp=shm_malloc(len+1);
-					//memcpy(temp,s->service_profiles[i].public_identities[j].wildcarded_psi.s,len);
-					//temp[len]=0;
-					LOG(L_DBG,"New_r_public : REGULAR EXPRESSION is %s\n\n",temp);
-					/*errcode=regcomp(&(newwpsi->exp),temp,REG_ICASE|REG_EXTENDED|REG_NOSUB);
-					if(errcode!=0)
-					{
-						// there was an error
-						LOG(L_DBG,"there was at least ONE error in regcomp %i\n",errcode);
-						//shm_free(temp); temp=NULL;
-						len=regerror(errcode,&(newwpsi->exp),NULL,0);
-						temp=shm_malloc(len);
-						regerror(errcode,&(newwpsi->exp),temp,len);
-						LOG(L_DBG,"and that was %s",temp);
-						shm_free(temp); temp=NULL;
-						
-						shm_free(newwpsi);
-						goto error;
-					}*/
-					newwpsi->s=temp;
-					//LOG(L_DBG,"there was NO error in regcomp\n");
-					//shm_free(temp); temp=NULL;
+					newwpsi=wpsi_compile(s->service_profiles[i].public_identities[j].wildcarded_psi);
+					if (!newwpsi) continue;
+					LOG(L_DBG,"DBG:"M_NAME":new_r_public(): Wildcarded PSI %s (literal prefix %d)\n",
+						newwpsi->s,newwpsi->prefix_len);
+					newwpsi->p=p;
 					newwpsi->prev=p->regexp->tail;
 					if (p->regexp->tail)
 					{
@@ -878,11 +1119,6 @@ r_public* new_r_public(str aor, enum Reg_States reg_state, ims_subscription *s)
 				}
 			}
 		}
-		
-		
-		
-			
-		
 	}
 	//LOG(L_DBG,"after the mess inside new_r_public\n");
 	p->aor.s = shm_malloc(aor.len); // I wonder if this should be done in the case of wildpsi
@@ -907,9 +1143,7 @@ r_public* new_r_public(str aor, enum Reg_States reg_state, ims_subscription *s)
 error:
 	if (p){
 		if (p->aor.s) shm_free(p->aor.s);
-		// free the regexp list of shit!	
 		if (p->regexp) free_regexp_list(&(p->regexp));
-		//if (temp) shm_free(temp);
 		shm_free(p);
 	}
 	//LOG(L_DBG,"new_r_public we are returning error\n");	
@@ -920,68 +1154,40 @@ error:
 
 
 /**
- * Searches in the last hash slot (Wildcarded PSI) for a match on the aor within the regular expressions
+ * Searches in the last hash slot (Wildcarded PSI) for a match on the aor within the wildcards.
+ * Only the index bucket of the aor prefix and the wildcards with short literal prefixes are 
+ * tried. If more than one matches, the one with the longest literal prefix wins. If none 
+ * does, the wildcards that could not be indexed are tried as regexps and the first match wins.
  * \note Aquires the lock on the last hash slot on success, so release it when you are done.
  * @param aor - the address of record to look for
  * @returns - the r_public found, 0 if not found
  */
-
 r_public* get_matching_wildcard_psi(str aor)
 {
-	r_public *p=0;
-	t_regexp_unit *t;
-	regex_t exp;
-	char *c,*temp;
-	int len;
-	int errcode;
-	
-	p = registrar[r_hash_size].head;
+	t_regexp_unit *u,*best=0;
 	
 	r_lock(r_hash_size);
 	
-	while (p)
-	{
-		
-		for(t=p->regexp->head;t;t=t->next)
-		{
-			LOG(L_DBG,"get_matching_wildcard_psi match %.*s with %s\n",aor.len,aor.s,t->s);
-			
-			c=shm_malloc((aor.len)+1);
-			memcpy(c,aor.s,aor.len);
-			c[aor.len]='\0';
-			
-			
-					errcode=regcomp(&(exp),t->s,REG_ICASE|REG_EXTENDED|REG_NOSUB);
-					if(errcode!=0)
-					{
-						// there was an error
-						LOG(L_DBG,"there was at least ONE error in regcomp %i\n",errcode);
-						//shm_free(temp); temp=NULL;
-						len=regerror(errcode,&(exp),NULL,0);
-						temp=shm_malloc(len);
-						regerror(errcode,&(exp),temp,len);
-						LOG(L_DBG,"and that was %s",temp);
-						shm_free(temp); temp=NULL;
-						//shm_free(newwpsi);
-						r_unlock(r_hash_size);
-						return NULL;
-					}
-					
-			
-			if (regexec(&(exp),c,0,NULL,0)==0)
-			{
-				//LOG(L_DBG,"A match has been produced!!!!!\n");
-				shm_free(c);
-				return p;
-			} else 
-			{
-				//LOG(L_ERR,"there was no match\n");
+	if (aor.len>=WPSI_INDEX_PREFIX)
+		for(u=wpsi_index[wpsi_bucket(aor.s)];u;u=u->bnext)
+			if ((!best || u->prefix_len>best->prefix_len) && wpsi_match(u,aor))
+				best = u;
+	if (!best)
+		for(u=wpsi_index[WPSI_INDEX_SIZE];u;u=u->bnext)
+			if ((!best || u->prefix_len>best->prefix_len) && wpsi_match(u,aor))
+				best = u;
+	if (!best)
+		for(u=wpsi_index[WPSI_INDEX_REGEX];u;u=u->bnext)
+			if (wpsi_regex_match(u,aor)){
+				best = u;
+				break;
 			}
-			shm_free(c);				 
-		}		
-		p=p->next;
+	if (best){
+		LOG(L_DBG,"DBG:"M_NAME":get_matching_wildcard_psi(): <%.*s> matched %s\n",
+			aor.len,aor.s,best->s);
+		return best->p;
 	}
-	LOG(L_ERR,"get_r_public (Trying wildcard PSI) found no match\n");
+	LOG(L_DBG,"DBG:"M_NAME":get_matching_wildcard_psi(): <%.*s> found no match\n",aor.len,aor.s);
 	r_unlock(r_hash_size);
 	
 	return 0;
@@ -1140,6 +1346,9 @@ r_public* add_r_public(str aor,enum Reg_States reg_state,ims_subscription *s)
 		if (p->prev) p->prev->next = p;
 		registrar[hash].tail = p;		
 		if (!registrar[hash].head) registrar[hash].head=p;
+		if (hash==r_hash_size) wpsi_index_add(p);
+		r_expiry_update(p);
+		journal_r_public(p);
 	
 	return p;
 }
@@ -1170,6 +1379,9 @@ r_public* add_r_public_previous_lock(str aor,int locked_hash,enum Reg_States reg
 			if (p->prev) p->prev->next = p;
 			registrar[hash].tail = p;
 			if (!registrar[hash].head) registrar[hash].head=p;
+			if (hash==r_hash_size) wpsi_index_add(p);
+			r_expiry_update(p);
+			journal_r_public(p);
 	return p;
 }
 
@@ -1222,7 +1434,11 @@ r_public* update_r_public(str aor,enum Reg_States *reg_state,ims_subscription **
 		else return 0;
 	}else{
 		//LOG(L_DBG,"updating a not so new r_public profile\n");		
-		if (reg_state) p->reg_state = *reg_state;
+		if (reg_state) {
+			p->reg_state = *reg_state;
+			r_expiry_update(p);
+			journal_r_public(p);
+		}
 		if (*s) {
 			
 			if (p->s){
@@ -1245,6 +1461,7 @@ r_public* update_r_public(str aor,enum Reg_States *reg_state,ims_subscription **
 			 	
 			 	 p->s=NULL; 
 			 	 			 	 
+			 	 wpsi_index_del(p);
 			 	 if (p->prev) p->prev->next=p->next;
 			 	 else registrar[r_hash_size].head=p->next;	
 			 	 if (p->next) p->next->prev=p->prev;
@@ -1274,6 +1491,7 @@ r_public* update_r_public(str aor,enum Reg_States *reg_state,ims_subscription **
 			if (p->ecf2.s) shm_free(p->ecf2.s);
 			STR_SHM_DUP(p->ecf2,*ecf2,"SHM ECF2");
 		}
+		if (*s || ccf1 || ccf2 || ecf1 || ecf2) journal_r_public(p);
 		//LOG(L_DBG,"update_r_public():    return normaly\n");
 		return p;
 	}
@@ -1321,7 +1539,11 @@ r_public* update_r_public_previous_lock(str aor,int locked_hash,enum Reg_States
 		}
 		else return 0;
 	}else{
-		if (reg_state) p->reg_state = *reg_state;
+		if (reg_state) {
+			p->reg_state = *reg_state;
+			r_expiry_update(p);
+			journal_r_public(p);
+		}
 		if (*s) {
 			if (p->s){
 				lock_get(p->s->lock);
@@ -1353,6 +1575,7 @@ r_public* update_r_public_previous_lock(str aor,int locked_hash,enum Reg_States
 			if (p->ecf2.s) shm_free(p->ecf2.s);
 			STR_SHM_DUP(p->ecf2,*ecf2,"SHM ECF2");
 		}
+		if (*s || ccf1 || ccf2 || ecf1 || ecf2) journal_r_public(p);
 		return p;
 	}
 out_of_memory:
@@ -1386,6 +1609,8 @@ void r_public_expire(str public_id)
 		r_cont->expires = expire;
 		r_cont=r_cont->next;
 	}
+	r_expiry_update(r_pub);
+	journal_r_public(r_pub);
 	
 	r_unlock(r_pub->hash);
 	print_r(L_ALERT);
@@ -1412,7 +1637,9 @@ void r_private_expire(str private_id)
 						if (p->s->private_identity.len == private_id.len &&
 							strncasecmp(p->s->private_identity.s,private_id.s,private_id.len)==0){
 								for(c=p->head;c;c=c->next)
-									c->expires = expire;								
+									c->expires = expire;
+								r_expiry_update(p);
+								journal_r_public(p);
 							}
 					lock_release(p->s->lock);
 				}
@@ -1422,6 +1649,114 @@ void r_private_expire(str private_id)
 	print_r(L_ALERT);
 }
 
+/**
+ * Removes a r_public from the expiry index of its hash slot.
+ * \note Must be called with a lock on the hash slot
+ * @param p - the r_public
+ */
+void r_expiry_del(r_public *p)
+{
+	r_public **bucket;
+	
+	if (!p->expiry_tick) return;
+	bucket = registrar[p->hash].expiry+(p->expiry_tick%R_EXPIRY_WHEEL);
+	if (p->eprev) p->eprev->enext = p->enext;
+	else *bucket = p->enext;
+	if (p->enext) p->enext->eprev = p->eprev;
+	p->enext = 0;
+	p->eprev = 0;
+	p->expiry_tick = 0;
+}
+
+/**
+ * Files a r_public in the expiry index of its hash slot, at the tick of the earliest
+ * expiration of its contacts and subscribers.
+ * A r_public left without contacts and subscribers is filed for the next tick, so that 
+ * the registrar_timer() de-registers or drops it, unless it is kept unregistered or a 
+ * timeout de-registration is already on its way.
+ * \note Must be called with a lock on the hash slot
+ * @param p - the r_public
+ */
+void r_expiry_update(r_public *p)
+{
+	r_hash_slot *slot;
+	r_contact *c;
+	r_subscriber *s;
+	time_t t=0;
+	unsigned int tick;
+	
+	if (p->hash>=r_hash_size) return;	/* the Wildcarded PSIs do not expire */
+	slot = registrar+p->hash;
+	r_pm_update(p);
+	
+	for(c=p->head;c;c=c->next)
+		if (!t || c->expires<t) t = c->expires;
+	for(s=p->shead;s;s=s->next)
+		if (!t || s->expires<t) t = s->expires;
+	
+	if (!t && (p->reg_state==UNREGISTERED || p->sar_pending)){
+		r_expiry_del(p);
+		return;
+	}
+	/* round up, as the timer expires what is due at the time of the tick */
+	tick = (t+R_EXPIRY_TICK-1)/R_EXPIRY_TICK;
+	if (tick<=slot->expiry_tick) tick = slot->expiry_tick+1;
+	if (tick==p->expiry_tick) return;
+	
+	r_expiry_del(p);
+	p->expiry_tick = tick;
+	p->eprev = 0;
+	p->enext = slot->expiry[tick%R_EXPIRY_WHEEL];
+	if (p->enext) p->enext->eprev = p;
+	slot->expiry[tick%R_EXPIRY_WHEEL] = p;
+}
+
+/**
+ * Refreshes what a r_public adds to the IMS PM counters of its hash slot.
+ * Called from r_expiry_update(), so on every change of the contacts, of the subscribers
+ * or of the registration state. Does nothing without WITH_IMS_PM.
+ * \note Must be called with a lock on the hash slot
+ * @param p - the r_public
+ */
+void r_pm_update(r_public *p)
+{
+#ifdef WITH_IMS_PM
+	r_pm_counters *pm;
+	r_contact *c;
+	r_subscriber *s;
+	
+	if (p->hash>=r_hash_size) return;
+	r_pm_drop(p);
+	pm = &(registrar[p->hash].pm);
+	if (p->head || p->reg_state!=NOT_REGISTERED) p->pm.impus = 1;
+	for(c=p->head;c;c=c->next) p->pm.contacts++;
+	for(s=p->shead;s;s=s->next) p->pm.subscribers++;
+	pm->impus += p->pm.impus;
+	pm->contacts += p->pm.contacts;
+	pm->subscribers += p->pm.subscribers;
+#endif
+}
+
+/**
+ * Takes out of the IMS PM counters of its hash slot what a r_public added to them,
+ * before it is removed from the slot. Does nothing without WITH_IMS_PM.
+ * \note Must be called with a lock on the hash slot
+ * @param p - the r_public
+ */
+void r_pm_drop(r_public *p)
+{
+#ifdef WITH_IMS_PM
+	r_pm_counters *pm;
+	
+	if (p->hash>=r_hash_size) return;
+	pm = &(registrar[p->hash].pm);
+	pm->impus -= p->pm.impus;
+	pm->contacts -= p->pm.contacts;
+	pm->subscribers -= p->pm.subscribers;
+	memset(&(p->pm),0,sizeof(r_pm_counters));
+#endif
+}
+
 /**
  * Drops and deallocates a r_public.
  * \note Don't forget to release the lock on the !!OLD!! hash value (yes, the memory is 
@@ -1432,6 +1767,10 @@ void r_private_expire(str private_id)
 void del_r_public(r_public *p)
 {
 	S_drop_all_dialogs(p->aor);
+	if (p->hash==r_hash_size) wpsi_index_del(p);
+	r_expiry_del(p);
+	r_pm_drop(p);
+	journal_r_public_delete(p);
 	if (registrar[p->hash].head == p) registrar[p->hash].head = p->next;
 	else p->prev->next = p->next;
 	if (registrar[p->hash].tail == p) registrar[p->hash].tail = p->prev;
@@ -1447,8 +1786,6 @@ void free_regexp_list(t_regexp_list **regexp)
 		while (un)
 		{
 			dos=un->next;
-			if (un->s) shm_free(un->s);
-			//if (1) regfree(&(un->exp));
 			shm_free(un);
 			un=dos;
 		}
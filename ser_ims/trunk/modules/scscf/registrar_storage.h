@@ -122,10 +122,16 @@ enum Reg_States {
 	UNREGISTERED=-1				/**< User not-registered, profile stored	*/
 } ;
 
+/** one compiled wildcard of a Wildcarded PSI - '*' matches any string, '?' one or no character */
 typedef struct _t_regexp_unit {
-	//regex_t exp; this is apearently useless
-	char *s; // it is null terminated
-	struct _t_regexp_unit *next,*prev;
+	char *s;					/**< lower-case wildcard pattern, null terminated	*/
+	int len;					/**< length of the pattern							*/
+	int prefix_len;				/**< length of the literal prefix (before any wildcard)	*/
+	int regex;					/**< if s is a regexp that the index can not match	*/
+	int bucket;					/**< wildcard PSI index bucket, -1 if not indexed	*/
+	struct _r_public *p;		/**< the wildcard PSI r_public this belongs to		*/
+	struct _t_regexp_unit *next,*prev;		/**< neighbours in the r_public list	*/
+	struct _t_regexp_unit *bnext,*bprev;	/**< neighbours in the index bucket		*/
 } t_regexp_unit;
 
 typedef struct _t_regexp_list {
@@ -134,6 +140,15 @@ typedef struct _t_regexp_list {
 } t_regexp_list;
 
 
+#ifdef WITH_IMS_PM
+/** IMS PM counters, kept per hash slot instead of counting the registrar on each timer run */
+typedef struct {
+	int impus;					/**< public identities with contacts or not de-registered	*/
+	int contacts;				/**< their contacts						*/
+	int subscribers;			/**< their reg event subscribers		*/
+} r_pm_counters;
+#endif
+
 /** registrar public identity structure */
 typedef struct _r_public {
 	unsigned int hash;			/**< the hash value 						*/
@@ -148,15 +163,33 @@ typedef struct _r_public {
 	r_contact *head,*tail;		/**< list of contacts						*/
 	r_subscriber *shead,*stail;	/**< list of subscribers attached			*/
 	
+	unsigned int expiry_tick;	/**< expiry index tick it is filed at, 0 if not indexed	*/
+	char sar_pending;			/**< if a timeout de-registration SAR is on its way	*/
+	char jdirty;				/**< if it changed since the last journal write	*/
+#ifdef WITH_IMS_PM
+	r_pm_counters pm;			/**< what this r_public adds to the slot counters	*/
+#endif
+	
 	struct _r_public *next,*prev; /**< collision hash neighbours			*/
+	struct _r_public *enext,*eprev; /**< neighbours in the expiry index bucket	*/
+	struct _r_public *jnext;	/**< next in the slot list of changed r_publics	*/
 } r_public;
 
 
+#define R_EXPIRY_TICK	10		/**< seconds per expiry index tick - the registrar_timer() interval	*/
+#define R_EXPIRY_WHEEL	64		/**< number of expiry index buckets per hash slot				*/
+
 /** S-CSCF registrar hash slot */
 typedef struct {
 	r_public *head;					/**< first slot in the table			*/
 	r_public *tail;					/**< last slot in the table				*/
 	gen_lock_t *lock;				/**< slot lock 							*/	
+	r_public *expiry[R_EXPIRY_WHEEL];/**< expiry index, r_publics by tick	*/
+	unsigned int expiry_tick;		/**< last expiry index tick processed	*/
+	r_public *journal;				/**< changed r_publics to journal		*/
+#ifdef WITH_IMS_PM
+	r_pm_counters pm;				/**< IMS PM counters of the slot		*/
+#endif
 } r_hash_slot;
 
 
@@ -218,6 +251,16 @@ r_public* update_r_public_previous_lock(str aor,int locked_hash,enum Reg_States
 void r_public_expire(str public_id);
 void r_private_expire(str private_id);
 void del_r_public(r_public *p);
+
+void r_expiry_update(r_public *p);
+
+void r_pm_update(r_public *p);
+void r_pm_drop(r_public *p);
+void r_expiry_del(r_public *p);
+
+void wpsi_index_add(r_public *p);
+void wpsi_index_del(r_public *p);
+r_public* get_matching_wildcard_psi(str aor);
 void free_r_public(r_public *p);
 
 void print_r(int log_level);
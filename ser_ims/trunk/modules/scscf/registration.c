@@ -67,6 +67,7 @@
 #include "rfc2617.h"
 #include "s_persistency.h"
 #include "ims_pm.h"
+#include "ims_pm_scscf.h"
 
 extern struct tm_binds tmb;						/**< Structure with pointers to tm funcs 		*/
 extern struct cdp_binds cdpb;					/**< Structure with pointers to cdp funcs 		*/
@@ -855,6 +856,201 @@ abort:
 }
 
 
+/**
+ * Resumes a REGISTER suspended by S_challenge_async(), processing the MAA and packing the challenge.
+ * Called by tm on the request retrieved from the transaction.
+ * @param msg - the original SIP message retrieved from the transaction
+ * @param param - the cx_async_ctx of the request
+ * @returns 1 if the script should continue in the resume route, 0 if not
+ */
+static int S_challenge_continue(struct sip_msg *msg,void *param)
+{
+	cx_async_ctx *ctx = param;
+	unsigned int aud_hash;
+	str private_identity,public_identity;
+	auth_vector *av=0;
+	
+	private_identity = cscf_get_private_identity(msg,ctx->realm);
+	public_identity = cscf_get_public_identity(msg);
+	
+	if (!S_MAA(msg,ctx->ans,public_identity,private_identity,ctx->is_sync,scscf_name_str))
+		return 0;
+	
+	av = get_auth_vector(private_identity,public_identity,AUTH_VECTOR_UNUSED,0,&aud_hash);
+	if (!av){
+		LOG(L_ERR,"ERR:"M_NAME":S_challenge_continue: Error retrieving an auth vector\n");
+		S_REGISTER_reply(msg,480,MSG_480_HSS_ERROR);
+		return 0;
+	}
+	if (!pack_challenge(msg,ctx->realm,av)){
+		S_REGISTER_reply(msg,500,MSG_500_PACK_AV);
+		auth_data_unlock(aud_hash);
+		return 0;
+	}
+	start_reg_await_timer(av);
+	auth_data_unlock(aud_hash);
+	return 1;
+}
+
+/**
+ * Transactional callback for the MAA of S_challenge_async().
+ * Runs in a Diameter worker process and resumes the suspended REGISTER.
+ * @param is_timeout - if this is a time-out
+ * @param param - the cx_async_ctx of the request
+ * @param maa - the MAA or NULL on time-out
+ */
+static void S_challenge_async_cb(int is_timeout,void *param,AAAMessage *maa)
+{
+	cx_async_ctx *ctx = param;
+	#ifdef WITH_IMS_PM
+		ims_pm_diameter_answer(maa);
+	#endif				
+	ctx->ans = maa;
+	if (tmb.t_continue(ctx->hash_index,ctx->label,ctx->route,S_challenge_continue,ctx)<0)
+		LOG(L_ERR,"ERR:"M_NAME":S_challenge_async_cb: Error resuming the REGISTER transaction %u:%u\n",
+			ctx->hash_index,ctx->label);
+	if (ctx->ans) cdpb.AAAFreeMessage(&(ctx->ans));
+	shm_free(ctx);
+}
+
+/**
+ * Challenges a REGISTER without blocking the process on the MAR.
+ * If an unused authentication vector is already available, the challenge is packed right away.
+ * Else the REGISTER transaction is suspended and the script continues in the given failure_route 
+ * once the MAA was received and the challenge packed; on errors the REGISTER is replied to.
+ * @param msg - the SIP message
+ * @param str1 - the failure_route to resume in (fixed to its index)
+ * @param str2 - the realm
+ * @returns #CSCF_RETURN_TRUE if the challenge was packed, #CSCF_RETURN_BREAK if suspended 
+ * or response sent
+ */
+int S_challenge_async(struct sip_msg *msg,char *str1,char *str2 )
+{
+	unsigned int aud_hash;
+	str realm,private_identity,public_identity,auts={0,0},nonce={0,0};
+	str authorization={0,0};
+	auth_vector *av=0;
+	int algo_type;
+	int count=av_request_at_once;
+	cx_async_ctx *ctx=0;
+	
+	LOG(L_DBG,"DBG:"M_NAME":S_challenge_async: Challenging the REGISTER...\n");
+
+	/* First check the parameters */
+	if (msg->first_line.type!=SIP_REQUEST||
+		msg->first_line.u.request.method.len!=8||
+		memcmp(msg->first_line.u.request.method.s,"REGISTER",8)!=0)
+	{
+		LOG(L_ERR,"ERR:"M_NAME":S_challenge_async: This message is not a REGISTER request\n");
+		return CSCF_RETURN_BREAK;
+	}		
+	realm.s = str2;realm.len = strlen(str2);
+	if (!realm.len) {
+		LOG(L_ERR,"ERR:"M_NAME":S_challenge_async: No realm found\n");
+		return CSCF_RETURN_BREAK;
+	}
+	private_identity = cscf_get_private_identity(msg,realm);
+	if (!private_identity.len){
+		LOG(L_ERR,"ERR:"M_NAME":S_challenge_async: No private identity specified (Authorization: username)\n");
+		S_REGISTER_reply(msg,403,MSG_403_NO_PRIVATE);
+		return CSCF_RETURN_BREAK;
+	}
+	public_identity = cscf_get_public_identity(msg);
+	if (!public_identity.len){
+		LOG(L_ERR,"ERR:"M_NAME":S_challenge_async: No public identity specified (To:)\n");
+		S_REGISTER_reply(msg,403,MSG_403_NO_PUBLIC);
+		return CSCF_RETURN_BREAK;
+	}
+	algo_type = registration_default_algorithm_type;	
+	
+	/* check if it is a synchronization request */
+	auts = cscf_get_auts(msg,realm);
+	if (auts.len){
+		LOG(L_DBG,"DBG:"M_NAME":S_challenge_async: Syncronization requested <%.*s>\n",
+			auts.len,auts.s);
+		
+		nonce = cscf_get_nonce(msg,realm);
+		if (nonce.len==0){
+			LOG(L_DBG,"L_DBG:"M_NAME":S_challenge_async: Nonce not found (Authorization: nonce)\n");
+			S_REGISTER_reply(msg,403,MSG_403_NO_NONCE);
+			return CSCF_RETURN_BREAK;
+		}
+		av = get_auth_vector(private_identity,public_identity,AUTH_VECTOR_USED,&nonce,&aud_hash);
+		if (!av)
+	    	av = get_auth_vector(private_identity,public_identity,AUTH_VECTOR_SENT,&nonce,&aud_hash);
+					
+		if (!av){
+			LOG(L_ERR,"DBG:"M_NAME":S_challenge_async: Nonce not regonized as sent, no sync!\n");			
+			auts.len = 0; auts.s=0;
+		}else{
+			av->status = AUTH_VECTOR_USELESS;
+			auth_data_unlock(aud_hash);
+			av =0;
+			count = av_request_at_sync;
+		}
+	}
+	
+	if (!auts.len){
+		/* no need to go to the HSS if we still have a vector */
+		av = get_auth_vector(private_identity,public_identity,AUTH_VECTOR_UNUSED,0,&aud_hash);
+		if (av){
+			if (!pack_challenge(msg,realm,av)){
+				S_REGISTER_reply(msg,500,MSG_500_PACK_AV);
+				auth_data_unlock(aud_hash);
+				return CSCF_RETURN_BREAK;
+			}
+			start_reg_await_timer(av);
+			auth_data_unlock(aud_hash);
+			return CSCF_RETURN_TRUE;
+		}
+	}
+
+	ctx = shm_malloc(sizeof(cx_async_ctx));
+	if (!ctx){
+		LOG(L_ERR,"ERR:"M_NAME":S_challenge_async: Error allocating %d bytes\n",(int)sizeof(cx_async_ctx));
+		S_REGISTER_reply(msg,480,MSG_480_HSS_ERROR);
+		return CSCF_RETURN_BREAK;
+	}
+	memset(ctx,0,sizeof(cx_async_ctx));
+	ctx->route = (int)(long)str1;
+	ctx->realm = realm;
+	
+	if (auts.len){
+		authorization.s = pkg_malloc(nonce.len*3/4+auts.len*3/4+8);
+		if (!authorization.s) {
+			LOG(L_ERR,"ERR:"M_NAME":S_challenge_async: Error allocating %d bytes\n",
+				nonce.len*3/4+auts.len*3/4+8);
+			goto error;
+		}
+		authorization.len = base64_to_bin(nonce.s,nonce.len,authorization.s);
+		authorization.len = RAND_LEN;
+		authorization.len += base64_to_bin(auts.s,auts.len,authorization.s+authorization.len);		
+		ctx->is_sync=1;
+	}
+	
+	if (tmb.t_suspend(msg,&(ctx->hash_index),&(ctx->label))<0){
+		LOG(L_ERR,"ERR:"M_NAME":S_challenge_async: Error suspending the REGISTER transaction\n");
+		goto error;
+	}
+	
+	if (!Cx_MAR_async(msg,public_identity,private_identity,count,auth_scheme_types[algo_type],
+			authorization,scscf_name_str,realm,S_challenge_async_cb,ctx)){
+		LOG(L_ERR,"ERR:"M_NAME":S_challenge_async: Error creating/sending MAR\n");
+		if (authorization.s) pkg_free(authorization.s);
+		shm_free(ctx);
+		S_REGISTER_reply(msg,480,MSG_480_DIAMETER_ERROR);
+		return CSCF_RETURN_BREAK;
+	}
+	if (authorization.s) pkg_free(authorization.s);
+	return CSCF_RETURN_BREAK;
+error:
+	if (authorization.s) pkg_free(authorization.s);
+	shm_free(ctx);
+	S_REGISTER_reply(msg,500,MSG_500_SUSPEND);
+	return CSCF_RETURN_BREAK;
+}
+
+
 str S_WWW_Authorization_AKA={"WWW-Authenticate: Digest realm=\"%.*s\","
 	" nonce=\"%.*s\", algorithm=%.*s, ck=\"%.*s\", ik=\"%.*s\"%.*s\r\n",106};
 str S_WWW_Authorization_MD5={"WWW-Authenticate: Digest realm=\"%.*s\","
@@ -964,21 +1160,13 @@ int S_MAR(struct sip_msg *msg, str public_identity, str private_identity,
 					int count,str auth_scheme,str nonce,str auts,str server_name,str realm)
 {
 	AAAMessage *maa;
-	AAA_AVP *auth_data;
-	int rc=-1,experimental_rc=-1;
-	auth_vector *av=0, **avlist=0;
-	int cnt,i,j;
-	int item_number;
+	str authorization={0,0};
 	int is_sync=0;
-	str authenticate={0,0},authorization={0,0},ck={0,0},ik={0,0},ip={0,0},ha1={0,0};
-	str line_identifier = {0,0};
-	str response_auth = {0, 0}, etsi_nonce={0,0},digest_realm={0,0};
-	HASHHEX ha1_hex;
-	HASHHEX result;
+	int ret;
 		
 	if (auts.len){
 		authorization.s = pkg_malloc(nonce.len*3/4+auts.len*3/4+8);
-		if (!authorization.s) goto done;
+		if (!authorization.s) return 0;
 		authorization.len = base64_to_bin(nonce.s,nonce.len,authorization.s);
 		authorization.len = RAND_LEN;
 		authorization.len += base64_to_bin(auts.s,auts.len,authorization.s+authorization.len);		
@@ -990,6 +1178,38 @@ int S_MAR(struct sip_msg *msg, str public_identity, str private_identity,
 
 	if (authorization.s) pkg_free(authorization.s);
 	
+	ret = S_MAA(msg,maa,public_identity,private_identity,is_sync,server_name);
+
+	if (maa) cdpb.AAAFreeMessage(&maa);
+	return ret;
+}
+
+/**
+ * Processes a Multimedia-Authentication-Answer, storing the authentication vectors received.
+ * Must respond with a SIP reply every time it returns 0
+ * @param msg - the SIP REGISTER message
+ * @param maa - the MAA received or NULL on time-out; not freed here
+ * @param public_identity - the public identity
+ * @param private_identity - the private identity
+ * @param is_sync - if the MAR was a synchronization
+ * @param server_name - the S-CSCF name saved on the HSS
+ * @returns 1 on success, 0 on failure
+ */
+int S_MAA(struct sip_msg *msg, AAAMessage *maa, str public_identity, str private_identity,
+					int is_sync,str server_name)
+{
+	AAA_AVP *auth_data;
+	int rc=-1,experimental_rc=-1;
+	auth_vector *av=0, **avlist=0;
+	int cnt,i,j;
+	int item_number;
+	str auth_scheme={0,0};
+	str authenticate={0,0},authorization={0,0},ck={0,0},ik={0,0},ip={0,0},ha1={0,0};
+	str line_identifier = {0,0};
+	str response_auth = {0, 0}, etsi_nonce={0,0},digest_realm={0,0};
+	HASHHEX ha1_hex;
+	HASHHEX result;
+	
 	if (!maa){
 		//TODO - add the warning code 99 in the reply	
 		S_REGISTER_reply(msg,480,MSG_480_DIAMETER_TIMEOUT);		
@@ -1075,7 +1295,7 @@ success:
 				etsi_nonce.len = authenticate.len/2;
 				etsi_nonce.s = pkg_malloc(etsi_nonce.len);
 				if (!etsi_nonce.s){
-					LOG(L_ERR,"ERR:"M_NAME":S_MAR: error allocating %d bytes\n",etsi_nonce.len);
+					LOG(L_ERR,"ERR:"M_NAME":S_MAA: error allocating %d bytes\n",etsi_nonce.len);
 					goto done;
 				}		
 				etsi_nonce.len = base16_to_bin(authenticate.s,authenticate.len,etsi_nonce.s);
@@ -1086,7 +1306,7 @@ success:
 				pkg_free(etsi_nonce.s);
 					
 				if (!response_auth.len==32 || strncasecmp(response_auth.s,result,32)){	
-					LOG(L_ERR,"ERR:"M_NAME":S_MAR: The HSS' Response-Auth is different from what we compute locally!\n"
+					LOG(L_ERR,"ERR:"M_NAME":S_MAA: The HSS' Response-Auth is different from what we compute locally!\n"
 						" BUT! If you sent an MAR with auth scheme unknown (HSS-Selected Authentication), this is normal.\n"
 						"HA1=\t|%s|\nNonce=\t|%.*s|\nMethod=\t|%.*s|\nuri=\t|%.*s|\nxresHSS=\t|%.*s|\nxresSCSCF=\t|%s|\n",
 						ha1_hex,
@@ -1120,11 +1340,10 @@ success:
 		if (!add_auth_vector(private_identity,public_identity,avlist[i])) 
 			free_auth_vector(avlist[i]);
 	
-	cdpb.AAAFreeMessage(&maa);
 	shm_free(avlist);	
 	return 1;
 done:	
-	if (maa) cdpb.AAAFreeMessage(&maa);
+	if (avlist) shm_free(avlist);
 	return 0;
 }
 
@@ -1155,6 +1374,7 @@ inline void auth_data_lock(unsigned int hash)
  */
 inline void auth_data_unlock(unsigned int hash)
 {
+	if (auth_data[(hash)].journal) journal_authdata_flush(hash);
 	lock_release(auth_data[(hash)].lock);
 //	LOG(L_CRIT,"RELEASED %d\n",hash);	
 }
@@ -1190,6 +1410,7 @@ void auth_data_destroy()
 	auth_userdata *aud,*next;
 	for(i=0;i<auth_data_hash_size;i++){
 		auth_data_lock(i);
+		auth_data[i].journal = 0;
 		lock_destroy(auth_data[i].lock);
 		lock_dealloc(auth_data[i].lock);
 		aud = auth_data[i].head;
@@ -1418,6 +1639,9 @@ auth_userdata *new_auth_userdata(str private_identity,str public_identity)
 	x->head=0;
 	x->tail=0;
 	
+	x->jdirty=0;
+	x->jnext=0;
+	
 	x->next=0;
 	x->prev=0;
 done:	
@@ -1524,6 +1748,7 @@ auth_userdata* get_auth_userdata(str private_identity,str public_identity)
 	if (!auth_data[hash].head) auth_data[hash].head = aud;
 	if (auth_data[hash].tail) auth_data[hash].tail->next = aud;
 	auth_data[hash].tail = aud;
+	journal_auth_userdata(aud);
 	
 	return aud;
 }
@@ -1560,6 +1785,7 @@ int add_auth_vector(str private_identity,str public_identity,auth_vector *av)
 	if (!aud->head) aud->head = av;
 	if (aud->tail) aud->tail->next = av;
 	aud->tail = av;
+	journal_auth_userdata(aud);
 	
 	auth_data_unlock(aud->hash);
 	return 1;
@@ -1569,6 +1795,7 @@ error:
 
 /**
  * Retrieve an authentication vector.
+ * The callers change the status of the vector returned, so its auth_userdata is marked to be journaled.
  * \note returns with a lock, so unlock it when done
  * @param private_identity - the private identity
  * @param public_identity - the public identity
@@ -1591,6 +1818,7 @@ auth_vector* get_auth_vector(str private_identity,str public_identity,int status
 						  memcmp(nonce->s,av->authenticate.s,nonce->len)==0)))
 		{
 			*hash = aud->hash;
+			journal_auth_userdata(aud);
 			return av;
 		}
 		av = av->next;
@@ -1619,6 +1847,7 @@ int drop_auth_userdata(str private_identity,str public_identity)
 		av->status = AUTH_VECTOR_USELESS;
 		av = av->next;
 	}
+	journal_auth_userdata(aud);
 	auth_data_unlock(aud->hash);
 	return 1;
 error:	
@@ -1686,6 +1915,7 @@ void reg_await_timer(unsigned int ticks, void* param)
 					if (av->next) av->next->prev = av->prev;
 					else aud->tail = av->prev;
 					free_auth_vector(av);
+					journal_auth_userdata(aud);
 				}
 				#ifdef WITH_IMS_PM
 					else{
@@ -1703,6 +1933,7 @@ void reg_await_timer(unsigned int ticks, void* param)
 				else 			
 				if (aud->expires<ticks){
 					LOG(L_DBG,"DBG:"M_NAME":reg_await_timer: ... dropping aud \n");
+					journal_auth_userdata_delete(aud);
 					if (aud->prev) aud->prev->next = aud->next;
 					else auth_data[i].head = aud->next;
 					if (aud->next) aud->next->prev = aud->prev;
@@ -58,6 +58,7 @@
 
 #include "mod.h"
 #include "../../locking.h"
+#include "../cdp/cdp_load.h"
 
 #define NONCE_LEN 16
 #define RAND_LEN  16
@@ -83,6 +84,8 @@ int S_is_authorized(struct sip_msg *msg,char *str1,char *str2 );
 
 int S_challenge(struct sip_msg *msg,char *str1,char *str2 );
 
+int S_challenge_async(struct sip_msg *msg,char *str1,char *str2 );
+
 
 enum authorization_types {
 	AUTH_UNKNOWN			= 0,
@@ -139,6 +142,9 @@ typedef struct _auth_userdata{
 	auth_vector *head;		/**< first auth vector in list	*/
 	auth_vector *tail;		/**< last auth vector in list	*/
 	
+	char jdirty;			/**< if it changed since the last journal write	*/
+	struct _auth_userdata *jnext;/**< next in the slot list of changed	*/
+	
 	struct _auth_userdata *next;/**< next element in list	*/
 	struct _auth_userdata *prev;/**< previous element in list*/
 } auth_userdata;
@@ -148,6 +154,7 @@ typedef struct {
 	auth_userdata *head;				/**< first in the slot			*/ 
 	auth_userdata *tail;				/**< last in the slot			*/
 	gen_lock_t *lock;			/**< slot lock 							*/	
+	auth_userdata *journal;		/**< changed userdata to journal		*/
 } auth_hash_slot_t;
 
 
@@ -160,6 +167,9 @@ int pack_challenge(struct sip_msg *msg,str realm,auth_vector *av);
 int S_MAR(struct sip_msg *msg, str public_identity, str private_identity,
 					int count,str auth_scheme,str nonce,str auts,str server_name,str realm);
 
+int S_MAA(struct sip_msg *msg, AAAMessage *maa, str public_identity, str private_identity,
+					int is_sync,str server_name);
+
 
 /*
  * Storage of authentication vectors
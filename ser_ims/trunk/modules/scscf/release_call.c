@@ -57,6 +57,7 @@
 
 #include "release_call.h"
 #include "sip.h"
+#include "s_persistency.h"
 
 extern struct tm_binds tmb; 
 extern dlg_func_t dialogb;	
@@ -153,6 +154,7 @@ void confirmed_response(struct cell *t,int type,struct tmcb_params *ps)
 			del_s_dialog(d);
 		} else {
 			d->state=DLG_STATE_TERMINATED_ONE_SIDE;
+			journal_s_dialog(d);
 		}		
 	} 	
 	d_unlock(hash);			 
@@ -268,9 +270,13 @@ int release_call_s(s_dialog *d,str reason)
 	}	
 	
 	o = get_s_dialog_dir_nolock(d->call_id,odir);
-	if (o && !o->is_releasing) o->is_releasing = 1;
+	if (o && !o->is_releasing) {
+		o->is_releasing = 1;
+		journal_s_dialog(o);
+	}
 		
 	d->is_releasing++;
+	journal_s_dialog(d);
 		
 	if (d->is_releasing>MAX_TIMES_TO_TRY_TO_RELEASE){
 		LOG(L_ERR,"ERR:"M_NAME":release_call_s(): had to delete silently dialog %.*s in direction %i\n",d->call_id.len,d->call_id.s,d->direction);
@@ -56,12 +56,16 @@
  */
 
 
+#include <sys/types.h>
+#include <unistd.h>
+
 #include "s_persistency.h"
 #include "bin_file.h"
 #include "bin_db_scscf.h"
 
 extern persistency_mode_t scscf_persistency_mode;/**< the type of persistency					*/
 extern char* scscf_persistency_location;		/**< where to dump the persistency data 		*/ 
+extern int scscf_persistency_load_workers;		/**< processes to load the indexed snapshots with */
 
 
 extern auth_hash_slot_t *auth_data;				/**< Authentication vector hash table 			*/
@@ -80,7 +84,611 @@ extern int* dialogs_snapshot_version;
 extern int* dialogs_step_version;
 extern int* registrar_snapshot_version;
 extern int* registrar_step_version;
-		
+
+
+/*
+ * Journal persistency
+ * 
+ * With WITH_JOURNAL, the changes between two snapshots are appended to a journal instead 
+ * of re-writting everything on each snapshot. The records changed are collected in a list 
+ * on their hash slot and are written, each one whole, when the slot is unlocked, so that 
+ * the records of one slot are journaled in the order in which they were changed. Removals
+ * are written right away, with just the key of the record. The persistency timers then 
+ * only make a new snapshot if something was journaled since the last one. The journal is
+ * rotated before the snapshot is started, so the changes made while the snapshot is 
+ * being written end up in the new journal (and maybe also in the snapshot, which is fine,
+ * as re-applying a record is harmless). On load, the last snapshot is loaded and then the
+ * journals written after it are replayed.
+ */
+static bin_journal authdata_journal;		/**< journal of the authorization data			*/
+static bin_journal dialogs_journal;			/**< journal of the dialogs						*/
+static bin_journal registrar_journal;		/**< journal of the registrar					*/
+
+/**
+ * Initializes the journals.
+ * \note Must be called from mod_init, before the snapshots are loaded
+ * @returns 1 on success or 0 on failure
+ */
+int persistency_journal_init()
+{
+	if (!bin_journal_init(&authdata_journal,scscf_persistency_location,"sauthdata")) return 0;
+	if (!bin_journal_init(&dialogs_journal,scscf_persistency_location,"sdialogs")) return 0;
+	if (!bin_journal_init(&registrar_journal,scscf_persistency_location,"sregistrar")) return 0;
+	return 1;
+}
+
+
+/**
+ * Marks an authorization userdata as changed, to be journaled on auth_data_unlock().
+ * \note Must be called with a lock on the hash slot
+ * @param aud - the userdata changed
+ */
+void journal_auth_userdata(auth_userdata *aud)
+{
+	if (scscf_persistency_mode!=WITH_JOURNAL || aud->jdirty) return;
+	aud->jdirty = 1;
+	aud->jnext = auth_data[aud->hash].journal;
+	auth_data[aud->hash].journal = aud;
+}
+
+/**
+ * Journals the removal of an authorization userdata.
+ * \note Must be called with a lock on the hash slot, before dropping it
+ * @param aud - the userdata to be removed
+ */
+void journal_auth_userdata_delete(auth_userdata *aud)
+{
+	bin_data x={0,0,0};
+	auth_userdata **q;
+	
+	if (scscf_persistency_mode!=WITH_JOURNAL) return;
+	if (aud->jdirty){
+		for(q=&(auth_data[aud->hash].journal);*q;q=&((*q)->jnext))
+			if (*q==aud){
+				*q = aud->jnext;
+				break;
+			}
+		aud->jdirty = 0;
+		aud->jnext = 0;
+	}
+	if (!bin_alloc(&x,256)) return;
+	if (bin_encode_auth_userdata_delta(&x,aud,BIN_DELTA_DELETE))
+		bin_journal_append(&authdata_journal,scscf_persistency_location,&x);
+	bin_free(&x);
+}
+
+/**
+ * Writes to the journal the authorization userdata changed in a hash slot.
+ * \note Must be called with a lock on the hash slot
+ * @param hash - the hash slot
+ */
+void journal_authdata_flush(unsigned int hash)
+{
+	bin_data x={0,0,0};
+	auth_userdata *aud;
+	int ok;
+	
+	ok = bin_alloc(&x,1024);
+	while(auth_data[hash].journal){
+		aud = auth_data[hash].journal;
+		auth_data[hash].journal = aud->jnext;
+		aud->jdirty = 0;
+		aud->jnext = 0;
+		if (ok) ok = bin_encode_auth_userdata_delta(&x,aud,BIN_DELTA_UPSERT);
+	}
+	if (ok) bin_journal_append(&authdata_journal,scscf_persistency_location,&x);
+	else LOG(L_ERR,"ERR:"M_NAME":journal_authdata_flush: error encoding the changes of slot %d - not journaled\n",hash);
+	if (x.s) bin_free(&x);
+}
+
+/**
+ * Applies a journal record to the authorization data.
+ * @param op - BIN_DELTA_UPSERT or BIN_DELTA_DELETE
+ * @param d - the content of the record
+ * @returns 1 on success or 0 on failure
+ */
+static int journal_apply_authdata(char op,bin_data *d)
+{
+	auth_userdata *aud=0,*o;
+	str private_identity,public_identity;
+	unsigned int hash;
+	
+	if (op==BIN_DELTA_DELETE){
+		if (!bin_decode_str(d,&private_identity)||
+			!bin_decode_str(d,&public_identity)) return 0;
+		hash = get_hash_auth(private_identity,public_identity);
+	}else{
+		aud = bin_decode_auth_userdata(d);
+		if (!aud) return 0;
+		private_identity = aud->private_identity;
+		public_identity = aud->public_identity;
+		hash = aud->hash;
+	}
+	auth_data_lock(hash);
+	for(o=auth_data[hash].head;o;o=o->next)
+		if (o->private_identity.len == private_identity.len &&
+			o->public_identity.len == public_identity.len &&
+			memcmp(o->private_identity.s,private_identity.s,private_identity.len)==0 &&
+			memcmp(o->public_identity.s,public_identity.s,public_identity.len)==0) break;
+	if (o){
+		if (o->prev) o->prev->next = o->next;
+		else auth_data[hash].head = o->next;
+		if (o->next) o->next->prev = o->prev;
+		else auth_data[hash].tail = o->prev;
+		free_auth_userdata(o);
+	}
+	if (aud){
+		aud->prev = auth_data[hash].tail;
+		aud->next = 0;
+		if (auth_data[hash].tail) auth_data[hash].tail->next = aud;
+		auth_data[hash].tail = aud;
+		if (!auth_data[hash].head) auth_data[hash].head = aud;
+	}
+	auth_data_unlock(hash);
+	return 1;
+}
+
+
+/**
+ * Marks a dialog as changed, to be journaled on d_unlock().
+ * \note Must be called with a lock on the hash slot
+ * @param d - the dialog changed
+ */
+void journal_s_dialog(s_dialog *d)
+{
+	if (scscf_persistency_mode!=WITH_JOURNAL || d->jdirty) return;
+	d->jdirty = 1;
+	d->jnext = s_dialogs[d->hash].journal;
+	s_dialogs[d->hash].journal = d;
+}
+
+/**
+ * Journals the removal of a dialog.
+ * \note Must be called with a lock on the hash slot, before dropping it
+ * @param d - the dialog to be removed
+ */
+void journal_s_dialog_delete(s_dialog *d)
+{
+	bin_data x={0,0,0};
+	s_dialog **q;
+	
+	if (scscf_persistency_mode!=WITH_JOURNAL) return;
+	if (d->jdirty){
+		for(q=&(s_dialogs[d->hash].journal);*q;q=&((*q)->jnext))
+			if (*q==d){
+				*q = d->jnext;
+				break;
+			}
+		d->jdirty = 0;
+		d->jnext = 0;
+	}
+	if (!bin_alloc(&x,256)) return;
+	if (bin_encode_s_dialog_delta(&x,d,BIN_DELTA_DELETE))
+		bin_journal_append(&dialogs_journal,scscf_persistency_location,&x);
+	bin_free(&x);
+}
+
+/**
+ * Writes to the journal the dialogs changed in a hash slot.
+ * \note Must be called with a lock on the hash slot
+ * @param hash - the hash slot
+ */
+void journal_dialogs_flush(unsigned int hash)
+{
+	bin_data x={0,0,0};
+	s_dialog *d;
+	int ok;
+	
+	ok = bin_alloc(&x,1024);
+	while(s_dialogs[hash].journal){
+		d = s_dialogs[hash].journal;
+		s_dialogs[hash].journal = d->jnext;
+		d->jdirty = 0;
+		d->jnext = 0;
+		if (ok) ok = bin_encode_s_dialog_delta(&x,d,BIN_DELTA_UPSERT);
+	}
+	if (ok) bin_journal_append(&dialogs_journal,scscf_persistency_location,&x);
+	else LOG(L_ERR,"ERR:"M_NAME":journal_dialogs_flush: error encoding the changes of slot %d - not journaled\n",hash);
+	if (x.s) bin_free(&x);
+}
+
+/**
+ * Applies a journal record to the dialogs.
+ * @param op - BIN_DELTA_UPSERT or BIN_DELTA_DELETE
+ * @param x - the content of the record
+ * @returns 1 on success or 0 on failure
+ */
+static int journal_apply_dialogs(char op,bin_data *x)
+{
+	s_dialog *d=0,*o;
+	str call_id;
+	char c;
+	enum s_dialog_direction dir;
+	unsigned int hash;
+	
+	if (op==BIN_DELTA_DELETE){
+		if (!bin_decode_str(x,&call_id)||
+			!bin_decode_char(x,&c)) return 0;
+		dir = c;
+		hash = get_s_dialog_hash(call_id);
+	}else{
+		d = bin_decode_s_dialog(x);
+		if (!d) return 0;
+		call_id = d->call_id;
+		dir = d->direction;
+		hash = d->hash;
+	}
+	d_lock(hash);
+	o = get_s_dialog_dir_nolock(call_id,dir);
+	if (o){
+		if (o->prev) o->prev->next = o->next;
+		else s_dialogs[hash].head = o->next;
+		if (o->next) o->next->prev = o->prev;
+		else s_dialogs[hash].tail = o->prev;
+		free_s_dialog(o);
+		/* free_s_dialog() uncounted it; a replacement takes its place in the count */
+		if (d) s_dialog_count_increment();
+	}else if (d){
+		/* a new dialog, counted as new_s_dialog() does */
+		s_dialog_count_increment();
+	}
+	if (d){
+		d->prev = s_dialogs[hash].tail;
+		d->next = 0;
+		if (s_dialogs[hash].tail) s_dialogs[hash].tail->next = d;
+		s_dialogs[hash].tail = d;
+		if (!s_dialogs[hash].head) s_dialogs[hash].head = d;
+	}
+	d_unlock(hash);
+	return 1;
+}
+
+
+/**
+ * Marks a r_public as changed, to be journaled on r_unlock().
+ * The Wildcarded PSIs are not journaled, as they are not in the snapshots either.
+ * \note Must be called with a lock on the hash slot
+ * @param p - the r_public changed
+ */
+void journal_r_public(r_public *p)
+{
+	if (scscf_persistency_mode!=WITH_JOURNAL || p->jdirty || p->hash>=r_hash_size) return;
+	p->jdirty = 1;
+	p->jnext = registrar[p->hash].journal;
+	registrar[p->hash].journal = p;
+}
+
+/**
+ * Journals the removal of a r_public.
+ * \note Must be called with a lock on the hash slot, before dropping it
+ * @param p - the r_public to be removed
+ */
+void journal_r_public_delete(r_public *p)
+{
+	bin_data x={0,0,0};
+	r_public **q;
+	
+	if (scscf_persistency_mode!=WITH_JOURNAL || p->hash>=r_hash_size) return;
+	if (p->jdirty){
+		for(q=&(registrar[p->hash].journal);*q;q=&((*q)->jnext))
+			if (*q==p){
+				*q = p->jnext;
+				break;
+			}
+		p->jdirty = 0;
+		p->jnext = 0;
+	}
+	if (!bin_alloc(&x,256)) return;
+	if (bin_encode_r_public_delta(&x,p,BIN_DELTA_DELETE))
+		bin_journal_append(&registrar_journal,scscf_persistency_location,&x);
+	bin_free(&x);
+}
+
+/**
+ * Writes to the journal the r_publics changed in a hash slot.
+ * \note Must be called with a lock on the hash slot
+ * @param hash - the hash slot
+ */
+void journal_registrar_flush(unsigned int hash)
+{
+	bin_data x={0,0,0};
+	r_public *p;
+	int ok;
+	
+	ok = bin_alloc(&x,1024);
+	while(registrar[hash].journal){
+		p = registrar[hash].journal;
+		registrar[hash].journal = p->jnext;
+		p->jdirty = 0;
+		p->jnext = 0;
+		if (ok) ok = bin_encode_r_public_delta(&x,p,BIN_DELTA_UPSERT);
+	}
+	if (ok) bin_journal_append(&registrar_journal,scscf_persistency_location,&x);
+	else LOG(L_ERR,"ERR:"M_NAME":journal_registrar_flush: error encoding the changes of slot %d - not journaled\n",hash);
+	if (x.s) bin_free(&x);
+}
+
+/**
+ * Applies a journal record to the registrar.
+ * @param op - BIN_DELTA_UPSERT or BIN_DELTA_DELETE
+ * @param d - the content of the record
+ * @returns 1 on success or 0 on failure
+ */
+static int journal_apply_registrar(char op,bin_data *d)
+{
+	r_public *p=0,*o;
+	str aor;
+	unsigned int hash;
+	
+	if (op==BIN_DELTA_DELETE){
+		if (!bin_decode_str(d,&aor)) return 0;
+		hash = get_aor_hash(aor,r_hash_size);
+	}else{
+		p = bin_decode_r_public(d);
+		if (!p) return 0;
+		aor = p->aor;
+		hash = p->hash;
+	}
+	r_lock(hash);
+	for(o=registrar[hash].head;o;o=o->next)
+		if (o->aor.len == aor.len &&
+			strncasecmp(o->aor.s,aor.s,aor.len)==0) break;
+	if (o){
+		r_expiry_del(o);
+		r_pm_drop(o);
+		if (o->prev) o->prev->next = o->next;
+		else registrar[hash].head = o->next;
+		if (o->next) o->next->prev = o->prev;
+		else registrar[hash].tail = o->prev;
+		free_r_public(o);
+	}
+	if (p){
+		p->prev = registrar[hash].tail;
+		p->next = 0;
+		if (registrar[hash].tail) registrar[hash].tail->next = p;
+		registrar[hash].tail = p;
+		if (!registrar[hash].head) registrar[hash].head = p;
+		r_expiry_update(p);
+	}
+	r_unlock(hash);
+	return 1;
+}
+
+
+/**
+ * Encodes a hash slot of the authorization data for a snapshot.
+ * @param x - binary data to append to
+ * @param i - the hash slot
+ * @returns 1 on success or 0 on failure
+ */
+static int snapshot_authdata_slot(bin_data *x,int i)
+{
+	auth_userdata *aud;
+	
+	auth_data_lock(i);
+	for(aud=auth_data[i].head;aud;aud=aud->next)
+		if (!bin_encode_auth_userdata(x,aud)) break;
+	auth_data_unlock(i);
+	return aud==0;
+}
+
+/**
+ * Encodes a hash slot of the dialogs for a snapshot.
+ * @param x - binary data to append to
+ * @param i - the hash slot
+ * @returns 1 on success or 0 on failure
+ */
+static int snapshot_dialogs_slot(bin_data *x,int i)
+{
+	s_dialog *d;
+	
+	d_lock(i);
+	for(d=s_dialogs[i].head;d;d=d->next)
+		if (!bin_encode_s_dialog(x,d)) break;
+	d_unlock(i);
+	return d==0;
+}
+
+/**
+ * Encodes a hash slot of the registrar for a snapshot.
+ * @param x - binary data to append to
+ * @param i - the hash slot
+ * @returns 1 on success or 0 on failure
+ */
+static int snapshot_registrar_slot(bin_data *x,int i)
+{
+	r_public *p;
+	
+	r_lock(i);
+	for(p=registrar[i].head;p;p=p->next)
+		if (!bin_encode_r_public(x,p)) break;
+	r_unlock(i);
+	return p==0;
+}
+
+
+/*
+ * Indexed snapshots
+ * 
+ * The file snapshots end with an index of the hash slots (see bind_dump_to_file_index()), 
+ * so on start-up they are mapped in memory and the slots are decoded and inserted by 
+ * scscf_persistency_load_workers processes in parallel, from mod_init, before the SIP 
+ * processes are forked. The hash tables are in shm, so what the workers load stays after 
+ * they exit. Snapshots written before the index are still loaded sequentially.
+ */
+
+/**
+ * Loads an indexed snapshot.
+ * If a worker fails, what the others loaded is dropped, so that the snapshot can be
+ * loaded again sequentially.
+ * @param fname - the snapshot name
+ * @param load_slot - the function to load a slot with
+ * @param unload - the function to drop the loaded records with
+ * @returns 1 on success or -1 if the snapshot has no index or the parallel load failed
+ */
+static int load_snapshot_indexed(char *fname,int (*load_slot)(bin_data *x),void (*unload)())
+{
+	char *map;
+	size_t len;
+	int k;
+	
+	map = bin_load_from_file_map(scscf_persistency_location,fname,&len);
+	if (!map) return -1;
+	k = bin_load_from_file_indexed(map,len,scscf_persistency_load_workers,load_slot);
+	bin_load_from_file_unmap(map,len);
+	if (k==-2) return -1;
+	if (k<0){
+		LOG(L_ERR,"ERR:"M_NAME":load_snapshot_indexed: parallel load of %s failed - loading it sequentially\n",
+			fname);
+		unload();
+		return -1;
+	}
+	return 1;
+}
+
+/**
+ * Decodes and inserts the authorization data of an indexed snapshot slot.
+ * @param x - the records of the slot
+ * @returns the number of records loaded or -1 on error
+ */
+static int load_slot_authdata(bin_data *x)
+{
+	auth_userdata *aud;
+	int cnt=0;
+	
+	while(x->max<x->len){
+		aud = bin_decode_auth_userdata(x);
+		if (!aud) return -1;
+		LOG(L_DBG,"DBG:"M_NAME":load_slot_authdata: Loaded auth_userdata for <%.*s>\n",aud->private_identity.len,aud->private_identity.s);
+		auth_data_lock(aud->hash);
+		aud->prev = auth_data[aud->hash].tail;
+		aud->next = 0;
+		if (auth_data[aud->hash].tail) auth_data[aud->hash].tail->next = aud;
+		auth_data[aud->hash].tail = aud;
+		if (!auth_data[aud->hash].head) auth_data[aud->hash].head = aud;
+		auth_data_unlock(aud->hash);
+		cnt++;
+	}
+	return cnt;
+}
+
+/**
+ * Decodes and inserts the dialogs of an indexed snapshot slot.
+ * @param x - the records of the slot
+ * @returns the number of records loaded or -1 on error
+ */
+static int load_slot_dialogs(bin_data *x)
+{
+	s_dialog *d;
+	int cnt=0;
+	
+	while(x->max<x->len){
+		d = bin_decode_s_dialog(x);
+		if (!d) return -1;
+		LOG(L_DBG,"DBG:"M_NAME":load_slot_dialogs: Loaded s_dialog for <%.*s>\n",d->aor.len,d->aor.s);
+		d_lock(d->hash);
+		d->prev = s_dialogs[d->hash].tail;
+		d->next = 0;
+		if (s_dialogs[d->hash].tail) s_dialogs[d->hash].tail->next = d;
+		s_dialogs[d->hash].tail = d;
+		if (!s_dialogs[d->hash].head) s_dialogs[d->hash].head = d;
+		d_unlock(d->hash);
+		/* counted as new_s_dialog() does, free_s_dialog() uncounts it */
+		s_dialog_count_increment();
+		cnt++;
+	}
+	return cnt;
+}
+
+/**
+ * Decodes and inserts the registrar records of an indexed snapshot slot.
+ * @param x - the records of the slot
+ * @returns the number of records loaded or -1 on error
+ */
+static int load_slot_registrar(bin_data *x)
+{
+	r_public *p;
+	int cnt=0;
+	
+	while(x->max<x->len){
+		p = bin_decode_r_public(x);
+		if (!p) return -1;
+		LOG(L_DBG,"DBG:"M_NAME":load_slot_registrar: Loaded r_public for <%.*s>\n",p->aor.len,p->aor.s);
+		r_lock(p->hash);
+		p->prev = registrar[p->hash].tail;
+		p->next = 0;
+		if (registrar[p->hash].tail) registrar[p->hash].tail->next = p;
+		registrar[p->hash].tail = p;
+		if (!registrar[p->hash].head) registrar[p->hash].head = p;
+		r_expiry_update(p);
+		r_unlock(p->hash);
+		cnt++;
+	}
+	return cnt;
+}
+
+
+/**
+ * Drops the authorization data loaded by a failed parallel load.
+ */
+static void unload_authdata()
+{
+	auth_userdata *aud,*next;
+	int i;
+	
+	for(i=0;i<auth_data_hash_size;i++){
+		auth_data_lock(i);
+		for(aud=auth_data[i].head;aud;aud=next){
+			next = aud->next;
+			free_auth_userdata(aud);
+		}
+		auth_data[i].head = 0;
+		auth_data[i].tail = 0;
+		auth_data_unlock(i);
+	}
+}
+
+/**
+ * Drops the dialogs loaded by a failed parallel load.
+ */
+static void unload_dialogs()
+{
+	s_dialog *d,*next;
+	int i;
+	
+	for(i=0;i<s_dialogs_hash_size;i++){
+		d_lock(i);
+		for(d=s_dialogs[i].head;d;d=next){
+			next = d->next;
+			free_s_dialog(d);
+		}
+		s_dialogs[i].head = 0;
+		s_dialogs[i].tail = 0;
+		d_unlock(i);
+	}
+}
+
+/**
+ * Drops the registrar records loaded by a failed parallel load.
+ */
+static void unload_registrar()
+{
+	r_public *p,*next;
+	int i;
+	
+	for(i=0;i<=r_hash_size;i++){
+		r_lock(i);
+		for(p=registrar[i].head;p;p=next){
+			next = p->next;
+			r_expiry_del(p);
+			r_pm_drop(p);
+			free_r_public(p);
+		}
+		registrar[i].head = 0;
+		registrar[i].tail = 0;
+		r_unlock(i);
+	}
+}
 
 /**
  * Creates a snapshots of the authorization data and then calls the dumping function.
@@ -88,7 +696,7 @@ extern int* registrar_step_version;
  */
 int make_snapshot_authdata()
 {
-	bin_data x={0,0,0};
+	bin_data x={0,0,0},index={0,0,0};
 	auth_userdata *aud;
 	int i,k;
 	time_t unique = time(0);
@@ -98,32 +706,37 @@ int make_snapshot_authdata()
 		case NO_PERSISTENCY:			
 			return 0;
 
+		case WITH_JOURNAL:
+			/* nothing changed since the last snapshot */
+			if (!bin_journal_size(&authdata_journal,scscf_persistency_location) &&
+				bin_load_from_file_unique(scscf_persistency_location,"sauthdata")) return 1;
+			unique = bin_journal_rotate(&authdata_journal);
+			
 		case WITH_FILES:
 			f = bin_dump_to_file_create(scscf_persistency_location,"sauthdata",unique);
 			if (!f) return 0;
+			if (!bin_alloc(&index,1024)) goto error;
 			
 			for(i=0;i<auth_data_hash_size;i++){
+				if (!auth_data[i].head) continue;
 				if (!bin_alloc(&x,1024)) goto error;
-				auth_data_lock(i);
-				aud = auth_data[i].head;
-				if (aud){
-					while(aud){
-						if (!bin_encode_auth_userdata(&x,aud)) goto error;
-						aud = aud->next;
-					}
-					auth_data_unlock(i);
-					k = bind_dump_to_file_append(f,&x);
-					if (k!=x.len) {
-						LOG(L_ERR,"ERR:"M_NAME":make_snapshot_authdata: error while dumping to file - only wrote %d bytes of %d \n",k,x.len);
-						auth_data_unlock(i);
-						bin_free(&x);
-						return 0;
-					} 					
-				}
-				else auth_data_unlock(i);
+				if (!snapshot_authdata_slot(&x,i)) goto error;
+				k = bind_dump_to_file_append_slot(f,&x,&index,i);
+				if (k!=x.len) {
+					LOG(L_ERR,"ERR:"M_NAME":make_snapshot_authdata: error while dumping to file - only wrote %d bytes of %d \n",k,x.len);
+					bin_free(&x);
+					bin_free(&index);
+					return 0;
+				} 					
 				bin_free(&x);
 			}
-			return bind_dump_to_file_close(f,scscf_persistency_location,"sauthdata",unique);
+			k = bind_dump_to_file_index(f,&index);
+			bin_free(&index);
+			if (!k) return 0;
+			k = bind_dump_to_file_close(f,scscf_persistency_location,"sauthdata",unique);
+			if (k && scscf_persistency_mode==WITH_JOURNAL)
+				bin_journal_cleanup(scscf_persistency_location,"sauthdata",unique);
+			return k;
 
 			break;
 			
@@ -150,6 +763,7 @@ int make_snapshot_authdata()
 	}	
 error:
 	if (x.s) bin_free(&x);	
+	if (index.s) bin_free(&index);
 	return 0;
 }
   
@@ -163,17 +777,35 @@ int load_snapshot_authdata()
 	bin_data x;
 	auth_userdata *aud;
 	int k,max;
+	unsigned int unique=0;
 	FILE *f;
+	long left;
 
 	switch (scscf_persistency_mode){
 		case NO_PERSISTENCY:
 			k=0;
 
+		case WITH_JOURNAL:
+			/* the journals alone, if there was no snapshot yet */
+			unique = bin_load_from_file_unique(scscf_persistency_location,"sauthdata");
+			if (!unique){
+				k = 1;
+				break;
+			}
+			
 		case WITH_FILES:
+			k = load_snapshot_indexed("sauthdata",load_slot_authdata,unload_authdata);
+			if (k>=0) break;
 			f = bin_load_from_file_open(scscf_persistency_location,"sauthdata");		
 			if (!f) return 0;
+			/* stop at the slot index, it is not made of records */
+			left = bin_load_from_file_records(f);
+			if (left<0){
+				bin_load_from_file_close(f);
+				return 0;
+			}
 			bin_alloc(&x,128*1024);
-			k=bin_load_from_file_read(f,&x);
+			k=bin_load_from_file_read_records(f,&x,&left);
 			max = x.max;
 			x.max=0;
 			LOG(L_INFO,"INFO:"M_NAME":load_snapshot_authdata: max %d len %d\n",x.max,x.len);
@@ -192,7 +824,7 @@ int load_snapshot_authdata()
 				memmove(x.s,x.s+x.max,x.len-x.max);
 				x.len -= x.max;
 				x.max = max;
-				k=bin_load_from_file_read(f,&x);
+				k=bin_load_from_file_read_records(f,&x,&left);
 				max = x.max;
 				x.max = 0;				
 			}
@@ -228,6 +860,8 @@ int load_snapshot_authdata()
 			LOG(L_ERR,"ERR:"M_NAME":load_snapshot_authdata: Can't resume because no such mode %d\n",scscf_persistency_mode);
 			k=0;
 	}	
+	if (k && scscf_persistency_mode==WITH_JOURNAL)
+		k = bin_journal_replay(scscf_persistency_location,"sauthdata",unique,journal_apply_authdata);
 	if (!k) goto error;
 	
 	
@@ -256,7 +890,7 @@ void persistency_timer_authdata(unsigned int ticks, void* param)
  */
 int make_snapshot_dialogs()
 {
-	bin_data x={0,0,0};
+	bin_data x={0,0,0},index={0,0,0};
 	s_dialog *d;
 	int i,k;
 	time_t unique = time(0);
@@ -266,33 +900,37 @@ int make_snapshot_dialogs()
 		case NO_PERSISTENCY:			
 			return 0;
 
+		case WITH_JOURNAL:
+			/* nothing changed since the last snapshot */
+			if (!bin_journal_size(&dialogs_journal,scscf_persistency_location) &&
+				bin_load_from_file_unique(scscf_persistency_location,"sdialogs")) return 1;
+			unique = bin_journal_rotate(&dialogs_journal);
+			
 		case WITH_FILES:
 			f = bin_dump_to_file_create(scscf_persistency_location,"sdialogs",unique);
 			if (!f) return 0;
+			if (!bin_alloc(&index,1024)) goto error;
 			
 			for(i=0;i<s_dialogs_hash_size;i++){
+				if (!s_dialogs[i].head) continue;
 				if (!bin_alloc(&x,1024)) goto error;
-				d_lock(i);
-				d = s_dialogs[i].head;
-				d_unlock(i);
-				if (d){
-					while(d){
-						if (!bin_encode_s_dialog(&x,d)) goto error;
-						d = d->next;
-					}
-					d_unlock(i);
-					k = bind_dump_to_file_append(f,&x);
-					if (k!=x.len) {
-						LOG(L_ERR,"ERR:"M_NAME":make_snapshot_dialogs: error while dumping to file - only wrote %d bytes of %d \n",k,x.len);
-						d_unlock(i);
-						bin_free(&x);
-						return 0;
-					} 					
-				}
-				else d_unlock(i);
+				if (!snapshot_dialogs_slot(&x,i)) goto error;
+				k = bind_dump_to_file_append_slot(f,&x,&index,i);
+				if (k!=x.len) {
+					LOG(L_ERR,"ERR:"M_NAME":make_snapshot_dialogs: error while dumping to file - only wrote %d bytes of %d \n",k,x.len);
+					bin_free(&x);
+					bin_free(&index);
+					return 0;
+				} 					
 				bin_free(&x);
 			}
-			return bind_dump_to_file_close(f,scscf_persistency_location,"sdialogs",unique);
+			k = bind_dump_to_file_index(f,&index);
+			bin_free(&index);
+			if (!k) return 0;
+			k = bind_dump_to_file_close(f,scscf_persistency_location,"sdialogs",unique);
+			if (k && scscf_persistency_mode==WITH_JOURNAL)
+				bin_journal_cleanup(scscf_persistency_location,"sdialogs",unique);
+			return k;
 
 			break;
 			
@@ -319,6 +957,7 @@ int make_snapshot_dialogs()
 	}	
 error:
 	if (x.s) bin_free(&x);		
+	if (index.s) bin_free(&index);
 	return 0;
 }  
 
@@ -331,17 +970,35 @@ int load_snapshot_dialogs()
 	bin_data x;
 	s_dialog *d;
 	int k,max;
+	unsigned int unique=0;
 	FILE *f;
+	long left;
 
 	switch (scscf_persistency_mode){
 		case NO_PERSISTENCY:
 			k=0;
 
+		case WITH_JOURNAL:
+			/* the journals alone, if there was no snapshot yet */
+			unique = bin_load_from_file_unique(scscf_persistency_location,"sdialogs");
+			if (!unique){
+				k = 1;
+				break;
+			}
+			
 		case WITH_FILES:
+			k = load_snapshot_indexed("sdialogs",load_slot_dialogs,unload_dialogs);
+			if (k>=0) break;
 			f = bin_load_from_file_open(scscf_persistency_location,"sdialogs");		
 			if (!f) return 0;
+			/* stop at the slot index, it is not made of records */
+			left = bin_load_from_file_records(f);
+			if (left<0){
+				bin_load_from_file_close(f);
+				return 0;
+			}
 			bin_alloc(&x,128*1024);
-			k=bin_load_from_file_read(f,&x);
+			k=bin_load_from_file_read_records(f,&x,&left);
 			max = x.max;
 			x.max=0;
 			LOG(L_INFO,"INFO:"M_NAME":load_snapshot_dialogs: max %d len %d\n",x.max,x.len);
@@ -356,11 +1013,12 @@ int load_snapshot_dialogs()
 				s_dialogs[d->hash].tail = d;
 				if (!s_dialogs[d->hash].head) s_dialogs[d->hash].head = d;
 				d_unlock(d->hash);
+				s_dialog_count_increment();
 				
 				memmove(x.s,x.s+x.max,x.len-x.max);
 				x.len -= x.max;
 				x.max = max;
-				k=bin_load_from_file_read(f,&x);
+				k=bin_load_from_file_read_records(f,&x,&left);
 				max = x.max;
 				x.max = 0;				
 			}
@@ -384,6 +1042,7 @@ int load_snapshot_dialogs()
 				s_dialogs[d->hash].tail = d;
 				if (!s_dialogs[d->hash].head) s_dialogs[d->hash].head = d;
 				d_unlock(d->hash);
+				s_dialog_count_increment();
 			}
 			bin_free(&x);
 			break;
@@ -396,6 +1055,8 @@ int load_snapshot_dialogs()
 			LOG(L_ERR,"ERR:"M_NAME":load_snapshot_dialogs: Can't resume because no such mode %d\n",scscf_persistency_mode);
 			k=0;
 	}	
+	if (k && scscf_persistency_mode==WITH_JOURNAL)
+		k = bin_journal_replay(scscf_persistency_location,"sdialogs",unique,journal_apply_dialogs);
 	if (!k) goto error;
 	
 	
@@ -424,7 +1085,7 @@ void persistency_timer_dialogs(unsigned int ticks, void* param)
  */
 int make_snapshot_registrar()
 {
-	bin_data x={0,0,0};
+	bin_data x={0,0,0},index={0,0,0};
 	r_public *p;
 	int i,k;
 	time_t unique = time(0);
@@ -434,36 +1095,37 @@ int make_snapshot_registrar()
 		case NO_PERSISTENCY:			
 			return 0;
 
+		case WITH_JOURNAL:
+			/* nothing changed since the last snapshot */
+			if (!bin_journal_size(&registrar_journal,scscf_persistency_location) &&
+				bin_load_from_file_unique(scscf_persistency_location,"sregistrar")) return 1;
+			unique = bin_journal_rotate(&registrar_journal);
+			
 		case WITH_FILES:
 			f = bin_dump_to_file_create(scscf_persistency_location,"sregistrar",unique);
 			if (!f) return 0;
+			if (!bin_alloc(&index,1024)) goto error;
 			
 			for(i=0;i<r_hash_size;i++){
-				r_lock(i);
-				p = registrar[i].head;				
-				if (!p){
-					r_unlock(i);
-					continue;
-				}
+				if (!registrar[i].head) continue;
 				if (!bin_alloc(&x,1024)) goto error;		
-				while(p){
-					if (!bin_encode_r_public(&x,p)) {
-						r_unlock(i);
-						goto error;
-					}
-					p = p->next;
-				}
-				r_unlock(i);
-				k = bind_dump_to_file_append(f,&x);
+				if (!snapshot_registrar_slot(&x,i)) goto error;
+				k = bind_dump_to_file_append_slot(f,&x,&index,i);
 				if (k!=x.len) {
 					LOG(L_ERR,"ERR:"M_NAME":make_snapshot_registrar: error while dumping to file - only wrote %d bytes of %d \n",k,x.len);
-					r_unlock(i);
 					bin_free(&x);
+					bin_free(&index);
 					return 0;
 				} 					
 				bin_free(&x);
 			}
-			return bind_dump_to_file_close(f,scscf_persistency_location,"sregistrar",unique);
+			k = bind_dump_to_file_index(f,&index);
+			bin_free(&index);
+			if (!k) return 0;
+			k = bind_dump_to_file_close(f,scscf_persistency_location,"sregistrar",unique);
+			if (k && scscf_persistency_mode==WITH_JOURNAL)
+				bin_journal_cleanup(scscf_persistency_location,"sregistrar",unique);
+			return k;
 
 			break;
 			
@@ -490,6 +1152,7 @@ int make_snapshot_registrar()
 	}	
 error:
 	if (x.s) bin_free(&x);		
+	if (index.s) bin_free(&index);
 	return 0;	
 }  
 
@@ -502,17 +1165,35 @@ int load_snapshot_registrar()
 	bin_data x;
 	r_public *p;
 	int k,max;
+	unsigned int unique=0;
 	FILE *f;
+	long left;
 
 	switch (scscf_persistency_mode){
 		case NO_PERSISTENCY:
 			k=0;
 
+		case WITH_JOURNAL:
+			/* the journals alone, if there was no snapshot yet */
+			unique = bin_load_from_file_unique(scscf_persistency_location,"sregistrar");
+			if (!unique){
+				k = 1;
+				break;
+			}
+			
 		case WITH_FILES:
+			k = load_snapshot_indexed("sregistrar",load_slot_registrar,unload_registrar);
+			if (k>=0) break;
 			f = bin_load_from_file_open(scscf_persistency_location,"sregistrar");		
 			if (!f) return 0;
+			/* stop at the slot index, it is not made of records */
+			left = bin_load_from_file_records(f);
+			if (left<0){
+				bin_load_from_file_close(f);
+				return 0;
+			}
 			bin_alloc(&x,128*1024);
-			k=bin_load_from_file_read(f,&x);
+			k=bin_load_from_file_read_records(f,&x,&left);
 			max = x.max;
 			x.max=0;
 			LOG(L_INFO,"INFO:"M_NAME":load_snapshot_registrar: max %d len %d\n",x.max,x.len);
@@ -526,12 +1207,13 @@ int load_snapshot_registrar()
 				if (registrar[p->hash].tail) registrar[p->hash].tail->next = p;
 				registrar[p->hash].tail = p;
 				if (!registrar[p->hash].head) registrar[p->hash].head = p;
+				r_expiry_update(p);
 				r_unlock(p->hash);	
 				
 				memmove(x.s,x.s+x.max,x.len-x.max);
 				x.len -= x.max;
 				x.max = max;
-				k=bin_load_from_file_read(f,&x);
+				k=bin_load_from_file_read_records(f,&x,&left);
 				max = x.max;
 				x.max = 0;				
 			}
@@ -554,6 +1236,7 @@ int load_snapshot_registrar()
 				if (registrar[p->hash].tail) registrar[p->hash].tail->next = p;
 				registrar[p->hash].tail = p;
 				if (!registrar[p->hash].head) registrar[p->hash].head = p;
+				r_expiry_update(p);
 				r_unlock(p->hash);
 			}
 			bin_free(&x);
@@ -567,6 +1250,8 @@ int load_snapshot_registrar()
 			LOG(L_ERR,"ERR:"M_NAME":load_snapshot_registrar: Can't resume because no such mode %d\n",scscf_persistency_mode);
 			k=0;
 	}	
+	if (k && scscf_persistency_mode==WITH_JOURNAL)
+		k = bin_journal_replay(scscf_persistency_location,"sregistrar",unique,journal_apply_registrar);
 	if (!k) goto error;
 	
 	
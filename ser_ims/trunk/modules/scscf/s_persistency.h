@@ -73,4 +73,18 @@ int make_snapshot_registrar();
 int load_snapshot_registrar();
 void persistency_timer_registrar(unsigned int ticks, void* param);
 
+int persistency_journal_init();
+
+void journal_auth_userdata(auth_userdata *aud);
+void journal_auth_userdata_delete(auth_userdata *aud);
+void journal_authdata_flush(unsigned int hash);
+
+void journal_s_dialog(s_dialog *d);
+void journal_s_dialog_delete(s_dialog *d);
+void journal_dialogs_flush(unsigned int hash);
+
+void journal_r_public(r_public *p);
+void journal_r_public_delete(r_public *p);
+void journal_registrar_flush(unsigned int hash);
+
 #endif
@@ -199,6 +199,8 @@ struct totag_elem {
 
 #define T_IN_AGONY (1<<5) /* set if waiting to die (delete timer)
                              TODO: replace it with del on unref */
+/* request processing suspended (t_suspend), waiting for t_continue */
+#define T_ASYNC_SUSPENDED (1<<6)
 
 #define T_DONT_FORK   (T_CANCELED|T_6xx)
 
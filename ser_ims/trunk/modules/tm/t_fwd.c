@@ -80,6 +80,8 @@
 #include "../../action.h"
 #include "../../data_lump.h"
 #include "../../onsend.h"
+#include "../../udp_server.h"
+#include "../../stats.h"
 #include "t_funcs.h"
 #include "t_hooks.h"
 #include "t_msgbuilder.h"
@@ -570,6 +572,11 @@ void e2e_cancel( struct sip_msg *cancel_msg,
 
 
 
+static int t_check_send_branch( struct cell *t, int branch,
+					struct sip_msg* p_msg, int lock_replies, int* ret);
+static int t_branch_sent( struct cell *t, int branch, struct sip_msg* p_msg,
+					struct proxy_l * proxy, int lock_replies, int send_res);
+
 /* sends one uac/branch buffer and fallbacks to other ips if
  *  the destination resolves to several addresses
  *  Takes care of starting timers a.s.o. (on send success)
@@ -582,12 +589,29 @@ void e2e_cancel( struct sip_msg *cancel_msg,
 int t_send_branch( struct cell *t, int branch, struct sip_msg* p_msg ,
 					struct proxy_l * proxy, int lock_replies)
 {
-	struct ip_addr ip; /* debugging */
 	int ret;
+
+	if (!t_check_send_branch(t, branch, p_msg, lock_replies, &ret))
+		return ret;
+	return t_branch_sent(t, branch, p_msg, proxy, lock_replies,
+							SEND_BUFFER( &t->uac[branch].request));
+}
+
+
+
+/* runs the onsend_route and the blacklist checks for a branch, before
+ *  sending it (see t_send_branch())
+ *  returns 1 if the branch can be sent, 0 if not - in this case *ret is set
+ *   to the t_send_branch() return value (-1 on drop or the new branch id
+ *   on failover) */
+static int t_check_send_branch( struct cell *t, int branch,
+					struct sip_msg* p_msg, int lock_replies, int* ret)
+{
+	struct ip_addr ip; /* debugging */
 	struct ua_client* uac;
 	
 	uac=&t->uac[branch];
-	ret=branch;
+	*ret=-1;
 	if (run_onsend(p_msg,	&uac->request.dst, uac->request.buffer,
 					uac->request.buffer_len)==0){
 		/* disable the current branch: set a "fake" timeout
@@ -604,8 +628,8 @@ int t_send_branch( struct cell *t, int branch, struct sip_msg* p_msg ,
 			/* if the destination resolves to more ips, add another
 			 *  branch/uac */
 			if (use_dns_failover){
-				ret=add_uac_dns_fallback(t, p_msg, uac, lock_replies);
-				if (ret>=0){
+				*ret=add_uac_dns_fallback(t, p_msg, uac, lock_replies);
+				if (*ret>=0){
 					su2ip_addr(&ip, &uac->request.dst.to);
 					DBG("t_send_branch: send on branch %d failed "
 							"(onsend_route), trying another ip %s:%d (%d)\n",
@@ -613,11 +637,12 @@ int t_send_branch( struct cell *t, int branch, struct sip_msg* p_msg ,
 							su_getport(&uac->request.dst.to),
 							uac->request.dst.proto);
 					/* success, return new branch */
-					return ret;
+					return 0;
 				}
 			}
 #endif /* USE_DNS_FAILOVER*/
-		return -1; /* drop, try next branch */
+		*ret=-1;
+		return 0; /* drop, try next branch */
 	}
 #ifdef USE_DST_BLACKLIST
 	if (use_dst_blacklist){
@@ -636,23 +661,42 @@ int t_send_branch( struct cell *t, int branch, struct sip_msg* p_msg ,
 			/* if the destination resolves to more ips, add another
 			 *  branch/uac */
 			if (use_dns_failover){
-				ret=add_uac_dns_fallback(t, p_msg, uac, lock_replies);
-				if (ret>=0){
+				*ret=add_uac_dns_fallback(t, p_msg, uac, lock_replies);
+				if (*ret>=0){
 					su2ip_addr(&ip, &uac->request.dst.to);
 					DBG("t_send_branch: send on branch %d failed (blacklist),"
 							" trying another ip %s:%d (%d)\n", branch,
 							ip_addr2a(&ip), su_getport(&uac->request.dst.to),
 							uac->request.dst.proto);
 					/* success, return new branch */
-					return ret;
+					return 0;
 				}
 			}
 #endif /* USE_DNS_FAILOVER*/
-			return -1; /* don't send */
+			*ret=-1;
+			return 0; /* don't send */
 		}
 	}
 #endif /* USE_DST_BLACKLIST */
-	if (SEND_BUFFER( &uac->request)==-1) {
+	return 1;
+}
+
+
+
+/* finishes sending a branch: starts the retransmissions if the send
+ *  succeeded (send_res==0) or disables the branch and tries dns failover
+ *  if it failed (send_res==-1)
+ *  returns the t_send_branch() return value */
+static int t_branch_sent( struct cell *t, int branch, struct sip_msg* p_msg,
+					struct proxy_l * proxy, int lock_replies, int send_res)
+{
+	struct ip_addr ip; /* debugging */
+	int ret;
+	struct ua_client* uac;
+	
+	uac=&t->uac[branch];
+	ret=branch;
+	if (send_res==-1) {
 		/* disable the current branch: set a "fake" timeout
 		 *  reply code but don't set uac->reply, to avoid overriding 
 		 *  a higly unlikely, perfectly timed fake reply (to a message
@@ -715,6 +759,9 @@ int t_forward_nonack( struct cell *t, struct sip_msg* p_msg ,
 	int lock_replies;
 	str dst_uri;
 	struct socket_info* si, *backup_si;
+	struct udp_batch_msg batch[MAX_BRANCHES];
+	int batch_branch[MAX_BRANCHES];
+	int batch_no, j;
 
 	/* make -Wall happy */
 	current_uri.s=0;
@@ -802,10 +849,25 @@ int t_forward_nonack( struct cell *t, struct sip_msg* p_msg ,
 	/* send them out now */
 	success_branch=0;
 	lock_replies= ! ((rmode==MODE_ONFAILURE) && (t==get_t()));
+	/* when forking, the udp branches are sent together (udp_send_batch()),
+	 * the others one by one */
+	batch_no=(t->nr_of_outgoings-first_branch>1)?0:-1;
 	for (i=first_branch; i<t->nr_of_outgoings; i++) {
 		if (added_branches & (1<<i)) {
 			
-			branch_ret=t_send_branch(t, i, p_msg , proxy, lock_replies);
+			if (batch_no>=0 && t->uac[i].request.dst.proto==PROTO_UDP &&
+					t->uac[i].request.dst.send_sock){
+				if (t_check_send_branch(t, i, p_msg, lock_replies,
+										&branch_ret)){
+					batch[batch_no].dst=&t->uac[i].request.dst;
+					batch[batch_no].buf=t->uac[i].request.buffer;
+					batch[batch_no].len=t->uac[i].request.buffer_len;
+					batch_branch[batch_no]=i;
+					batch_no++;
+					continue;
+				}
+			}else
+				branch_ret=t_send_branch(t, i, p_msg , proxy, lock_replies);
 			if (branch_ret>=0){ /* some kind of success */
 				if (branch_ret==i) /* success */
 					success_branch++;
@@ -814,6 +876,36 @@ int t_forward_nonack( struct cell *t, struct sip_msg* p_msg ,
 			}
 		}
 	}
+	if (batch_no>0){
+		udp_send_batch(batch, batch_no);
+		first_branch=t->nr_of_outgoings;
+		for (j=0; j<batch_no; j++){
+			if (batch[j].ret==-1){
+				STATS_TX_DROPS;
+				LOG(L_ERR, "ERROR: t_forward_nonack: udp_send_batch failed\n");
+			}
+			branch_ret=t_branch_sent(t, batch_branch[j], p_msg, proxy,
+						lock_replies, (batch[j].ret==-1)?-1:0);
+			if (branch_ret>=0){
+				if (branch_ret==batch_branch[j])
+					success_branch++;
+				else
+					added_branches |= 1<<branch_ret;
+			}
+		}
+		/* failover branches added for the failed sends */
+		for (i=first_branch; i<t->nr_of_outgoings; i++) {
+			if (added_branches & (1<<i)) {
+				branch_ret=t_send_branch(t, i, p_msg , proxy, lock_replies);
+				if (branch_ret>=0){
+					if (branch_ret==i)
+						success_branch++;
+					else
+						added_branches |= 1<<branch_ret;
+				}
+			}
+		}
+	}
 	if (success_branch<=0) {
 		ser_error=E_SEND;
 		/* the caller should take care and delete the transaction */
@@ -1275,7 +1275,7 @@ int t_unref( struct sip_msg* p_msg  )
 		return -1;
 	if (p_msg->first_line.type==SIP_REQUEST){
 		kr=get_kr();
-		if (kr==0 
+		if ((kr==0 && !(T->flags & T_ASYNC_SUSPENDED))
 				||(p_msg->REQ_METHOD==METHOD_ACK && !(kr & REQ_RLSD))) {
 			LOG(L_WARN, "WARNING: script writer didn't release transaction\n");
 			t_release_transaction(T);
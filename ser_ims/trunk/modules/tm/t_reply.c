@@ -2027,3 +2027,110 @@ int t_exit_ctx(struct cell * new_trans, enum route_mode new_rmode){
 	return 0;
 }
 
+/* Suspend the processing of a request, e.g. while waiting for a Diameter answer.
+ * The transaction is created if needed and marked as suspended; its identifiers are
+ * returned so that the request route can end and the process can go on with other
+ * messages. The transaction is kept until t_continue is called for it (it is
+ * marked as forwarded, so that it is not put on wait when the script ends).
+ * returns 1 on success, -1 on error
+ */
+int t_suspend(struct sip_msg *msg, unsigned int *hash_index, unsigned int *label)
+{
+	struct cell *t;
+
+	if (t_check(msg,0)!=1){
+		if (t_newtran(msg)<=0){
+			LOG(L_ERR, "ERROR: t_suspend: could not create the transaction\n");
+			return -1;
+		}
+	}
+	t = get_t();
+	if (!t || t==T_UNDEFINED){
+		LOG(L_ERR, "ERROR: t_suspend: no transaction for the message\n");
+		return -1;
+	}
+	if (!t->uas.request || t->uas.status>=200){
+		LOG(L_ERR, "ERROR: t_suspend: local or already replied transaction\n");
+		return -1;
+	}
+
+	LOCK_REPLIES(t);
+	if (t->flags & T_ASYNC_SUSPENDED){
+		UNLOCK_REPLIES(t);
+		LOG(L_ERR, "ERROR: t_suspend: transaction already suspended\n");
+		return -1;
+	}
+	t->flags |= T_ASYNC_SUSPENDED;
+	UNLOCK_REPLIES(t);
+	/* t_continue will relay or reply it */
+	set_kr(REQ_FWDED);
+
+	*hash_index = t->hash_index;
+	*label = t->label;
+	return 1;
+}
+
+/* Resume a request suspended with t_suspend, in any process.
+ * The request is faked from the transaction as for a failure_route, cb is called on
+ * it and then, if cb returned >0, the failure_route[route] block is executed. If after
+ * this the request was neither replied nor relayed, a 500 is sent back.
+ * -- similar to run_failure_handlers, so it runs with the reply lock taken
+ * returns 1 on success, -1 if the transaction was not found or not suspended
+ */
+int t_continue(unsigned int hash_index, unsigned int label,
+		int route, t_continue_cb_f *cb, void *param)
+{
+	static struct sip_msg faked_req;
+	struct cell *t, *backup_t;
+	int ret=1, branches;
+
+	backup_t = get_t();
+	if (t_lookup_ident(&t, hash_index, label)<0){
+		LOG(L_ERR, "ERROR: t_continue: transaction %u:%u not found\n",
+			hash_index, label);
+		set_t(backup_t);
+		return -1;
+	}
+
+	LOCK_REPLIES(t);
+	if (!(t->flags & T_ASYNC_SUSPENDED)){
+		LOG(L_ERR, "ERROR: t_continue: transaction %u:%u is not suspended\n",
+			hash_index, label);
+		ret = -1;
+		goto done;
+	}
+	t->flags &= ~T_ASYNC_SUSPENDED;
+	if (t->uas.status>=200){
+		DBG("DEBUG: t_continue: transaction %u:%u already replied\n",
+			hash_index, label);
+		goto done;
+	}
+
+	if (!fake_req(&faked_req, t->uas.request, 0)) {
+		LOG(L_ERR, "ERROR: t_continue: fake_req failed\n");
+		t_reply_unsafe(t, t->uas.request, 500, "Server Internal Error");
+		ret = -1;
+		goto done;
+	}
+	faked_env(t, &faked_req);
+
+	branches = t->nr_of_outgoings;
+	if (!cb || cb(&faked_req, param)>0){
+		if (route>=0 && route<failure_rt.entries && failure_rt.rlist[route] &&
+				run_actions(failure_rt.rlist[route], &faked_req)<0)
+			LOG(L_ERR, "ERROR: t_continue: Error in do_action\n");
+	}
+	if (t->uas.status<200 && t->nr_of_outgoings==branches)
+		t_reply_unsafe(t, &faked_req, 500, "Server Internal Error");
+
+	faked_env(t, 0);
+	free_faked_req(&faked_req, t);
+	t->uas.request->flags = faked_req.flags;
+
+done:
+	UNLOCK_REPLIES(t);
+	UNREF(t);
+	set_t(backup_t);
+	return ret;
+}
+
@@ -83,6 +83,19 @@ int t_enter_ctx(unsigned int new_hash_index, unsigned int new_label,
 		struct cell** crt_trans, struct cell ** new_trans);
 int t_exit_ctx(struct cell * new_trans, enum route_mode new_rmode);
 
+/* callback run by t_continue on the (faked) request, before the resume route;
+ * returns >0 to run the route or <=0 if the transaction was already handled */
+typedef int (t_continue_cb_f)(struct sip_msg *msg, void *param);
+
+typedef int (*tsuspend_f)(struct sip_msg *msg, unsigned int *hash_index,
+		unsigned int *label);
+typedef int (*tcontinue_f)(unsigned int hash_index, unsigned int label,
+		int route, t_continue_cb_f *cb, void *param);
+
+int t_suspend(struct sip_msg *msg, unsigned int *hash_index, unsigned int *label);
+int t_continue(unsigned int hash_index, unsigned int label,
+		int route, t_continue_cb_f *cb, void *param);
+
 /* wrapper function needed after changes in w_t_reply */
 int w_t_reply_wrp(struct sip_msg *m, unsigned int code, char *txt);
 
@@ -316,6 +316,8 @@ static cmd_export_t cmds[]={
 	{"t_unref_ident",         (cmd_function)t_unref_ident,           NO_SCRIPT,   0, 0},
 	{"t_enter_ctx",	 (cmd_function)t_enter_ctx,	NO_SCRIPT,	0,	0},
 	{"t_exit_ctx",	 (cmd_function)t_exit_ctx,	NO_SCRIPT,	0,	0},
+	{"t_suspend",	 (cmd_function)t_suspend,	NO_SCRIPT,	0,	0},
+	{"t_continue",	 (cmd_function)t_continue,	NO_SCRIPT,	0,	0},
 	{0,0,0,0,0}
 };
 
@@ -206,6 +206,14 @@ int load_tm( struct tm_binds *tmb)
 		LOG( L_ERR, LOAD_ERROR "'t_exit_ctx' not found\n");
 		return -1;
 	}
+	if (!(tmb->t_suspend=(tsuspend_f)find_export("t_suspend",NO_SCRIPT,0))) {
+		LOG( L_ERR, LOAD_ERROR "'t_suspend' not found\n");
+		return -1;
+	}
+	if (!(tmb->t_continue=(tcontinue_f)find_export("t_continue",NO_SCRIPT,0))) {
+		LOG( L_ERR, LOAD_ERROR "'t_continue' not found\n");
+		return -1;
+	}
 
 	tmb->prepare_request_within = prepare_req_within;
 	tmb->send_prepared_request = send_prepared_request;
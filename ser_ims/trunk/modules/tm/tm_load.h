@@ -113,6 +113,8 @@ struct tm_binds {
 	tunref_ident_f     t_unref_ident;
 	tenter_ctx_f    t_enter_ctx;
 	texit_ctx_f    t_exit_ctx;
+	tsuspend_f     t_suspend;
+	tcontinue_f    t_continue;
 	prepare_request_within_f  prepare_request_within;
 	send_prepared_request_f   send_prepared_request;
 	enum route_mode*   route_mode;
@@ -95,61 +95,64 @@ int get_all_ucontacts(void *buf, int len, unsigned int flags)
 	ucontact_t *c;
 	void *cp;
 	int shortage;
+	int i, l;
 
 	cp = buf;
 	shortage = 0;
 	/* Reserve space for terminating 0000 */
 	len -= sizeof(c->c.len);
 	for (p = root; p != NULL; p = p->next) {
-		lock_udomain(p->d);
-		if (p->d->d_ll.n <= 0) {
-			unlock_udomain(p->d);
+		if (atomic_get(&p->d->users) <= 0)
 			continue;
-		}
-		for (r = p->d->d_ll.first; r != NULL; r = r->d_ll.next) {
-			for (c = r->contacts; c != NULL; c = c->next) {
-				if (c->c.len <= 0)
-					continue;
-				     /*
-				      * List only contacts that have all requested
-				      * flags set
-				      */
-				if ((c->flags & flags) != flags)
-					continue;
-				if (c->received.s) {
-					if (len >= (int)(sizeof(c->received.len) +
-							 c->received.len + sizeof(c->sock))) {
-						memcpy(cp, &c->received.len, sizeof(c->received.len));
-						cp = (char*)cp + sizeof(c->received.len);
-						memcpy(cp, c->received.s, c->received.len);
-						cp = (char*)cp + c->received.len;
-						memcpy(cp, &c->sock, sizeof(c->sock));
-						cp = (char*)cp + sizeof(c->sock);
-						len -= sizeof(c->received.len) + c->received.len +
-							sizeof(c->sock);
-					} else {
-						shortage += sizeof(c->received.len) +
-							c->received.len + sizeof(c->sock);
-					}
-				} else {
-					if (len >= (int)(sizeof(c->c.len) + c->c.len +
-					sizeof(c->sock))) {
-						memcpy(cp, &c->c.len, sizeof(c->c.len));
-						cp = (char*)cp + sizeof(c->c.len);
-						memcpy(cp, c->c.s, c->c.len);
-						cp = (char*)cp + c->c.len;
-						memcpy(cp, &c->sock, sizeof(c->sock));
-						cp = (char*)cp + sizeof(c->sock);
-						len -= sizeof(c->c.len) + c->c.len + sizeof(c->sock);
-					} else {
-						shortage += sizeof(c->c.len) + c->c.len +
-							sizeof(c->sock);
-
+		for (l = 0; l < UDOMAIN_LOCKS; l++) {
+			lock_ulslot(p->d, l);
+			for (i = l; i < UDOMAIN_HASH_SIZE; i += UDOMAIN_LOCKS) {
+				for (r = p->d->table[i].first; r != NULL; r = r->s_ll.next) {
+					for (c = r->contacts; c != NULL; c = c->next) {
+						if (c->c.len <= 0)
+							continue;
+						     /*
+						      * List only contacts that have all requested
+						      * flags set
+						      */
+						if ((c->flags & flags) != flags)
+							continue;
+						if (c->received.s) {
+							if (len >= (int)(sizeof(c->received.len) +
+									 c->received.len + sizeof(c->sock))) {
+								memcpy(cp, &c->received.len, sizeof(c->received.len));
+								cp = (char*)cp + sizeof(c->received.len);
+								memcpy(cp, c->received.s, c->received.len);
+								cp = (char*)cp + c->received.len;
+								memcpy(cp, &c->sock, sizeof(c->sock));
+								cp = (char*)cp + sizeof(c->sock);
+								len -= sizeof(c->received.len) + c->received.len +
+									sizeof(c->sock);
+							} else {
+								shortage += sizeof(c->received.len) +
+									c->received.len + sizeof(c->sock);
+							}
+						} else {
+							if (len >= (int)(sizeof(c->c.len) + c->c.len +
+							sizeof(c->sock))) {
+								memcpy(cp, &c->c.len, sizeof(c->c.len));
+								cp = (char*)cp + sizeof(c->c.len);
+								memcpy(cp, c->c.s, c->c.len);
+								cp = (char*)cp + c->c.len;
+								memcpy(cp, &c->sock, sizeof(c->sock));
+								cp = (char*)cp + sizeof(c->sock);
+								len -= sizeof(c->c.len) + c->c.len + sizeof(c->sock);
+							} else {
+								shortage += sizeof(c->c.len) + c->c.len +
+									sizeof(c->sock);
+
+							}
+						}
 					}
 				}
 			}
+			unlock_ulslot(p->d, l);
 		}
-		unlock_udomain(p->d);
 	}
 	/* len < 0 is possible, if size of the buffer < sizeof(c->c.len) */
 	if (len >= 0)
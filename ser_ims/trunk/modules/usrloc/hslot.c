@@ -34,12 +34,13 @@
 /*
  * Initialize cache slot structure
  */
-int init_slot(struct udomain* _d, hslot_t* _s)
+int init_slot(struct udomain* _d, hslot_t* _s, int _n)
 {
 	_s->n = 0;
 	_s->first = 0;
 	_s->last = 0;
 	_s->d = _d;
+	_s->lock_idx = _n & (UDOMAIN_LOCKS - 1);
 	return 0;
 }
 
@@ -102,3 +103,21 @@ void slot_rem(hslot_t* _s, struct urecord* _r)
 	_r->slot = 0;
 	_s->n--;
 }
+
+
+/*
+ * Get the lock protecting the slot
+ */
+void lock_slot(hslot_t* _s)
+{
+	lock_set_get(_s->d->locks, _s->lock_idx);
+}
+
+
+/*
+ * Release the lock protecting the slot
+ */
+void unlock_slot(hslot_t* _s)
+{
+	lock_set_release(_s->d->locks, _s->lock_idx);
+}
@@ -44,13 +44,15 @@ typedef struct hslot {
 	struct urecord* first;  /* First element in the list */
 	struct urecord* last;   /* Last element in the list */
 	struct udomain* d;      /* Domain we belong to */
+	int lock_idx;           /* Lock of the domain lock set protecting the slot */
 } hslot_t;
 
 
 /*
- * Initialize slot structure
+ * Initialize slot structure, _n is the index
+ * of the slot in the hash table
  */
-int init_slot(struct udomain* _d, hslot_t* _s);
+int init_slot(struct udomain* _d, hslot_t* _s, int _n);
 
 
 /*
@@ -71,4 +73,16 @@ void slot_add(hslot_t* _s, struct urecord* _r);
 void slot_rem(hslot_t* _s, struct urecord* _r);
 
 
+/*
+ * Get the lock protecting the slot
+ */
+void lock_slot(hslot_t* _s);
+
+
+/*
+ * Release the lock protecting the slot
+ */
+void unlock_slot(hslot_t* _s);
+
+
 #endif /* HSLOT_H */
@@ -56,8 +56,8 @@ static void destroy_avps(avp_t *avp)
 	avp_t *n;
 
 	while (avp) {
-		shm_free(avp); /* FIXME: really ?? */
 		n = avp->next;
+		shm_free(avp); /* FIXME: really ?? */
 		avp = n;
 	}
 }
@@ -272,23 +272,23 @@ int read_reg_avps(struct sip_msg *m, char* _domain, char* fp)
 	
 /*	INFO("reading avps for uid=%.*s\n", uid.len, ZSW(uid.s)); */
 
-	lock_udomain(d);
+	lock_udomain(d, &uid);
 	
 	if (get_urecord(d, &uid, &r) != 0) {
-		unlock_udomain(d);
+		unlock_udomain(d, &uid);
 		WARN("urecord not found\n");
 		return -1;
 	}
 
 	if (get_ucontact(r, &m->new_uri, &contact) != 0) {
-		unlock_udomain(d);
+		unlock_udomain(d, &uid);
 		WARN("ucontact not found\n");
 		return -1;
 	}
 
 	load_reg_avps(contact);
 	
-	unlock_udomain(d);
+	unlock_udomain(d, &uid);
 	
 	return 1;
 }
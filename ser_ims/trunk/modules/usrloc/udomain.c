@@ -69,47 +69,6 @@ static inline int hash_func(udomain_t* _d, unsigned char* _s, int _l)
 }
 
 
-/*
- * Add a record to list of all records in a domain
- */
-static inline void udomain_add(udomain_t* _d, urecord_t* _r)
-{
-	if (_d->d_ll.n == 0) {
-		_d->d_ll.first = _r;
-		_d->d_ll.last = _r;
-	} else {
-		_r->d_ll.prev = _d->d_ll.last;
-		_d->d_ll.last->d_ll.next = _r;
-		_d->d_ll.last = _r;
-	}
-	_d->d_ll.n++;
-}
-
-
-/*
- * Remove a record from list of all records in a domain
- */
-static inline void udomain_remove(udomain_t* _d, urecord_t* _r)
-{
-	if (_d->d_ll.n == 0) return;
-
-	if (_r->d_ll.prev) {
-		_r->d_ll.prev->d_ll.next = _r->d_ll.next;
-	} else {
-		_d->d_ll.first = _r->d_ll.next;
-	}
-
-	if (_r->d_ll.next) {
-		_r->d_ll.next->d_ll.prev = _r->d_ll.prev;
-	} else {
-		_d->d_ll.last = _r->d_ll.prev;
-	}
-
-	_r->d_ll.prev = _r->d_ll.next = 0;
-	_d->d_ll.n--;
-}
-
-
 /*
  * Create a new domain structure
  * _n is pointer to str representing
@@ -142,7 +101,7 @@ int new_udomain(str* _n, udomain_t** _d)
 	(*_d)->name = _n;
 	
 	for(i = 0; i < UDOMAIN_HASH_SIZE; i++) {
-		if (init_slot(*_d, &((*_d)->table[i])) < 0) {
+		if (init_slot(*_d, &((*_d)->table[i]), i) < 0) {
 			LOG(L_ERR, "new_udomain(): Error while initializing hash table\n");
 			shm_free((*_d)->table);
 			shm_free(*_d);
@@ -150,9 +109,23 @@ int new_udomain(str* _n, udomain_t** _d)
 		}
 	}
 
-	lock_init(&(*_d)->lock);
-	(*_d)->users = 0;
-	(*_d)->expired = 0;
+	(*_d)->locks = lock_set_alloc(UDOMAIN_LOCKS);
+	if (!(*_d)->locks) {
+		LOG(L_ERR, "new_udomain(): No memory left 3\n");
+		shm_free((*_d)->table);
+		shm_free(*_d);
+		return -4;
+	}
+	if (lock_set_init((*_d)->locks) == 0) {
+		LOG(L_ERR, "new_udomain(): Error while initializing locks\n");
+		lock_set_dealloc((*_d)->locks);
+		shm_free((*_d)->table);
+		shm_free(*_d);
+		return -5;
+	}
+
+	atomic_set(&(*_d)->users, 0);
+	atomic_set(&(*_d)->expired, 0);
 	
 	return 0;
 }
@@ -166,15 +139,18 @@ void free_udomain(udomain_t* _d)
 {
 	int i;
 	
-	lock_udomain(_d);
+	     /* Called before fork or on shutdown only, no
+	      * other process can use the domain, no locking
+	      */
 	if (_d->table) {
 		for(i = 0; i < UDOMAIN_HASH_SIZE; i++) {
 			deinit_slot(_d->table + i);
 		}
 		shm_free(_d->table);
 	}
-	unlock_udomain(_d);
-	lock_destroy(&_d->lock);/* destroy the lock (required for SYSV sems!)*/
+	/* destroy the locks (required for SYSV sems!)*/
+	lock_set_destroy(_d->locks);
+	lock_set_dealloc(_d->locks);
 
         shm_free(_d);
 }
@@ -186,25 +162,21 @@ void free_udomain(udomain_t* _d)
 void print_udomain(FILE* _f, udomain_t* _d)
 {
 	struct urecord* r;
+	int i;
+
 	fprintf(_f, "---Domain---\n");
 	fprintf(_f, "name : '%.*s'\n", _d->name->len, ZSW(_d->name->s));
 	fprintf(_f, "size : %d\n", UDOMAIN_HASH_SIZE);
+	fprintf(_f, "locks: %d\n", UDOMAIN_LOCKS);
 	fprintf(_f, "table: %p\n", _d->table);
-	fprintf(_f, "d_ll {\n");
-	fprintf(_f, "    n    : %d\n", _d->d_ll.n);
-	fprintf(_f, "    first: %p\n", _d->d_ll.first);
-	fprintf(_f, "    last : %p\n", _d->d_ll.last);
-	fprintf(_f, "}\n");
-	/*fprintf(_f, "lock : %d\n", _d->lock); -- can be a structure --andrei*/
-	if (_d->d_ll.n > 0) {
+	fprintf(_f, "users: %d\n", atomic_get(&_d->users));
+	if (atomic_get(&_d->users) > 0) {
 		fprintf(_f, "\n");
-		r = _d->d_ll.first;
-		while(r) {
-			print_urecord(_f, r);
-			r = r->d_ll.next;
+		for(i = 0; i < UDOMAIN_HASH_SIZE; i++) {
+			for(r = _d->table[i].first; r; r = r->s_ll.next) {
+				print_urecord(_f, r);
+			}
 		}
-
-
 		fprintf(_f, "\n");
 	}
 	fprintf(_f, "---/Domain---\n");
@@ -326,8 +298,6 @@ int preload_udomain(db_con_t* _c, udomain_t* _d)
 		return 0;
 	}
 
-	lock_udomain(_d);
-
 	for(i = 0; i < RES_ROW_N(res); i++) {
 		row = RES_ROWS(res) + i;
 		
@@ -420,19 +390,20 @@ int preload_udomain(db_con_t* _c, udomain_t* _d)
 			aor.len = 0;
 		}
 
+		lock_udomain(_d, &uid);
 		if (get_urecord(_d, &uid, &r) > 0) {
 			if (mem_insert_urecord(_d, &uid, &r) < 0) {
 				LOG(L_ERR, "preload_udomain(): Can't create a record\n");
+				unlock_udomain(_d, &uid);
 				ul_dbf.free_result(_c, res);
-				unlock_udomain(_d);
 				return -2;
 			}
 		}
 		
 		if (mem_insert_ucontact(r, &aor, &contact, expires, q, &callid, cseq, flags, &c, &ua, rec, sock, &instance) < 0) {
 			LOG(L_ERR, "preload_udomain(): Error while inserting contact\n");
+			unlock_udomain(_d, &uid);
 			ul_dbf.free_result(_c, res);
-			unlock_udomain(_d);
 			return -3;
 		}
 
@@ -444,10 +415,10 @@ int preload_udomain(db_con_t* _c, udomain_t* _d)
 			  * the correct state
 		      */
 		c->state = CS_SYNC;
+		unlock_udomain(_d, &uid);
 	}
 
 	ul_dbf.free_result(_c, res);
-	unlock_udomain(_d);
 	return 0;
 }
 
@@ -466,8 +437,7 @@ int mem_insert_urecord(udomain_t* _d, str* _uid, struct urecord** _r)
 
 	sl = hash_func(_d, (unsigned char*)_uid->s, _uid->len);
 	slot_add(&_d->table[sl], *_r);
-	udomain_add(_d, *_r);
-	_d->users++;
+	atomic_inc(&_d->users);
 	return 0;
 }
 
@@ -478,64 +448,90 @@ int mem_insert_urecord(udomain_t* _d, str* _uid, struct urecord** _r)
 void mem_delete_urecord(udomain_t* _d, struct urecord* _r)
 {
 	if (_r->watchers == 0) {
-		udomain_remove(_d, _r);
 		slot_rem(_r->slot, _r);
 		free_urecord(_r);
-		_d->users--; /* FIXME */
+		atomic_dec(&_d->users);
 	}
 		
 }
 
 
+/*
+ * Walk the domain one slot stripe at a time, so the
+ * lookups hashed to other stripes are not blocked by
+ * the timer
+ */
 int timer_udomain(udomain_t* _d)
 {
 	struct urecord* ptr, *t;
-
-	lock_udomain(_d);
-
-	ptr = _d->d_ll.first;
-
-	while(ptr) {
-		if (timer_urecord(ptr) < 0) {
-			LOG(L_ERR, "timer_udomain(): Error in timer_urecord\n");
-			unlock_udomain(_d);
-			return -1;
-		}
-		
-		     /* Remove the entire record
-		      * if it is empty
-		      */
-		if (ptr->contacts == 0) {
-			t = ptr;
-			ptr = ptr->d_ll.next;
-			mem_delete_urecord(_d, t);
-		} else {
-			ptr = ptr->d_ll.next;
+	int i, l;
+
+	for(l = 0; l < UDOMAIN_LOCKS; l++) {
+		lock_ulslot(_d, l);
+
+		for(i = l; i < UDOMAIN_HASH_SIZE; i += UDOMAIN_LOCKS) {
+			ptr = _d->table[i].first;
+
+			while(ptr) {
+				if (timer_urecord(ptr) < 0) {
+					LOG(L_ERR, "timer_udomain(): Error in timer_urecord\n");
+					unlock_ulslot(_d, l);
+					return -1;
+				}
+
+				     /* Remove the entire record
+				      * if it is empty
+				      */
+				t = ptr;
+				ptr = ptr->s_ll.next;
+				if (t->contacts == 0) {
+					mem_delete_urecord(_d, t);
+				}
+			}
 		}
+
+		unlock_ulslot(_d, l);
 	}
-	
-	unlock_udomain(_d);
+
 /*	process_del_list(_d->name); */
 /*	process_ins_list(_d->name); */
 	return 0;
 }
 
 
+/*
+ * Get lock of the slot stripe
+ */
+void lock_ulslot(udomain_t* _d, int _l)
+{
+	lock_set_get(_d->locks, _l);
+}
+
+
+/*
+ * Release lock of the slot stripe
+ */
+void unlock_ulslot(udomain_t* _d, int _l)
+{
+	lock_set_release(_d->locks, _l);
+}
+
+
 /*
  * Get lock
  */
-void lock_udomain(udomain_t* _d)
+void lock_udomain(udomain_t* _d, str* _uid)
 {
-	lock_get(&_d->lock);
+	lock_slot(&_d->table[hash_func(_d, (unsigned char*)_uid->s, _uid->len)]);
 }
 
 
 /*
  * Release lock
  */
-void unlock_udomain(udomain_t* _d)
+void unlock_udomain(udomain_t* _d, str* _uid)
 {
-	lock_release(&_d->lock);
+	unlock_slot(&_d->table[hash_func(_d, (unsigned char*)_uid->s, _uid->len)]);
 }
 
 
@@ -40,6 +40,7 @@
 
 #include <stdio.h>
 #include "../../locking.h"
+#include "../../atomic_ops.h"
 #include "../../str.h"
 #include "../../db/db.h"
 #include "urecord.h"
@@ -51,6 +52,11 @@
  *  32768 4-5% inc over 16384 */
 #define UDOMAIN_HASH_SIZE	16384
 
+/* number of locks protecting the hash table, slot i is protected by
+ * lock i & (UDOMAIN_LOCKS-1), must be a 2^k value not bigger than
+ * UDOMAIN_HASH_SIZE (keep it low when using SYSV semaphores) */
+#define UDOMAIN_LOCKS		128
+
 struct hslot;   /* Hash table slot */
 struct urecord; /* Usrloc record */
 
@@ -60,15 +66,10 @@ struct urecord; /* Usrloc record */
  */
 typedef struct udomain {
 	str* name;                     /* Domain name */
-	int users;                     /* Number of registered users */
-	int expired;                   /* Number of expired contacts */
+	atomic_t users;                /* Number of registered users */
+	atomic_t expired;              /* Number of expired contacts */
 	struct hslot* table;           /* Hash table - array of collision slots */
-	struct {                       /* Linked list of all elements in the domain */
-		int n;                 /* Number of element in the linked list */
-		struct urecord* first; /* First element in the list */
-		struct urecord* last;  /* Last element in the list */
-	} d_ll;
-	gen_lock_t lock;                /* lock variable */
+	gen_lock_set_t* locks;         /* Locks of the slots, see UDOMAIN_LOCKS */
 } udomain_t;
 
 
@@ -120,17 +121,30 @@ void mem_delete_urecord(udomain_t* _d, struct urecord* _r);
 
 
 /*
- * Get lock
+ * Get lock of the slot stripe _l, used to walk the whole
+ * domain, the stripe contains slots _l, _l + UDOMAIN_LOCKS, ...
+ */
+void lock_ulslot(udomain_t* _d, int _l);
+
+
+/*
+ * Release lock of the slot stripe _l
+ */
+void unlock_ulslot(udomain_t* _d, int _l);
+
+
+/*
+ * Get lock of the slot the record with given uid belongs to
  */
-typedef void (*lock_udomain_t)(udomain_t* _d);
-void lock_udomain(udomain_t* _d);
+typedef void (*lock_udomain_t)(udomain_t* _d, str* _uid);
+void lock_udomain(udomain_t* _d, str* _uid);
 
 
 /*
- * Release lock
+ * Release lock of the slot the record with given uid belongs to
  */
-typedef void (*unlock_udomain_t)(udomain_t* _d);
-void unlock_udomain(udomain_t* _d);
+typedef void (*unlock_udomain_t)(udomain_t* _d, str* _uid);
+void unlock_udomain(udomain_t* _d, str* _uid);
 
 
 /* ===== module interface ======= */
@@ -0,0 +1,248 @@
+/*
+ * $Id$
+ *
+ * Usrloc write-back flushing
+ *
+ * This file is part of ser, a free SIP server.
+ *
+ * ser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * For a license to use the ser software under conditions
+ * other than those described here, or to purchase support for this
+ * software, please contact iptel.org by e-mail at the following addresses:
+ *    info@iptel.org
+ *
+ * ser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+#include "../../mem/shm_mem.h"
+#include "../../locking.h"
+#include "../../dprint.h"
+#include "../../pt.h"
+#include "../../ut.h"
+#include "ul_mod.h"
+#include "reg_avps.h"
+#include "ul_flush.h"
+
+
+/*
+ * Queued database operation, the contact is a private copy
+ * and its uid points to the uid stored behind the structure
+ */
+struct ul_flush_entry {
+	enum ul_flush_op op;
+	str uid;
+	ucontact_t* c;
+	struct ul_flush_entry* next;
+};
+
+
+struct ul_flush_queue {
+	gen_lock_t* lock;
+	struct ul_flush_entry* first;
+	struct ul_flush_entry* last;
+	int n;
+};
+
+
+static struct ul_flush_queue* queue = 0;
+
+
+static void free_entry(struct ul_flush_entry* _e)
+{
+	delete_reg_avps(_e->c);
+	free_ucontact(_e->c);
+	shm_free(_e);
+}
+
+
+/*
+ * Allocate the queue
+ */
+int ul_flush_init(void)
+{
+	queue = (struct ul_flush_queue*)shm_malloc(sizeof(struct ul_flush_queue));
+	if (!queue) {
+		LOG(L_ERR, "ul_flush_init(): No memory left\n");
+		return -1;
+	}
+	memset(queue, 0, sizeof(struct ul_flush_queue));
+
+	queue->lock = lock_alloc();
+	if (!queue->lock || !lock_init(queue->lock)) {
+		LOG(L_ERR, "ul_flush_init(): Error while creating lock\n");
+		if (queue->lock) lock_dealloc(queue->lock);
+		shm_free(queue);
+		queue = 0;
+		return -1;
+	}
+	return 0;
+}
+
+
+/*
+ * Free the queue
+ */
+void ul_flush_destroy(void)
+{
+	struct ul_flush_entry* e;
+
+	if (!queue) return;
+
+	while(queue->first) {
+		e = queue->first;
+		queue->first = e->next;
+		free_entry(e);
+	}
+	lock_destroy(queue->lock);
+	lock_dealloc(queue->lock);
+	shm_free(queue);
+	queue = 0;
+}
+
+
+/*
+ * Queue a copy of the contact
+ */
+int ul_flush_add(enum ul_flush_op _op, ucontact_t* _c)
+{
+	struct ul_flush_entry* e;
+
+	     /* Memory only contacts never reach the database */
+	if (_c->flags & FL_MEM) return 0;
+
+	e = (struct ul_flush_entry*)shm_malloc(sizeof(struct ul_flush_entry) + _c->uid->len);
+	if (!e) {
+		LOG(L_ERR, "ul_flush_add(): No memory left\n");
+		return -1;
+	}
+	memset(e, 0, sizeof(struct ul_flush_entry));
+	e->op = _op;
+	e->uid.s = (char*)(e + 1);
+	memcpy(e->uid.s, _c->uid->s, _c->uid->len);
+	e->uid.len = _c->uid->len;
+
+	if (new_ucontact(_c->domain, &e->uid, &_c->aor, &_c->c, _c->expires, _c->q,
+			 &_c->callid, _c->cseq, _c->flags, &e->c, &_c->user_agent,
+			 _c->received.s ? &_c->received : 0, _c->sock,
+			 _c->instance.s ? &_c->instance : 0) < 0) {
+		LOG(L_ERR, "ul_flush_add(): Error while copying contact\n");
+		shm_free(e);
+		return -1;
+	}
+	dup_reg_avps(e->c, _c);
+
+	lock_get(queue->lock);
+	if (queue->last) queue->last->next = e;
+	else queue->first = e;
+	queue->last = e;
+	queue->n++;
+	lock_release(queue->lock);
+	return 0;
+}
+
+
+/*
+ * Detach the queue and write it to the database, the
+ * queue lock is held only while the list is taken over
+ */
+int ul_flush_run(void)
+{
+	struct ul_flush_entry* e, *batch;
+	int n;
+
+	if (!queue || !ul_dbh) return 0;
+
+	lock_get(queue->lock);
+	batch = queue->first;
+	n = queue->n;
+	queue->first = queue->last = 0;
+	queue->n = 0;
+	lock_release(queue->lock);
+
+	while(batch) {
+		e = batch;
+		batch = batch->next;
+
+		switch(e->op) {
+		case UL_FLUSH_INSERT:
+			if (db_insert_ucontact(e->c) < 0) {
+				LOG(L_ERR, "ul_flush_run(): Error while inserting contact into database\n");
+			}
+			db_save_reg_avps(e->c);
+			break;
+
+		case UL_FLUSH_UPDATE:
+			if (db_update_ucontact(e->c) < 0) {
+				LOG(L_ERR, "ul_flush_run(): Error while updating contact in db\n");
+			}
+			db_update_reg_avps(e->c);
+			break;
+
+		case UL_FLUSH_DELETE:
+			db_delete_reg_avps(e->c);
+			if (db_delete_ucontact(e->c) < 0) {
+				LOG(L_ERR, "ul_flush_run(): Can't delete contact from database\n");
+			}
+			break;
+		}
+
+		free_entry(e);
+	}
+
+	return n;
+}
+
+
+/*
+ * Number of queued operations
+ */
+int ul_flush_pending(void)
+{
+	int n;
+
+	if (!queue) return 0;
+
+	lock_get(queue->lock);
+	n = queue->n;
+	lock_release(queue->lock);
+	return n;
+}
+
+
+static void ul_flush_process(void)
+{
+	for(;;) {
+		if (ul_flush_run() == 0) {
+			sleep_us(UL_FLUSH_IDLE);
+		}
+	}
+}
+
+
+/*
+ * Fork the flusher process
+ */
+int ul_flush_start(void)
+{
+	int pid;
+
+	pid = fork_process(UL_FLUSH_PROCESS_RANK, "usrloc flusher", 0);
+	if (pid < 0) {
+		LOG(L_ERR, "ul_flush_start(): Error on fork() for the flusher process\n");
+		return -1;
+	}
+	if (pid == 0) ul_flush_process();
+	return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * $Id$
+ *
+ * Usrloc write-back flushing
+ *
+ * This file is part of ser, a free SIP server.
+ *
+ * ser is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * For a license to use the ser software under conditions
+ * other than those described here, or to purchase support for this
+ * software, please contact iptel.org by e-mail at the following addresses:
+ *    info@iptel.org
+ *
+ * ser is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * In write-back mode the timer does not touch the database while it
+ * holds the slot locks. It takes a copy of every contact that has to
+ * be written and appends it to a queue in shared memory, a dedicated
+ * flusher process detaches the whole queue at once and writes it to
+ * the database without holding any usrloc lock.
+ */
+
+#ifndef UL_FLUSH_H
+#define UL_FLUSH_H
+
+#include "ucontact.h"
+
+
+#define UL_FLUSH_PROCESS_RANK 2201   /* rank given to child_init of the flusher process */
+#define UL_FLUSH_IDLE         100000 /* us the flusher sleeps when the queue is empty */
+
+
+enum ul_flush_op {
+	UL_FLUSH_INSERT = 1,  /* Insert the contact into the database */
+	UL_FLUSH_UPDATE,      /* Update the contact in the database */
+	UL_FLUSH_DELETE       /* Delete the contact from the database */
+};
+
+
+/*
+ * Allocate the queue, must be called from mod_init
+ */
+int ul_flush_init(void);
+
+
+/*
+ * Free the queue and the operations left in it
+ */
+void ul_flush_destroy(void);
+
+
+/*
+ * Queue a copy of the contact to be written to the database,
+ * the caller holds the lock of the slot the contact belongs to
+ */
+int ul_flush_add(enum ul_flush_op _op, ucontact_t* _c);
+
+
+/*
+ * Write all queued operations to the database,
+ * returns the number of operations processed
+ */
+int ul_flush_run(void);
+
+
+/*
+ * Number of operations waiting in the queue
+ */
+int ul_flush_pending(void);
+
+
+/*
+ * Fork the flusher process, must be called from
+ * child_init with rank PROC_MAIN
+ */
+int ul_flush_start(void);
+
+
+#endif /* UL_FLUSH_H */
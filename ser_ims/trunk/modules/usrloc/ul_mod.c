@@ -46,6 +46,7 @@
 #include "../../dprint.h"
 #include "../../timer.h"     /* register_timer */
 #include "../../globals.h"   /* is_main */
+#include "../../pt.h"        /* register_procs */
 #include "dlist.h"           /* register_udomain */
 #include "udomain.h"         /* {insert,delete,get,release}_urecord */
 #include "urecord.h"         /* {insert,delete,get}_ucontact */
@@ -55,6 +56,7 @@
 #include "ul_rpc.h"
 #include "usrloc.h"
 #include "reg_avps.h"
+#include "ul_flush.h"
 
 MODULE_VERSION
 
@@ -213,6 +215,15 @@ static int mod_init(void)
 		}
 	}
 
+	/* Write-back mode writes to the database from its own process */
+	if (db_mode == WRITE_BACK) {
+		if (ul_flush_init() < 0) {
+			LOG(L_ERR, "ERROR: mod_init(): Can't initialize flush queue\n");
+			return -1;
+		}
+		register_procs(1);
+	}
+
 	set_reg_avpflag_name(reg_avp_flag_name);
 
 	return 0;
@@ -221,6 +232,8 @@ static int mod_init(void)
 
 static int child_init(int _rank)
 {
+	if (_rank==PROC_MAIN && db_mode==WRITE_BACK && ul_flush_start()<0)
+		return -1;
 	if (_rank==PROC_MAIN || _rank==PROC_TCP_MAIN)
 		return 0; /* do nothing for the main or tcp_main processes */
 	     /* Shall we use database ? */
@@ -243,12 +256,18 @@ static int child_init(int _rank)
 static void destroy(void)
 {
 	/* Parent only, synchronize the world
-	* and then nuke it */
-	if (is_main && ul_dbh) {
-		if (synchronize_all_udomains() != 0) {
-			LOG(L_ERR, "timer(): Error while flushing cache\n");
+	* and then nuke it, the flusher process is
+	* gone already so write what it left queued */
+	if (is_main && db_mode == WRITE_BACK) {
+		if (!ul_dbh) ul_dbh = ul_dbf.init(db_url.s);
+		if (ul_dbh) {
+			if (synchronize_all_udomains() != 0) {
+				LOG(L_ERR, "timer(): Error while flushing cache\n");
+			}
+			ul_flush_run();
 		}
 		free_all_udomains();
+		ul_flush_destroy();
 	}
 
 	/* All processes close database connection */
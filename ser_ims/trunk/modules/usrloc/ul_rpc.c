@@ -33,6 +33,7 @@
 #include "utime.h"
 #include "ul_mod.h"
 #include "ul_rpc.h"
+#include "ul_flush.h"
 
 
 static inline void rpc_find_domain(str* _name, udomain_t** _d)
@@ -127,10 +128,11 @@ static void rpc_stats(rpc_t* rpc, void* c)
 	ptr = root;
 	while(ptr) {
 		rpc->add(c, "{", &handle);
-		rpc->struct_add(handle, "Sdd",
+		rpc->struct_add(handle, "Sddd",
 				"domain", ptr->d->name,
-				"users", ptr->d->users,
-				"expired", ptr->d->expired);
+				"users", atomic_get(&ptr->d->users),
+				"expired", atomic_get(&ptr->d->expired),
+				"flush_pending", ul_flush_pending());
 		ptr = ptr->next;
 	}
 }
@@ -151,14 +153,14 @@ static void rpc_delete_uid(rpc_t* rpc, void* c)
 
         rpc_find_domain(&t, &d);
         if (d) {
-                lock_udomain(d);
+                lock_udomain(d, &uid);
                 if (delete_urecord(d, &uid) < 0) {
                         ERR("Error while deleting user %.*s\n", uid.len, uid.s);
-                        unlock_udomain(d);
+                        unlock_udomain(d, &uid);
 			rpc->fault(c, 500, "Error While Deleting Record");
                         return;
                 }
-                unlock_udomain(d);
+                unlock_udomain(d, &uid);
         } else {
 		rpc->fault(c, 400, "Table Not Found");
         }
@@ -184,19 +186,19 @@ static void rpc_delete_contact(rpc_t* rpc, void* ctx)
         rpc_find_domain(&t, &d);
 
         if (d) {
-                lock_udomain(d);
+                lock_udomain(d, &uid);
 
                 res = get_urecord(d, &uid, &r);
                 if (res < 0) {
 			rpc->fault(ctx, 500, "Error While Searching Table");
 			ERR("Error while looking for uid %.*s in table %.*s\n", uid.len, uid.s, t.len, t.s);
-                        unlock_udomain(d);
+                        unlock_udomain(d, &uid);
                         return;
                 }
 
                 if (res > 0) {
 			rpc->fault(ctx, 404, "AOR Not Found");
-                        unlock_udomain(d);
+                        unlock_udomain(d, &uid);
                         return;
                 }
 
@@ -204,24 +206,24 @@ static void rpc_delete_contact(rpc_t* rpc, void* ctx)
                 if (res < 0) {
 			rpc->fault(ctx, 500, "Error While Searching for Contact");
                         ERR("Error while looking for contact %.*s\n", c.len, c.s);
-                        unlock_udomain(d);
+                        unlock_udomain(d, &uid);
                         return;
                 }
 
                 if (res > 0) {
 			rpc->fault(ctx, 404, "Contact Not Found");
-                        unlock_udomain(d);
+                        unlock_udomain(d, &uid);
                         return;
                 }
 
                 if (delete_ucontact(r, con) < 0) {
 			rpc->fault(ctx, 500, "Error While Deleting Contact");
-                        unlock_udomain(d);
+                        unlock_udomain(d, &uid);
                         return;
                 }
 
                 release_urecord(r);
-                unlock_udomain(d);
+                unlock_udomain(d, &uid);
         } else {
 		rpc->fault(ctx, 404, "Table Not Found");
         }
@@ -271,16 +273,16 @@ static void rpc_add_contact(rpc_t* rpc, void* c)
 		      
         rpc_find_domain(&table, &d);
         if (d) {
-                lock_udomain(d);
+                lock_udomain(d, &uid);
 
                 if (add_contact(d, &uid, &contact, expires, qval, flags) < 0) {
-                        unlock_udomain(d);
+                        unlock_udomain(d, &uid);
                         ERR("Error while adding contact ('%.*s','%.*s') in table '%.*s'\n",
                             uid.len, ZSW(uid.s), contact.len, ZSW(contact.s), table.len, ZSW(table.s));
 			rpc->fault(c, 500, "Error while adding Contact");
                         return;
                 }
-                unlock_udomain(d);
+                unlock_udomain(d, &uid);
         } else {
 		rpc->fault(c, 400, "Table Not Found");
         }
@@ -328,31 +330,31 @@ static void rpc_show_contacts(rpc_t* rpc, void* c)
 
         rpc_find_domain(&t, &d);
         if (d) {
-                lock_udomain(d);
+                lock_udomain(d, &uid);
 
                 res = get_urecord(d, &uid, &r);
                 if (res < 0) {
 			rpc->fault(c, 500, "Error While Searching AOR");
                         ERR("Error while looking for username %.*s in table %.*s\n", uid.len, uid.s, t.len, t.s);
-                        unlock_udomain(d);
+                        unlock_udomain(d, &uid);
                         return;
                 }
 
                 if (res > 0) {
 			rpc->fault(c, 404, "AOR Not Found");
-                        unlock_udomain(d);
+                        unlock_udomain(d, &uid);
                         return;
                 }
 
                 get_act_time();
 
                 if (!print_contacts(rpc, c, r->contacts)) {
-                        unlock_udomain(d);
+                        unlock_udomain(d, &uid);
 			rpc->fault(c, 404, "No Registered Contacts Found");
                         return;
                 }
 
-                unlock_udomain(d);
+                unlock_udomain(d, &uid);
         } else {
 		rpc->fault(c, 400, "Table Not Found");
         }
@@ -47,6 +47,7 @@
 #include "notify.h"
 #include "ul_callback.h"
 #include "reg_avps.h"
+#include "ul_flush.h"
 
 /*
  * Create and initialize new record structure
@@ -233,7 +234,7 @@ static inline int nodb_timer(urecord_t* _r)
 			
 			delete_reg_avps(t);
 			mem_delete_ucontact(_r, t);
-			_r->slot->d->expired++;
+			atomic_inc(&_r->slot->d->expired);
 		} else {
 			ptr = ptr->next;
 		}
@@ -283,7 +284,7 @@ static inline int wt_timer(urecord_t* _r)
 			
 			delete_reg_avps(t);
 			mem_delete_ucontact(_r, t);
-			_r->slot->d->expired++;
+			atomic_inc(&_r->slot->d->expired);
 		} else {
 			     /* the contact was unregistered and is not marked 
 			      * for replication so remove it, but the notify was
@@ -298,7 +299,9 @@ static inline int wt_timer(urecord_t* _r)
 
 
 /*
- * Write-back timer
+ * Write-back timer, the database operations are only
+ * queued here, the flusher process executes them once
+ * the slot lock is released
  */
 static inline int wb_timer(urecord_t* _r)
 {
@@ -321,57 +324,56 @@ static inline int wb_timer(urecord_t* _r)
 			    ptr->uid->len, ZSW(ptr->uid->s),
 			    ptr->c.len, ZSW(ptr->c.s));
 			if (ptr->next == 0) not=1;
-			_r->slot->d->expired++;
+			atomic_inc(&_r->slot->d->expired);
 
 			t = ptr;
 			ptr = ptr->next;
 			
 			     /* Should we remove the contact from the database ? */
 			if (st_expired_ucontact(t) == 1) {
-				db_delete_reg_avps(t);
-				if (db_delete_ucontact(t) < 0) {
-					LOG(L_ERR, "wb_timer(): Can't delete contact from the database\n");
+				if (ul_flush_add(UL_FLUSH_DELETE, t) < 0) {
+					LOG(L_ERR, "wb_timer(): Can't queue contact for deletion from the database\n");
 				}
 			}
 			
 			delete_reg_avps(t);
 			mem_delete_ucontact(_r, t);
 		} else {
+			t = ptr;
+			ptr = ptr->next;
+
 			     /* Determine the operation we have to do */
-			op = st_flush_ucontact(ptr);
+			op = st_flush_ucontact(t);
 			
 			switch(op) {
 			case 0: /* do nothing, contact is synchronized */
 				break;
 
 			case 1: /* insert */
-				if (db_insert_ucontact(ptr) < 0) {
-					LOG(L_ERR, "wb_timer(): Error while inserting contact into database\n");
+				if (ul_flush_add(UL_FLUSH_INSERT, t) < 0) {
+					LOG(L_ERR, "wb_timer(): Error while queueing contact for insertion\n");
+					t->state = CS_NEW; /* try again next time */
 				}
-				db_save_reg_avps(ptr);
 				break;
 
 			case 2: /* update */
-				if (db_update_ucontact(ptr) < 0) {
-					LOG(L_ERR, "wb_timer(): Error while updating contact in db\n");
+				if (ul_flush_add(UL_FLUSH_UPDATE, t) < 0) {
+					LOG(L_ERR, "wb_timer(): Error while queueing contact for update\n");
+					t->state = CS_DIRTY; /* try again next time */
 				}
-				db_update_reg_avps(ptr);
 				break;
 
 			case 4: /* delete */
-				db_delete_reg_avps(ptr);
-				if (db_delete_ucontact(ptr) < 0) {
-					LOG(L_ERR, "wb_timer(): Can't delete contact from database\n");
+				if (ul_flush_add(UL_FLUSH_DELETE, t) < 0) {
+					LOG(L_ERR, "wb_timer(): Can't queue contact for deletion from the database\n");
 				}
 				     /* fall through to the next case statement */
 
 			case 3: /* delete from memory */
-				delete_reg_avps(ptr);
-				mem_delete_ucontact(_r, ptr);
+				delete_reg_avps(t);
+				mem_delete_ucontact(_r, t);
 				break;
 			}
-
-			ptr = ptr->next;
 		}
 	}
 
@@ -57,10 +57,6 @@ typedef struct urecord {
 	ucontact_t* contacts;          /* One or more contact fields */
 	
 	struct hslot* slot;            /* Collision slot in the hash table array we belong to */
-	struct {
-		struct urecord* prev;  /* Next item in the linked list */
-		struct urecord* next;  /* Previous item in the linked list */
-	} d_ll;
 	struct {                         /* Linked list of all elements in hash table */
 		struct urecord* prev;  /* Previous item in the list */
 		struct urecord* next;  /* Next item in the list */
@@ -38,6 +38,10 @@
  */
 
 
+#ifdef __linux__
+	#define _GNU_SOURCE /* sched_setaffinity() */
+	#include <sched.h>
+#endif
 #include "pt.h"
 #include "tcp_init.h"
 #include "sr_module.h"
@@ -410,3 +414,34 @@ end:
 	return ret;
 }
 #endif
+
+
+
+/**
+ * Pins the calling process on a CPU.
+ * @param cpu - index of the cpu, taken modulo the number of online cpus
+ * @returns 0 on success, -1 on error or if not supported
+ */
+int set_process_cpu(int cpu)
+{
+#ifdef __linux__
+	cpu_set_t set;
+	long cpus;
+
+	cpus=sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus<1) cpus=1;
+	CPU_ZERO(&set);
+	CPU_SET(cpu%cpus, &set);
+	if (sched_setaffinity(0, sizeof(set), &set)==-1){
+		LOG(L_ERR, "ERROR: set_process_cpu: could not pin process %d to"
+				" cpu %d: %s\n", process_no, (int)(cpu%cpus), strerror(errno));
+		return -1;
+	}
+	DBG("set_process_cpu: process %d pinned to cpu %d\n", process_no,
+			(int)(cpu%cpus));
+	return 0;
+#else
+	LOG(L_WARN, "WARNING: set_process_cpu: cpu affinity not supported\n");
+	return -1;
+#endif
+}
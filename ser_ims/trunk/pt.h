@@ -57,6 +57,10 @@ struct process_table {
 	int idx; 		/* tcp child index, -1 for other processes 	*/
 #endif
 	char desc[MAX_PT_DESC];
+	unsigned int udp_rcv_calls;	/* recvfrom()/recvmmsg() calls that returned data */
+	unsigned int udp_rcv_msgs;	/* datagrams received by them 					*/
+	unsigned int udp_snd_calls;	/* sendto()/sendmmsg() calls from udp_send_batch()	*/
+	unsigned int udp_snd_msgs;	/* datagrams sent by them 						*/
 };
 
 extern struct process_table *pt;
@@ -83,6 +87,8 @@ int fork_process(int child_id,char *desc,int make_sock);
 
 void drop_my_process();
 
+int set_process_cpu(int cpu);
+
 /**
  * Forks a new TCP process.
  * @param desc - text description for the process table
@@ -380,17 +380,16 @@ void free_rdata_list(struct rdata* head)
 
 
 
-/* gets the DNS records for name:type
+/* parses a dns answer (msg, size bytes) to a name:type query
  * returns a dyn. alloc'ed struct rdata linked list with the parsed responses
- * or 0 on error
+ * or 0 on error (name is used only for logging)
  * see rfc1035 for the query/response format */
-struct rdata* get_record(char* name, int type, int flags)
+struct rdata* dns_parse_answer(unsigned char* msg, int size, char* name,
+								int type, int flags)
 {
-	int size;
 	int skip;
 	int qno, answers_no;
 	int r;
-	static union dns_query buff;
 	unsigned char* p;
 	unsigned char* end;
 	static char rec_name[MAX_DNS_NAME]; /* placeholder for the record name */
@@ -404,24 +403,18 @@ struct rdata* get_record(char* name, int type, int flags)
 	struct srv_rdata* srv_rd;
 	struct srv_rdata* crt_srv;
 	
-	size=res_search(name, C_IN, type, buff.buff, sizeof(buff));
-	if (size<0) {
-		DBG("get_record: lookup(%s, %d) failed\n", name, type);
-		goto not_found;
-	}
-	else if (size > sizeof(buff)) size=sizeof(buff);
 	head=rd=0;
 	last=crt=&head;
 	
-	p=buff.buff+DNS_HDR_SIZE;
-	end=buff.buff+size;
+	p=msg+DNS_HDR_SIZE;
+	end=msg+size;
 	if (p>=end) goto error_boundary;
-	qno=ntohs((unsigned short)buff.hdr.qdcount);
+	qno=ntohs((unsigned short)((HEADER*)msg)->qdcount);
 
 	for (r=0; r<qno; r++){
 		/* skip the name of the question */
 		if ((p=dns_skipname(p, end))==0) {
-			LOG(L_ERR, "ERROR: get_record: skipname==0\n");
+			LOG(L_ERR, "ERROR: dns_parse_answer: skipname==0\n");
 			goto error;
 		}
 		p+=2+2; /* skip QCODE & QCLASS */
@@ -430,29 +423,29 @@ struct rdata* get_record(char* name, int type, int flags)
 		p+=1+2+2; /* skip the ending  '\0, QCODE and QCLASS */
 	#endif
 		if (p>end) {
-			LOG(L_ERR, "ERROR: get_record: p>=end\n");
+			LOG(L_ERR, "ERROR: dns_parse_answer: p>=end\n");
 			goto error;
 		}
 	};
-	answers_no=ntohs((unsigned short)buff.hdr.ancount);
+	answers_no=ntohs((unsigned short)((HEADER*)msg)->ancount);
 again:
 	for (r=0; (r<answers_no) && (p<end); r++){
 #if 0
 		/*  ignore it the default domain name */
 		if ((p=dns_skipname(p, end))==0) {
-			LOG(L_ERR, "ERROR: get_record: skip_name=0 (#2)\n");
+			LOG(L_ERR, "ERROR: dns_parse_answer: skip_name=0 (#2)\n");
 			goto error;
 		}
 #else
-		if ((skip=dn_expand(buff.buff, end, p, rec_name, MAX_DNS_NAME-1))==-1){
-			LOG(L_ERR, "ERROR: get_record: dn_expand(rec_name) failed\n");
+		if ((skip=dn_expand(msg, end, p, rec_name, MAX_DNS_NAME-1))==-1){
+			LOG(L_ERR, "ERROR: dns_parse_answer: dn_expand(rec_name) failed\n");
 			goto error;
 		}
 #endif
 		p+=skip;
 		rec_name_len=strlen(rec_name);
 		if (rec_name_len>255){
-			LOG(L_ERR, "ERROR: get_record: dn_expand(rec_name): name too"
+			LOG(L_ERR, "ERROR: dns_parse_answer: dn_expand(rec_name): name too"
 					" long  (%d)\n", rec_name_len);
 			goto error;
 		}
@@ -483,7 +476,7 @@ again:
 		
 		rd=(struct rdata*) local_malloc(sizeof(struct rdata)+rec_name_len+1-1);
 		if (rd==0){
-			LOG(L_ERR, "ERROR: get_record: out of memory\n");
+			LOG(L_ERR, "ERROR: dns_parse_answer: out of memory\n");
 			goto error;
 		}
 		rd->type=rtype;
@@ -495,7 +488,7 @@ again:
 		rd->name_len=rec_name_len;
 		switch(rtype){
 			case T_SRV:
-				srv_rd= dns_srv_parser(buff.buff, end, p);
+				srv_rd= dns_srv_parser(msg, end, p);
 				rd->rdata=(void*)srv_rd;
 				if (srv_rd==0) goto error_parse;
 				
@@ -531,19 +524,19 @@ again:
 				last=&(rd->next);
 				break;
 			case T_CNAME:
-				rd->rdata=(void*) dns_cname_parser(buff.buff, end, p);
+				rd->rdata=(void*) dns_cname_parser(msg, end, p);
 				if(rd->rdata==0) goto error_parse;
 				*last=rd;
 				last=&(rd->next);
 				break;
 			case T_NAPTR:
-				rd->rdata=(void*) dns_naptr_parser(buff.buff, end, p);
+				rd->rdata=(void*) dns_naptr_parser(msg, end, p);
 				if(rd->rdata==0) goto error_parse;
 				*last=rd;
 				last=&(rd->next);
 				break;
 			default:
-				LOG(L_ERR, "WARNING: get_record: unknown type %d\n", rtype);
+				LOG(L_ERR, "WARNING: dns_parse_answer: unknown type %d\n", rtype);
 				rd->rdata=0;
 				*last=rd;
 				last=&(rd->next);
@@ -554,12 +547,12 @@ again:
 	}
 	if (flags & RES_AR){
 		flags&=~RES_AR;
-		answers_no=ntohs((unsigned short)buff.hdr.nscount);
-		DBG("get_record: skipping %d NS (p=%p, end=%p)\n", answers_no, p, end);
+		answers_no=ntohs((unsigned short)((HEADER*)msg)->nscount);
+		DBG("dns_parse_answer: skipping %d NS (p=%p, end=%p)\n", answers_no, p, end);
 		for (r=0; (r<answers_no) && (p<end); r++){
 			/* skip over the ns records */
 			if ((p=dns_skipname(p, end))==0) {
-				LOG(L_ERR, "ERROR: get_record: skip_name=0 (#3)\n");
+				LOG(L_ERR, "ERROR: dns_parse_answer: skip_name=0 (#3)\n");
 				goto error;
 			}
 			/* check if enough space is left for type, class, ttl & size */
@@ -567,31 +560,47 @@ again:
 			memcpy((void*)&rdlength, (void*)p+2+2+4, 2);
 			p+=2+2+4+2+ntohs(rdlength);
 		}
-		answers_no=ntohs((unsigned short)buff.hdr.arcount);
-		DBG("get_record: parsing %d ARs (p=%p, end=%p)\n", answers_no, p, end);
+		answers_no=ntohs((unsigned short)((HEADER*)msg)->arcount);
+		DBG("dns_parse_answer: parsing %d ARs (p=%p, end=%p)\n", answers_no, p, end);
 		goto again; /* add also the additional records */
 	}
 			
 	return head;
 error_boundary:
-		LOG(L_ERR, "ERROR: get_record: end of query buff reached\n");
+		LOG(L_ERR, "ERROR: dns_parse_answer: end of query buff reached\n");
 		if (head) free_rdata_list(head);
 		return 0;
 error_parse:
-		LOG(L_ERR, "ERROR: get_record: rdata parse error (%s, %d), %p-%p"
+		LOG(L_ERR, "ERROR: dns_parse_answer: rdata parse error (%s, %d), %p-%p"
 						" rtype=%d, class=%d, ttl=%d, rdlength=%d \n",
 				name, type,
 				p, end, rtype, class, ttl, rdlength);
 		if (rd) local_free(rd); /* rd->rdata=0 & rd is not linked yet into
 								   the list */
 error:
-		LOG(L_ERR, "ERROR: get_record \n");
+		LOG(L_ERR, "ERROR: dns_parse_answer \n");
 		if (head) free_rdata_list(head);
-not_found:
 	return 0;
 }
 
 
+/* gets the DNS records for name:type
+ * returns a dyn. alloc'ed struct rdata linked list with the parsed responses
+ * or 0 on error */
+struct rdata* get_record(char* name, int type, int flags)
+{
+	int size;
+	static union dns_query buff;
+	
+	size=res_search(name, C_IN, type, buff.buff, sizeof(buff));
+	if (size<0) {
+		DBG("get_record: lookup(%s, %d) failed\n", name, type);
+		return 0;
+	}
+	else if (size > sizeof(buff)) size=sizeof(buff);
+	return dns_parse_answer(buff.buff, size, name, type, flags);
+}
+
 
 
 
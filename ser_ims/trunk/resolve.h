@@ -147,6 +147,8 @@ struct cname_rdata {
 
 
 struct rdata* get_record(char* name, int type, int flags);
+struct rdata* dns_parse_answer(unsigned char* msg, int size, char* name,
+								int type, int flags);
 void free_rdata_list(struct rdata* head);
 
 
@@ -47,6 +47,7 @@
 #include "ut.h"
 #include "re.h"
 #include "route_struct.h"
+#include "route.h"
 #include "flags.h"
 #include "trim.h"
 
@@ -872,6 +873,27 @@ int fixup_str_2(void** param, int param_no)
     else return 0;
 }
 
+/*
+ * The 1st parameter is the name of a failure_route, it will be
+ * converted to the route index (to resume a suspended transaction in)
+ */
+int fixup_failure_route_1(void** param, int param_no)
+{
+    int route_no;
+
+    if (param_no != 1) return 0;
+    route_no = route_get(&failure_rt, (char*)*param);
+    if (route_no == -1) {
+	ERR("Cannot fix failure_route \"%s\"\n", (char*)*param);
+	return E_UNSPEC;
+    }
+    if (failure_rt.rlist[route_no] == 0) {
+	WARN("failure_route \"%s\" is empty / doesn't exist\n", (char*)*param);
+    }
+    *param = (void*)(long)route_no;
+    return 0;
+}
+
 
 /*
  * Get the function parameter value as string
@@ -293,6 +293,12 @@ int fixup_str_1(void** param, int param_no);
 /* Same as fixup_str_12 but applies to the 2nd parameter only */
 int fixup_str_2(void** param, int param_no);
 
+/*
+ * The 1st parameter is the name of a failure_route, it will be
+ * converted to the route index (to resume a suspended transaction in)
+ */
+int fixup_failure_route_1(void** param, int param_no);
+
 /*
  * Get the function parameter value as string
  * Return values:  0 - Success
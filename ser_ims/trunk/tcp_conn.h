@@ -56,11 +56,15 @@
 							 the connection to the tcp master process */
 #define TCP_MAIN_SELECT_TIMEOUT 5 /* how often "tcp main" checks for timeout*/
 #define TCP_CHILD_SELECT_TIMEOUT 2 /* the same as above but for children */
+#define DEFAULT_TCP_WBUF_MAX (256*1024) /* maximum bytes queued for write on
+										   a connection */
 
 
 /* tcp connection flags */
 #define F_CONN_NON_BLOCKING 1
 #define F_CONN_REMOVED      2 /* no longer  in "main" listen fd list */
+#define F_CONN_WRITE_W      4 /* watched for write by "main" */
+#define F_CONN_PENDING      8 /* async connect not yet completed */
 
 
 enum tcp_req_errors {	TCP_REQ_INIT, TCP_REQ_OK, TCP_READ_ERROR,
@@ -80,9 +84,10 @@ enum tcp_conn_states { S_CONN_ERROR=-2, S_CONN_BAD=-1, S_CONN_OK=0,
 
 /* fd communication commands */
 enum conn_cmds { CONN_DESTROY=-3, CONN_ERROR=-2, CONN_EOF=-1, CONN_RELEASE, 
-					CONN_GET_FD, CONN_NEW , SOCKET_INFO_IPSEC,ADD_CONNECTION_IPSEC,FREE_PORT_IPSEC};
+					CONN_GET_FD, CONN_NEW , SOCKET_INFO_IPSEC,ADD_CONNECTION_IPSEC,FREE_PORT_IPSEC,
+					CONN_QUEUED_WRITE };
 /* CONN_RELEASE, EOF, ERROR, DESTROY can be used by "reader" processes
- * CONN_GET_FD, NEW, ERROR only by writers */
+ * CONN_GET_FD, NEW, ERROR, QUEUED_WRITE only by writers */
 
 struct tcp_req{
 	struct tcp_req* next;
@@ -103,6 +108,24 @@ struct tcp_req{
 
 
 
+/* outbound data that could not be written without blocking, kept until
+ * "tcp main" (or the reader holding the connection) can flush it */
+struct tcp_wbuffer{
+	struct tcp_wbuffer* next;
+	unsigned int len; /* bytes in buf */
+	char buf[1];
+};
+
+struct tcp_wbuffer_queue{
+	struct tcp_wbuffer* first;
+	struct tcp_wbuffer* last;
+	unsigned int queued; /* total bytes queued */
+	unsigned int offset; /* bytes already written from first */
+	ticks_t wr_timeout; /* flush deadline for the oldest queued data */
+};
+
+
+
 struct tcp_connection;
 
 /* tcp port alias structure */
@@ -137,6 +160,7 @@ struct tcp_connection{
 	struct tcp_connection* c_prev;
 	struct tcp_conn_alias con_aliases[TCP_CON_MAX_ALIASES];
 	int aliases; /* aliases number, at least 1 */
+	struct tcp_wbuffer_queue wbufq; /* pending writes, under write_lock */
 };
 
 
@@ -200,6 +224,7 @@ static inline unsigned tcp_addr_hash(struct ip_addr* ip, unsigned short port)
 
 struct tcp_connection* tcpconn_get(int id, struct ip_addr* ip, int port,
 									ticks_t timeout);
+int tcpconn_wbufq_flush(struct tcp_connection* c, int fd);
 
 #endif
 
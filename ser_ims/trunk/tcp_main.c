@@ -156,6 +156,29 @@
 #define SEND_FD_QUEUE_TIMEOUT	MS_TO_TICKS(2000)  /* 2 s */
 #endif
 
+#define TCP_BUF_WRITE /* if a send would block, queue the rest of the data
+						 on the connection and let "tcp main" (or the reader
+						 holding it) flush it when the socket is writeable,
+						 instead of blocking the sender (tcp only, tls writes
+						 still block) */
+#define TCP_CONNECT_WAIT /* don't wait for connect() to complete, queue the
+							data until "tcp main" sees the socket writeable */
+#define TCP_FD_CACHE /* keep the fds received from "tcp main" in each process,
+						for the next sends on the same connection */
+#ifdef TCP_CONNECT_WAIT
+#ifndef TCP_BUF_WRITE
+#define TCP_BUF_WRITE
+#endif
+#endif
+#ifdef TCP_FD_CACHE
+#define TCP_FD_CACHE_SIZE		32	/* per process, must be 2^k */
+#endif
+#ifdef HAVE_MSG_NOSIGNAL
+#define TCP_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define TCP_SEND_FLAGS 0
+#endif
+
 /* maximum accepted lifetime (maximum possible is  ~ MAXINT/2) */
 #define MAX_TCP_CON_LIFETIME	(1U<<(sizeof(ticks_t)*8-1))
 /* minimum interval tcpconn_timeout() is allowed to run, in ticks */
@@ -173,6 +196,7 @@ int tcp_con_lifetime=DEFAULT_TCP_CONNECTION_LIFETIME;
 enum poll_types tcp_poll_method=0; /* by default choose the best method */
 int tcp_max_connections=DEFAULT_TCP_MAX_CONNECTIONS;
 int tcp_max_fd_no=0;
+int tcp_wbuf_max=DEFAULT_TCP_WBUF_MAX; /* max. bytes queued per connection */
 
 static int* tcp_connections_no=0; /* current open connections */
 
@@ -475,8 +499,10 @@ struct tcp_connection* tcpconn_connect(union sockaddr_union* server, int type)
 	socklen_t my_name_len;
 	struct tcp_connection* con;
 	struct ip_addr ip;
+	int pending;
 
 	s=-1;
+	pending=0;
 	
 	if (*tcp_connections_no >= tcp_max_connections){
 		LOG(L_ERR, "ERROR: tcpconn_connect: maximum number of connections"
@@ -494,6 +520,22 @@ struct tcp_connection* tcpconn_connect(union sockaddr_union* server, int type)
 		LOG(L_ERR, "ERROR: tcpconn_connect: init_sock_opt failed\n");
 		goto error;
 	}
+#ifdef TCP_CONNECT_WAIT
+	if (type!=PROTO_TLS){
+		/* s is non-blocking, "tcp main" will wait for the connect to
+		 * complete (the tls handshake needs a connected socket) */
+again:
+		if (connect(s, &server->s, sockaddru_len(*server))==-1){
+			if (errno==EINTR) goto again;
+			if (errno!=EINPROGRESS){
+				LOG(L_ERR, "ERROR: tcpconn_connect: connect: (%d) %s\n",
+						errno, strerror(errno));
+				goto error;
+			}
+			pending=1;
+		}
+	}else
+#endif
 	if (tcp_blocking_connect(s, &server->s, sockaddru_len(*server))<0){
 		LOG(L_ERR, "ERROR: tcpconn_connect: tcp_blocking_connect failed\n");
 		goto error;
@@ -526,6 +568,7 @@ struct tcp_connection* tcpconn_connect(union sockaddr_union* server, int type)
 				 " socket\n");
 		goto error;
 	}
+	if (pending) con->flags|=F_CONN_PENDING;
 	return con;
 	/*FIXME: set sock idx! */
 error:
@@ -535,6 +578,198 @@ error:
 
 
 
+#ifdef TCP_BUF_WRITE
+/* appends len bytes to the connection write queue
+ * must be called with c->write_lock held
+ * returns 0 on success, -1 on error (queue full or out of memory) */
+static int wbufq_add(struct tcp_connection* c, char* data, unsigned int len)
+{
+	struct tcp_wbuffer_queue* q;
+	struct tcp_wbuffer* wb;
+	
+	q=&c->wbufq;
+	if (q->queued+len>(unsigned int)tcp_wbuf_max){
+		LOG(L_ERR, "ERROR: wbufq_add: write queue full for %p (id %d):"
+				" %u queued, %u more, max %d\n", c, c->id, q->queued, len,
+				tcp_wbuf_max);
+		return -1;
+	}
+	wb=shm_malloc(sizeof(struct tcp_wbuffer)+len-1);
+	if (wb==0){
+		LOG(L_ERR, "ERROR: wbufq_add: out of shared memory\n");
+		return -1;
+	}
+	wb->next=0;
+	wb->len=len;
+	memcpy(wb->buf, data, len);
+	if (q->last){
+		q->last->next=wb;
+	}else{
+		q->first=wb;
+		q->offset=0;
+		q->wr_timeout=get_ticks_raw()+((c->flags & F_CONN_PENDING)?
+										S_TO_TICKS(tcp_connect_timeout):
+										S_TO_TICKS(tcp_send_timeout));
+	}
+	q->last=wb;
+	q->queued+=len;
+	return 0;
+}
+
+
+
+static void wbufq_destroy(struct tcp_wbuffer_queue* q)
+{
+	struct tcp_wbuffer* wb;
+	
+	while(q->first){
+		wb=q->first;
+		q->first=wb->next;
+		shm_free(wb);
+	}
+	q->last=0;
+	q->queued=0;
+	q->offset=0;
+}
+
+
+
+/* writes as much as possible from the write queue, without blocking
+ * must be called with c->write_lock held
+ * returns -1 on error, 0 if data is still queued, 1 if the queue is empty */
+static int _wbufq_run(int fd, struct tcp_connection* c)
+{
+	struct tcp_wbuffer_queue* q;
+	struct tcp_wbuffer* wb;
+	int n;
+	
+	q=&c->wbufq;
+	while(q->first){
+		wb=q->first;
+		n=send(fd, wb->buf+q->offset, wb->len-q->offset, TCP_SEND_FLAGS);
+		if (n<0){
+			if (errno==EINTR) continue;
+			if ((errno==EAGAIN)||(errno==EWOULDBLOCK)) return 0;
+			LOG(L_ERR, "ERROR: wbufq_run: send on %p (id %d) failed:"
+					" (%d) %s\n", c, c->id, errno, strerror(errno));
+			return -1;
+		}
+		/* some progress, restart the send timeout */
+		q->wr_timeout=get_ticks_raw()+S_TO_TICKS(tcp_send_timeout);
+		q->queued-=n;
+		q->offset+=n;
+		if (q->offset<wb->len) return 0; /* partial write */
+		q->first=wb->next;
+		if (q->first==0) q->last=0;
+		q->offset=0;
+		shm_free(wb);
+	}
+	return 1;
+}
+
+
+
+/* writes without blocking, returns the number of bytes written or -1 */
+static int tcp_nonblock_write(int fd, char* buf, unsigned int len)
+{
+	unsigned int written;
+	int n;
+	
+	written=0;
+	while(written<len){
+		n=send(fd, buf+written, len-written, TCP_SEND_FLAGS);
+		if (n<0){
+			if (errno==EINTR) continue;
+			if ((errno==EAGAIN)||(errno==EWOULDBLOCK)) break;
+			LOG(L_ERR, "ERROR: tcp_nonblock_write: failed to send: (%d) %s\n",
+					errno, strerror(errno));
+			return -1;
+		}
+		written+=n;
+	}
+	return written;
+}
+#endif /* TCP_BUF_WRITE */
+
+
+
+/* tries to write the data queued on c on fd, without blocking
+ * (used by the reader holding the connection)
+ * returns -1 on error, 0 if data is still queued, 1 if the queue is empty */
+int tcpconn_wbufq_flush(struct tcp_connection* c, int fd)
+{
+#ifdef TCP_BUF_WRITE
+	int ret;
+	
+	ret=0;
+	lock_get(&c->write_lock);
+	/* a pending connect is completed only by "tcp main" */
+	if (!(c->flags & F_CONN_PENDING))
+		ret=_wbufq_run(fd, c);
+	lock_release(&c->write_lock);
+	return ret;
+#else
+	return 1;
+#endif
+}
+
+
+
+#ifdef TCP_FD_CACHE
+/* per process cache of the fds received from "tcp main", indexed after the
+ * connection id; the connection pointer and id are checked on each use,
+ * "tcp main" shutdown()s the socket when it destroys the connection, so a
+ * stale entry only keeps a dead fd open until it's replaced */
+struct fd_cache_entry{
+	struct tcp_connection* con;
+	int id;
+	int fd;
+};
+
+static struct fd_cache_entry fd_cache[TCP_FD_CACHE_SIZE];
+
+
+
+static inline int tcp_fd_cache_get(struct tcp_connection* c)
+{
+	struct fd_cache_entry* e;
+	
+	e=&fd_cache[c->id&(TCP_FD_CACHE_SIZE-1)];
+	if ((e->con==c) && (e->id==c->id))
+		return e->fd;
+	return -1;
+}
+
+
+
+static inline void tcp_fd_cache_add(struct tcp_connection* c, int fd)
+{
+	struct fd_cache_entry* e;
+	
+	e=&fd_cache[c->id&(TCP_FD_CACHE_SIZE-1)];
+	if (e->con) close(e->fd);
+	e->con=c;
+	e->id=c->id;
+	e->fd=fd;
+}
+
+
+
+/* removes c from the cache and closes its fd */
+static inline void tcp_fd_cache_rm(struct tcp_connection* c)
+{
+	struct fd_cache_entry* e;
+	
+	e=&fd_cache[c->id&(TCP_FD_CACHE_SIZE-1)];
+	if ((e->con==c) && (e->id==c->id)){
+		close(e->fd);
+		e->con=0;
+	}
+}
+#endif /* TCP_FD_CACHE */
+
+
+
 /* adds a tcp connection to the tcpconn hashes
  * Note: it's called _only_ from the tcp_main process */
 struct tcp_connection*  tcpconn_add(struct tcp_connection *c)
@@ -573,6 +808,9 @@ void _tcpconn_rm(struct tcp_connection* c)
 		tcpconn_listrm(tcpconn_aliases_hash[c->con_aliases[r].hash], 
 						&c->con_aliases[r], next, prev);
 	lock_destroy(&c->write_lock);
+#ifdef TCP_BUF_WRITE
+	wbufq_destroy(&c->wbufq);
+#endif
 #ifdef USE_TLS
 	if (c->type==PROTO_TLS) tls_tcpconn_clean(c);
 #endif
@@ -592,6 +830,9 @@ void tcpconn_rm(struct tcp_connection* c)
 						&c->con_aliases[r], next, prev);
 	TCPCONN_UNLOCK;
 	lock_destroy(&c->write_lock);
+#ifdef TCP_BUF_WRITE
+	wbufq_destroy(&c->wbufq);
+#endif
 #ifdef USE_TLS
 	if ((c->type==PROTO_TLS)&&(c->extra_data)) tls_tcpconn_clean(c);
 #endif
@@ -720,7 +961,9 @@ error_sec:
 
 /* finds a tcpconn & sends on it
  * uses the dst members to, proto (TCP|TLS) and id
- * returns: number of bytes written (>=0) on success
+ * if the data cannot be written without blocking, the rest is queued on
+ * the connection and "tcp main" flushes it (TCP_BUF_WRITE)
+ * returns: number of bytes written or queued (>=0) on success
  *          <0 on error */
 int tcp_send(struct dest_info* dst, char* buf, unsigned len)
 {
@@ -731,6 +974,13 @@ int tcp_send(struct dest_info* dst, char* buf, unsigned len)
 	int fd;
 	long response[2];
 	int n;
+	int do_close_fd;
+#ifdef TCP_BUF_WRITE
+	int enable_write_watch;
+	
+	enable_write_watch=0;
+#endif
+	do_close_fd=1;
 	
 	port=su_getport(&dst->to);
 	if (port){
@@ -766,6 +1016,21 @@ no_id:
 			}
 			atomic_set(&c->refcnt, 1); /* ref. only from here for now */
 			fd=c->s;
+#ifdef TCP_CONNECT_WAIT
+			if (c->flags & F_CONN_PENDING){
+				/* not yet visible to anybody else, no lock needed; "tcp main"
+				 * will write it when the connect completes */
+				if (wbufq_add(c, buf, len)<0){
+					LOG(L_ERR, "ERROR: tcp_send: failed to queue the data on"
+								" a new connection\n");
+					lock_destroy(&c->write_lock);
+					wbufq_destroy(&c->wbufq);
+					shm_free(c);
+					close(fd);
+					return -1;
+				}
+			}
+#endif
 			
 			/* send the new tcpconn to "tcp main" */
 			response[0]=(long)c;
@@ -776,10 +1041,29 @@ no_id:
 						strerror(errno), errno);
 				n=-1;
 				goto end;
-			}	
+			}
+#ifdef TCP_FD_CACHE
+			tcp_fd_cache_add(c, fd);
+			do_close_fd=0;
+#endif
+#ifdef TCP_CONNECT_WAIT
+			if (c->flags & F_CONN_PENDING){
+				n=len;
+				goto end;
+			}
+#endif
 			goto send_it;
 		}
 get_fd:
+#ifdef TCP_FD_CACHE
+			fd=tcp_fd_cache_get(c);
+			if (fd!=-1){
+				DBG("tcp_send: tcp connection found (%p), cached fd %d\n",
+						c, fd);
+				do_close_fd=0;
+				goto send_it;
+			}
+#endif
 			/* todo: see if this is not the same process holding
 			 *  c  and if so send directly on c->fd */
 			DBG("tcp_send: tcp connection found (%p), acquiring fd\n", c);
@@ -812,6 +1096,10 @@ get_fd:
 				goto end;
 			}
 			DBG("tcp_send: after receive_fd: c= %p n=%d fd=%d\n",c, n, fd);
+#ifdef TCP_FD_CACHE
+			tcp_fd_cache_add(c, fd);
+			do_close_fd=0;
+#endif
 		
 	
 	
@@ -823,8 +1111,28 @@ send_it:
 		n=tls_blocking_write(c, fd, buf, len);
 	else
 #endif
+	{
+#ifdef TCP_BUF_WRITE
+		if (c->wbufq.first || (c->flags & F_CONN_PENDING)){
+			/* keep the order: append after the already queued data, whoever
+			 * queued it already asked "tcp main" to flush it */
+			n=(wbufq_add(c, buf, len)<0)?-1:(int)len;
+		}else{
+			n=tcp_nonblock_write(fd, buf, len);
+			if ((n>=0) && (n<(int)len)){
+				if (wbufq_add(c, buf+n, len-n)<0){
+					n=-1;
+				}else{
+					n=len;
+					enable_write_watch=1;
+				}
+			}
+		}
+#else
 		/* n=tcp_blocking_write(c, fd, buf, len); */
 		n=tsend_stream(fd, buf, len, tcp_send_timeout*1000); 
+#endif
+	}
 	lock_release(&c->write_lock);
 	DBG("tcp_send: after write: c= %p n=%d fd=%d\n",c, n, fd);
 	DBG("tcp_send: buf=\n%.*s\n", (int)len, buf);
@@ -844,11 +1152,30 @@ send_it:
 		}
 		/* CONN_ERROR will auto-dec refcnt => we must not call tcpconn_put 
 		 * if it succeeds */
+#ifdef TCP_FD_CACHE
+		if (!do_close_fd) tcp_fd_cache_rm(c);
+		else
+#endif
 		close(fd);
 		return n; /* error return, no tcpconn_put */
 	}
+#ifdef TCP_BUF_WRITE
+	if (enable_write_watch){
+		/* ask "tcp main" to watch the socket for write; CONN_QUEUED_WRITE
+		 * will auto-dec refcnt => no tcpconn_put if it succeeds */
+		response[0]=(long)c;
+		response[1]=CONN_QUEUED_WRITE;
+		if (send_all(unix_tcp_sock, response, sizeof(response))<=0){
+			LOG(L_ERR, "BUG: tcp_send: queued write notification failed:"
+						" %s (%d)\n", strerror(errno), errno);
+			goto end;
+		}
+		if (do_close_fd) close(fd);
+		return n;
+	}
+#endif
 end:
-	close(fd);
+	if (do_close_fd) close(fd);
 release_c:
 	tcpconn_put(c); /* release c (lock; dec refcnt; unlock) */
 	return n;
@@ -969,6 +1296,10 @@ static void tcpconn_destroy(struct tcp_connection* tcpconn)
 			tls_close(tcpconn, fd);
 #endif
 		_tcpconn_rm(tcpconn);
+#ifdef TCP_FD_CACHE
+		/* other processes might still have it in their fd cache */
+		shutdown(fd, SHUT_RDWR);
+#endif
 		close(fd);
 		(*tcp_connections_no)--;
 	}else{
@@ -1119,6 +1450,65 @@ inline static void send_fd_queue_run(struct tcp_send_fd_q* q)
 
 
 
+#ifdef TCP_BUF_WRITE
+/* starts watching for write a connection (in the "tcp main" io set) that
+ * has data queued or a connect pending */
+inline static void tcpconn_watch_write(struct tcp_connection* c, int fd_i)
+{
+	if ((c->flags & (F_CONN_REMOVED|F_CONN_WRITE_W)) ||
+			!(c->wbufq.first || (c->flags & F_CONN_PENDING)))
+		return;
+	if (io_watch_chg(&io_h, c->s, POLLIN|POLLOUT, fd_i)<0){
+		LOG(L_ERR, "ERROR: tcpconn_watch_write: failed to watch %p (id %d)"
+				" for write\n", c, c->id);
+		return;
+	}
+	c->flags|=F_CONN_WRITE_W;
+}
+
+
+
+/* completes a pending connect and writes the queued data,
+ * called when a connection watched for write becomes writeable
+ * returns -1 on error (the connection should be destroyed), 0 on success */
+inline static int tcpconn_main_flush(struct tcp_connection* c, int fd_i)
+{
+	int err;
+	unsigned int err_len;
+	int empty;
+	int ret;
+	
+	lock_get(&c->write_lock);
+	if (c->flags & F_CONN_PENDING){
+		err_len=sizeof(err);
+		if (getsockopt(c->s, SOL_SOCKET, SO_ERROR, &err, &err_len)<0)
+			err=errno;
+		if (err){
+			lock_release(&c->write_lock);
+			LOG(L_ERR, "ERROR: tcpconn_main_flush: connect failed for %p"
+					" (id %d): (%d) %s\n", c, c->id, err, strerror(err));
+			return -1;
+		}
+		c->flags&=~F_CONN_PENDING;
+		c->wbufq.wr_timeout=get_ticks_raw()+S_TO_TICKS(tcp_send_timeout);
+	}
+	ret=_wbufq_run(c->s, c);
+	empty=(c->wbufq.first==0);
+	lock_release(&c->write_lock);
+	if (ret<0) return -1;
+	if (empty){
+		/* a sender queueing something new will ask for write again */
+		if (io_watch_chg(&io_h, c->s, POLLIN, fd_i)<0)
+			LOG(L_ERR, "ERROR: tcpconn_main_flush: failed to stop watching"
+					" %p (id %d) for write\n", c, c->id);
+		c->flags&=~F_CONN_WRITE_W;
+	}
+	return 0;
+}
+#endif /* TCP_BUF_WRITE */
+
+
+
 /* handles io from a tcp child process
  * params: tcp_c - pointer in the tcp_children array, to the entry for
  *                 which an io event was detected 
@@ -1203,6 +1593,10 @@ inline static int handle_tcp_child(struct tcp_child* tcp_c, int fd_i)
 			/* must be after the de-ref*/
 			io_watch_add(&io_h, tcpconn->s, F_TCPCONN, tcpconn);
 			tcpconn->flags&=~F_CONN_REMOVED;
+#ifdef TCP_BUF_WRITE
+			/* data queued while the reader had it */
+			tcpconn_watch_write(tcpconn, -1);
+#endif
 			DBG("handle_tcp_child: CONN_RELEASE  %p refcnt= %d\n", 
 							tcpconn, atomic_get(&tcpconn->refcnt));
 			break;
@@ -1358,7 +1752,27 @@ inline static int handle_ser_child(struct process_table* p, int fd_i)
 			tcpconn->timeout=get_ticks_raw()+tcp_con_lifetime;
 			io_watch_add(&io_h, tcpconn->s, F_TCPCONN, tcpconn);
 			tcpconn->flags&=~F_CONN_REMOVED;
+#ifdef TCP_BUF_WRITE
+			/* connect pending or a partial first write */
+			tcpconn_watch_write(tcpconn, -1);
+#endif
 			break;
+#ifdef TCP_BUF_WRITE
+		case CONN_QUEUED_WRITE:
+			/* WARNING: this will auto-dec. refcnt! */
+			if (tcpconn->state==S_CONN_BAD){
+				if (!(tcpconn->flags & F_CONN_REMOVED) && (tcpconn->s!=-1)){
+					io_watch_del(&io_h, tcpconn->s, -1, IO_FD_CLOSING);
+					tcpconn->flags|=F_CONN_REMOVED;
+				}
+				tcpconn_destroy(tcpconn);
+				break;
+			}
+			/* if a reader has it, it's watched on CONN_RELEASE */
+			tcpconn_watch_write(tcpconn, -1);
+			tcpconn_put(tcpconn);
+			break;
+#endif
                 case SOCKET_INFO_IPSEC:
                          LOG(L_INFO,"L_INFO:SOCKET_INFO_IPSEC");
 			if(!grep_sock_info(&(tcp_listen->name),port,PROTO_TCP))
@@ -1685,7 +2099,8 @@ static inline int handle_new_connect(struct socket_info* si)
  *            tcp_main is not interested in further io events that might be
  *            queued for this fd)
  */
-inline static int handle_tcpconn_ev(struct tcp_connection* tcpconn, int fd_i)
+inline static int handle_tcpconn_ev(struct tcp_connection* tcpconn, short ev,
+										int fd_i)
 {
 	/*  is refcnt!=0 really necessary? 
 	 *  No, in fact it's a bug: I can have the following situation: a send only
@@ -1703,11 +2118,29 @@ inline static int handle_tcpconn_ev(struct tcp_connection* tcpconn, int fd_i)
 					tcpconn, tcpconn->refcnt, tcpconn->s);
 		return -1;
 	}
+#endif
+#ifdef TCP_BUF_WRITE
+	if (ev & POLLOUT){
+		if ((tcpconn->flags & F_CONN_WRITE_W) &&
+				(tcpconn_main_flush(tcpconn, fd_i)<0)){
+			if (io_watch_del(&io_h, tcpconn->s, fd_i, IO_FD_CLOSING)==-1)
+				goto error;
+			tcpconn->flags|=F_CONN_REMOVED;
+			tcpconn->flags&=~F_CONN_WRITE_W;
+			tcpconn_ref(tcpconn); /* tcpconn_destroy dec. refcnt */
+			tcpconn_destroy(tcpconn);
+			return 0;
+		}
+		/* write only event (or a sigio one we didn't ask for) */
+		if (!(ev & (POLLIN|POLLPRI|POLLERR|POLLHUP)))
+			return 0;
+	}
 #endif
 	/* pass it to child, so remove it from the io watch list */
 	DBG("handle_tcpconn_ev: data available on %p %d\n", tcpconn, tcpconn->s);
 	if (io_watch_del(&io_h, tcpconn->s, fd_i, 0)==-1) goto error;
 	tcpconn->flags|=F_CONN_REMOVED;
+	tcpconn->flags&=~F_CONN_WRITE_W;
 	tcpconn_ref(tcpconn); /* refcnt ++ */
 	if (send2child(tcpconn)<0){
 		LOG(L_ERR,"ERROR: handle_tcpconn_ev: no children available\n");
@@ -1743,7 +2176,8 @@ inline static int handle_io(struct fd_map* fm, int idx)
 			ret=handle_new_connect((struct socket_info*)fm->data);
 			break;
 		case F_TCPCONN:
-			ret=handle_tcpconn_ev((struct tcp_connection*)fm->data, idx);
+			ret=handle_tcpconn_ev((struct tcp_connection*)fm->data,
+									fm->revents, idx);
 			break;
 		case F_TCPCHILD:
 			ret=handle_tcp_child((struct tcp_child*)fm->data, idx);
@@ -1790,6 +2224,17 @@ static inline void tcpconn_timeout(int force)
 		c=tcpconn_id_hash[h];
 		while(c){
 			next=c->id_next;
+#ifdef TCP_BUF_WRITE
+			if (!force && c->wbufq.first && (c->state!=S_CONN_BAD) &&
+					((s_ticks_t)(ticks-c->wbufq.wr_timeout)>=0)){
+				LOG(L_ERR, "ERROR: tcpconn_timeout: %s timeout on %p (id %d),"
+						" dropping %u queued bytes\n",
+						(c->flags & F_CONN_PENDING)?"connect":"send",
+						c, c->id, c->wbufq.queued);
+				c->state=S_CONN_BAD;
+				c->timeout=ticks;
+			}
+#endif
 			if (force ||((atomic_get(&c->refcnt)==0) &&
 						((s_ticks_t)(ticks-c->timeout)>=0))){
 				if (!force)
@@ -1812,6 +2257,9 @@ static inline void tcpconn_timeout(int force)
 #endif
 				_tcpconn_rm(c);
 				if (fd>0) {
+#ifdef TCP_FD_CACHE
+					shutdown(fd, SHUT_RDWR);
+#endif
 					close(fd);
 				}
 				(*tcp_connections_no)--;
@@ -664,6 +664,10 @@ void release_tcpconn(struct tcp_connection* c, long state, int unix_sock)
 		DBG( "releasing con %p, state %ld, fd=%d, id=%d\n",
 				c, state, c->fd, c->id);
 		DBG(" extra_data %p\n", c->extra_data);
+		/* write what was queued while we had it, "tcp main" will take
+		 * care of the rest */
+		if ((state==CONN_RELEASE) && (c->fd!=-1) && c->wbufq.first)
+			tcpconn_wbufq_flush(c, c->fd);
 		/* release req & signal the parent */
 		if (c->fd!=-1) close(c->fd);
 		/* errno==EINTR, EWOULDBLOCK a.s.o todo */
@@ -818,6 +822,22 @@ skip:
 
 
 
+/* watches con for write while it has queued data: "tcp main" does not watch
+ * the connections held by a reader, so the reader flushes them when they
+ * become writeable */
+inline static void tcpconn_reader_watch_write(struct tcp_connection* con,
+												int idx)
+{
+	short events;
+	
+	events=con->wbufq.first?(POLLIN|POLLOUT):POLLIN;
+	if (io_watch_chg(&io_w, con->fd, events, idx)<0)
+		LOG(L_ERR, "ERROR: tcp_receive: failed to change the watched events"
+				" of %p (id %d) to 0x%x\n", con, con->id, events);
+}
+
+
+
 /* handle io routine, based on the fd_map type
  * (it will be called from io_wait_loop* )
  * params:  fm  - pointer to a fd hash entry
@@ -892,8 +912,22 @@ again:
 			break;
 		case F_TCPCONN:
 			con=(struct tcp_connection*)fm->data;
+			if (fm->revents & POLLOUT){
+				/* writeable, flush the queued data */
+				if (tcpconn_wbufq_flush(con, con->fd)<0){
+					resp=CONN_ERROR;
+					goto read_error;
+				}
+				if (!(fm->revents & (POLLIN|POLLPRI|POLLERR|POLLHUP))){
+					/* write only event */
+					tcpconn_reader_watch_write(con, idx);
+					ret=0;
+					break;
+				}
+			}
 			resp=tcp_read_req(con, &ret);
 			if (resp<0){
+read_error:
 				ret=-1; /* some error occured */
 				io_watch_del(&io_w, con->fd, idx, IO_FD_CLOSING);
 				tcpconn_listrm(tcp_conn_lst, con, c_next, c_prev);
@@ -902,6 +936,14 @@ again:
 			}else{
 				/* update timeout */
 				con->timeout=get_ticks_raw()+S_TO_TICKS(TCP_CHILD_TIMEOUT);
+				/* we have the fd, write the queued data if possible and
+				 * wait for the socket to become writeable for the rest */
+				if (con->wbufq.first &&
+						(tcpconn_wbufq_flush(con, con->fd)<0)){
+					resp=CONN_ERROR;
+					goto read_error;
+				}
+				tcpconn_reader_watch_write(con, idx);
 			}
 			break;
 		case F_NONE:
@@ -952,7 +994,11 @@ static inline void tcp_receive_timeout()
 			io_watch_del(&io_w, con->fd, -1, IO_FD_CLOSING);
 			tcpconn_listrm(tcp_conn_lst, con, c_next, c_prev);
 			release_tcpconn(con, CONN_RELEASE, tcpmain_sock);
+			continue;
 		}
+		/* data queued by the other processes while we hold it */
+		if (con->wbufq.first)
+			tcpconn_reader_watch_write(con, -1);
 	}
 }
 
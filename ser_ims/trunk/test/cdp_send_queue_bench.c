@@ -0,0 +1,238 @@
+/*
+ * $Id$
+ *
+ *  cdp peer send path micro-benchmark
+ *
+ *  Several producer processes (the SIP workers sending Cx requests) hand
+ *  messages to one consumer process (the cdp receiver of the peer), which
+ *  writes them on a stream socket to the "HSS" (a sink process):
+ *
+ *   - fifo:  as the old peer_send_msg(), open()/write()/close() of the named
+ *            pipe for each message and one read() + write() per message in
+ *            the receiver
+ *   - queue: as the cdp send queues, push on a shared memory MPSC queue and
+ *            signal an eventfd; the receiver drains it with one writev() per
+ *            64 messages
+ *
+ *  and reports the Cx request rate for the peer.
+ *
+ *  Compile with: gcc -O2 cdp_send_queue_bench.c -o cdp_send_queue_bench
+ *  Usage:        ./cdp_send_queue_bench [-p producers] [-c count] [-s size]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+
+#define BATCH		64
+#define FIFO_NAME	"/tmp/cdp_send_queue_bench_fifo"
+
+struct msg {
+	struct msg * volatile next;
+	int len;
+	char buf[1024];
+};
+
+struct queue {
+	struct msg * volatile in;
+	struct msg *out;
+	struct msg stub;
+};
+
+static char* help_msg="\
+Usage: cdp_send_queue_bench [-p producers] [-c count] [-s size]\n\
+Options:\n\
+    -p producers  number of sending processes (default 8)\n\
+    -c count      messages sent by each process (default 50000)\n\
+    -s size       message size, a Cx MAR/SAR is 300-600 bytes (default 400)\n\
+    -h            this help message\n\
+";
+
+static int producers=8, count=50000, size=400;
+static struct msg *msgs;	/* shm, producers*count messages */
+static struct queue *q;		/* shm */
+
+static void q_link(struct msg *m)
+{
+	struct msg *prev;
+	m->next=0;
+	prev=__atomic_exchange_n(&q->in, m, __ATOMIC_SEQ_CST);
+	prev->next=m;
+}
+
+static struct msg* q_pop()
+{
+	struct msg *out=q->out, *next=out->next;
+	if (out==&q->stub){
+		if (!next) return 0;
+		q->out=next; out=next; next=next->next;
+	}
+	if (next){ q->out=next; return out; }
+	if (out!=__atomic_load_n(&q->in, __ATOMIC_SEQ_CST)) return 0;
+	q_link(&q->stub);
+	next=out->next;
+	if (next){ q->out=next; return out; }
+	return 0;
+}
+
+/* the HSS: reads everything, returns when all the bytes arrived */
+static void sink(int sock, long total)
+{
+	char buf[65536];
+	long got=0;
+	int n;
+	while(got<total){
+		n=read(sock, buf, sizeof(buf));
+		if (n<=0){ perror("sink read"); exit(1); }
+		got+=n;
+	}
+}
+
+static void producer(int id, int mode, int efd)
+{
+	struct msg *m;
+	uint64_t one=1;
+	int i, fd;
+	for (i=0; i<count; i++){
+		m=&msgs[id*count+i];
+		if (mode==0){
+			fd=open(FIFO_NAME, O_WRONLY);
+			if (fd<0){ perror("producer open"); exit(1); }
+			if (write(fd, &m, sizeof(m))!=sizeof(m)){ perror("producer write"); exit(1); }
+			close(fd);
+		}else{
+			q_link(m);
+			while (write(efd, &one, sizeof(one))<0 && errno==EINTR);
+		}
+	}
+	exit(0);
+}
+
+/* the cdp receiver of the peer */
+static void consumer(int mode, int sock, int efd)
+{
+	struct msg *m, *batch[BATCH];
+	struct iovec iov[BATCH];
+	long sent=0, total=(long)producers*count;
+	uint64_t cnt;
+	fd_set rfds;
+	int rfd=-1, wfd, n;
+
+	if (mode==0){
+		rfd=open(FIFO_NAME, O_RDONLY|O_NDELAY);
+		wfd=open(FIFO_NAME, O_WRONLY);	/* keep-alive, as make_send_pipe() */
+		if (rfd<0 || wfd<0){ perror("consumer open"); exit(1); }
+	}
+	while(sent<total){
+		FD_ZERO(&rfds);
+		FD_SET(mode==0?rfd:efd, &rfds);
+		if (select((mode==0?rfd:efd)+1, &rfds, 0, 0, 0)<0){
+			if (errno==EINTR) continue;
+			perror("select"); exit(1);
+		}
+		if (mode==0){
+			if (read(rfd, &m, sizeof(m))!=sizeof(m)) continue;
+			if (write(sock, m->buf, m->len)!=m->len){ perror("write"); exit(1); }
+			sent++;
+		}else{
+			while (read(efd, &cnt, sizeof(cnt))<0 && errno==EINTR);
+			do {
+				for (n=0; n<BATCH && (batch[n]=q_pop())!=0; n++){
+					iov[n].iov_base=batch[n]->buf;
+					iov[n].iov_len=batch[n]->len;
+				}
+				if (n && writev(sock, iov, n)<0){ perror("writev"); exit(1); }
+				sent+=n;
+			} while(n==BATCH);
+		}
+	}
+	exit(0);
+}
+
+static double run(int mode)
+{
+	struct timeval start, end;
+	int sv[2], efd=-1, i, status;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)<0){ perror("socketpair"); exit(1); }
+	if (mode==0){
+		unlink(FIFO_NAME);
+		if (mkfifo(FIFO_NAME, 0666)<0){ perror("mkfifo"); exit(1); }
+	}else{
+		efd=eventfd(0, EFD_NONBLOCK);
+		if (efd<0){ perror("eventfd"); exit(1); }
+		q->in=&q->stub;
+		q->out=&q->stub;
+		q->stub.next=0;
+	}
+	if (fork()==0){ close(sv[1]); consumer(mode, sv[0], efd); }
+	if (mode==0) usleep(100000);	/* let the consumer open the fifo */
+	gettimeofday(&start, 0);
+	for (i=0; i<producers; i++)
+		if (fork()==0) producer(i, mode, efd);
+	close(sv[0]);
+	sink(sv[1], (long)producers*count*size);
+	gettimeofday(&end, 0);
+	while (wait(&status)>0);
+	close(sv[1]);
+	if (efd>=0) close(efd);
+	if (mode==0) unlink(FIFO_NAME);
+	return (end.tv_sec-start.tv_sec)*1000000.0+(end.tv_usec-start.tv_usec);
+}
+
+int main(int argc, char** argv)
+{
+	double t1, t2;
+	long total, i;
+	char c;
+
+	while((c=getopt(argc, argv, "p:c:s:h"))!=-1){
+		switch(c){
+			case 'p': producers=atoi(optarg); break;
+			case 'c': count=atoi(optarg); break;
+			case 's': size=atoi(optarg); break;
+			default:
+				printf("%s", help_msg);
+				return c=='h'?0:1;
+		}
+	}
+	if (producers<1 || count<1 || size<20 || size>(int)sizeof(msgs[0].buf)){
+		printf("%s", help_msg);
+		return 1;
+	}
+	total=(long)producers*count;
+	msgs=mmap(0, total*sizeof(struct msg), PROT_READ|PROT_WRITE,
+				MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	q=mmap(0, sizeof(struct queue), PROT_READ|PROT_WRITE,
+				MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (msgs==MAP_FAILED || q==MAP_FAILED){ perror("mmap"); return 1; }
+	for (i=0; i<total; i++){
+		msgs[i].len=size;
+		memset(msgs[i].buf, 'x', size);
+		msgs[i].buf[0]=1;	/* diameter version */
+	}
+
+	t1=run(0);
+	t2=run(1);
+
+	printf("%d producers x %d messages of %d bytes to one peer\n",
+		producers, count, size);
+	printf(" fifo open/write/close : %10.0f us, %10.0f msg/s\n", t1, total/t1*1000000.0);
+	printf(" shm queue + eventfd   : %10.0f us, %10.0f msg/s\n", t2, total/t2*1000000.0);
+	printf(" speed-up              : %10.1fx\n", t1/t2);
+	return 0;
+}
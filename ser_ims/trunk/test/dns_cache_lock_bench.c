@@ -0,0 +1,243 @@
+/*
+ * $Id$
+ *
+ *  dns cache locking design model
+ *
+ *  This is a standalone model of the locking, not a benchmark of ser: it
+ *  does not link dns_cache.c or dst_blacklist.c and does not run
+ *  dns_get_entry() or dst_is_blacklisted_ip(). It only compares the two
+ *  lock layouts on a table shaped like the cache, so its numbers show what
+ *  the lock striping can gain at best, not what ser gets.
+ *
+ *  Several processes (the SIP workers) look up names in a shared memory
+ *  hash laid out like the dns cache (1024 circular bucket lists, the
+ *  found entry is referenced and moved at the end of its bucket), while
+ *  one more process (the timer) sweeps the whole table for expired
+ *  entries every millisecond:
+ *
+ *   - global:  as the old dns_hash_lock, one lock for the whole hash, the
+ *              sweep holds it for the whole table
+ *   - striped: as the dns cache lock set, bucket h uses lock h&127 and the
+ *              sweep locks one bucket at a time
+ *
+ *  and reports the lookup rate of the model.
+ *
+ *  Compile with: gcc -O2 dns_cache_lock_bench.c -o dns_cache_lock_bench
+ *  Usage:        ./dns_cache_lock_bench [-p procs] [-c count] [-n names]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+
+#define HASH_SIZE	1024
+#define HASH_LOCKS	128
+#define NAME_LEN	32
+
+struct entry {
+	struct entry* next;
+	struct entry* prev;
+	volatile int refcnt;
+	int name_len;
+	char name[NAME_LEN];
+};
+
+struct head {
+	struct entry* next;
+	struct entry* prev;
+};
+
+static char* help_msg="\
+Usage: dns_cache_lock_bench [-p procs] [-c count] [-n names]\n\
+Options:\n\
+    -p procs      number of looking up processes (default 8)\n\
+    -c count      lookups done by each process (default 500000)\n\
+    -n names      names in the cache (default 4096)\n\
+    -h            this help message\n\
+";
+
+static int procs=8, count=500000, names=4096;
+static struct head *hash;			/* shm */
+static volatile int *locks;			/* shm, HASH_LOCKS locks */
+static struct entry *entries;		/* shm */
+static int nlocks;					/* 1 = global, HASH_LOCKS = striped */
+
+/* test and set with yield, as the ser fast locks */
+static void lock_get(volatile int *l)
+{
+	int i=1024;
+	while(__sync_lock_test_and_set(l, 1)){
+		if (i>0) i--;
+		else sched_yield();
+	}
+}
+
+static void lock_release(volatile int *l)
+{
+	__sync_lock_release(l);
+}
+
+#define LOCK(h)		lock_get(&locks[(h)&(nlocks-1)])
+#define UNLOCK(h)	lock_release(&locks[(h)&(nlocks-1)])
+
+static unsigned int hash_no(char *s, int len)
+{
+	unsigned int v=0;
+	int i;
+	for (i=0; i<len; i++) v=v*31+(s[i]|0x20);
+	return (v^(v>>10))%HASH_SIZE;
+}
+
+static void insert(struct entry *e)
+{
+	unsigned int h=hash_no(e->name, e->name_len);
+	e->prev=hash[h].prev;
+	e->next=(void*)&hash[h];
+	e->prev->next=e;
+	hash[h].prev=e;
+}
+
+static struct entry* lookup(char *name, int len)
+{
+	struct entry *e;
+	unsigned int h=hash_no(name, len);
+
+	LOCK(h);
+	for (e=hash[h].next; e!=(void*)&hash[h]; e=e->next){
+		if (e->name_len==len && strncasecmp(e->name, name, len)==0){
+			/* move it at the end */
+			e->prev->next=e->next;
+			e->next->prev=e->prev;
+			e->prev=hash[h].prev;
+			e->next=(void*)&hash[h];
+			e->prev->next=e;
+			hash[h].prev=e;
+			__sync_fetch_and_add(&e->refcnt, 1);
+			break;
+		}
+	}
+	UNLOCK(h);
+	if (e==(void*)&hash[h]) return 0;
+	return e;
+}
+
+static void worker(int id)
+{
+	struct entry *e;
+	char name[NAME_LEN];
+	unsigned int seed=id+1;
+	int i, len;
+
+	for (i=0; i<count; i++){
+		len=snprintf(name, sizeof(name), "host%d.example.com",
+					rand_r(&seed)%names);
+		e=lookup(name, len);
+		if (e==0){ fprintf(stderr, "%s not found\n", name); exit(1); }
+		__sync_fetch_and_sub(&e->refcnt, 1);
+	}
+	exit(0);
+}
+
+/* the timer, walks the table looking for expired entries (there are none) */
+static void sweeper()
+{
+	struct entry *e;
+	int h, n;
+
+	for(;;){
+		n=0;
+		if (nlocks==1) LOCK(0);
+		for (h=0; h<HASH_SIZE; h++){
+			if (nlocks!=1) LOCK(h);
+			for (e=hash[h].next; e!=(void*)&hash[h]; e=e->next)
+				n+=(e->refcnt<0);
+			if (nlocks!=1) UNLOCK(h);
+		}
+		if (nlocks==1) UNLOCK(0);
+		if (n) exit(1);
+		usleep(1000);
+	}
+}
+
+static double run(int l)
+{
+	struct timeval start, end;
+	pid_t sw;
+	int i, status;
+
+	nlocks=l;
+	if ((sw=fork())==0) sweeper();
+	gettimeofday(&start, 0);
+	for (i=0; i<procs; i++)
+		if (fork()==0) worker(i);
+	for (i=0; i<procs; i++){
+		wait(&status);
+		if (!WIFEXITED(status) || WEXITSTATUS(status)){
+			fprintf(stderr, "worker failed\n");
+			exit(1);
+		}
+	}
+	gettimeofday(&end, 0);
+	kill(sw, SIGTERM);
+	waitpid(sw, &status, 0);
+	return (end.tv_sec-start.tv_sec)*1000000.0+(end.tv_usec-start.tv_usec);
+}
+
+int main(int argc, char** argv)
+{
+	double t1, t2;
+	long total;
+	int i;
+	char c;
+
+	while((c=getopt(argc, argv, "p:c:n:h"))!=-1){
+		switch(c){
+			case 'p': procs=atoi(optarg); break;
+			case 'c': count=atoi(optarg); break;
+			case 'n': names=atoi(optarg); break;
+			default:
+				printf("%s", help_msg);
+				return c=='h'?0:1;
+		}
+	}
+	if (procs<1 || count<1 || names<1){
+		printf("%s", help_msg);
+		return 1;
+	}
+	hash=mmap(0, HASH_SIZE*sizeof(struct head), PROT_READ|PROT_WRITE,
+				MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	locks=mmap(0, HASH_LOCKS*sizeof(int), PROT_READ|PROT_WRITE,
+				MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	entries=mmap(0, names*sizeof(struct entry), PROT_READ|PROT_WRITE,
+				MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (hash==MAP_FAILED || locks==MAP_FAILED || entries==MAP_FAILED){
+		perror("mmap");
+		return 1;
+	}
+	for (i=0; i<HASH_SIZE; i++)
+		hash[i].next=hash[i].prev=(void*)&hash[i];
+	for (i=0; i<names; i++){
+		entries[i].name_len=snprintf(entries[i].name, NAME_LEN,
+									"host%d.example.com", i);
+		insert(&entries[i]);
+	}
+
+	t1=run(1);
+	t2=run(HASH_LOCKS);
+
+	total=(long)procs*count;
+	printf("%d processes x %d lookups, %d names in %d buckets\n",
+		procs, count, names, HASH_SIZE);
+	printf(" global lock       : %10.0f us, %10.0f lookups/s\n", t1, total/t1*1000000.0);
+	printf(" %3d striped locks : %10.0f us, %10.0f lookups/s\n", HASH_LOCKS, t2, total/t2*1000000.0);
+	printf(" speed-up          : %10.1fx\n", t1/t2);
+	return 0;
+}
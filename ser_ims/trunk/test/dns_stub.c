@@ -0,0 +1,248 @@
+/*
+ * $Id$
+ *
+ *  stub dns server, for testing the dns resolver process
+ *  (dns_cache_async) against a slow server
+ *
+ *  Answers every A, SRV and NAPTR query on udp after a delay:
+ *   - A:      127.0.0.1
+ *   - SRV:    0 0 5060 <name without the _service._proto labels>
+ *   - NAPTR:  100 10 "u" "E2U+sip" "!^(.*)$!sip:\1@example.com!" .
+ *  names starting with "nx" get NXDOMAIN, the rest NOERROR without
+ *  answers. Every second it prints the received queries, so one can see
+ *  the coalesced requests and the entries refreshed before their ttl
+ *  expires (dns_cache_prefetch).
+ *
+ *  Compile with: gcc -O2 dns_stub.c -o dns_stub -lresolv
+ *  Usage:        ./dns_stub [-p port] [-d delay_ms] [-t ttl]
+ *  and point ser to it with "nameserver 127.0.0.1" in resolv.conf (the
+ *  port must then be 53).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <resolv.h>
+
+#define MAX_PENDING	1024
+#define MSG_SIZE	512
+
+struct pending {
+	struct sockaddr_in from;
+	long long due; /* ms */
+	int len;
+	unsigned char msg[MSG_SIZE];
+};
+
+static char* help_msg="\
+Usage: dns_stub [-p port] [-d delay_ms] [-t ttl]\n\
+Options:\n\
+    -p port       udp port to listen on (default 5353)\n\
+    -d delay_ms   answer delay (default 200)\n\
+    -t ttl        ttl of the answers (default 30)\n\
+    -h            this help message\n\
+";
+
+static int port=5353, delay=200, ttl=30;
+static struct pending pending[MAX_PENDING];
+static int pending_no;
+static int queries, answers;
+
+static long long now_ms()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return (long long)tv.tv_sec*1000+tv.tv_usec/1000;
+}
+
+static unsigned char* put16(unsigned char* p, unsigned short v)
+{
+	*p++=v>>8; *p++=v&0xff;
+	return p;
+}
+
+static unsigned char* put32(unsigned char* p, unsigned int v)
+{
+	p=put16(p, v>>16);
+	return put16(p, v&0xffff);
+}
+
+/* appends name uncompressed, returns 0 if no room */
+static unsigned char* put_name(unsigned char* p, unsigned char* end,
+								char* name)
+{
+	int len;
+	unsigned char* dst;
+	dst=p;
+	len=dn_comp(name, dst, end-dst, 0, 0);
+	if (len<0) return 0;
+	return dst+len;
+}
+
+static unsigned char* put_string(unsigned char* p, char* s)
+{
+	int len=strlen(s);
+	*p++=len;
+	memcpy(p, s, len);
+	return p+len;
+}
+
+/* builds the answer in place, returns its length or -1 to drop the query */
+static int answer(unsigned char* msg, int len)
+{
+	HEADER* h=(HEADER*)msg;
+	char name[MAXDNAME];
+	unsigned char* p;
+	unsigned char* end;
+	unsigned char* rdlen;
+	unsigned short type;
+	char* target;
+	int skip;
+
+	if (len<HFIXEDSZ || h->qr || ntohs(h->qdcount)!=1) return -1;
+	skip=dn_expand(msg, msg+len, msg+HFIXEDSZ, name, sizeof(name));
+	if (skip<0 || HFIXEDSZ+skip+4>len) return -1;
+	p=msg+HFIXEDSZ+skip;
+	type=(p[0]<<8)|p[1];
+	p+=4; /* end of the question */
+	end=msg+MSG_SIZE;
+
+	h->qr=1; h->aa=1; h->ra=1; h->tc=0;
+	h->ancount=h->nscount=h->arcount=0;
+	if (strncasecmp(name, "nx", 2)==0){
+		h->rcode=NXDOMAIN;
+		return p-msg;
+	}
+	h->rcode=NOERROR;
+	if (type!=T_A && type!=T_SRV && type!=T_NAPTR)
+		return p-msg;
+
+	p=put16(p, 0xc000|HFIXEDSZ); /* pointer to the question name */
+	p=put16(p, type);
+	p=put16(p, C_IN);
+	p=put32(p, ttl);
+	rdlen=p;
+	p+=2;
+	switch(type){
+		case T_A:
+			*p++=127; *p++=0; *p++=0; *p++=1;
+			break;
+		case T_SRV:
+			p=put16(p, 0);
+			p=put16(p, 0);
+			p=put16(p, 5060);
+			/* skip _service._proto */
+			target=name;
+			if (target[0]=='_' && (target=strchr(target, '.')) &&
+					target[1]=='_' && (target=strchr(target+1, '.')))
+				target++;
+			else
+				target=name;
+			if ((p=put_name(p, end, target))==0) return -1;
+			break;
+		case T_NAPTR:
+			p=put16(p, 100);
+			p=put16(p, 10);
+			p=put_string(p, "u");
+			p=put_string(p, "E2U+sip");
+			p=put_string(p, "!^(.*)$!sip:\\1@example.com!");
+			*p++=0; /* root replacement */
+			break;
+	}
+	put16(rdlen, p-rdlen-2);
+	h->ancount=htons(1);
+	return p-msg;
+}
+
+int main(int argc, char** argv)
+{
+	struct sockaddr_in addr;
+	struct pollfd pfd;
+	socklen_t from_len;
+	struct pending* q;
+	long long now, next_stats, wait;
+	int sock, i, c;
+
+	while((c=getopt(argc, argv, "p:d:t:h"))!=-1){
+		switch(c){
+			case 'p': port=atoi(optarg); break;
+			case 'd': delay=atoi(optarg); break;
+			case 't': ttl=atoi(optarg); break;
+			default:
+				printf("%s", help_msg);
+				return c=='h'?0:1;
+		}
+	}
+	if (port<1 || delay<0 || ttl<0){
+		printf("%s", help_msg);
+		return 1;
+	}
+	sock=socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family=AF_INET;
+	addr.sin_port=htons(port);
+	addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+	if (sock<0 || bind(sock, (struct sockaddr*)&addr, sizeof(addr))<0){
+		perror("socket/bind");
+		return 1;
+	}
+	printf("listening on 127.0.0.1:%d, delay %d ms, ttl %d s\n",
+			port, delay, ttl);
+	next_stats=now_ms()+1000;
+	for(;;){
+		now=now_ms();
+		wait=next_stats-now;
+		for (i=0; i<pending_no; i++)
+			if (pending[i].due-now<wait) wait=pending[i].due-now;
+		pfd.fd=sock;
+		pfd.events=POLLIN;
+		if (poll(&pfd, 1, wait>0?(int)wait:0)<0 && errno!=EINTR){
+			perror("poll");
+			return 1;
+		}
+		if ((pfd.revents & POLLIN) && pending_no<MAX_PENDING){
+			q=&pending[pending_no];
+			from_len=sizeof(q->from);
+			q->len=recvfrom(sock, q->msg, MSG_SIZE, 0,
+							(struct sockaddr*)&q->from, &from_len);
+			if (q->len>0){
+				queries++;
+				q->due=now_ms()+delay;
+				pending_no++;
+			}
+		}
+		now=now_ms();
+		for (i=0; i<pending_no; ){
+			q=&pending[i];
+			if (q->due>now){
+				i++;
+				continue;
+			}
+			c=answer(q->msg, q->len);
+			if (c>0 && sendto(sock, q->msg, c, 0, (struct sockaddr*)&q->from,
+								sizeof(q->from))>0)
+				answers++;
+			pending[i]=pending[--pending_no];
+		}
+		if (now>=next_stats){
+			if (queries)
+				printf("%lld: %d queries, %d answers\n", now/1000,
+						queries, answers);
+			queries=answers=0;
+			next_stats=now+1000;
+		}
+		fflush(stdout);
+	}
+	return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * $Id$
+ *
+ *  iFC trigger point regex micro-benchmark
+ *
+ *  Evaluates a 20 iFC profile (SIP header and SDP line SPTs, as
+ *  checked by modules/isc/checker.c) against recorded requests, once
+ *  compiling every regex on each check (the old isc behaviour) and once
+ *  with the regex compiled only once (the isc per-process regex cache).
+ *
+ *  Compile with: gcc -O2 ifc_regex_bench.c -o ifc_regex_bench
+ *  Usage:        ./ifc_regex_bench iterations file.sip [file.sip ...]
+ *                e.g. ./ifc_regex_bench 1000 ms-invite-00.sip invite00.sip
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <regex.h>
+#include <sys/time.h>
+
+#define SPT_HEADER	3
+#define SPT_SDP		5
+
+struct spt {
+	int type;
+	char *name;		/* header name or SDP line */
+	char *content;	/* content regex */
+	regex_t name_comp;
+	regex_t content_comp;
+};
+
+/* a realistic 20 iFC profile - some match, most don't */
+static struct spt profile[]={
+	{SPT_HEADER,"Accept-Contact",".*\\+g\\.3gpp\\.icsi-ref=\"urn%3Aurn-7%3A3gpp-service\\.ims\\.icsi\\.mmtel\".*"},
+	{SPT_HEADER,"Accept-Contact",".*\\+g\\.oma\\.sip-im.*"},
+	{SPT_HEADER,"P-Asserted-Service","urn:urn-7:3gpp-service\\.ims\\.icsi\\.mmtel"},
+	{SPT_HEADER,"P-Preferred-Service","urn:urn-7:3gpp-service\\.ims\\.icsi\\.oma\\.cpm\\..*"},
+	{SPT_HEADER,"Event","presence(\\.winfo)?"},
+	{SPT_HEADER,"Event","conference"},
+	{SPT_HEADER,"Event","message-summary"},
+	{SPT_HEADER,"Content-Type","application/(pidf|vnd\\.3gpp\\.sms|simple-message-summary)\\+?.*"},
+	{SPT_HEADER,"User-Agent",".*(Windows RTC|X-Lite|eyeBeam).*"},
+	{SPT_HEADER,"Supported",".*100rel.*"},
+	{SPT_HEADER,"P-Access-Network-Info","3GPP-(UTRAN|E-UTRAN)-(FDD|TDD).*"},
+	{SPT_HEADER,"Privacy","(id|header|user)"},
+	{SPT_HEADER,"To",".*sip:(voicemail|vm)@.*"},
+	{SPT_HEADER,"From",".*sip:.*@(iptel\\.org|open-ims\\.test).*"},
+	{SPT_SDP,"m","audio [0-9]+ RTP/AVP.*"},
+	{SPT_SDP,"m","video [0-9]+ RTP/AVP.*"},
+	{SPT_SDP,"m","message [0-9]+ TCP/MSRP.*"},
+	{SPT_SDP,"a","rtpmap:[0-9]+ (AMR|AMR-WB)/.*"},
+	{SPT_SDP,"b","AS:[0-9]+"},
+	{SPT_SDP,"c","IN IP6 .*"},
+};
+#define PROFILE_CNT ((int)(sizeof(profile)/sizeof(struct spt)))
+
+static char* load(char *file)
+{
+	FILE *f;
+	long len;
+	char *buf;
+
+	f=fopen(file,"r");
+	if (!f) { perror(file); exit(1); }
+	fseek(f,0,SEEK_END);
+	len=ftell(f);
+	fseek(f,0,SEEK_SET);
+	buf=malloc(len+1);
+	if (!buf || fread(buf,1,len,f)!=(size_t)len) { perror(file); exit(1); }
+	buf[len]=0;
+	fclose(f);
+	return buf;
+}
+
+/* checks all the header lines of msg against the SPT, as isc_check_headers() */
+static int check_headers(struct spt *spt, char *msg, int precompiled)
+{
+	char line[1024],*p,*e,*colon,*body;
+	regex_t hc,cc;
+	regex_t *h=&hc,*c=&cc;
+	int r=0;
+
+	if (precompiled){
+		h=&spt->name_comp;
+		c=&spt->content_comp;
+	}else{
+		regcomp(h,spt->name,REG_ICASE|REG_EXTENDED);
+		regcomp(c,spt->content,REG_ICASE|REG_EXTENDED);
+	}
+	for(p=strchr(msg,'\n');p && *(++p) && *p!='\r' && *p!='\n';p=e){
+		e=strchr(p,'\n');
+		if (!e) e=p+strlen(p);
+		if (e-p>=(long)sizeof(line)) continue;
+		memcpy(line,p,e-p);
+		line[e-p]=0;
+		colon=strchr(line,':');
+		if (!colon) continue;
+		*colon=0;
+		for(body=colon+1;*body==' ';body++);
+		if (regexec(h,line,0,NULL,0)==0 && regexec(c,body,0,NULL,0)==0){
+			r=1;
+			break;
+		}
+	}
+	if (!precompiled){
+		regfree(h);
+		regfree(c);
+	}
+	return r;
+}
+
+/* checks the SDP body of msg against the SPT, as isc_check_session_desc() */
+static int check_sdp(struct spt *spt, char *msg, int precompiled)
+{
+	char *body,*x;
+	regex_t comp;
+	int r;
+
+	body=strstr(msg,"\r\n\r\n");
+	if (!body) body=strstr(msg,"\n\n");
+	if (!body) return 0;
+	if (precompiled)
+		return regexec(&spt->content_comp,body,0,NULL,0)==0;
+	x=malloc(strlen(spt->name)+2+strlen(spt->content));
+	sprintf(x,"%s=%s",spt->name,spt->content);
+	regcomp(&comp,x,REG_ICASE|REG_EXTENDED);
+	r=(regexec(&comp,body,0,NULL,0)==0);
+	regfree(&comp);
+	free(x);
+	return r;
+}
+
+static double run(char **msgs, int msgs_cnt, int iterations, int precompiled, int *matches)
+{
+	struct timeval start,end;
+	int i,j,k;
+
+	*matches=0;
+	gettimeofday(&start,0);
+	for(i=0;i<iterations;i++)
+		for(j=0;j<msgs_cnt;j++)
+			for(k=0;k<PROFILE_CNT;k++)
+				if (profile[k].type==SPT_HEADER)
+					*matches+=check_headers(profile+k,msgs[j],precompiled);
+				else
+					*matches+=check_sdp(profile+k,msgs[j],precompiled);
+	gettimeofday(&end,0);
+	return (end.tv_sec-start.tv_sec)*1000000.0+(end.tv_usec-start.tv_usec);
+}
+
+int main(int argc, char** argv)
+{
+	char **msgs;
+	char x[256];
+	int iterations,i,m1,m2;
+	double t1,t2;
+
+	if (argc<3){
+		fprintf(stderr,"Usage: %s iterations file.sip [file.sip ...]\n",argv[0]);
+		return 1;
+	}
+	iterations=atoi(argv[1]);
+	msgs=malloc(sizeof(char*)*(argc-2));
+	for(i=2;i<argc;i++)
+		msgs[i-2]=load(argv[i]);
+
+	for(i=0;i<PROFILE_CNT;i++)
+		if (profile[i].type==SPT_HEADER){
+			regcomp(&profile[i].name_comp,profile[i].name,REG_ICASE|REG_EXTENDED|REG_NOSUB);
+			regcomp(&profile[i].content_comp,profile[i].content,REG_ICASE|REG_EXTENDED|REG_NOSUB);
+		}else{
+			snprintf(x,sizeof(x),"%s=%s",profile[i].name,profile[i].content);
+			regcomp(&profile[i].content_comp,x,REG_ICASE|REG_EXTENDED|REG_NOSUB);
+		}
+
+	t1=run(msgs,argc-2,iterations,0,&m1);
+	t2=run(msgs,argc-2,iterations,1,&m2);
+
+	printf("%d iFC x %d messages x %d iterations\n",PROFILE_CNT,argc-2,iterations);
+	printf(" regcomp on every check : %10.0f us total, %8.2f us per message (%d matches)\n",
+		t1,t1/iterations/(argc-2),m1);
+	printf(" precompiled            : %10.0f us total, %8.2f us per message (%d matches)\n",
+		t2,t2/iterations/(argc-2),m2);
+	printf(" speed-up               : %10.1fx\n",t1/t2);
+	return 0;
+}
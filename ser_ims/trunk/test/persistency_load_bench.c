@@ -0,0 +1,292 @@
+/*
+ * $Id$
+ *
+ *  S-CSCF registrar snapshot loading micro-benchmark
+ *
+ *  A snapshot of registrar records, written slot by slot with the slot index
+ *  at the end as bind_dump_to_file_index() does, is loaded into a shared
+ *  memory hash table (one malloc per record, under the slot lock):
+ *
+ *   - seq:     as load_snapshot_registrar() did, the file is read in a buffer
+ *              grown by the exact missing size and each decoded record is
+ *              memmove()d out of the front of it
+ *   - indexed: the file is mmap()ed and the slots of the index are decoded
+ *              by several forked processes, as bin_load_from_file_indexed()
+ *
+ *  and reports the load time per million records.
+ *
+ *  Compile with: gcc -O2 persistency_load_bench.c -o persistency_load_bench
+ *  Usage:        ./persistency_load_bench [-r records] [-s slots] [-w workers]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define SNAP_FILE	"/tmp/persistency_load_bench.bin"
+#define ARENA		(1L<<30)	/* shared memory for the loaded records */
+#define CHUNK		(128*1024)	/* what load_snapshot_registrar() read at once */
+
+struct rec {
+	struct rec *next;
+	int expires;
+	short aor_len, contact_len;
+	char data[];
+};
+
+struct slot {
+	struct rec *head;
+	volatile int lock;
+};
+
+struct arena {
+	volatile int lock;
+	long used;
+	char mem[];
+};
+
+static char* help_msg="\
+Usage: persistency_load_bench [-r records] [-s slots] [-w workers]\n\
+Options:\n\
+    -r records    number of registered public identities (default 1000000)\n\
+    -s slots      registrar hash slots (default 16384)\n\
+    -w workers    loading processes for the indexed snapshot (default 4)\n\
+    -h            this help message\n\
+";
+
+static int records=1000000, slots=16384, workers=4;
+static struct slot *table;		/* shm */
+static struct arena *shm;		/* shm, the records as with shm_malloc() */
+
+static inline void spin_lock(volatile int *l)
+{
+	while(__atomic_test_and_set(l, __ATOMIC_ACQUIRE)) sched_yield();
+}
+
+static inline void spin_unlock(volatile int *l)
+{
+	__atomic_clear(l, __ATOMIC_RELEASE);
+}
+
+static void *shm_alloc(long size)
+{
+	void *p;
+	spin_lock(&shm->lock);
+	p=shm->mem+shm->used;
+	shm->used+=(size+7)&~7L;
+	spin_unlock(&shm->lock);
+	return shm->used<=ARENA ? p : 0;
+}
+
+static inline long now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1000000000L+t.tv_nsec;
+}
+
+/* as bin_encode_r_public(): int(aor_len,2) aor int(expires,4) int(contact_len,2) contact */
+static int encode(char *buf, long i)
+{
+	char aor[64], contact[160];
+	short al, cl;
+	int e=600000, k=0;
+	al=snprintf(aor, sizeof(aor), "sip:user%ld@open-ims.test", i);
+	cl=snprintf(contact, sizeof(contact), "<sip:user%ld@10.0.%ld.%ld:5060>;expires=600000",
+		i, (i>>8)&0xff, i&0xff);
+	memcpy(buf+k, &al, 2); k+=2;
+	memcpy(buf+k, aor, al); k+=al;
+	memcpy(buf+k, &e, 4); k+=4;
+	memcpy(buf+k, &cl, 2); k+=2;
+	memcpy(buf+k, contact, cl); k+=cl;
+	return k;
+}
+
+/* decodes and inserts one record, returns its encoded length or 0 if incomplete */
+static int decode(char *buf, int len)
+{
+	struct rec *r;
+	short al, cl;
+	unsigned int h=0;
+	int k, i;
+
+	if (len<2) return 0;
+	memcpy(&al, buf, 2);
+	if (len<2+al+6) return 0;
+	memcpy(&cl, buf+2+al+4, 2);
+	k=2+al+6+cl;
+	if (len<k) return 0;
+	r=shm_alloc(sizeof(struct rec)+al+cl);
+	if (!r){ fprintf(stderr, "out of shared memory\n"); exit(1); }
+	r->aor_len=al; r->contact_len=cl;
+	memcpy(r->data, buf+2, al);
+	memcpy(&r->expires, buf+2+al, 4);
+	memcpy(r->data+al, buf+2+al+6, cl);
+	for (i=0; i<al; i++) h=h*31+(unsigned char)r->data[i];
+	h%=slots;
+	spin_lock(&table[h].lock);
+	r->next=table[h].head;
+	table[h].head=r;
+	spin_unlock(&table[h].lock);
+	return k;
+}
+
+static void write_snapshot()
+{
+	unsigned int *idx, n=0, off;
+	char *buf;
+	long i;
+	int s, k, len;
+	FILE *f;
+
+	f=fopen(SNAP_FILE, "w");
+	if (!f){ perror("fopen"); exit(1); }
+	idx=malloc((long)slots*12+8);
+	buf=malloc((long)(records/slots+16)*256);
+	for (s=0; s<slots; s++){
+		for (len=0, i=s; i<records; i+=slots)
+			len+=encode(buf+len, i);
+		if (!len) continue;
+		idx[n*3]=s; idx[n*3+1]=ftell(f); idx[n*3+2]=len; n++;
+		fwrite(buf, 1, len, f);
+	}
+	off=ftell(f);
+	idx[n*3]=n; idx[n*3+1]=off;
+	fwrite(idx, 12, n, f);
+	fwrite(idx+n*3, 4, 2, f);
+	fwrite("BININDEX", 1, 8, f);
+	k=fclose(f);
+	if (k){ perror("fclose"); exit(1); }
+	free(buf);
+	free(idx);
+}
+
+static void reset()
+{
+	memset(table, 0, (long)slots*sizeof(struct slot));
+	shm->used=0;
+}
+
+static void load_seq()
+{
+	char *buf=0;
+	int len=0, max=0, k, fd, left;
+	struct stat st;
+
+	fd=open(SNAP_FILE, O_RDONLY);
+	fstat(fd, &st);
+	/* the old snapshots had no index, stop before it */
+	pread(fd, &left, 4, st.st_size-8-4);
+	for (;;){
+		if (left && max-len<CHUNK){
+			max+=CHUNK;
+			buf=realloc(buf, max);
+		}
+		if (left){
+			k=read(fd, buf+len, max-len<left ? max-len : left);
+			if (k<=0) left=0;
+			else { len+=k; left-=k; }
+		}
+		k=decode(buf, len);
+		if (!k){
+			if (!left) break;
+			continue;
+		}
+		memmove(buf, buf+k, len-k);
+		len-=k;
+	}
+	close(fd);
+	free(buf);
+}
+
+static void load_indexed()
+{
+	unsigned int *trailer, n, off, *e;
+	char *map;
+	struct stat st;
+	int fd, w, i, k, status;
+
+	fd=open(SNAP_FILE, O_RDONLY);
+	fstat(fd, &st);
+	map=mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	madvise(map, st.st_size, MADV_WILLNEED);
+	trailer=(unsigned int*)(map+st.st_size-8-8);
+	n=trailer[0]; off=trailer[1];
+	fflush(stdout);
+	for (w=0; w<workers; w++){
+		if (workers>1 && fork()>0) continue;
+		for (i=w; i<n; i+=workers){
+			e=(unsigned int*)(map+off+i*12);
+			for (k=0; k<e[2]; )
+				k+=decode(map+e[1]+k, e[2]-k);
+		}
+		if (workers>1) _exit(0);
+	}
+	if (workers>1)
+		for (w=0; w<workers; w++) wait(&status);
+	munmap(map, st.st_size);
+}
+
+static int count()
+{
+	struct rec *r;
+	int i, n=0;
+	for (i=0; i<slots; i++)
+		for (r=table[i].head; r; r=r->next) n++;
+	return n;
+}
+
+int main(int argc, char** argv)
+{
+	long t;
+	char c;
+
+	while((c=getopt(argc, argv, "r:s:w:h"))!=-1){
+		switch(c){
+			case 'r': records=atoi(optarg); break;
+			case 's': slots=atoi(optarg); break;
+			case 'w': workers=atoi(optarg); break;
+			default:
+				printf("%s", help_msg);
+				return c=='h'?0:1;
+		}
+	}
+	if (records<1 || slots<1 || workers<1){
+		printf("%s", help_msg);
+		return 1;
+	}
+	table=mmap(0, (long)slots*sizeof(struct slot), PROT_READ|PROT_WRITE,
+				MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	shm=mmap(0, sizeof(struct arena)+ARENA, PROT_READ|PROT_WRITE,
+				MAP_SHARED|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+	if (table==MAP_FAILED || shm==MAP_FAILED){ perror("mmap"); return 1; }
+
+	write_snapshot();
+	printf("%d records in %d slots\n", records, slots);
+
+	reset();
+	t=now_ns();
+	load_seq();
+	t=now_ns()-t;
+	printf(" seq      %8.0f ms | %8.0f ms per million records | %d loaded\n",
+		t/1000000.0, t/1000000.0*1000000/records, count());
+
+	reset();
+	t=now_ns();
+	load_indexed();
+	t=now_ns()-t;
+	printf(" indexed  %8.0f ms | %8.0f ms per million records | %d loaded with %d processes\n",
+		t/1000000.0, t/1000000.0*1000000/records, count(), workers);
+
+	unlink(SNAP_FILE);
+	return 0;
+}
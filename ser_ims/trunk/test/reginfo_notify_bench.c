@@ -0,0 +1,358 @@
+/*
+ * $Id$
+ *
+ *  S-CSCF reg event NOTIFY fan-out micro-benchmark
+ *
+ *  Users are registered by several worker processes; each user is watched by
+ *  several subscribers (P-CSCF, UE, AS) and each registration generates a
+ *  NOTIFY with the partial reginfo to each of them:
+ *
+ *   - old: as before, the reginfo is rendered with sprintf() in stack
+ *          buffers, each notification gets its own shm copy printed with its
+ *          version, and one process (the notification timer) sends them all
+ *   - new: the reginfo is rendered once in a growing buffer, shared by the
+ *          notifications with a reference count and the version spliced in
+ *          at send time, and the notifications are sent by several
+ *          notification processes, the ones of a dialog always by the same
+ *
+ *  The NOTIFYs are sent over UDP to a local socket nobody reads. Reports the
+ *  time until all the NOTIFYs are sent.
+ *
+ *  Compile with: gcc -O2 reginfo_notify_bench.c -o reginfo_notify_bench
+ *  Usage:        ./reginfo_notify_bench [-u users] [-s subscribers] [-w workers] [-p processes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <semaphore.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define MAX_REGINFO_SIZE	16384
+#define ARENA				(1L<<31)	/* shared memory for the notifications */
+#define MAX_PROCS			64
+
+struct subscriber {
+	char uri[64];
+	int version;
+	int cseq;
+};
+
+struct reginfo {
+	volatile int ref;
+	int len, version_pos;
+	char content[];
+};
+
+struct notification {
+	struct notification *next;
+	struct subscriber *s;
+	int version;
+	struct reginfo *reginfo;	/* new */
+	int len;					/* old */
+	char content[];
+};
+
+struct queue {
+	volatile int lock;
+	struct notification *head, *tail;
+	sem_t full;
+};
+
+struct shared {
+	volatile int lock;
+	long used;
+	volatile long sent;
+	struct queue q[MAX_PROCS];
+	char mem[];
+};
+
+static char* help_msg="\
+Usage: reginfo_notify_bench [-u users] [-s subscribers] [-w workers] [-p processes]\n\
+Options:\n\
+    -u users        registered users (default 100000)\n\
+    -s subscribers  subscribers to the reg event of each user (default 3)\n\
+    -w workers      SIP worker processes registering them (default 4)\n\
+    -p processes    notification processes in the new mode (default 4)\n\
+    -h              this help message\n\
+";
+
+static int users=100000, subs=3, workers=4, procs=4;
+static struct shared *sh;
+static struct subscriber *subscribers;	/* shm, users x subs */
+static int sock;
+static struct sockaddr_in dst;
+
+static inline void spin_lock(volatile int *l)
+{
+	while(__atomic_test_and_set(l, __ATOMIC_ACQUIRE)) sched_yield();
+}
+
+static inline void spin_unlock(volatile int *l)
+{
+	__atomic_clear(l, __ATOMIC_RELEASE);
+}
+
+/* as shm_malloc(), never freed here */
+static void *shm_alloc(long size)
+{
+	void *p;
+	spin_lock(&sh->lock);
+	p=sh->mem+sh->used;
+	sh->used+=(size+15)&~15L;
+	spin_unlock(&sh->lock);
+	if (sh->used>ARENA){ fprintf(stderr, "out of shared memory\n"); exit(1); }
+	return p;
+}
+
+static inline long now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1000000000L+t.tv_nsec;
+}
+
+static void enqueue(struct queue *q, struct notification *n)
+{
+	n->next=0;
+	spin_lock(&q->lock);
+	if (q->tail) q->tail->next=n;
+	else q->head=n;
+	q->tail=n;
+	spin_unlock(&q->lock);
+	sem_post(&q->full);
+}
+
+static struct notification *dequeue(struct queue *q)
+{
+	struct notification *n;
+	spin_lock(&q->lock);
+	n=q->head;
+	if (n){
+		q->head=n->next;
+		if (!q->head) q->tail=0;
+	}
+	spin_unlock(&q->lock);
+	return n;
+}
+
+static void send_notify(struct subscriber *s, char *body, int len)
+{
+	char msg[MAX_REGINFO_SIZE+1024];
+	int k;
+	k=snprintf(msg, sizeof(msg), "NOTIFY %s SIP/2.0\r\nCSeq: %d NOTIFY\r\n"
+		"Event: reg\r\nMax-Forwards: 70\r\nSubscription-State: active;expires=600000\r\n"
+		"Content-Type: application/reginfo+xml\r\nContent-Length: %d\r\n\r\n",
+		s->uri, ++s->cseq, len);
+	memcpy(msg+k, body, len);
+	sendto(sock, msg, k+len, 0, (struct sockaddr*)&dst, sizeof(dst));
+	__atomic_add_fetch(&sh->sent, 1, __ATOMIC_RELAXED);
+}
+
+/* ---- old: sprintf() in stack buffers, a copy per notification ---- */
+
+static void old_event(long u)
+{
+	char bufc[MAX_REGINFO_SIZE], padc[MAX_REGINFO_SIZE], verc[MAX_REGINFO_SIZE];
+	struct notification *n;
+	struct subscriber *s;
+	int len=0, i, k;
+
+	len+=sprintf(bufc+len, "<?xml version=\"1.0\"?>\n");
+	sprintf(padc, "<reginfo xmlns=\"urn:ietf:params:xml:ns:reginfo\" version=\"%s\" state=\"%.*s\">\n",
+		"%d", 7, "partial");
+	k=strlen(padc); memcpy(bufc+len, padc, k); len+=k;
+	sprintf(padc, "\t<registration aor=\"sip:user%ld@open-ims.test\" id=\"%p\" state=\"%.*s\">\n",
+		u, (void*)u, 6, "active");
+	k=strlen(padc); memcpy(bufc+len, padc, k); len+=k;
+	sprintf(padc, "\t\t<contact id=\"%p\" state=\"%.*s\" event=\"%.*s\" expires=\"%d\">\n",
+		(void*)(u+1), 6, "active", 10, "registered", 600000);
+	k=strlen(padc); memcpy(bufc+len, padc, k); len+=k;
+	sprintf(padc, "\t\t\t<uri>sip:user%ld@10.0.%ld.%ld:5060</uri>\n", u, (u>>8)&0xff, u&0xff);
+	k=strlen(padc); memcpy(bufc+len, padc, k); len+=k;
+	len+=sprintf(bufc+len, "\t\t</contact>\n\t</registration>\n</reginfo>\n");
+	bufc[len]=0;
+
+	for (i=0; i<subs; i++){
+		s=subscribers+u*subs+i;
+		sprintf(verc, bufc, s->version++);
+		k=strlen(verc);
+		n=shm_alloc(sizeof(struct notification)+k);
+		n->s=s;
+		n->len=k;
+		memcpy(n->content, verc, k);
+		enqueue(sh->q, n);
+	}
+}
+
+/* ---- new: rendered once, shared, version spliced in at send time ---- */
+
+static char *rbuf;
+static int rmax, rlen;
+
+static void r_printf(char *fmt, ...)
+{
+	va_list ap;
+	int k;
+	va_start(ap, fmt);
+	k=vsnprintf(rbuf+rlen, rmax-rlen, fmt, ap);
+	va_end(ap);
+	if (k>=rmax-rlen){
+		while (rmax-rlen<=k) rmax*=2;
+		rbuf=realloc(rbuf, rmax);
+		va_start(ap, fmt);
+		vsnprintf(rbuf+rlen, rmax-rlen, fmt, ap);
+		va_end(ap);
+	}
+	rlen+=k;
+}
+
+static void new_event(long u)
+{
+	struct notification *n;
+	struct subscriber *s;
+	struct reginfo *r;
+	int i, vpos;
+
+	rlen=0;
+	r_printf("<?xml version=\"1.0\"?>\n<reginfo xmlns=\"urn:ietf:params:xml:ns:reginfo\" version=\"");
+	vpos=rlen;
+	r_printf("\" state=\"%.*s\">\n", 7, "partial");
+	r_printf("\t<registration aor=\"sip:user%ld@open-ims.test\" id=\"%p\" state=\"%.*s\">\n",
+		u, (void*)u, 6, "active");
+	r_printf("\t\t<contact id=\"%p\" state=\"%.*s\" event=\"%.*s\" expires=\"%d\">\n",
+		(void*)(u+1), 6, "active", 10, "registered", 600000);
+	r_printf("\t\t\t<uri>sip:user%ld@10.0.%ld.%ld:5060</uri>\n", u, (u>>8)&0xff, u&0xff);
+	r_printf("\t\t</contact>\n\t</registration>\n</reginfo>\n");
+
+	r=shm_alloc(sizeof(struct reginfo)+rlen);
+	r->ref=1;
+	r->len=rlen;
+	r->version_pos=vpos;
+	memcpy(r->content, rbuf, rlen);
+	for (i=0; i<subs; i++){
+		s=subscribers+u*subs+i;
+		n=shm_alloc(sizeof(struct notification));
+		n->s=s;
+		n->version=s->version++;
+		__atomic_add_fetch(&r->ref, 1, __ATOMIC_RELAXED);
+		n->reginfo=r;
+		enqueue(sh->q+((unsigned long)s/sizeof(struct subscriber))%procs, n);
+	}
+	__atomic_sub_fetch(&r->ref, 1, __ATOMIC_RELEASE);
+}
+
+static void sender(int k, int mode)
+{
+	char body[MAX_REGINFO_SIZE+16];
+	struct notification *n;
+	struct reginfo *r;
+	int len;
+
+	for (;;){
+		sem_wait(&sh->q[k].full);
+		n=dequeue(sh->q+k);
+		if (!n) _exit(0);		/* posted without a notification: done */
+		if (mode==0){
+			send_notify(n->s, n->content, n->len);
+			continue;
+		}
+		r=n->reginfo;
+		memcpy(body, r->content, r->version_pos);
+		len=r->version_pos+sprintf(body+r->version_pos, "%d", n->version);
+		memcpy(body+len, r->content+r->version_pos, r->len-r->version_pos);
+		len+=r->len-r->version_pos;
+		send_notify(n->s, body, len);
+		__atomic_sub_fetch(&r->ref, 1, __ATOMIC_RELEASE);
+	}
+}
+
+static void run(int mode, char *name)
+{
+	int i, p=mode?procs:1, status;
+	long t, u;
+	pid_t pid[MAX_PROCS];
+
+	sh->used=0;
+	sh->sent=0;
+	memset(subscribers, 0, (long)users*subs*sizeof(struct subscriber));
+	for (u=0; u<(long)users*subs; u++)
+		snprintf(subscribers[u].uri, sizeof(subscribers[u].uri),
+			"sip:watcher%ld@10.1.%ld.%ld:5060", u, (u>>8)&0xff, u&0xff);
+	for (i=0; i<p; i++){
+		sh->q[i].head=sh->q[i].tail=0;
+		sem_init(&sh->q[i].full, 1, 0);
+	}
+	fflush(stdout);
+
+	t=now_ns();
+	for (i=0; i<p; i++)
+		if ((pid[i]=fork())==0) sender(i, mode);
+	for (i=0; i<workers; i++){
+		if (fork()) continue;
+		for (u=i; u<users; u+=workers)
+			if (mode==0) old_event(u);
+			else new_event(u);
+		_exit(0);
+	}
+	for (i=0; i<workers; i++) wait(&status);
+	for (i=0; i<p; i++) sem_post(&sh->q[i].full);
+	for (i=0; i<p; i++) waitpid(pid[i], &status, 0);
+	t=now_ns()-t;
+
+	printf(" %-4s %8.0f ms | %8ld NOTIFYs from %d process(es) | %6.1f us per NOTIFY | %5ld MB shm\n",
+		name, t/1000000.0, sh->sent, p, t/1000.0/sh->sent, sh->used>>20);
+	for (i=0; i<p; i++) sem_destroy(&sh->q[i].full);
+}
+
+int main(int argc, char** argv)
+{
+	struct sockaddr_in a;
+	socklen_t al=sizeof(a);
+	char c;
+
+	while((c=getopt(argc, argv, "u:s:w:p:h"))!=-1){
+		switch(c){
+			case 'u': users=atoi(optarg); break;
+			case 's': subs=atoi(optarg); break;
+			case 'w': workers=atoi(optarg); break;
+			case 'p': procs=atoi(optarg); break;
+			default:
+				printf("%s", help_msg);
+				return c=='h'?0:1;
+		}
+	}
+	if (users<1 || subs<1 || workers<1 || procs<1 || procs>MAX_PROCS){
+		printf("%s", help_msg);
+		return 1;
+	}
+	sh=mmap(0, sizeof(struct shared)+ARENA, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+	subscribers=mmap(0, (long)users*subs*sizeof(struct subscriber), PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (sh==MAP_FAILED || subscribers==MAP_FAILED){ perror("mmap"); return 1; }
+	rmax=1024;
+	rbuf=malloc(rmax);
+
+	/* a local socket nobody reads, the NOTIFYs are dropped when its buffer is full */
+	sock=socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&a, 0, sizeof(a));
+	a.sin_family=AF_INET;
+	a.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+	if (sock<0 || bind(sock, (struct sockaddr*)&a, sizeof(a))<0 ||
+		getsockname(sock, (struct sockaddr*)&dst, &al)<0){ perror("socket"); return 1; }
+
+	printf("%d users with %d subscribers each, registered by %d workers\n", users, subs, workers);
+	run(0, "old");
+	run(1, "new");
+	return 0;
+}
@@ -0,0 +1,424 @@
+/*
+ * $Id$
+ *
+ *  TCP send path design model
+ *
+ *  This is a standalone model of the two send paths, not a benchmark of ser:
+ *  it does not link tcp_main.c or tcp_read.c and does not run tcp_send().
+ *  Its "tcp main" and workers only do what the model below describes, so the
+ *  numbers show how far the write queues can cut the send latency, not
+ *  what ser gets.
+ *
+ *  Several worker processes send SIP sized messages on tcp connections owned
+ *  by a "tcp main" process; a few of the connections are stalled (the peer
+ *  never reads, as an UE behind a dead NAT binding):
+ *
+ *   - block: as tcp_send() did, each send asks "tcp main" for the fd
+ *            (request + fd passing over a unix socket) and writes it with a
+ *            poll() loop, blocking up to the send timeout
+ *   - queue: as with TCP_BUF_WRITE and TCP_FD_CACHE, the fd is asked for only
+ *            once per process; the data that can't be written right away is
+ *            appended to the connection's shared memory write queue and
+ *            "tcp main" flushes it when epoll reports the socket writeable
+ *
+ *  and reports the send rate and the latency of the modelled workers' sends.
+ *  The send timeout is shorter than ser's tcp_send_timeout (10 s) to keep
+ *  the run short; the stalled sends in block mode cost -t ms each.
+ *
+ *  Compile with: gcc -O2 tcp_send_bench.c -o tcp_send_bench
+ *  Usage:        ./tcp_send_bench [-c conns] [-w workers] [-n sends] ...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define MSG_LEN		800			/* a typical SIP request */
+#define QUEUE_MAX	(256*1024)	/* tcp_max_write_queue */
+#define HIST_US		1000000		/* latency histogram, 1us buckets up to 1s */
+#define MAX_CONNS	4096
+
+enum cmds { CMD_GET_FD, CMD_QUEUED_WRITE };
+
+struct wqueue {
+	volatile int lock;
+	unsigned int off, len;		/* queued data is buf[off..len) */
+	char buf[QUEUE_MAX];
+};
+
+struct stats {
+	volatile int stop;
+	long failed, fd_requests;
+	unsigned int hist[];		/* workers x HIST_US */
+};
+
+static char* help_msg="\
+Usage: tcp_send_bench [-c conns] [-w workers] [-n sends] [-s stalled]\n\
+                      [-p permille] [-t timeout]\n\
+Options:\n\
+    -c conns      tcp connections (default 64)\n\
+    -w workers    sending processes (default 4)\n\
+    -n sends      messages sent by each worker (default 50000)\n\
+    -s stalled    connections whose peer never reads (default 1)\n\
+    -p permille   sends that go to a stalled connection, per 1000 (default 1)\n\
+    -t timeout    send timeout in ms (default 100)\n\
+    -h            this help message\n\
+";
+
+static int conns=64, workers=4, sends=50000, stalled=1, permille=1;
+static int timeout_ms=100;
+static int fds[MAX_CONNS];		/* "tcp main" and sink side */
+static struct wqueue *queues;	/* shm, one per connection */
+static struct stats *st;		/* shm */
+
+static inline void spin_lock(volatile int *l)
+{
+	while(__atomic_test_and_set(l, __ATOMIC_ACQUIRE)) sched_yield();
+}
+
+static inline void spin_unlock(volatile int *l)
+{
+	__atomic_clear(l, __ATOMIC_RELEASE);
+}
+
+static inline long now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1000000000L+t.tv_nsec;
+}
+
+static int send_fd(int unix_sock, int id, int fd)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	char cbuf[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr *cmsg;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base=&id; iov.iov_len=sizeof(id);
+	msg.msg_iov=&iov; msg.msg_iovlen=1;
+	msg.msg_control=cbuf; msg.msg_controllen=sizeof(cbuf);
+	cmsg=CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level=SOL_SOCKET;
+	cmsg->cmsg_type=SCM_RIGHTS;
+	cmsg->cmsg_len=CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	return sendmsg(unix_sock, &msg, 0);
+}
+
+static int receive_fd(int unix_sock)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	char cbuf[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr *cmsg;
+	int id, fd;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base=&id; iov.iov_len=sizeof(id);
+	msg.msg_iov=&iov; msg.msg_iovlen=1;
+	msg.msg_control=cbuf; msg.msg_controllen=sizeof(cbuf);
+	if (recvmsg(unix_sock, &msg, MSG_WAITALL)<=0) return -1;
+	cmsg=CMSG_FIRSTHDR(&msg);
+	if (!cmsg) return -1;
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	return fd;
+}
+
+/* the peers: read and discard everything, except on the stalled conns */
+static void sink(int *peer)
+{
+	struct epoll_event ev, evs[64];
+	char buf[65536];
+	int ep, i, n;
+
+	ep=epoll_create(MAX_CONNS);
+	for (i=stalled; i<conns; i++){
+		ev.events=EPOLLIN;
+		ev.data.fd=peer[i];
+		epoll_ctl(ep, EPOLL_CTL_ADD, peer[i], &ev);
+	}
+	while(!st->stop){
+		n=epoll_wait(ep, evs, 64, 100);
+		for (i=0; i<n; i++)
+			while(read(evs[i].data.fd, buf, sizeof(buf))==sizeof(buf));
+	}
+	_exit(0);
+}
+
+/* "tcp main": answers the fd requests and flushes the write queues */
+static void tcp_main(int *unix_socks)
+{
+	struct epoll_event ev, evs[64];
+	struct wqueue *q;
+	int ep, i, n, k, cmd[2];
+
+	ep=epoll_create(MAX_CONNS);
+	for (i=0; i<workers; i++){
+		ev.events=EPOLLIN;
+		ev.data.u32=MAX_CONNS+i;
+		epoll_ctl(ep, EPOLL_CTL_ADD, unix_socks[i], &ev);
+	}
+	for (i=0; i<conns; i++){
+		ev.events=0;
+		ev.data.u32=i;
+		epoll_ctl(ep, EPOLL_CTL_ADD, fds[i], &ev);
+	}
+	while(!st->stop){
+		n=epoll_wait(ep, evs, 64, 100);
+		for (i=0; i<n; i++){
+			if (evs[i].data.u32>=MAX_CONNS){
+				k=unix_socks[evs[i].data.u32-MAX_CONNS];
+				if (read(k, cmd, sizeof(cmd))!=sizeof(cmd)) continue;
+				if (cmd[0]==CMD_GET_FD){
+					send_fd(k, cmd[1], fds[cmd[1]]);
+				}else{
+					ev.events=EPOLLOUT;
+					ev.data.u32=cmd[1];
+					epoll_ctl(ep, EPOLL_CTL_MOD, fds[cmd[1]], &ev);
+				}
+				continue;
+			}
+			/* writeable */
+			q=queues+evs[i].data.u32;
+			spin_lock(&q->lock);
+			while(q->off<q->len){
+				k=send(fds[evs[i].data.u32], q->buf+q->off, q->len-q->off,
+						MSG_NOSIGNAL|MSG_DONTWAIT);
+				if (k<=0) break;
+				q->off+=k;
+			}
+			if (q->off==q->len){
+				q->off=q->len=0;
+				ev.events=0;
+				ev.data.u32=evs[i].data.u32;
+				epoll_ctl(ep, EPOLL_CTL_MOD, fds[evs[i].data.u32], &ev);
+			}
+			spin_unlock(&q->lock);
+		}
+	}
+	_exit(0);
+}
+
+static int get_fd(int unix_sock, int c)
+{
+	int cmd[2]={CMD_GET_FD, c};
+	__atomic_add_fetch(&st->fd_requests, 1, __ATOMIC_RELAXED);
+	if (write(unix_sock, cmd, sizeof(cmd))!=sizeof(cmd)) return -1;
+	return receive_fd(unix_sock);
+}
+
+/* tsend_stream(): blocking write with a timeout on a non-blocking fd */
+static int send_block(int fd, char *buf, int len)
+{
+	struct pollfd pf;
+	long end;
+	int n, w=0, to;
+
+	end=now_ns()+timeout_ms*1000000L;
+	pf.fd=fd; pf.events=POLLOUT;
+	while(w<len){
+		n=send(fd, buf+w, len-w, MSG_NOSIGNAL|MSG_DONTWAIT);
+		if (n>0){ w+=n; continue; }
+		if (n<0 && errno!=EAGAIN && errno!=EINTR) return -1;
+		to=(end-now_ns())/1000000;
+		if (to<=0 || poll(&pf, 1, to)<=0) return -1;
+	}
+	return w;
+}
+
+/* wbufq_add() + tcp_nonblock_write() */
+static int send_queue(int fd, struct wqueue *q, char *buf, int len, int *notify)
+{
+	int n=0;
+
+	spin_lock(&q->lock);
+	if (q->off==q->len){
+		n=send(fd, buf, len, MSG_NOSIGNAL|MSG_DONTWAIT);
+		if (n<0){
+			if (errno!=EAGAIN){ spin_unlock(&q->lock); return -1; }
+			n=0;
+		}
+		if (n==len){ spin_unlock(&q->lock); return len; }
+		*notify=1;
+	}
+	if (q->len+len-n>QUEUE_MAX){
+		if (q->len-q->off+len-n>QUEUE_MAX){ spin_unlock(&q->lock); return -1; }
+		memmove(q->buf, q->buf+q->off, q->len-q->off);
+		q->len-=q->off;
+		q->off=0;
+	}
+	memcpy(q->buf+q->len, buf+n, len-n);
+	q->len+=len-n;
+	spin_unlock(&q->lock);
+	return len;
+}
+
+static void worker(int id, int unix_sock, int queued)
+{
+	unsigned int *hist=st->hist+(long)id*HIST_US;
+	unsigned int seed=id*7919+1;
+	int cache[MAX_CONNS];
+	char msg[MSG_LEN];
+	int i, c, fd, n, notify, cmd[2];
+	long t, us;
+
+	memset(msg, 'x', sizeof(msg));
+	for (i=0; i<conns; i++) cache[i]=-1;
+	for (i=0; i<sends; i++){
+		if (stalled && (int)(rand_r(&seed)%1000)<permille)
+			c=rand_r(&seed)%stalled;
+		else
+			c=stalled+rand_r(&seed)%(conns-stalled);
+		t=now_ns();
+		if (!queued){
+			fd=get_fd(unix_sock, c);
+			n=send_block(fd, msg, MSG_LEN);
+			close(fd);
+		}else{
+			if (cache[c]==-1) cache[c]=get_fd(unix_sock, c);
+			notify=0;
+			n=send_queue(cache[c], queues+c, msg, MSG_LEN, &notify);
+			if (notify){
+				cmd[0]=CMD_QUEUED_WRITE; cmd[1]=c;
+				if (write(unix_sock, cmd, sizeof(cmd))!=sizeof(cmd)) n=-1;
+			}
+		}
+		us=(now_ns()-t)/1000;
+		hist[us<HIST_US?us:HIST_US-1]++;
+		if (n<0) __atomic_add_fetch(&st->failed, 1, __ATOMIC_RELAXED);
+	}
+	_exit(0);
+}
+
+static void run(int queued, char *name)
+{
+	int sp[2], unix_socks[64], peer[MAX_CONNS];
+	struct sockaddr_in addr;
+	socklen_t alen=sizeof(addr);
+	long t, total=0, cnt, p50=0, p99=0, p999=0, max=0;
+	pid_t sink_pid, main_pid;
+	int lsock, i, j, status, one=1, small=16384;
+	unsigned int *sum;
+
+	memset(st, 0, sizeof(struct stats)+(long)workers*HIST_US*sizeof(unsigned int));
+	memset(queues, 0, (long)conns*sizeof(struct wqueue));
+
+	lsock=socket(AF_INET, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family=AF_INET;
+	addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+	if (bind(lsock, (struct sockaddr*)&addr, sizeof(addr))<0 ||
+			listen(lsock, MAX_CONNS)<0){ perror("listen"); exit(1); }
+	getsockname(lsock, (struct sockaddr*)&addr, &alen);
+	for (i=0; i<conns; i++){
+		fds[i]=socket(AF_INET, SOCK_STREAM, 0);
+		if (i<stalled)
+			setsockopt(fds[i], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+		if (connect(fds[i], (struct sockaddr*)&addr, sizeof(addr))<0){
+			perror("connect"); exit(1);
+		}
+		setsockopt(fds[i], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL)|O_NONBLOCK);
+		peer[i]=accept(lsock, 0, 0);
+		if (i<stalled)
+			setsockopt(peer[i], SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+	}
+	close(lsock);
+
+	fflush(stdout);
+	if ((sink_pid=fork())==0) sink(peer);
+	for (i=0; i<workers; i++){
+		socketpair(AF_UNIX, SOCK_STREAM, 0, sp);
+		unix_socks[i]=sp[0];
+		if (fork()==0){
+			close(sp[0]);
+			for (j=0; j<conns; j++){ close(fds[j]); close(peer[j]); }
+			worker(i, sp[1], queued);
+		}
+		close(sp[1]);
+	}
+	if ((main_pid=fork())==0) tcp_main(unix_socks);
+
+	t=now_ns();
+	for (i=0; i<workers; i++) wait(&status);
+	t=now_ns()-t;
+	st->stop=1;
+	waitpid(main_pid, &status, 0);
+	waitpid(sink_pid, &status, 0);
+	for (i=0; i<workers; i++) close(unix_socks[i]);
+	for (i=0; i<conns; i++){ close(fds[i]); close(peer[i]); }
+
+	sum=calloc(HIST_US, sizeof(unsigned int));
+	for (i=0; i<workers; i++)
+		for (j=0; j<HIST_US; j++){
+			sum[j]+=st->hist[(long)i*HIST_US+j];
+			total+=st->hist[(long)i*HIST_US+j];
+		}
+	for (cnt=0, j=0; j<HIST_US; j++){
+		if (!sum[j]) continue;
+		cnt+=sum[j];
+		if (!p50 && cnt>=total*0.5) p50=j+1;
+		if (!p99 && cnt>=total*0.99) p99=j+1;
+		if (!p999 && cnt>=total*0.999) p999=j+1;
+		max=j+1;
+	}
+	free(sum);
+	printf(" %-5s %7.0f ms | %8.0f sends/s | latency p50 %4ld us p99 %6ld us"
+		" p99.9 %6ld us max %7ld us | %ld failed, %ld fd requests\n",
+		name, t/1000000.0, total/(t/1000000000.0), p50, p99, p999, max,
+		st->failed, st->fd_requests);
+}
+
+int main(int argc, char** argv)
+{
+	char c;
+
+	while((c=getopt(argc, argv, "c:w:n:s:p:t:h"))!=-1){
+		switch(c){
+			case 'c': conns=atoi(optarg); break;
+			case 'w': workers=atoi(optarg); break;
+			case 'n': sends=atoi(optarg); break;
+			case 's': stalled=atoi(optarg); break;
+			case 'p': permille=atoi(optarg); break;
+			case 't': timeout_ms=atoi(optarg); break;
+			default:
+				printf("%s", help_msg);
+				return c=='h'?0:1;
+		}
+	}
+	if (conns<1 || conns>MAX_CONNS || workers<1 || workers>64 || sends<1 ||
+			stalled<0 || stalled>=conns || permille<0 || timeout_ms<1){
+		printf("%s", help_msg);
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	queues=mmap(0, (long)conns*sizeof(struct wqueue), PROT_READ|PROT_WRITE,
+				MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	st=mmap(0, sizeof(struct stats)+(long)workers*HIST_US*sizeof(unsigned int),
+				PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (queues==MAP_FAILED || st==MAP_FAILED){ perror("mmap"); return 1; }
+
+	printf("%d workers x %d sends of %d bytes on %d connections, %d stalled"
+		" (%d permille of the sends), %d ms send timeout\n",
+		workers, sends, MSG_LEN, conns, stalled, permille, timeout_ms);
+	run(0, "block");
+	run(1, "queue");
+	return 0;
+}
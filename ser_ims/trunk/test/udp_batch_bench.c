@@ -0,0 +1,171 @@
+/*
+ * $Id$
+ *
+ *  UDP batched receive micro-benchmark
+ *
+ *  Receives datagrams as the ser udp receivers do, either with one
+ *  recvfrom() per datagram or with recvmmsg() batches (see udp_rcv_batch),
+ *  and reports the packets per second and the syscalls made.
+ *  The traffic is generated with udp_flood, e.g.:
+ *
+ *      ./udp_batch_bench -p 5070 -c 500000 -b 1  &
+ *      ./udp_flood -f invite00.sip -d 127.0.0.1 -p 5070 -c 500000
+ *      ./udp_batch_bench -p 5070 -c 500000 -b 16 &
+ *      ./udp_flood -f invite00.sip -d 127.0.0.1 -p 5070 -c 500000
+ *
+ *  Compile with: gcc -O2 udp_batch_bench.c -o udp_batch_bench
+ *
+ *  The receiver stops after count packets or after 1s without traffic
+ *  (packets dropped by the kernel are not received). With a single
+ *  udp_flood the receiver is usually faster than the sender - use -w to
+ *  queue the flood first and measure only the receive side.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#define BUF_SIZE	65535
+#define MAX_BATCH	64
+
+static char* help_msg="\
+Usage: udp_batch_bench -p port [-c count] [-b batch] [-r rcvbuf]\n\
+Options:\n\
+    -p port       port to listen on (udp, all addresses)\n\
+    -c count      number of packets to receive (default 100000)\n\
+    -b batch      datagrams per recvmmsg(), 1 uses recvfrom() (default 1)\n\
+    -r rcvbuf     socket receive buffer size (default 4MB)\n\
+    -w sec        wait sec seconds before reading, so that the flood is\n\
+                  queued in the receive buffer and the drain rate is measured\n\
+    -h            this help message\n\
+";
+
+/* what ser does with each datagram before parsing it */
+static unsigned long touch(char* buf, int len)
+{
+	buf[len]=0;
+	return (unsigned char)buf[0]+len;
+}
+
+int main(int argc, char** argv)
+{
+	struct sockaddr_in addr;
+	struct sockaddr_in from[MAX_BATCH];
+	struct mmsghdr hdr[MAX_BATCH];
+	struct iovec iov[MAX_BATCH];
+	struct timeval tv, start, end;
+	socklen_t fromlen;
+	char* bufs[MAX_BATCH];
+	int sock, port, count, batch, rcvbuf, wait;
+	int received, calls, n, i;
+	unsigned long sum;
+	double t;
+	char c;
+
+	port=0;
+	count=100000;
+	batch=1;
+	rcvbuf=4*1024*1024;
+	wait=0;
+	while((c=getopt(argc, argv, "p:c:b:r:w:h"))!=-1){
+		switch(c){
+			case 'p': port=atoi(optarg); break;
+			case 'c': count=atoi(optarg); break;
+			case 'b': batch=atoi(optarg); break;
+			case 'r': rcvbuf=atoi(optarg); break;
+			case 'w': wait=atoi(optarg); break;
+			default:
+				printf("%s", help_msg);
+				return c=='h'?0:1;
+		}
+	}
+	if (port<=0 || count<=0 || batch<1 || batch>MAX_BATCH){
+		printf("%s", help_msg);
+		return 1;
+	}
+
+	sock=socket(PF_INET, SOCK_DGRAM, 0);
+	if (sock==-1){ perror("socket"); return 1; }
+#ifdef SO_RCVBUFFORCE
+	/* go over rmem_max if allowed to */
+	if (setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf))<0)
+#endif
+		setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family=AF_INET;
+	addr.sin_port=htons(port);
+	addr.sin_addr.s_addr=htonl(INADDR_ANY);
+	if (bind(sock, (struct sockaddr*)&addr, sizeof(addr))==-1){
+		perror("bind"); return 1;
+	}
+	for (i=0; i<batch; i++){
+		bufs[i]=malloc(BUF_SIZE+1);
+		if (!bufs[i]){ perror("malloc"); return 1; }
+	}
+
+	if (wait) sleep(wait);
+	/* wait for the first packet, then time the rest */
+	received=calls=0;
+	sum=0;
+	fromlen=sizeof(from[0]);
+	n=recvfrom(sock, bufs[0], BUF_SIZE, 0, (struct sockaddr*)&from[0],
+				&fromlen);
+	if (n<0){ perror("recvfrom"); return 1; }
+	received++;
+	gettimeofday(&start, 0);
+	tv.tv_sec=1;
+	tv.tv_usec=0;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	end=start;
+
+	while(received<count){
+		if (batch==1){
+			fromlen=sizeof(from[0]);
+			n=recvfrom(sock, bufs[0], BUF_SIZE, 0,
+						(struct sockaddr*)&from[0], &fromlen);
+			if (n>=0){
+				sum+=touch(bufs[0], n);
+				n=1;
+			}
+		}else{
+			for (i=0; i<batch; i++){
+				iov[i].iov_base=bufs[i];
+				iov[i].iov_len=BUF_SIZE;
+				memset(&hdr[i], 0, sizeof(hdr[i]));
+				hdr[i].msg_hdr.msg_name=&from[i];
+				hdr[i].msg_hdr.msg_namelen=sizeof(from[i]);
+				hdr[i].msg_hdr.msg_iov=&iov[i];
+				hdr[i].msg_hdr.msg_iovlen=1;
+			}
+			n=recvmmsg(sock, hdr, batch, MSG_WAITFORONE, 0);
+			for (i=0; i<n; i++)
+				sum+=touch(bufs[i], hdr[i].msg_len);
+		}
+		if (n<0){
+			if (errno==EAGAIN || errno==EWOULDBLOCK) break; /* idle */
+			if (errno==EINTR) continue;
+			perror("receive");
+			return 1;
+		}
+		calls++;
+		received+=n;
+		gettimeofday(&end, 0);
+	}
+
+	t=(end.tv_sec-start.tv_sec)*1000000.0+(end.tv_usec-start.tv_usec);
+	printf("%s, batch %d: %d packets in %d calls (%.2f per call)\n",
+		batch==1?"recvfrom":"recvmmsg", batch, received, calls+1,
+		(double)received/(calls+1));
+	if (t>0)
+		printf(" %10.0f us, %10.0f packets/s (checksum %lu)\n",
+			t, (received-1)/t*1000000.0, sum);
+	close(sock);
+	return 0;
+}
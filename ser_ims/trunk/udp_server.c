@@ -41,6 +41,9 @@
  */
 
 
+#ifdef __linux__
+	#define _GNU_SOURCE /* recvmmsg() & sendmmsg() */
+#endif
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
@@ -49,6 +52,7 @@
 #include <netinet/in_systm.h>
 #include <netinet/ip.h>
 #include <errno.h>
+#include <unistd.h>
 #include <arpa/inet.h>
 #ifdef __linux__
 	#include <linux/types.h>
@@ -63,6 +67,11 @@
 #include "receive.h"
 #include "mem/mem.h"
 #include "ip_addr.h"
+#include "pt.h"
+
+#if defined(__linux__) && defined(MSG_WAITFORONE) && !defined(NO_MMSG)
+	#define USE_MMSG
+#endif
 
 #ifdef USE_STUN
   #include "ser_stun.h"
@@ -302,6 +311,15 @@ int udp_init(struct socket_info* sock_info)
 		LOG(L_ERR, "ERROR: udp_init: setsockopt: %s\n", strerror(errno));
 		goto error;
 	}
+#ifdef SO_REUSEPORT
+	/* one socket per receiver, the kernel spreads the flows between them */
+	if ((sock_info->flags & SI_REUSEPORT) && setsockopt(sock_info->socket,
+				SOL_SOCKET, SO_REUSEPORT, (void*)&optval, sizeof(optval))==-1){
+		LOG(L_ERR, "ERROR: udp_init: setsockopt(SO_REUSEPORT): %s\n",
+				strerror(errno));
+		goto error;
+	}
+#endif
 	/* tos */
 	optval = tos;
 	if (setsockopt(sock_info->socket, IPPROTO_IP, IP_TOS, (void*)&optval, 
@@ -390,6 +408,208 @@ error:
 
 
 
+/* opens the SO_REUSEPORT sockets of the receiver children of an udp
+ * listen socket (udp_reuseport): child 0 uses sock_info->socket, each other
+ * child gets its own socket bound on the same address
+ * must be called from the main process, after udp_init(sock_info) and before
+ * dropping the privileges (all the sockets of a SO_REUSEPORT group must
+ * belong to the same user)
+ * returns 0 on success, -1 on error */
+int udp_init_reuseport(struct socket_info* sock_info, int children)
+{
+	struct socket_info si;
+	int i;
+
+	if (!(sock_info->flags & SI_REUSEPORT) || children<1) return 0;
+	sock_info->child_sockets=(int*)pkg_malloc(children*sizeof(int));
+	if (sock_info->child_sockets==0){
+		LOG(L_ERR, "ERROR: udp_init_reuseport: out of memory\n");
+		return -1;
+	}
+	sock_info->child_sockets[0]=sock_info->socket;
+	for (i=1; i<children; i++){
+		si=*sock_info;
+		if (udp_init(&si)==-1){
+			LOG(L_ERR, "ERROR: udp_init_reuseport: could not open socket %d"
+					" on %s:%s\n", i, sock_info->address_str.s,
+					sock_info->port_no_str.s);
+			for (i--; i>0; i--)
+				close(sock_info->child_sockets[i]);
+			pkg_free(sock_info->child_sockets);
+			sock_info->child_sockets=0;
+			return -1;
+		}
+		sock_info->child_sockets[i]=si.socket;
+	}
+	return 0;
+}
+
+
+
+/* checks a received datagram and passes it to receive_msg()
+ * (fills the source in ri first)
+ * returns 1 if the buffer was passed on (and freed, with DYN_BUF), 0 if
+ *  the datagram was dropped */
+static int udp_rcv_msg(char* buf, unsigned len, union sockaddr_union* from,
+						struct receive_info* ri)
+{
+	char *tmp;
+
+	/* we must 0-term the messages, receive_msg expects it */
+	buf[len]=0; /* no need to save the previous char */
+
+	ri->src_su=*from;
+	su2ip_addr(&ri->src_ip, from);
+	ri->src_port=su_getport(from);
+
+#ifndef NO_ZERO_CHECKS
+#ifdef USE_STUN
+	/* STUN support can be switched off even if it's compiled */
+	if (stun_allow_stun == 0 || (unsigned char)*buf != 0x00) {
+#endif
+	  if (len<MIN_UDP_PACKET) {
+		  tmp=ip_addr2a(&ri->src_ip);
+		  DBG("udp_rcv_loop: probing packet received from %s %d\n",
+			  	tmp, htons(ri->src_port));
+		  return 0;
+	  }
+#ifdef USE_STUN
+	}
+#endif
+#ifndef USE_STUN
+	if (buf[len-1]==0) {
+		tmp=ip_addr2a(&ri->src_ip);
+		LOG(L_WARN, "WARNING: udp_rcv_loop: "
+				"upstream bug - 0-terminated packet from %s %d\n",
+				tmp, htons(ri->src_port));
+		LOG(L_WARN, "WARNING: this fix was disabled as it was modifying correct messages <dvi>.\n");
+		//len--;
+	}
+#endif
+#endif
+#ifdef DBG_MSG_QA
+	if (!dbg_msg_qa(buf, len)) {
+		LOG(L_WARN, "WARNING: an incoming message didn't pass test,"
+					"  drop it: %.*s\n", len, buf );
+		return 0;
+	}
+#endif
+	if (ri->src_port==0){
+		tmp=ip_addr2a(&ri->src_ip);
+		LOG(L_INFO, "udp_rcv_loop: dropping 0 port packet from %s\n", tmp);
+		return 0;
+	}
+	
+#ifdef USE_STUN
+		/* STUN support can be switched off even if it's compiled */
+		if (stun_allow_stun && (unsigned char)*buf == 0x00) {
+		    /* stun_process_msg releases buf memory if necessary */
+			stun_process_msg(buf, len, ri);
+			return 1;
+		}
+#endif
+	/* receive_msg must free buf too!*/
+	receive_msg(buf, len, ri);
+	return 1;
+}
+
+
+
+#ifdef USE_MMSG
+/* receive loop reading up to udp_rcv_batch datagrams with each recvmmsg()
+ * call and processing them all before the next call */
+static int udp_rcv_mmsg_loop(struct socket_info* si)
+{
+	struct mmsghdr* hdr;
+	struct iovec* iov;
+	union sockaddr_union* from;
+	char** bufs;
+	struct receive_info ri;
+	int n, i, b;
+
+	b=udp_rcv_batch;
+	hdr=(struct mmsghdr*)pkg_malloc(b*(sizeof(struct mmsghdr)+
+				sizeof(struct iovec)+sizeof(union sockaddr_union)+sizeof(char*)));
+	if (hdr==0){
+		LOG(L_ERR, "ERROR: udp_rcv_mmsg_loop: out of memory\n");
+		return -1;
+	}
+	iov=(struct iovec*)(hdr+b);
+	from=(union sockaddr_union*)(iov+b);
+	bufs=(char**)(from+b);
+	memset(hdr, 0, b*(sizeof(struct mmsghdr)+sizeof(struct iovec)+
+				sizeof(union sockaddr_union)+sizeof(char*)));
+#ifndef DYN_BUF
+	/* the buffers are reused for each batch */
+	for (i=0; i<b; i++){
+		bufs[i]=pkg_malloc(BUF_SIZE+1);
+		if (bufs[i]==0){
+			LOG(L_ERR, "ERROR: udp_rcv_mmsg_loop: could not allocate %d"
+					" receive buffers\n", b);
+			goto error;
+		}
+	}
+#endif
+	ri.bind_address=si; /* this will not change, we do it only once*/
+	ri.dst_port=si->port_no;
+	ri.dst_ip=si->address;
+	ri.proto=PROTO_UDP;
+	ri.proto_reserved1=ri.proto_reserved2=0;
+	for(;;){
+		for (i=0; i<b; i++){
+#ifdef DYN_BUF
+			/* receive_msg() frees the buffers passed to it */
+			if (bufs[i]==0){
+				bufs[i]=pkg_malloc(BUF_SIZE+1);
+				if (bufs[i]==0){
+					LOG(L_ERR, "ERROR: udp_rcv_mmsg_loop: could not allocate"
+							" receive buffer\n");
+					goto error;
+				}
+			}
+#endif
+			iov[i].iov_base=bufs[i];
+			iov[i].iov_len=BUF_SIZE;
+			hdr[i].msg_hdr.msg_name=&from[i].s;
+			hdr[i].msg_hdr.msg_namelen=sockaddru_len(si->su);
+			hdr[i].msg_hdr.msg_iov=&iov[i];
+			hdr[i].msg_hdr.msg_iovlen=1;
+		}
+		/* blocks for the first datagram only, then takes what is queued */
+		n=recvmmsg(si->socket, hdr, b, MSG_WAITFORONE, 0);
+		if (n==-1){
+			if (errno==EAGAIN){
+				DBG("udp_rcv_loop: packet with bad checksum received\n");
+				continue;
+			}
+			LOG(L_ERR, "ERROR: udp_rcv_loop:recvmmsg:[%d] %s\n",
+						errno, strerror(errno));
+			if ((errno==EINTR)||(errno==EWOULDBLOCK)|| (errno==ECONNREFUSED))
+				continue;
+			else goto error;
+		}
+		if (n<=0) continue;
+		pt[process_no].udp_rcv_calls++;
+		pt[process_no].udp_rcv_msgs+=n;
+		for (i=0; i<n; i++){
+#ifdef DYN_BUF
+			if (udp_rcv_msg(bufs[i], hdr[i].msg_len, &from[i], &ri))
+				bufs[i]=0;
+#else
+			udp_rcv_msg(bufs[i], hdr[i].msg_len, &from[i], &ri);
+#endif
+		}
+	}
+error:
+	for (i=0; i<b; i++)
+		if (bufs[i]) pkg_free(bufs[i]);
+	pkg_free(hdr);
+	return -1;
+}
+#endif /* USE_MMSG */
+
+
+
 int udp_rcv_loop()
 {
 	unsigned len;
@@ -398,11 +618,18 @@ int udp_rcv_loop()
 #else
 	static char buf [BUF_SIZE+1];
 #endif
-	char *tmp;
 	union sockaddr_union* from;
 	unsigned int fromlen;
 	struct receive_info ri;
 
+#ifdef USE_MMSG
+	if (udp_rcv_batch>1)
+		return udp_rcv_mmsg_loop(bind_address);
+#else
+	if (udp_rcv_batch>1)
+		LOG(L_WARN, "WARNING: udp_rcv_loop: recvmmsg() not available,"
+				" ignoring udp_rcv_batch\n");
+#endif
 
 	from=(union sockaddr_union*) pkg_malloc(sizeof(union sockaddr_union));
 	if (from==0){
@@ -438,62 +665,9 @@ int udp_rcv_loop()
 				continue; /* goto skip;*/
 			else goto error;
 		}
-		/* we must 0-term the messages, receive_msg expects it */
-		buf[len]=0; /* no need to save the previous char */
-
-		ri.src_su=*from;
-		su2ip_addr(&ri.src_ip, from);
-		ri.src_port=su_getport(from);
-
-#ifndef NO_ZERO_CHECKS
-#ifdef USE_STUN
-		/* STUN support can be switched off even if it's compiled */
-		if (stun_allow_stun == 0 || (unsigned char)*buf != 0x00) {
-#endif
-		  if (len<MIN_UDP_PACKET) {
-			  tmp=ip_addr2a(&ri.src_ip);
-			  DBG("udp_rcv_loop: probing packet received from %s %d\n",
-				  	tmp, htons(ri.src_port));
-			  continue;
-		  }
-#ifdef USE_STUN
-		}
-#endif
-#ifndef USE_STUN
-		if (buf[len-1]==0) {
-			tmp=ip_addr2a(&ri.src_ip);
-			LOG(L_WARN, "WARNING: udp_rcv_loop: "
-					"upstream bug - 0-terminated packet from %s %d\n",
-					tmp, htons(ri.src_port));
-			LOG(L_WARN, "WARNING: this fix was disabled as it was modifying correct messages <dvi>.\n");
-			//len--;
-		}
-#endif
-#endif
-#ifdef DBG_MSG_QA
-		if (!dbg_msg_qa(buf, len)) {
-			LOG(L_WARN, "WARNING: an incoming message didn't pass test,"
-						"  drop it: %.*s\n", len, buf );
-			continue;
-		}
-#endif
-		if (ri.src_port==0){
-			tmp=ip_addr2a(&ri.src_ip);
-			LOG(L_INFO, "udp_rcv_loop: dropping 0 port packet from %s\n", tmp);
-			continue;
-		}
-		
-#ifdef USE_STUN
-			/* STUN support can be switched off even if it's compiled */
-			if (stun_allow_stun && (unsigned char)*buf == 0x00) {
-			    /* stun_process_msg releases buf memory if necessary */
-				if ((stun_process_msg(buf, len, &ri)) != 0) {
-					continue; /* some error occurred */
-				}
-			} else
-#endif
-		/* receive_msg must free buf too!*/
-		receive_msg(buf, len, &ri);
+		pt[process_no].udp_rcv_calls++;
+		pt[process_no].udp_rcv_msgs++;
+		udp_rcv_msg(buf, len, from, &ri);
 		
 	/* skip: do other stuff */
 		
@@ -523,12 +697,13 @@ unsigned len;
 #else
 	static char buf [BUF_SIZE+1];
 #endif
-	char *tmp;
 	union sockaddr_union* from;
 	unsigned int fromlen;
 	struct receive_info ri;
 
-
+	/* no recvmmsg() batches here (udp_rcv_batch): this runs in a thread of
+	 * a worker process (IPsec protected ports) and the batch buffers would
+	 * come from the (not thread safe) pkg mem */
 	from=(union sockaddr_union*) pkg_malloc(sizeof(union sockaddr_union));
 	if (from==0){
 		LOG(L_ERR, "ERROR: udp_rcv_loop: out of memory\n");
@@ -576,73 +751,9 @@ unsigned len;
 				continue; /* goto skip;*/
 			else goto error;
 		}
-		/* we must 0-term the messages, receive_msg expects it */
-		buf[len]=0; /* no need to save the previous char */
-
-		ri.src_su=*from;
-		su2ip_addr(&ri.src_ip, from);
-		ri.src_port=su_getport(from);
-
-
-
-
-
-#ifndef NO_ZERO_CHECKS
-#ifdef USE_STUN
-		/* STUN support can be switched off even if it's compiled */
-		if (stun_allow_stun == 0 || (unsigned char)*buf != 0x00) {
-#endif
-		  if (len<MIN_UDP_PACKET) {
-			  tmp=ip_addr2a(&ri.src_ip);
-			  DBG("udp_rcv_loop: probing packet received from %s %d\n",
-				  	tmp, htons(ri.src_port));
-			  continue;
-		  }
-#ifdef USE_STUN
-		}
-#endif
-#ifndef USE_STUN
-		if (buf[len-1]==0) {
-			tmp=ip_addr2a(&ri.src_ip);
-			LOG(L_WARN, "WARNING: udp_rcv_loop: "
-					"upstream bug - 0-terminated packet from %s %d\n",
-					tmp, htons(ri.src_port));
-			LOG(L_WARN, "WARNING: this fix was disabled as it was modifying correct messages <dvi>.\n");
-			//len--;
-		}
-#endif
-#endif
-#ifdef DBG_MSG_QA
-		if (!dbg_msg_qa(buf, len)) {
-			LOG(L_WARN, "WARNING: an incoming message didn't pass test,"
-						"  drop it: %.*s\n", len, buf );
-			continue;
-		}
-#endif
-		if (ri.src_port==0){
-			tmp=ip_addr2a(&ri.src_ip);
-			LOG(L_INFO, "udp_rcv_loop: dropping 0 port packet from %s\n", tmp);
-			continue;
-		}
-		
-#ifdef USE_STUN
-			/* STUN support can be switched off even if it's compiled */
-			if (stun_allow_stun && (unsigned char)*buf == 0x00) {
-			    /* stun_process_msg releases buf memory if necessary */
-				if ((stun_process_msg(buf, len, &ri)) != 0) {
-					continue; /* some error occurred */
-				}
-			} else
-#endif
-		/* receive_msg must free buf too!*/
-
-
-
-		receive_msg(buf, len, &ri);
-
-
-
-
+		pt[process_no].udp_rcv_calls++;
+		pt[process_no].udp_rcv_msgs++;
+		udp_rcv_msg(buf, len, from, &ri);
 		
 	/* skip: do other stuff */
 		
@@ -695,3 +806,71 @@ again:
 	}
 	return n;
 }
+
+
+
+/* sends several buffers over udp, each to its own destination (uses only the
+ * to and send_sock members of m[i].dst, which must be set)
+ * consecutive messages on the same socket go out with a single sendmmsg()
+ * m[i].ret is set to the number of bytes sent or to -1 on error
+ * returns the number of messages sent */
+int udp_send_batch(struct udp_batch_msg* m, int n)
+{
+	int i, sent;
+#ifdef USE_MMSG
+	struct mmsghdr hdr[UDP_SND_BATCH_MAX];
+	struct iovec iov[UDP_SND_BATCH_MAX];
+	int k, j, r;
+#endif
+
+	sent=0;
+#ifdef USE_MMSG
+	for (i=0; i<n; i+=k){
+		for (k=0; i+k<n && k<UDP_SND_BATCH_MAX &&
+				m[i+k].dst->send_sock==m[i].dst->send_sock; k++){
+#ifdef DBG_MSG_QA
+			/* aborts on error, does nothing otherwise */
+			if (!dbg_msg_qa( m[i+k].buf, m[i+k].len )) {
+				LOG(L_ERR, "ERROR: udp_send_batch: dbg_msg_qa failed\n");
+				abort();
+			}
+#endif
+			iov[k].iov_base=m[i+k].buf;
+			iov[k].iov_len=m[i+k].len;
+			memset(&hdr[k], 0, sizeof(struct mmsghdr));
+			hdr[k].msg_hdr.msg_name=&m[i+k].dst->to.s;
+			hdr[k].msg_hdr.msg_namelen=sockaddru_len(m[i+k].dst->to);
+			hdr[k].msg_hdr.msg_iov=&iov[k];
+			hdr[k].msg_hdr.msg_iovlen=1;
+		}
+		if (k==1){
+			m[i].ret=udp_send(m[i].dst, m[i].buf, m[i].len);
+			if (m[i].ret!=-1) sent++;
+			continue;
+		}
+again:
+		r=sendmmsg(m[i].dst->send_sock->socket, hdr, k, 0);
+		if (r==-1){
+			if (errno==EINTR) goto again;
+			r=0;
+		}
+		pt[process_no].udp_snd_calls++;
+		pt[process_no].udp_snd_msgs+=r;
+		for (j=0; j<r; j++)
+			m[i+j].ret=hdr[j].msg_len;
+		sent+=r;
+		/* sendmmsg() stops at the first datagram that fails - send it and
+		 * the rest one by one, so that errors are reported for each */
+		for (j=r; j<k; j++){
+			m[i+j].ret=udp_send(m[i+j].dst, m[i+j].buf, m[i+j].len);
+			if (m[i+j].ret!=-1) sent++;
+		}
+	}
+#else
+	for (i=0; i<n; i++){
+		m[i].ret=udp_send(m[i].dst, m[i].buf, m[i].len);
+		if (m[i].ret!=-1) sent++;
+	}
+#endif
+	return sent;
+}
@@ -37,8 +37,18 @@
 #define BUFFER_INCREMENT	2048
 
 
+/* one message of a udp_send_batch() */
+struct udp_batch_msg {
+	struct dest_info* dst;
+	char* buf;
+	unsigned len;
+	int ret; /* bytes sent or -1, filled by udp_send_batch() */
+};
+
 int udp_init(struct socket_info* si);
+int udp_init_reuseport(struct socket_info* si, int children);
 int udp_send(struct dest_info* dst, char *buf, unsigned len);
+int udp_send_batch(struct udp_batch_msg* m, int n);
 int udp_rcv_loop();
 int thread_rcv_loop(struct socket_info * bind_address);
 